@@ -2,6 +2,13 @@
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <intrin.h>
+
+#pragma comment(lib, "Synchronization.lib")
+
+// x86 and x64 never reorder loads with loads or stores with stores, so
+// acquire loads and release stores only need to stop the compiler reordering.
+// ARM64 needs the load-acquire and store-release instructions.
 
 int atomic_increment(int* address)
 {
@@ -18,12 +25,158 @@ int atomic_compare_and_exchange(int* dest, int compare, int exchange)
 	return InterlockedCompareExchange(dest, exchange, compare);
 }
 
+int atomic_fetch_add(int* address, int value)
+{
+	return InterlockedExchangeAdd(address, value);
+}
+
+int atomic_exchange(int* address, int value)
+{
+	return InterlockedExchange(address, value);
+}
+
 int atomic_load(int* address)
 {
-	return *(volatile int*)address;
+	return atomic_load_acquire(address);
 }
 
 void atomic_store(int* address, int value)
 {
-	*(volatile int*)address = value;
+	atomic_store_release(address, value);
+}
+
+int atomic_load_acquire(int* address)
+{
+#if defined(_M_ARM64)
+	return (int)__ldar32((unsigned int volatile*)address);
+#else
+	int value = __iso_volatile_load32(address);
+	_ReadWriteBarrier();
+	return value;
+#endif
+}
+
+int atomic_load_seq_cst(int* address)
+{
+	// Seq-cst stores carry the full barrier, so a seq-cst load is the same as an acquire load.
+	return atomic_load_acquire(address);
+}
+
+void atomic_store_release(int* address, int value)
+{
+#if defined(_M_ARM64)
+	__stlr32((unsigned int volatile*)address, (unsigned int)value);
+#else
+	_ReadWriteBarrier();
+	__iso_volatile_store32(address, value);
+#endif
+}
+
+void atomic_store_seq_cst(int* address, int value)
+{
+	InterlockedExchange(address, value);
+}
+
+int64_t atomic_increment64(int64_t* address)
+{
+	return InterlockedIncrement64(address) - 1;
+}
+
+int64_t atomic_decrement64(int64_t* address)
+{
+	return InterlockedDecrement64(address) + 1;
+}
+
+int64_t atomic_fetch_add64(int64_t* address, int64_t value)
+{
+	return InterlockedExchangeAdd64(address, value);
+}
+
+int64_t atomic_exchange64(int64_t* address, int64_t value)
+{
+	return InterlockedExchange64(address, value);
+}
+
+int64_t atomic_compare_and_exchange64(int64_t* dest, int64_t compare, int64_t exchange)
+{
+	return InterlockedCompareExchange64(dest, exchange, compare);
+}
+
+int64_t atomic_load64(int64_t* address)
+{
+#if defined(_M_ARM64)
+	return (int64_t)__ldar64((unsigned __int64 volatile*)address);
+#elif defined(_M_X64)
+	int64_t value = __iso_volatile_load64(address);
+	_ReadWriteBarrier();
+	return value;
+#else
+	// 32-bit x86 has no plain 64-bit load.
+	return InterlockedCompareExchange64(address, 0, 0);
+#endif
+}
+
+void atomic_store64(int64_t* address, int64_t value)
+{
+#if defined(_M_ARM64)
+	__stlr64((unsigned __int64 volatile*)address, (unsigned __int64)value);
+#elif defined(_M_X64)
+	_ReadWriteBarrier();
+	__iso_volatile_store64(address, value);
+#else
+	InterlockedExchange64(address, value);
+#endif
+}
+
+void* atomic_compare_and_exchange_ptr(void** dest, void* compare, void* exchange)
+{
+	return InterlockedCompareExchangePointer(dest, exchange, compare);
+}
+
+void* atomic_exchange_ptr(void** address, void* value)
+{
+	return InterlockedExchangePointer(address, value);
+}
+
+void* atomic_load_ptr(void** address)
+{
+#if defined(_WIN64)
+	return (void*)atomic_load64((int64_t*)address);
+#else
+	return (void*)(intptr_t)atomic_load_acquire((int*)address);
+#endif
+}
+
+void atomic_store_ptr(void** address, void* value)
+{
+#if defined(_WIN64)
+	atomic_store64((int64_t*)address, (int64_t)value);
+#else
+	atomic_store_release((int*)address, (int)(intptr_t)value);
+#endif
+}
+
+void atomic_thread_fence()
+{
+	MemoryBarrier();
+}
+
+void atomic_signal_fence()
+{
+	_ReadWriteBarrier();
+}
+
+void atomic_wait(int* address, int value)
+{
+	WaitOnAddress(address, &value, sizeof(value), INFINITE);
+}
+
+void atomic_wake_all(int* address)
+{
+	WakeByAddressAll(address);
+}
+
+void atomic_wake_one(int* address)
+{
+	WakeByAddressSingle(address);
 }
@@ -1,6 +1,9 @@
 #pragma once
 
-// Atomic operations on 32-bit integers.
+#include <stdint.h>
+
+// Atomic operations on 32-bit and 64-bit integers and pointers.
+// Unless noted otherwise, read-modify-write operations are full (sequentially consistent) barriers.
 
 // Increment a number atomically.
 // Returns the old value of the number.
@@ -20,10 +23,106 @@ int atomic_decrement(int* address);
 //   int old_value = *address; if (*address == compare) *address = exchange; return old_value;
 int atomic_compare_and_exchange(int* dest, int compare, int exchange);
 
+// Add to a number atomically.
+// Returns the old value of the number.
+// Performs the following operation atomically:
+//   int old_value = *address; *address += value; return old_value;
+int atomic_fetch_add(int* address, int value);
+
+// Assign a number atomically.
+// Returns the old value of the number.
+// Performs the following operation atomically:
+//   int old_value = *address; *address = value; return old_value;
+int atomic_exchange(int* address, int value);
+
 // Reads an integer from an address.
 // All writes that occurred before the last atomic_store to this address are flushed.
+// Same as atomic_load_acquire().
 int atomic_load(int* address);
 
 // Writes an integer.
 // Paired with an atomic_load, can guarantee ordering and visibility.
+// Same as atomic_store_release().
 void atomic_store(int* address, int value);
+
+// Reads an integer with acquire ordering.
+// Later reads and writes by this thread cannot move before the load.
+int atomic_load_acquire(int* address);
+
+// Reads an integer with sequentially consistent ordering.
+// Ordered with respect to every other sequentially consistent operation.
+int atomic_load_seq_cst(int* address);
+
+// Writes an integer with release ordering.
+// Earlier reads and writes by this thread cannot move after the store.
+void atomic_store_release(int* address, int value);
+
+// Writes an integer with sequentially consistent ordering.
+// Unlike a release store, a later load cannot move before it.
+void atomic_store_seq_cst(int* address, int value);
+
+// Increment a 64-bit number atomically.
+// Returns the old value of the number.
+int64_t atomic_increment64(int64_t* address);
+
+// Decrement a 64-bit number atomically.
+// Returns the old value of the number.
+int64_t atomic_decrement64(int64_t* address);
+
+// Add to a 64-bit number atomically.
+// Returns the old value of the number.
+int64_t atomic_fetch_add64(int64_t* address, int64_t value);
+
+// Assign a 64-bit number atomically.
+// Returns the old value of the number.
+int64_t atomic_exchange64(int64_t* address, int64_t value);
+
+// Compare two 64-bit numbers atomically and assign if equal.
+// Returns the old value of the number.
+// Performs the following operation atomically:
+//   int64_t old_value = *address; if (*address == compare) *address = exchange; return old_value;
+int64_t atomic_compare_and_exchange64(int64_t* dest, int64_t compare, int64_t exchange);
+
+// Reads a 64-bit integer from an address atomically.
+// Even on 32-bit targets the value is never torn.
+// Has acquire ordering.
+int64_t atomic_load64(int64_t* address);
+
+// Writes a 64-bit integer atomically.
+// Even on 32-bit targets the value is never torn.
+// Has release ordering.
+void atomic_store64(int64_t* address, int64_t value);
+
+// Compare two pointers atomically and assign if equal.
+// Returns the old value of the pointer.
+// Performs the following operation atomically:
+//   void* old_value = *address; if (*address == compare) *address = exchange; return old_value;
+void* atomic_compare_and_exchange_ptr(void** dest, void* compare, void* exchange);
+
+// Assign a pointer atomically.
+// Returns the old value of the pointer.
+void* atomic_exchange_ptr(void** address, void* value);
+
+// Reads a pointer with acquire ordering.
+void* atomic_load_ptr(void** address);
+
+// Writes a pointer with release ordering.
+void atomic_store_ptr(void** address, void* value);
+
+// Full memory barrier.
+// No read or write may move across it in either direction, including a store followed by a load.
+void atomic_thread_fence();
+
+// Compiler-only barrier.
+// Stops the compiler from reordering memory accesses across it; emits no instruction.
+void atomic_signal_fence();
+
+// Blocks the calling thread while the integer at address equals value.
+// May return spuriously, so callers must re-check their condition.
+void atomic_wait(int* address, int value);
+
+// Wakes all threads blocked in atomic_wait() on an address.
+void atomic_wake_all(int* address);
+
+// Wakes one thread blocked in atomic_wait() on an address.
+void atomic_wake_one(int* address);
@@ -0,0 +1,457 @@
+#include "bench.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "ecs.h"
+#include "fs.h"
+#include "heap.h"
+#include "job.h"
+#include "mat4f.h"
+#include "parallel.h"
+#include "queue.h"
+#include "thread.h"
+#include "timer.h"
+#include "trace.h"
+#include "transform.h"
+
+#include "lz4/lz4.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+	// Samples run and thrown away before measuring, while caches and branch predictors settle.
+	k_warmup_samples = 20,
+	// Samples measured per benchmark.
+	k_samples = 200,
+	// Most benchmarks in one run.
+	k_max_results = 16,
+
+	k_heap_batch = 64,
+	k_queue_producers = 3,
+	k_queue_capacity = 1024,
+	k_ecs_entities = 10000,
+	k_math_count = 256,
+	k_lz4_size = 64 * 1024,
+	k_trace_event_capacity = 64 * 1024,
+	k_parallel_items = 256 * 1024,
+};
+
+typedef struct bench_result_t
+{
+	const char* name;
+	int operations;
+	double min_ns;
+	double p50_ns;
+	double p90_ns;
+	double p99_ns;
+	double max_ns;
+} bench_result_t;
+
+typedef struct bench_t
+{
+	heap_t* heap;
+	bench_result_t results[k_max_results];
+	int result_count;
+} bench_t;
+
+// Runs operations of a benchmark.
+typedef void (*bench_func_t)(void* user, int operations);
+
+typedef struct heap_bench_t
+{
+	heap_t* heap;
+	void* allocations[k_heap_batch];
+} heap_bench_t;
+
+typedef struct queue_bench_t
+{
+	queue_t* queue;
+	int stop;
+} queue_bench_t;
+
+typedef struct ecs_bench_t
+{
+	ecs_t* ecs;
+	int transform_type;
+	float sum;
+} ecs_bench_t;
+
+typedef struct math_bench_t
+{
+	transform_t transforms[k_math_count];
+	mat4f_t a[k_math_count];
+	mat4f_t b[k_math_count];
+	mat4f_t results[k_math_count];
+} math_bench_t;
+
+typedef struct lz4_bench_t
+{
+	char* source;
+	char* compressed;
+	char* decompressed;
+	int compressed_capacity;
+} lz4_bench_t;
+
+typedef struct parallel_bench_t
+{
+	job_system_t* jobs;
+	uint64_t* source; //random keys, copied in before every sort
+	uint64_t* keys;
+	uint64_t* temp_keys;
+	uint32_t* values;
+	uint32_t* temp_values;
+	int* items;
+} parallel_bench_t;
+
+static void measure(bench_t* bench, const char* name, int operations, bench_func_t func, void* user);
+static int compare_doubles(const void* a, const void* b);
+static void heap_func(void* user, int operations);
+static void queue_pop_func(void* user, int operations);
+static int queue_producer_thread(void* user);
+static void ecs_query_func(void* user, int operations);
+static void ecs_chunk_query_func(void* user, int operations);
+static void mat4f_mul_func(void* user, int operations);
+static void transform_to_matrix_func(void* user, int operations);
+static void transform_to_matrix_batch_func(void* user, int operations);
+static void lz4_func(void* user, int operations);
+static void trace_func(void* user, int operations);
+static void parallel_for_func(void* user, int operations);
+static void parallel_for_items(void* data, int begin, int end);
+static void radix_sort32_func(void* user, int operations);
+static void radix_sort64_func(void* user, int operations);
+static void exclusive_scan_func(void* user, int operations);
+static int write_results(bench_t* bench, fs_t* fs, const char* path);
+
+int bench_run(heap_t* heap, fs_t* fs, const char* path)
+{
+	bench_t bench = { .heap = heap, .result_count = 0 };
+
+	//allocations come from a heap of their own, so the benchmark's own storage doesn't fragment it
+	heap_bench_t heap_bench = { .heap = heap_create(1024 * 1024) };
+	measure(&bench, "heap_alloc_free", k_heap_batch * 16, heap_func, &heap_bench);
+	heap_destroy(heap_bench.heap);
+
+	//the main thread pops while producers contend to push
+	queue_bench_t queue_bench = { .queue = queue_create(heap, k_queue_capacity), .stop = 0 };
+	thread_t* producers[k_queue_producers];
+	for (int i = 0; i < _countof(producers); ++i)
+	{
+		producers[i] = thread_create(queue_producer_thread, &queue_bench);
+	}
+	measure(&bench, "queue_push_pop_contended", 1024, queue_pop_func, &queue_bench);
+	atomic_store(&queue_bench.stop, 1);
+	for (int i = 0; i < _countof(producers); ++i)
+	{
+		thread_destroy(producers[i]);
+	}
+	queue_destroy(queue_bench.queue);
+
+	ecs_bench_t ecs_bench = { .ecs = ecs_create(heap) };
+	ecs_bench.transform_type = ecs_register_component_type(ecs_bench.ecs, "transform", sizeof(transform_t), _Alignof(transform_t));
+	for (int i = 0; i < k_ecs_entities; ++i)
+	{
+		ecs_entity_ref_t entity = ecs_entity_add(ecs_bench.ecs, ECS_MASK(ecs_bench.transform_type));
+		transform_t* transform = ecs_entity_get_component(ecs_bench.ecs, entity, ecs_bench.transform_type, true);
+		transform_identity(transform);
+		transform->translation.x = (float)i;
+	}
+	ecs_update(ecs_bench.ecs);
+	measure(&bench, "ecs_query_per_entity", k_ecs_entities, ecs_query_func, &ecs_bench);
+	measure(&bench, "ecs_chunk_query_per_entity", k_ecs_entities, ecs_chunk_query_func, &ecs_bench);
+	ecs_destroy(ecs_bench.ecs);
+
+	math_bench_t* math_bench = heap_alloc(heap, sizeof(math_bench_t), 16);
+	for (int i = 0; i < k_math_count; ++i)
+	{
+		transform_identity(&math_bench->transforms[i]);
+		math_bench->transforms[i].translation.x = (float)i;
+		math_bench->transforms[i].rotation = quatf_from_z_angle(i * 0.01f);
+		transform_to_matrix(&math_bench->transforms[i], &math_bench->a[i]);
+		mat4f_make_identity(&math_bench->b[i]);
+	}
+	measure(&bench, "mat4f_mul", k_math_count, mat4f_mul_func, math_bench);
+	measure(&bench, "transform_to_matrix", k_math_count, transform_to_matrix_func, math_bench);
+	measure(&bench, "transform_to_matrix_batch", k_math_count, transform_to_matrix_batch_func, math_bench);
+	heap_free(heap, math_bench);
+
+	//repetitive text compresses about as well as typical assets
+	lz4_bench_t lz4_bench;
+	lz4_bench.compressed_capacity = LZ4_compressBound(k_lz4_size);
+	lz4_bench.source = heap_alloc(heap, k_lz4_size, 8);
+	lz4_bench.compressed = heap_alloc(heap, lz4_bench.compressed_capacity, 8);
+	lz4_bench.decompressed = heap_alloc(heap, k_lz4_size, 8);
+	for (int i = 0; i < k_lz4_size; ++i)
+	{
+		lz4_bench.source[i] = "the quick brown fox jumps over the lazy dog "[(i * 7 + i / 64) % 44];
+	}
+	measure(&bench, "lz4_round_trip_64k", 1, lz4_func, &lz4_bench);
+	if (memcmp(lz4_bench.source, lz4_bench.decompressed, k_lz4_size) != 0)
+	{
+		debug_print(k_print_error, "LZ4 round trip does not match!\n");
+	}
+	heap_free(heap, lz4_bench.decompressed);
+	heap_free(heap, lz4_bench.compressed);
+	heap_free(heap, lz4_bench.source);
+
+	//idle is a zone's cost while no capture runs; capturing includes handing blocks to the writer
+	trace_t* trace = trace_create(heap, k_trace_event_capacity);
+	measure(&bench, "trace_duration_push_pop_idle", 1024, trace_func, trace);
+	trace_capture_start(trace, "bench.trace");
+	measure(&bench, "trace_duration_push_pop_capturing", 1024, trace_func, trace);
+	trace_capture_stop(trace);
+	trace_destroy(trace);
+
+	//each operation is an item; sorts include copying their keys in
+	parallel_bench_t parallel_bench = { .jobs = job_system_create(heap, 0) };
+	parallel_bench.source = heap_alloc(heap, sizeof(uint64_t) * k_parallel_items, 8);
+	parallel_bench.keys = heap_alloc(heap, sizeof(uint64_t) * k_parallel_items, 8);
+	parallel_bench.temp_keys = heap_alloc(heap, sizeof(uint64_t) * k_parallel_items, 8);
+	parallel_bench.values = heap_alloc(heap, sizeof(uint32_t) * k_parallel_items, 8);
+	parallel_bench.temp_values = heap_alloc(heap, sizeof(uint32_t) * k_parallel_items, 8);
+	parallel_bench.items = heap_alloc(heap, sizeof(int) * k_parallel_items, 8);
+	uint64_t seed = 1;
+	for (int i = 0; i < k_parallel_items; ++i)
+	{
+		seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+		parallel_bench.source[i] = seed;
+		parallel_bench.items[i] = (int)(seed >> 60);
+	}
+	measure(&bench, "parallel_for_per_item", k_parallel_items, parallel_for_func, &parallel_bench);
+	measure(&bench, "parallel_radix_sort32_per_key", k_parallel_items, radix_sort32_func, &parallel_bench);
+	measure(&bench, "parallel_radix_sort64_per_key", k_parallel_items, radix_sort64_func, &parallel_bench);
+	for (int i = 1; i < k_parallel_items; ++i)
+	{
+		if (parallel_bench.keys[i - 1] > parallel_bench.keys[i])
+		{
+			debug_print(k_print_error, "Parallel radix sort is out of order!\n");
+			break;
+		}
+	}
+	measure(&bench, "parallel_exclusive_scan_per_item", k_parallel_items, exclusive_scan_func, &parallel_bench);
+	heap_free(heap, parallel_bench.items);
+	heap_free(heap, parallel_bench.temp_values);
+	heap_free(heap, parallel_bench.values);
+	heap_free(heap, parallel_bench.temp_keys);
+	heap_free(heap, parallel_bench.keys);
+	heap_free(heap, parallel_bench.source);
+	job_system_destroy(parallel_bench.jobs);
+
+	return path ? write_results(&bench, fs, path) : 0;
+}
+
+static void measure(bench_t* bench, const char* name, int operations, bench_func_t func, void* user)
+{
+	double samples[k_samples];
+	for (int i = 0; i < k_warmup_samples; ++i)
+	{
+		func(user, operations);
+	}
+	for (int i = 0; i < k_samples; ++i)
+	{
+		uint64_t start = timer_get_ticks();
+		func(user, operations);
+		samples[i] = (double)timer_ticks_to_ns(timer_get_ticks() - start) / operations;
+	}
+	qsort(samples, k_samples, sizeof(samples[0]), compare_doubles);
+
+	bench_result_t* result = &bench->results[bench->result_count++];
+	result->name = name;
+	result->operations = operations;
+	result->min_ns = samples[0];
+	result->p50_ns = samples[k_samples * 50 / 100];
+	result->p90_ns = samples[k_samples * 90 / 100];
+	result->p99_ns = samples[k_samples * 99 / 100];
+	result->max_ns = samples[k_samples - 1];
+
+	debug_print(k_print_info, "%-34s ns per operation: min %9.2f  p50 %9.2f  p90 %9.2f  p99 %9.2f  max %9.2f\n",
+		name, result->min_ns, result->p50_ns, result->p90_ns, result->p99_ns, result->max_ns);
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void heap_func(void* user, int operations)
+{
+	heap_bench_t* bench = user;
+	for (int i = 0; i < operations; i += k_heap_batch)
+	{
+		//mixed sizes, freed in a different order than allocated
+		for (int j = 0; j < k_heap_batch; ++j)
+		{
+			bench->allocations[j] = heap_alloc(bench->heap, 16 + (j * 37 % 16) * 64, 8);
+		}
+		for (int j = 0; j < k_heap_batch; ++j)
+		{
+			heap_free(bench->heap, bench->allocations[(j * 5) % k_heap_batch]);
+		}
+	}
+}
+
+static void queue_pop_func(void* user, int operations)
+{
+	queue_bench_t* bench = user;
+	for (int i = 0; i < operations; ++i)
+	{
+		queue_pop(bench->queue);
+	}
+}
+
+static int queue_producer_thread(void* user)
+{
+	queue_bench_t* bench = user;
+	while (!atomic_load(&bench->stop))
+	{
+		//try so that a full queue can't keep the thread from seeing stop
+		queue_try_push(bench->queue, bench);
+	}
+	return 0;
+}
+
+static void ecs_query_func(void* user, int operations)
+{
+	ecs_bench_t* bench = user;
+	float sum = 0.0f;
+	for (ecs_query_t query = ecs_query_create(bench->ecs, ECS_MASK(bench->transform_type));
+		ecs_query_is_valid(bench->ecs, &query);
+		ecs_query_next(bench->ecs, &query))
+	{
+		transform_t* transform = ecs_query_get_component(bench->ecs, &query, bench->transform_type);
+		sum += transform->translation.x;
+	}
+	bench->sum += sum;
+}
+
+static void ecs_chunk_query_func(void* user, int operations)
+{
+	ecs_bench_t* bench = user;
+	float sum = 0.0f;
+	for (ecs_chunk_query_t query = ecs_chunk_query_create(bench->ecs, ECS_MASK(bench->transform_type));
+		ecs_chunk_query_is_valid(bench->ecs, &query);
+		ecs_chunk_query_next(bench->ecs, &query))
+	{
+		transform_t* transforms = ecs_chunk_query_get_components(bench->ecs, &query, bench->transform_type);
+		int count = ecs_chunk_query_get_count(bench->ecs, &query);
+		for (int i = 0; i < count; ++i)
+		{
+			sum += transforms[i].translation.x;
+		}
+	}
+	bench->sum += sum;
+}
+
+static void mat4f_mul_func(void* user, int operations)
+{
+	math_bench_t* bench = user;
+	for (int i = 0; i < operations; ++i)
+	{
+		mat4f_mul(&bench->results[i], &bench->a[i], &bench->b[i]);
+	}
+}
+
+static void transform_to_matrix_func(void* user, int operations)
+{
+	math_bench_t* bench = user;
+	for (int i = 0; i < operations; ++i)
+	{
+		transform_to_matrix(&bench->transforms[i], &bench->results[i]);
+	}
+}
+
+static void transform_to_matrix_batch_func(void* user, int operations)
+{
+	math_bench_t* bench = user;
+	transform_to_matrix_batch(bench->transforms, operations, bench->results);
+}
+
+static void lz4_func(void* user, int operations)
+{
+	lz4_bench_t* bench = user;
+	for (int i = 0; i < operations; ++i)
+	{
+		int size = LZ4_compress_default(bench->source, bench->compressed, k_lz4_size, bench->compressed_capacity);
+		LZ4_decompress_safe(bench->compressed, bench->decompressed, size, k_lz4_size);
+	}
+}
+
+static void trace_func(void* user, int operations)
+{
+	trace_t* trace = user;
+	for (int i = 0; i < operations; ++i)
+	{
+		trace_duration_push(trace, "bench");
+		trace_duration_pop(trace);
+	}
+}
+
+static void parallel_for_func(void* user, int operations)
+{
+	parallel_bench_t* bench = user;
+	parallel_for(bench->jobs, operations, 0, parallel_for_items, bench->items);
+}
+
+static void parallel_for_items(void* data, int begin, int end)
+{
+	int* items = data;
+	for (int i = begin; i < end; ++i)
+	{
+		items[i] = items[i] * 3 + 1;
+	}
+}
+
+static void radix_sort32_func(void* user, int operations)
+{
+	parallel_bench_t* bench = user;
+	uint32_t* keys = (uint32_t*)bench->keys;
+	for (int i = 0; i < operations; ++i)
+	{
+		keys[i] = (uint32_t)(bench->source[i] >> 32);
+		bench->values[i] = i;
+	}
+	parallel_radix_sort32(bench->jobs, keys, bench->values, (uint32_t*)bench->temp_keys, bench->temp_values, operations);
+}
+
+static void radix_sort64_func(void* user, int operations)
+{
+	parallel_bench_t* bench = user;
+	memcpy(bench->keys, bench->source, sizeof(uint64_t) * operations);
+	for (int i = 0; i < operations; ++i)
+	{
+		bench->values[i] = i;
+	}
+	parallel_radix_sort64(bench->jobs, bench->keys, bench->values, bench->temp_keys, bench->temp_values, operations);
+}
+
+static void exclusive_scan_func(void* user, int operations)
+{
+	parallel_bench_t* bench = user;
+	parallel_exclusive_scan(bench->jobs, bench->items, (int*)bench->temp_values, operations);
+}
+
+static int write_results(bench_t* bench, fs_t* fs, const char* path)
+{
+	//a result line is well under 256 characters
+	size_t capacity = 256 * (bench->result_count + 1);
+	char* buffer = heap_alloc(bench->heap, capacity, 8);
+	int length = snprintf(buffer, capacity, "name,operations_per_sample,samples,min_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+	for (int i = 0; i < bench->result_count; ++i)
+	{
+		const bench_result_t* result = &bench->results[i];
+		length += snprintf(buffer + length, capacity - length, "%s,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+			result->name, result->operations, k_samples,
+			result->min_ns, result->p50_ns, result->p90_ns, result->p99_ns, result->max_ns);
+	}
+
+	fs_work_t* work = fs_write(fs, path, buffer, length, false);
+	fs_work_wait(work);
+	int result = fs_work_get_result(work);
+	fs_work_destroy(work);
+	heap_free(bench->heap, buffer);
+	return result;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Micro-benchmarks for core engine primitives.
+// Each benchmark runs in timed samples of many operations, discards the first samples as warm-up
+// and reports percentiles of the nanoseconds per operation over the rest, so one preempted sample
+// doesn't skew a result. Run with ga2022 -bench [results.csv].
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+
+// Run every benchmark, printing the results.
+// If path is not NULL, the results are also written there as comma-separated values, one line per
+// benchmark, for comparing runs.
+// Returns zero on success.
+int bench_run(heap_t* heap, fs_t* fs, const char* path);
@@ -53,6 +53,43 @@ cpMessage(const char *condition, const char *file, int line, int isError, int is
 #endif
 }
 
+static cpAllocator cpCurrentAllocator = {NULL, NULL, NULL, NULL};
+
+void
+cpSetAllocator(const cpAllocator *allocator)
+{
+	if(allocator){
+		cpCurrentAllocator = *allocator;
+	} else {
+		cpAllocator defaults = {NULL, NULL, NULL, NULL};
+		cpCurrentAllocator = defaults;
+	}
+}
+
+void *
+cpAllocatorCalloc(size_t count, size_t size)
+{
+	if(cpCurrentAllocator.callocFunc) return cpCurrentAllocator.callocFunc(count, size, cpCurrentAllocator.data);
+	return calloc(count, size);
+}
+
+void *
+cpAllocatorRealloc(void *ptr, size_t size)
+{
+	if(cpCurrentAllocator.reallocFunc) return cpCurrentAllocator.reallocFunc(ptr, size, cpCurrentAllocator.data);
+	return realloc(ptr, size);
+}
+
+void
+cpAllocatorFree(void *ptr)
+{
+	if(cpCurrentAllocator.freeFunc){
+		cpCurrentAllocator.freeFunc(ptr, cpCurrentAllocator.data);
+	} else {
+		free(ptr);
+	}
+}
+
 #define STR(s) #s
 #define XSTR(s) STR(s)
 
@@ -240,7 +277,9 @@ QHullReduce(cpFloat tol, cpVect *verts, int count, cpVect a, cpVect pivot, cpVec
 		
 		result[index++] = pivot;
 		
+		// An empty right side has no pivot, and verts[left_count] would read past the end.
 		int right_count = QHullPartition(verts + left_count, count - left_count, pivot, b, tol);
+		if(right_count == 0) return index;
 		return index + QHullReduce(tol, verts + left_count + 1, right_count - 1, pivot, verts[left_count], b, result + index);
 	}
 }
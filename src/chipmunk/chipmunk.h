@@ -67,19 +67,35 @@ CP_EXPORT void cpMessage(const char *condition, const char *file, int line, int
 	#define CP_BUFFER_BYTES (32*1024)
 #endif
 
+/// Memory functions Chipmunk allocates through, with the data pointer given to cpSetAllocator().
+typedef struct cpAllocator {
+	void *(*callocFunc)(size_t count, size_t size, void *data);
+	void *(*reallocFunc)(void *ptr, size_t size, void *data);
+	void (*freeFunc)(void *ptr, void *data);
+	void *data;
+} cpAllocator;
+
+/// Replace the functions cpcalloc(), cprealloc() and cpfree() call, or restore calloc(), realloc() and free() if NULL.
+/// Set it before creating anything and keep it until everything is freed, since memory must go back where it came from.
+CP_EXPORT void cpSetAllocator(const cpAllocator *allocator);
+
+CP_EXPORT void *cpAllocatorCalloc(size_t count, size_t size);
+CP_EXPORT void *cpAllocatorRealloc(void *ptr, size_t size);
+CP_EXPORT void cpAllocatorFree(void *ptr);
+
 #ifndef cpcalloc
 	/// Chipmunk calloc() alias.
-	#define cpcalloc calloc
+	#define cpcalloc cpAllocatorCalloc
 #endif
 
 #ifndef cprealloc
 	/// Chipmunk realloc() alias.
-	#define cprealloc realloc
+	#define cprealloc cpAllocatorRealloc
 #endif
 
 #ifndef cpfree
 	/// Chipmunk free() alias.
-	#define cpfree free
+	#define cpfree cpAllocatorFree
 #endif
 
 typedef struct cpArray cpArray;
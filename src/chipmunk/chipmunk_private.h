@@ -27,10 +27,78 @@
 
 #define CP_HASH_COEF (3344921057ul)
 #define CP_HASH_PAIR(A, B) ((cpHashValue)(A)*CP_HASH_COEF ^ (cpHashValue)(B)*CP_HASH_COEF)
+// Arbiters are cached by their shapes' ids rather than addresses, so the cache iterates in the same order on every run.
+#define CP_HASH_SHAPE_PAIR(A, B) CP_HASH_PAIR((A)->hashid, (B)->hashid)
 
 // TODO: Eww. Magic numbers.
 #define MAGIC_EPSILON 1e-5
 
+// A cpVect fits in one SSE2 register, so its x and y can be computed in a single instruction.
+// Every x64 CPU has SSE2, so this needs no runtime detection.
+#if !defined(CP_USE_SSE2)
+	#if defined(__SSE2__) || defined(_M_X64)
+		#define CP_USE_SSE2 1
+	#else
+		#define CP_USE_SSE2 0
+	#endif
+#endif
+
+#if CP_USE_SSE2
+	#include <emmintrin.h>
+
+// Two cpFloat lanes, x and y of a cpVect or one value each for a pair of bodies, in whichever
+// register type holds cpFloats. Single precision uses the low half of a float register; its
+// loads clear the high half, so the unused lanes stay finite.
+#if CP_USE_DOUBLES
+typedef __m128d cpSSE2Vect;
+
+static inline cpSSE2Vect cpSSE2Load(const cpFloat *p){return _mm_loadu_pd(p);}
+static inline void cpSSE2Store(cpFloat *p, cpSSE2Vect a){_mm_storeu_pd(p, a);}
+static inline cpSSE2Vect cpSSE2Set(cpFloat x, cpFloat y){return _mm_setr_pd(x, y);}
+static inline cpSSE2Vect cpSSE2Set1(cpFloat x){return _mm_set1_pd(x);}
+static inline cpSSE2Vect cpSSE2SetLow(cpFloat x){return _mm_set_sd(x);}
+static inline cpSSE2Vect cpSSE2Zero(void){return _mm_setzero_pd();}
+static inline cpSSE2Vect cpSSE2Add(cpSSE2Vect a, cpSSE2Vect b){return _mm_add_pd(a, b);}
+static inline cpSSE2Vect cpSSE2Sub(cpSSE2Vect a, cpSSE2Vect b){return _mm_sub_pd(a, b);}
+static inline cpSSE2Vect cpSSE2Mul(cpSSE2Vect a, cpSSE2Vect b){return _mm_mul_pd(a, b);}
+static inline cpSSE2Vect cpSSE2Min(cpSSE2Vect a, cpSSE2Vect b){return _mm_min_pd(a, b);}
+static inline cpSSE2Vect cpSSE2Max(cpSSE2Vect a, cpSSE2Vect b){return _mm_max_pd(a, b);}
+// {a.x, b.x} and {a.y, b.y}
+static inline cpSSE2Vect cpSSE2UnpackLow(cpSSE2Vect a, cpSSE2Vect b){return _mm_unpacklo_pd(a, b);}
+static inline cpSSE2Vect cpSSE2UnpackHigh(cpSSE2Vect a, cpSSE2Vect b){return _mm_unpackhi_pd(a, b);}
+// {a.y, a.x}
+static inline cpSSE2Vect cpSSE2Reverse(cpSSE2Vect a){return _mm_shuffle_pd(a, a, 1);}
+static inline cpFloat cpSSE2High(cpSSE2Vect a){return _mm_cvtsd_f64(_mm_unpackhi_pd(a, a));}
+static inline void cpSSE2StoreLow(cpFloat *p, cpSSE2Vect a){_mm_store_sd(p, a);}
+static inline void cpSSE2StoreHigh(cpFloat *p, cpSSE2Vect a){_mm_storeh_pd(p, a);}
+#else
+typedef __m128 cpSSE2Vect;
+
+static inline cpSSE2Vect cpSSE2Load(const cpFloat *p){return _mm_castpd_ps(_mm_load_sd((const double *)p));}
+static inline void cpSSE2Store(cpFloat *p, cpSSE2Vect a){_mm_store_sd((double *)p, _mm_castps_pd(a));}
+static inline cpSSE2Vect cpSSE2Set(cpFloat x, cpFloat y){return _mm_setr_ps(x, y, 0.0f, 0.0f);}
+static inline cpSSE2Vect cpSSE2Set1(cpFloat x){return _mm_setr_ps(x, x, 0.0f, 0.0f);}
+static inline cpSSE2Vect cpSSE2SetLow(cpFloat x){return _mm_set_ss(x);}
+static inline cpSSE2Vect cpSSE2Zero(void){return _mm_setzero_ps();}
+static inline cpSSE2Vect cpSSE2Add(cpSSE2Vect a, cpSSE2Vect b){return _mm_add_ps(a, b);}
+static inline cpSSE2Vect cpSSE2Sub(cpSSE2Vect a, cpSSE2Vect b){return _mm_sub_ps(a, b);}
+static inline cpSSE2Vect cpSSE2Mul(cpSSE2Vect a, cpSSE2Vect b){return _mm_mul_ps(a, b);}
+static inline cpSSE2Vect cpSSE2Min(cpSSE2Vect a, cpSSE2Vect b){return _mm_min_ps(a, b);}
+static inline cpSSE2Vect cpSSE2Max(cpSSE2Vect a, cpSSE2Vect b){return _mm_max_ps(a, b);}
+// {a.x, b.x} and {a.y, b.y}
+static inline cpSSE2Vect cpSSE2UnpackLow(cpSSE2Vect a, cpSSE2Vect b){return _mm_unpacklo_ps(a, b);}
+static inline cpSSE2Vect cpSSE2UnpackHigh(cpSSE2Vect a, cpSSE2Vect b){cpSSE2Vect t = _mm_unpacklo_ps(a, b); return _mm_movehl_ps(t, t);}
+// {a.y, a.x}
+static inline cpSSE2Vect cpSSE2Reverse(cpSSE2Vect a){return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 2, 0, 1));}
+static inline cpFloat cpSSE2High(cpSSE2Vect a){return _mm_cvtss_f32(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));}
+static inline void cpSSE2StoreLow(cpFloat *p, cpSSE2Vect a){_mm_store_ss(p, a);}
+static inline void cpSSE2StoreHigh(cpFloat *p, cpSSE2Vect a){_mm_store_ss(p, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));}
+#endif
+
+// {a.x + a.y, b.x + b.y}
+static inline cpSSE2Vect cpSSE2PairAdd(cpSSE2Vect a, cpSSE2Vect b){return cpSSE2Add(cpSSE2UnpackLow(a, b), cpSSE2UnpackHigh(a, b));}
+#endif
+
 
 //MARK: cpArray
 
@@ -39,6 +107,7 @@ cpArray *cpArrayNew(int size);
 void cpArrayFree(cpArray *arr);
 
 void cpArrayPush(cpArray *arr, void *object);
+void cpArrayReserve(cpArray *arr, int max);
 void *cpArrayPop(cpArray *arr);
 void cpArrayDeleteObj(cpArray *arr, void *obj);
 cpBool cpArrayContains(cpArray *arr, void *ptr);
@@ -57,6 +126,7 @@ void cpHashSetSetDefaultValue(cpHashSet *set, void *default_value);
 void cpHashSetFree(cpHashSet *set);
 
 int cpHashSetCount(cpHashSet *set);
+void cpHashSetReserve(cpHashSet *set, int count);
 const void *cpHashSetInsert(cpHashSet *set, cpHashValue hash, const void *ptr, cpHashSetTransFunc trans, void *data);
 const void *cpHashSetRemove(cpHashSet *set, cpHashValue hash, const void *ptr);
 const void *cpHashSetFind(cpHashSet *set, cpHashValue hash, const void *ptr);
@@ -78,6 +148,10 @@ void cpBodyAccumulateMassFromShapes(cpBody *body);
 
 void cpBodyRemoveConstraint(cpBody *body, cpConstraint *constraint);
 
+// Integrate every body in an array, inlining the default integrators instead of calling through their function pointers.
+void cpBodyArrayUpdateVelocity(cpArray *bodies, cpVect gravity, cpFloat damping, cpFloat dt);
+void cpBodyArrayUpdatePosition(cpArray *bodies, cpFloat dt);
+
 
 //MARK: Spatial Index Functions
 
@@ -96,6 +170,20 @@ cpArbiterThreadForBody(cpArbiter *arb, cpBody *body)
 
 void cpArbiterUnthread(cpArbiter *arb);
 
+static inline void
+cpBodyPushArbiter(cpBody *body, cpArbiter *arb)
+{
+	cpAssertSoft(cpArbiterThreadForBody(arb, body)->next == NULL, "Internal Error: Dangling contact graph pointers detected. (A)");
+	cpAssertSoft(cpArbiterThreadForBody(arb, body)->prev == NULL, "Internal Error: Dangling contact graph pointers detected. (B)");
+	
+	cpArbiter *next = body->arbiterList;
+	cpAssertSoft(next == NULL || cpArbiterThreadForBody(next, body)->prev == NULL, "Internal Error: Dangling contact graph pointers detected. (C)");
+	cpArbiterThreadForBody(arb, body)->next = next;
+	
+	if(next) cpArbiterThreadForBody(next, body)->prev = arb;
+	body->arbiterList = arb;
+}
+
 void cpArbiterUpdate(cpArbiter *arb, struct cpCollisionInfo *info, cpSpace *space);
 void cpArbiterPreStep(cpArbiter *arb, cpFloat dt, cpFloat bias, cpFloat slop);
 void cpArbiterApplyCachedImpulse(cpArbiter *arb, cpFloat dt_coef);
@@ -285,6 +373,8 @@ void cpSpaceProcessComponents(cpSpace *space, cpFloat dt);
 void cpSpacePushFreshContactBuffer(cpSpace *space);
 struct cpContact *cpContactBufferGetArray(cpSpace *space);
 void cpSpacePushContacts(cpSpace *space, int count);
+void cpSpaceClearContacts(cpSpace *space);
+void *cpSpaceArbiterSetTrans(cpShape **shapes, cpSpace *space);
 
 cpPostStepCallback *cpSpaceGetPostStepCallback(cpSpace *space, void *key);
 
@@ -300,7 +390,7 @@ cpSpaceUncacheArbiter(cpSpace *space, cpArbiter *arb)
 {
 	const cpShape *a = arb->a, *b = arb->b;
 	const cpShape *shape_pair[] = {a, b};
-	cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b);
+	cpHashValue arbHashID = CP_HASH_SHAPE_PAIR(a, b);
 	cpHashSetRemove(space->cachedArbiters, arbHashID, shape_pair);
 	cpArrayDeleteObj(space->arbiters, arb);
 }
@@ -314,6 +404,12 @@ cpSpaceArrayForBodyType(cpSpace *space, cpBodyType type)
 void cpShapeUpdateFunc(cpShape *shape, void *unused);
 cpCollisionID cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space);
 
+// cpSpaceCollideShapes() split in two, for narrowphase run apart from the broadphase and away from the space.
+// Colliding a pair only reads the shapes, so pairs may be collided on any thread; adding a collision copies its
+// contacts into the space's contact buffer and makes or updates its arbiter, and must be done in the step.
+struct cpCollisionInfo cpSpaceCollidePair(cpShape *a, cpShape *b, cpCollisionID id, struct cpContact *contacts);
+void cpSpaceAddCollision(cpSpace *space, struct cpCollisionInfo *info);
+
 
 //MARK: Foreach loops
 
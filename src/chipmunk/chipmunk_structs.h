@@ -78,6 +78,16 @@ struct cpBody {
 		cpBody *next;
 		cpFloat idleTime;
 	} sleeping;
+	
+	// Bit per color of the hasty space's colored solver already used by this body's contacts and constraints this step.
+	unsigned int solverColors;
+	
+	// Radius of the circle cpBodyUpdatePositionSwept() sweeps the body's center of gravity as.
+	cpFloat sweepRadius;
+	
+	// Pool the body's memory was taken from by the physics wrapper, or NULL if it was allocated on its own.
+	// A pooled body goes back to its pool when destroyed there rather than through cpBodyFree().
+	void *pool;
 };
 
 enum cpArbiterState {
@@ -142,6 +152,9 @@ struct cpArbiter {
 	
 	cpTimestamp stamp;
 	enum cpArbiterState state;
+	
+	// Narrowphase hint from the last step the shapes collided, for narrowphase not run from the broadphase.
+	cpCollisionID collisionID;
 };
 
 struct cpShapeMassInfo {
@@ -401,6 +414,8 @@ struct cpSpace {
 	
 	cpFloat idleSpeedThreshold;
 	cpFloat sleepTimeThreshold;
+	cpSpaceSleepFunc sleepFunc;
+	void *sleepData;
 	
 	cpFloat collisionSlop;
 	cpFloat collisionBias;
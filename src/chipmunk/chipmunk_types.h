@@ -54,6 +54,9 @@
 
 #ifndef CP_USE_DOUBLES
 	// Use doubles by default for higher precision.
+	// Defining CP_USE_DOUBLES as 0 for the whole project builds in single precision instead, which halves
+	// bodies, shapes and contacts and runs the same SSE2 solver and integration on float registers.
+	// Compare how piles settle with ga2022 -physicsbench in both builds before switching.
 	#define CP_USE_DOUBLES 1
 #endif
 
@@ -454,9 +454,105 @@ cpArbiterApplyCachedImpulse(cpArbiter *arb, cpFloat dt_coef)
 
 // TODO: is it worth splitting velocity/position correction?
 
+#if CP_USE_SSE2
+
+// SSE2 port of cpArbiterApplyImpulse_NEON() in cpHastySpace.c.
+// Contacts are solved in order, each seeing the velocities the last one produced; the lanes
+// instead pair x with y, body a with body b, and the bias impulse with the normal impulse.
+static void
+cpArbiterApplyImpulse_SSE2(cpArbiter *arb)
+{
+	cpBody *a = arb->body_a;
+	cpBody *b = arb->body_b;
+	cpSSE2Vect surface_vr = cpSSE2Load(&arb->surface_vr.x);
+	cpSSE2Vect n = cpSSE2Load(&arb->n.x);
+	cpFloat friction = arb->u;
+	
+	cpSSE2Vect perp = cpSSE2Set(-1.0f, 1.0f);
+	cpSSE2Vect nperp = cpSSE2Set(1.0f, -1.0f);
+	cpSSE2Vect t = cpSSE2Mul(cpSSE2Reverse(n), perp);
+	cpSSE2Vect i_inv = cpSSE2Set(-a->i_inv, b->i_inv);
+	cpSSE2Vect m_inv_a = cpSSE2Set1(a->m_inv);
+	cpSSE2Vect m_inv_b = cpSSE2Set1(b->m_inv);
+	
+	int numContacts = arb->count;
+	struct cpContact *contacts = arb->contacts;
+	for(int i=0; i<numContacts; i++){
+		struct cpContact *con = contacts + i;
+		cpSSE2Vect r1 = cpSSE2Load(&con->r1.x);
+		cpSSE2Vect r2 = cpSSE2Load(&con->r2.x);
+		cpSSE2Vect r1p = cpSSE2Mul(cpSSE2Reverse(r1), perp);
+		cpSSE2Vect r2p = cpSSE2Mul(cpSSE2Reverse(r2), perp);
+		
+		cpSSE2Vect vBias_a = cpSSE2Load(&a->v_bias.x);
+		cpSSE2Vect vBias_b = cpSSE2Load(&b->v_bias.x);
+		cpSSE2Vect wBias = cpSSE2Set(a->w_bias, b->w_bias);
+		cpSSE2Vect vb1 = cpSSE2Add(vBias_a, cpSSE2Mul(r1p, cpSSE2UnpackLow(wBias, wBias)));
+		cpSSE2Vect vb2 = cpSSE2Add(vBias_b, cpSSE2Mul(r2p, cpSSE2UnpackHigh(wBias, wBias)));
+		cpSSE2Vect vbr = cpSSE2Sub(vb2, vb1);
+		
+		cpSSE2Vect v_a = cpSSE2Load(&a->v.x);
+		cpSSE2Vect v_b = cpSSE2Load(&b->v.x);
+		cpSSE2Vect w = cpSSE2Set(a->w, b->w);
+		cpSSE2Vect v1 = cpSSE2Add(v_a, cpSSE2Mul(r1p, cpSSE2UnpackLow(w, w)));
+		cpSSE2Vect v2 = cpSSE2Add(v_b, cpSSE2Mul(r2p, cpSSE2UnpackHigh(w, w)));
+		cpSSE2Vect vr = cpSSE2Add(cpSSE2Sub(v2, v1), surface_vr);
+		
+		cpSSE2Vect vbn_vrn = cpSSE2PairAdd(cpSSE2Mul(vbr, n), cpSSE2Mul(vr, n));
+		
+		cpSSE2Vect v_offset = cpSSE2Set(con->bias, -con->bounce);
+		cpSSE2Vect jOld = cpSSE2Set(con->jBias, con->jnAcc);
+		cpSSE2Vect jbn_jn = cpSSE2Mul(cpSSE2Sub(v_offset, vbn_vrn), cpSSE2Set1(con->nMass));
+		jbn_jn = cpSSE2Max(cpSSE2Add(jOld, jbn_jn), cpSSE2Zero());
+		cpSSE2Vect jApply = cpSSE2Sub(jbn_jn, jOld);
+		
+		cpSSE2Vect vrt_tmp = cpSSE2Mul(vr, t);
+		cpSSE2Vect vrt = cpSSE2PairAdd(vrt_tmp, vrt_tmp);
+		
+		cpSSE2Vect jtOld = cpSSE2SetLow(con->jtAcc);
+		cpSSE2Vect jtMax = cpSSE2Set1(friction*cpSSE2High(jbn_jn));
+		cpSSE2Vect jt = cpSSE2Mul(vrt, cpSSE2Set1(-con->tMass));
+		jt = cpSSE2Max(cpSSE2Sub(cpSSE2Zero(), jtMax), cpSSE2Min(cpSSE2Add(jtOld, jt), jtMax));
+		cpSSE2Vect jtApply = cpSSE2Sub(jt, jtOld);
+		
+		cpSSE2Vect jBias = cpSSE2Mul(n, cpSSE2UnpackLow(jApply, jApply));
+		cpSSE2Vect jBiasCross = cpSSE2Mul(cpSSE2Reverse(jBias), nperp);
+		cpSSE2Vect biasCrosses = cpSSE2PairAdd(cpSSE2Mul(r1, jBiasCross), cpSSE2Mul(r2, jBiasCross));
+		wBias = cpSSE2Add(wBias, cpSSE2Mul(i_inv, biasCrosses));
+		vBias_a = cpSSE2Sub(vBias_a, cpSSE2Mul(jBias, m_inv_a));
+		vBias_b = cpSSE2Add(vBias_b, cpSSE2Mul(jBias, m_inv_b));
+		
+		cpSSE2Vect j = cpSSE2Add(cpSSE2Mul(n, cpSSE2UnpackHigh(jApply, jApply)), cpSSE2Mul(t, cpSSE2UnpackLow(jtApply, jtApply)));
+		cpSSE2Vect jCross = cpSSE2Mul(cpSSE2Reverse(j), nperp);
+		cpSSE2Vect crosses = cpSSE2PairAdd(cpSSE2Mul(r1, jCross), cpSSE2Mul(r2, jCross));
+		w = cpSSE2Add(w, cpSSE2Mul(i_inv, crosses));
+		v_a = cpSSE2Sub(v_a, cpSSE2Mul(j, m_inv_a));
+		v_b = cpSSE2Add(v_b, cpSSE2Mul(j, m_inv_b));
+		
+		cpSSE2Store(&a->v_bias.x, vBias_a);
+		cpSSE2Store(&b->v_bias.x, vBias_b);
+		cpSSE2StoreLow(&a->w_bias, wBias);
+		cpSSE2StoreHigh(&b->w_bias, wBias);
+		
+		cpSSE2Store(&a->v.x, v_a);
+		cpSSE2Store(&b->v.x, v_b);
+		cpSSE2StoreLow(&a->w, w);
+		cpSSE2StoreHigh(&b->w, w);
+		
+		cpSSE2StoreLow(&con->jBias, jbn_jn);
+		cpSSE2StoreHigh(&con->jnAcc, jbn_jn);
+		cpSSE2StoreLow(&con->jtAcc, jt);
+	}
+}
+
+#endif
+
 void
 cpArbiterApplyImpulse(cpArbiter *arb)
 {
+#if CP_USE_SSE2
+	cpArbiterApplyImpulse_SSE2(arb);
+#else
 	cpBody *a = arb->body_a;
 	cpBody *b = arb->body_b;
 	cpVect n = arb->n;
@@ -493,4 +589,5 @@ cpArbiterApplyImpulse(cpArbiter *arb)
 		apply_bias_impulses(a, b, r1, r2, cpvmult(n, con->jBias - jbnOld));
 		apply_impulses(a, b, r1, r2, cpvrotate(n, cpv(con->jnAcc - jnOld, con->jtAcc - jtOld)));
 	}
+#endif
 }
@@ -59,6 +59,16 @@ cpArrayPush(cpArray *arr, void *object)
 	arr->num++;
 }
 
+// Grow the array to hold at least max objects without reallocating.
+void
+cpArrayReserve(cpArray *arr, int max)
+{
+	if(arr->max < max){
+		arr->max = max;
+		arr->arr = (void **)cprealloc(arr->arr, arr->max*sizeof(void*));
+	}
+}
+
 void *
 cpArrayPop(cpArray *arr)
 {
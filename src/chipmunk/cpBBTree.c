@@ -32,6 +32,7 @@ typedef struct Pair Pair;
 struct cpBBTree {
 	cpSpatialIndex spatialIndex;
 	cpBBTreeVelocityFunc velocityFunc;
+	cpBBTreePairRejectFunc pairRejectFunc;
 	
 	cpHashSet *leaves;
 	Node *root;
@@ -41,6 +42,9 @@ struct cpBBTree {
 	cpArray *allocatedBuffers;
 	
 	cpTimestamp stamp;
+	
+	// Counter choosing the path cpBBTreeOptimizeIncremental() takes down the tree next.
+	unsigned int optimizePath;
 };
 
 struct Node {
@@ -427,7 +431,11 @@ MarkLeafQuery(Node *subtree, Node *leaf, cpBool left, MarkContext *context)
 {
 	if(cpBBIntersects(leaf->bb, subtree->bb)){
 		if(NodeIsLeaf(subtree)){
-			if(left){
+			// Pairs that could never collide aren't cached, so they cost nothing on later steps.
+			cpBBTreePairRejectFunc pairRejectFunc = context->tree->pairRejectFunc;
+			if(pairRejectFunc && pairRejectFunc(leaf->obj, subtree->obj)){
+				return;
+			} else if(left){
 				PairInsert(leaf, subtree, context->tree);
 			} else {
 				if(subtree->STAMP < leaf->STAMP) PairInsert(subtree, leaf, context->tree);
@@ -562,6 +570,7 @@ cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *static
 	cpSpatialIndexInit((cpSpatialIndex *)tree, Klass(), bbfunc, staticIndex);
 	
 	tree->velocityFunc = NULL;
+	tree->pairRejectFunc = NULL;
 	
 	tree->leaves = cpHashSetNew(0, (cpHashSetEqlFunc)leafSetEql);
 	tree->root = NULL;
@@ -570,6 +579,7 @@ cpBBTreeInit(cpBBTree *tree, cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *static
 	tree->allocatedBuffers = cpArrayNew(0);
 	
 	tree->stamp = 0;
+	tree->optimizePath = 0;
 	
 	return (cpSpatialIndex *)tree;
 }
@@ -585,6 +595,17 @@ cpBBTreeSetVelocityFunc(cpSpatialIndex *index, cpBBTreeVelocityFunc func)
 	((cpBBTree *)index)->velocityFunc = func;
 }
 
+void
+cpBBTreeSetPairRejectFunc(cpSpatialIndex *index, cpBBTreePairRejectFunc func)
+{
+	if(index->klass != Klass()){
+		cpAssertWarn(cpFalse, "Ignoring cpBBTreeSetPairRejectFunc() call to non-tree spatial index.");
+		return;
+	}
+	
+	((cpBBTree *)index)->pairRejectFunc = func;
+}
+
 cpSpatialIndex *
 cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialIndex *staticIndex)
 {
@@ -805,24 +826,71 @@ partitionNodes(cpBBTree *tree, Node **nodes, int count)
 	);
 }
 
-//static void
-//cpBBTreeOptimizeIncremental(cpBBTree *tree, int passes)
-//{
-//	for(int i=0; i<passes; i++){
-//		Node *root = tree->root;
-//		Node *node = root;
-//		int bit = 0;
-//		unsigned int path = tree->opath;
-//		
-//		while(!NodeIsLeaf(node)){
-//			node = (path&(1<<bit) ? node->a : node->b);
-//			bit = (bit + 1)&(sizeof(unsigned int)*8 - 1);
-//		}
-//		
-//		root = subtreeRemove(root, node, tree);
-//		tree->root = subtreeInsert(root, node, tree);
-//	}
-//}
+// Swap a child of node with one of its sibling's children if that shrinks the sibling, as in Kensler's tree rotations.
+// Only the sibling's bounds change, so the tree's total area drops by as much as the sibling's does.
+static cpBool
+NodeRotate(Node *node)
+{
+	Node *a = node->A, *b = node->B;
+	cpFloat best = 0.0f;
+	int rotation = 0;
+	
+	if(!NodeIsLeaf(b)){
+		cpFloat area = cpBBArea(b->bb);
+		cpFloat swapA = cpBBMergedArea(a->bb, b->B->bb) - area; // a <-> b->A
+		cpFloat swapB = cpBBMergedArea(b->A->bb, a->bb) - area; // a <-> b->B
+		if(swapA < best){best = swapA; rotation = 1;}
+		if(swapB < best){best = swapB; rotation = 2;}
+	}
+	
+	if(!NodeIsLeaf(a)){
+		cpFloat area = cpBBArea(a->bb);
+		cpFloat swapA = cpBBMergedArea(b->bb, a->B->bb) - area; // b <-> a->A
+		cpFloat swapB = cpBBMergedArea(a->A->bb, b->bb) - area; // b <-> a->B
+		if(swapA < best){best = swapA; rotation = 3;}
+		if(swapB < best){best = swapB; rotation = 4;}
+	}
+	
+	switch(rotation){
+		case 1: {Node *c = b->A; NodeSetA(node, c); NodeSetA(b, a); break;}
+		case 2: {Node *c = b->B; NodeSetA(node, c); NodeSetB(b, a); break;}
+		case 3: {Node *c = a->A; NodeSetB(node, c); NodeSetA(a, b); break;}
+		case 4: {Node *c = a->B; NodeSetB(node, c); NodeSetB(a, b); break;}
+		default: return cpFalse;
+	}
+	
+	Node *changed = (rotation <= 2 ? b : a);
+	changed->bb = cpBBMerge(changed->A->bb, changed->B->bb);
+	return cpTrue;
+}
+
+int
+cpBBTreeOptimizeIncremental(cpSpatialIndex *index, int passes)
+{
+	if(index->klass != &klass) return 0;
+	
+	cpBBTree *tree = (cpBBTree *)index;
+	int rotations = 0;
+	
+	for(int i=0; i<passes && tree->root; i++){
+		// Successive passes differ first in the bits read near the root, so they spread out over the whole tree.
+		unsigned int path = tree->optimizePath++;
+		int bit = 0;
+		
+		Node *node = tree->root;
+		while(!NodeIsLeaf(node)){
+			node = (path&(1u<<bit) ? node->B : node->A);
+			bit = (bit + 1)&(sizeof(unsigned int)*8 - 1);
+		}
+		
+		// Rotating on the way back up lets each rotation see the subtrees below it already improved.
+		for(node = node->parent; node; node = node->parent){
+			if(NodeRotate(node)) rotations++;
+		}
+	}
+	
+	return rotations;
+}
 
 void
 cpBBTreeOptimize(cpSpatialIndex *index)
@@ -55,6 +55,8 @@ cpBodyInit(cpBody *body, cpFloat mass, cpFloat moment)
 	body->v_bias = cpvzero;
 	body->w_bias = 0.0f;
 	
+	body->sweepRadius = 0.0f;
+	
 	body->userData = NULL;
 	
 	// Setters must be called after full initialization so the sanity checks don't assert on garbage data.
@@ -521,6 +523,132 @@ cpBodyUpdatePosition(cpBody *body, cpFloat dt)
 	cpAssertSaneBody(body);
 }
 
+cpFloat
+cpBodyGetSweepRadius(const cpBody *body)
+{
+	return body->sweepRadius;
+}
+
+void
+cpBodySetSweepRadius(cpBody *body, cpFloat radius)
+{
+	body->sweepRadius = radius;
+}
+
+struct SweepContext {
+	cpBody *body;
+	cpShapeFilter filter;
+	cpVect start, end;
+	cpFloat alpha;
+};
+
+static cpFloat
+SweepShape(struct SweepContext *context, cpShape *shape, void *unused)
+{
+	if(shape->body == context->body || shape->sensor || cpShapeFilterReject(shape->filter, context->filter)) return context->alpha;
+	
+	// A sweep starting inside a shape misses it, leaving that contact to the collision step as usual.
+	cpSegmentQueryInfo info = {NULL, context->end, cpvzero, 1.0f};
+	if(cpShapeSegmentQuery(shape, context->start, context->end, context->body->sweepRadius, &info) && info.alpha < context->alpha){
+		context->alpha = info.alpha;
+	}
+	
+	return context->alpha;
+}
+
+void
+cpBodyUpdatePositionSwept(cpBody *body, cpFloat dt)
+{
+	cpVect start = body->p;
+	cpBodyUpdatePosition(body, dt);
+	
+	// Steps shorter than the radius can't pass through anything the collision step would miss.
+	cpSpace *space = body->space;
+	cpFloat length = cpvdist(start, body->p);
+	if(!space || length <= body->sweepRadius) return;
+	
+	cpShapeFilter filter = (body->shapeList ? body->shapeList->filter : CP_SHAPE_FILTER_ALL);
+	struct SweepContext context = {body, filter, start, body->p, 1.0f};
+	cpSpatialIndexSegmentQuery(space->staticShapes, &context, start, body->p, 1.0f, (cpSpatialIndexSegmentQueryFunc)SweepShape, NULL);
+	cpSpatialIndexSegmentQuery(space->dynamicShapes, &context, start, body->p, 1.0f, (cpSpatialIndexSegmentQueryFunc)SweepShape, NULL);
+	
+	if(context.alpha < 1.0f){
+		// Stop just past the first impact, so the collision step finds the contact and resolves it with the body's
+		// full velocity. The unswept parts of the body's shapes only end up deeper into what it hit.
+		cpFloat alpha = cpfmin(context.alpha + space->collisionSlop/length, 1.0f);
+		SetTransform(body, body->p = cpvlerp(start, context.end, alpha), body->a);
+	}
+}
+
+void
+cpBodyArrayUpdateVelocity(cpArray *bodies, cpVect gravity, cpFloat damping, cpFloat dt)
+{
+#if CP_USE_SSE2
+	cpSSE2Vect g = cpSSE2Load(&gravity.x);
+	cpSSE2Vect damping2 = cpSSE2Set1(damping);
+	cpSSE2Vect dt2 = cpSSE2Set1(dt);
+#endif
+	
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		if(body->velocity_func != cpBodyUpdateVelocity){
+			body->velocity_func(body, gravity, damping, dt);
+			continue;
+		}
+		
+		// Same as cpBodyUpdateVelocity().
+		if(cpBodyGetType(body) == CP_BODY_TYPE_KINEMATIC) continue;
+		cpAssertSoft(body->m > 0.0f && body->i > 0.0f, "Body's mass and moment must be positive to simulate. (Mass: %f Moment: %f)", body->m, body->i);
+		
+	#if CP_USE_SSE2
+		cpSSE2Vect v = cpSSE2Load(&body->v.x);
+		cpSSE2Vect f = cpSSE2Load(&body->f.x);
+		cpSSE2Vect accel = cpSSE2Add(g, cpSSE2Mul(f, cpSSE2Set1(body->m_inv)));
+		cpSSE2Store(&body->v.x, cpSSE2Add(cpSSE2Mul(v, damping2), cpSSE2Mul(accel, dt2)));
+	#else
+		body->v = cpvadd(cpvmult(body->v, damping), cpvmult(cpvadd(gravity, cpvmult(body->f, body->m_inv)), dt));
+	#endif
+		body->w = body->w*damping + body->t*body->i_inv*dt;
+		
+		body->f = cpvzero;
+		body->t = 0.0f;
+		
+		cpAssertSaneBody(body);
+	}
+}
+
+void
+cpBodyArrayUpdatePosition(cpArray *bodies, cpFloat dt)
+{
+#if CP_USE_SSE2
+	cpSSE2Vect dt2 = cpSSE2Set1(dt);
+#endif
+	
+	for(int i=0; i<bodies->num; i++){
+		cpBody *body = (cpBody *)bodies->arr[i];
+		if(body->position_func != cpBodyUpdatePosition){
+			body->position_func(body, dt);
+			continue;
+		}
+		
+		// Same as cpBodyUpdatePosition().
+	#if CP_USE_SSE2
+		cpSSE2Vect p = cpSSE2Load(&body->p.x);
+		cpSSE2Vect v = cpSSE2Add(cpSSE2Load(&body->v.x), cpSSE2Load(&body->v_bias.x));
+		cpSSE2Store(&body->p.x, cpSSE2Add(p, cpSSE2Mul(v, dt2)));
+	#else
+		body->p = cpvadd(body->p, cpvmult(cpvadd(body->v, body->v_bias), dt));
+	#endif
+		cpFloat a = SetAngle(body, body->a + (body->w + body->w_bias)*dt);
+		SetTransform(body, body->p, a);
+		
+		body->v_bias = cpvzero;
+		body->w_bias = 0.0f;
+		
+		cpAssertSaneBody(body);
+	}
+}
+
 cpVect
 cpBodyLocalToWorld(const cpBody *body, const cpVect point)
 {
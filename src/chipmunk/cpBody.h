@@ -148,6 +148,16 @@ CP_EXPORT void cpBodyUpdateVelocity(cpBody *body, cpVect gravity, cpFloat dampin
 /// Default position integration function.
 CP_EXPORT void cpBodyUpdatePosition(cpBody *body, cpFloat dt);
 
+/// Position integration function for fast bodies, which would otherwise pass through thin shapes between steps.
+/// Sweeps the body's center of gravity as a circle of its sweep radius against the space's shapes, stopping the body
+/// where it would first hit one so the step collides with it. Costs a segment query per step the body moves further than the radius.
+CP_EXPORT void cpBodyUpdatePositionSwept(cpBody *body, cpFloat dt);
+/// Get the radius cpBodyUpdatePositionSwept() sweeps the body as.
+CP_EXPORT cpFloat cpBodyGetSweepRadius(const cpBody *body);
+/// Set the radius cpBodyUpdatePositionSwept() sweeps the body as, somewhat less than the smallest distance from its
+/// center of gravity to the edge of its shapes so resting contacts aren't swept against.
+CP_EXPORT void cpBodySetSweepRadius(cpBody *body, cpFloat radius);
+
 /// Convert body relative/local coordinates to absolute/world coordinates.
 CP_EXPORT cpVect cpBodyLocalToWorld(const cpBody *body, const cpVect point);
 /// Convert body absolute/world coordinates to  relative/local coordinates.
@@ -36,6 +36,7 @@ struct cpHashSet {
 	
 	cpHashSetBin **table;
 	cpHashSetBin *pooledBins;
+	unsigned int pooledCount;
 	
 	cpArray *allocatedBuffers;
 };
@@ -66,6 +67,7 @@ cpHashSetNew(int size, cpHashSetEqlFunc eqlFunc)
 	
 	set->table = (cpHashSetBin **)cpcalloc(set->size, sizeof(cpHashSetBin *));
 	set->pooledBins = NULL;
+	set->pooledCount = 0;
 	
 	set->allocatedBuffers = cpArrayNew(0);
 	
@@ -85,10 +87,10 @@ setIsFull(cpHashSet *set)
 }
 
 static void
-cpHashSetResize(cpHashSet *set)
+cpHashSetResize(cpHashSet *set, unsigned int minSize)
 {
 	// Get the next approximate doubled prime.
-	unsigned int newSize = next_prime(set->size + 1);
+	unsigned int newSize = next_prime(minSize);
 	// Allocate a new table.
 	cpHashSetBin **newTable = (cpHashSetBin **)cpcalloc(newSize, sizeof(cpHashSetBin *));
 	
@@ -118,29 +120,44 @@ recycleBin(cpHashSet *set, cpHashSetBin *bin)
 {
 	bin->next = set->pooledBins;
 	set->pooledBins = bin;
+	set->pooledCount++;
 	bin->elt = NULL;
 }
 
+static void
+growBinPool(cpHashSet *set)
+{
+	int count = CP_BUFFER_BYTES/sizeof(cpHashSetBin);
+	cpAssertHard(count, "Internal Error: Buffer size is too small.");
+	
+	cpHashSetBin *buffer = (cpHashSetBin *)cpcalloc(1, CP_BUFFER_BYTES);
+	cpArrayPush(set->allocatedBuffers, buffer);
+	
+	for(int i=0; i<count; i++) recycleBin(set, buffer + i);
+}
+
 static cpHashSetBin *
 getUnusedBin(cpHashSet *set)
 {
 	cpHashSetBin *bin = set->pooledBins;
 	
-	if(bin){
-		set->pooledBins = bin->next;
-		return bin;
-	} else {
+	if(!bin){
 		// Pool is exhausted, make more
-		int count = CP_BUFFER_BYTES/sizeof(cpHashSetBin);
-		cpAssertHard(count, "Internal Error: Buffer size is too small.");
-		
-		cpHashSetBin *buffer = (cpHashSetBin *)cpcalloc(1, CP_BUFFER_BYTES);
-		cpArrayPush(set->allocatedBuffers, buffer);
-		
-		// push all but the first one, return it instead
-		for(int i=1; i<count; i++) recycleBin(set, buffer + i);
-		return buffer;
+		growBinPool(set);
+		bin = set->pooledBins;
 	}
+	
+	set->pooledBins = bin->next;
+	set->pooledCount--;
+	return bin;
+}
+
+// Size the table and pool bins so the set holds at least count entries without allocating.
+void
+cpHashSetReserve(cpHashSet *set, int count)
+{
+	if(set->size < (unsigned int)count) cpHashSetResize(set, count);
+	while(set->entries + set->pooledCount < (unsigned int)count) growBinPool(set);
 }
 
 int
@@ -169,7 +186,7 @@ cpHashSetInsert(cpHashSet *set, cpHashValue hash, const void *ptr, cpHashSetTran
 		set->table[idx] = bin;
 		
 		set->entries++;
-		if(setIsFull(set)) cpHashSetResize(set);
+		if(setIsFull(set)) cpHashSetResize(set, set->size + 1);
 	}
 	
 	return bin->elt;
@@ -380,14 +380,29 @@ cpArbiterApplyImpulse_NEON(cpArbiter *arb)
 // If you are using a ridiculous number of iterations it could help though.
 #define MAX_THREADS 2
 
+// Dispatched workers aren't threads of the space's own, and scale further with the colored solver.
+#define MAX_DISPATCH_THREADS 16
+
+// Colors the colored solver groups contacts and constraints into, one bit each in cpBody.solverColors.
+// Anything that fits none of them goes in one more group, solved serially after the rest.
+#define MAX_COLORS 32
+
+// Fewest broadphase pairs worth waking the workers to narrowphase.
+#define NARROWPHASE_PAIR_THRESHOLD 128
+
+// A broadphase pair, and its contacts once narrowphase has run on a worker.
+struct NarrowphasePair {
+	cpShape *a, *b;
+	struct cpCollisionInfo info;
+	struct cpContact contacts[CP_MAX_CONTACTS_PER_ARBITER];
+};
+
 struct ThreadContext {
 	pthread_t thread;
 	cpHastySpace *space;
 	unsigned long thread_num;
 };
 
-typedef	void (*cpHastySpaceWorkFunction)(cpSpace *space, unsigned long worker, unsigned long worker_count);
-
 struct cpHastySpace {
 	cpSpace space;
 	
@@ -406,6 +421,25 @@ struct cpHastySpace {
 	// Work function to invoke.
 	cpHastySpaceWorkFunction work;
 	
+	// Runs the workers on an external thread pool instead of the threads below, if not NULL.
+	cpHastySpaceDispatchFunction dispatch;
+	void *dispatch_data;
+	
+	// Colored solver state: the arbiters and constraints of each color, plus the serial leftovers, and the color being solved.
+	cpBool colored, deterministic;
+	cpArray *color_arbiters[MAX_COLORS + 1];
+	cpArray *color_constraints[MAX_COLORS + 1];
+	int solve_color;
+	
+	// Broadphase pairs of the current step, narrowphased across the workers.
+	struct NarrowphasePair *pairs;
+	int pair_count, pair_capacity;
+	
+	// Phase timing, if clock is not NULL: the time the current phase began and the totals to add to.
+	cpHastySpaceClockFunction phase_clock;
+	unsigned long long *phase_times;
+	unsigned long long phase_start;
+	
 	struct ThreadContext workers[MAX_THREADS - 1];
 };
 
@@ -437,9 +471,15 @@ WorkerThreadLoop(struct ThreadContext *context)
 	return NULL;
 }
 
+// Worker count only applies to dispatched workers; the space's own threads always all run.
 static void
-RunWorkers(cpHastySpace *hasty, cpHastySpaceWorkFunction func)
+RunWorkers(cpHastySpace *hasty, cpHastySpaceWorkFunction func, unsigned long worker_count)
 {
+	if(hasty->dispatch){
+		hasty->dispatch((cpSpace *)hasty, func, worker_count, hasty->dispatch_data);
+		return;
+	}
+	
 	hasty->num_working = hasty->num_threads - 1;
 	hasty->work = func;
 	
@@ -462,6 +502,16 @@ RunWorkers(cpHastySpace *hasty, cpHastySpaceWorkFunction func)
 	hasty->work = NULL;
 }
 
+static inline void
+ApplyArbiterImpulse(cpArbiter *arb)
+{
+#ifdef __ARM_NEON__
+	cpArbiterApplyImpulse_NEON(arb);
+#else
+	cpArbiterApplyImpulse(arb);
+#endif
+}
+
 static void
 Solver(cpSpace *space, unsigned long worker, unsigned long worker_count)
 {
@@ -473,12 +523,7 @@ Solver(cpSpace *space, unsigned long worker, unsigned long worker_count)
 	
 	for(unsigned long i=0; i<iterations; i++){
 		for(int j=0; j<arbiters->num; j++){
-			cpArbiter *arb = (cpArbiter *)arbiters->arr[j];
-			#ifdef __ARM_NEON__
-				cpArbiterApplyImpulse_NEON(arb);
-			#else
-				cpArbiterApplyImpulse(arb);
-			#endif
+			ApplyArbiterImpulse((cpArbiter *)arbiters->arr[j]);
 		}
 			
 		for(int j=0; j<constraints->num; j++){
@@ -488,11 +533,243 @@ Solver(cpSpace *space, unsigned long worker, unsigned long worker_count)
 	}
 }
 
+//MARK: Parallel Narrowphase
+
+// Broadphase callback recording pairs instead of colliding them.
+// The index's own collision ID can't be updated once the pairs are collided later, so the arbiter keeps it instead.
+static cpCollisionID
+CollectPair(cpShape *a, cpShape *b, cpCollisionID id, cpHastySpace *hasty)
+{
+	if(hasty->pair_count == hasty->pair_capacity){
+		hasty->pair_capacity = (hasty->pair_capacity ? hasty->pair_capacity*2 : 256);
+		hasty->pairs = (struct NarrowphasePair *)cprealloc(hasty->pairs, hasty->pair_capacity*sizeof(struct NarrowphasePair));
+	}
+	
+	struct NarrowphasePair *pair = hasty->pairs + hasty->pair_count++;
+	pair->a = a;
+	pair->b = b;
+	return id;
+}
+
+// Collide one slice of the pairs into their own contacts. The arbiter set is only read here.
+static void
+NarrowphaseWorker(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	unsigned long count = (unsigned long)hasty->pair_count;
+	unsigned long begin = count*worker/worker_count;
+	unsigned long end = count*(worker + 1)/worker_count;
+	for(unsigned long i=begin; i<end; i++){
+		struct NarrowphasePair *pair = hasty->pairs + i;
+		const cpShape *shape_pair[] = {pair->a, pair->b};
+		cpArbiter *arb = (cpArbiter *)cpHashSetFind(space->cachedArbiters, CP_HASH_SHAPE_PAIR(pair->a, pair->b), shape_pair);
+		pair->info = cpSpaceCollidePair(pair->a, pair->b, (arb ? arb->collisionID : 0), pair->contacts);
+	}
+}
+
+// Orders pairs by their shapes' ids, once each pair has its lower id first.
+static int
+PairOrder(const void *a, const void *b)
+{
+	const struct NarrowphasePair *pa = (const struct NarrowphasePair *)a, *pb = (const struct NarrowphasePair *)b;
+	cpHashValue a0 = pa->a->hashid, a1 = pa->b->hashid, b0 = pb->a->hashid, b1 = pb->b->hashid;
+	if(a0 != b0) return (a0 < b0 ? -1 : 1);
+	return (a1 < b1 ? -1 : (a1 > b1));
+}
+
+// Broadphase, then narrowphase in parallel, then merge arbiters in the broadphase's order so results stay the same.
+// A deterministic space sorts the pairs first, since the order a tree finds them in and which way round depend on
+// how it was built, which neither a restored snapshot nor optimizing the tree reproduces. Which way round a pair is
+// collided changes a new arbiter's contacts.
+// Charge the time since the last mark to phase.
+static inline void
+MarkPhase(cpHastySpace *hasty, cpHastySpacePhase phase)
+{
+	if(hasty->phase_clock){
+		unsigned long long now = hasty->phase_clock();
+		hasty->phase_times[phase] += now - hasty->phase_start;
+		hasty->phase_start = now;
+	}
+}
+
+static void
+CollideShapes(cpHastySpace *hasty)
+{
+	cpSpace *space = (cpSpace *)hasty;
+	hasty->pair_count = 0;
+	cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)CollectPair, hasty);
+	if(hasty->deterministic){
+		for(int i=0; i<hasty->pair_count; i++){
+			struct NarrowphasePair *pair = hasty->pairs + i;
+			if(pair->a->hashid > pair->b->hashid){cpShape *a = pair->a; pair->a = pair->b; pair->b = a;}
+		}
+		qsort(hasty->pairs, hasty->pair_count, sizeof(struct NarrowphasePair), PairOrder);
+	}
+	MarkPhase(hasty, CP_HASTY_PHASE_BROADPHASE);
+	
+	if(hasty->pair_count > NARROWPHASE_PAIR_THRESHOLD){
+		RunWorkers(hasty, NarrowphaseWorker, hasty->num_threads);
+	} else {
+		NarrowphaseWorker(space, 0, 1);
+	}
+	
+	for(int i=0; i<hasty->pair_count; i++){
+		struct NarrowphasePair *pair = hasty->pairs + i;
+		if(pair->info.count) cpSpaceAddCollision(space, &pair->info);
+	}
+	MarkPhase(hasty, CP_HASTY_PHASE_NARROWPHASE);
+}
+
+//MARK: Colored Solver
+
+// Static and kinematic bodies take no impulse, so contacts that share only those can be solved at the same time.
+// (Solving still stores their unchanged velocities, which is harmless.)
+static inline unsigned int
+BodyColors(cpBody *body)
+{
+	return (cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC ? body->solverColors : 0);
+}
+
+// Lowest color neither body has used yet, marking it used by both, or MAX_COLORS if none is left.
+static int
+ColorPair(cpBody *a, cpBody *b)
+{
+	unsigned int used = BodyColors(a) | BodyColors(b);
+	for(int color=0; color<MAX_COLORS; color++){
+		unsigned int bit = 1u << color;
+		if(!(used & bit)){
+			a->solverColors |= bit;
+			b->solverColors |= bit;
+			return color;
+		}
+	}
+	
+	return MAX_COLORS;
+}
+
+// Greedily color this step's contact graph. Bodies visited in the same order give the same colors every run.
+static void
+ColorGraph(cpHastySpace *hasty)
+{
+	cpArray *arbiters = hasty->space.arbiters;
+	cpArray *constraints = hasty->space.constraints;
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		arb->body_a->solverColors = arb->body_b->solverColors = 0;
+	}
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		constraint->a->solverColors = constraint->b->solverColors = 0;
+	}
+	
+	for(int color=0; color<=MAX_COLORS; color++){
+		hasty->color_arbiters[color]->num = 0;
+		hasty->color_constraints[color]->num = 0;
+	}
+	
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		cpArrayPush(hasty->color_arbiters[ColorPair(arb->body_a, arb->body_b)], arb);
+	}
+	for(int i=0; i<constraints->num; i++){
+		cpConstraint *constraint = (cpConstraint *)constraints->arr[i];
+		cpArrayPush(hasty->color_constraints[ColorPair(constraint->a, constraint->b)], constraint);
+	}
+}
+
+// Solve one slice of the current color. Nothing in a color shares a dynamic body, so slices need no locks.
+static void
+ColorSolver(cpSpace *space, unsigned long worker, unsigned long worker_count)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	cpArray *arbiters = hasty->color_arbiters[hasty->solve_color];
+	cpArray *constraints = hasty->color_constraints[hasty->solve_color];
+	cpFloat dt = space->curr_dt;
+	
+	unsigned long count = (unsigned long)(arbiters->num + constraints->num);
+	unsigned long begin = count*worker/worker_count;
+	unsigned long end = count*(worker + 1)/worker_count;
+	for(unsigned long i=begin; i<end; i++){
+		if(i < (unsigned long)arbiters->num){
+			ApplyArbiterImpulse((cpArbiter *)arbiters->arr[i]);
+		} else {
+			cpConstraint *constraint = (cpConstraint *)constraints->arr[i - arbiters->num];
+			constraint->klass->applyImpulse(constraint, dt);
+		}
+	}
+}
+
+static void
+SolveColored(cpHastySpace *hasty)
+{
+	ColorGraph(hasty);
+	
+	for(int i=0; i<hasty->space.iterations; i++){
+		for(int color=0; color<=MAX_COLORS; color++){
+			unsigned long count = (unsigned long)(hasty->color_arbiters[color]->num + hasty->color_constraints[color]->num);
+			if(count == 0) continue;
+			
+			// Colors too small to be worth waking the workers for, and the leftovers, are solved on this thread.
+			hasty->solve_color = color;
+			if(color < MAX_COLORS && count > hasty->constraint_count_threshold){
+				RunWorkers(hasty, ColorSolver, hasty->num_threads);
+			} else {
+				ColorSolver((cpSpace *)hasty, 0, 1);
+			}
+		}
+	}
+}
+
+void
+cpHastySpaceSetColoredSolver(cpSpace *space, cpBool colored)
+{
+	((cpHastySpace *)space)->colored = colored;
+}
+
+void
+cpHastySpaceSetDeterministic(cpSpace *space, cpBool deterministic)
+{
+	((cpHastySpace *)space)->deterministic = deterministic;
+}
+
+cpBool
+cpHastySpaceGetDeterministic(cpSpace *space)
+{
+	return ((cpHastySpace *)space)->deterministic;
+}
+
+void
+cpHastySpaceReserve(cpSpace *space, int arbiters, int contacts)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	cpSpaceReserve(space, arbiters, contacts);
+	
+	// The broadphase finds more pairs than collide, so leave room past both the hint and the last step's count.
+	int pairs = arbiters*3/2;
+	if(pairs < hasty->pair_count + hasty->pair_count/4) pairs = hasty->pair_count + hasty->pair_count/4;
+	if(pairs > hasty->pair_capacity){
+		hasty->pair_capacity = pairs;
+		hasty->pairs = (struct NarrowphasePair *)cprealloc(hasty->pairs, hasty->pair_capacity*sizeof(struct NarrowphasePair));
+	}
+	
+	// How arbiters split between colors shifts as piles settle, so each color keeps generous room past what it held last step.
+	for(int color=0; color<=MAX_COLORS; color++){
+		cpArray *color_arbiters = hasty->color_arbiters[color];
+		cpArray *color_constraints = hasty->color_constraints[color];
+		cpArrayReserve(color_arbiters, color_arbiters->num + color_arbiters->num/2 + 16);
+		cpArrayReserve(color_constraints, color_constraints->num + color_constraints->num/2 + 16);
+	}
+}
+
 //MARK: Thread Management Functions
 
 static void
 HaltThreads(cpHastySpace *hasty)
 {
+	// Dispatched workers run on threads the space doesn't own.
+	if(hasty->dispatch) return;
+	
 	pthread_mutex_t *mutex = &hasty->mutex;
 	pthread_mutex_lock(mutex); {
 		hasty->work = NULL; // NULL work function means break and exit
@@ -525,11 +802,12 @@ cpHastySpaceSetThreads(cpSpace *space, unsigned long threads)
 	if(threads == 0) threads = 1;
 #endif
 	
-	hasty->num_threads = (threads < MAX_THREADS ? threads : MAX_THREADS);
+	unsigned long max_threads = (hasty->dispatch ? MAX_DISPATCH_THREADS : MAX_THREADS);
+	hasty->num_threads = (threads < max_threads ? threads : max_threads);
 	hasty->num_working = hasty->num_threads - 1;
 	
 	// Create the worker threads and wait for them to signal ready.
-	if(hasty->num_working > 0){
+	if(hasty->num_working > 0 && !hasty->dispatch){
 		pthread_mutex_lock(&hasty->mutex);
 		for(unsigned long i=0; i<(hasty->num_threads-1); i++){
 			hasty->workers[i].space = hasty;
@@ -543,6 +821,28 @@ cpHastySpaceSetThreads(cpSpace *space, unsigned long threads)
 	}
 }
 
+void
+cpHastySpaceSetPhaseTimer(cpSpace *space, cpHastySpaceClockFunction clock, unsigned long long *times)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	hasty->phase_clock = (times ? clock : NULL);
+	hasty->phase_times = times;
+}
+
+void
+cpHastySpaceSetDispatch(cpSpace *space, cpHastySpaceDispatchFunction func, void *data)
+{
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	unsigned long threads = hasty->num_threads;
+	HaltThreads(hasty);
+	
+	// Restart with the same number of workers, now running wherever func puts them.
+	hasty->num_threads = 1;
+	hasty->dispatch = func;
+	hasty->dispatch_data = data;
+	cpHastySpaceSetThreads(space, threads);
+}
+
 unsigned long
 cpHastySpaceGetThreads(cpSpace *space)
 {
@@ -564,6 +864,11 @@ cpHastySpaceNew(void)
 	// TODO magic number, should test this more thoroughly.
 	hasty->constraint_count_threshold = 50;
 	
+	for(int color=0; color<=MAX_COLORS; color++){
+		hasty->color_arbiters[color] = cpArrayNew(0);
+		hasty->color_constraints[color] = cpArrayNew(0);
+	}
+	
 	// Default to 1 thread for determinism.
 	hasty->num_threads = 1;
 	cpHastySpaceSetThreads((cpSpace *)hasty, 1);
@@ -582,6 +887,12 @@ cpHastySpaceFree(cpSpace *space)
 	pthread_cond_destroy(&hasty->cond_work);
 	pthread_cond_destroy(&hasty->cond_resume);
 	
+	cpfree(hasty->pairs);
+	for(int color=0; color<=MAX_COLORS; color++){
+		cpArrayFree(hasty->color_arbiters[color]);
+		cpArrayFree(hasty->color_constraints[color]);
+	}
+	
 	cpSpaceFree(space);
 }
 
@@ -591,6 +902,9 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 	// don't step if the timestep is 0!
 	if(dt == 0.0f) return;
 	
+	cpHastySpace *hasty = (cpHastySpace *)space;
+	if(hasty->phase_clock) hasty->phase_start = hasty->phase_clock();
+	
 	space->stamp++;
 	
 	cpFloat prev_dt = space->curr_dt;
@@ -614,23 +928,23 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 	
 	cpSpaceLock(space); {
 		// Integrate positions
-		for(int i=0; i<bodies->num; i++){
-			cpBody *body = (cpBody *)bodies->arr[i];
-			body->position_func(body, dt);
-		}
+		cpBodyArrayUpdatePosition(bodies, dt);
+		MarkPhase(hasty, CP_HASTY_PHASE_INTEGRATE);
 		
 		// Find colliding pairs.
 		cpSpacePushFreshContactBuffer(space);
 		cpSpatialIndexEach(space->dynamicShapes, (cpSpatialIndexIteratorFunc)cpShapeUpdateFunc, NULL);
-		cpSpatialIndexReindexQuery(space->dynamicShapes, (cpSpatialIndexQueryFunc)cpSpaceCollideShapes, space);
+		CollideShapes(hasty);
 	} cpSpaceUnlock(space, cpFalse);
 	
 	// Rebuild the contact graph (and detect sleeping components if sleeping is enabled)
 	cpSpaceProcessComponents(space, dt);
+	MarkPhase(hasty, CP_HASTY_PHASE_INTEGRATE);
 	
 	cpSpaceLock(space); {
 		// Clear out old cached arbiters and call separate callbacks
 		cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)cpSpaceArbiterSetFilter, space);
+		MarkPhase(hasty, CP_HASTY_PHASE_NARROWPHASE);
 
 		// Prestep the arbiters and constraints.
 		cpFloat slop = space->collisionSlop;
@@ -648,13 +962,13 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			constraint->klass->preStep(constraint, dt);
 		}
 	
+		MarkPhase(hasty, CP_HASTY_PHASE_SOLVER);
+		
 		// Integrate velocities.
 		cpFloat damping = cpfpow(space->damping, dt);
 		cpVect gravity = space->gravity;
-		for(int i=0; i<bodies->num; i++){
-			cpBody *body = (cpBody *)bodies->arr[i];
-			body->velocity_func(body, gravity, damping, dt);
-		}
+		cpBodyArrayUpdateVelocity(bodies, gravity, damping, dt);
+		MarkPhase(hasty, CP_HASTY_PHASE_INTEGRATE);
 		
 		// Apply cached impulses
 		cpFloat dt_coef = (prev_dt == 0.0f ? 0.0f : dt/prev_dt);
@@ -668,9 +982,11 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 		}
 		
 		// Run the impulse solver.
-		cpHastySpace *hasty = (cpHastySpace *)space;
-		if((unsigned long)(arbiters->num + constraints->num) > hasty->constraint_count_threshold){
-			RunWorkers(hasty, Solver);
+		if(hasty->colored || hasty->deterministic){
+			SolveColored(hasty);
+		} else if((unsigned long)(arbiters->num + constraints->num) > hasty->constraint_count_threshold){
+			// Splitting iterations stops helping past MAX_THREADS workers.
+			RunWorkers(hasty, Solver, (hasty->num_threads < MAX_THREADS ? hasty->num_threads : MAX_THREADS));
 		} else {
 			Solver(space, 0, 1);
 		}
@@ -690,5 +1006,6 @@ cpHastySpaceStep(cpSpace *space, cpFloat dt)
 			cpCollisionHandler *handler = arb->handler;
 			handler->postSolveFunc(arb, space, handler->userData);
 		}
+		MarkPhase(hasty, CP_HASTY_PHASE_SOLVER);
 	} cpSpaceUnlock(space, cpTrue);
 }
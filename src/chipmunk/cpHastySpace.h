@@ -25,3 +25,49 @@ CP_EXPORT unsigned long cpHastySpaceGetThreads(cpSpace *space);
 
 /// When stepping a hasty space, you must use this function.
 CP_EXPORT void cpHastySpaceStep(cpSpace *space, cpFloat dt);
+
+/// Solve with contacts and constraints grouped into colors that share no dynamic bodies, solving each color across the workers.
+/// Unlike the default solver, which splits iterations between threads and is limited to 2, this scales with the worker
+/// count and gives the same results whatever it is. Off by default.
+CP_EXPORT void cpHastySpaceSetColoredSolver(cpSpace *space, cpBool colored);
+
+/// Step identically whatever the thread count, by always using the colored solver. Off by default.
+/// Identical runs also need the same floating point environment on every thread that steps the space, which is up to the caller.
+CP_EXPORT void cpHastySpaceSetDeterministic(cpSpace *space, cpBool deterministic);
+
+/// Returns whether the space steps identically whatever the thread count.
+CP_EXPORT cpBool cpHastySpaceGetDeterministic(cpSpace *space);
+
+/// Preallocate for steps with up to @c arbiters colliding shape pairs and @c contacts contacts, as cpSpaceReserve() does.
+/// Also sizes the space's own pair and color storage, with room past what the last step used.
+CP_EXPORT void cpHastySpaceReserve(cpSpace *space, int arbiters, int contacts);
+
+/// Work run by each of the solver's workers, numbered from 0 to worker_count - 1.
+typedef void (*cpHastySpaceWorkFunction)(cpSpace *space, unsigned long worker, unsigned long worker_count);
+
+/// Runs work(space, worker, worker_count) for every worker at once, returning when all have finished.
+typedef void (*cpHastySpaceDispatchFunction)(cpSpace *space, cpHastySpaceWorkFunction work, unsigned long worker_count, void *data);
+
+/// Hand the solver's workers to an external thread pool instead of threads owned by the space.
+/// The thread count still sets how many workers are dispatched, up to 16 rather than 2. Passing NULL goes back to the space's own threads.
+CP_EXPORT void cpHastySpaceSetDispatch(cpSpace *space, cpHastySpaceDispatchFunction func, void *data);
+
+/// Phases of a step, as timed by cpHastySpaceSetPhaseTimer().
+typedef enum cpHastySpacePhase {
+	/// Integrating positions and velocities, and rebuilding the contact graph and sleeping sets.
+	CP_HASTY_PHASE_INTEGRATE,
+	/// Updating shape bounds and finding overlapping pairs in the spatial index.
+	CP_HASTY_PHASE_BROADPHASE,
+	/// Colliding the overlapping pairs and caching their arbiters.
+	CP_HASTY_PHASE_NARROWPHASE,
+	/// Prestepping, applying cached impulses and iterating contacts and constraints.
+	CP_HASTY_PHASE_SOLVER,
+	CP_HASTY_PHASE_COUNT,
+} cpHastySpacePhase;
+
+/// Reads a monotonic clock in any units.
+typedef unsigned long long (*cpHastySpaceClockFunction)(void);
+
+/// Time the phases of every step with clock, adding each phase's elapsed time to @c times[phase].
+/// @c times must hold CP_HASTY_PHASE_COUNT values and stay valid while set. Passing NULL stops timing.
+CP_EXPORT void cpHastySpaceSetPhaseTimer(cpSpace *space, cpHastySpaceClockFunction clock, unsigned long long *times);
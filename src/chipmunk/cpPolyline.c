@@ -593,50 +593,68 @@ DeepestNotch(int count, cpVect *verts, int hullCount, cpVect *hullVerts, int fir
 	return notch;
 }
 
-static inline int IMAX(int a, int b){return (a > b ? a : b);}
-
+// Each split recurses on the smaller piece and carries on with the larger, so the recursion stays shallow enough for a
+// job's fiber stack, and scratch comes from the heap rather than alloca() for the same reason.
+// A polygon touching itself, as marched outlines do at diagonal pixels, can make splits that never shrink it; once
+// more of those have been made in a row than the piece has vertexes, its hull is taken instead.
 static void
 ApproximateConcaveDecomposition(cpVect *verts, int count, cpFloat tol, cpPolylineSet *set)
 {
-	int first;
-	cpVect *hullVerts = (cpVect*) alloca(count*sizeof(cpVect));
-	int hullCount = cpConvexHull(count, verts, hullVerts, &first, 0.0);
-	
-	if(hullCount != count){
-		struct Notch notch = DeepestNotch(count, verts, hullCount, hullVerts, first, tol);
+	cpVect *piece = (cpVect*) cpcalloc(count, sizeof(cpVect));
+	memcpy(piece, verts, count*sizeof(cpVect));
+	cpVect *hullVerts = (cpVect*) cpcalloc(count, sizeof(cpVect));
+	int stalls = 0;
+	
+	for(;;){
+		int first;
+		int hullCount = cpConvexHull(count, piece, hullVerts, &first, 0.0);
+		
+		cpFloat steiner_it = -1.0;
+		struct Notch notch;
+		if(hullCount != count && stalls <= count){
+			notch = DeepestNotch(count, piece, hullCount, hullVerts, first, tol);
+			if(notch.d > tol) steiner_it = FindSteiner(count, piece, notch);
+		}
 		
-		if(notch.d > tol){
-			cpFloat steiner_it = FindSteiner(count, verts, notch);
+		if(steiner_it < 0.0){
+			cpPolyline *hull = cpPolylineMake(hullCount + 1);
 			
-			if(steiner_it >= 0.0){
-				int steiner_i = (int)steiner_it;
-				cpVect steiner = cpvlerp(verts[steiner_i], verts[Next(steiner_i, count)], steiner_it - steiner_i);
-				
-				// Vertex counts NOT including the steiner point.
-				int sub1_count = (steiner_i - notch.i + count)%count + 1;
-				int sub2_count = count - (steiner_i - notch.i + count)%count;
-				cpVect *scratch = (cpVect*) alloca((IMAX(sub1_count, sub2_count) + 1)*sizeof(cpVect));
-				
-				for(int i=0; i<sub1_count; i++) scratch[i] = verts[(notch.i + i)%count];
-				scratch[sub1_count] = steiner;
-				ApproximateConcaveDecomposition(scratch, sub1_count + 1, tol, set);
-				
-				for(int i=0; i<sub2_count; i++) scratch[i] = verts[(steiner_i + 1 + i)%count];
-				scratch[sub2_count] = steiner;
-				ApproximateConcaveDecomposition(scratch, sub2_count + 1, tol, set);
-				
-				return;
-			}
+			memcpy(hull->verts, hullVerts, hullCount*sizeof(cpVect));
+			hull->verts[hullCount] = hullVerts[0];
+			hull->count = hullCount + 1;
+			cpPolylineSetPush(set, hull);
+			break;
 		}
+		
+		int steiner_i = (int)steiner_it;
+		cpVect steiner = cpvlerp(piece[steiner_i], piece[Next(steiner_i, count)], steiner_it - steiner_i);
+		
+		// Vertex counts NOT including the steiner point.
+		int sub1_count = (steiner_i - notch.i + count)%count + 1;
+		int sub2_count = count - (steiner_i - notch.i + count)%count;
+		cpVect *sub1 = (cpVect*) cpcalloc(sub1_count + 1, sizeof(cpVect));
+		cpVect *sub2 = (cpVect*) cpcalloc(sub2_count + 1, sizeof(cpVect));
+		
+		for(int i=0; i<sub1_count; i++) sub1[i] = piece[(notch.i + i)%count];
+		sub1[sub1_count] = steiner;
+		for(int i=0; i<sub2_count; i++) sub2[i] = piece[(steiner_i + 1 + i)%count];
+		sub2[sub2_count] = steiner;
+		
+		cpBool first_smaller = (sub1_count <= sub2_count);
+		ApproximateConcaveDecomposition(first_smaller ? sub1 : sub2, (first_smaller ? sub1_count : sub2_count) + 1, tol, set);
+		cpfree(first_smaller ? sub1 : sub2);
+		
+		int larger_count = (first_smaller ? sub2_count : sub1_count) + 1;
+		stalls = (larger_count >= count ? stalls + 1 : 0);
+		cpfree(piece);
+		cpfree(hullVerts);
+		piece = (first_smaller ? sub2 : sub1);
+		count = larger_count;
+		hullVerts = (cpVect*) cpcalloc(count, sizeof(cpVect));
 	}
 	
-	cpPolyline *hull = cpPolylineMake(hullCount + 1);
-	
-	memcpy(hull->verts, hullVerts, hullCount*sizeof(cpVect));
-	hull->verts[hullCount] = hullVerts[0];
-	hull->count = hullCount + 1;
-	
-	cpPolylineSetPush(set, hull);
+	cpfree(hullVerts);
+	cpfree(piece);
 }
 
 cpPolylineSet *
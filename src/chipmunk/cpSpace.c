@@ -154,6 +154,8 @@ cpSpaceInit(cpSpace *space)
 	
 	space->sleepTimeThreshold = INFINITY;
 	space->idleSpeedThreshold = 0.0f;
+	space->sleepFunc = NULL;
+	space->sleepData = NULL;
 	
 	space->arbiters = cpArrayNew(0);
 	space->pooledArbiters = cpArrayNew(0);
@@ -299,6 +301,13 @@ cpSpaceSetSleepTimeThreshold(cpSpace *space, cpFloat sleepTimeThreshold)
 	space->sleepTimeThreshold = sleepTimeThreshold;
 }
 
+void
+cpSpaceSetSleepCallback(cpSpace *space, cpSpaceSleepFunc func, void *data)
+{
+	space->sleepFunc = func;
+	space->sleepData = data;
+}
+
 cpFloat
 cpSpaceGetCollisionSlop(const cpSpace *space)
 {
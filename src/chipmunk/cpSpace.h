@@ -186,6 +186,32 @@ typedef void (*cpPostStepFunc)(cpSpace *space, void *key, void *data);
 /// It's possible to pass @c NULL for @c func if you only want to mark @c key as being used.
 CP_EXPORT cpBool cpSpaceAddPostStepCallback(cpSpace *space, cpPostStepFunc func, void *key, void *data);
 
+//MARK: Capacity
+
+/// Preallocate everything stepping grows, so steps with up to @c arbiters colliding shape pairs and @c contacts contacts allocate nothing.
+/// Storage only grows, so a space that has reached its peak load stops allocating anyway; this moves the growth out of a step.
+CP_EXPORT void cpSpaceReserve(cpSpace *space, int arbiters, int contacts);
+
+//MARK: Snapshots
+
+/// Save the state stepping changes, of every non-static body and every cached arbiter with its contacts,
+/// into @c buffer if it's at least @c size bytes. Returns the bytes the snapshot needs, whether or not they fit.
+CP_EXPORT size_t cpSpaceSaveSnapshot(cpSpace *space, void *buffer, size_t size);
+/// Put the space back into the state saved in a snapshot, without creating or destroying bodies or shapes, so stepping
+/// again from it steps as it did the first time. Bodies and shapes must not have been added or removed since it was saved.
+/// Bodies asleep when it was saved but woken since stay awake, so rolling back is only exact with sleeping disabled.
+/// Returns false, changing nothing, if the snapshot doesn't match the space.
+CP_EXPORT cpBool cpSpaceRestoreSnapshot(cpSpace *space, const void *buffer, size_t size);
+
+//MARK: Sleep Callbacks
+
+/// Sleep callback function type, called with @c sleeping true as a dynamic body falls asleep and false as it wakes.
+typedef void (*cpSpaceSleepFunc)(cpSpace *space, cpBody *body, cpBool sleeping, void *data);
+/// Set a callback to call as each dynamic body in the space falls asleep or wakes up, or @c NULL for none.
+/// Bodies fall asleep while the space is locked in cpSpaceStep(), so the callback must not add or remove anything.
+/// Bodies woken while the space is locked are reported once it unlocks.
+CP_EXPORT void cpSpaceSetSleepCallback(cpSpace *space, cpSpaceSleepFunc func, void *data);
+
 
 //MARK: Queries
 
@@ -61,7 +61,7 @@ cpSpaceActivateBody(cpSpace *space, cpBody *body)
 				// Reinsert the arbiter into the arbiter cache
 				const cpShape *a = arb->a, *b = arb->b;
 				const cpShape *shape_pair[] = {a, b};
-				cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)a, (cpHashValue)b);
+				cpHashValue arbHashID = CP_HASH_SHAPE_PAIR(a, b);
 				cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, NULL, arb);
 				
 				// Update the arbiter's state
@@ -76,6 +76,8 @@ cpSpaceActivateBody(cpSpace *space, cpBody *body)
 			cpBody *bodyA = constraint->a;
 			if(body == bodyA || cpBodyGetType(bodyA) == CP_BODY_TYPE_STATIC) cpArrayPush(space->constraints, constraint);
 		}
+		
+		if(space->sleepFunc) space->sleepFunc(space, body, cpFalse, space->sleepData);
 	}
 }
 
@@ -108,6 +110,8 @@ cpSpaceDeactivateBody(cpSpace *space, cpBody *body)
 		cpBody *bodyA = constraint->a;
 		if(body == bodyA || cpBodyGetType(bodyA) == CP_BODY_TYPE_STATIC) cpArrayDeleteObj(space->constraints, constraint);
 	}
+	
+	if(space->sleepFunc) space->sleepFunc(space, body, cpTrue, space->sleepData);
 }
 
 static inline cpBody *
@@ -166,20 +170,6 @@ cpBodyActivateStatic(cpBody *body, cpShape *filter)
 	// TODO: should also activate joints?
 }
 
-static inline void
-cpBodyPushArbiter(cpBody *body, cpArbiter *arb)
-{
-	cpAssertSoft(cpArbiterThreadForBody(arb, body)->next == NULL, "Internal Error: Dangling contact graph pointers detected. (A)");
-	cpAssertSoft(cpArbiterThreadForBody(arb, body)->prev == NULL, "Internal Error: Dangling contact graph pointers detected. (B)");
-	
-	cpArbiter *next = body->arbiterList;
-	cpAssertSoft(next == NULL || cpArbiterThreadForBody(next, body)->prev == NULL, "Internal Error: Dangling contact graph pointers detected. (C)");
-	cpArbiterThreadForBody(arb, body)->next = next;
-	
-	if(next) cpArbiterThreadForBody(next, body)->prev = arb;
-	body->arbiterList = arb;
-}
-
 static inline void
 ComponentAdd(cpBody *root, cpBody *body){
 	body->sleeping.root = root;
@@ -0,0 +1,299 @@
+/* Copyright (c) 2013 Scott Lembcke and Howling Moon Software
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+
+#include "chipmunk_private.h"
+
+// Snapshots are laid out as a header, the bodies, then the arbiters, each arbiter followed by its contacts.
+// Arbiters solved in the last step come first, in the order they were solved in.
+struct SnapshotHeader {
+	size_t size;
+	int shapeCount;
+	int bodyCount;
+	int arbiterCount;
+	int solvedCount;
+	cpFloat curr_dt;
+};
+
+struct BodySnapshot {
+	cpBody *body;
+	cpVect p, v, f;
+	cpFloat a, w, t;
+	cpTransform transform;
+	cpVect v_bias;
+	cpFloat w_bias;
+	cpFloat idleTime;
+	cpBool sleeping;
+};
+
+struct ArbiterSnapshot {
+	const cpShape *a, *b;
+	cpFloat e, u;
+	cpVect surface_vr, n;
+	cpDataPointer data;
+	cpCollisionHandler *handler, *handlerA, *handlerB;
+	cpCollisionID collisionID;
+	cpTimestamp age; // Steps since the arbiter was last used, as the space's stamp isn't saved.
+	enum cpArbiterState state;
+	cpBool swapped;
+	int count;
+};
+
+struct SnapshotWriter {
+	cpSpace *space;
+	char *buffer;
+	size_t size;
+	size_t used;
+	int count;
+};
+
+static inline cpBool
+ArbiterKeptOnRestore(cpArbiter *arb)
+{
+	// Matches cpSpaceArbiterSetFilter(), which never drops these while the bodies sleep.
+	cpBody *a = arb->body_a, *b = arb->body_b;
+	return (
+		(cpBodyGetType(a) == CP_BODY_TYPE_STATIC || cpBodyIsSleeping(a)) &&
+		(cpBodyGetType(b) == CP_BODY_TYPE_STATIC || cpBodyIsSleeping(b))
+	);
+}
+
+static inline cpBool
+ArbiterSolved(cpSpace *space, cpArbiter *arb)
+{
+	// Arbiters used in the last step but not solved, such as sensors, had their contacts dropped.
+	return (arb->stamp == space->stamp && arb->count > 0);
+}
+
+static void *
+WriterReserve(struct SnapshotWriter *writer, size_t bytes)
+{
+	void *ptr = (writer->used + bytes <= writer->size ? writer->buffer + writer->used : NULL);
+	writer->used += bytes;
+	return ptr;
+}
+
+static void
+SaveBody(struct SnapshotWriter *writer, cpBody *body)
+{
+	struct BodySnapshot *snapshot = (struct BodySnapshot *)WriterReserve(writer, sizeof(struct BodySnapshot));
+	writer->count++;
+	if(!snapshot) return;
+	
+	snapshot->body = body;
+	snapshot->p = body->p;
+	snapshot->v = body->v;
+	snapshot->f = body->f;
+	snapshot->a = body->a;
+	snapshot->w = body->w;
+	snapshot->t = body->t;
+	snapshot->transform = body->transform;
+	snapshot->v_bias = body->v_bias;
+	snapshot->w_bias = body->w_bias;
+	snapshot->idleTime = body->sleeping.idleTime;
+	snapshot->sleeping = cpBodyIsSleeping(body);
+}
+
+static void
+SaveArbiter(struct SnapshotWriter *writer, cpArbiter *arb)
+{
+	size_t contactBytes = arb->count*sizeof(struct cpContact);
+	struct ArbiterSnapshot *snapshot = (struct ArbiterSnapshot *)WriterReserve(writer, sizeof(struct ArbiterSnapshot) + contactBytes);
+	writer->count++;
+	if(!snapshot) return;
+	
+	snapshot->a = arb->a;
+	snapshot->b = arb->b;
+	snapshot->e = arb->e;
+	snapshot->u = arb->u;
+	snapshot->surface_vr = arb->surface_vr;
+	snapshot->n = arb->n;
+	snapshot->data = arb->data;
+	snapshot->handler = arb->handler;
+	snapshot->handlerA = arb->handlerA;
+	snapshot->handlerB = arb->handlerB;
+	snapshot->collisionID = arb->collisionID;
+	snapshot->age = writer->space->stamp - arb->stamp;
+	snapshot->state = arb->state;
+	snapshot->swapped = arb->swapped;
+	snapshot->count = arb->count;
+	if(contactBytes) memcpy(snapshot + 1, arb->contacts, contactBytes);
+}
+
+static void
+SaveCachedArbiter(cpArbiter *arb, struct SnapshotWriter *writer)
+{
+	if(!ArbiterKeptOnRestore(arb) && !ArbiterSolved(writer->space, arb)) SaveArbiter(writer, arb);
+}
+
+static inline int
+SpaceShapeCount(cpSpace *space)
+{
+	return cpSpatialIndexCount(space->staticShapes) + cpSpatialIndexCount(space->dynamicShapes);
+}
+
+size_t
+cpSpaceSaveSnapshot(cpSpace *space, void *buffer, size_t size)
+{
+	struct SnapshotWriter writer = {space, (char *)buffer, size, 0, 0};
+	struct SnapshotHeader *header = (struct SnapshotHeader *)WriterReserve(&writer, sizeof(struct SnapshotHeader));
+	
+	cpArray *bodies = space->dynamicBodies;
+	for(int i=0; i<bodies->num; i++) SaveBody(&writer, (cpBody *)bodies->arr[i]);
+	
+	cpArray *components = space->sleepingComponents;
+	for(int i=0; i<components->num; i++){
+		CP_BODY_FOREACH_COMPONENT((cpBody *)components->arr[i], body) SaveBody(&writer, body);
+	}
+	int bodyCount = writer.count;
+	writer.count = 0;
+	
+	cpArray *arbiters = space->arbiters;
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		if(!ArbiterKeptOnRestore(arb)) SaveArbiter(&writer, arb);
+	}
+	int solvedCount = writer.count;
+	
+	cpHashSetEach(space->cachedArbiters, (cpHashSetIteratorFunc)SaveCachedArbiter, &writer);
+	
+	if(header){
+		header->size = writer.used;
+		header->shapeCount = SpaceShapeCount(space);
+		header->bodyCount = bodyCount;
+		header->arbiterCount = writer.count;
+		header->solvedCount = solvedCount;
+		header->curr_dt = space->curr_dt;
+	}
+	
+	return writer.used;
+}
+
+static cpBool
+DropArbiter(cpArbiter *arb, cpSpace *space)
+{
+	if(ArbiterKeptOnRestore(arb)) return cpTrue;
+	
+	arb->contacts = NULL;
+	arb->count = 0;
+	cpArrayPush(space->pooledArbiters, arb);
+	return cpFalse;
+}
+
+cpBool
+cpSpaceRestoreSnapshot(cpSpace *space, const void *buffer, size_t size)
+{
+	cpAssertHard(!space->locked, "You cannot restore a snapshot while the space is locked, such as from a callback.");
+	
+	const struct SnapshotHeader *header = (const struct SnapshotHeader *)buffer;
+	if(size < sizeof(struct SnapshotHeader) || header->size != size || header->shapeCount != SpaceShapeCount(space)) return cpFalse;
+	
+	const struct BodySnapshot *bodies = (const struct BodySnapshot *)(header + 1);
+	for(int i=0; i<header->bodyCount; i++){
+		if(bodies[i].body->space != space) return cpFalse;
+	}
+	
+	// Wake bodies that were awake, restoring their arbiters to the cache so they're dropped with the rest.
+	for(int i=0; i<header->bodyCount; i++){
+		if(!bodies[i].sleeping && cpBodyIsSleeping(bodies[i].body)) cpBodyActivate(bodies[i].body);
+	}
+	
+	// Unthread last step's arbiters as the next step would, then drop every cached arbiter.
+	cpArray *arbiters = space->arbiters;
+	for(int i=0; i<arbiters->num; i++){
+		cpArbiter *arb = (cpArbiter *)arbiters->arr[i];
+		if(!cpBodyIsSleeping(arb->body_a) && !cpBodyIsSleeping(arb->body_b)) cpArbiterUnthread(arb);
+	}
+	arbiters->num = 0;
+	cpHashSetFilter(space->cachedArbiters, (cpHashSetFilterFunc)DropArbiter, space);
+	
+	// The dropped arbiters held the only references into the contact buffers, so refill the newest from its start.
+	cpSpaceClearContacts(space);
+	
+	for(int i=0; i<header->bodyCount; i++){
+		const struct BodySnapshot *snapshot = &bodies[i];
+		cpBody *body = snapshot->body;
+		
+		// Sleeping bodies don't move, and their shapes sit in the static index, so leave them be.
+		if(cpBodyIsSleeping(body)) continue;
+		
+		body->p = snapshot->p;
+		body->v = snapshot->v;
+		body->f = snapshot->f;
+		body->a = snapshot->a;
+		body->w = snapshot->w;
+		body->t = snapshot->t;
+		body->transform = snapshot->transform;
+		body->v_bias = snapshot->v_bias;
+		body->w_bias = snapshot->w_bias;
+		body->sleeping.idleTime = snapshot->idleTime;
+		
+		CP_BODY_FOREACH_SHAPE(body, shape) cpShapeCacheBB(shape);
+	}
+	
+	const char *cursor = (const char *)(bodies + header->bodyCount);
+	for(int i=0; i<header->arbiterCount; i++){
+		const struct ArbiterSnapshot *snapshot = (const struct ArbiterSnapshot *)cursor;
+		cursor += sizeof(struct ArbiterSnapshot) + snapshot->count*sizeof(struct cpContact);
+		
+		const cpShape *shape_pair[] = {snapshot->a, snapshot->b};
+		cpHashValue arbHashID = CP_HASH_SHAPE_PAIR(snapshot->a, snapshot->b);
+		cpArbiter *arb = (cpArbiter *)cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, (cpHashSetTransFunc)cpSpaceArbiterSetTrans, space);
+		
+		arb->a = snapshot->a;
+		arb->b = snapshot->b;
+		arb->body_a = snapshot->a->body;
+		arb->body_b = snapshot->b->body;
+		arb->e = snapshot->e;
+		arb->u = snapshot->u;
+		arb->surface_vr = snapshot->surface_vr;
+		arb->n = snapshot->n;
+		arb->data = snapshot->data;
+		arb->handler = snapshot->handler;
+		arb->handlerA = snapshot->handlerA;
+		arb->handlerB = snapshot->handlerB;
+		arb->collisionID = snapshot->collisionID;
+		arb->stamp = space->stamp - snapshot->age;
+		arb->state = snapshot->state;
+		arb->swapped = snapshot->swapped;
+		arb->count = snapshot->count;
+		arb->contacts = NULL;
+		
+		if(snapshot->count){
+			// Contacts go in the newest buffer, which outlives any arbiter restored into it.
+			if(!space->contactBuffersHead) cpSpacePushFreshContactBuffer(space);
+			arb->contacts = cpContactBufferGetArray(space);
+			memcpy(arb->contacts, snapshot + 1, snapshot->count*sizeof(struct cpContact));
+			cpSpacePushContacts(space, snapshot->count);
+		}
+		
+		if(i < header->solvedCount){
+			cpArrayPush(arbiters, arb);
+			cpBodyPushArbiter(arb->body_a, arb);
+			cpBodyPushArbiter(arb->body_b, arb);
+		}
+	}
+	
+	space->curr_dt = header->curr_dt;
+	return cpTrue;
+}
@@ -19,6 +19,8 @@
  * SOFTWARE.
  */
 
+#include <string.h>
+
 #include "chipmunk_private.h"
 
 //MARK: Post Step Callback Functions
@@ -177,6 +179,13 @@ cpSpacePushContacts(cpSpace *space, int count)
 	space->contactBuffersHead->numContacts += count;
 }
 
+// Reuse the newest contact buffer from its start, once nothing refers to its contacts.
+void
+cpSpaceClearContacts(cpSpace *space)
+{
+	if(space->contactBuffersHead) space->contactBuffersHead->numContacts = 0;
+}
+
 static void
 cpSpacePopContacts(cpSpace *space, int count){
 	space->contactBuffersHead->numContacts -= count;
@@ -184,23 +193,53 @@ cpSpacePopContacts(cpSpace *space, int count){
 
 //MARK: Collision Detection Functions
 
-static void *
+static void
+cpSpaceGrowArbiterPool(cpSpace *space)
+{
+	int count = CP_BUFFER_BYTES/sizeof(cpArbiter);
+	cpAssertHard(count, "Internal Error: Buffer size too small.");
+	
+	cpArbiter *buffer = (cpArbiter *)cpcalloc(1, CP_BUFFER_BYTES);
+	cpArrayPush(space->allocatedBuffers, buffer);
+	
+	for(int i=0; i<count; i++) cpArrayPush(space->pooledArbiters, buffer + i);
+}
+
+void *
 cpSpaceArbiterSetTrans(cpShape **shapes, cpSpace *space)
 {
-	if(space->pooledArbiters->num == 0){
-		// arbiter pool is exhausted, make more
-		int count = CP_BUFFER_BYTES/sizeof(cpArbiter);
-		cpAssertHard(count, "Internal Error: Buffer size too small.");
-		
-		cpArbiter *buffer = (cpArbiter *)cpcalloc(1, CP_BUFFER_BYTES);
-		cpArrayPush(space->allocatedBuffers, buffer);
-		
-		for(int i=0; i<count; i++) cpArrayPush(space->pooledArbiters, buffer + i);
-	}
+	// arbiter pool is exhausted, make more
+	if(space->pooledArbiters->num == 0) cpSpaceGrowArbiterPool(space);
 	
 	return cpArbiterInit((cpArbiter *)cpArrayPop(space->pooledArbiters), shapes[0], shapes[1]);
 }
 
+void
+cpSpaceReserve(cpSpace *space, int arbiters, int contacts)
+{
+	cpAssertSpaceUnlocked(space);
+	
+	cpArrayReserve(space->arbiters, arbiters);
+	cpHashSetReserve(space->cachedArbiters, arbiters);
+	while(space->pooledArbiters->num + cpHashSetCount(space->cachedArbiters) < arbiters) cpSpaceGrowArbiterPool(space);
+	
+	// Buffers are reused once they're older than the collision persistence, so the ring holds a step more than that.
+	int perStep = (contacts + (int)CP_CONTACTS_BUFFER_SIZE - 1)/(int)CP_CONTACTS_BUFFER_SIZE;
+	int needed = perStep*(int)(space->collisionPersistence + 2);
+	if(!space->contactBuffersHead){
+		if(needed == 0) return;
+		space->contactBuffersHead = cpContactBufferHeaderInit(cpSpaceAllocContactBuffer(space), space->stamp, NULL);
+	}
+	
+	cpContactBufferHeader *head = space->contactBuffersHead;
+	int count = 1;
+	for(cpContactBufferHeader *buffer = head->next; buffer != head; buffer = buffer->next) count++;
+	
+	// Spares go right after the head with stamps already stale, so they're the next buffers the ring reuses.
+	cpTimestamp stale = space->stamp - space->collisionPersistence - 1;
+	for(; count < needed; count++) head->next = cpContactBufferHeaderInit(cpSpaceAllocContactBuffer(space), stale, head);
+}
+
 static inline cpBool
 QueryRejectConstraint(cpBody *a, cpBody *b)
 {
@@ -231,25 +270,20 @@ QueryReject(cpShape *a, cpShape *b)
 	);
 }
 
-// Callback from the spatial hash.
-cpCollisionID
-cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+// Make or update the arbiter for colliding shapes whose contacts were just pushed into the contact buffer.
+static void
+cpSpaceProcessCollision(cpSpace *space, struct cpCollisionInfo *infoPtr)
 {
-	// Reject any of the simple cases
-	if(QueryReject(a,b)) return id;
-	
-	// Narrow-phase collision detection.
-	struct cpCollisionInfo info = cpCollide(a, b, id, cpContactBufferGetArray(space));
-	
-	if(info.count == 0) return info.id; // Shapes are not colliding.
-	cpSpacePushContacts(space, info.count);
+	struct cpCollisionInfo info = *infoPtr;
+	const cpShape *a = info.a, *b = info.b;
 	
 	// Get an arbiter from space->arbiterSet for the two shapes.
 	// This is where the persistant contact magic comes from.
 	const cpShape *shape_pair[] = {info.a, info.b};
-	cpHashValue arbHashID = CP_HASH_PAIR((cpHashValue)info.a, (cpHashValue)info.b);
+	cpHashValue arbHashID = CP_HASH_SHAPE_PAIR(info.a, info.b);
 	cpArbiter *arb = (cpArbiter *)cpHashSetInsert(space->cachedArbiters, arbHashID, shape_pair, (cpHashSetTransFunc)cpSpaceArbiterSetTrans, space);
 	cpArbiterUpdate(arb, &info, space);
+	arb->collisionID = info.id;
 	
 	cpCollisionHandler *handler = arb->handler;
 	
@@ -285,9 +319,47 @@ cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
 	
 	// Time stamp the arbiter so we know it was used recently.
 	arb->stamp = space->stamp;
+}
+
+// Callback from the spatial hash.
+cpCollisionID
+cpSpaceCollideShapes(cpShape *a, cpShape *b, cpCollisionID id, cpSpace *space)
+{
+	// Reject any of the simple cases
+	if(QueryReject(a,b)) return id;
+	
+	// Narrow-phase collision detection.
+	struct cpCollisionInfo info = cpCollide(a, b, id, cpContactBufferGetArray(space));
+	
+	if(info.count == 0) return info.id; // Shapes are not colliding.
+	cpSpacePushContacts(space, info.count);
+	
+	cpSpaceProcessCollision(space, &info);
 	return info.id;
 }
 
+struct cpCollisionInfo
+cpSpaceCollidePair(cpShape *a, cpShape *b, cpCollisionID id, struct cpContact *contacts)
+{
+	if(QueryReject(a,b)){
+		struct cpCollisionInfo info = {a, b, id, cpvzero, 0, contacts};
+		return info;
+	}
+	
+	return cpCollide(a, b, id, contacts);
+}
+
+void
+cpSpaceAddCollision(cpSpace *space, struct cpCollisionInfo *info)
+{
+	struct cpContact *contacts = cpContactBufferGetArray(space);
+	memcpy(contacts, info->arr, info->count*sizeof(struct cpContact));
+	info->arr = contacts;
+	cpSpacePushContacts(space, info->count);
+	
+	cpSpaceProcessCollision(space, info);
+}
+
 // Hashset filter func to throw away old arbiters.
 cpBool
 cpSpaceArbiterSetFilter(cpArbiter *arb, cpSpace *space)
@@ -361,10 +433,7 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 
 	cpSpaceLock(space); {
 		// Integrate positions
-		for(int i=0; i<bodies->num; i++){
-			cpBody *body = (cpBody *)bodies->arr[i];
-			body->position_func(body, dt);
-		}
+		cpBodyArrayUpdatePosition(bodies, dt);
 		
 		// Find colliding pairs.
 		cpSpacePushFreshContactBuffer(space);
@@ -398,10 +467,7 @@ cpSpaceStep(cpSpace *space, cpFloat dt)
 		// Integrate velocities.
 		cpFloat damping = cpfpow(space->damping, dt);
 		cpVect gravity = space->gravity;
-		for(int i=0; i<bodies->num; i++){
-			cpBody *body = (cpBody *)bodies->arr[i];
-			body->velocity_func(body, gravity, damping, dt);
-		}
+		cpBodyArrayUpdateVelocity(bodies, gravity, damping, dt);
 		
 		// Apply cached impulses
 		cpFloat dt_coef = (prev_dt == 0.0f ? 0.0f : dt/prev_dt);
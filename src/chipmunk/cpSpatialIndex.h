@@ -95,12 +95,24 @@ CP_EXPORT cpSpatialIndex* cpBBTreeNew(cpSpatialIndexBBFunc bbfunc, cpSpatialInde
 /// Perform a static top down optimization of the tree.
 CP_EXPORT void cpBBTreeOptimize(cpSpatialIndex *index);
 
+/// Improve the tree a little at a time with rotations along @c passes paths from the root to a leaf, each a step of its depth.
+/// Unlike cpBBTreeOptimize() this never allocates, and the paths cycle through the whole tree over repeated calls.
+/// Returns the rotations made, which drops to 0 as the tree settles. Does nothing to other index types.
+CP_EXPORT int cpBBTreeOptimizeIncremental(cpSpatialIndex *index, int passes);
+
 /// Bounding box tree velocity callback function.
 /// This function should return an estimate for the object's velocity.
 typedef cpVect (*cpBBTreeVelocityFunc)(void *obj);
 /// Set the velocity function for the bounding box tree to enable temporal coherence.
 CP_EXPORT void cpBBTreeSetVelocityFunc(cpSpatialIndex *index, cpBBTreeVelocityFunc func);
 
+/// Bounding box tree pair rejection callback function.
+/// This function should return true for two objects that can never collide.
+typedef cpBool (*cpBBTreePairRejectFunc)(void *a, void *b);
+/// Set the pair rejection function for the bounding box tree, so overlapping objects it rejects are neither cached as pairs nor reported.
+/// Objects it rejects must be reindexed when their answer may have changed, as pairs are only rebuilt when objects move.
+CP_EXPORT void cpBBTreeSetPairRejectFunc(cpSpatialIndex *index, cpBBTreePairRejectFunc func);
+
 //MARK: Single Axis Sweep
 
 typedef struct cpSweep1D cpSweep1D;
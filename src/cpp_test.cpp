@@ -1,6 +1,62 @@
 #include "cpp_test.h"
 
+#include "ecs_cpp.h"
+
+namespace
+{
+	struct position_component_t
+	{
+		float x;
+		float y;
+	};
+
+	struct velocity_component_t
+	{
+		float x;
+		float y;
+	};
+}
+
 int cpp_test_function(int v)
 {
 	return v * v;
 }
+
+int cpp_test_ecs(heap_t* heap)
+{
+	ecs_t* ecs = ecs_create(heap);
+	ecs::register_component<position_component_t>(ecs, "position");
+	ecs::register_component<velocity_component_t>(ecs, "velocity");
+
+	const int k_entity_count = 8;
+	ecs_mask_t mask = ecs::mask<position_component_t, velocity_component_t>();
+	for (int i = 0; i < k_entity_count; ++i)
+	{
+		ecs_entity_ref_t entity = ecs_entity_add(ecs, mask);
+		position_component_t* position = static_cast<position_component_t*>(ecs_entity_get_component(ecs, entity, ecs::component_type<position_component_t>::index, true));
+		*position = { 0.0f, 0.0f };
+		velocity_component_t* velocity = static_cast<velocity_component_t*>(ecs_entity_get_component(ecs, entity, ecs::component_type<velocity_component_t>::index, true));
+		*velocity = { (float)i, -(float)i };
+	}
+	ecs_update(ecs);
+
+	ecs::query<position_component_t, const velocity_component_t> move(ecs);
+	for (int step = 0; step < 2; ++step)
+	{
+		move.each([](position_component_t& position, const velocity_component_t& velocity)
+		{
+			position.x += velocity.x;
+			position.y += velocity.y;
+		});
+	}
+
+	int arrived = 0;
+	ecs::query<const position_component_t, const velocity_component_t> check(ecs);
+	check.each([&arrived](const position_component_t& position, const velocity_component_t& velocity)
+	{
+		arrived += position.x == 2.0f * velocity.x && position.y == 2.0f * velocity.y;
+	});
+
+	ecs_destroy(ecs);
+	return arrived;
+}
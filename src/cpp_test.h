@@ -4,8 +4,14 @@
 extern "C" {
 #endif
 
+typedef struct heap_t heap_t;
+
 int cpp_test_function(int v);
 
+// Move a few entities through typed C++ queries over the entity component system.
+// Returns how many ended up where they were expected to.
+int cpp_test_ecs(heap_t* heap);
+
 #ifdef __cplusplus
 }
 #endif
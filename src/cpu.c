@@ -0,0 +1,96 @@
+#include "cpu.h"
+
+#include "debug.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+static uint32_t s_cpu_features = 0;
+
+static const char* s_cpu_feature_names[] =
+{
+	"sse4.1",
+	"avx",
+	"avx2",
+	"fma",
+	"avx512",
+};
+
+static uint32_t detect_features();
+
+void cpu_startup(uint32_t disabled_features)
+{
+	s_cpu_features = detect_features() & ~disabled_features;
+
+	char names[64] = "sse2";
+	for (int i = 0; i < _countof(s_cpu_feature_names); ++i)
+	{
+		if (s_cpu_features & (1 << i))
+		{
+			strcat_s(names, sizeof(names), " ");
+			strcat_s(names, sizeof(names), s_cpu_feature_names[i]);
+		}
+	}
+	debug_print(k_print_info, "CPU features: %s\n", names);
+}
+
+uint32_t cpu_get_features()
+{
+	return s_cpu_features;
+}
+
+void* cpu_select(const char* kernel, const cpu_variant_t* variants, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		if ((variants[i].features & s_cpu_features) == variants[i].features)
+		{
+			debug_print(k_print_info, "CPU kernel %s: %s\n", kernel, variants[i].name);
+			return variants[i].function;
+		}
+	}
+	debug_print(k_print_error, "CPU kernel %s has no variant for this CPU!\n", kernel);
+	return NULL;
+}
+
+static uint32_t detect_features()
+{
+	uint32_t features = 0;
+#if defined(_M_X64) || defined(_M_IX86)
+	int regs[4];
+	__cpuid(regs, 0);
+	int max_leaf = regs[0];
+
+	__cpuid(regs, 1);
+	bool sse41 = (regs[2] & (1 << 19)) != 0;
+	bool fma = (regs[2] & (1 << 12)) != 0;
+	bool osxsave = (regs[2] & (1 << 27)) != 0;
+	bool avx = (regs[2] & (1 << 28)) != 0;
+
+	bool avx2 = false;
+	bool avx512 = false;
+	if (max_leaf >= 7)
+	{
+		__cpuidex(regs, 7, 0);
+		avx2 = (regs[1] & (1 << 5)) != 0;
+		avx512 = (regs[1] & (1 << 16)) != 0;
+	}
+
+	//the OS must save the wider registers too: xmm and ymm state for AVX, plus opmask and zmm state for AVX-512
+	uint64_t xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool ymm_saved = (xcr0 & 0x6) == 0x6;
+	bool zmm_saved = (xcr0 & 0xe6) == 0xe6;
+
+	features |= sse41 ? k_cpu_feature_sse41 : 0;
+	features |= avx && ymm_saved ? k_cpu_feature_avx : 0;
+	features |= avx && avx2 && ymm_saved ? k_cpu_feature_avx2 : 0;
+	features |= avx && fma && ymm_saved ? k_cpu_feature_fma : 0;
+	features |= avx512 && zmm_saved ? k_cpu_feature_avx512 : 0;
+#endif
+	return features;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// CPU feature detection and kernel dispatch.
+// One build runs everywhere with SSE2, which every x64 target has; kernels with wider variants pick the fastest
+// the CPU and OS support once at startup, through a function pointer, rather than per build configuration.
+
+#include <stdint.h>
+
+// Instruction sets beyond SSE2 kernels may have variants for.
+// Each is reported only where the OS also saves its registers across context switches.
+typedef enum cpu_feature_t
+{
+	k_cpu_feature_sse41 = 1 << 0,
+	k_cpu_feature_avx = 1 << 1,
+	k_cpu_feature_avx2 = 1 << 2,
+	k_cpu_feature_fma = 1 << 3,
+	k_cpu_feature_avx512 = 1 << 4, //AVX-512 foundation
+} cpu_feature_t;
+
+// One implementation of a kernel and the features it needs.
+typedef struct cpu_variant_t
+{
+	const char* name;
+	uint32_t features; //mask of cpu_feature_t
+	void* function;
+} cpu_variant_t;
+
+// Perform one-time detection of the CPU's features, printing them.
+// Disabled features are treated as missing, to run slower variants on a machine that has faster ones.
+void cpu_startup(uint32_t disabled_features);
+
+// Get the mask of cpu_feature_t the CPU has, less those disabled at startup.
+uint32_t cpu_get_features();
+
+// Pick the first of a kernel's variants whose features the CPU has, printing which was picked.
+// List variants fastest first, ending with one that needs no features.
+void* cpu_select(const char* kernel, const cpu_variant_t* variants, int count);
@@ -1,14 +1,90 @@
 #include "debug.h"
 
+#include "atomic.h"
+#include "heap.h"
+#include "lock.h"
+#include "queue.h"
+#include "thread.h"
+#include "timer.h"
+
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <DbgHelp.h>
+#include <intrin.h>
+
+enum
+{
+	k_debug_log_records = 256, //messages queued at once before new ones are dropped
+	k_debug_log_text = 256,
+	k_debug_repeat_slots = 64, //distinct messages tracked for rate limiting; must be a power of two
+	k_debug_repeat_burst = 8, //copies of one message printed per window before the rest are suppressed
+	k_debug_repeat_window_ms = 1000,
+	k_debug_symbol_slots = 4096, //addresses whose symbols are cached; must be a power of two
+	k_debug_symbol_name = 120,
+};
+
+// A formatted message waiting for the logger thread.
+typedef struct debug_record_t
+{
+	const char* format; //identifies repeats of the same message
+	int length;
+	char text[k_debug_log_text];
+} debug_record_t;
+
+// Rate limiting state for one message, owned by the logger thread.
+typedef struct debug_repeat_t
+{
+	const char* format;
+	uint32_t window_start_ms;
+	int count;
+	int suppressed;
+	char text[k_debug_log_text];
+} debug_repeat_t;
+
+typedef struct debug_logger_t
+{
+	heap_t* heap;
+	debug_record_t* records;
+	queue_t* free_records;
+	queue_t* full_records;
+	thread_t* thread;
+	HANDLE file;
+	int dropped;
+	debug_repeat_t repeats[k_debug_repeat_slots];
+} debug_logger_t;
+
+// A cached symbol lookup.
+typedef struct debug_symbol_t
+{
+	void* address; //NULL marks an unused slot
+	char name[k_debug_symbol_name]; //empty if the address has no symbol
+} debug_symbol_t;
 
 static uint32_t s_mask = 0xffffffff;
 
+// Symbol lookups, made under the lock since DbgHelp is single-threaded.
+// The table is mapped when symbols are first loaded; untouched pages cost nothing.
+static lock_t s_symbol_lock;
+static bool s_symbols_loaded = false;
+static debug_symbol_t* s_symbols = NULL;
+static int s_symbol_count = 0;
+
+// Logger taking prints while asynchronous logging is running, or NULL.
+static debug_logger_t* s_logger = NULL;
+// Threads between loading s_logger and finishing their push.
+static int s_logger_producers = 0;
+
+static void print_sync(const char* text, int length);
+static int logger_thread_func(void* user);
+static void logger_write(debug_logger_t* logger, const char* text, int length);
+static void logger_flush_repeat(debug_logger_t* logger, debug_repeat_t* repeat);
+static debug_symbol_t* find_symbol(void* address);
+static void load_symbol(void* address, char* name, size_t name_size);
+
 static LONG debug_exception_handler(LPEXCEPTION_POINTERS info)
 {
 	// XXX: MS uses 0xE06D7363 to indicate C++ language exception.
@@ -19,7 +95,9 @@ static LONG debug_exception_handler(LPEXCEPTION_POINTERS info)
 		return EXCEPTION_EXECUTE_HANDLER;
 	}
 
-	debug_print(k_print_error, "Caught exception!\n");
+	//the logger thread may never get to run again, so skip its queue
+	static const char k_message[] = "Caught exception!\n";
+	print_sync(k_message, (int)strlen(k_message));
 
 	HANDLE file = CreateFile(L"ga2022-crash.dmp", GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 	if (file != INVALID_HANDLE_VALUE)
@@ -60,21 +138,280 @@ void debug_print(uint32_t type, _Printf_format_string_ const char* format, ...)
 		return;
 	}
 
+	//announce this thread before looking at the logger so debug_logger_stop() can wait for it
+	atomic_increment(&s_logger_producers);
+	debug_logger_t* logger = atomic_load_ptr((void**)&s_logger);
+	debug_record_t* record = logger ? queue_try_pop(logger->free_records) : NULL;
+	if (logger && !record)
+	{
+		//never block the caller; the logger thread reports how many were lost
+		atomic_increment(&logger->dropped);
+		atomic_decrement(&s_logger_producers);
+		return;
+	}
+
+	char buffer[k_debug_log_text];
+	char* text = record ? record->text : buffer;
+
 	va_list args;
 	va_start(args, format);
-	char buffer[256];
-	vsnprintf(buffer, sizeof(buffer), format, args);
+	int length = vsnprintf(text, k_debug_log_text, format, args);
 	va_end(args);
+	length = length < 0 ? 0 : __min(length, k_debug_log_text - 1);
 
-	OutputDebugStringA(buffer);
+	if (record)
+	{
+		record->format = format;
+		record->length = length;
+		queue_push(logger->full_records, record);
+		atomic_decrement(&s_logger_producers);
+		return;
+	}
+	atomic_decrement(&s_logger_producers);
 
-	DWORD bytes = (DWORD)strlen(buffer);
-	DWORD written = 0;
-	HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
-	WriteConsoleA(out, buffer, bytes, &written, NULL);
+	print_sync(text, length);
+}
+
+void debug_logger_start(heap_t* heap, const char* log_path)
+{
+	debug_logger_t* logger = heap_alloc(heap, sizeof(debug_logger_t), 8);
+	memset(logger, 0, sizeof(*logger));
+	logger->heap = heap;
+	logger->records = heap_alloc(heap, sizeof(debug_record_t) * k_debug_log_records, 8);
+	logger->free_records = queue_create(heap, k_debug_log_records);
+	logger->full_records = queue_create(heap, k_debug_log_records + 1);
+	for (int i = 0; i < k_debug_log_records; ++i)
+	{
+		queue_push(logger->free_records, &logger->records[i]);
+	}
+
+	logger->file = INVALID_HANDLE_VALUE;
+	if (log_path)
+	{
+		logger->file = CreateFileA(log_path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	}
+
+	thread_options_t options = { .name = "Logger", .priority = k_thread_priority_low };
+	logger->thread = thread_create_with_options(logger_thread_func, logger, &options);
+
+	atomic_store_ptr((void**)&s_logger, logger);
+}
+
+void debug_logger_stop()
+{
+	debug_logger_t* logger = atomic_exchange_ptr((void**)&s_logger, NULL);
+	if (!logger)
+	{
+		return;
+	}
+
+	//threads that saw the logger before it was cleared finish their pushes first
+	while (atomic_load(&s_logger_producers))
+	{
+		YieldProcessor();
+	}
+
+	queue_push(logger->full_records, NULL);
+	thread_destroy(logger->thread);
+
+	if (logger->file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(logger->file);
+	}
+	queue_destroy(logger->full_records);
+	queue_destroy(logger->free_records);
+	heap_free(logger->heap, logger->records);
+	heap_free(logger->heap, logger);
 }
 
 int debug_backtrace(void** stack, int stack_capacity)
 {
+#if DEBUG_FRAME_POINTERS
+	//each frame holds the caller's frame pointer followed by the return address into the caller;
+	//the walk stops at the first link that leaves the thread's stack or fails to climb it
+	NT_TIB* tib = (NT_TIB*)NtCurrentTeb();
+	void** frame = (void**)_AddressOfReturnAddress() - 1;
+	int skip = 1; //the return into our caller, which CaptureStackBackTrace() skips too
+	int count = 0;
+	while (count < stack_capacity &&
+		(void*)frame >= tib->StackLimit && (void*)(frame + 2) <= tib->StackBase &&
+		!((uintptr_t)frame & (sizeof(void*) - 1)))
+	{
+		if (skip)
+		{
+			skip--;
+		}
+		else
+		{
+			stack[count++] = frame[1];
+		}
+
+		void** next = frame[0];
+		if (next <= frame)
+		{
+			break;
+		}
+		frame = next;
+	}
+	return count;
+#else
 	return CaptureStackBackTrace(2, stack_capacity, stack, NULL);
+#endif
+}
+
+bool debug_symbolize(void* address, char* name, size_t name_size)
+{
+	lock_acquire(&s_symbol_lock);
+	if (!s_symbols_loaded)
+	{
+		//deferred loads read a module's symbols on the first lookup inside it instead of all of them up front
+		SymSetOptions(SymGetOptions() | SYMOPT_DEFERRED_LOADS | SYMOPT_UNDNAME);
+		SymInitialize(GetCurrentProcess(), NULL, TRUE);
+		s_symbols = VirtualAlloc(NULL, sizeof(debug_symbol_t) * k_debug_symbol_slots, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		s_symbols_loaded = true;
+	}
+
+	debug_symbol_t* symbol = find_symbol(address);
+	if (symbol && symbol->address == address)
+	{
+		snprintf(name, name_size, "%s", symbol->name);
+	}
+	else if (symbol)
+	{
+		load_symbol(address, symbol->name, sizeof(symbol->name));
+		symbol->address = address;
+		s_symbol_count++;
+		snprintf(name, name_size, "%s", symbol->name);
+	}
+	else
+	{
+		load_symbol(address, name, name_size);
+	}
+	lock_release(&s_symbol_lock);
+
+	return name[0] != '\0';
+}
+
+static void print_sync(const char* text, int length)
+{
+	OutputDebugStringA(text);
+
+	DWORD written = 0;
+	HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+	WriteConsoleA(out, text, (DWORD)length, &written, NULL);
+}
+
+static int logger_thread_func(void* user)
+{
+	debug_logger_t* logger = user;
+
+	while (true)
+	{
+		debug_record_t* record = queue_pop(logger->full_records);
+		if (!record)
+		{
+			break;
+		}
+
+		//repeats are recognized by format string; two messages sharing a slot just reset each other
+		uint32_t now_ms = timer_ticks_to_ms(timer_get_ticks());
+		debug_repeat_t* repeat = &logger->repeats[((uintptr_t)record->format >> 3) & (k_debug_repeat_slots - 1)];
+		if (repeat->format != record->format || now_ms - repeat->window_start_ms >= k_debug_repeat_window_ms)
+		{
+			logger_flush_repeat(logger, repeat);
+			repeat->format = record->format;
+			repeat->window_start_ms = now_ms;
+			repeat->count = 0;
+		}
+
+		if (++repeat->count <= k_debug_repeat_burst)
+		{
+			logger_write(logger, record->text, record->length);
+		}
+		else
+		{
+			++repeat->suppressed;
+			memcpy(repeat->text, record->text, record->length + 1);
+		}
+		queue_push(logger->free_records, record);
+
+		int dropped = atomic_exchange(&logger->dropped, 0);
+		if (dropped)
+		{
+			char text[k_debug_log_text];
+			int length = snprintf(text, sizeof(text), "Logger dropped %d messages.\n", dropped);
+			logger_write(logger, text, length);
+		}
+	}
+
+	for (int i = 0; i < k_debug_repeat_slots; ++i)
+	{
+		logger_flush_repeat(logger, &logger->repeats[i]);
+	}
+	return 0;
+}
+
+static void logger_write(debug_logger_t* logger, const char* text, int length)
+{
+	print_sync(text, length);
+
+	if (logger->file != INVALID_HANDLE_VALUE)
+	{
+		DWORD written = 0;
+		WriteFile(logger->file, text, (DWORD)length, &written, NULL);
+	}
+}
+
+static void logger_flush_repeat(debug_logger_t* logger, debug_repeat_t* repeat)
+{
+	if (repeat->suppressed)
+	{
+		char text[k_debug_log_text];
+		int length = snprintf(text, sizeof(text), "Suppressed %d repeats of: %s", repeat->suppressed, repeat->text);
+		length = length < 0 ? 0 : __min(length, (int)sizeof(text) - 1);
+		logger_write(logger, text, length);
+		repeat->suppressed = 0;
+	}
+}
+
+// Find the cache slot of an address, or the empty slot it belongs in.
+// Returns NULL if the address is not cached and the table is too full to take it.
+// Must be called with the symbol lock held.
+static debug_symbol_t* find_symbol(void* address)
+{
+	if (!s_symbols)
+	{
+		return NULL;
+	}
+
+	uint32_t index = (uint32_t)(((uint64_t)(uintptr_t)address * 0x9e3779b97f4a7c15ull) >> 32) & (k_debug_symbol_slots - 1);
+	while (s_symbols[index].address && s_symbols[index].address != address)
+	{
+		index = (index + 1) & (k_debug_symbol_slots - 1);
+	}
+	if (!s_symbols[index].address && s_symbol_count >= k_debug_symbol_slots * 3 / 4)
+	{
+		return NULL;
+	}
+	return &s_symbols[index];
+}
+
+// Look up the symbol of an address with DbgHelp.
+// Must be called with the symbol lock held.
+static void load_symbol(void* address, char* name, size_t name_size)
+{
+	union
+	{
+		IMAGEHLP_SYMBOL64 symbol;
+		char storage[sizeof(IMAGEHLP_SYMBOL64) + k_debug_symbol_name];
+	} lookup;
+	memset(&lookup, 0, sizeof(lookup));
+	lookup.symbol.SizeOfStruct = sizeof(IMAGEHLP_SYMBOL64);
+	lookup.symbol.MaxNameLength = k_debug_symbol_name - 1;
+
+	name[0] = '\0';
+	if (SymGetSymFromAddr64(GetCurrentProcess(), (DWORD64)(uintptr_t)address, 0, &lookup.symbol))
+	{
+		snprintf(name, name_size, "%s", lookup.symbol.Name);
+	}
 }
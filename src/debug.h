@@ -1,9 +1,17 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Debugging Support
 
+typedef struct heap_t heap_t;
+
 // Flags for debug_print().
 typedef enum debug_print_t
 {
@@ -25,7 +33,35 @@ void debug_set_print_mask(uint32_t mask);
 // See debug_set_print_mask.
 void debug_print(uint32_t type, _Printf_format_string_ const char* format, ...);
 
-// Capture a list of addresses that make up the current function callstack.
+// Start printing asynchronously.
+// Until debug_logger_stop(), debug_print() only formats the message and queues it for a
+// background thread that writes it to the console and, if log_path is not NULL, to a file.
+// Messages are dropped rather than blocking the caller when the queue is full, and
+// copies of one message beyond a few per second are suppressed and counted.
+void debug_logger_start(heap_t* heap, const char* log_path);
+
+// Stop printing asynchronously, writing out any queued messages first.
+void debug_logger_stop();
+
+// Frame pointer backtraces follow the chain of saved frame pointers up the stack, a few loads per frame,
+// instead of unwinding with CaptureStackBackTrace(). Only valid when every function keeps a frame pointer:
+// build with /Oy- on 32-bit MSVC or -fno-omit-frame-pointer with clang-cl, as 64-bit MSVC never keeps them.
+// Off by default; define DEBUG_FRAME_POINTERS as 1 to enable.
+#if !defined(DEBUG_FRAME_POINTERS)
+#define DEBUG_FRAME_POINTERS 0
+#endif
+
+// Capture a list of addresses that make up the current function callstack, starting with the caller's caller.
 // On return, stack contains at most stack_capacity addresses.
 // The number of addresses captured is the return value.
 int debug_backtrace(void** stack, int stack_capacity);
+
+// Write the name of the function containing a code address, such as one from debug_backtrace(), to name.
+// Symbols load on the first call, and then only for modules addresses fall in; results are cached, so a
+// repeated address costs a table probe. Safe to call from any thread.
+// Returns false, leaving name empty, if the address has no symbol.
+bool debug_symbolize(void* address, char* name, size_t name_size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,16 +1,118 @@
 #include "ecs.h"
 
 #include "debug.h"
+#include "fs.h"
 #include "heap.h"
+#include "lock.h"
+#include "math.h"
+#include "string_id.h"
+#include "trace.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
 enum
 {
-	k_max_component_types = 64,
-	k_max_entities = 512,
+	k_max_component_types = k_ecs_max_component_types,
+	k_entity_page_shift = 7,
+	k_entities_per_page = 1 << k_entity_page_shift,
+	k_chunk_size = 16 * 1024,
+	k_command_data_initial_capacity = 1024,
+
+	// Bytes that start a saved world, "GAEC" read little endian, then its version.
+	k_save_magic = 0x43454147,
+	k_save_version = 2,
 };
 
+typedef enum command_type_t
+{
+	k_command_spawn,
+	k_command_spawn_component,
+	k_command_despawn,
+	k_command_add_component,
+	k_command_remove_component,
+} command_type_t;
+
+// One deferred structural change.
+// Component data is copied into the buffer's data, at data_offset.
+typedef struct command_t
+{
+	command_type_t type;
+	ecs_entity_ref_t ref; //entity changed, or for a spawn the entity spawned once played back
+	ecs_mask_t component_mask; //of a spawn
+	int component_type;
+	int spawn; //index of the spawn whose component a spawn component command sets
+	size_t data_offset;
+	bool has_data;
+	ecs_spawn_callback_t callback;
+	void* callback_data;
+} command_t;
+
+// Start of a saved world.
+// Followed by a save_type_t per component type, the entity table, a save_archetype_t per archetype each followed
+// by its chunks, and for each sparse type its count followed by its entities, write ticks and data.
+typedef struct save_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t tick;
+	int32_t global_sequence;
+	int32_t free_entity;
+	int32_t component_type_count;
+	int32_t entity_page_count;
+	int32_t archetype_count;
+} save_header_t;
+
+// A component type as saved, which must match the registered type to load.
+typedef struct save_type_t
+{
+	char name[32];
+	uint64_t size;
+	uint64_t alignment;
+	uint64_t sparse;
+} save_type_t;
+
+// An archetype as saved, before its used chunks.
+typedef struct save_archetype_t
+{
+	ecs_mask_t component_mask;
+	uint64_t chunk_size;
+	int32_t entity_count;
+	int32_t chunk_count;
+} save_archetype_t;
+
+// Archetypes matching a registered query, in creation order.
+typedef struct registered_query_t
+{
+	ecs_mask_t component_mask;
+	int* archetypes;
+	int archetype_count;
+	int archetype_capacity;
+} registered_query_t;
+
+// Components instances of a prefab start with, each type's default data at its offset in defaults.
+typedef struct prefab_t
+{
+	ecs_mask_t component_mask;
+	char* defaults;
+	size_t offsets[k_max_component_types];
+} prefab_t;
+
+// Commands one thread recorded since the last ecs_update.
+typedef struct ecs_command_buffer_t
+{
+	struct ecs_command_buffer_t* next;
+	command_t* commands;
+	int command_count;
+	int command_capacity;
+	char* data;
+	size_t data_size;
+	size_t data_capacity;
+} ecs_command_buffer_t;
+
 typedef enum entity_state_t
 {
 	k_entity_unused,
@@ -19,71 +121,322 @@ typedef enum entity_state_t
 	k_entity_pending_remove,
 } entity_state_t;
 
+// Bookkeeping for a single entity slot.
+// Slots are allocated in pages that never move, so growing keeps existing pages in place.
+typedef struct entity_info_t
+{
+	int sequence;
+	entity_state_t state;
+	int archetype;
+	int row;
+	int next_free;
+	ecs_mask_t component_mask;
+} entity_info_t;
+
+// A unique combination of component types.
+// Entities sharing a component mask are packed together in fixed-size chunks.
+// Each chunk stores an array of entity indices, the tick each component type last changed
+// anywhere in the chunk, then per component type an array of data and an array of write ticks.
+// Chunk ticks are kept for types up to the archetype's last, so chunks don't carry one for every type there could be.
+// Tag components have neither array; their write tick is the chunk's.
+typedef struct ecs_archetype_t
+{
+	ecs_mask_t component_mask;
+	ecs_mask_t stored_mask; //components with per-row data and write ticks, which tags lack
+	size_t component_offsets[k_max_component_types];
+	size_t version_offsets[k_max_component_types];
+	size_t chunk_version_offset;
+	int chunk_version_count; //one past the archetype's last component type
+	int chunk_capacity;
+	int chunk_shift;
+	size_t chunk_size;
+	int chunk_count;
+	int chunk_array_capacity;
+	char** chunks;
+	int entity_count;
+} ecs_archetype_t;
+
+// Data of a sparse component type, packed apart from archetype chunks.
+// Each entity slot's position in the packed arrays is found through pages of an index that parallel the
+// entity pages, each allocated the first time an entity in its range gets the type.
+typedef struct sparse_set_t
+{
+	int** index_pages; //packed position + 1 per entity slot, 0 where absent
+	int index_page_count;
+	char* data;
+	int* entities;
+	uint32_t* versions;
+	int count;
+	int capacity;
+} sparse_set_t;
+
 typedef struct ecs_t
 {
 	heap_t* heap;
 	int global_sequence;
+	uint32_t tick;
 
-	int sequences[k_max_entities];
-	entity_state_t entity_states[k_max_entities];
-	uint64_t component_masks[k_max_entities];
+	entity_info_t** entity_pages;
+	int entity_page_count;
+	int entity_page_capacity;
 
-	void* components[k_max_component_types];
+	// Unused slots are chained through entity_info_t::next_free.
+	int free_entity;
+
+	// Entities whose state changes at the next ecs_update.
+	int* pending_adds;
+	int pending_add_count;
+	int pending_add_capacity;
+	int* pending_removes;
+	int pending_remove_count;
+	int pending_remove_capacity;
+
+	ecs_archetype_t** archetypes;
+	int archetype_count;
+	int archetype_capacity;
+
+	registered_query_t* registered_queries;
+	int registered_query_count;
+	int registered_query_capacity;
+
+	prefab_t* prefabs;
+	int prefab_count;
+	int prefab_capacity;
+
+	int component_type_count;
 	size_t component_type_sizes[k_max_component_types];
-	char component_type_names[k_max_component_types][32];
+	size_t component_type_alignments[k_max_component_types];
+	string_id_t component_type_names[k_max_component_types];
+	ecs_mask_t sparse_mask;
+	sparse_set_t sparse_sets[k_max_component_types];
+
+	// Each thread's command buffer is created on its first command and kept until the system is destroyed.
+	ecs_command_buffer_t* command_buffers;
+	DWORD command_tls;
+	lock_t command_lock; //held only to add a buffer
 } ecs_t;
 
+static entity_info_t* get_entity_info(ecs_t* ecs, int entity);
+static void grow_entity_pages(ecs_t* ecs);
+static int alloc_entity(ecs_t* ecs, ecs_mask_t component_mask);
+static void push_pending(ecs_t* ecs, int** list, int* count, int* capacity, int entity);
+static void* grow_array(ecs_t* ecs, void* array, size_t element_size, int* capacity);
+static ecs_archetype_t* find_or_create_archetype(ecs_t* ecs, ecs_mask_t component_mask, int* archetype_index);
+static void archetype_add_chunk(ecs_t* ecs, ecs_archetype_t* archetype);
+static int archetype_add_row(ecs_t* ecs, ecs_archetype_t* archetype, int entity);
+static void fill_copies(char* dst, const char* src, size_t size, int count);
+static void archetype_remove_row(ecs_t* ecs, ecs_archetype_t* archetype, int row);
+static void archetype_mark_row_changed(ecs_t* ecs, ecs_archetype_t* archetype, int row, int component_type);
+static bool archetype_chunk_changed(ecs_archetype_t* archetype, int chunk_index, ecs_mask_t changed_mask, uint32_t since_tick);
+static bool archetype_row_changed(ecs_t* ecs, ecs_archetype_t* archetype, int row, ecs_mask_t changed_mask, uint32_t since_tick);
+static int find_archetype(ecs_t* ecs, int registered, ecs_mask_t mask, int* match);
+static bool archetype_matches(const ecs_archetype_t* archetype, const ecs_mask_t* mask);
+static void* archetype_row_component(ecs_t* ecs, ecs_archetype_t* archetype, int row, int component_type);
+static void entity_set_component_mask(ecs_t* ecs, int entity, ecs_mask_t component_mask);
+static int sparse_find(ecs_t* ecs, int component_type, int entity);
+static int* sparse_index_slot(ecs_t* ecs, int component_type, int entity);
+static void sparse_reserve(ecs_t* ecs, int component_type, int count);
+static void sparse_insert(ecs_t* ecs, int component_type, int entity);
+static void sparse_remove(ecs_t* ecs, int component_type, int entity);
+static void sparse_update_mask(ecs_t* ecs, int entity, ecs_mask_t old_mask, ecs_mask_t new_mask);
+static ecs_command_buffer_t* get_command_buffer(ecs_t* ecs);
+static command_t* push_command(ecs_t* ecs, ecs_command_buffer_t* buffer, command_type_t type, int component_type, const void* data);
+static void play_commands(ecs_t* ecs, ecs_command_buffer_t* buffer);
+static size_t save_size(ecs_t* ecs);
+static bool load_archetypes(ecs_t* ecs, const char** cursor, const char* end, int count, int* remap, bool apply);
+static bool load_sparse_sets(ecs_t* ecs, const char** cursor, const char* end, int entity_count, bool apply);
+static bool read_bytes(const char** cursor, const char* end, void* data, size_t size);
+static void write_bytes(char** cursor, const void* data, size_t size);
+
 ecs_t* ecs_create(heap_t* heap)
 {
 	ecs_t* ecs = heap_alloc(heap, sizeof(ecs_t), 8);
 	memset(ecs, 0, sizeof(*ecs));
 	ecs->heap = heap;
 	ecs->global_sequence = 1;
+	ecs->tick = 1;
+	ecs->free_entity = -1;
+	ecs->command_tls = TlsAlloc();
+	if (ecs->command_tls == TLS_OUT_OF_INDEXES)
+	{
+		debug_print(k_print_error, "Out of thread local storage for ECS command buffers.\n");
+	}
+	lock_init_named(&ecs->command_lock, "ecs commands");
 	return ecs;
 }
 
 void ecs_destroy(ecs_t* ecs)
 {
-	for (int i = 0; i < _countof(ecs->components); ++i)
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		ecs_archetype_t* archetype = ecs->archetypes[i];
+		for (int c = 0; c < archetype->chunk_count; ++c)
+		{
+			heap_free(ecs->heap, archetype->chunks[c]);
+		}
+		if (archetype->chunks)
+		{
+			heap_free(ecs->heap, archetype->chunks);
+		}
+		heap_free(ecs->heap, archetype);
+	}
+	if (ecs->archetypes)
+	{
+		heap_free(ecs->heap, ecs->archetypes);
+	}
+	for (int i = 0; i < ecs->registered_query_count; ++i)
+	{
+		if (ecs->registered_queries[i].archetypes)
+		{
+			heap_free(ecs->heap, ecs->registered_queries[i].archetypes);
+		}
+	}
+	if (ecs->registered_queries)
+	{
+		heap_free(ecs->heap, ecs->registered_queries);
+	}
+	for (int i = 0; i < ecs->prefab_count; ++i)
+	{
+		heap_free(ecs->heap, ecs->prefabs[i].defaults);
+	}
+	if (ecs->prefabs)
+	{
+		heap_free(ecs->heap, ecs->prefabs);
+	}
+	for (int i = 0; i < ecs->entity_page_count; ++i)
+	{
+		heap_free(ecs->heap, ecs->entity_pages[i]);
+	}
+	if (ecs->entity_pages)
+	{
+		heap_free(ecs->heap, ecs->entity_pages);
+	}
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		sparse_set_t* set = &ecs->sparse_sets[i];
+		for (int p = 0; p < set->index_page_count; ++p)
+		{
+			if (set->index_pages[p])
+			{
+				heap_free(ecs->heap, set->index_pages[p]);
+			}
+		}
+		if (set->index_pages)
+		{
+			heap_free(ecs->heap, set->index_pages);
+		}
+		if (set->data)
+		{
+			heap_free(ecs->heap, set->data);
+			heap_free(ecs->heap, set->entities);
+			heap_free(ecs->heap, set->versions);
+		}
+	}
+	if (ecs->pending_adds)
+	{
+		heap_free(ecs->heap, ecs->pending_adds);
+	}
+	if (ecs->pending_removes)
+	{
+		heap_free(ecs->heap, ecs->pending_removes);
+	}
+	while (ecs->command_buffers)
 	{
-		if (ecs->components[i])
+		ecs_command_buffer_t* buffer = ecs->command_buffers;
+		ecs->command_buffers = buffer->next;
+		if (buffer->commands)
+		{
+			heap_free(ecs->heap, buffer->commands);
+		}
+		if (buffer->data)
 		{
-			heap_free(ecs->heap, ecs->components[i]);
+			heap_free(ecs->heap, buffer->data);
 		}
+		heap_free(ecs->heap, buffer);
 	}
+	TlsFree(ecs->command_tls);
 	heap_free(ecs->heap, ecs);
 }
 
 void ecs_update(ecs_t* ecs)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	TRACE_ZONE_BEGIN(k_trace_category_ecs, "ecs_update");
+
+	// Spawns played back here are added and activated below along with any others.
+	for (ecs_command_buffer_t* buffer = ecs->command_buffers; buffer; buffer = buffer->next)
+	{
+		play_commands(ecs, buffer);
+	}
+
+	// An entity removed in the same frame it was added sits on both lists.
+	// It is no longer pending add, so only the remove pass affects it.
+	for (int i = 0; i < ecs->pending_add_count; ++i)
 	{
-		if (ecs->entity_states[i] == k_entity_pending_add)
+		entity_info_t* info = get_entity_info(ecs, ecs->pending_adds[i]);
+		if (info->state == k_entity_pending_add)
 		{
-			ecs->entity_states[i] = k_entity_active;
+			info->state = k_entity_active;
 		}
-		else if (ecs->entity_states[i] == k_entity_pending_remove)
+	}
+	ecs->pending_add_count = 0;
+
+	for (int i = 0; i < ecs->pending_remove_count; ++i)
+	{
+		int entity = ecs->pending_removes[i];
+		entity_info_t* info = get_entity_info(ecs, entity);
+		info->state = k_entity_unused;
+		archetype_remove_row(ecs, ecs->archetypes[info->archetype], info->row);
+		sparse_update_mask(ecs, entity, info->component_mask, ecs_mask_empty());
+		info->next_free = ecs->free_entity;
+		ecs->free_entity = entity;
+	}
+	ecs->pending_remove_count = 0;
+
+	++ecs->tick;
+	TRACE_ZONE_END(k_trace_category_ecs);
+}
+
+int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment)
+{
+	ecs_component_options_t options = { 0 };
+	return ecs_register_component_type_with_options(ecs, name, size_per_component, alignment, &options);
+}
+
+int ecs_register_component_type_with_options(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment, const ecs_component_options_t* options)
+{
+	if (ecs->component_type_count < k_max_component_types)
+	{
+		int i = ecs->component_type_count++;
+		alignment = size_per_component ? alignment : 1;
+		size_t aligned_size = (size_per_component + (alignment - 1)) & ~(alignment - 1);
+		ecs->component_type_names[i] = string_id_intern(name);
+		ecs->component_type_sizes[i] = aligned_size;
+		ecs->component_type_alignments[i] = alignment;
+		if (options->storage == k_ecs_storage_sparse && size_per_component)
 		{
-			ecs->entity_states[i] = k_entity_unused;
+			ecs_mask_set(&ecs->sparse_mask, i);
 		}
+		return i;
 	}
+	debug_print(k_print_warning, "Out of component types.");
+	return -1;
 }
 
-int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment)
+int ecs_register_tag_type(ecs_t* ecs, const char* name)
+{
+	return ecs_register_component_type(ecs, name, 0, 1);
+}
+
+int ecs_find_component_type(ecs_t* ecs, const char* name)
 {
-	for (int i = 0; i < _countof(ecs->components); ++i)
+	string_id_t id = string_id_find(name);
+	for (int i = 0; id != k_string_id_none && i < ecs->component_type_count; ++i)
 	{
-		if (ecs->components[i] == NULL)
+		if (ecs->component_type_names[i] == id)
 		{
-			size_t aligned_size = (size_per_component + (alignment - 1)) & ~(alignment - 1);
-			strcpy_s(ecs->component_type_names[i], sizeof(ecs->component_type_names[i]), name);
-			ecs->component_type_sizes[i] = aligned_size;
-			ecs->components[i] = heap_alloc(ecs->heap, aligned_size * k_max_entities, alignment);
-			memset(ecs->components[i], 0, aligned_size * k_max_entities);
 			return i;
 		}
 	}
-	debug_print(k_print_warning, "Out of component types.");
 	return -1;
 }
 
@@ -92,27 +445,144 @@ size_t ecs_get_component_type_size(ecs_t* ecs, int component_type)
 	return ecs->component_type_sizes[component_type];
 }
 
-ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, uint64_t component_mask)
+uint32_t ecs_get_tick(ecs_t* ecs)
+{
+	return ecs->tick;
+}
+
+ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, ecs_mask_t component_mask)
 {
-	for (int i = 0; i < _countof(ecs->entity_states); ++i)
+	int entity = alloc_entity(ecs, component_mask);
+	entity_info_t* info = get_entity_info(ecs, entity);
+
+	int archetype_index = -1;
+	ecs_archetype_t* archetype = find_or_create_archetype(ecs, component_mask, &archetype_index);
+	info->archetype = archetype_index;
+	info->row = archetype_add_row(ecs, archetype, entity);
+	sparse_update_mask(ecs, entity, ecs_mask_empty(), component_mask);
+	return (ecs_entity_ref_t) { .entity = entity, .sequence = info->sequence };
+}
+
+int ecs_register_prefab(ecs_t* ecs, ecs_mask_t component_mask)
+{
+	if (ecs->prefab_count == ecs->prefab_capacity)
+	{
+		ecs->prefabs = grow_array(ecs, ecs->prefabs, sizeof(prefab_t), &ecs->prefab_capacity);
+	}
+	int index = ecs->prefab_count++;
+	prefab_t* prefab = &ecs->prefabs[index];
+	memset(prefab, 0, sizeof(*prefab));
+	prefab->component_mask = component_mask;
+
+	size_t size = 0;
+	size_t alignment = 8;
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (ecs_mask_test(component_mask, i) && ecs->component_type_sizes[i])
+		{
+			size = (size + (ecs->component_type_alignments[i] - 1)) & ~(ecs->component_type_alignments[i] - 1);
+			prefab->offsets[i] = size;
+			size += ecs->component_type_sizes[i];
+			alignment = __max(alignment, ecs->component_type_alignments[i]);
+		}
+	}
+	prefab->defaults = heap_alloc(ecs->heap, __max(size, 1), alignment);
+	memset(prefab->defaults, 0, size);
+	return index;
+}
+
+void* ecs_prefab_get_component(ecs_t* ecs, int prefab, int component_type)
+{
+	prefab_t* p = &ecs->prefabs[prefab];
+	if (!ecs_mask_test(p->component_mask, component_type) || !ecs->component_type_sizes[component_type])
+	{
+		return NULL;
+	}
+	return &p->defaults[p->offsets[component_type]];
+}
+
+void ecs_instantiate_n(ecs_t* ecs, int prefab, int count, ecs_entity_ref_t* refs)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_ecs, "ecs_instantiate_n");
+	prefab_t* p = &ecs->prefabs[prefab];
+	int archetype_index = -1;
+	ecs_archetype_t* archetype = find_or_create_archetype(ecs, p->component_mask, &archetype_index);
+
+	int first_row = archetype->entity_count;
+	while (archetype->chunk_count << archetype->chunk_shift < first_row + count)
+	{
+		archetype_add_chunk(ecs, archetype);
+	}
+
+	// Fill the new rows a chunk at a time, each component's defaults copied across the rows in one go.
+	for (int row = first_row; row < first_row + count;)
+	{
+		char* chunk = archetype->chunks[row >> archetype->chunk_shift];
+		int first_index = row & (archetype->chunk_capacity - 1);
+		int run = __min(archetype->chunk_capacity - first_index, first_row + count - row);
+		for (int i = 0; i < run; ++i)
+		{
+			int entity = alloc_entity(ecs, p->component_mask);
+			entity_info_t* info = get_entity_info(ecs, entity);
+			info->archetype = archetype_index;
+			info->row = row + i;
+			((int*)chunk)[first_index + i] = entity;
+			if (refs)
+			{
+				refs[row - first_row + i] = (ecs_entity_ref_t) { .entity = entity, .sequence = info->sequence };
+			}
+		}
+		for (int i = 0; i < ecs->component_type_count; ++i)
+		{
+			if (ecs_mask_test(archetype->stored_mask, i))
+			{
+				size_t size = ecs->component_type_sizes[i];
+				fill_copies(&chunk[archetype->component_offsets[i] + size * first_index], &p->defaults[p->offsets[i]], size, run);
+				uint32_t* versions = (uint32_t*)&chunk[archetype->version_offsets[i]];
+				for (int j = 0; j < run; ++j)
+				{
+					versions[first_index + j] = ecs->tick;
+				}
+			}
+			if (ecs_mask_test(archetype->component_mask, i))
+			{
+				((uint32_t*)&chunk[archetype->chunk_version_offset])[i] = ecs->tick;
+			}
+		}
+		row += run;
+	}
+	archetype->entity_count += count;
+
+	// Sparse components live apart from the rows, so each instance gets its own.
+	ecs_mask_t sparse_mask = ecs_mask_and(p->component_mask, ecs->sparse_mask);
+	for (int i = ecs_mask_next(sparse_mask, 0); i >= 0; i = ecs_mask_next(sparse_mask, i + 1))
+	{
+		sparse_reserve(ecs, i, ecs->sparse_sets[i].count + count);
+	}
+	for (int row = first_row; !ecs_mask_is_empty(sparse_mask) && row < first_row + count; ++row)
 	{
-		if (ecs->entity_states[i] == k_entity_unused)
+		const char* chunk = archetype->chunks[row >> archetype->chunk_shift];
+		int entity = ((const int*)chunk)[row & (archetype->chunk_capacity - 1)];
+		sparse_update_mask(ecs, entity, ecs_mask_empty(), p->component_mask);
+		for (int i = ecs_mask_next(sparse_mask, 0); i >= 0; i = ecs_mask_next(sparse_mask, i + 1))
 		{
-			ecs->entity_states[i] = k_entity_pending_add;
-			ecs->sequences[i] = ecs->global_sequence++;
-			ecs->component_masks[i] = component_mask;
-			return (ecs_entity_ref_t) { .entity = i, .sequence = ecs->sequences[i] };
+			size_t size = ecs->component_type_sizes[i];
+			memcpy(&ecs->sparse_sets[i].data[size * sparse_find(ecs, i, entity)], &p->defaults[p->offsets[i]], size);
 		}
 	}
-	debug_print(k_print_warning, "Out of entities.");
-	return (ecs_entity_ref_t) { .entity = -1, .sequence = -1 };
+	TRACE_ZONE_END(k_trace_category_ecs);
 }
 
 void ecs_entity_remove(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 {
 	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add))
 	{
-		ecs->entity_states[ref.entity] = k_entity_pending_remove;
+		entity_info_t* info = get_entity_info(ecs, ref.entity);
+		if (info->state != k_entity_pending_remove)
+		{
+			info->state = k_entity_pending_remove;
+			push_pending(ecs, &ecs->pending_removes, &ecs->pending_remove_count, &ecs->pending_remove_capacity, ref.entity);
+		}
 	}
 	else
 	{
@@ -122,24 +592,92 @@ void ecs_entity_remove(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 
 bool ecs_is_entity_ref_valid(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pending_add)
 {
-	return ref.entity >= 0 &&
-		ecs->sequences[ref.entity] == ref.sequence &&
-		ecs->entity_states[ref.entity] >= (allow_pending_add ? k_entity_pending_add : k_entity_active);
+	if (ref.entity < 0 || ref.entity >= ecs->entity_page_count * k_entities_per_page)
+	{
+		return false;
+	}
+	entity_info_t* info = get_entity_info(ecs, ref.entity);
+	return info->sequence == ref.sequence &&
+		info->state >= (allow_pending_add ? k_entity_pending_add : k_entity_active);
 }
 
 void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, bool allow_pending_add)
 {
-	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add) && ecs->components[component_type])
+	if (ecs_is_entity_ref_valid(ecs, ref, allow_pending_add) && ecs_mask_test(get_entity_info(ecs, ref.entity)->component_mask, component_type))
 	{
-		char* components = ecs->components[component_type];
-		return &components[ecs->component_type_sizes[component_type] * ref.entity];
+		entity_info_t* info = get_entity_info(ecs, ref.entity);
+		return archetype_row_component(ecs, ecs->archetypes[info->archetype], info->row, component_type);
 	}
 	return NULL;
 }
 
-ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask)
+void ecs_entity_mark_changed(ecs_t* ecs, ecs_entity_ref_t ref, int component_type)
+{
+	if (ecs_is_entity_ref_valid(ecs, ref, true) && ecs_mask_test(get_entity_info(ecs, ref.entity)->component_mask, component_type))
+	{
+		entity_info_t* info = get_entity_info(ecs, ref.entity);
+		archetype_mark_row_changed(ecs, ecs->archetypes[info->archetype], info->row, component_type);
+	}
+}
+
+uint32_t ecs_entity_get_component_version(ecs_t* ecs, ecs_entity_ref_t ref, int component_type)
+{
+	if (ecs_is_entity_ref_valid(ecs, ref, true) && ecs_mask_test(get_entity_info(ecs, ref.entity)->component_mask, component_type))
+	{
+		if (ecs_mask_test(ecs->sparse_mask, component_type))
+		{
+			return ecs->sparse_sets[component_type].versions[sparse_find(ecs, component_type, ref.entity)];
+		}
+		entity_info_t* info = get_entity_info(ecs, ref.entity);
+		ecs_archetype_t* archetype = ecs->archetypes[info->archetype];
+		const char* chunk = archetype->chunks[info->row >> archetype->chunk_shift];
+		if (!ecs_mask_test(archetype->stored_mask, component_type))
+		{
+			return ((const uint32_t*)&chunk[archetype->chunk_version_offset])[component_type];
+		}
+		const uint32_t* versions = (const uint32_t*)&chunk[archetype->version_offsets[component_type]];
+		return versions[info->row & (archetype->chunk_capacity - 1)];
+	}
+	return 0;
+}
+
+int ecs_register_query(ecs_t* ecs, ecs_mask_t mask)
+{
+	if (ecs->registered_query_count == ecs->registered_query_capacity)
+	{
+		ecs->registered_queries = grow_array(ecs, ecs->registered_queries, sizeof(registered_query_t), &ecs->registered_query_capacity);
+	}
+	int index = ecs->registered_query_count++;
+	registered_query_t* registered = &ecs->registered_queries[index];
+	memset(registered, 0, sizeof(*registered));
+	registered->component_mask = mask;
+
+	// Archetypes created from here on are added as they are created.
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		if (ecs_mask_contains(ecs->archetypes[i]->component_mask, mask))
+		{
+			push_pending(ecs, &registered->archetypes, &registered->archetype_count, &registered->archetype_capacity, i);
+		}
+	}
+	return index;
+}
+
+ecs_query_t ecs_query_create(ecs_t* ecs, ecs_mask_t mask)
+{
+	return ecs_query_create_changed(ecs, mask, ecs_mask_empty(), 0);
+}
+
+ecs_query_t ecs_query_create_registered(ecs_t* ecs, int registered)
+{
+	ecs_query_t query = { .component_mask = ecs->registered_queries[registered].component_mask, .registered = registered, .entity = -1, .row = -1 };
+	ecs_query_next(ecs, &query);
+	return query;
+}
+
+ecs_query_t ecs_query_create_changed(ecs_t* ecs, ecs_mask_t mask, ecs_mask_t changed_mask, uint32_t since_tick)
 {
-	ecs_query_t query = { .component_mask = mask, .entity = -1 };
+	ecs_query_t query = { .component_mask = mask, .changed_mask = changed_mask, .since_tick = since_tick, .registered = -1, .entity = -1, .row = -1 };
 	ecs_query_next(ecs, &query);
 	return query;
 }
@@ -151,12 +689,34 @@ bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query)
 
 void ecs_query_next(ecs_t* ecs, ecs_query_t* query)
 {
-	for (int i = query->entity + 1; i < _countof(ecs->component_masks); ++i)
+	++query->row;
+	bool filtered = !ecs_mask_is_empty(query->changed_mask);
+	for (; (query->archetype = find_archetype(ecs, query->registered, query->component_mask, &query->match)) >= 0; ++query->match, query->row = 0)
 	{
-		if ((ecs->component_masks[i] & query->component_mask) == query->component_mask && ecs->entity_states[i] >= k_entity_active)
+		ecs_archetype_t* archetype = ecs->archetypes[query->archetype];
+		for (; query->row < archetype->entity_count; ++query->row)
 		{
-			query->entity = i;
-			return;
+			if (filtered)
+			{
+				// Skip whole chunks that have not changed.
+				if ((query->row & (archetype->chunk_capacity - 1)) == 0 &&
+					!archetype_chunk_changed(archetype, query->row >> archetype->chunk_shift, query->changed_mask, query->since_tick))
+				{
+					query->row += archetype->chunk_capacity - 1;
+					continue;
+				}
+				if (!archetype_row_changed(ecs, archetype, query->row, query->changed_mask, query->since_tick))
+				{
+					continue;
+				}
+			}
+			const int* entities = (const int*)archetype->chunks[query->row >> archetype->chunk_shift];
+			int entity = entities[query->row & (archetype->chunk_capacity - 1)];
+			if (get_entity_info(ecs, entity)->state >= k_entity_active)
+			{
+				query->entity = entity;
+				return;
+			}
 		}
 	}
 	query->entity = -1;
@@ -164,11 +724,1129 @@ void ecs_query_next(ecs_t* ecs, ecs_query_t* query)
 
 void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type)
 {
-	char* components = ecs->components[component_type];
-	return &components[ecs->component_type_sizes[component_type] * query->entity];
+	return archetype_row_component(ecs, ecs->archetypes[query->archetype], query->row, component_type);
 }
 
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query)
 {
-	return (ecs_entity_ref_t) { .entity = query->entity, .sequence = ecs->sequences[query->entity] };
+	return (ecs_entity_ref_t) { .entity = query->entity, .sequence = get_entity_info(ecs, query->entity)->sequence };
+}
+
+void ecs_query_mark_changed(ecs_t* ecs, ecs_query_t* query, int component_type)
+{
+	archetype_mark_row_changed(ecs, ecs->archetypes[query->archetype], query->row, component_type);
+}
+
+ecs_chunk_query_t ecs_chunk_query_create(ecs_t* ecs, ecs_mask_t mask)
+{
+	return ecs_chunk_query_create_changed(ecs, mask, ecs_mask_empty(), 0);
+}
+
+ecs_chunk_query_t ecs_chunk_query_create_registered(ecs_t* ecs, int registered)
+{
+	ecs_chunk_query_t query = { .component_mask = ecs->registered_queries[registered].component_mask, .registered = registered, .chunk = -1, .count = 0 };
+	ecs_chunk_query_next(ecs, &query);
+	return query;
+}
+
+ecs_chunk_query_t ecs_chunk_query_create_changed(ecs_t* ecs, ecs_mask_t mask, ecs_mask_t changed_mask, uint32_t since_tick)
+{
+	ecs_chunk_query_t query = { .component_mask = mask, .changed_mask = changed_mask, .since_tick = since_tick, .registered = -1, .chunk = -1, .count = 0 };
+	ecs_chunk_query_next(ecs, &query);
+	return query;
+}
+
+bool ecs_chunk_query_is_valid(ecs_t* ecs, ecs_chunk_query_t* query)
+{
+	return query->count > 0;
+}
+
+void ecs_chunk_query_next(ecs_t* ecs, ecs_chunk_query_t* query)
+{
+	++query->chunk;
+	bool filtered = !ecs_mask_is_empty(query->changed_mask);
+	for (; (query->archetype = find_archetype(ecs, query->registered, query->component_mask, &query->match)) >= 0; ++query->match, query->chunk = 0)
+	{
+		ecs_archetype_t* archetype = ecs->archetypes[query->archetype];
+		// Rows are packed, so only the last used chunk can be partially full.
+		for (int first_row = query->chunk << archetype->chunk_shift;
+			first_row < archetype->entity_count;
+			first_row = ++query->chunk << archetype->chunk_shift)
+		{
+			if (!filtered || archetype_chunk_changed(archetype, query->chunk, query->changed_mask, query->since_tick))
+			{
+				query->count = __min(archetype->chunk_capacity, archetype->entity_count - first_row);
+				return;
+			}
+		}
+	}
+	query->count = 0;
+}
+
+int ecs_chunk_query_get_count(ecs_t* ecs, ecs_chunk_query_t* query)
+{
+	return query->count;
+}
+
+ecs_mask_t ecs_chunk_query_get_component_mask(ecs_t* ecs, ecs_chunk_query_t* query)
+{
+	return ecs->archetypes[query->archetype]->component_mask;
+}
+
+void* ecs_chunk_query_get_components(ecs_t* ecs, ecs_chunk_query_t* query, int component_type)
+{
+	if (ecs_mask_test(ecs->sparse_mask, component_type))
+	{
+		return NULL;
+	}
+	ecs_archetype_t* archetype = ecs->archetypes[query->archetype];
+	return &archetype->chunks[query->chunk][archetype->component_offsets[component_type]];
+}
+
+ecs_entity_ref_t ecs_chunk_query_get_entity(ecs_t* ecs, ecs_chunk_query_t* query, int index)
+{
+	const int* entities = (const int*)ecs->archetypes[query->archetype]->chunks[query->chunk];
+	int entity = entities[index];
+	return (ecs_entity_ref_t) { .entity = entity, .sequence = get_entity_info(ecs, entity)->sequence };
+}
+
+void ecs_chunk_query_mark_changed(ecs_t* ecs, ecs_chunk_query_t* query, int component_type)
+{
+	ecs_archetype_t* archetype = ecs->archetypes[query->archetype];
+	if (!ecs_mask_test(archetype->component_mask, component_type))
+	{
+		return;
+	}
+	char* chunk = archetype->chunks[query->chunk];
+	if (ecs_mask_test(archetype->stored_mask, component_type))
+	{
+		uint32_t* versions = (uint32_t*)&chunk[archetype->version_offsets[component_type]];
+		for (int i = 0; i < query->count; ++i)
+		{
+			versions[i] = ecs->tick;
+		}
+	}
+	else if (ecs_mask_test(ecs->sparse_mask, component_type))
+	{
+		const int* entities = (const int*)chunk;
+		sparse_set_t* set = &ecs->sparse_sets[component_type];
+		for (int i = 0; i < query->count; ++i)
+		{
+			set->versions[sparse_find(ecs, component_type, entities[i])] = ecs->tick;
+		}
+	}
+	((uint32_t*)&chunk[archetype->chunk_version_offset])[component_type] = ecs->tick;
+}
+
+int ecs_command_spawn(ecs_t* ecs, ecs_mask_t component_mask, ecs_spawn_callback_t callback, void* callback_data)
+{
+	ecs_command_buffer_t* buffer = get_command_buffer(ecs);
+	command_t* command = push_command(ecs, buffer, k_command_spawn, -1, NULL);
+	command->component_mask = component_mask;
+	command->callback = callback;
+	command->callback_data = callback_data;
+	return buffer->command_count - 1;
+}
+
+void ecs_command_set_spawn_component(ecs_t* ecs, int spawn, int component_type, const void* data)
+{
+	ecs_command_buffer_t* buffer = get_command_buffer(ecs);
+	command_t* command = push_command(ecs, buffer, k_command_spawn_component, component_type, data);
+	command->spawn = spawn;
+}
+
+void ecs_command_despawn(ecs_t* ecs, ecs_entity_ref_t ref)
+{
+	command_t* command = push_command(ecs, get_command_buffer(ecs), k_command_despawn, -1, NULL);
+	command->ref = ref;
+}
+
+void ecs_command_add_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, const void* data)
+{
+	command_t* command = push_command(ecs, get_command_buffer(ecs), k_command_add_component, component_type, data);
+	command->ref = ref;
+}
+
+void ecs_command_remove_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type)
+{
+	command_t* command = push_command(ecs, get_command_buffer(ecs), k_command_remove_component, component_type, NULL);
+	command->ref = ref;
+}
+
+void* ecs_save(ecs_t* ecs, heap_t* heap, size_t* size)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_ecs, "ecs_save");
+	*size = save_size(ecs);
+	char* data = heap_alloc(heap, *size, 8);
+	char* cursor = data;
+
+	save_header_t header =
+	{
+		.magic = k_save_magic,
+		.version = k_save_version,
+		.tick = ecs->tick,
+		.global_sequence = ecs->global_sequence,
+		.free_entity = ecs->free_entity,
+		.component_type_count = ecs->component_type_count,
+		.entity_page_count = ecs->entity_page_count,
+		.archetype_count = ecs->archetype_count,
+	};
+	write_bytes(&cursor, &header, sizeof(header));
+
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		save_type_t type = { .size = ecs->component_type_sizes[i], .alignment = ecs->component_type_alignments[i], .sparse = ecs_mask_test(ecs->sparse_mask, i) };
+		//names are compared to registered ones up to the length saved
+		const char* name = string_id_get(ecs->component_type_names[i]);
+		memcpy(type.name, name, __min(strlen(name), sizeof(type.name) - 1));
+		write_bytes(&cursor, &type, sizeof(type));
+	}
+
+	for (int i = 0; i < ecs->entity_page_count; ++i)
+	{
+		write_bytes(&cursor, ecs->entity_pages[i], sizeof(entity_info_t) * k_entities_per_page);
+	}
+
+	// Chunks hold entity indices rather than pointers, so they are written as they are.
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		ecs_archetype_t* archetype = ecs->archetypes[i];
+		save_archetype_t saved =
+		{
+			.component_mask = archetype->component_mask,
+			.chunk_size = archetype->chunk_size,
+			.entity_count = archetype->entity_count,
+			.chunk_count = (archetype->entity_count + archetype->chunk_capacity - 1) >> archetype->chunk_shift,
+		};
+		write_bytes(&cursor, &saved, sizeof(saved));
+		for (int c = 0; c < saved.chunk_count; ++c)
+		{
+			write_bytes(&cursor, archetype->chunks[c], archetype->chunk_size);
+		}
+	}
+
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (ecs_mask_test(ecs->sparse_mask, i))
+		{
+			sparse_set_t* set = &ecs->sparse_sets[i];
+			int32_t count = set->count;
+			write_bytes(&cursor, &count, sizeof(count));
+			write_bytes(&cursor, set->entities, sizeof(int) * set->count);
+			write_bytes(&cursor, set->versions, sizeof(uint32_t) * set->count);
+			write_bytes(&cursor, set->data, ecs->component_type_sizes[i] * set->count);
+		}
+	}
+	TRACE_ZONE_END(k_trace_category_ecs);
+	return data;
+}
+
+bool ecs_load(ecs_t* ecs, const void* data, size_t size)
+{
+	const char* cursor = data;
+	const char* end = cursor + size;
+
+	save_header_t header = { 0 };
+	if (!read_bytes(&cursor, end, &header, sizeof(header)) ||
+		header.magic != k_save_magic ||
+		header.version != k_save_version ||
+		header.component_type_count != ecs->component_type_count ||
+		header.entity_page_count < 0 ||
+		header.archetype_count < 0)
+	{
+		debug_print(k_print_error, "Saved world is invalid.\n");
+		return false;
+	}
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		save_type_t type;
+		if (!read_bytes(&cursor, end, &type, sizeof(type)) ||
+			type.size != ecs->component_type_sizes[i] ||
+			type.alignment != ecs->component_type_alignments[i] ||
+			type.sparse != (uint64_t)ecs_mask_test(ecs->sparse_mask, i) ||
+			strncmp(type.name, string_id_get(ecs->component_type_names[i]), sizeof(type.name) - 1) != 0)
+		{
+			debug_print(k_print_error, "Saved world's component types differ from those registered.\n");
+			return false;
+		}
+	}
+
+	size_t entity_table_size = sizeof(entity_info_t) * k_entities_per_page * header.entity_page_count;
+	const char* entity_table = cursor;
+	if ((size_t)(end - cursor) < entity_table_size)
+	{
+		debug_print(k_print_error, "Saved world is invalid.\n");
+		return false;
+	}
+	cursor += entity_table_size;
+	int entity_count = header.entity_page_count * k_entities_per_page;
+	bool valid = true;
+	for (int i = 0; i < entity_count && valid; ++i)
+	{
+		entity_info_t info;
+		memcpy(&info, entity_table + sizeof(entity_info_t) * i, sizeof(info));
+		valid = info.state == k_entity_unused || (info.archetype >= 0 && info.archetype < header.archetype_count);
+	}
+
+	// Check every section before changing anything; archetypes this creates are empty, so harmless if it fails.
+	const char* sections = cursor;
+	int* remap = heap_alloc(ecs->heap, sizeof(int) * (header.archetype_count + 1), 8);
+	if (!valid ||
+		!load_archetypes(ecs, &cursor, end, header.archetype_count, remap, false) ||
+		!load_sparse_sets(ecs, &cursor, end, entity_count, false))
+	{
+		debug_print(k_print_error, "Saved world is invalid.\n");
+		heap_free(ecs->heap, remap);
+		return false;
+	}
+
+	TRACE_ZONE_BEGIN(k_trace_category_ecs, "ecs_load");
+	for (ecs_command_buffer_t* buffer = ecs->command_buffers; buffer; buffer = buffer->next)
+	{
+		buffer->command_count = 0;
+		buffer->data_size = 0;
+	}
+	ecs->pending_add_count = 0;
+	ecs->pending_remove_count = 0;
+
+	while (ecs->entity_page_count < header.entity_page_count)
+	{
+		grow_entity_pages(ecs);
+	}
+	while (ecs->entity_page_count > header.entity_page_count)
+	{
+		heap_free(ecs->heap, ecs->entity_pages[--ecs->entity_page_count]);
+	}
+	for (int i = 0; i < ecs->entity_page_count; ++i)
+	{
+		memcpy(ecs->entity_pages[i], entity_table + sizeof(entity_info_t) * k_entities_per_page * i, sizeof(entity_info_t) * k_entities_per_page);
+	}
+
+	cursor = sections;
+	load_archetypes(ecs, &cursor, end, header.archetype_count, remap, true);
+	load_sparse_sets(ecs, &cursor, end, entity_count, true);
+
+	// Archetype indices are remapped to this system's, and pending entities queued again.
+	for (int i = 0; i < ecs->entity_page_count * k_entities_per_page; ++i)
+	{
+		entity_info_t* info = get_entity_info(ecs, i);
+		if (info->state != k_entity_unused)
+		{
+			info->archetype = remap[info->archetype];
+		}
+		if (info->state == k_entity_pending_add)
+		{
+			push_pending(ecs, &ecs->pending_adds, &ecs->pending_add_count, &ecs->pending_add_capacity, i);
+		}
+		else if (info->state == k_entity_pending_remove)
+		{
+			push_pending(ecs, &ecs->pending_removes, &ecs->pending_remove_count, &ecs->pending_remove_capacity, i);
+		}
+	}
+	heap_free(ecs->heap, remap);
+
+	ecs->tick = header.tick;
+	ecs->global_sequence = header.global_sequence;
+	ecs->free_entity = header.free_entity;
+	TRACE_ZONE_END(k_trace_category_ecs);
+	return true;
+}
+
+int ecs_save_file(ecs_t* ecs, fs_t* fs, const char* path, bool use_compression)
+{
+	size_t size = 0;
+	void* data = ecs_save(ecs, ecs->heap, &size);
+	fs_work_t* work = fs_write(fs, path, data, size, use_compression);
+	fs_work_wait(work);
+	int result = fs_work_get_result(work);
+	fs_work_destroy(work);
+	heap_free(ecs->heap, data);
+	if (result)
+	{
+		debug_print(k_print_error, "Unable to save world to %s.\n", path);
+	}
+	return result;
+}
+
+int ecs_load_file(ecs_t* ecs, fs_t* fs, const char* path, bool use_compression)
+{
+	//a mapped view needs no copy of its own, but compressed files must be decompressed somewhere
+	fs_work_t* work = use_compression ? fs_read(fs, path, ecs->heap, false, true) : fs_map(fs, path);
+	fs_work_wait(work);
+	int result = fs_work_get_result(work);
+	void* data = fs_work_get_buffer(work);
+	if (!result && !ecs_load(ecs, data, fs_work_get_size(work)))
+	{
+		result = -1;
+	}
+	if (result)
+	{
+		debug_print(k_print_error, "Unable to load world from %s.\n", path);
+	}
+	if (use_compression && data)
+	{
+		heap_free(ecs->heap, data);
+	}
+	fs_work_destroy(work);
+	return result;
+}
+
+static entity_info_t* get_entity_info(ecs_t* ecs, int entity)
+{
+	return &ecs->entity_pages[entity >> k_entity_page_shift][entity & (k_entities_per_page - 1)];
+}
+
+static void grow_entity_pages(ecs_t* ecs)
+{
+	if (ecs->entity_page_count == ecs->entity_page_capacity)
+	{
+		ecs->entity_pages = grow_array(ecs, ecs->entity_pages, sizeof(entity_info_t*), &ecs->entity_page_capacity);
+	}
+
+	entity_info_t* page = heap_alloc(ecs->heap, sizeof(entity_info_t) * k_entities_per_page, 8);
+	memset(page, 0, sizeof(entity_info_t) * k_entities_per_page);
+	ecs->entity_pages[ecs->entity_page_count] = page;
+
+	// Chain the new slots onto the free list, lowest index first.
+	int first = ecs->entity_page_count++ << k_entity_page_shift;
+	for (int i = k_entities_per_page - 1; i >= 0; --i)
+	{
+		page[i].next_free = ecs->free_entity;
+		ecs->free_entity = first + i;
+	}
+}
+
+// Take a free entity slot for a new entity pending add, with a new sequence and the masked components.
+// The caller gives it a row.
+static int alloc_entity(ecs_t* ecs, ecs_mask_t component_mask)
+{
+	if (ecs->free_entity < 0)
+	{
+		grow_entity_pages(ecs);
+	}
+	int entity = ecs->free_entity;
+	entity_info_t* info = get_entity_info(ecs, entity);
+	ecs->free_entity = info->next_free;
+
+	info->state = k_entity_pending_add;
+	info->sequence = ecs->global_sequence++;
+	info->component_mask = component_mask;
+	push_pending(ecs, &ecs->pending_adds, &ecs->pending_add_count, &ecs->pending_add_capacity, entity);
+	return entity;
+}
+
+static void push_pending(ecs_t* ecs, int** list, int* count, int* capacity, int entity)
+{
+	if (*count == *capacity)
+	{
+		*list = grow_array(ecs, *list, sizeof(int), capacity);
+	}
+	(*list)[(*count)++] = entity;
+}
+
+static void* grow_array(ecs_t* ecs, void* array, size_t element_size, int* capacity)
+{
+	*capacity = *capacity ? *capacity * 2 : 16;
+	return heap_realloc(ecs->heap, array, element_size * *capacity, 8);
+}
+
+static ecs_archetype_t* find_or_create_archetype(ecs_t* ecs, ecs_mask_t component_mask, int* archetype_index)
+{
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		if (ecs_mask_equals(ecs->archetypes[i]->component_mask, component_mask))
+		{
+			*archetype_index = i;
+			return ecs->archetypes[i];
+		}
+	}
+
+	if (ecs->archetype_count == ecs->archetype_capacity)
+	{
+		ecs->archetypes = grow_array(ecs, ecs->archetypes, sizeof(ecs_archetype_t*), &ecs->archetype_capacity);
+	}
+
+	ecs_archetype_t* archetype = heap_alloc(ecs->heap, sizeof(ecs_archetype_t), 8);
+	memset(archetype, 0, sizeof(*archetype));
+	archetype->component_mask = component_mask;
+
+	// Chunk write ticks are indexed by component type, up to the archetype's last.
+	for (int i = ecs_mask_next(component_mask, 0); i >= 0; i = ecs_mask_next(component_mask, i + 1))
+	{
+		archetype->chunk_version_count = i + 1;
+	}
+
+	// Size of one entity's worth of data, including worst-case alignment padding per array.
+	size_t row_size = sizeof(int);
+	size_t padding = sizeof(uint32_t) * archetype->chunk_version_count;
+	ecs_mask_t dense_mask = ecs_mask_and_not(component_mask, ecs->sparse_mask);
+	for (int i = ecs_mask_next(dense_mask, 0); i >= 0; i = ecs_mask_next(dense_mask, i + 1))
+	{
+		if (ecs->component_type_sizes[i])
+		{
+			ecs_mask_set(&archetype->stored_mask, i);
+			row_size += ecs->component_type_sizes[i] + sizeof(uint32_t);
+			padding += ecs->component_type_alignments[i] + sizeof(uint32_t);
+		}
+	}
+
+	// Largest power of two number of rows that fits in a chunk.
+	// Power of two keeps row to chunk/index conversion to a shift and a mask.
+	archetype->chunk_shift = 0;
+	while ((row_size << (archetype->chunk_shift + 1)) + padding <= k_chunk_size)
+	{
+		++archetype->chunk_shift;
+	}
+	archetype->chunk_capacity = 1 << archetype->chunk_shift;
+
+	size_t offset = sizeof(int) * archetype->chunk_capacity;
+	archetype->chunk_version_offset = offset;
+	offset += sizeof(uint32_t) * archetype->chunk_version_count;
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (ecs_mask_test(archetype->stored_mask, i))
+		{
+			size_t alignment = ecs->component_type_alignments[i];
+			offset = (offset + (alignment - 1)) & ~(alignment - 1);
+			archetype->component_offsets[i] = offset;
+			offset += ecs->component_type_sizes[i] * archetype->chunk_capacity;
+
+			offset = (offset + (sizeof(uint32_t) - 1)) & ~(sizeof(uint32_t) - 1);
+			archetype->version_offsets[i] = offset;
+			offset += sizeof(uint32_t) * archetype->chunk_capacity;
+		}
+	}
+	archetype->chunk_size = offset;
+
+	*archetype_index = ecs->archetype_count;
+	ecs->archetypes[ecs->archetype_count++] = archetype;
+
+	for (int i = 0; i < ecs->registered_query_count; ++i)
+	{
+		registered_query_t* registered = &ecs->registered_queries[i];
+		if (ecs_mask_contains(component_mask, registered->component_mask))
+		{
+			push_pending(ecs, &registered->archetypes, &registered->archetype_count, &registered->archetype_capacity, *archetype_index);
+		}
+	}
+	return archetype;
+}
+
+static void archetype_add_chunk(ecs_t* ecs, ecs_archetype_t* archetype)
+{
+	if (archetype->chunk_count == archetype->chunk_array_capacity)
+	{
+		archetype->chunks = grow_array(ecs, archetype->chunks, sizeof(char*), &archetype->chunk_array_capacity);
+	}
+	char* new_chunk = heap_alloc(ecs->heap, archetype->chunk_size, 64);
+	memset(&new_chunk[archetype->chunk_version_offset], 0, sizeof(uint32_t) * archetype->chunk_version_count);
+	archetype->chunks[archetype->chunk_count++] = new_chunk;
+}
+
+static int archetype_add_row(ecs_t* ecs, ecs_archetype_t* archetype, int entity)
+{
+	int row = archetype->entity_count;
+	int chunk_index = row >> archetype->chunk_shift;
+	if (chunk_index >= archetype->chunk_count)
+	{
+		archetype_add_chunk(ecs, archetype);
+	}
+
+	char* chunk = archetype->chunks[chunk_index];
+	int index = row & (archetype->chunk_capacity - 1);
+	((int*)chunk)[index] = entity;
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (ecs_mask_test(archetype->stored_mask, i))
+		{
+			size_t size = ecs->component_type_sizes[i];
+			memset(&chunk[archetype->component_offsets[i] + size * index], 0, size);
+			((uint32_t*)&chunk[archetype->version_offsets[i]])[index] = ecs->tick;
+		}
+		if (ecs_mask_test(archetype->component_mask, i))
+		{
+			((uint32_t*)&chunk[archetype->chunk_version_offset])[i] = ecs->tick;
+		}
+	}
+
+	archetype->entity_count++;
+	return row;
+}
+
+// Write count copies of size bytes from src to dst, doubling what is copied each pass.
+static void fill_copies(char* dst, const char* src, size_t size, int count)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+	memcpy(dst, src, size);
+	for (int done = 1; done < count;)
+	{
+		int copies = __min(done, count - done);
+		memcpy(&dst[size * done], dst, size * copies);
+		done += copies;
+	}
+}
+
+static void archetype_remove_row(ecs_t* ecs, ecs_archetype_t* archetype, int row)
+{
+	// Keep the archetype packed by moving its last row into the hole.
+	int last_row = archetype->entity_count - 1;
+	if (row != last_row)
+	{
+		char* dst_chunk = archetype->chunks[row >> archetype->chunk_shift];
+		char* src_chunk = archetype->chunks[last_row >> archetype->chunk_shift];
+		int dst_index = row & (archetype->chunk_capacity - 1);
+		int src_index = last_row & (archetype->chunk_capacity - 1);
+
+		int moved_entity = ((int*)src_chunk)[src_index];
+		((int*)dst_chunk)[dst_index] = moved_entity;
+		for (int i = 0; i < ecs->component_type_count; ++i)
+		{
+			if (ecs_mask_test(archetype->stored_mask, i))
+			{
+				size_t size = ecs->component_type_sizes[i];
+				size_t offset = archetype->component_offsets[i];
+				memcpy(&dst_chunk[offset + size * dst_index], &src_chunk[offset + size * src_index], size);
+
+				// The moved row's write tick travels with it and may be newer than anything in the destination chunk.
+				uint32_t version = ((uint32_t*)&src_chunk[archetype->version_offsets[i]])[src_index];
+				((uint32_t*)&dst_chunk[archetype->version_offsets[i]])[dst_index] = version;
+				uint32_t* chunk_version = &((uint32_t*)&dst_chunk[archetype->chunk_version_offset])[i];
+				*chunk_version = __max(*chunk_version, version);
+			}
+			else if (ecs_mask_test(archetype->component_mask, i))
+			{
+				// A tag's tick is its chunk's, so the moved row carries the source chunk's.
+				// Sparse components keep per-entity ticks in their set, but the chunk's still has to cover them.
+				uint32_t version = ((uint32_t*)&src_chunk[archetype->chunk_version_offset])[i];
+				uint32_t* chunk_version = &((uint32_t*)&dst_chunk[archetype->chunk_version_offset])[i];
+				*chunk_version = __max(*chunk_version, version);
+			}
+		}
+		get_entity_info(ecs, moved_entity)->row = row;
+	}
+	archetype->entity_count--;
+}
+
+static void archetype_mark_row_changed(ecs_t* ecs, ecs_archetype_t* archetype, int row, int component_type)
+{
+	if (!ecs_mask_test(archetype->component_mask, component_type))
+	{
+		return;
+	}
+	char* chunk = archetype->chunks[row >> archetype->chunk_shift];
+	if (ecs_mask_test(archetype->stored_mask, component_type))
+	{
+		((uint32_t*)&chunk[archetype->version_offsets[component_type]])[row & (archetype->chunk_capacity - 1)] = ecs->tick;
+	}
+	else if (ecs_mask_test(ecs->sparse_mask, component_type))
+	{
+		int entity = ((const int*)chunk)[row & (archetype->chunk_capacity - 1)];
+		ecs->sparse_sets[component_type].versions[sparse_find(ecs, component_type, entity)] = ecs->tick;
+	}
+	((uint32_t*)&chunk[archetype->chunk_version_offset])[component_type] = ecs->tick;
+}
+
+static bool archetype_chunk_changed(ecs_archetype_t* archetype, int chunk_index, ecs_mask_t changed_mask, uint32_t since_tick)
+{
+	const uint32_t* chunk_versions = (const uint32_t*)&archetype->chunks[chunk_index][archetype->chunk_version_offset];
+	ecs_mask_t mask = ecs_mask_and(changed_mask, archetype->component_mask);
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		if (chunk_versions[i] >= since_tick)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool archetype_row_changed(ecs_t* ecs, ecs_archetype_t* archetype, int row, ecs_mask_t changed_mask, uint32_t since_tick)
+{
+	const char* chunk = archetype->chunks[row >> archetype->chunk_shift];
+	int index = row & (archetype->chunk_capacity - 1);
+	ecs_mask_t mask = ecs_mask_and(changed_mask, archetype->component_mask);
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		uint32_t version;
+		if (ecs_mask_test(archetype->stored_mask, i))
+		{
+			version = ((const uint32_t*)&chunk[archetype->version_offsets[i]])[index];
+		}
+		else if (ecs_mask_test(ecs->sparse_mask, i))
+		{
+			version = ecs->sparse_sets[i].versions[sparse_find(ecs, i, ((const int*)chunk)[index])];
+		}
+		else
+		{
+			version = ((const uint32_t*)&chunk[archetype->chunk_version_offset])[i];
+		}
+		if (version >= since_tick)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Find the first archetype a query matches at or after a match position, or -1 past the last.
+// A registered query's position indexes its archetype list; otherwise every archetype's mask is tested in turn.
+static int find_archetype(ecs_t* ecs, int registered, ecs_mask_t mask, int* match)
+{
+	if (registered >= 0)
+	{
+		const registered_query_t* query = &ecs->registered_queries[registered];
+		return *match < query->archetype_count ? query->archetypes[*match] : -1;
+	}
+	for (; *match < ecs->archetype_count; ++*match)
+	{
+		if (archetype_matches(ecs->archetypes[*match], &mask))
+		{
+			return *match;
+		}
+	}
+	return -1;
+}
+
+// Determines if an archetype has every component type of a query mask, comparing 128 bits at a time.
+static bool archetype_matches(const ecs_archetype_t* archetype, const ecs_mask_t* mask)
+{
+#if MATH_SIMD
+	__m128i missing = _mm_setzero_si128();
+	for (int i = 0; i < k_ecs_mask_words; i += 4)
+	{
+		__m128i query = _mm_loadu_si128((const __m128i*)&mask->words[i]);
+		__m128i has = _mm_loadu_si128((const __m128i*)&archetype->component_mask.words[i]);
+		missing = _mm_or_si128(missing, _mm_andnot_si128(has, query));
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(missing, _mm_setzero_si128())) == 0xffff;
+#else
+	return ecs_mask_contains(archetype->component_mask, *mask);
+#endif
+}
+
+// Get a row's component, from its chunk or, for a sparse type, its set.
+static void* archetype_row_component(ecs_t* ecs, ecs_archetype_t* archetype, int row, int component_type)
+{
+	char* chunk = archetype->chunks[row >> archetype->chunk_shift];
+	size_t index = row & (archetype->chunk_capacity - 1);
+	if (ecs_mask_test(ecs->sparse_mask, component_type))
+	{
+		sparse_set_t* set = &ecs->sparse_sets[component_type];
+		return &set->data[ecs->component_type_sizes[component_type] * sparse_find(ecs, component_type, ((const int*)chunk)[index])];
+	}
+	return &chunk[archetype->component_offsets[component_type] + ecs->component_type_sizes[component_type] * index];
+}
+
+// Move an entity to the archetype of a new component mask.
+// Components it keeps carry their data and write ticks; components it gains start zeroed and changed this tick.
+// Sparse components it keeps stay where they are in their sets.
+static void entity_set_component_mask(ecs_t* ecs, int entity, ecs_mask_t component_mask)
+{
+	entity_info_t* info = get_entity_info(ecs, entity);
+	if (ecs_mask_equals(info->component_mask, component_mask))
+	{
+		return;
+	}
+
+	int archetype_index = -1;
+	ecs_archetype_t* new_archetype = find_or_create_archetype(ecs, component_mask, &archetype_index);
+	ecs_archetype_t* old_archetype = ecs->archetypes[info->archetype];
+	int new_row = archetype_add_row(ecs, new_archetype, entity);
+
+	ecs_mask_t kept_mask = ecs_mask_and(new_archetype->stored_mask, old_archetype->stored_mask);
+	char* new_chunk = new_archetype->chunks[new_row >> new_archetype->chunk_shift];
+	const char* old_chunk = old_archetype->chunks[info->row >> old_archetype->chunk_shift];
+	int new_index = new_row & (new_archetype->chunk_capacity - 1);
+	int old_index = info->row & (old_archetype->chunk_capacity - 1);
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (ecs_mask_test(kept_mask, i))
+		{
+			memcpy(archetype_row_component(ecs, new_archetype, new_row, i),
+				archetype_row_component(ecs, old_archetype, info->row, i), ecs->component_type_sizes[i]);
+			uint32_t version = ((const uint32_t*)&old_chunk[old_archetype->version_offsets[i]])[old_index];
+			((uint32_t*)&new_chunk[new_archetype->version_offsets[i]])[new_index] = version;
+		}
+	}
+
+	//the old row's hole is filled by that archetype's last row, whose entity info is updated with it
+	archetype_remove_row(ecs, old_archetype, info->row);
+	sparse_update_mask(ecs, entity, info->component_mask, component_mask);
+	info->archetype = archetype_index;
+	info->row = new_row;
+	info->component_mask = component_mask;
+}
+
+// Find an entity's position in a sparse type's packed arrays, or -1 if it lacks the type.
+static int sparse_find(ecs_t* ecs, int component_type, int entity)
+{
+	const sparse_set_t* set = &ecs->sparse_sets[component_type];
+	int page = entity >> k_entity_page_shift;
+	if (page >= set->index_page_count || !set->index_pages[page])
+	{
+		return -1;
+	}
+	return set->index_pages[page][entity & (k_entities_per_page - 1)] - 1;
+}
+
+// Get an entity slot's entry in a sparse type's index, allocating its page if needed.
+static int* sparse_index_slot(ecs_t* ecs, int component_type, int entity)
+{
+	sparse_set_t* set = &ecs->sparse_sets[component_type];
+	int page = entity >> k_entity_page_shift;
+	if (page >= set->index_page_count)
+	{
+		//the index covers every entity page, so it grows only when they do
+		int** pages = heap_alloc(ecs->heap, sizeof(int*) * ecs->entity_page_capacity, 8);
+		memset(pages, 0, sizeof(int*) * ecs->entity_page_capacity);
+		if (set->index_pages)
+		{
+			memcpy(pages, set->index_pages, sizeof(int*) * set->index_page_count);
+			heap_free(ecs->heap, set->index_pages);
+		}
+		set->index_pages = pages;
+		set->index_page_count = ecs->entity_page_capacity;
+	}
+	if (!set->index_pages[page])
+	{
+		set->index_pages[page] = heap_alloc(ecs->heap, sizeof(int) * k_entities_per_page, 8);
+		memset(set->index_pages[page], 0, sizeof(int) * k_entities_per_page);
+	}
+	return &set->index_pages[page][entity & (k_entities_per_page - 1)];
+}
+
+// Grow a sparse type's packed arrays, doubling, until they hold at least count components.
+static void sparse_reserve(ecs_t* ecs, int component_type, int count)
+{
+	sparse_set_t* set = &ecs->sparse_sets[component_type];
+	size_t size = ecs->component_type_sizes[component_type];
+	while (set->capacity < count)
+	{
+		int capacity = set->capacity;
+		set->entities = grow_array(ecs, set->entities, sizeof(int), &capacity);
+		capacity = set->capacity;
+		set->versions = grow_array(ecs, set->versions, sizeof(uint32_t), &capacity);
+		char* data = heap_alloc(ecs->heap, size * capacity, ecs->component_type_alignments[component_type]);
+		if (set->data)
+		{
+			memcpy(data, set->data, size * set->count);
+			heap_free(ecs->heap, set->data);
+		}
+		set->data = data;
+		set->capacity = capacity;
+	}
+}
+
+// Give an entity a sparse type's component, zeroed and written this tick.
+static void sparse_insert(ecs_t* ecs, int component_type, int entity)
+{
+	sparse_set_t* set = &ecs->sparse_sets[component_type];
+	int* slot = sparse_index_slot(ecs, component_type, entity);
+	sparse_reserve(ecs, component_type, set->count + 1);
+
+	int index = set->count++;
+	size_t size = ecs->component_type_sizes[component_type];
+	memset(&set->data[size * index], 0, size);
+	set->entities[index] = entity;
+	set->versions[index] = ecs->tick;
+	*slot = index + 1;
+}
+
+// Take a sparse type's component from an entity, moving the set's last component into its place.
+static void sparse_remove(ecs_t* ecs, int component_type, int entity)
+{
+	sparse_set_t* set = &ecs->sparse_sets[component_type];
+	int index = sparse_find(ecs, component_type, entity);
+	int last = --set->count;
+	if (index != last)
+	{
+		size_t size = ecs->component_type_sizes[component_type];
+		int moved_entity = set->entities[last];
+		memcpy(&set->data[size * index], &set->data[size * last], size);
+		set->entities[index] = moved_entity;
+		set->versions[index] = set->versions[last];
+		set->index_pages[moved_entity >> k_entity_page_shift][moved_entity & (k_entities_per_page - 1)] = index + 1;
+	}
+	set->index_pages[entity >> k_entity_page_shift][entity & (k_entities_per_page - 1)] = 0;
+}
+
+// Insert and remove an entity's sparse components for a change of component mask.
+static void sparse_update_mask(ecs_t* ecs, int entity, ecs_mask_t old_mask, ecs_mask_t new_mask)
+{
+	ecs_mask_t changed = ecs_mask_and(ecs_mask_xor(old_mask, new_mask), ecs->sparse_mask);
+	for (int i = ecs_mask_next(changed, 0); i >= 0; i = ecs_mask_next(changed, i + 1))
+	{
+		if (ecs_mask_test(new_mask, i))
+		{
+			sparse_insert(ecs, i, entity);
+		}
+		else
+		{
+			sparse_remove(ecs, i, entity);
+		}
+	}
+}
+
+static ecs_command_buffer_t* get_command_buffer(ecs_t* ecs)
+{
+	ecs_command_buffer_t* buffer = TlsGetValue(ecs->command_tls);
+	if (!buffer)
+	{
+		buffer = heap_alloc(ecs->heap, sizeof(ecs_command_buffer_t), 8);
+		memset(buffer, 0, sizeof(*buffer));
+		lock_acquire(&ecs->command_lock);
+		buffer->next = ecs->command_buffers;
+		ecs->command_buffers = buffer;
+		lock_release(&ecs->command_lock);
+		TlsSetValue(ecs->command_tls, buffer);
+	}
+	return buffer;
+}
+
+// Append a command to a buffer, copying a component's data with it if given.
+static command_t* push_command(ecs_t* ecs, ecs_command_buffer_t* buffer, command_type_t type, int component_type, const void* data)
+{
+	if (buffer->command_count == buffer->command_capacity)
+	{
+		buffer->commands = grow_array(ecs, buffer->commands, sizeof(command_t), &buffer->command_capacity);
+	}
+	command_t* command = &buffer->commands[buffer->command_count++];
+	memset(command, 0, sizeof(*command));
+	command->type = type;
+	command->component_type = component_type;
+
+	if (data)
+	{
+		size_t size = ecs->component_type_sizes[component_type];
+		if (buffer->data_size + size > buffer->data_capacity)
+		{
+			size_t capacity = buffer->data_capacity ? buffer->data_capacity : k_command_data_initial_capacity;
+			while (buffer->data_size + size > capacity)
+			{
+				capacity *= 2;
+			}
+			char* new_data = heap_alloc(ecs->heap, capacity, 16);
+			if (buffer->data)
+			{
+				memcpy(new_data, buffer->data, buffer->data_size);
+				heap_free(ecs->heap, buffer->data);
+			}
+			buffer->data = new_data;
+			buffer->data_capacity = capacity;
+		}
+		memcpy(&buffer->data[buffer->data_size], data, size);
+		command->data_offset = buffer->data_size;
+		command->has_data = true;
+		buffer->data_size += size;
+	}
+	return command;
+}
+
+// Apply a buffer's commands in the order they were recorded, then run the callbacks of its spawns, and empty it.
+static void play_commands(ecs_t* ecs, ecs_command_buffer_t* buffer)
+{
+	for (int i = 0; i < buffer->command_count; ++i)
+	{
+		command_t* command = &buffer->commands[i];
+		switch (command->type)
+		{
+		case k_command_spawn:
+			command->ref = ecs_entity_add(ecs, command->component_mask);
+			break;
+		case k_command_spawn_component:
+		{
+			void* component = ecs_entity_get_component(ecs, buffer->commands[command->spawn].ref, command->component_type, true);
+			if (component)
+			{
+				memcpy(component, &buffer->data[command->data_offset], ecs->component_type_sizes[command->component_type]);
+			}
+			break;
+		}
+		case k_command_despawn:
+			ecs_entity_remove(ecs, command->ref, true);
+			break;
+		case k_command_add_component:
+		case k_command_remove_component:
+		{
+			//entities about to be removed keep their archetype until they are
+			if (!ecs_is_entity_ref_valid(ecs, command->ref, true) || get_entity_info(ecs, command->ref.entity)->state == k_entity_pending_remove)
+			{
+				break;
+			}
+			entity_info_t* info = get_entity_info(ecs, command->ref.entity);
+			ecs_mask_t component_mask = info->component_mask;
+			if (command->type == k_command_add_component)
+			{
+				ecs_mask_set(&component_mask, command->component_type);
+			}
+			else
+			{
+				ecs_mask_clear(&component_mask, command->component_type);
+			}
+			entity_set_component_mask(ecs, command->ref.entity, component_mask);
+			if (command->type == k_command_add_component)
+			{
+				void* component = ecs_entity_get_component(ecs, command->ref, command->component_type, true);
+				if (command->has_data)
+				{
+					memcpy(component, &buffer->data[command->data_offset], ecs->component_type_sizes[command->component_type]);
+				}
+				archetype_mark_row_changed(ecs, ecs->archetypes[info->archetype], info->row, command->component_type);
+			}
+			break;
+		}
+		}
+	}
+
+	for (int i = 0; i < buffer->command_count; ++i)
+	{
+		command_t* command = &buffer->commands[i];
+		if (command->type == k_command_spawn && command->callback)
+		{
+			command->callback(ecs, command->ref, command->callback_data);
+		}
+	}
+
+	buffer->command_count = 0;
+	buffer->data_size = 0;
+}
+
+// Bytes ecs_save() writes.
+static size_t save_size(ecs_t* ecs)
+{
+	size_t size = sizeof(save_header_t) + sizeof(save_type_t) * ecs->component_type_count;
+	size += sizeof(entity_info_t) * k_entities_per_page * ecs->entity_page_count;
+	for (int i = 0; i < ecs->archetype_count; ++i)
+	{
+		ecs_archetype_t* archetype = ecs->archetypes[i];
+		int chunk_count = (archetype->entity_count + archetype->chunk_capacity - 1) >> archetype->chunk_shift;
+		size += sizeof(save_archetype_t) + archetype->chunk_size * chunk_count;
+	}
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (ecs_mask_test(ecs->sparse_mask, i))
+		{
+			size += sizeof(int32_t) + (sizeof(int) + sizeof(uint32_t) + ecs->component_type_sizes[i]) * ecs->sparse_sets[i].count;
+		}
+	}
+	return size;
+}
+
+// Read saved archetypes, finding or creating this system's archetype for each and recording its index in remap.
+// Called first to check the saved archetypes fit, then if apply is set to copy in their chunks,
+// emptying every archetype the save lacks.
+static bool load_archetypes(ecs_t* ecs, const char** cursor, const char* end, int count, int* remap, bool apply)
+{
+	if (apply)
+	{
+		for (int i = 0; i < ecs->archetype_count; ++i)
+		{
+			ecs->archetypes[i]->entity_count = 0;
+		}
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		save_archetype_t saved;
+		if (!read_bytes(cursor, end, &saved, sizeof(saved)))
+		{
+			return false;
+		}
+		ecs_archetype_t* archetype = find_or_create_archetype(ecs, saved.component_mask, &remap[i]);
+		int chunk_count = (saved.entity_count + archetype->chunk_capacity - 1) >> archetype->chunk_shift;
+		if (saved.chunk_size != archetype->chunk_size ||
+			saved.entity_count < 0 ||
+			saved.chunk_count != chunk_count ||
+			(size_t)(end - *cursor) / archetype->chunk_size < (size_t)chunk_count)
+		{
+			return false;
+		}
+		if (apply)
+		{
+			while (archetype->chunk_count < chunk_count)
+			{
+				if (archetype->chunk_count == archetype->chunk_array_capacity)
+				{
+					archetype->chunks = grow_array(ecs, archetype->chunks, sizeof(char*), &archetype->chunk_array_capacity);
+				}
+				archetype->chunks[archetype->chunk_count++] = heap_alloc(ecs->heap, archetype->chunk_size, 64);
+			}
+			for (int c = 0; c < chunk_count; ++c)
+			{
+				memcpy(archetype->chunks[c], *cursor + archetype->chunk_size * c, archetype->chunk_size);
+			}
+			archetype->entity_count = saved.entity_count;
+		}
+		*cursor += archetype->chunk_size * chunk_count;
+	}
+	return true;
+}
+
+// Read saved sparse sets, checking they fit and hold saved entity slots, or if apply is set replacing each set with its saved one.
+static bool load_sparse_sets(ecs_t* ecs, const char** cursor, const char* end, int entity_count, bool apply)
+{
+	for (int i = 0; i < ecs->component_type_count; ++i)
+	{
+		if (!ecs_mask_test(ecs->sparse_mask, i))
+		{
+			continue;
+		}
+		int32_t count;
+		size_t element_size = sizeof(int) + sizeof(uint32_t) + ecs->component_type_sizes[i];
+		if (!read_bytes(cursor, end, &count, sizeof(count)) || count < 0 || (size_t)(end - *cursor) / element_size < (size_t)count)
+		{
+			return false;
+		}
+		for (int e = 0; e < count && !apply; ++e)
+		{
+			int entity;
+			memcpy(&entity, *cursor + sizeof(int) * e, sizeof(entity));
+			if (entity < 0 || entity >= entity_count)
+			{
+				return false;
+			}
+		}
+		if (apply)
+		{
+			sparse_set_t* set = &ecs->sparse_sets[i];
+			for (int p = 0; p < set->index_page_count; ++p)
+			{
+				if (set->index_pages[p])
+				{
+					memset(set->index_pages[p], 0, sizeof(int) * k_entities_per_page);
+				}
+			}
+			sparse_reserve(ecs, i, count);
+			set->count = count;
+			memcpy(set->entities, *cursor, sizeof(int) * count);
+			memcpy(set->versions, *cursor + sizeof(int) * count, sizeof(uint32_t) * count);
+			memcpy(set->data, *cursor + (sizeof(int) + sizeof(uint32_t)) * count, ecs->component_type_sizes[i] * count);
+			for (int e = 0; e < count; ++e)
+			{
+				*sparse_index_slot(ecs, i, set->entities[e]) = e + 1;
+			}
+		}
+		*cursor += element_size * count;
+	}
+	return true;
+}
+
+// Copy size bytes from a cursor into data and advance it, unless fewer than size bytes remain before end.
+static bool read_bytes(const char** cursor, const char* end, void* data, size_t size)
+{
+	if ((size_t)(end - *cursor) < size)
+	{
+		return false;
+	}
+	memcpy(data, *cursor, size);
+	*cursor += size;
+	return true;
+}
+
+static void write_bytes(char** cursor, const void* data, size_t size)
+{
+	memcpy(*cursor, data, size);
+	*cursor += size;
 }
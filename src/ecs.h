@@ -3,14 +3,172 @@
 // Entity Component System
 // Framework for game entities and their components.
 
+#include <intrin.h>
 #include <stdbool.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fs_t fs_t;
 typedef struct heap_t heap_t;
 
 // Handle to an entity component system interface.
 typedef struct ecs_t ecs_t;
 
+enum
+{
+	// Most component types, tags included, one system can register.
+	k_ecs_max_component_types = 256,
+	k_ecs_mask_words = k_ecs_max_component_types / 32,
+};
+
+// Set of component types, one bit per type.
+// Build masks with ECS_MASK() or ecs_mask_set() and combine and test them with the ecs_mask functions
+// below, rather than through their words.
+typedef struct ecs_mask_t
+{
+	uint32_t words[k_ecs_mask_words];
+} ecs_mask_t;
+
+// Mask of the component types listed, as in ECS_MASK(transform_type, model_type). C only.
+#define ECS_MASK(...) ecs_mask_of_types((const int[]){ __VA_ARGS__ }, (int)(sizeof((const int[]){ __VA_ARGS__ }) / sizeof(int)))
+
+// Mask with no component types.
+__forceinline ecs_mask_t ecs_mask_empty()
+{
+	ecs_mask_t mask = { { 0 } };
+	return mask;
+}
+
+// Add a component type to a mask.
+__forceinline void ecs_mask_set(ecs_mask_t* mask, int component_type)
+{
+	mask->words[component_type >> 5] |= 1u << (component_type & 31);
+}
+
+// Remove a component type from a mask.
+__forceinline void ecs_mask_clear(ecs_mask_t* mask, int component_type)
+{
+	mask->words[component_type >> 5] &= ~(1u << (component_type & 31));
+}
+
+// Determines if a mask has a component type.
+__forceinline bool ecs_mask_test(ecs_mask_t mask, int component_type)
+{
+	return (mask.words[component_type >> 5] >> (component_type & 31)) & 1;
+}
+
+// Mask of count component types. Negative types, such as those that failed to register, are skipped.
+__forceinline ecs_mask_t ecs_mask_of_types(const int* component_types, int count)
+{
+	ecs_mask_t mask = ecs_mask_empty();
+	for (int i = 0; i < count; ++i)
+	{
+		if (component_types[i] >= 0)
+		{
+			ecs_mask_set(&mask, component_types[i]);
+		}
+	}
+	return mask;
+}
+
+// Component types in either mask.
+__forceinline ecs_mask_t ecs_mask_or(ecs_mask_t a, ecs_mask_t b)
+{
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		a.words[i] |= b.words[i];
+	}
+	return a;
+}
+
+// Component types in both masks.
+__forceinline ecs_mask_t ecs_mask_and(ecs_mask_t a, ecs_mask_t b)
+{
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		a.words[i] &= b.words[i];
+	}
+	return a;
+}
+
+// Component types in one mask but not the other.
+__forceinline ecs_mask_t ecs_mask_xor(ecs_mask_t a, ecs_mask_t b)
+{
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		a.words[i] ^= b.words[i];
+	}
+	return a;
+}
+
+// Component types in a but not in b.
+__forceinline ecs_mask_t ecs_mask_and_not(ecs_mask_t a, ecs_mask_t b)
+{
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		a.words[i] &= ~b.words[i];
+	}
+	return a;
+}
+
+// Determines if a mask has every component type of subset.
+__forceinline bool ecs_mask_contains(ecs_mask_t mask, ecs_mask_t subset)
+{
+	uint32_t missing = 0;
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		missing |= subset.words[i] & ~mask.words[i];
+	}
+	return !missing;
+}
+
+// Determines if two masks share a component type.
+__forceinline bool ecs_mask_intersects(ecs_mask_t a, ecs_mask_t b)
+{
+	uint32_t shared = 0;
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		shared |= a.words[i] & b.words[i];
+	}
+	return shared != 0;
+}
+
+// Determines if two masks have the same component types.
+__forceinline bool ecs_mask_equals(ecs_mask_t a, ecs_mask_t b)
+{
+	uint32_t different = 0;
+	for (int i = 0; i < k_ecs_mask_words; ++i)
+	{
+		different |= a.words[i] ^ b.words[i];
+	}
+	return !different;
+}
+
+// Determines if a mask has no component types.
+__forceinline bool ecs_mask_is_empty(ecs_mask_t mask)
+{
+	return ecs_mask_equals(mask, ecs_mask_empty());
+}
+
+// Get the first component type in a mask at or after from, or -1 if there is none.
+// Walks a mask's types in order with for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1)).
+__forceinline int ecs_mask_next(ecs_mask_t mask, int from)
+{
+	for (int word = from >> 5; word < k_ecs_mask_words; ++word)
+	{
+		unsigned long bit;
+		uint32_t bits = mask.words[word] & (word == from >> 5 ? ~0u << (from & 31) : ~0u);
+		if (_BitScanForward(&bit, bits))
+		{
+			return word * 32 + (int)bit;
+		}
+	}
+	return -1;
+}
+
 // Weak reference to an entity.
 typedef struct ecs_entity_ref_t
 {
@@ -19,12 +177,56 @@ typedef struct ecs_entity_ref_t
 } ecs_entity_ref_t;
 
 // Working data for an active entity query.
+// Queries walk the archetype chunks whose component mask matches.
+// If changed_mask is not empty, only entities with one of those components written on or after since_tick are visited.
 typedef struct ecs_query_t
 {
-	uint64_t component_mask;
+	ecs_mask_t component_mask;
+	ecs_mask_t changed_mask;
+	uint32_t since_tick;
+	int registered; //registered query whose matching archetypes are walked, or -1 to test every archetype
+	int match; //position in the registered query's archetypes, or archetype index
 	int entity;
+	int archetype;
+	int row;
 } ecs_query_t;
 
+// Working data for an active chunk query.
+// Each step covers one archetype chunk, whose component data is stored contiguously.
+typedef struct ecs_chunk_query_t
+{
+	ecs_mask_t component_mask;
+	ecs_mask_t changed_mask;
+	uint32_t since_tick;
+	int registered;
+	int match;
+	int archetype;
+	int chunk;
+	int count;
+} ecs_chunk_query_t;
+
+// Where a component type's data is stored.
+typedef enum ecs_storage_t
+{
+	// In the chunks of every archetype with the type, packed with the entity's other components.
+	// Suits types most entities have or that systems walk by chunk.
+	k_ecs_storage_dense,
+
+	// In one packed array per type, found through an index by entity, apart from archetype chunks.
+	// The type still selects archetypes, so queries match on it as usual, but its bytes don't widen chunk rows,
+	// and adding or removing other components leaves its data where it is. Suits rare types read per entity,
+	// such as a player or camera, whose size would otherwise cut how many rows fit in their archetypes' chunks.
+	// Chunk queries return no array for it; read it per entity instead.
+	k_ecs_storage_sparse,
+} ecs_storage_t;
+
+// Options for registering a component type.
+// Zero initialize for defaults.
+typedef struct ecs_component_options_t
+{
+	ecs_storage_t storage;
+} ecs_component_options_t;
+
 // Create an entity component system.
 ecs_t* ecs_create(heap_t* heap);
 
@@ -35,13 +237,45 @@ void ecs_destroy(ecs_t* ecs);
 void ecs_update(ecs_t* ecs);
 
 // Register a type of component with the entity system.
+// A size of zero registers a tag. See ecs_register_tag_type().
 int ecs_register_component_type(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment);
 
+// Register a type of component with options.
+// Tags have no data to store, so they ignore the storage option.
+int ecs_register_component_type_with_options(ecs_t* ecs, const char* name, size_t size_per_component, size_t alignment, const ecs_component_options_t* options);
+
+// Register a type of tag component, which marks entities without holding data.
+// Tags take no space in chunks, and their write tick is tracked per chunk rather than per entity, so changed
+// queries on a tag visit every entity in a chunk where any tag of that type was written. Getting a tag's
+// component returns a pointer to no bytes, which is non-NULL where the entity has the tag.
+int ecs_register_tag_type(ecs_t* ecs, const char* name);
+
+// Find a type of component registered with the system by name, or -1 if none has it.
+// Names are interned, so finding compares ids rather than text.
+int ecs_find_component_type(ecs_t* ecs, const char* name);
+
 // Return the size of a type of component registered with the sytem.
 size_t ecs_get_component_type_size(ecs_t* ecs, int component_type);
 
+// Get the current tick of the entity component system.
+// The tick advances once per ecs_update. Component writes are stamped with the tick they occur on.
+uint32_t ecs_get_tick(ecs_t* ecs);
+
 // Spawn an entity with the masked components and return a reference to it.
-ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, uint64_t component_mask);
+ecs_entity_ref_t ecs_entity_add(ecs_t* ecs, ecs_mask_t component_mask);
+
+// Register a prefab: a component mask and the data instances' components start with, returning its index.
+// Every component starts zeroed; write the defaults through ecs_prefab_get_component().
+int ecs_register_prefab(ecs_t* ecs, ecs_mask_t component_mask);
+
+// Get the default data of one of a prefab's components, or NULL if it lacks the component or it is a tag.
+// Changes apply to instances made afterward.
+void* ecs_prefab_get_component(ecs_t* ecs, int prefab, int component_type);
+
+// Spawn count entities of a prefab at once, writing references to them to refs unless it is NULL.
+// Rows for all of them are taken together at the end of the prefab's archetype and its defaults copied in bulk,
+// rather than an ecs_entity_add and component writes for each. Entities are pending add like any other.
+void ecs_instantiate_n(ecs_t* ecs, int prefab, int count, ecs_entity_ref_t* refs);
 
 // Destroy an entity.
 // If allow_pending_add is true, can destroy an entity that is not fully spawned.
@@ -54,10 +288,32 @@ bool ecs_is_entity_ref_valid(ecs_t* ecs, ecs_entity_ref_t ref, bool allow_pendin
 // Get the memory for a component on an entity.
 // NULL is returned if the entity is not valid or the component_type is not present on the entity.
 // If allow_pending_add is true, will return component data for not fully spawned entities.
+// Pointers are valid until the next structural change: entities moving between archetypes move their dense
+// components, and entities gaining or losing a sparse component may move other entities' data of that type.
 void* ecs_entity_get_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, bool allow_pending_add);
 
+// Record that a component on an entity was written this tick.
+// Newly added entities count as changed on the tick they are added.
+void ecs_entity_mark_changed(ecs_t* ecs, ecs_entity_ref_t ref, int component_type);
+
+// Get the tick a component on an entity was last written.
+// Returns 0 if the entity is not valid or the component_type is not present on the entity.
+uint32_t ecs_entity_get_component_version(ecs_t* ecs, ecs_entity_ref_t ref, int component_type);
+
+// Register a query by component type mask, returning its index.
+// The system keeps the list of archetypes matching a registered query as archetypes are created, so queries
+// created from it walk only those instead of testing every archetype's mask. Call while nothing queries the system,
+// such as at startup, for masks queried every frame or from many places.
+int ecs_register_query(ecs_t* ecs, ecs_mask_t mask);
+
 // Creates a new entity query by component type mask.
-ecs_query_t ecs_query_create(ecs_t* ecs, uint64_t mask);
+ecs_query_t ecs_query_create(ecs_t* ecs, ecs_mask_t mask);
+
+// Creates a new entity query from a registered query.
+ecs_query_t ecs_query_create_registered(ecs_t* ecs, int registered);
+
+// Creates a new entity query that skips entities unless a component in changed_mask was written on or after since_tick.
+ecs_query_t ecs_query_create_changed(ecs_t* ecs, ecs_mask_t mask, ecs_mask_t changed_mask, uint32_t since_tick);
 
 // Determines if the query points at a valid entity.
 bool ecs_query_is_valid(ecs_t* ecs, ecs_query_t* query);
@@ -70,3 +326,98 @@ void* ecs_query_get_component(ecs_t* ecs, ecs_query_t* query, int component_type
 
 // Get a entity reference for the current query location.
 ecs_entity_ref_t ecs_query_get_entity(ecs_t* ecs, ecs_query_t* query);
+
+// Record that a component on the entity referenced by the query was written this tick.
+void ecs_query_mark_changed(ecs_t* ecs, ecs_query_t* query, int component_type);
+
+// Creates a new chunk query by component type mask.
+// Unlike ecs_query_t, chunks also contain entities that are not fully spawned.
+ecs_chunk_query_t ecs_chunk_query_create(ecs_t* ecs, ecs_mask_t mask);
+
+// Creates a new chunk query from a registered query.
+ecs_chunk_query_t ecs_chunk_query_create_registered(ecs_t* ecs, int registered);
+
+// Creates a new chunk query that skips chunks unless a component in changed_mask was written on or after since_tick.
+// Filtering is per chunk, so returned chunks may also contain unchanged entities.
+ecs_chunk_query_t ecs_chunk_query_create_changed(ecs_t* ecs, ecs_mask_t mask, ecs_mask_t changed_mask, uint32_t since_tick);
+
+// Determines if the chunk query points at a chunk with entities.
+bool ecs_chunk_query_is_valid(ecs_t* ecs, ecs_chunk_query_t* query);
+
+// Advances the chunk query to the next matching chunk, if any.
+void ecs_chunk_query_next(ecs_t* ecs, ecs_chunk_query_t* query);
+
+// Get the number of entities in the current chunk.
+int ecs_chunk_query_get_count(ecs_t* ecs, ecs_chunk_query_t* query);
+
+// Get the component types, tags included, of every entity in the current chunk.
+ecs_mask_t ecs_chunk_query_get_component_mask(ecs_t* ecs, ecs_chunk_query_t* query);
+
+// Get a contiguous array of components for every entity in the current chunk.
+// Elements are ecs_get_component_type_size bytes apart.
+// Returns NULL for sparse component types, which are not stored in chunks.
+void* ecs_chunk_query_get_components(ecs_t* ecs, ecs_chunk_query_t* query, int component_type);
+
+// Get an entity reference for an entity in the current chunk.
+ecs_entity_ref_t ecs_chunk_query_get_entity(ecs_t* ecs, ecs_chunk_query_t* query, int index);
+
+// Record that a component was written for every entity in the current chunk this tick.
+void ecs_chunk_query_mark_changed(ecs_t* ecs, ecs_chunk_query_t* query, int component_type);
+
+// Deferred structural changes.
+// Spawning, despawning and changing an entity's components directly is only safe on the thread that calls ecs_update(),
+// while nothing queries the system. Commands record those changes instead, from any thread while systems run, into a
+// buffer each thread owns so recording takes no lock. The next ecs_update() plays every buffer back before it
+// activates and removes pending entities: each thread's commands in the order it recorded them, threads in no set order.
+// Commands must not be recorded during ecs_update() itself.
+
+// Called when a spawn command is played back, with the entity it spawned.
+// Runs inside ecs_update(), so it may change the entity directly but must not record commands.
+typedef void (*ecs_spawn_callback_t)(ecs_t* ecs, ecs_entity_ref_t entity, void* user);
+
+// Record spawning an entity with the masked components. It is active once played back.
+// Callback, which may be NULL, runs on playback after the entity's initial components are written.
+// Returns the spawn's index in the calling thread's buffer, for ecs_command_set_spawn_component().
+int ecs_command_spawn(ecs_t* ecs, ecs_mask_t component_mask, ecs_spawn_callback_t callback, void* callback_data);
+
+// Record the initial data of a component of an entity the calling thread's buffer spawns, copying it now.
+// Components without initial data start zeroed.
+void ecs_command_set_spawn_component(ecs_t* ecs, int spawn, int component_type, const void* data);
+
+// Record destroying an entity, which may still be pending add.
+void ecs_command_despawn(ecs_t* ecs, ecs_entity_ref_t ref);
+
+// Record adding a component to an entity, moving it to the archetype with that component.
+// Data is copied now; adding a component already present overwrites it. NULL data zeroes a new component
+// and leaves one already present as it is.
+void ecs_command_add_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type, const void* data);
+
+// Record removing a component from an entity, moving it to the archetype without that component.
+void ecs_command_remove_component(ecs_t* ecs, ecs_entity_ref_t ref, int component_type);
+
+// World serialization.
+// A saved world is one blob: a small header, the registered component types, the entity table, every archetype's
+// chunks as they sit in memory and every sparse type's packed arrays. Saving and loading copy those in bulk
+// instead of visiting entities. A blob only loads into a system built for the same platform with the same
+// component types registered in the same order. Save and load between frames, on the thread that calls
+// ecs_update(), with no commands recorded since it last ran.
+
+// Save every entity to a blob allocated from heap, setting size to its length. The caller frees the blob.
+void* ecs_save(ecs_t* ecs, heap_t* heap, size_t* size);
+
+// Replace every entity with those saved in a blob from ecs_save(), along with the tick.
+// References to saved entities stay valid; references to entities loaded over do not.
+// Returns false and leaves the system as it was if the blob is invalid or its component types differ.
+bool ecs_load(ecs_t* ecs, const void* data, size_t size);
+
+// Save every entity to a file, blocking until it is written.
+// If use_compression is true, the file is LZ4 compressed. Returns zero on success.
+int ecs_save_file(ecs_t* ecs, fs_t* fs, const char* path, bool use_compression);
+
+// Load the entities saved to a file by ecs_save_file(), blocking until they are read.
+// Uncompressed files are memory mapped, so chunks are copied straight from the page cache. Returns zero on success.
+int ecs_load_file(ecs_t* ecs, fs_t* fs, const char* path, bool use_compression);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,176 @@
+#pragma once
+
+// Typed C++ queries over the entity component system.
+// Component types are still registered at run time, so each C++ type's index is kept in ecs::component_type<T>,
+// set when ecs::register_component<T>() registers it. Indices are process wide: register a type only once, or
+// with every entity system in the same order. A query builds its mask from them once, when it is created.
+// Iteration walks chunks and fetches each type's array once per chunk, so the body runs over plain typed arrays
+// the compiler can inline and vectorize, not a lookup and a cast per component per entity.
+//
+//   ecs::query<const transform_component_t, model_component_t> query(ecs);
+//   query.each([](const transform_component_t& transform, model_component_t& model) { ... });
+//
+// Types listed without const are written: each() marks them changed in every chunk it visits.
+
+#include "ecs.h"
+#include "debug.h"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace ecs
+{
+	// Index of the component type registered for a C++ type, or -1 if it is not registered.
+	template <typename T>
+	struct component_type
+	{
+		static int index;
+	};
+
+	template <typename T>
+	int component_type<T>::index = -1;
+
+	// Register a C++ type as a component type, with options, or the defaults if options is NULL.
+	template <typename T>
+	int register_component(ecs_t* ecs, const char* name, const ecs_component_options_t* options = nullptr)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "Components are moved with memcpy.");
+		ecs_component_options_t defaults = { };
+		int index = ecs_register_component_type_with_options(ecs, name, sizeof(T), alignof(T), options ? options : &defaults);
+		if (component_type<T>::index >= 0 && component_type<T>::index != index)
+		{
+			debug_print(k_print_warning, "Component type %s registered with different indices.\n", name);
+		}
+		component_type<T>::index = index;
+		return index;
+	}
+
+	// Mask of the component types registered for some C++ types.
+	template <typename... Ts>
+	ecs_mask_t mask()
+	{
+		int types[] = { -1, component_type<typename std::remove_const<Ts>::type>::index... };
+		return ecs_mask_of_types(types, (int)(sizeof(types) / sizeof(types[0])));
+	}
+
+	// Query for entities with every listed component type.
+	// Like ecs_chunk_query_t, it visits entities that are not fully spawned.
+	template <typename... Ts>
+	class query
+	{
+	public:
+		explicit query(ecs_t* ecs) : _ecs(ecs), _mask(mask<Ts...>()), _registered(-1)
+		{
+		}
+
+		// Query from a registered query, which must have been registered with this query's mask.
+		query(ecs_t* ecs, int registered) : _ecs(ecs), _mask(mask<Ts...>()), _registered(registered)
+		{
+		}
+
+		ecs_mask_t get_mask() const
+		{
+			return _mask;
+		}
+
+		// Call f with references to each entity's components, in the listed order.
+		template <typename F>
+		void each(F&& f)
+		{
+			for (ecs_chunk_query_t chunk = create(); ecs_chunk_query_is_valid(_ecs, &chunk); ecs_chunk_query_next(_ecs, &chunk))
+			{
+				each_in_chunk(chunk, f, std::index_sequence_for<Ts...>());
+			}
+		}
+
+		// Call f with an entity reference followed by references to its components.
+		template <typename F>
+		void each_entity(F&& f)
+		{
+			for (ecs_chunk_query_t chunk = create(); ecs_chunk_query_is_valid(_ecs, &chunk); ecs_chunk_query_next(_ecs, &chunk))
+			{
+				each_entity_in_chunk(chunk, f, std::index_sequence_for<Ts...>());
+			}
+		}
+
+	private:
+		ecs_chunk_query_t create()
+		{
+			return _registered >= 0 ? ecs_chunk_query_create_registered(_ecs, _registered) : ecs_chunk_query_create(_ecs, _mask);
+		}
+
+		template <typename T>
+		T* get_array(ecs_chunk_query_t& chunk)
+		{
+			return static_cast<T*>(ecs_chunk_query_get_components(_ecs, &chunk, component_type<typename std::remove_const<T>::type>::index));
+		}
+
+		template <typename T>
+		T* get_component(ecs_entity_ref_t ref)
+		{
+			return static_cast<T*>(ecs_entity_get_component(_ecs, ref, component_type<typename std::remove_const<T>::type>::index, true));
+		}
+
+		void mark_written(ecs_chunk_query_t& chunk)
+		{
+			int types[] = { 0, (std::is_const<Ts>::value ? -1 : component_type<Ts>::index)... };
+			for (int i = 1; i < (int)(sizeof(types) / sizeof(types[0])); ++i)
+			{
+				if (types[i] >= 0)
+				{
+					ecs_chunk_query_mark_changed(_ecs, &chunk, types[i]);
+				}
+			}
+		}
+
+		template <typename F, size_t... Is>
+		void each_in_chunk(ecs_chunk_query_t& chunk, F& f, std::index_sequence<Is...> sequence)
+		{
+			each_with_entity_in_chunk(chunk, [&f](ecs_entity_ref_t, Ts&... components) { f(components...); }, sequence, false);
+		}
+
+		template <typename F, size_t... Is>
+		void each_entity_in_chunk(ecs_chunk_query_t& chunk, F& f, std::index_sequence<Is...> sequence)
+		{
+			each_with_entity_in_chunk(chunk, f, sequence, true);
+		}
+
+		// Call f for each entity in a chunk, with its reference if need_ref is set, or an invalid one if not.
+		template <typename F, size_t... Is>
+		void each_with_entity_in_chunk(ecs_chunk_query_t& chunk, F&& f, std::index_sequence<Is...>, bool need_ref)
+		{
+			int count = ecs_chunk_query_get_count(_ecs, &chunk);
+			std::tuple<Ts*...> arrays(get_array<Ts>(chunk)...);
+			bool in_chunk[] = { true, (std::get<Is>(arrays) != nullptr)... };
+			bool dense = true;
+			for (bool b : in_chunk)
+			{
+				dense = dense && b;
+			}
+
+			if (dense)
+			{
+				for (int i = 0; i < count; ++i)
+				{
+					ecs_entity_ref_t ref = need_ref ? ecs_chunk_query_get_entity(_ecs, &chunk, i) : ecs_entity_ref_t { -1, 0 };
+					f(ref, std::get<Is>(arrays)[i]...);
+				}
+			}
+			else
+			{
+				//sparse types have no chunk array, so every component is found through the entity
+				for (int i = 0; i < count; ++i)
+				{
+					ecs_entity_ref_t ref = ecs_chunk_query_get_entity(_ecs, &chunk, i);
+					f(ref, *get_component<Ts>(ref)...);
+				}
+			}
+			mark_written(chunk);
+		}
+
+		ecs_t* _ecs;
+		ecs_mask_t _mask;
+		int _registered;
+	};
+}
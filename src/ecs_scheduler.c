@@ -0,0 +1,299 @@
+#include "ecs_scheduler.h"
+
+#include "debug.h"
+#include "ecs.h"
+#include "heap.h"
+#include "job.h"
+#include "timer.h"
+#include "timer_object.h"
+
+#include <string.h>
+
+enum
+{
+	k_max_systems = 64,
+};
+
+typedef struct ecs_system_t
+{
+	char name[32];
+	ecs_mask_t read_mask;
+	ecs_mask_t write_mask;
+	bool split_query;
+	int query; //registered for split systems, which query their chunks every update
+	int interval; //updates between runs, at least 1
+	ecs_system_function_t function;
+	void* user;
+} ecs_system_t;
+
+// A single call to a system function: either a whole system or one chunk of it.
+typedef struct ecs_work_item_t
+{
+	ecs_t* ecs;
+	ecs_system_t* system;
+	ecs_chunk_query_t chunk;
+	bool has_chunk;
+} ecs_work_item_t;
+
+// Entities visited only one run in interval, while they have a tag.
+typedef struct ecs_tier_t
+{
+	int tag_type;
+	int interval;
+} ecs_tier_t;
+
+typedef struct ecs_scheduler_t
+{
+	heap_t* heap;
+	ecs_t* ecs;
+	job_system_t* jobs;
+
+	ecs_system_t systems[k_max_systems];
+	int system_count;
+
+	ecs_tier_t tiers[k_ecs_scheduler_max_tiers];
+	int tier_count;
+
+	timer_object_t* timer;
+	uint64_t last_ticks; //of the system timer at the last update, for measuring without a timer
+
+	// Time each of the latest updates advanced by, indexed by update count, so any interval's time is a sum.
+	uint64_t delta_us[k_ecs_scheduler_max_interval];
+	uint32_t update_count;
+
+	// Work for the batch currently running.
+	ecs_work_item_t* items;
+	int item_count;
+	int item_capacity;
+} ecs_scheduler_t;
+
+static void run_item(void* user);
+static int get_chunk_interval(ecs_scheduler_t* scheduler, int system, ecs_chunk_query_t* chunk);
+static bool is_system_due(ecs_scheduler_t* scheduler, int system);
+static bool is_chunk_due(ecs_scheduler_t* scheduler, int system, ecs_chunk_query_t* chunk);
+static bool systems_conflict(const ecs_system_t* a, const ecs_system_t* b);
+static void add_item(ecs_scheduler_t* scheduler, ecs_system_t* system, ecs_chunk_query_t* chunk);
+static void run_batch(ecs_scheduler_t* scheduler, int first_system, int system_count);
+
+ecs_scheduler_t* ecs_scheduler_create(heap_t* heap, ecs_t* ecs, job_system_t* jobs)
+{
+	ecs_scheduler_t* scheduler = heap_alloc(heap, sizeof(ecs_scheduler_t), 8);
+	memset(scheduler, 0, sizeof(*scheduler));
+	scheduler->heap = heap;
+	scheduler->ecs = ecs;
+	scheduler->jobs = jobs;
+	scheduler->last_ticks = timer_get_ticks();
+	return scheduler;
+}
+
+void ecs_scheduler_destroy(ecs_scheduler_t* scheduler)
+{
+	if (scheduler->items)
+	{
+		heap_free(scheduler->heap, scheduler->items);
+	}
+	heap_free(scheduler->heap, scheduler);
+}
+
+int ecs_scheduler_add_system(ecs_scheduler_t* scheduler, const char* name, ecs_mask_t read_mask, ecs_mask_t write_mask, bool split_query, ecs_system_function_t function, void* user)
+{
+	ecs_system_options_t options = { 0 };
+	return ecs_scheduler_add_system_with_options(scheduler, name, read_mask, write_mask, split_query, function, user, &options);
+}
+
+int ecs_scheduler_add_system_with_options(ecs_scheduler_t* scheduler, const char* name, ecs_mask_t read_mask, ecs_mask_t write_mask, bool split_query, ecs_system_function_t function, void* user, const ecs_system_options_t* options)
+{
+	if (scheduler->system_count >= k_max_systems)
+	{
+		debug_print(k_print_warning, "Out of systems.");
+		return -1;
+	}
+	int index = scheduler->system_count++;
+	ecs_system_t* system = &scheduler->systems[index];
+	strcpy_s(system->name, sizeof(system->name), name);
+	system->read_mask = read_mask;
+	system->write_mask = write_mask;
+	system->split_query = split_query;
+	system->query = split_query ? ecs_register_query(scheduler->ecs, ecs_mask_or(read_mask, write_mask)) : -1;
+	system->interval = __min(__max(options->interval, 1), k_ecs_scheduler_max_interval);
+	system->function = function;
+	system->user = user;
+	return index;
+}
+
+int ecs_scheduler_add_tier(ecs_scheduler_t* scheduler, int tag_type, int interval)
+{
+	if (scheduler->tier_count >= k_ecs_scheduler_max_tiers)
+	{
+		debug_print(k_print_warning, "Out of tiers.");
+		return -1;
+	}
+	int index = scheduler->tier_count++;
+	ecs_tier_t* tier = &scheduler->tiers[index];
+	tier->tag_type = tag_type;
+	tier->interval = __min(__max(interval, 1), k_ecs_scheduler_max_interval);
+	return index;
+}
+
+void ecs_scheduler_set_timer(ecs_scheduler_t* scheduler, timer_object_t* timer)
+{
+	scheduler->timer = timer;
+}
+
+uint64_t ecs_scheduler_get_delta_us(ecs_scheduler_t* scheduler, int system, ecs_chunk_query_t* chunk)
+{
+	int interval = scheduler->systems[system].interval;
+	if (chunk)
+	{
+		interval *= get_chunk_interval(scheduler, system, chunk);
+	}
+
+	uint64_t delta_us = 0;
+	for (int i = 0; i < interval; ++i)
+	{
+		delta_us += scheduler->delta_us[(scheduler->update_count - i) % k_ecs_scheduler_max_interval];
+	}
+	return delta_us;
+}
+
+void ecs_scheduler_update(ecs_scheduler_t* scheduler)
+{
+	uint64_t ticks = timer_get_ticks();
+	++scheduler->update_count;
+	scheduler->delta_us[scheduler->update_count % k_ecs_scheduler_max_interval] = scheduler->timer ?
+		timer_object_get_delta_us(scheduler->timer) : timer_ticks_to_us(ticks - scheduler->last_ticks);
+	scheduler->last_ticks = ticks;
+
+	// Greedily batch consecutive systems that do not conflict with each other.
+	// Batches run one after another, so conflicting systems keep registration order.
+	int first = 0;
+	while (first < scheduler->system_count)
+	{
+		int last = first + 1;
+		for (; last < scheduler->system_count; ++last)
+		{
+			bool conflict = false;
+			for (int i = first; i < last && !conflict; ++i)
+			{
+				conflict = systems_conflict(&scheduler->systems[i], &scheduler->systems[last]);
+			}
+			if (conflict)
+			{
+				break;
+			}
+		}
+		run_batch(scheduler, first, last - first);
+		first = last;
+	}
+}
+
+static void run_item(void* user)
+{
+	ecs_work_item_t* item = user;
+	item->system->function(item->ecs, item->has_chunk ? &item->chunk : NULL, item->system->user);
+}
+
+// Get how many of a system's runs go by for each that visits a chunk, from the tier of its entities.
+// Cut so the updates from one visit to the next stay within the time kept.
+static int get_chunk_interval(ecs_scheduler_t* scheduler, int system, ecs_chunk_query_t* chunk)
+{
+	ecs_mask_t mask = ecs_chunk_query_get_component_mask(scheduler->ecs, chunk);
+	for (int i = 0; i < scheduler->tier_count; ++i)
+	{
+		if (ecs_mask_test(mask, scheduler->tiers[i].tag_type))
+		{
+			return __max(__min(scheduler->tiers[i].interval, k_ecs_scheduler_max_interval / scheduler->systems[system].interval), 1);
+		}
+	}
+	return 1;
+}
+
+// Check if a system runs this update, offset by its index so systems of one interval don't all run together.
+static bool is_system_due(ecs_scheduler_t* scheduler, int system)
+{
+	return (scheduler->update_count + system) % scheduler->systems[system].interval == 0;
+}
+
+// Check if a due system visits a chunk this run, offset by where the chunk is so each run gets a share of the tier.
+// A chunk keeps its turn while entities come and go, as rows stay packed into the first chunks of an archetype.
+static bool is_chunk_due(ecs_scheduler_t* scheduler, int system, ecs_chunk_query_t* chunk)
+{
+	uint32_t run = (scheduler->update_count + system) / scheduler->systems[system].interval;
+	return (run + chunk->archetype + chunk->chunk) % get_chunk_interval(scheduler, system, chunk) == 0;
+}
+
+static bool systems_conflict(const ecs_system_t* a, const ecs_system_t* b)
+{
+	return ecs_mask_intersects(a->write_mask, ecs_mask_or(b->read_mask, b->write_mask)) || ecs_mask_intersects(b->write_mask, a->read_mask);
+}
+
+static void add_item(ecs_scheduler_t* scheduler, ecs_system_t* system, ecs_chunk_query_t* chunk)
+{
+	if (scheduler->item_count == scheduler->item_capacity)
+	{
+		int capacity = scheduler->item_capacity ? scheduler->item_capacity * 2 : 64;
+		ecs_work_item_t* items = heap_alloc(scheduler->heap, sizeof(ecs_work_item_t) * capacity, 8);
+		if (scheduler->items)
+		{
+			memcpy(items, scheduler->items, sizeof(ecs_work_item_t) * scheduler->item_count);
+			heap_free(scheduler->heap, scheduler->items);
+		}
+		scheduler->items = items;
+		scheduler->item_capacity = capacity;
+	}
+
+	ecs_work_item_t* item = &scheduler->items[scheduler->item_count++];
+	item->ecs = scheduler->ecs;
+	item->system = system;
+	item->has_chunk = chunk != NULL;
+	if (chunk)
+	{
+		item->chunk = *chunk;
+	}
+}
+
+static void run_batch(ecs_scheduler_t* scheduler, int first_system, int system_count)
+{
+	scheduler->item_count = 0;
+	for (int i = first_system; i < first_system + system_count; ++i)
+	{
+		ecs_system_t* system = &scheduler->systems[i];
+		if (!is_system_due(scheduler, i))
+		{
+			continue;
+		}
+		if (system->split_query)
+		{
+			for (ecs_chunk_query_t chunk = ecs_chunk_query_create_registered(scheduler->ecs, system->query);
+				ecs_chunk_query_is_valid(scheduler->ecs, &chunk);
+				ecs_chunk_query_next(scheduler->ecs, &chunk))
+			{
+				if (is_chunk_due(scheduler, i, &chunk))
+				{
+					add_item(scheduler, system, &chunk);
+				}
+			}
+		}
+		else
+		{
+			add_item(scheduler, system, NULL);
+		}
+	}
+
+	if (!scheduler->jobs)
+	{
+		for (int i = 0; i < scheduler->item_count; ++i)
+		{
+			run_item(&scheduler->items[i]);
+		}
+		return;
+	}
+
+	// The calling thread runs items too while it waits for the batch.
+	job_counter_t counter = { 0 };
+	for (int i = 0; i < scheduler->item_count; ++i)
+	{
+		job_run(scheduler->jobs, run_item, &scheduler->items[i], &counter);
+	}
+	job_wait(scheduler->jobs, &counter);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+// ECS System Scheduler
+// Runs registered systems as jobs on a job system.
+// Systems declare which component types they read and write; systems that
+// do not conflict run in parallel, and systems may split their query by chunk.
+// Systems may run less often than every update, and split systems may visit entities
+// tagged into slower tiers, such as those far from the players, only every few updates.
+
+#include "ecs.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+typedef struct timer_object_t timer_object_t;
+
+enum
+{
+	// Most tiers a scheduler holds.
+	k_ecs_scheduler_max_tiers = 8,
+
+	// Most updates between runs of a system on a chunk; longer intervals are cut to it.
+	k_ecs_scheduler_max_interval = 64,
+};
+
+// Handle to a system scheduler.
+typedef struct ecs_scheduler_t ecs_scheduler_t;
+
+// Function run by a system.
+// Systems that split their query are called once per matching chunk, possibly on many threads at once.
+// Other systems are called once per update with a NULL chunk.
+typedef void (*ecs_system_function_t)(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
+
+// Options for registering a system.
+// Zero-initialized options give the same system as ecs_scheduler_add_system().
+typedef struct ecs_system_options_t
+{
+	// Updates from one run of the system to the next, or zero for every update.
+	// Systems are offset by their index, so those sharing an interval spread over the updates in between.
+	int interval;
+} ecs_system_options_t;
+
+// Create a scheduler for systems on an entity component system.
+// Systems run on the workers of jobs, or only on the calling thread if jobs is NULL;
+// the thread calling ecs_scheduler_update also runs systems.
+ecs_scheduler_t* ecs_scheduler_create(heap_t* heap, ecs_t* ecs, job_system_t* jobs);
+
+// Destroy a scheduler.
+void ecs_scheduler_destroy(ecs_scheduler_t* scheduler);
+
+// Register a system with the scheduler.
+// read_mask and write_mask are the component types the system accesses.
+// If split_query is true, the system is called per chunk of entities with all read and write components.
+// Systems run in registration order except where their component access does not conflict.
+// Returns the system index, or -1 on failure.
+int ecs_scheduler_add_system(ecs_scheduler_t* scheduler, const char* name, ecs_mask_t read_mask, ecs_mask_t write_mask, bool split_query, ecs_system_function_t function, void* user);
+
+// Register a system with options.
+int ecs_scheduler_add_system_with_options(ecs_scheduler_t* scheduler, const char* name, ecs_mask_t read_mask, ecs_mask_t write_mask, bool split_query, ecs_system_function_t function, void* user, const ecs_system_options_t* options);
+
+// Add a tier of entities that split systems visit only once every interval of their runs.
+// Entities are in the tier while they have the tag, so moving them between tiers is adding and removing tags, and
+// each tier's entities are in chunks of their own. The chunks of a tier take turns, a share of them each run.
+// Entities with the tags of several tiers are in the first added.
+// Returns the tier index, or -1 on failure.
+int ecs_scheduler_add_tier(ecs_scheduler_t* scheduler, int tag_type, int interval);
+
+// Measure the time systems are given with a timer, updated before each ecs_scheduler_update, so they follow its
+// scale and pauses. Without one they are given real time.
+void ecs_scheduler_set_timer(ecs_scheduler_t* scheduler, timer_object_t* timer);
+
+// Get the time in microseconds a system should advance by this run: since it last ran on the chunk, or since it
+// last ran at all for a NULL chunk. Call from the system.
+// Entities just moved into a tier are visited on its turns from then, so their first time there may be off by
+// a few updates.
+uint64_t ecs_scheduler_get_delta_us(ecs_scheduler_t* scheduler, int system, ecs_chunk_query_t* chunk);
+
+// Run all registered systems once and wait for them to complete.
+// Systems must not add or remove entities while they run.
+void ecs_scheduler_update(ecs_scheduler_t* scheduler);
@@ -1,5 +1,7 @@
 #include "event.h"
 
+#include "atomic.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -28,3 +30,35 @@ bool event_is_raised(event_t* event)
 {
 	return WaitForSingleObject(event, 0) == WAIT_OBJECT_0;
 }
+
+void light_event_init(light_event_t* event)
+{
+	event->state = 0;
+}
+
+void light_event_signal(light_event_t* event)
+{
+	if (atomic_exchange(&event->state, 1) == 2)
+	{
+		atomic_wake_all(&event->state);
+	}
+}
+
+void light_event_wait(light_event_t* event)
+{
+	int state = atomic_load(&event->state);
+	while (state != 1)
+	{
+		//mark the event waited on so the signal wakes blocked threads
+		if (state == 2 || atomic_compare_and_exchange(&event->state, 0, 2) == 0)
+		{
+			atomic_wait(&event->state, 2);
+		}
+		state = atomic_load(&event->state);
+	}
+}
+
+bool light_event_is_raised(light_event_t* event)
+{
+	return atomic_load(&event->state) == 1;
+}
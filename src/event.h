@@ -22,3 +22,26 @@ void event_wait(event_t* event);
 
 // Determines if an event is signaled.
 bool event_is_raised(event_t* event);
+
+// Lightweight event.
+// Like event_t, but lives inside the structure that uses it instead of behind a kernel handle:
+// signaling and waiting without contention are a single interlocked instruction, and only a waiter
+// that has to block enters the kernel, through atomic_wait().
+// Zero-initialize or call light_event_init before first use.
+typedef struct light_event_t
+{
+	int state; //0 = unsignaled, 1 = signaled, 2 = unsignaled with threads blocked
+} light_event_t;
+
+// Initialize an event to the unsignaled state.
+void light_event_init(light_event_t* event);
+
+// Signals an event.
+// All threads waiting on this event will resume.
+void light_event_signal(light_event_t* event);
+
+// Waits for an event to be signaled.
+void light_event_wait(light_event_t* event);
+
+// Determines if an event is signaled.
+bool light_event_is_raised(light_event_t* event);
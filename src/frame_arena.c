@@ -0,0 +1,128 @@
+#include "frame_arena.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+#include "lock.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Header for an allocation that did not fit in a frame's buffer.
+typedef struct overflow_t
+{
+	struct overflow_t* next;
+	void* block;
+} overflow_t;
+
+typedef struct arena_frame_t
+{
+	char* base;
+	int used;
+	overflow_t* overflow;
+} arena_frame_t;
+
+typedef struct frame_arena_t
+{
+	heap_t* heap;
+	char* memory;
+	size_t size_per_frame;
+	int frame_count;
+	int frame_index;
+	arena_frame_t frames[k_frame_arena_max_frames];
+	lock_t overflow_lock;
+} frame_arena_t;
+
+static void* overflow_alloc(frame_arena_t* arena, arena_frame_t* frame, size_t size, size_t alignment);
+static void overflow_free(frame_arena_t* arena, arena_frame_t* frame);
+
+frame_arena_t* frame_arena_create(heap_t* heap, size_t size_per_frame, int frame_count)
+{
+	if (frame_count > k_frame_arena_max_frames)
+	{
+		debug_print(k_print_warning, "Frame arena limited to %d frames.\n", k_frame_arena_max_frames);
+		frame_count = k_frame_arena_max_frames;
+	}
+
+	frame_arena_t* arena = heap_alloc(heap, sizeof(frame_arena_t), 8);
+	memset(arena, 0, sizeof(*arena));
+	arena->heap = heap;
+	arena->size_per_frame = size_per_frame;
+	arena->frame_count = frame_count;
+	arena->memory = heap_alloc(heap, size_per_frame * frame_count, 64);
+	for (int i = 0; i < frame_count; ++i)
+	{
+		arena->frames[i].base = arena->memory + size_per_frame * i;
+	}
+	lock_init_named(&arena->overflow_lock, "frame arena overflow");
+	return arena;
+}
+
+void frame_arena_destroy(frame_arena_t* arena)
+{
+	for (int i = 0; i < arena->frame_count; ++i)
+	{
+		overflow_free(arena, &arena->frames[i]);
+	}
+	heap_free(arena->heap, arena->memory);
+	heap_free(arena->heap, arena);
+}
+
+void* frame_arena_alloc(frame_arena_t* arena, size_t size, size_t alignment)
+{
+	arena_frame_t* frame = &arena->frames[arena->frame_index];
+	while (true)
+	{
+		int used = atomic_load(&frame->used);
+		uintptr_t address = ((uintptr_t)frame->base + used + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+		size_t end = (size_t)(address - (uintptr_t)frame->base) + size;
+		if (end > arena->size_per_frame)
+		{
+			return overflow_alloc(arena, frame, size, alignment);
+		}
+		if (atomic_compare_and_exchange(&frame->used, used, (int)end) == used)
+		{
+			return (void*)address;
+		}
+	}
+}
+
+void frame_arena_next_frame(frame_arena_t* arena)
+{
+	arena->frame_index = (arena->frame_index + 1) % arena->frame_count;
+	arena_frame_t* frame = &arena->frames[arena->frame_index];
+	overflow_free(arena, frame);
+	atomic_store(&frame->used, 0);
+}
+
+static void* overflow_alloc(frame_arena_t* arena, arena_frame_t* frame, size_t size, size_t alignment)
+{
+	//keep the overflow link in front of the block, padded to preserve alignment
+	size_t offset = (sizeof(overflow_t) + (alignment - 1)) & ~(alignment - 1);
+	char* block = heap_alloc(arena->heap, offset + size, alignment);
+	overflow_t* overflow = (overflow_t*)(block + offset) - 1;
+	overflow->block = block;
+
+	lock_acquire(&arena->overflow_lock);
+	overflow->next = frame->overflow;
+	frame->overflow = overflow;
+	lock_release(&arena->overflow_lock);
+
+	return block + offset;
+}
+
+static void overflow_free(frame_arena_t* arena, arena_frame_t* frame)
+{
+	lock_acquire(&arena->overflow_lock);
+	overflow_t* overflow = frame->overflow;
+	frame->overflow = NULL;
+	lock_release(&arena->overflow_lock);
+
+	while (overflow)
+	{
+		overflow_t* next = overflow->next;
+		heap_free(arena->heap, overflow->block);
+		overflow = next;
+	}
+}
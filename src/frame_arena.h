@@ -0,0 +1,35 @@
+#pragma once
+
+// Frame Arena
+// Linear allocator for memory that only lives for a handful of frames.
+// Allocation is a pointer bump; everything in a frame's buffer is freed at once when that buffer is reused.
+
+#include <stddef.h>
+
+typedef struct heap_t heap_t;
+
+// Handle to a frame arena.
+typedef struct frame_arena_t frame_arena_t;
+
+enum
+{
+	// Buffers one frame arena can have.
+	k_frame_arena_max_frames = 4,
+};
+
+// Create a frame arena with frame_count buffers of size_per_frame bytes each.
+// Memory allocated during one frame stays valid until frame_count more frames have begun.
+frame_arena_t* frame_arena_create(heap_t* heap, size_t size_per_frame, int frame_count);
+
+// Destroy a frame arena and all memory allocated from it.
+void frame_arena_destroy(frame_arena_t* arena);
+
+// Allocate memory from the current frame's buffer.
+// Safe to call from multiple threads. If the buffer is full, falls back to the heap
+// and the memory is freed along with the buffer.
+void* frame_arena_alloc(frame_arena_t* arena, size_t size, size_t alignment);
+
+// Begin a new frame, recycling the oldest buffer.
+// The caller must ensure memory from that buffer is no longer in use.
+// Must not be called concurrently with frame_arena_alloc.
+void frame_arena_next_frame(frame_arena_t* arena);
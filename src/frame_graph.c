@@ -0,0 +1,381 @@
+#include "frame_graph.h"
+
+#include "debug.h"
+#include "heap.h"
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct frame_graph_pass_t
+{
+	const char* name;
+	int resources[k_frame_graph_max_pass_uses];
+	frame_graph_usage_t usages[k_frame_graph_max_pass_uses];
+	int use_count;
+} frame_graph_pass_t;
+
+typedef struct frame_graph_t
+{
+	heap_t* heap;
+
+	frame_graph_resource_info_t resources[k_frame_graph_max_resources];
+	frame_graph_resource_plan_t resource_plans[k_frame_graph_max_resources];
+	int resource_count;
+
+	frame_graph_pass_t passes[k_frame_graph_max_passes];
+	frame_graph_pass_plan_t pass_plans[k_frame_graph_max_passes];
+	int pass_count;
+
+	frame_graph_barrier_t barriers[k_frame_graph_max_barriers];
+	int barrier_count;
+	int group_count;
+	size_t transient_size;
+} frame_graph_t;
+
+static bool is_write(frame_graph_usage_t usage);
+static bool is_attachment(frame_graph_usage_t usage);
+static void cull_passes(frame_graph_t* graph);
+static bool plan_passes(frame_graph_t* graph);
+static void place_transients(frame_graph_t* graph);
+
+frame_graph_t* frame_graph_create(heap_t* heap)
+{
+	frame_graph_t* graph = heap_alloc(heap, sizeof(frame_graph_t), 8);
+	memset(graph, 0, sizeof(*graph));
+	graph->heap = heap;
+	return graph;
+}
+
+void frame_graph_destroy(frame_graph_t* graph)
+{
+	heap_free(graph->heap, graph);
+}
+
+int frame_graph_add_resource(frame_graph_t* graph, const frame_graph_resource_info_t* info)
+{
+	if (graph->resource_count >= k_frame_graph_max_resources)
+	{
+		debug_print(k_print_error, "Frame graph resource %s not added: %d resources already\n", info->name, graph->resource_count);
+		return -1;
+	}
+	graph->resources[graph->resource_count] = *info;
+	return graph->resource_count++;
+}
+
+int frame_graph_add_pass(frame_graph_t* graph, const char* name)
+{
+	if (graph->pass_count >= k_frame_graph_max_passes)
+	{
+		debug_print(k_print_error, "Frame graph pass %s not added: %d passes already\n", name, graph->pass_count);
+		return -1;
+	}
+	frame_graph_pass_t* pass = &graph->passes[graph->pass_count];
+	memset(pass, 0, sizeof(*pass));
+	pass->name = name;
+	return graph->pass_count++;
+}
+
+void frame_graph_pass_use(frame_graph_t* graph, int pass, int resource, frame_graph_usage_t usage)
+{
+	frame_graph_pass_t* p = &graph->passes[pass];
+	if (p->use_count >= k_frame_graph_max_pass_uses)
+	{
+		debug_print(k_print_error, "Frame graph pass %s can't use %s: %d uses already\n", p->name, graph->resources[resource].name, p->use_count);
+		return;
+	}
+	p->resources[p->use_count] = resource;
+	p->usages[p->use_count] = usage;
+	p->use_count++;
+}
+
+bool frame_graph_compile(frame_graph_t* graph)
+{
+	memset(graph->resource_plans, 0, sizeof(graph->resource_plans));
+	memset(graph->pass_plans, 0, sizeof(graph->pass_plans));
+	graph->barrier_count = 0;
+	graph->group_count = 0;
+	graph->transient_size = 0;
+
+	cull_passes(graph);
+	if (!plan_passes(graph))
+	{
+		return false;
+	}
+	place_transients(graph);
+	return true;
+}
+
+int frame_graph_get_pass_count(frame_graph_t* graph)
+{
+	return graph->pass_count;
+}
+
+int frame_graph_get_resource_count(frame_graph_t* graph)
+{
+	return graph->resource_count;
+}
+
+int frame_graph_get_pass_uses(frame_graph_t* graph, int pass, const int** resources, const frame_graph_usage_t** usages)
+{
+	*resources = graph->passes[pass].resources;
+	*usages = graph->passes[pass].usages;
+	return graph->passes[pass].use_count;
+}
+
+const frame_graph_resource_info_t* frame_graph_get_resource_info(frame_graph_t* graph, int resource)
+{
+	return &graph->resources[resource];
+}
+
+const frame_graph_resource_plan_t* frame_graph_get_resource_plan(frame_graph_t* graph, int resource)
+{
+	return &graph->resource_plans[resource];
+}
+
+const frame_graph_pass_plan_t* frame_graph_get_pass_plan(frame_graph_t* graph, int pass)
+{
+	return &graph->pass_plans[pass];
+}
+
+int frame_graph_get_barriers(frame_graph_t* graph, const frame_graph_barrier_t** barriers)
+{
+	*barriers = graph->barriers;
+	return graph->barrier_count;
+}
+
+int frame_graph_get_group_count(frame_graph_t* graph)
+{
+	return graph->group_count;
+}
+
+size_t frame_graph_get_transient_size(frame_graph_t* graph)
+{
+	return graph->transient_size;
+}
+
+static bool is_write(frame_graph_usage_t usage)
+{
+	return usage == k_frame_graph_usage_color_write || usage == k_frame_graph_usage_depth_write;
+}
+
+static bool is_attachment(frame_graph_usage_t usage)
+{
+	return usage == k_frame_graph_usage_color_write ||
+		usage == k_frame_graph_usage_depth_write ||
+		usage == k_frame_graph_usage_depth_read ||
+		usage == k_frame_graph_usage_input;
+}
+
+// Keep only passes that write what the frame hands on or a kept pass reads, walking back from the last.
+// A resource stays needed once any later pass needs it, so earlier writes a later one draws over are kept.
+static void cull_passes(frame_graph_t* graph)
+{
+	bool needed[k_frame_graph_max_resources];
+	for (int r = 0; r < graph->resource_count; ++r)
+	{
+		needed[r] = graph->resources[r].imported;
+	}
+
+	for (int p = graph->pass_count - 1; p >= 0; --p)
+	{
+		frame_graph_pass_t* pass = &graph->passes[p];
+		bool live = false;
+		for (int u = 0; u < pass->use_count; ++u)
+		{
+			live |= is_write(pass->usages[u]) && needed[pass->resources[u]];
+		}
+
+		graph->pass_plans[p].culled = !live;
+		for (int u = 0; live && u < pass->use_count; ++u)
+		{
+			needed[pass->resources[u]] |= !is_write(pass->usages[u]);
+		}
+	}
+}
+
+// Walk the kept passes in order, grouping them into render passes and recording each change of usage.
+// A pass joins the render pass before it when its attachments are the same size and it reads what the
+// render pass wrote only at the pixel being shaded; anything sampled or copied must be finished first.
+static bool plan_passes(frame_graph_t* graph)
+{
+	frame_graph_usage_t last_usage[k_frame_graph_max_resources] = { 0 };
+	int last_write_group[k_frame_graph_max_resources];
+	for (int r = 0; r < graph->resource_count; ++r)
+	{
+		last_write_group[r] = -1;
+	}
+
+	int group = -1;
+	int subpass = 0;
+	int group_width = 0;
+	int group_height = 0;
+	uint32_t group_writes = 0;
+	for (int p = 0; p < graph->pass_count; ++p)
+	{
+		if (graph->pass_plans[p].culled)
+		{
+			continue;
+		}
+		frame_graph_pass_t* pass = &graph->passes[p];
+
+		int width = 0;
+		int height = 0;
+		bool joins = group >= 0;
+		for (int u = 0; u < pass->use_count; ++u)
+		{
+			frame_graph_resource_info_t* info = &graph->resources[pass->resources[u]];
+			if (is_attachment(pass->usages[u]))
+			{
+				width = info->width;
+				height = info->height;
+				joins &= info->width == group_width && info->height == group_height;
+			}
+			else if (group_writes & (1u << pass->resources[u]))
+			{
+				joins = false;
+			}
+		}
+		joins &= width != 0;
+
+		if (joins)
+		{
+			++subpass;
+		}
+		else
+		{
+			++group;
+			subpass = 0;
+			group_width = width;
+			group_height = height;
+			group_writes = 0;
+		}
+		graph->pass_plans[p].group = group;
+		graph->pass_plans[p].subpass = subpass;
+
+		for (int u = 0; u < pass->use_count; ++u)
+		{
+			int r = pass->resources[u];
+			frame_graph_usage_t usage = pass->usages[u];
+			frame_graph_resource_plan_t* plan = &graph->resource_plans[r];
+
+			if (!plan->used)
+			{
+				if (!is_write(usage) && !graph->resources[r].imported)
+				{
+					debug_print(k_print_error, "Frame graph pass %s reads %s before any pass writes it\n", pass->name, graph->resources[r].name);
+					return false;
+				}
+				plan->used = true;
+				plan->first_pass = p;
+				plan->load = !is_write(usage);
+			}
+			else if (!is_write(usage) && last_write_group[r] >= 0 && last_write_group[r] != group)
+			{
+				plan->store = true;
+			}
+
+			//reads in the same usage as the last share its barrier
+			if (last_usage[r] == k_frame_graph_usage_none || is_write(last_usage[r]) || is_write(usage) || last_usage[r] != usage)
+			{
+				graph->barriers[graph->barrier_count++] = (frame_graph_barrier_t)
+				{
+					.resource = r,
+					.pass = p,
+					.src_pass = last_usage[r] == k_frame_graph_usage_none ? -1 : plan->last_pass,
+					.src_usage = last_usage[r],
+					.dst_usage = usage,
+					.by_region = plan->last_pass != p && last_usage[r] != k_frame_graph_usage_none && graph->pass_plans[plan->last_pass].group == group,
+				};
+			}
+
+			last_usage[r] = usage;
+			plan->last_pass = p;
+			if (is_write(usage))
+			{
+				last_write_group[r] = group;
+				group_writes |= 1u << r;
+			}
+		}
+	}
+	graph->group_count = group + 1;
+
+	//imported resources are handed on, so they are kept and moved to their final usage
+	for (int r = 0; r < graph->resource_count; ++r)
+	{
+		frame_graph_resource_plan_t* plan = &graph->resource_plans[r];
+		frame_graph_resource_info_t* info = &graph->resources[r];
+		plan->final_usage = last_usage[r];
+		if (!plan->used || !info->imported)
+		{
+			continue;
+		}
+
+		plan->store = true;
+		if (info->final_usage != k_frame_graph_usage_none && info->final_usage != last_usage[r])
+		{
+			plan->final_usage = info->final_usage;
+			graph->barriers[graph->barrier_count++] = (frame_graph_barrier_t)
+			{
+				.resource = r,
+				.pass = graph->pass_count,
+				.src_pass = plan->last_pass,
+				.src_usage = last_usage[r],
+				.dst_usage = info->final_usage,
+			};
+		}
+	}
+	return true;
+}
+
+// Place transient resources in one block of memory, largest first, each at the lowest offset clear of
+// every resource already placed whose lifetime overlaps its own.
+// Lifetimes are counted in render passes, since a render pass holds all its attachments throughout.
+static void place_transients(frame_graph_t* graph)
+{
+	int order[k_frame_graph_max_resources];
+	int order_count = 0;
+	for (int r = 0; r < graph->resource_count; ++r)
+	{
+		if (!graph->resource_plans[r].used || graph->resources[r].imported)
+		{
+			continue;
+		}
+
+		int i = order_count++;
+		for (; i > 0 && graph->resources[order[i - 1]].size < graph->resources[r].size; --i)
+		{
+			order[i] = order[i - 1];
+		}
+		order[i] = r;
+	}
+
+	for (int i = 0; i < order_count; ++i)
+	{
+		int r = order[i];
+		frame_graph_resource_plan_t* plan = &graph->resource_plans[r];
+		size_t size = graph->resources[r].size;
+		size_t alignment = __max(graph->resources[r].alignment, 1);
+		int first_group = graph->pass_plans[plan->first_pass].group;
+		int last_group = graph->pass_plans[plan->last_pass].group;
+
+		size_t offset = 0;
+		for (int j = 0; j < i; ++j)
+		{
+			frame_graph_resource_plan_t* other = &graph->resource_plans[order[j]];
+			size_t other_size = graph->resources[order[j]].size;
+			bool overlaps_time =
+				graph->pass_plans[other->first_pass].group <= last_group &&
+				graph->pass_plans[other->last_pass].group >= first_group;
+			bool overlaps_memory = other->offset < offset + size && offset < other->offset + other_size;
+			if (overlaps_time && overlaps_memory)
+			{
+				//move past it and check everything placed again
+				offset = (other->offset + other_size + alignment - 1) / alignment * alignment;
+				j = -1;
+			}
+		}
+
+		plan->offset = offset;
+		graph->transient_size = __max(graph->transient_size, offset + size);
+	}
+}
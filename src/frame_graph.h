@@ -0,0 +1,133 @@
+#pragma once
+
+// Frame Graph
+// Plans a frame's passes from the resources each declares it reads and writes, so passes
+// can be added without writing barriers or setting aside memory for each of their targets.
+// Compiling the graph culls passes whose output nothing uses, derives the barrier every change
+// of a resource's usage needs, merges consecutive passes that only read their predecessors'
+// output at the same pixel into subpasses of one render pass, and places transient resources
+// whose lifetimes don't overlap at the same offsets of one block of memory.
+// The plan says nothing about the graphics API; the GPU layer turns it into render passes.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct heap_t heap_t;
+
+// Handle to a frame graph.
+typedef struct frame_graph_t frame_graph_t;
+
+enum
+{
+	// Most resources and passes a graph can hold.
+	k_frame_graph_max_resources = 32,
+	k_frame_graph_max_passes = 32,
+
+	// Most resources one pass can use.
+	k_frame_graph_max_pass_uses = 8,
+
+	// Most barriers a compiled graph holds: one per use, plus one per resource at the end of the frame.
+	k_frame_graph_max_barriers = k_frame_graph_max_passes * k_frame_graph_max_pass_uses + k_frame_graph_max_resources,
+};
+
+// How a pass uses a resource.
+typedef enum frame_graph_usage_t
+{
+	k_frame_graph_usage_none, //not used, or before the frame for a resource's first barrier
+	k_frame_graph_usage_color_write,
+	k_frame_graph_usage_depth_write,
+	k_frame_graph_usage_depth_read,
+	k_frame_graph_usage_input, //read at the pixel being shaded, which lets the passes share a render pass
+	k_frame_graph_usage_sampled, //read anywhere by a shader
+	k_frame_graph_usage_transfer_read,
+	k_frame_graph_usage_present,
+
+	k_frame_graph_usage_count,
+} frame_graph_usage_t;
+
+typedef struct frame_graph_resource_info_t
+{
+	const char* name;
+	int width;
+	int height;
+	// Imported resources outlive the frame, such as the image it is presented from: their contents are
+	// kept after the last pass and handed on in final usage. Other resources are transient, live only
+	// between their first and last pass, and may share memory.
+	bool imported;
+	frame_graph_usage_t final_usage;
+	// Memory a transient resource needs, for placing it.
+	size_t size;
+	size_t alignment;
+} frame_graph_resource_info_t;
+
+// Change of a resource's usage, needed before a pass.
+typedef struct frame_graph_barrier_t
+{
+	int resource;
+	int pass; //the barrier comes before it, or is at the end of the frame for a pass equal to the pass count
+	int src_pass; //last pass to use the resource before, or -1 for its first use
+	frame_graph_usage_t src_usage; //none for a resource's first use
+	frame_graph_usage_t dst_usage;
+	bool by_region; //both passes are subpasses of one render pass, so each pixel depends only on itself
+} frame_graph_barrier_t;
+
+// A resource's place in the compiled plan.
+typedef struct frame_graph_resource_plan_t
+{
+	bool used; //by a pass that was not culled
+	int first_pass; //first and last passes using it, in execution order
+	int last_pass;
+	frame_graph_usage_t final_usage; //of its last use, or the final usage of an imported resource
+	bool load; //contents from before its first pass are read
+	bool store; //contents are read after the render pass that writes them last
+	size_t offset; //into the transient memory, for transient resources
+} frame_graph_resource_plan_t;
+
+// A pass's place in the compiled plan.
+typedef struct frame_graph_pass_plan_t
+{
+	bool culled; //nothing reads what it writes
+	int group; //render pass it is a subpass of, counting up in execution order
+	int subpass; //index within its render pass
+} frame_graph_pass_plan_t;
+
+// Create an empty frame graph.
+frame_graph_t* frame_graph_create(heap_t* heap);
+
+// Destroy a frame graph.
+void frame_graph_destroy(frame_graph_t* graph);
+
+// Add a resource. Returns its index, or -1 if the graph is full.
+int frame_graph_add_resource(frame_graph_t* graph, const frame_graph_resource_info_t* info);
+
+// Add a pass, which runs after the passes added before it. Returns its index, or -1 if the graph is full.
+int frame_graph_add_pass(frame_graph_t* graph, const char* name);
+
+// Declare that a pass uses a resource. A pass uses each resource one way.
+void frame_graph_pass_use(frame_graph_t* graph, int pass, int resource, frame_graph_usage_t usage);
+
+// Plan the graph's passes. Returns false, with an error printed, if a resource is read before any pass writes it.
+bool frame_graph_compile(frame_graph_t* graph);
+
+// Get the number of passes and resources added.
+int frame_graph_get_pass_count(frame_graph_t* graph);
+int frame_graph_get_resource_count(frame_graph_t* graph);
+
+// Get the resources a pass uses and how, returning how many.
+int frame_graph_get_pass_uses(frame_graph_t* graph, int pass, const int** resources, const frame_graph_usage_t** usages);
+
+// Get a resource's info as added.
+const frame_graph_resource_info_t* frame_graph_get_resource_info(frame_graph_t* graph, int resource);
+
+// Get a compiled resource or pass plan.
+const frame_graph_resource_plan_t* frame_graph_get_resource_plan(frame_graph_t* graph, int resource);
+const frame_graph_pass_plan_t* frame_graph_get_pass_plan(frame_graph_t* graph, int pass);
+
+// Get the compiled barriers, in execution order, returning how many.
+int frame_graph_get_barriers(frame_graph_t* graph, const frame_graph_barrier_t** barriers);
+
+// Get the number of render passes the compiled passes were merged into.
+int frame_graph_get_group_count(frame_graph_t* graph);
+
+// Get the bytes of memory every transient resource fits in at its planned offset.
+size_t frame_graph_get_transient_size(frame_graph_t* graph);
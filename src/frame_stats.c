@@ -0,0 +1,182 @@
+#include "frame_stats.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+#include "lock.h"
+#include "timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct frame_stats_t
+{
+	heap_t* heap;
+
+	int64_t current[k_frame_stat_count]; //counters for the frame in progress
+	int64_t totals[k_frame_stat_count]; //sums of every closed frame
+
+	lock_t lock; //guards the window and scratch buffer
+	int64_t* window; //k_frame_stat_count rings of window_frames values
+	int64_t* scratch; //window_frames values sorted to find percentiles
+	int window_frames;
+	int window_next;
+	int frame_count;
+
+	uint64_t frame_ticks;
+	uint64_t log_ticks;
+	uint64_t log_interval_ticks;
+} frame_stats_t;
+
+static const char* s_frame_stat_names[k_frame_stat_count] =
+{
+	"Frame (us)",
+	"Render (us)",
+	"Render Record (us)",
+	"GPU Frame End (us)",
+	"GPU (us)",
+	"Draw Calls",
+	"Pipeline Binds",
+	"Mesh Binds",
+	"Uniform Bytes",
+	"Heap Bytes",
+	"Net Bytes In",
+	"Net Bytes Out",
+	"Physics (us)",
+	"Tick Overrun (us)",
+	"FS Bytes Read",
+};
+
+// Frame statistics used by engine systems, or NULL.
+static frame_stats_t* s_default_frame_stats = NULL;
+
+static int compare_values(const void* a, const void* b);
+
+frame_stats_t* frame_stats_create(heap_t* heap, int window_frames, int log_interval_seconds)
+{
+	frame_stats_t* stats = heap_alloc(heap, sizeof(frame_stats_t), 8);
+	memset(stats, 0, sizeof(*stats));
+	stats->heap = heap;
+	lock_init_named(&stats->lock, "frame stats");
+	stats->window_frames = window_frames;
+	stats->window = heap_alloc(heap, sizeof(int64_t) * window_frames * k_frame_stat_count, 8);
+	stats->scratch = heap_alloc(heap, sizeof(int64_t) * window_frames, 8);
+	stats->frame_ticks = timer_get_ticks();
+	stats->log_ticks = stats->frame_ticks;
+	stats->log_interval_ticks = log_interval_seconds * timer_get_ticks_per_second();
+	return stats;
+}
+
+void frame_stats_destroy(frame_stats_t* stats)
+{
+	heap_free(stats->heap, stats->scratch);
+	heap_free(stats->heap, stats->window);
+	heap_free(stats->heap, stats);
+}
+
+void frame_stats_add(frame_stats_t* stats, frame_stat_t stat, int64_t value)
+{
+	if (stats)
+	{
+		atomic_fetch_add64(&stats->current[stat], value);
+	}
+}
+
+void frame_stats_set(frame_stats_t* stats, frame_stat_t stat, int64_t value)
+{
+	if (stats)
+	{
+		atomic_store64(&stats->current[stat], value);
+	}
+}
+
+void frame_stats_end_frame(frame_stats_t* stats)
+{
+	uint64_t now = timer_get_ticks();
+	frame_stats_set(stats, k_frame_stat_frame_us, timer_ticks_to_us(now - stats->frame_ticks));
+	stats->frame_ticks = now;
+
+	lock_acquire(&stats->lock);
+	for (int i = 0; i < k_frame_stat_count; ++i)
+	{
+		//counters added after the exchange land in the next frame
+		int64_t value = atomic_exchange64(&stats->current[i], 0);
+		stats->window[i * stats->window_frames + stats->window_next] = value;
+		stats->totals[i] += value;
+	}
+	stats->window_next = (stats->window_next + 1) % stats->window_frames;
+	stats->frame_count = __min(stats->frame_count + 1, stats->window_frames);
+	lock_release(&stats->lock);
+
+	if (stats->log_interval_ticks && now - stats->log_ticks >= stats->log_interval_ticks)
+	{
+		frame_stats_dump(stats);
+		stats->log_ticks = now;
+	}
+}
+
+void frame_stats_get(frame_stats_t* stats, frame_stat_t stat, frame_stat_summary_t* summary)
+{
+	memset(summary, 0, sizeof(*summary));
+
+	lock_acquire(&stats->lock);
+	int count = stats->frame_count;
+	if (count)
+	{
+		const int64_t* values = stats->window + stat * stats->window_frames;
+		int last = (stats->window_next + stats->window_frames - 1) % stats->window_frames;
+		summary->last = values[last];
+
+		//until the window fills, its valid values are the first count entries
+		int64_t total = 0;
+		for (int i = 0; i < count; ++i)
+		{
+			stats->scratch[i] = values[i];
+			total += values[i];
+		}
+		qsort(stats->scratch, count, sizeof(int64_t), compare_values);
+
+		summary->min = stats->scratch[0];
+		summary->max = stats->scratch[count - 1];
+		summary->avg = total / count;
+		summary->p99 = stats->scratch[(count - 1) * 99 / 100];
+	}
+	summary->total = stats->totals[stat];
+	summary->frame_count = count;
+	lock_release(&stats->lock);
+}
+
+const char* frame_stats_get_name(frame_stat_t stat)
+{
+	return s_frame_stat_names[stat];
+}
+
+void frame_stats_dump(frame_stats_t* stats)
+{
+	frame_stat_summary_t summary;
+	frame_stats_get(stats, k_frame_stat_frame_us, &summary);
+	debug_print(k_print_info, "Frame stats over %d frames:\n", summary.frame_count);
+	for (int i = 0; i < k_frame_stat_count; ++i)
+	{
+		frame_stats_get(stats, i, &summary);
+		debug_print(k_print_info, "  %-16s min %10lld avg %10lld p99 %10lld max %10lld\n",
+			s_frame_stat_names[i], summary.min, summary.avg, summary.p99, summary.max);
+	}
+}
+
+void frame_stats_set_default(frame_stats_t* stats)
+{
+	s_default_frame_stats = stats;
+}
+
+frame_stats_t* frame_stats_get_default()
+{
+	return s_default_frame_stats;
+}
+
+static int compare_values(const void* a, const void* b)
+{
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
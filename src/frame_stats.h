@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+// Per-frame statistics.
+// Subsystems add to the current frame's counters from any thread; once a frame the
+// game thread closes the frame, pushing every counter into a rolling window from which
+// min, average and 99th percentile can be queried at runtime or logged periodically.
+
+typedef struct heap_t heap_t;
+
+typedef struct frame_stats_t frame_stats_t;
+
+// Statistics tracked for every frame.
+typedef enum frame_stat_t
+{
+	k_frame_stat_frame_us, //game thread time between frames, measured by frame_stats_end_frame()
+	k_frame_stat_render_us, //render thread time spent executing commands and submitting to the GPU
+	k_frame_stat_render_record_us, //render thread time building and recording a frame's draws, within render
+	k_frame_stat_gpu_frame_end_us, //render thread time in gpu_frame_end() submitting and presenting, within render
+	k_frame_stat_gpu_us, //GPU time from a frame's first timestamp to its last, added once the frame has finished
+	k_frame_stat_draw_calls,
+	k_frame_stat_pipeline_binds,
+	k_frame_stat_mesh_binds,
+	k_frame_stat_uniform_bytes, //bytes of uniform data uploaded to the GPU
+	k_frame_stat_heap_bytes, //bytes allocated from the main heap at the end of the frame
+	k_frame_stat_net_bytes_in,
+	k_frame_stat_net_bytes_out,
+	k_frame_stat_physics_us, //game thread time stepping physics
+	k_frame_stat_tick_overrun_us, //time the previous frame ran past its fixed rate, added as the frame starts
+	k_frame_stat_fs_bytes_read, //bytes read from files and packs, before decompression
+	k_frame_stat_count,
+} frame_stat_t;
+
+// Summary of one statistic over the frames in the window.
+typedef struct frame_stat_summary_t
+{
+	int64_t last;
+	int64_t min;
+	int64_t avg;
+	int64_t p99;
+	int64_t max;
+	int64_t total; //sum over every frame since the statistics were created
+	int frame_count; //frames in the window, at most the window size
+} frame_stat_summary_t;
+
+// Creates an empty set of frame statistics.
+// Window frames is the number of most recent frames summaries are computed over.
+// Every log interval seconds the summaries are printed to the debug log; zero disables logging.
+frame_stats_t* frame_stats_create(heap_t* heap, int window_frames, int log_interval_seconds);
+
+// Destroys a set of frame statistics.
+void frame_stats_destroy(frame_stats_t* stats);
+
+// Add to a statistic for the current frame.
+// Safe to call from any thread.
+void frame_stats_add(frame_stats_t* stats, frame_stat_t stat, int64_t value);
+
+// Set a statistic for the current frame, replacing anything added so far.
+// Safe to call from any thread.
+void frame_stats_set(frame_stats_t* stats, frame_stat_t stat, int64_t value);
+
+// Close the current frame and start the next one.
+// Call once per frame from a single thread.
+void frame_stats_end_frame(frame_stats_t* stats);
+
+// Summarize a statistic over the frames in the window.
+void frame_stats_get(frame_stats_t* stats, frame_stat_t stat, frame_stat_summary_t* summary);
+
+// Get a statistic's display name.
+const char* frame_stats_get_name(frame_stat_t stat);
+
+// Print summaries of all statistics to the debug log.
+void frame_stats_dump(frame_stats_t* stats);
+
+// Set the frame statistics engine systems report to. May be NULL.
+void frame_stats_set_default(frame_stats_t* stats);
+
+// Get the frame statistics engine systems report to, or NULL.
+frame_stats_t* frame_stats_get_default();
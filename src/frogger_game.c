@@ -2,23 +2,32 @@
 
 #include "debug.h"
 #include "ecs.h"
+#include "ecs_scheduler.h"
 #include "fs.h"
 #include "gpu.h"
 #include "heap.h"
+#include "mover.h"
 #include "net.h"
 #include "render.h"
+#include "string_id.h"
 #include "timer_object.h"
 #include "transform.h"
 #include "wm.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
 
 const float player_speed = 5.0f;
 const float truck_speed = 6.0f;
 const float screen_height = 20.0f;
 
+//trucks further from the player than these move every other and every fourth frame, by the time since they last moved
+const float truck_mid_distance = 12.0f;
+const float truck_far_distance = 24.0f;
+const int truck_lod_interval = 8;
+
 typedef struct transform_component_t
 {
 	transform_t transform;
@@ -55,7 +64,7 @@ typedef struct truck_component_t
 
 typedef struct name_component_t
 {
-	char name[32];
+	string_id_t name;
 } name_component_t;
 
 typedef struct frogger_game_t
@@ -69,6 +78,8 @@ typedef struct frogger_game_t
 	timer_object_t* timer;
 
 	ecs_t* ecs;
+	ecs_scheduler_t* scheduler;
+	mover_t* mover;
 	int transform_type;
 	int camera_type;
 	int model_type;
@@ -76,6 +87,8 @@ typedef struct frogger_game_t
 	int lane_type;
 	int truck_type;
 	int name_type;
+	int mid_tier_type;
+	int far_tier_type;
 	ecs_entity_ref_t player_ent;
 	ecs_entity_ref_t lane_ent;
 	ecs_entity_ref_t truck_ent;
@@ -97,7 +110,7 @@ static void spawn_lane(frogger_game_t* game, int index, int direction, vec3f_t p
 static void spawn_truck(frogger_game_t* game, int index, int direction, vec3f_t position, float size, gpu_mesh_info_t* mesh);
 static void spawn_camera(frogger_game_t* game);
 static void update_players(frogger_game_t* game);
-static void update_trucks(frogger_game_t* game);
+static void update_truck_tiers(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
 static void draw_models(frogger_game_t* game);
 
 frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, int argc, const char** argv)
@@ -117,8 +130,30 @@ frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window,
 	game->player_type = ecs_register_component_type(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t));
 	game->truck_type = ecs_register_component_type(game->ecs, "truck", sizeof(truck_component_t), _Alignof(truck_component_t));
 	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
+	game->mid_tier_type = ecs_register_tag_type(game->ecs, "mid_tier");
+	game->far_tier_type = ecs_register_tag_type(game->ecs, "far_tier");
+
+	//the game is small enough to run its systems on the main thread
+	game->scheduler = ecs_scheduler_create(heap, game->ecs, NULL);
+	ecs_scheduler_set_timer(game->scheduler, game->timer);
+	ecs_scheduler_add_tier(game->scheduler, game->mid_tier_type, 2);
+	ecs_scheduler_add_tier(game->scheduler, game->far_tier_type, 4);
+	ecs_system_options_t tier_options = { .interval = truck_lod_interval };
+	ecs_scheduler_add_system_with_options(game->scheduler, "update_truck_tiers",
+		ECS_MASK(game->transform_type, game->truck_type), ecs_mask_empty(), false, update_truck_tiers, game, &tier_options);
+	game->mover = mover_create(heap, game->ecs, game->scheduler, game->transform_type);
+
+	net_options_t net_options = { .timer = game->timer };
+	game->net = net_create_with_options(heap, game->ecs, &net_options);
+	//positions to 1/512 of a unit within 256 units of the origin, scale to 1/64 up to 64 units
+	net_field_t transform_fields[] =
+	{
+		{ .encoding = k_net_field_fixed, .offset = offsetof(transform_component_t, transform.translation), .count = 3, .bits = 18, .min = -256.0f, .max = 256.0f },
+		{ .encoding = k_net_field_fixed, .offset = offsetof(transform_component_t, transform.scale), .count = 3, .bits = 12, .min = 0.0f, .max = 64.0f },
+		{ .encoding = k_net_field_quaternion, .offset = offsetof(transform_component_t, transform.rotation), .bits = 10 },
+	};
+	net_state_register_component_fields(game->net, game->transform_type, transform_fields, _countof(transform_fields));
 
-	game->net = net_create(heap, game->ecs);
 	if (argc >= 2)
 	{
 		net_address_t server;
@@ -146,6 +181,8 @@ frogger_game_t* frogger_game_create(heap_t* heap, fs_t* fs, wm_window_t* window,
 void frogger_game_destroy(frogger_game_t* game)
 {
 	net_destroy(game->net);
+	ecs_scheduler_destroy(game->scheduler);
+	mover_destroy(game->mover);
 	ecs_destroy(game->ecs);
 	timer_object_destroy(game->timer);
 	unload_resources(game);
@@ -158,15 +195,15 @@ void frogger_game_update(frogger_game_t* game)
 	ecs_update(game->ecs);
 	net_update(game->net);
 	update_players(game);
-	update_trucks(game);
+	ecs_scheduler_update(game->scheduler);
 	draw_models(game);
 	render_push_done(game->render);
 }
 
 static void load_resources(frogger_game_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
+	game->vertex_shader_work = fs_map(game->fs, "shaders/instanced.vert.spv");
+	game->fragment_shader_work = fs_map(game->fs, "shaders/triangle.frag.spv");
 	game->cube_shader = (gpu_shader_info_t)
 	{
 		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
@@ -174,6 +211,7 @@ static void load_resources(frogger_game_t* game)
 		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
 		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
 		.uniform_buffer_count = 1,
+		.storage_buffer_count = 1,
 	};
 
 	static vec3f_t player_verts[] =
@@ -272,8 +310,6 @@ static void load_resources(frogger_game_t* game)
 
 static void unload_resources(frogger_game_t* game)
 {
-	heap_free(game->heap, fs_work_get_buffer(game->vertex_shader_work));
-	heap_free(game->heap, fs_work_get_buffer(game->fragment_shader_work));
 	fs_work_destroy(game->fragment_shader_work);
 	fs_work_destroy(game->vertex_shader_work);
 }
@@ -298,11 +334,11 @@ static void truck_net_configure(ecs_t* ecs, ecs_entity_ref_t entity, int type, v
 
 static void spawn_player(frogger_game_t* game, int index)
 {
-	uint64_t k_player_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->player_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_player_ent_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->player_type,
+		game->name_type);
 	game->player_ent = ecs_entity_add(game->ecs, k_player_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->transform_type, true);
@@ -310,7 +346,7 @@ static void spawn_player(frogger_game_t* game, int index)
 	transform_comp->transform.translation.z = 18.0f;
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "player");
+	name_comp->name = string_id_intern("player");
 
 	player_component_t* player_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->player_type, true);
 	player_comp->index = index;
@@ -319,12 +355,11 @@ static void spawn_player(frogger_game_t* game, int index)
 	model_comp->mesh_info = &game->player_mesh;
 	model_comp->shader_info = &game->cube_shader;
 
-	uint64_t k_player_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->name_type);
-	uint64_t k_player_ent_rep_mask =
-		(1ULL << game->transform_type);
+	ecs_mask_t k_player_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->name_type);
+	ecs_mask_t k_player_ent_rep_mask = ECS_MASK(game->transform_type);
 	net_state_register_entity_type(game->net, 0, k_player_ent_net_mask, k_player_ent_rep_mask, player_net_configure, game);
 
 	net_state_register_entity_instance(game->net, 0, game->player_ent);
@@ -332,10 +367,10 @@ static void spawn_player(frogger_game_t* game, int index)
 
 static void spawn_lane(frogger_game_t* game, int index, int direction, vec3f_t position)
 {
-	uint64_t k_lane_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->lane_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_lane_ent_mask = ECS_MASK(
+		game->transform_type,
+		game->lane_type,
+		game->name_type);
 	game->lane_ent = ecs_entity_add(game->ecs, k_lane_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->lane_ent, game->transform_type, true);
@@ -343,17 +378,16 @@ static void spawn_lane(frogger_game_t* game, int index, int direction, vec3f_t p
 	transform_comp->transform.translation = position;
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->lane_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "lane");
+	name_comp->name = string_id_intern("lane");
 
 	lane_component_t* lane_comp = ecs_entity_get_component(game->ecs, game->lane_ent, game->lane_type, true);
 	lane_comp->index = index;
 	lane_comp->direction = direction;
 
-	uint64_t k_lane_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->name_type);
-	uint64_t k_lane_ent_rep_mask =
-		(1ULL << game->transform_type);
+	ecs_mask_t k_lane_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->name_type);
+	ecs_mask_t k_lane_ent_rep_mask = ECS_MASK(game->transform_type);
 	net_state_register_entity_type(game->net, 0, k_lane_ent_net_mask, k_lane_ent_rep_mask, player_net_configure, game);
 
 	net_state_register_entity_instance(game->net, 0, game->lane_ent);
@@ -399,11 +433,12 @@ static void spawn_lane(frogger_game_t* game, int index, int direction, vec3f_t p
 
 static void spawn_truck(frogger_game_t* game, int index, int direction, vec3f_t position, float size, gpu_mesh_info_t* mesh)
 {
-	uint64_t k_truck_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->truck_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_truck_ent_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->truck_type,
+		mover_get_component_type(game->mover),
+		game->name_type);
 	game->truck_ent = ecs_entity_add(game->ecs, k_truck_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->truck_ent, game->transform_type, true);
@@ -413,22 +448,28 @@ static void spawn_truck(frogger_game_t* game, int index, int direction, vec3f_t
 	transform_comp->transform.scale.y = size;
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->truck_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "truck");
+	name_comp->name = string_id_intern("truck");
 
 	truck_component_t* truck_comp = ecs_entity_get_component(game->ecs, game->truck_ent, game->truck_type, true);
 	truck_comp->index = index;
 	truck_comp->direction = direction;
 
+	//trucks drive along x and wrap along their length, where they always have
+	mover_component_t* mover_comp = ecs_entity_get_component(game->ecs, game->truck_ent, mover_get_component_type(game->mover), true);
+	mover_comp->velocity = vec3f_scale(vec3f_right(), truck_speed * direction);
+	mover_comp->wrap_min = vec3f_new(0.0f, -40.0f - size, 0.0f);
+	mover_comp->wrap_max = vec3f_new(0.0f, 40.0f + size, 0.0f);
+	mover_comp->wrap_mask = k_mover_wrap_y;
+
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->truck_ent, game->model_type, true);
 	model_comp->mesh_info = mesh;
 	model_comp->shader_info = &game->cube_shader;
 
-	uint64_t k_truck_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->name_type);
-	uint64_t k_truck_ent_rep_mask =
-		(1ULL << game->transform_type);
+	ecs_mask_t k_truck_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->name_type);
+	ecs_mask_t k_truck_ent_rep_mask = ECS_MASK(game->transform_type);
 	net_state_register_entity_type(game->net, 0, k_truck_ent_net_mask, k_truck_ent_rep_mask, player_net_configure, game);
 
 	net_state_register_entity_instance(game->net, 0, game->truck_ent);
@@ -436,13 +477,13 @@ static void spawn_truck(frogger_game_t* game, int index, int direction, vec3f_t
 
 static void spawn_camera(frogger_game_t* game)
 {
-	uint64_t k_camera_ent_mask =
-		(1ULL << game->camera_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_camera_ent_mask = ECS_MASK(
+		game->camera_type,
+		game->name_type);
 	game->camera_ent = ecs_entity_add(game->ecs, k_camera_ent_mask);
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->camera_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "camera");
+	name_comp->name = string_id_intern("camera");
 
 	camera_component_t* camera_comp = ecs_entity_get_component(game->ecs, game->camera_ent, game->camera_type, true);
 	mat4f_make_orthographic(&camera_comp->projection, screen_height, 2.0f, -1000.0f, 1000.0f);
@@ -459,7 +500,7 @@ static void update_players(frogger_game_t* game)
 
 	uint32_t key_mask = wm_get_key_mask(game->window);
 
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->player_type);
+	ecs_mask_t k_query_mask = ECS_MASK(game->transform_type, game->player_type);
 
 	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
 		ecs_query_is_valid(game->ecs, &query);
@@ -473,7 +514,7 @@ static void update_players(frogger_game_t* game)
 			transform_comp->transform.translation.z = 18.0f;
 			transform_comp->transform.translation.y = 0.0f;
 		}
-		k_query_mask = (1ULL << game->transform_type) | (1ULL << game->truck_type);
+		k_query_mask = ECS_MASK(game->transform_type, game->truck_type);
 
 		for (ecs_query_t truck_query = ecs_query_create(game->ecs, k_query_mask);
 			ecs_query_is_valid(game->ecs, &truck_query);
@@ -511,69 +552,96 @@ static void update_players(frogger_game_t* game)
 			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), dt * player_speed));
 		}
 		transform_multiply(&transform_comp->transform, &move);
+		ecs_query_mark_changed(game->ecs, &query, game->transform_type);
 	}
 }
 
-static void update_trucks(frogger_game_t* game)
+// Tag trucks into tiers by their distance from the player, to take effect at the next ecs_update.
+static void update_truck_tiers(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user)
 {
-	float dt = (float)timer_object_get_delta_ms(game->timer) * 0.001f;
-
-	uint32_t key_mask = wm_get_key_mask(game->window);
-
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->truck_type);
+	frogger_game_t* game = user;
+	transform_component_t* player_transform = ecs_entity_get_component(ecs, game->player_ent, game->transform_type, false);
+	if (!player_transform)
+	{
+		return;
+	}
 
-	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
-		ecs_query_is_valid(game->ecs, &query);
-		ecs_query_next(game->ecs, &query))
+	ecs_mask_t k_query_mask = ECS_MASK(game->transform_type, game->truck_type);
+	for (ecs_chunk_query_t query = ecs_chunk_query_create(ecs, k_query_mask);
+		ecs_chunk_query_is_valid(ecs, &query);
+		ecs_chunk_query_next(ecs, &query))
 	{
-		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-		truck_component_t* truck_comp = ecs_query_get_component(game->ecs, &query, game->truck_type);
+		ecs_mask_t mask = ecs_chunk_query_get_component_mask(ecs, &query);
+		int tier = ecs_mask_test(mask, game->far_tier_type) ? 2 : ecs_mask_test(mask, game->mid_tier_type) ? 1 : 0;
+		transform_component_t* transform_comps = ecs_chunk_query_get_components(ecs, &query, game->transform_type);
+		int count = ecs_chunk_query_get_count(ecs, &query);
 
-		if ((truck_comp->direction == 1 && transform_comp->transform.translation.y > (40.0f + transform_comp->transform.scale.y)) || (truck_comp->direction == -1 && transform_comp->transform.translation.y < (-40.0f - transform_comp->transform.scale.y)))
-		{
-			transform_comp->transform.translation.y = (40.0f + transform_comp->transform.scale.y) * -truck_comp->direction;
-		}
-		else
+		for (int i = 0; i < count; ++i)
 		{
-			transform_t move;
-			transform_identity(&move);
-			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), dt * truck_speed * truck_comp->direction));
-			transform_multiply(&transform_comp->transform, &move);
+			float distance = vec3f_dist(transform_comps[i].transform.translation, player_transform->transform.translation);
+			int wanted = distance > truck_far_distance ? 2 : distance > truck_mid_distance ? 1 : 0;
+			if (wanted == tier)
+			{
+				continue;
+			}
+
+			ecs_entity_ref_t entity = ecs_chunk_query_get_entity(ecs, &query, i);
+			if (tier > 0)
+			{
+				ecs_command_remove_component(ecs, entity, tier == 2 ? game->far_tier_type : game->mid_tier_type);
+			}
+			if (wanted > 0)
+			{
+				ecs_command_add_component(ecs, entity, wanted == 2 ? game->far_tier_type : game->mid_tier_type, NULL);
+			}
 		}
-		
 	}
 }
 
 static void draw_models(frogger_game_t* game)
 {
-	uint64_t k_camera_query_mask = (1ULL << game->camera_type);
+	ecs_mask_t k_camera_query_mask = ECS_MASK(game->camera_type);
 	for (ecs_query_t camera_query = ecs_query_create(game->ecs, k_camera_query_mask);
 		ecs_query_is_valid(game->ecs, &camera_query);
 		ecs_query_next(game->ecs, &camera_query))
 	{
 		camera_component_t* camera_comp = ecs_query_get_component(game->ecs, &camera_query, game->camera_type);
 
-		uint64_t k_model_query_mask = (1ULL << game->transform_type) | (1ULL << game->model_type);
-		for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
-			ecs_query_is_valid(game->ecs, &query);
-			ecs_query_next(game->ecs, &query))
+		struct
+		{
+			mat4f_t projection;
+			mat4f_t view;
+		} uniform_data;
+		uniform_data.projection = camera_comp->projection;
+		uniform_data.view = camera_comp->view;
+		gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
+
+		ecs_mask_t k_model_query_mask = ECS_MASK(game->transform_type, game->model_type);
+		for (ecs_chunk_query_t query = ecs_chunk_query_create(game->ecs, k_model_query_mask);
+			ecs_chunk_query_is_valid(game->ecs, &query);
+			ecs_chunk_query_next(game->ecs, &query))
 		{
-			transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-			model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
-			ecs_entity_ref_t entity_ref = ecs_query_get_entity(game->ecs, &query);
+			transform_component_t* transform_comps = ecs_chunk_query_get_components(game->ecs, &query, game->transform_type);
+			model_component_t* model_comps = ecs_chunk_query_get_components(game->ecs, &query, game->model_type);
+			int count = ecs_chunk_query_get_count(game->ecs, &query);
 
-			struct
+			//models of a mesh share the camera and are drawn in one instanced draw, as in the physics sandbox;
+			//runs of models with the same mesh and shader convert their transforms straight into the draw's instances
+			for (int first = 0, last = 0; first < count; first = last)
 			{
-				mat4f_t projection;
-				mat4f_t model;
-				mat4f_t view;
-			} uniform_data;
-			uniform_data.projection = camera_comp->projection;
-			uniform_data.view = camera_comp->view;
-			transform_to_matrix(&transform_comp->transform, &uniform_data.model);
-			gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
-
-			render_push_model(game->render, &entity_ref, model_comp->mesh_info, model_comp->shader_info, &uniform_info);
+				model_component_t* model_comp = &model_comps[first];
+				for (last = first + 1; last < count; ++last)
+				{
+					if (model_comps[last].mesh_info != model_comp->mesh_info ||
+						model_comps[last].shader_info != model_comp->shader_info)
+					{
+						break;
+					}
+				}
+
+				mat4f_t* models = render_push_instances(game->render, model_comp->mesh_info, model_comp->shader_info, &uniform_info, sizeof(mat4f_t), last - first);
+				transform_to_matrix_batch(&transform_comps[first].transform, last - first, models);
+			}
 		}
 	}
 }
\ No newline at end of file
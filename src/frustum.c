@@ -0,0 +1,161 @@
+#include "frustum.h"
+
+#include "cpu.h"
+#include "mat4f.h"
+
+#include <math.h>
+
+#include <immintrin.h>
+
+typedef void (*cull_spheres_func_t)(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible);
+
+static void cull_spheres_sse2(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible);
+static void cull_spheres_avx(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible);
+
+static cull_spheres_func_t s_cull_spheres = cull_spheres_sse2;
+
+void frustum_startup()
+{
+	cpu_variant_t variants[] =
+	{
+		{ .name = "avx", .features = k_cpu_feature_avx, .function = cull_spheres_avx },
+		{ .name = "sse2", .features = 0, .function = cull_spheres_sse2 },
+	};
+	s_cull_spheres = cpu_select("frustum_cull_spheres", variants, _countof(variants));
+}
+
+void frustum_from_camera(frustum_t* frustum, const mat4f_t* projection, const mat4f_t* view)
+{
+	mat4f_t view_projection;
+	mat4f_mul(&view_projection, view, projection);
+
+	//each clip coordinate is a point dotted with a column of the matrix;
+	//the planes are where x and y meet -w and w, and where z meets 0 and w
+	const float (*m)[4] = view_projection.data;
+	for (int i = 0; i < 4; ++i)
+	{
+		frustum->planes[0][i] = m[i][3] + m[i][0];
+		frustum->planes[1][i] = m[i][3] - m[i][0];
+		frustum->planes[2][i] = m[i][3] + m[i][1];
+		frustum->planes[3][i] = m[i][3] - m[i][1];
+		frustum->planes[4][i] = m[i][2];
+		frustum->planes[5][i] = m[i][3] - m[i][2];
+	}
+
+	//normalized planes give true distances to compare against sphere radii
+	for (int p = 0; p < 6; ++p)
+	{
+		float* plane = frustum->planes[p];
+		float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		if (length > 0.0f)
+		{
+			for (int i = 0; i < 4; ++i)
+			{
+				plane[i] /= length;
+			}
+		}
+	}
+}
+
+void frustum_cull_spheres(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible)
+{
+	s_cull_spheres(frustum, spheres, count, visible);
+}
+
+static void cull_spheres_sse2(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible)
+{
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		//transpose four spheres into a register each of x, y, z and radius
+		__m128 x = _mm_loadu_ps(&spheres[i + 0].center.x);
+		__m128 y = _mm_loadu_ps(&spheres[i + 1].center.x);
+		__m128 z = _mm_loadu_ps(&spheres[i + 2].center.x);
+		__m128 radius = _mm_loadu_ps(&spheres[i + 3].center.x);
+		_MM_TRANSPOSE4_PS(x, y, z, radius);
+		__m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+		__m128 inside = _mm_cmpeq_ps(x, x);
+		for (int p = 0; p < 6; ++p)
+		{
+			const float* plane = frustum->planes[p];
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane[0])), _mm_mul_ps(y, _mm_set1_ps(plane[1]))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane[2])), _mm_set1_ps(plane[3])));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, neg_radius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (int j = 0; j < 4; ++j)
+		{
+			visible[i + j] = (mask >> j) & 1;
+		}
+	}
+
+	for (; i < count; ++i)
+	{
+		const frustum_sphere_t* sphere = &spheres[i];
+		visible[i] = true;
+		for (int p = 0; p < 6; ++p)
+		{
+			const float* plane = frustum->planes[p];
+			float distance = sphere->center.x * plane[0] + sphere->center.y * plane[1] + sphere->center.z * plane[2] + plane[3];
+			if (distance < -sphere->radius)
+			{
+				visible[i] = false;
+				break;
+			}
+		}
+	}
+}
+
+// Eight spheres at a time in 256 bit registers, then the rest with SSE2.
+// Uses only VEX encoded instructions, and clears the upper halves on the way out so the SSE2 code after pays no transition.
+static void cull_spheres_avx(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible)
+{
+	__m256 planes[6][4];
+	for (int p = 0; p < 6; ++p)
+	{
+		for (int c = 0; c < 4; ++c)
+		{
+			planes[p][c] = _mm256_set1_ps(frustum->planes[p][c]);
+		}
+	}
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		//two spheres per load; transposing within each 128 bit half leaves lane l holding sphere (l % 4) * 2 + l / 4
+		__m256 r0 = _mm256_loadu_ps(&spheres[i + 0].center.x);
+		__m256 r1 = _mm256_loadu_ps(&spheres[i + 2].center.x);
+		__m256 r2 = _mm256_loadu_ps(&spheres[i + 4].center.x);
+		__m256 r3 = _mm256_loadu_ps(&spheres[i + 6].center.x);
+		__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+		__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+		__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+		__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+		__m256 x = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 y = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 z = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 radius = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 neg_radius = _mm256_sub_ps(_mm256_setzero_ps(), radius);
+
+		__m256 inside = _mm256_cmp_ps(x, x, _CMP_EQ_OQ);
+		for (int p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_add_ps(
+				_mm256_add_ps(_mm256_mul_ps(x, planes[p][0]), _mm256_mul_ps(y, planes[p][1])),
+				_mm256_add_ps(_mm256_mul_ps(z, planes[p][2]), planes[p][3]));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, neg_radius, _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);
+		for (int lane = 0; lane < 8; ++lane)
+		{
+			visible[i + (lane % 4) * 2 + lane / 4] = (mask >> lane) & 1;
+		}
+	}
+	_mm256_zeroupper();
+
+	cull_spheres_sse2(frustum, spheres + i, count - i, visible + i);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// View frustum culling.
+// Bounding spheres are tested against the six planes of a camera's view frustum,
+// four spheres at a time, or eight with AVX.
+
+#include "vec3f.h"
+
+#include <stdbool.h>
+
+typedef struct mat4f_t mat4f_t;
+
+// Frustum as six planes whose normals point inward.
+// A point p is inside a plane when dot(normal, p) + distance >= 0.
+typedef struct frustum_t
+{
+	float planes[6][4]; //normal x, y, z and distance
+} frustum_t;
+
+// Bounding sphere in world space.
+typedef struct frustum_sphere_t
+{
+	vec3f_t center;
+	float radius;
+} frustum_sphere_t;
+
+// Pick the fastest culling kernel the CPU supports. Call after cpu_startup().
+// Until then spheres are culled with SSE2.
+void frustum_startup();
+
+// Extract the frustum of a camera from its view and projection matrices.
+// Clip space depth runs from zero to one, as in Vulkan.
+void frustum_from_camera(frustum_t* frustum, const mat4f_t* projection, const mat4f_t* view);
+
+// Test count spheres against a frustum.
+// Writes true to each sphere's entry in visible if any part of it may be inside the frustum.
+void frustum_cull_spheres(const frustum_t* frustum, const frustum_sphere_t* spheres, int count, bool* visible);
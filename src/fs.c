@@ -1,99 +1,392 @@
 #include "fs.h"
 
+#include "atomic.h"
 #include "event.h"
+#include "frame_stats.h"
 #include "heap.h"
+#include "job.h"
+#include "lock.h"
+#include "object_pool.h"
 #include "queue.h"
+#include "semaphore.h"
 #include "thread.h"
+#include "trace.h"
 #include "debug.h"
 #include "lz4/lz4.h"
+#define LZ4F_STATIC_LINKING_ONLY
+#include "lz4/lz4frame.h"
+#include "lz4/xxhash.h"
 
+#include <ctype.h>
 #include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+enum
+{
+	k_fs_work_pool_size = 64,
+
+	// Cached files held only by the cache are evicted once the cache holds more than this.
+	k_fs_cache_capacity = 64 * 1024 * 1024,
+
+	// Streams keep this many chunks of this size in memory, each read or written as one request.
+	k_fs_stream_slot_count = 4,
+	k_fs_stream_chunk_size = 256 * 1024,
+
+	// Room for one compressed chunk and its size prefix.
+	k_fs_stream_staging_size = LZ4_COMPRESSBOUND(k_fs_stream_chunk_size) + 4,
+
+	// Room for the ".<sequence>.tmp" suffix of a write's temporary file.
+	k_fs_write_temp_suffix_size = 32,
+};
+
+// Completion keys posted to the I/O completion port.
+enum
+{
+	k_fs_key_io, //an overlapped read or write finished
+	k_fs_key_submit, //new work was pushed on a file queue
+	k_fs_key_cancel, //work was cancelled; look for cancelled reads and writes in flight
+	k_fs_key_quit,
+};
+
 typedef struct fs_t
 {
 	heap_t* heap;
-	queue_t* file_queue;
+	object_pool_t* work_pool;
+	queue_t* file_queues[k_fs_priority_count]; //one queue per priority, drained most urgent first
 	queue_t* compression_queue; //queue to hold the work that needs to be compressed/decompressed
+	job_system_t* jobs; //compresses chunks in parallel, or NULL to compress on the compression thread
+	HANDLE completion_port;
+	int max_in_flight; //overlapped operations the file thread keeps issued at once
+	int in_flight; //only touched by the file thread
+	struct fs_work_t* issued; //reads and writes in flight, only touched by the file thread
 	thread_t* file_thread;
 	thread_t* compression_thread; //thread used to process the compression queue
+
+	// Files read through fs_read_cached(), newest first.
+	lock_t cache_lock;
+	struct fs_work_t* cache;
+
+	// Unfinished fs_write() work, newest first, so a newer write to a path can supersede older ones.
+	lock_t write_lock;
+	struct fs_work_t* pending_writes;
+	uint64_t write_sequence;
+
+	struct fs_pack_t* pack; //mounted pack file, or NULL
 } fs_t;
 
 typedef enum fs_work_op_t
 {
 	k_fs_work_op_read,
 	k_fs_work_op_write,
+	k_fs_work_op_map,
 } fs_work_op_t;
 
 typedef struct fs_work_t
 {
+	fs_t* fs;
 	heap_t* heap;
 	fs_work_op_t op;
-	char path[1024];
+	char* path; //UTF-8, stored after wide_path in one allocation sized to it
+	wchar_t* wide_path; //UTF-16 for the file APIs, converted when a loose file is issued
+	wchar_t* wide_temp_path; //for writes, the temporary file written before it is moved over the path
+	size_t path_length; //including the terminator
 	bool null_terminate;
 	bool use_compression;
+	int compression_level;
+	bool compute_hash;
+	uint64_t content_hash; //XXH64 of what was read, once done, if compute_hash is set
 	void* buffer;
+	const void* source_buffer; //caller's buffer while buffer holds its compressed copy
 	size_t size;
-	event_t* done;
+	int done; //set once the work is finished; waiters block on it with atomic_wait()
 	int result;
+	HANDLE handle;
+	OVERLAPPED overlapped;
+
+	// Set when the work is one chunk of a stream.
+	struct fs_stream_t* stream;
+	uint64_t offset;
+	int sequence; //order of the chunk in a read stream
+	int busy; //0 = free, 1 = in flight, 2 = read and waiting to be delivered
+
+	// Set when the work is shared through the cache; the cache holds one of the references.
+	bool cached;
+	int refcount; //guarded by the cache lock
+	uint32_t path_hash;
+	FILETIME write_time; //last write time of the file when the read was queued
+	struct fs_work_t* cache_next;
+
+	bool owns_buffer; //buffer came from the file system's heap and is freed with the work
+	fs_priority_t priority;
+	fs_work_callback_t callback;
+	void* callback_user;
+	queue_t* completion_queue;
+	uint64_t flow; //trace flow from the caller through the file and compression threads
+	int cancelled;
+	struct fs_work_t* issued_prev;
+	struct fs_work_t* issued_next;
+	const struct fs_pack_entry_t* pack_entry; //set when the path was found in the mounted pack
+
+	// Set for fs_write() work, which is coalesced with other writes to its path.
+	uint64_t write_sequence; //order the write was queued in, from 1
+	bool write_issued; //guarded by the write lock
+	int superseded; //a newer write to the path replaces this one's data
+	struct fs_work_t* write_next;
 } fs_work_t;
 
+typedef struct fs_stream_t
+{
+	fs_t* fs;
+	HANDLE handle;
+	bool is_read;
+	bool use_compression;
+	int result; //first error, or zero
+	fs_work_t* slots[k_fs_stream_slot_count];
+
+	// Uncompressed chunks, double-buffered so LZ4 can refer back into the previous one.
+	char* blocks[2];
+	int block_index;
+	size_t block_used;
+
+	// Write streams.
+	light_semaphore_t free_slots;
+	fs_work_t* current; //slot being filled when not compressing
+	uint64_t write_offset;
+	LZ4_stream_t* lz4;
+
+	// Read streams; everything below is only touched by the file thread once reads are queued.
+	fs_stream_callback_t callback;
+	void* user;
+	light_event_t done;
+	uint64_t file_size;
+	uint64_t read_offset;
+	int next_sequence;
+	int next_deliver;
+	int in_flight;
+	char* staging; //compressed bytes gathered until a whole block is present
+	size_t staging_used;
+	LZ4_streamDecode_t* lz4_decode;
+} fs_stream_t;
+
+// Pack files hold many files in one: a header, then a table of contents laid out as an
+// open-addressed hash table keyed by path hash, then an optional compression dictionary, then the file data.
+enum
+{
+	k_fs_pack_magic = 0x4B415047, //"GPAK"
+	k_fs_pack_version = 3,
+	k_fs_pack_alignment = 16, //alignment of each file's data in the pack
+
+	// Files up to this size are sampled into the pack's dictionary, this much from each, up to the dictionary size.
+	// Small files share too little history within themselves for LZ4 to find matches; a dictionary of
+	// what the pack's files have in common gives them that history up front.
+	k_fs_pack_dictionary_file_size = 64 * 1024,
+	k_fs_pack_dictionary_sample_size = 4 * 1024,
+	k_fs_pack_dictionary_size = 64 * 1024, //LZ4 only looks back this far
+	k_fs_pack_dictionary_min_files = 4, //too few small files to be worth a dictionary
+};
+
+enum
+{
+	k_fs_pack_entry_used = 1 << 0,
+	k_fs_pack_entry_compressed = 1 << 1, //stored in the same chunked LZ4 format as compressed fs_write()
+	k_fs_pack_entry_dictionary = 1 << 2, //compressed against the pack's dictionary
+};
+
+typedef struct fs_pack_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t table_size; //power of two
+	uint32_t entry_count;
+	uint32_t dictionary_size; //stored right after the table
+	uint32_t reserved;
+} fs_pack_header_t;
+
+typedef struct fs_pack_entry_t
+{
+	uint64_t path_hash;
+	uint64_t offset;
+	uint64_t stored_size;
+	uint64_t size; //size once decompressed
+	uint64_t content_hash; //XXH64 of the decompressed contents
+	uint32_t flags;
+	uint32_t reserved;
+} fs_pack_entry_t;
+
+typedef struct fs_pack_t
+{
+	HANDLE handle;
+	uint32_t table_mask;
+	fs_pack_entry_t* table;
+	char* dictionary;
+	uint32_t dictionary_size;
+} fs_pack_t;
+
 static int file_thread_func(void* user);
+static void file_queue_push(fs_t* fs, fs_work_t* work);
+static void release_compressed(fs_work_t* work);
+
+static fs_stream_t* stream_create(fs_t* fs, const char* path, bool is_read, bool use_compression);
+static fs_work_t* stream_acquire_slot(fs_stream_t* stream);
+static void stream_submit_write(fs_stream_t* stream);
+static void stream_prepare_read(fs_stream_t* stream, fs_work_t* slot);
+static bool stream_issue(fs_work_t* slot);
+static void stream_complete(fs_work_t* slot, DWORD bytes, int result);
 
 static int compression_thread_func(void* user);
+static int compress_work(fs_t* fs, fs_work_t* work, const LZ4F_CDict* dictionary);
+
+static fs_work_t* work_create(fs_t* fs, fs_work_op_t op, const char* path, heap_t* heap);
+static void work_set_options(fs_work_t* work, const fs_work_options_t* options);
+static bool work_is_done(fs_work_t* work);
+static void work_wait(fs_work_t* work);
+static void work_finish(fs_work_t* work);
+static void read_hash(fs_work_t* work);
+
+static bool work_same_path(const fs_work_t* a, const fs_work_t* b);
+static void write_register(fs_t* fs, fs_work_t* work);
+static bool write_begin(fs_t* fs, fs_work_t* work);
+static void write_commit(fs_t* fs, fs_work_t* work);
+static void write_unlink(fs_t* fs, fs_work_t* work);
+
+static uint64_t hash_pack_path(const char* path);
+static size_t pack_align(size_t offset);
+static size_t build_pack_dictionary(const void** data, const size_t* sizes, int count, char* dictionary);
+static bool pack_read_sync(HANDLE handle, uint64_t offset, void* buffer, size_t size);
+static const fs_pack_entry_t* pack_find(fs_t* fs, const char* path);
+static bool pack_attach(fs_t* fs, fs_work_t* work);
+static bool pack_issue(fs_t* fs, fs_work_t* work);
+static void pack_destroy(fs_t* fs);
 
-fs_t* fs_create(heap_t* heap, int queue_capacity)
+static fs_work_t* cache_acquire(fs_t* fs, const char* path, bool null_terminate);
+static void cache_evict(fs_t* fs);
+static bool cache_release(fs_work_t* work);
+static void work_free(fs_work_t* work);
+
+fs_t* fs_create(heap_t* heap, int queue_capacity, job_system_t* jobs)
 {
 	fs_t* fs = heap_alloc(heap, sizeof(fs_t), 8);
 	fs->heap = heap;
-	fs->file_queue = queue_create(heap, queue_capacity);
-	fs->file_thread = thread_create(file_thread_func, fs);
+	fs->jobs = jobs;
+	fs->work_pool = object_pool_create(heap, sizeof(fs_work_t), 8, k_fs_work_pool_size);
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		fs->file_queues[i] = queue_create(heap, queue_capacity);
+	}
+	fs->completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	fs->max_in_flight = queue_capacity;
+	fs->in_flight = 0;
+	fs->issued = NULL;
+	thread_options_t file_options = { .name = "FS File" };
+	fs->file_thread = thread_create_with_options(file_thread_func, fs, &file_options);
 	fs->compression_queue = queue_create(heap, queue_capacity);
-	fs->compression_thread = thread_create(compression_thread_func, fs);
+	thread_options_t compression_options = { .name = "FS Compression" };
+	fs->compression_thread = thread_create_with_options(compression_thread_func, fs, &compression_options);
+	lock_init_named(&fs->cache_lock, "fs cache");
+	fs->cache = NULL;
+	lock_init_named(&fs->write_lock, "fs writes");
+	fs->pending_writes = NULL;
+	fs->write_sequence = 0;
+	fs->pack = NULL;
 	return fs;
 }
 
 void fs_destroy(fs_t* fs)
 {
-	queue_push(fs->file_queue, NULL);
+	//drop the cache's references while the threads can still finish pending reads
+	while (fs->cache)
+	{
+		fs_work_t* work = fs->cache;
+		fs->cache = work->cache_next;
+		fs_work_destroy(work);
+	}
+
+	PostQueuedCompletionStatus(fs->completion_port, 0, k_fs_key_quit, NULL);
 	thread_destroy(fs->file_thread);
-	queue_destroy(fs->file_queue);
+	CloseHandle(fs->completion_port);
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		queue_destroy(fs->file_queues[i]);
+	}
 	queue_push(fs->compression_queue, NULL);
 	thread_destroy(fs->compression_thread);
 	queue_destroy(fs->compression_queue);
+	pack_destroy(fs);
+	object_pool_destroy(fs->work_pool);
 	heap_free(fs->heap, fs);
 }
 
 fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = heap;
-	work->op = k_fs_work_op_read;
-	strcpy_s(work->path, sizeof(work->path), path);
-	work->buffer = NULL;
-	work->size = 0;
-	work->done = event_create();
-	work->result = 0;
+	return fs_read_with_options(fs, path, heap, null_terminate, use_compression, NULL);
+}
+
+fs_work_t* fs_read_with_priority(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, fs_priority_t priority)
+{
+	fs_work_options_t options = { .priority = priority };
+	return fs_read_with_options(fs, path, heap, null_terminate, use_compression, &options);
+}
+
+fs_work_t* fs_read_with_options(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, const fs_work_options_t* options)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_read, path, heap);
 	work->null_terminate = null_terminate;
 	work->use_compression = use_compression;
-	queue_push(fs->file_queue, work);
+	work_set_options(work, options);
+	pack_attach(fs, work);
+	work->flow = trace_flow_begin(trace_get_default(), "fs_read");
+	file_queue_push(fs, work);
+	return work;
+}
+
+fs_work_t* fs_read_cached(fs_t* fs, const char* path, bool null_terminate)
+{
+	lock_acquire(&fs->cache_lock);
+	fs_work_t* work = cache_acquire(fs, path, null_terminate);
+	lock_release(&fs->cache_lock);
+	return work;
+}
+
+void fs_prefetch(fs_t* fs, const char* path)
+{
+	fs_work_destroy(fs_read_cached(fs, path, false));
+}
+
+fs_work_t* fs_map(fs_t* fs, const char* path)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_map, path, fs->heap);
+	if (pack_attach(fs, work))
+	{
+		//packed files cannot be mapped on their own, so read them into a buffer we own instead
+		work->op = k_fs_work_op_read;
+		work->owns_buffer = true;
+	}
+	file_queue_push(fs, work);
 	return work;
 }
 
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression)
 {
-	fs_work_t* work = heap_alloc(fs->heap, sizeof(fs_work_t), 8);
-	work->heap = fs->heap;
-	work->op = k_fs_work_op_write;
-	strcpy_s(work->path, sizeof(work->path), path);
+	return fs_write_with_options(fs, path, buffer, size, use_compression, NULL);
+}
+
+fs_work_t* fs_write_with_priority(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression, fs_priority_t priority)
+{
+	fs_work_options_t options = { .priority = priority };
+	return fs_write_with_options(fs, path, buffer, size, use_compression, &options);
+}
+
+fs_work_t* fs_write_with_options(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression, const fs_work_options_t* options)
+{
+	fs_work_t* work = work_create(fs, k_fs_work_op_write, path, fs->heap);
 	work->buffer = (void*)buffer;
 	work->size = size;
-	work->done = event_create();
-	work->result = 0;
-	work->null_terminate = false;
 	work->use_compression = use_compression;
+	work_set_options(work, options);
+	write_register(fs, work);
+	work->flow = trace_flow_begin(trace_get_default(), "fs_write");
 
 	if (use_compression)
 	{
@@ -103,22 +396,40 @@ fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size,
 	}
 	else
 	{
-		queue_push(fs->file_queue, work);
+		file_queue_push(fs, work);
 	}
 
 	return work;
 }
 
+void fs_work_cancel(fs_work_t* work)
+{
+	//cached reads may be shared with other callers, so they always run to completion
+	if (work && !work->cached && !work->stream)
+	{
+		atomic_store(&work->cancelled, 1);
+		PostQueuedCompletionStatus(work->fs->completion_port, 0, k_fs_key_cancel, NULL);
+	}
+}
+
 bool fs_work_is_done(fs_work_t* work)
 {
-	return work ? event_is_raised(work->done) : true;
+	return work ? work_is_done(work) : true;
 }
 
 void fs_work_wait(fs_work_t* work)
 {
 	if (work)
 	{
-		event_wait(work->done);
+		work_wait(work);
+	}
+}
+
+void fs_work_wait_job(fs_work_t* work, job_system_t* jobs)
+{
+	while (!fs_work_is_done(work))
+	{
+		job_yield(jobs);
 	}
 }
 
@@ -140,181 +451,1686 @@ size_t fs_work_get_size(fs_work_t* work)
 	return work ? work->size : 0;
 }
 
+uint64_t fs_work_get_hash(fs_work_t* work)
+{
+	fs_work_wait(work);
+	return work && !work->result ? work->content_hash : 0;
+}
+
 void fs_work_destroy(fs_work_t* work)
 {
-	if (work)
+	if (work && cache_release(work))
 	{
-		event_wait(work->done);
-		event_destroy(work->done);
-		heap_free(work->heap, work);
+		work_free(work);
 	}
 }
 
-static void file_read(fs_t* fs, fs_work_t* work)
+fs_stream_t* fs_stream_open_write(fs_t* fs, const char* path, bool use_compression)
 {
-	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	fs_stream_t* stream = stream_create(fs, path, false, use_compression);
+	if (!stream)
 	{
-		work->result = -1;
-		event_signal(work->done);
-		return;
+		return NULL;
 	}
 
-	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
-		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (handle == INVALID_HANDLE_VALUE)
+	light_semaphore_init(&stream->free_slots, k_fs_stream_slot_count, k_fs_stream_slot_count);
+	if (use_compression)
 	{
-		work->result = GetLastError();
-		event_signal(work->done);
-		return;
+		for (int i = 0; i < _countof(stream->blocks); ++i)
+		{
+			stream->blocks[i] = heap_alloc(fs->heap, k_fs_stream_chunk_size, 8);
+		}
+		stream->lz4 = LZ4_initStream(heap_alloc(fs->heap, sizeof(LZ4_stream_t), 8), sizeof(LZ4_stream_t));
 	}
+	return stream;
+}
 
-	if (!GetFileSizeEx(handle, (PLARGE_INTEGER)&work->size))
+void fs_stream_set_priority(fs_stream_t* stream, fs_priority_t priority)
+{
+	for (int i = 0; i < k_fs_stream_slot_count; ++i)
 	{
-		work->result = GetLastError();
-		CloseHandle(handle);
-		event_signal(work->done);
-		return;
+		stream->slots[i]->priority = priority;
 	}
+}
 
-	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+void fs_stream_write(fs_stream_t* stream, const void* data, size_t size)
+{
+	const char* src = data;
+	while (size)
+	{
+		if (!stream->use_compression && !stream->current)
+		{
+			stream->current = stream_acquire_slot(stream);
+		}
+
+		char* dst = stream->use_compression ? stream->blocks[stream->block_index] : stream->current->buffer;
+		size_t copy = __min(size, k_fs_stream_chunk_size - stream->block_used);
+		memcpy(dst + stream->block_used, src, copy);
+		stream->block_used += copy;
+		src += copy;
+		size -= copy;
+
+		if (stream->block_used == k_fs_stream_chunk_size)
+		{
+			stream_submit_write(stream);
+		}
+	}
+}
 
-	DWORD bytes_read = 0;
-	if (!ReadFile(handle, work->buffer, (DWORD)work->size, &bytes_read, NULL))
+fs_stream_t* fs_stream_open_read(fs_t* fs, const char* path, bool use_compression, fs_stream_callback_t callback, void* user)
+{
+	fs_stream_t* stream = stream_create(fs, path, true, use_compression);
+	if (!stream)
 	{
-		work->result = GetLastError();
-		CloseHandle(handle);
-		event_signal(work->done);
-		return;
+		return NULL;
 	}
 
-	work->size = bytes_read;
-	if (work->null_terminate)
+	stream->callback = callback;
+	stream->user = user;
+	light_event_init(&stream->done);
+	if (!GetFileSizeEx(stream->handle, (PLARGE_INTEGER)&stream->file_size))
 	{
-		((char*)work->buffer)[bytes_read] = 0;
+		stream->result = GetLastError();
+		stream->callback(stream->user, NULL, 0, stream->result);
+		light_event_signal(&stream->done);
+		return stream;
 	}
 
-	CloseHandle(handle);
+	if (use_compression)
+	{
+		for (int i = 0; i < _countof(stream->blocks); ++i)
+		{
+			stream->blocks[i] = heap_alloc(fs->heap, k_fs_stream_chunk_size, 8);
+		}
+		stream->staging = heap_alloc(fs->heap, k_fs_stream_staging_size, 8);
+		stream->lz4_decode = heap_alloc(fs->heap, sizeof(LZ4_streamDecode_t), 8);
+		LZ4_setStreamDecode(stream->lz4_decode, NULL, 0);
+	}
 
-	if (work->use_compression)
+	//fill every slot with read-ahead; later reads are issued by the file thread as chunks are delivered
+	//always issue at least one read so an empty file still reports its end
+	//set every slot up before queueing any, since completions update the same state
+	int count = 0;
+	while (count < k_fs_stream_slot_count && (count == 0 || stream->read_offset < stream->file_size))
 	{
-		//add the work to be decompressed
-		queue_push(fs->compression_queue, work);
+		stream_prepare_read(stream, stream->slots[count++]);
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		file_queue_push(fs, stream->slots[i]);
+	}
+	return stream;
+}
+
+int fs_stream_close(fs_stream_t* stream)
+{
+	if (!stream)
+	{
+		return -1;
+	}
+
+	fs_t* fs = stream->fs;
+	if (stream->is_read)
+	{
+		light_event_wait(&stream->done);
 	}
 	else
 	{
-		event_signal(work->done);
+		if (stream->block_used)
+		{
+			stream_submit_write(stream);
+		}
+		//every write has landed once all slots are free again
+		for (int i = 0; i < k_fs_stream_slot_count; ++i)
+		{
+			light_semaphore_acquire(&stream->free_slots);
+		}
+	}
+
+	CloseHandle(stream->handle);
+	for (int i = 0; i < k_fs_stream_slot_count; ++i)
+	{
+		heap_free(fs->heap, stream->slots[i]->buffer);
+		object_pool_free(fs->work_pool, stream->slots[i]);
+	}
+	for (int i = 0; i < _countof(stream->blocks); ++i)
+	{
+		heap_free(fs->heap, stream->blocks[i]);
 	}
+	heap_free(fs->heap, stream->staging);
+	heap_free(fs->heap, stream->lz4);
+	heap_free(fs->heap, stream->lz4_decode);
+
+	int result = stream->result;
+	heap_free(fs->heap, stream);
+	return result;
 }
 
-static void file_write(fs_work_t* work)
+bool fs_mount_pack(fs_t* fs, const char* path)
 {
 	wchar_t wide_path[1024];
-	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, wide_path, sizeof(wide_path)) <= 0)
+	if (fs->pack || MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
 	{
-		work->result = -1;
-		event_signal(work->done);
-		return;
+		return false;
 	}
 
-	HANDLE handle = CreateFile(wide_path, GENERIC_WRITE, FILE_SHARE_WRITE, NULL,
-		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
 	if (handle == INVALID_HANDLE_VALUE)
 	{
-		work->result = GetLastError();
-		event_signal(work->done);
-		return;
+		return false;
 	}
 
-	DWORD bytes_written = 0;
-	if (!WriteFile(handle, work->buffer, (DWORD)work->size, &bytes_written, NULL))
+	//the table of contents is read before the handle is tied to the completion port
+	fs_pack_header_t header;
+	if (!pack_read_sync(handle, 0, &header, sizeof(header)) ||
+		header.magic != k_fs_pack_magic ||
+		header.version != k_fs_pack_version ||
+		!header.table_size ||
+		(header.table_size & (header.table_size - 1)))
 	{
-		work->result = GetLastError();
 		CloseHandle(handle);
-		event_signal(work->done);
-		return;
+		return false;
 	}
-	work->size = bytes_written;
 
-	CloseHandle(handle);
+	size_t table_bytes = sizeof(fs_pack_entry_t) * header.table_size;
+	fs_pack_entry_t* table = heap_alloc(fs->heap, table_bytes, 8);
+	char* dictionary = header.dictionary_size ? heap_alloc(fs->heap, header.dictionary_size, 8) : NULL;
+	if (header.dictionary_size > k_fs_pack_dictionary_size ||
+		!pack_read_sync(handle, sizeof(header), table, table_bytes) ||
+		(dictionary && !pack_read_sync(handle, sizeof(header) + table_bytes, dictionary, header.dictionary_size)) ||
+		!CreateIoCompletionPort(handle, fs->completion_port, k_fs_key_io, 0))
+	{
+		heap_free(fs->heap, dictionary);
+		heap_free(fs->heap, table);
+		CloseHandle(handle);
+		return false;
+	}
 
-	event_signal(work->done);
+	fs_pack_t* pack = heap_alloc(fs->heap, sizeof(fs_pack_t), 8);
+	pack->handle = handle;
+	pack->table_mask = header.table_size - 1;
+	pack->table = table;
+	pack->dictionary = dictionary;
+	pack->dictionary_size = header.dictionary_size;
+	fs->pack = pack;
+	return true;
 }
 
-static int file_thread_func(void* user)
+int fs_pack_build(fs_t* fs, const char* pack_path, const char** paths, int count, bool use_compression, int compression_level)
 {
-	fs_t* fs = user;
-	while (true)
+	//keep the table at most half full so probes stay short
+	uint32_t table_size = 1;
+	while (table_size < (uint32_t)count * 2)
 	{
-		fs_work_t* work = queue_pop(fs->file_queue);
-		if (work == NULL)
+		table_size <<= 1;
+	}
+	size_t table_bytes = sizeof(fs_pack_entry_t) * table_size;
+	fs_pack_entry_t* table = heap_alloc(fs->heap, table_bytes, 8);
+	memset(table, 0, table_bytes);
+	void** data = heap_alloc(fs->heap, sizeof(void*) * (count + 1), 8);
+	size_t* sizes = heap_alloc(fs->heap, sizeof(size_t) * (count + 1), 8);
+	fs_pack_entry_t** entries = heap_alloc(fs->heap, sizeof(fs_pack_entry_t*) * (count + 1), 8);
+
+	//read every file first so the dictionary can be sampled from all of them
+	int result = 0;
+	int loaded = 0;
+	for (; loaded < count && !result; ++loaded)
+	{
+		//always read the loose file, even if a pack holding it is mounted
+		fs_work_t* work = work_create(fs, k_fs_work_op_read, paths[loaded], fs->heap);
+		file_queue_push(fs, work);
+		fs_work_wait(work);
+		result = work->result;
+		data[loaded] = work->buffer;
+		sizes[loaded] = work->size;
+		work->buffer = NULL;
+		fs_work_destroy(work);
+	}
+
+	char* dictionary = NULL;
+	uint32_t dictionary_size = 0;
+	LZ4F_CDict* cdict = NULL;
+	if (!result && use_compression)
+	{
+		dictionary = heap_alloc(fs->heap, k_fs_pack_dictionary_size, 8);
+		dictionary_size = (uint32_t)build_pack_dictionary((const void**)data, sizes, count, dictionary);
+		cdict = dictionary_size ? LZ4F_createCDict(dictionary, dictionary_size) : NULL;
+		if (!cdict)
 		{
-			break;
+			dictionary_size = 0;
 		}
-		
-		switch (work->op)
+	}
+
+	size_t offset = pack_align(sizeof(fs_pack_header_t) + table_bytes + dictionary_size);
+	for (int i = 0; i < count && !result; ++i)
+	{
+		size_t size = sizes[i];
+		uint64_t content_hash = XXH64(data[i], size, 0);
+		fs_work_t work = { .fs = fs, .buffer = data[i], .size = size };
+		work.compression_level = __min(compression_level, k_fs_compression_max);
+
+		bool compressed = false;
+		if (use_compression && size)
 		{
-		case k_fs_work_op_read:
-			file_read(fs, work);
-			break;
-		case k_fs_work_op_write:
-			file_write(work);
-			break;
+			//keep the compressed copy only if it saves space
+			compressed = compress_work(fs, &work, cdict) == 0 && work.size < size;
+			if (compressed)
+			{
+				heap_free(fs->heap, data[i]);
+				work.source_buffer = NULL;
+				data[i] = work.buffer;
+			}
+			else
+			{
+				release_compressed(&work);
+			}
+		}
+
+		uint64_t hash = hash_pack_path(paths[i]);
+		fs_pack_entry_t* entry = &table[hash & (table_size - 1)];
+		while (!result && (entry->flags & k_fs_pack_entry_used))
+		{
+			if (entry->path_hash == hash)
+			{
+				debug_print(k_print_error, "fs pack: %s is listed twice or collides with another path!\n", paths[i]);
+				result = -1;
+			}
+			entry = &table[(entry - table + 1) & (table_size - 1)];
+		}
+
+		if (!result)
+		{
+			entry->path_hash = hash;
+			entry->offset = offset;
+			entry->stored_size = compressed ? work.size : size;
+			entry->size = size;
+			entry->content_hash = content_hash;
+			entry->flags = k_fs_pack_entry_used;
+			entry->flags |= compressed ? k_fs_pack_entry_compressed : 0;
+			entry->flags |= compressed && cdict ? k_fs_pack_entry_dictionary : 0;
+			entries[i] = entry;
+			offset = pack_align(offset + (size_t)entry->stored_size);
 		}
 	}
-	return 0;
+	if (cdict)
+	{
+		LZ4F_freeCDict(cdict);
+	}
+
+	fs_stream_t* stream = result ? NULL : fs_stream_open_write(fs, pack_path, false);
+	if (stream)
+	{
+		static const char k_padding[k_fs_pack_alignment] = { 0 };
+		fs_pack_header_t header = { k_fs_pack_magic, k_fs_pack_version, table_size, (uint32_t)count, dictionary_size };
+		fs_stream_write(stream, &header, sizeof(header));
+		fs_stream_write(stream, table, table_bytes);
+		fs_stream_write(stream, dictionary, dictionary_size);
+		offset = sizeof(header) + table_bytes + dictionary_size;
+		for (int i = 0; i < count; ++i)
+		{
+			fs_stream_write(stream, k_padding, (size_t)entries[i]->offset - offset);
+			fs_stream_write(stream, data[i], (size_t)entries[i]->stored_size);
+			offset = (size_t)(entries[i]->offset + entries[i]->stored_size);
+		}
+		result = fs_stream_close(stream);
+	}
+	else if (!result)
+	{
+		result = -1;
+	}
+
+	for (int i = 0; i < loaded; ++i)
+	{
+		heap_free(fs->heap, data[i]);
+	}
+	heap_free(fs->heap, dictionary);
+	heap_free(fs->heap, entries);
+	heap_free(fs->heap, sizes);
+	heap_free(fs->heap, data);
+	heap_free(fs->heap, table);
+	return result;
 }
 
-static int compression_thread_func(void* user)
+static void file_queue_push(fs_t* fs, fs_work_t* work)
 {
-	fs_t* fs = user;
-	while (true)
+	queue_push(fs->file_queues[work->priority], work);
+	PostQueuedCompletionStatus(fs->completion_port, 0, k_fs_key_submit, NULL);
+}
+
+// Free the compressed copy of a write and give the caller's buffer back.
+static void release_compressed(fs_work_t* work)
+{
+	if (work->source_buffer)
 	{
-		fs_work_t* work = queue_pop(fs->compression_queue);
-		if (work == NULL)
+		heap_free(work->fs->heap, work->buffer);
+		work->buffer = (void*)work->source_buffer;
+		work->source_buffer = NULL;
+	}
+}
+
+static void file_fail(fs_work_t* work, int result)
+{
+	if (work->handle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(work->handle);
+		work->handle = INVALID_HANDLE_VALUE;
+		if (work->write_sequence)
 		{
-			break;
+			DeleteFile(work->wide_temp_path);
 		}
-		//the char* that stores the compressed text or the decompressed text
-		char* dest;
-		
-		int destination_size;
-		switch (work->op)
+	}
+	release_compressed(work);
+	work->result = result;
+	work_finish(work);
+}
+
+// Map a whole file into memory read-only.
+// Pages are read in on first touch, so this finishes without waiting on the disk.
+static void file_map(fs_work_t* work, const wchar_t* wide_path)
+{
+	HANDLE handle = CreateFile(wide_path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		file_fail(work, GetLastError());
+		return;
+	}
+
+	if (!GetFileSizeEx(handle, (PLARGE_INTEGER)&work->size))
+	{
+		int result = GetLastError();
+		CloseHandle(handle);
+		file_fail(work, result);
+		return;
+	}
+
+	//empty files cannot be mapped; leave the buffer NULL
+	if (work->size)
+	{
+		//the view keeps the file open, so both handles can be closed right away
+		HANDLE mapping = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
 		{
-		case k_fs_work_op_read:
-			//read the size of the uncompressed buffer from the first 4 bytes of the buffer
-			memcpy(&destination_size, (int*)work->buffer, 1);
-			//allocate enough space to store the uncompressed buffer
-			dest = heap_alloc(fs->heap, destination_size, 8);
-			//decompress the buffer to dest
-			work->size = LZ4_decompress_safe(((char*)work->buffer)+4, dest, ((int)work->size - 4), destination_size);
-			//replace buffer with dest
-			heap_free(fs->heap, work->buffer);
-			work->buffer = dest;
-			if (work->null_terminate)
-			{
-				((char*)work->buffer)[work->size] = 0;
-			}
-			//signal that the work is complete
-			event_signal(work->done);
-			break;
-		case k_fs_work_op_write:
-			//determine the size of the compressed file
-			destination_size = LZ4_compressBound((int)work->size);
-			//allocate enough space to store the compressed file and an extra 4 bytes for the uncompressed size
-			dest = heap_alloc(fs->heap, destination_size + 4, 8);
-			//write to the first 4 bytes of dest, the uncompressed size
-			dest[0] = (char)work->size;
-			//compress buffer, writing to dest ignoring the first 4 bytes as to not overwrite 
-			//the size account for int storage overhead
-			work->size = LZ4_compress_default(work->buffer, (char*)dest+4, (int)work->size, destination_size) + 4;
-			//replace the uncompressed text with the compressed text
-			heap_free(fs->heap, work->buffer);
-			work->buffer = dest;
-			//add the work to the queue to be written
-			queue_push(fs->file_queue, work);
-			break;
+			work->buffer = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+		if (!work->buffer)
+		{
+			work->result = GetLastError();
 		}
 	}
-	return 0;
+	CloseHandle(handle);
+	work_finish(work);
+}
+
+// Open the file and issue an overlapped read or write for it.
+// Returns true if a completion packet will arrive for the work.
+static bool file_issue(fs_t* fs, fs_work_t* work)
+{
+	if (work->stream)
+	{
+		return stream_issue(work);
+	}
+
+	trace_flow_step(trace_get_default(), "File Issue", work->flow);
+	work->handle = INVALID_HANDLE_VALUE;
+
+	if (work->pack_entry)
+	{
+		return pack_issue(fs, work);
+	}
+
+	if (work->write_sequence && !write_begin(fs, work))
+	{
+		//a newer write to the same path was queued behind this one and carries the latest data
+		release_compressed(work);
+		work_finish(work);
+		return false;
+	}
+
+	if (MultiByteToWideChar(CP_UTF8, 0, work->path, -1, work->wide_path, (int)work->path_length) <= 0)
+	{
+		file_fail(work, -1);
+		return false;
+	}
+
+	if (work->op == k_fs_work_op_map)
+	{
+		file_map(work, work->wide_path);
+		return false;
+	}
+
+	//writes go to a temporary file, written through to the disk, and are moved over the path once complete,
+	//so a crash mid-write leaves the old file rather than a torn one
+	bool is_read = work->op == k_fs_work_op_read;
+	if (!is_read)
+	{
+		swprintf_s(work->wide_temp_path, work->path_length + k_fs_write_temp_suffix_size, L"%s.%llu.tmp",
+			work->wide_path, (unsigned long long)work->write_sequence);
+	}
+	work->handle = CreateFile(is_read ? work->wide_path : work->wide_temp_path,
+		is_read ? GENERIC_READ : GENERIC_WRITE,
+		is_read ? FILE_SHARE_READ : FILE_SHARE_WRITE,
+		NULL,
+		is_read ? OPEN_EXISTING : CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | (is_read ? 0 : FILE_FLAG_WRITE_THROUGH),
+		NULL);
+	if (work->handle == INVALID_HANDLE_VALUE)
+	{
+		file_fail(work, GetLastError());
+		return false;
+	}
+
+	if (!CreateIoCompletionPort(work->handle, fs->completion_port, k_fs_key_io, 0))
+	{
+		file_fail(work, GetLastError());
+		return false;
+	}
+
+	if (is_read)
+	{
+		if (!GetFileSizeEx(work->handle, (PLARGE_INTEGER)&work->size))
+		{
+			file_fail(work, GetLastError());
+			return false;
+		}
+		work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+	}
+
+	//even when the call completes immediately, a completion packet is still queued
+	memset(&work->overlapped, 0, sizeof(work->overlapped));
+	BOOL issued = is_read ?
+		ReadFile(work->handle, work->buffer, (DWORD)work->size, NULL, &work->overlapped) :
+		WriteFile(work->handle, work->buffer, (DWORD)work->size, NULL, &work->overlapped);
+	if (!issued && GetLastError() != ERROR_IO_PENDING)
+	{
+		file_fail(work, GetLastError());
+		return false;
+	}
+	return true;
+}
+
+// Finish a read or write whose completion packet arrived.
+static void file_complete(fs_t* fs, fs_work_t* work, DWORD bytes, int result)
+{
+	if (result)
+	{
+		file_fail(work, result);
+		return;
+	}
+
+	//packed reads share the pack's handle
+	if (work->handle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(work->handle);
+		work->handle = INVALID_HANDLE_VALUE;
+	}
+	work->size = bytes;
+
+	if (work->write_sequence)
+	{
+		write_commit(fs, work);
+	}
+
+	if (work->op == k_fs_work_op_read)
+	{
+		frame_stats_add(frame_stats_get_default(), k_frame_stat_fs_bytes_read, bytes);
+		if (work->null_terminate)
+		{
+			((char*)work->buffer)[bytes] = 0;
+		}
+		if (work->use_compression)
+		{
+			//add the work to be decompressed
+			queue_push(fs->compression_queue, work);
+			return;
+		}
+		read_hash(work);
+	}
+	release_compressed(work);
+	work_finish(work);
+}
+
+static bool work_is_cancelled(fs_work_t* work)
+{
+	return !work->stream && atomic_load(&work->cancelled);
+}
+
+// Take the most urgent queued work that may be issued now.
+static fs_work_t* file_queue_pop(fs_t* fs)
+{
+	//background work gets at most half the slots, so urgent reads never wait behind a full queue of it
+	int background_limit = __max(fs->max_in_flight / 2, 1);
+	for (int i = 0; i < k_fs_priority_count; ++i)
+	{
+		if (i == k_fs_priority_background && fs->in_flight >= background_limit)
+		{
+			break;
+		}
+		fs_work_t* work = queue_try_pop(fs->file_queues[i]);
+		if (work)
+		{
+			return work;
+		}
+	}
+	return NULL;
+}
+
+static void issued_link(fs_t* fs, fs_work_t* work)
+{
+	work->issued_prev = NULL;
+	work->issued_next = fs->issued;
+	if (fs->issued)
+	{
+		fs->issued->issued_prev = work;
+	}
+	fs->issued = work;
+}
+
+static void issued_unlink(fs_t* fs, fs_work_t* work)
+{
+	if (work->issued_prev)
+	{
+		work->issued_prev->issued_next = work->issued_next;
+	}
+	else
+	{
+		fs->issued = work->issued_next;
+	}
+	if (work->issued_next)
+	{
+		work->issued_next->issued_prev = work->issued_prev;
+	}
+}
+
+// Ask the OS to abort cancelled reads and writes in flight; they complete with ERROR_OPERATION_ABORTED.
+static void issued_cancel(fs_t* fs)
+{
+	for (fs_work_t* work = fs->issued; work; work = work->issued_next)
+	{
+		if (work_is_cancelled(work))
+		{
+			CancelIoEx(work->pack_entry ? fs->pack->handle : work->handle, &work->overlapped);
+		}
+	}
+}
+
+static int file_thread_func(void* user)
+{
+	fs_t* fs = user;
+	bool quit = false;
+
+	//keep up to max_in_flight operations issued so the drive sees queue depth,
+	//and exit once asked to with nothing left outstanding
+	while (!quit || fs->in_flight > 0)
+	{
+		while (fs->in_flight < fs->max_in_flight)
+		{
+			fs_work_t* work = file_queue_pop(fs);
+			if (!work)
+			{
+				break;
+			}
+			if (work_is_cancelled(work))
+			{
+				file_fail(work, ERROR_OPERATION_ABORTED);
+				continue;
+			}
+			TRACE_ZONE_BEGIN(k_trace_category_fs, "File Issue");
+			bool issued = file_issue(fs, work);
+			TRACE_ZONE_END(k_trace_category_fs);
+			if (issued)
+			{
+				fs->in_flight++;
+				if (!work->stream)
+				{
+					issued_link(fs, work);
+				}
+			}
+		}
+		trace_counter(trace_get_default(), "FS In Flight", fs->in_flight);
+
+		if (quit && fs->in_flight == 0)
+		{
+			break;
+		}
+
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED* overlapped = NULL;
+		BOOL succeeded = GetQueuedCompletionStatus(fs->completion_port, &bytes, &key, &overlapped, INFINITE);
+		if (!overlapped)
+		{
+			if (succeeded && key == k_fs_key_quit)
+			{
+				quit = true;
+			}
+			else if (succeeded && key == k_fs_key_cancel)
+			{
+				issued_cancel(fs);
+			}
+			continue;
+		}
+
+		int result = succeeded ? 0 : GetLastError();
+		fs_work_t* work = CONTAINING_RECORD(overlapped, fs_work_t, overlapped);
+		fs->in_flight--;
+		TRACE_ZONE_BEGIN(k_trace_category_fs, "File Complete");
+		if (work->stream)
+		{
+			stream_complete(work, bytes, result);
+		}
+		else
+		{
+			issued_unlink(fs, work);
+			file_complete(fs, work, bytes, result);
+		}
+		TRACE_ZONE_END(k_trace_category_fs);
+	}
+	return 0;
+}
+
+static fs_stream_t* stream_create(fs_t* fs, const char* path, bool is_read, bool use_compression)
+{
+	wchar_t wide_path[1024];
+	if (MultiByteToWideChar(CP_UTF8, 0, path, -1, wide_path, _countof(wide_path)) <= 0)
+	{
+		return NULL;
+	}
+
+	HANDLE handle = CreateFile(wide_path,
+		is_read ? GENERIC_READ : GENERIC_WRITE,
+		is_read ? FILE_SHARE_READ : FILE_SHARE_WRITE,
+		NULL,
+		is_read ? OPEN_EXISTING : CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+		NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+	if (!CreateIoCompletionPort(handle, fs->completion_port, k_fs_key_io, 0))
+	{
+		CloseHandle(handle);
+		return NULL;
+	}
+
+	fs_stream_t* stream = heap_alloc(fs->heap, sizeof(fs_stream_t), 8);
+	memset(stream, 0, sizeof(*stream));
+	stream->fs = fs;
+	stream->handle = handle;
+	stream->is_read = is_read;
+	stream->use_compression = use_compression;
+
+	//compressed writes need room for a size prefix and LZ4's worst case
+	size_t slot_size = use_compression && !is_read ? k_fs_stream_staging_size : k_fs_stream_chunk_size;
+	for (int i = 0; i < k_fs_stream_slot_count; ++i)
+	{
+		fs_work_t* slot = object_pool_alloc(fs->work_pool);
+		memset(slot, 0, sizeof(*slot));
+		slot->fs = fs;
+		slot->heap = fs->heap;
+		slot->op = is_read ? k_fs_work_op_read : k_fs_work_op_write;
+		slot->stream = stream;
+		slot->priority = k_fs_priority_normal;
+		slot->handle = handle;
+		slot->buffer = heap_alloc(fs->heap, slot_size, 8);
+		stream->slots[i] = slot;
+	}
+	return stream;
+}
+
+static void stream_fail(fs_stream_t* stream, int result)
+{
+	atomic_compare_and_exchange(&stream->result, 0, result);
+}
+
+// Wait for a write slot whose previous write has landed.
+static fs_work_t* stream_acquire_slot(fs_stream_t* stream)
+{
+	light_semaphore_acquire(&stream->free_slots);
+	for (int i = 0; i < k_fs_stream_slot_count; ++i)
+	{
+		fs_work_t* slot = stream->slots[i];
+		if (atomic_compare_and_exchange(&slot->busy, 0, 1) == 0)
+		{
+			return slot;
+		}
+	}
+	debug_print(k_print_error, "fs stream: no free slot after acquire!\n");
+	return NULL;
+}
+
+// Queue the filled chunk for writing at the end of the file.
+static void stream_submit_write(fs_stream_t* stream)
+{
+	fs_work_t* slot;
+	if (stream->use_compression)
+	{
+		//each chunk is one LZ4 block that may refer back into the previous chunk
+		slot = stream_acquire_slot(stream);
+		char* dst = slot->buffer;
+		int compressed = LZ4_compress_fast_continue(stream->lz4, stream->blocks[stream->block_index], dst + 4,
+			(int)stream->block_used, k_fs_stream_staging_size - 4, 1);
+		if (compressed <= 0)
+		{
+			stream_fail(stream, -1);
+			compressed = 0;
+		}
+		memcpy(dst, &compressed, 4);
+		slot->size = (size_t)compressed + 4;
+		stream->block_index ^= 1;
+	}
+	else
+	{
+		slot = stream->current;
+		slot->size = stream->block_used;
+		stream->current = NULL;
+	}
+	stream->block_used = 0;
+
+	slot->offset = stream->write_offset;
+	stream->write_offset += slot->size;
+	file_queue_push(stream->fs, slot);
+}
+
+// Set a slot up to read the next chunk of the file.
+static void stream_prepare_read(fs_stream_t* stream, fs_work_t* slot)
+{
+	slot->offset = stream->read_offset;
+	slot->size = (size_t)__min(stream->file_size - stream->read_offset, (uint64_t)k_fs_stream_chunk_size);
+	slot->sequence = stream->next_sequence++;
+	slot->busy = 1;
+	stream->read_offset += slot->size;
+	stream->in_flight++;
+}
+
+// Issue an overlapped read or write of a stream slot at its file offset.
+// Returns true if a completion packet will arrive for the slot.
+static bool stream_issue(fs_work_t* slot)
+{
+	memset(&slot->overlapped, 0, sizeof(slot->overlapped));
+	slot->overlapped.Offset = (DWORD)slot->offset;
+	slot->overlapped.OffsetHigh = (DWORD)(slot->offset >> 32);
+	BOOL issued = slot->stream->is_read ?
+		ReadFile(slot->handle, slot->buffer, (DWORD)slot->size, NULL, &slot->overlapped) :
+		WriteFile(slot->handle, slot->buffer, (DWORD)slot->size, NULL, &slot->overlapped);
+	if (!issued && GetLastError() != ERROR_IO_PENDING)
+	{
+		stream_complete(slot, 0, GetLastError());
+		return false;
+	}
+	return true;
+}
+
+// Decompress every whole block in the staging buffer and hand it to the callback.
+static void stream_decode(fs_stream_t* stream)
+{
+	size_t offset = 0;
+	while (!stream->result && stream->staging_used - offset >= 4)
+	{
+		int compressed;
+		memcpy(&compressed, stream->staging + offset, 4);
+		if (compressed < 0 || compressed > k_fs_stream_staging_size - 4)
+		{
+			stream_fail(stream, -1);
+			break;
+		}
+		if (stream->staging_used - offset < (size_t)compressed + 4)
+		{
+			break;
+		}
+
+		char* dst = stream->blocks[stream->block_index];
+		int size = LZ4_decompress_safe_continue(stream->lz4_decode, stream->staging + offset + 4, dst, compressed, k_fs_stream_chunk_size);
+		if (size < 0)
+		{
+			stream_fail(stream, -1);
+			break;
+		}
+		stream->callback(stream->user, dst, size, 0);
+		stream->block_index ^= 1;
+		offset += (size_t)compressed + 4;
+	}
+	memmove(stream->staging, stream->staging + offset, stream->staging_used - offset);
+	stream->staging_used -= offset;
+}
+
+// Hand a chunk read from disk to the stream's consumer.
+static void stream_deliver(fs_stream_t* stream, const char* data, size_t size)
+{
+	if (!stream->use_compression)
+	{
+		stream->callback(stream->user, data, size, 0);
+		return;
+	}
+
+	//blocks can straddle chunks, so gather bytes until whole blocks are available
+	while (size && !stream->result)
+	{
+		size_t copy = __min(size, k_fs_stream_staging_size - stream->staging_used);
+		memcpy(stream->staging + stream->staging_used, data, copy);
+		stream->staging_used += copy;
+		data += copy;
+		size -= copy;
+		stream_decode(stream);
+	}
+}
+
+// Called on the file thread when a stream read or write finishes.
+static void stream_complete(fs_work_t* slot, DWORD bytes, int result)
+{
+	fs_stream_t* stream = slot->stream;
+	if (result && result != ERROR_HANDLE_EOF)
+	{
+		stream_fail(stream, result);
+	}
+
+	if (!stream->is_read)
+	{
+		atomic_store(&slot->busy, 0);
+		light_semaphore_release(&stream->free_slots);
+		return;
+	}
+
+	//reads can complete out of order; deliver them in file order
+	slot->size = bytes;
+	slot->busy = 2;
+	stream->in_flight--;
+	bool delivered = true;
+	while (delivered)
+	{
+		delivered = false;
+		for (int i = 0; i < k_fs_stream_slot_count; ++i)
+		{
+			fs_work_t* ready = stream->slots[i];
+			if (ready->busy == 2 && ready->sequence == stream->next_deliver)
+			{
+				if (!stream->result)
+				{
+					stream_deliver(stream, ready->buffer, ready->size);
+				}
+				ready->busy = 0;
+				stream->next_deliver++;
+				if (!stream->result && stream->read_offset < stream->file_size)
+				{
+					//already on the file thread, so issue directly rather than through the file queue
+					stream_prepare_read(stream, ready);
+					if (stream_issue(ready))
+					{
+						stream->fs->in_flight++;
+					}
+				}
+				delivered = true;
+			}
+		}
+	}
+
+	if (stream->in_flight == 0)
+	{
+		if (!stream->result && stream->use_compression && stream->staging_used)
+		{
+			//the file ended partway through a block
+			stream_fail(stream, -1);
+		}
+		stream->callback(stream->user, NULL, 0, stream->result);
+		light_event_signal(&stream->done);
+	}
+}
+
+// Compressed files are a sequence of independent LZ4 frames, one per chunk, so chunks
+// can be compressed and decompressed in parallel. They are preceded by a skippable
+// frame holding the chunk table; standard LZ4 tools ignore it and still decode the file.
+enum
+{
+	k_fs_lz4_chunk_size = 4 * 1024 * 1024,
+	k_fs_lz4_index_magic = 0x184D2A5A, //LZ4 skippable frame magic, low nibble chosen by us
+};
+
+// Body of the skippable index frame, followed by a uint32_t compressed size per chunk.
+typedef struct fs_lz4_index_t
+{
+	uint64_t content_size;
+	uint32_t chunk_size;
+	uint32_t chunk_count;
+} fs_lz4_index_t;
+
+// One chunk of a compressed file, handled by one job.
+typedef struct fs_lz4_chunk_t
+{
+	const char* src;
+	size_t src_size;
+	char* dst;
+	size_t dst_capacity;
+	int level; //of compression
+	const LZ4F_CDict* cdict; //compress against this dictionary, or NULL
+	const char* dictionary; //decompress against this dictionary, or NULL
+	size_t dictionary_size;
+	size_t result; //compressed or decompressed size, or an LZ4F error code
+} fs_lz4_chunk_t;
+
+// Frame preferences for a chunk; levels of LZ4HC_CLEVEL_MIN and up compress it with LZ4HC.
+static LZ4F_preferences_t get_chunk_prefs(size_t size, int level)
+{
+	LZ4F_preferences_t prefs = { 0 };
+	prefs.compressionLevel = level;
+	prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+	prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+	prefs.frameInfo.contentSize = size;
+	return prefs;
+}
+
+static void compress_chunk(void* user)
+{
+	fs_lz4_chunk_t* chunk = user;
+	LZ4F_preferences_t prefs = get_chunk_prefs(chunk->src_size, chunk->level);
+	if (!chunk->cdict)
+	{
+		chunk->result = LZ4F_compressFrame(chunk->dst, chunk->dst_capacity, chunk->src, chunk->src_size, &prefs);
+		return;
+	}
+
+	LZ4F_cctx* context = NULL;
+	chunk->result = LZ4F_createCompressionContext(&context, LZ4F_VERSION);
+	if (!LZ4F_isError(chunk->result))
+	{
+		chunk->result = LZ4F_compressFrame_usingCDict(context, chunk->dst, chunk->dst_capacity, chunk->src, chunk->src_size, chunk->cdict, &prefs);
+	}
+	LZ4F_freeCompressionContext(context);
+}
+
+static void decompress_chunk(void* user)
+{
+	fs_lz4_chunk_t* chunk = user;
+	LZ4F_dctx* context = NULL;
+	chunk->result = LZ4F_createDecompressionContext(&context, LZ4F_VERSION);
+	if (LZ4F_isError(chunk->result))
+	{
+		return;
+	}
+
+	size_t src_offset = 0;
+	size_t dst_offset = 0;
+	size_t hint = 1;
+	while (hint && src_offset < chunk->src_size && !LZ4F_isError(hint))
+	{
+		size_t src_size = chunk->src_size - src_offset;
+		size_t dst_size = chunk->dst_capacity - dst_offset;
+		hint = LZ4F_decompress_usingDict(context, chunk->dst + dst_offset, &dst_size, chunk->src + src_offset, &src_size,
+			chunk->dictionary, chunk->dictionary_size, NULL);
+		src_offset += src_size;
+		dst_offset += dst_size;
+		if (!src_size && !dst_size)
+		{
+			//output is full but the frame is not done: the chunk is bigger than the index says
+			break;
+		}
+	}
+	chunk->result = LZ4F_isError(hint) ? hint : dst_offset;
+	LZ4F_freeDecompressionContext(context);
+}
+
+// Run function on every chunk, on the job system if there is one.
+static void run_chunks(fs_t* fs, fs_lz4_chunk_t* chunks, int count, job_function_t function)
+{
+	if (!fs->jobs || count < 2)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			function(&chunks[i]);
+		}
+		return;
+	}
+
+	job_counter_t counter = { 0 };
+	for (int i = 0; i < count; ++i)
+	{
+		job_run(fs->jobs, function, &chunks[i], &counter);
+	}
+	job_wait(fs->jobs, &counter);
+}
+
+// Compress a work's buffer into the chunked LZ4 format, against a dictionary if it is not NULL.
+static int compress_work(fs_t* fs, fs_work_t* work, const LZ4F_CDict* dictionary)
+{
+	int count = (int)((work->size + k_fs_lz4_chunk_size - 1) / k_fs_lz4_chunk_size);
+	fs_lz4_chunk_t* chunks = heap_alloc(fs->heap, sizeof(fs_lz4_chunk_t) * (count + 1), 8);
+	memset(chunks, 0, sizeof(fs_lz4_chunk_t) * (count + 1));
+
+	//compress each chunk into its own slice of one buffer, after the index
+	size_t index_size = 8 + sizeof(fs_lz4_index_t) + sizeof(uint32_t) * count;
+	size_t capacity = index_size;
+	for (int i = 0; i < count; ++i)
+	{
+		chunks[i].src = (const char*)work->buffer + (size_t)i * k_fs_lz4_chunk_size;
+		chunks[i].src_size = __min(work->size - (size_t)i * k_fs_lz4_chunk_size, (size_t)k_fs_lz4_chunk_size);
+		chunks[i].level = work->compression_level;
+		chunks[i].cdict = dictionary;
+		LZ4F_preferences_t prefs = get_chunk_prefs(chunks[i].src_size, chunks[i].level);
+		chunks[i].dst_capacity = LZ4F_compressFrameBound(chunks[i].src_size, &prefs);
+		capacity += chunks[i].dst_capacity;
+	}
+	char* dst = heap_alloc(fs->heap, capacity, 8);
+	size_t offset = index_size;
+	for (int i = 0; i < count; ++i)
+	{
+		chunks[i].dst = dst + offset;
+		offset += chunks[i].dst_capacity;
+	}
+
+	run_chunks(fs, chunks, count, compress_chunk);
+
+	//pack the compressed chunks together behind the index
+	uint32_t* header = (uint32_t*)dst;
+	header[0] = k_fs_lz4_index_magic;
+	header[1] = (uint32_t)(index_size - 8);
+	fs_lz4_index_t* index = (fs_lz4_index_t*)(header + 2);
+	index->content_size = work->size;
+	index->chunk_size = k_fs_lz4_chunk_size;
+	index->chunk_count = count;
+	uint32_t* sizes = (uint32_t*)(index + 1);
+	offset = index_size;
+	int result = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		if (LZ4F_isError(chunks[i].result))
+		{
+			result = -1;
+			break;
+		}
+		sizes[i] = (uint32_t)chunks[i].result;
+		memmove(dst + offset, chunks[i].dst, chunks[i].result);
+		offset += chunks[i].result;
+	}
+	heap_free(fs->heap, chunks);
+
+	if (result)
+	{
+		heap_free(fs->heap, dst);
+		return result;
+	}
+
+	//the caller still owns its buffer; the compressed copy is freed once written
+	work->source_buffer = work->buffer;
+	work->buffer = dst;
+	work->size = offset;
+	return 0;
+}
+
+static int decompress_work(fs_t* fs, fs_work_t* work)
+{
+	const char* src = work->buffer;
+	const uint32_t* header = (const uint32_t*)src;
+	if (work->size < 8 + sizeof(fs_lz4_index_t) || header[0] != k_fs_lz4_index_magic)
+	{
+		return -1;
+	}
+	const fs_lz4_index_t* index = (const fs_lz4_index_t*)(header + 2);
+	const uint32_t* sizes = (const uint32_t*)(index + 1);
+
+	//each chunk decodes into its own slice of the content, so the header must agree with itself and the file
+	uint64_t chunk_size = index->chunk_size;
+	if (!chunk_size ||
+		index->chunk_count != index->content_size / chunk_size + (index->content_size % chunk_size != 0) ||
+		(work->size - 8 - sizeof(fs_lz4_index_t)) / sizeof(uint32_t) < index->chunk_count)
+	{
+		return -1;
+	}
+	size_t offset = 8 + (size_t)header[1];
+	int count = (int)index->chunk_count;
+	if (offset > work->size || offset < 8 + sizeof(fs_lz4_index_t) + sizeof(uint32_t) * count)
+	{
+		return -1;
+	}
+
+	//packed files may be compressed against the pack's dictionary
+	const fs_pack_t* pack = fs->pack;
+	bool use_dictionary = work->pack_entry && (work->pack_entry->flags & k_fs_pack_entry_dictionary);
+	if (use_dictionary && (!pack || !pack->dictionary))
+	{
+		return -1;
+	}
+
+	size_t content_size = (size_t)index->content_size;
+	char* dst = heap_alloc(work->heap, work->null_terminate ? content_size + 1 : content_size, 8);
+	fs_lz4_chunk_t* chunks = heap_alloc(fs->heap, sizeof(fs_lz4_chunk_t) * (count + 1), 8);
+	memset(chunks, 0, sizeof(fs_lz4_chunk_t) * (count + 1));
+	for (int i = 0; i < count; ++i)
+	{
+		if (use_dictionary)
+		{
+			chunks[i].dictionary = pack->dictionary;
+			chunks[i].dictionary_size = pack->dictionary_size;
+		}
+		chunks[i].src = src + offset;
+		chunks[i].src_size = sizes[i];
+		chunks[i].dst = dst + (size_t)i * index->chunk_size;
+		chunks[i].dst_capacity = __min(content_size - (size_t)i * index->chunk_size, (size_t)index->chunk_size);
+		offset += sizes[i];
+	}
+
+	int result = offset <= work->size ? 0 : -1;
+	if (!result)
+	{
+		run_chunks(fs, chunks, count, decompress_chunk);
+		for (int i = 0; i < count && !result; ++i)
+		{
+			result = chunks[i].result == chunks[i].dst_capacity ? 0 : -1;
+		}
+	}
+	heap_free(fs->heap, chunks);
+
+	if (result)
+	{
+		heap_free(work->heap, dst);
+		return result;
+	}
+
+	heap_free(work->heap, work->buffer);
+	work->buffer = dst;
+	work->size = content_size;
+	if (work->null_terminate)
+	{
+		dst[content_size] = 0;
+	}
+	return 0;
+}
+
+static int compression_thread_func(void* user)
+{
+	fs_t* fs = user;
+	while (true)
+	{
+		fs_work_t* work = queue_pop(fs->compression_queue);
+		if (work == NULL)
+		{
+			break;
+		}
+
+		TRACE_ZONE_BEGIN(k_trace_category_fs, work->op == k_fs_work_op_read ? "Decompress" : "Compress");
+		trace_flow_step(trace_get_default(), "Compression", work->flow);
+		if (work_is_cancelled(work))
+		{
+			if (work->op == k_fs_work_op_read)
+			{
+				heap_free(work->heap, work->buffer);
+				work->buffer = NULL;
+				work->size = 0;
+			}
+			work->result = ERROR_OPERATION_ABORTED;
+			work_finish(work);
+			TRACE_ZONE_END(k_trace_category_fs);
+			continue;
+		}
+
+		switch (work->op)
+		{
+		case k_fs_work_op_read:
+			work->result = decompress_work(fs, work);
+			if (!work->result)
+			{
+				read_hash(work);
+			}
+			work_finish(work);
+			break;
+		case k_fs_work_op_write:
+			if (atomic_load(&work->superseded))
+			{
+				//the file thread drops it; no need to compress data that won't be written
+				file_queue_push(fs, work);
+				break;
+			}
+			work->result = compress_work(fs, work, NULL);
+			if (work->result)
+			{
+				work_finish(work);
+			}
+			else
+			{
+				//add the work to the queue to be written
+				file_queue_push(fs, work);
+			}
+			break;
+		}
+		TRACE_ZONE_END(k_trace_category_fs);
+	}
+	return 0;
+}
+
+static uint32_t hash_path(const char* path)
+{
+	//fnv-1a
+	uint32_t hash = 2166136261u;
+	for (const char* c = path; *c; ++c)
+	{
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+	}
+	return hash;
+}
+
+static bool get_write_time(const char* path, FILETIME* time)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+	{
+		return false;
+	}
+	*time = data.ftLastWriteTime;
+	return true;
+}
+
+static fs_work_t* cache_acquire(fs_t* fs, const char* path, bool null_terminate)
+{
+	uint32_t hash = hash_path(path);
+
+	//a packed file is checked against the hash in the pack's table instead of the loose file's write time,
+	//which saves asking the OS on every hit
+	const fs_pack_entry_t* entry = pack_find(fs, path);
+	FILETIME write_time = { 0 };
+	if (!entry)
+	{
+		get_write_time(path, &write_time);
+	}
+
+	fs_work_t** link = &fs->cache;
+	while (*link)
+	{
+		fs_work_t* work = *link;
+		if (work->path_hash != hash || work->null_terminate != null_terminate || strcmp(work->path, path) != 0)
+		{
+			link = &work->cache_next;
+			continue;
+		}
+
+		//a read still in flight is shared as is; a finished one must still match the file on disk
+		bool stale = work_is_done(work) &&
+			(work->result != 0 ||
+			(entry ? work->content_hash != entry->content_hash : CompareFileTime(&work->write_time, &write_time) != 0));
+		if (!stale)
+		{
+			++work->refcount;
+			return work;
+		}
+
+		*link = work->cache_next;
+		if (--work->refcount == 0)
+		{
+			work_free(work);
+		}
+		break;
+	}
+
+	fs_work_options_t options = { .compute_hash = true };
+	fs_work_t* work = fs_read_with_options(fs, path, fs->heap, null_terminate, false, &options);
+	work->cached = true;
+	work->owns_buffer = true;
+	work->refcount = 2; //one for the cache, one for the caller
+	work->path_hash = hash;
+	work->write_time = write_time;
+	work->cache_next = fs->cache;
+	fs->cache = work;
+
+	cache_evict(fs);
+	return work;
+}
+
+static void cache_evict(fs_t* fs)
+{
+	size_t total = 0;
+	for (fs_work_t* work = fs->cache; work; work = work->cache_next)
+	{
+		if (work_is_done(work))
+		{
+			total += work->size;
+		}
+	}
+
+	//oldest entries sit at the end of the list, so evict from the back
+	while (total > k_fs_cache_capacity)
+	{
+		fs_work_t** victim = NULL;
+		for (fs_work_t** link = &fs->cache; *link; link = &(*link)->cache_next)
+		{
+			if ((*link)->refcount == 1 && work_is_done(*link))
+			{
+				victim = link;
+			}
+		}
+		if (!victim)
+		{
+			break;
+		}
+
+		fs_work_t* work = *victim;
+		*victim = work->cache_next;
+		total -= work->size;
+		work_free(work);
+	}
+}
+
+static bool cache_release(fs_work_t* work)
+{
+	if (!work->cached)
+	{
+		return true;
+	}
+
+	fs_t* fs = work->fs;
+	lock_acquire(&fs->cache_lock);
+	bool last = --work->refcount == 0;
+	lock_release(&fs->cache_lock);
+	return last;
+}
+
+static void work_free(fs_work_t* work)
+{
+	work_wait(work);
+	if (work->op == k_fs_work_op_map && work->buffer)
+	{
+		UnmapViewOfFile(work->buffer);
+	}
+	if (work->owns_buffer && work->buffer)
+	{
+		heap_free(work->fs->heap, work->buffer);
+	}
+	heap_free(work->fs->heap, work->wide_path);
+	object_pool_free(work->fs->work_pool, work);
+}
+
+static fs_work_t* work_create(fs_t* fs, fs_work_op_t op, const char* path, heap_t* heap)
+{
+	fs_work_t* work = object_pool_alloc(fs->work_pool);
+	memset(work, 0, sizeof(*work));
+	work->fs = fs;
+	work->heap = heap;
+	work->op = op;
+
+	//UTF-16 never needs more code units than UTF-8 has bytes, so every form fits in one block sized to the path
+	work->path_length = strlen(path) + 1;
+	size_t wide_length = work->path_length;
+	if (op == k_fs_work_op_write)
+	{
+		wide_length += work->path_length + k_fs_write_temp_suffix_size;
+	}
+	work->wide_path = heap_alloc(fs->heap, wide_length * sizeof(wchar_t) + work->path_length, 8);
+	work->wide_temp_path = op == k_fs_work_op_write ? work->wide_path + work->path_length : NULL;
+	work->path = (char*)(work->wide_path + wide_length);
+	memcpy(work->path, path, work->path_length);
+	work->handle = INVALID_HANDLE_VALUE;
+	work->priority = k_fs_priority_normal;
+	return work;
+}
+
+static void work_set_options(fs_work_t* work, const fs_work_options_t* options)
+{
+	if (options)
+	{
+		work->priority = options->priority;
+		work->callback = options->callback;
+		work->callback_user = options->callback_user;
+		work->completion_queue = options->completion_queue;
+		work->compression_level = __min(options->compression_level, k_fs_compression_max);
+		work->compute_hash |= options->compute_hash;
+	}
+}
+
+static bool work_is_done(fs_work_t* work)
+{
+	return atomic_load(&work->done) != 0;
+}
+
+static void work_wait(fs_work_t* work)
+{
+	while (!work_is_done(work))
+	{
+		atomic_wait(&work->done, 0);
+	}
+}
+
+static bool work_same_path(const fs_work_t* a, const fs_work_t* b)
+{
+	return a->path_hash == b->path_hash && a->path_length == b->path_length && strcmp(a->path, b->path) == 0;
+}
+
+// Track a new write, superseding older writes to its path that have not been issued yet.
+static void write_register(fs_t* fs, fs_work_t* work)
+{
+	work->path_hash = hash_path(work->path);
+	lock_acquire(&fs->write_lock);
+	work->write_sequence = ++fs->write_sequence;
+	for (fs_work_t* other = fs->pending_writes; other; other = other->write_next)
+	{
+		if (!other->write_issued && work_same_path(other, work))
+		{
+			atomic_store(&other->superseded, 1);
+		}
+	}
+	work->write_next = fs->pending_writes;
+	fs->pending_writes = work;
+	lock_release(&fs->write_lock);
+}
+
+// Mark a write issued, unless a newer write to its path superseded it first.
+static bool write_begin(fs_t* fs, fs_work_t* work)
+{
+	lock_acquire(&fs->write_lock);
+	bool issue = !atomic_load(&work->superseded);
+	work->write_issued = issue;
+	lock_release(&fs->write_lock);
+	return issue;
+}
+
+// Move a finished write's temporary file over its path, unless a newer write to the path landed first.
+// Older writes to the path still in flight are superseded, so they cannot land after this one.
+// Only the file thread commits writes and supersedes issued ones, so the check and the move need no lock.
+static void write_commit(fs_t* fs, fs_work_t* work)
+{
+	if (atomic_load(&work->superseded))
+	{
+		DeleteFile(work->wide_temp_path);
+		return;
+	}
+	if (!MoveFileEx(work->wide_temp_path, work->wide_path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+	{
+		work->result = GetLastError();
+		DeleteFile(work->wide_temp_path);
+		return;
+	}
+
+	lock_acquire(&fs->write_lock);
+	for (fs_work_t* other = fs->pending_writes; other; other = other->write_next)
+	{
+		if (other->write_sequence < work->write_sequence && work_same_path(other, work))
+		{
+			atomic_store(&other->superseded, 1);
+		}
+	}
+	lock_release(&fs->write_lock);
+}
+
+static void write_unlink(fs_t* fs, fs_work_t* work)
+{
+	lock_acquire(&fs->write_lock);
+	for (fs_work_t** link = &fs->pending_writes; *link; link = &(*link)->write_next)
+	{
+		if (*link == work)
+		{
+			*link = work->write_next;
+			break;
+		}
+	}
+	lock_release(&fs->write_lock);
+}
+
+// Hash a read's contents on the thread finishing it, if asked to, so callers never reread them to check them.
+// Packed files are always hashed and checked against the hash stored when the pack was built.
+static void read_hash(fs_work_t* work)
+{
+	if (!work->compute_hash)
+	{
+		return;
+	}
+
+	TRACE_ZONE_BEGIN(k_trace_category_fs, "Hash");
+	work->content_hash = XXH64(work->buffer, work->size, 0);
+	if (work->pack_entry && work->content_hash != work->pack_entry->content_hash)
+	{
+		debug_print(k_print_error, "fs pack: %s is corrupt!\n", work->path);
+		work->result = ERROR_CRC;
+	}
+	TRACE_ZONE_END(k_trace_category_fs);
+}
+
+// Mark work finished, wake its waiters and report it to the caller.
+static void work_finish(fs_work_t* work)
+{
+	if (work->write_sequence)
+	{
+		write_unlink(work->fs, work);
+	}
+
+	//once done is set the caller may destroy the work, so read what we need first
+	fs_work_callback_t callback = work->callback;
+	void* callback_user = work->callback_user;
+	queue_t* completion_queue = work->completion_queue;
+	trace_flow_end(trace_get_default(), "File Done", work->flow);
+
+	atomic_store(&work->done, 1);
+	atomic_wake_all(&work->done);
+
+	if (callback)
+	{
+		callback(work, callback_user);
+	}
+	if (completion_queue)
+	{
+		queue_push(completion_queue, work);
+	}
+}
+
+static uint64_t hash_pack_path(const char* path)
+{
+	//fnv-1a with case and separators folded, so "Shaders\A.spv" finds "shaders/a.spv"
+	uint64_t hash = 14695981039346656037ull;
+	for (const char* c = path; *c; ++c)
+	{
+		char ch = *c == '\\' ? '/' : (char)tolower((unsigned char)*c);
+		hash = (hash ^ (uint8_t)ch) * 1099511628211ull;
+	}
+	return hash;
+}
+
+static size_t pack_align(size_t offset)
+{
+	return (offset + k_fs_pack_alignment - 1) & ~((size_t)k_fs_pack_alignment - 1);
+}
+
+// Fill a pack's dictionary with the start of each small file, where headers and common strings gather.
+// LZ4 has no dictionary trainer; samples of the files themselves serve as one, and the most recent bytes
+// are the cheapest to match, so later samples take precedence if the dictionary would overflow.
+// Returns the dictionary size, or 0 if there are too few small files for one to help.
+static size_t build_pack_dictionary(const void** data, const size_t* sizes, int count, char* dictionary)
+{
+	int small_count = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		small_count += sizes[i] && sizes[i] <= k_fs_pack_dictionary_file_size;
+	}
+	if (small_count < k_fs_pack_dictionary_min_files)
+	{
+		return 0;
+	}
+
+	size_t size = 0;
+	for (int i = count - 1; i >= 0 && size < k_fs_pack_dictionary_size; --i)
+	{
+		if (sizes[i] && sizes[i] <= k_fs_pack_dictionary_file_size)
+		{
+			//samples are laid down back to front so the last files end up nearest the data
+			size_t sample = __min(__min(sizes[i], (size_t)k_fs_pack_dictionary_sample_size), k_fs_pack_dictionary_size - size);
+			size += sample;
+			memcpy(dictionary + k_fs_pack_dictionary_size - size, data[i], sample);
+		}
+	}
+	memmove(dictionary, dictionary + k_fs_pack_dictionary_size - size, size);
+	return size;
+}
+
+static bool pack_read_sync(HANDLE handle, uint64_t offset, void* buffer, size_t size)
+{
+	OVERLAPPED overlapped = { 0 };
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD bytes = 0;
+	if (!ReadFile(handle, buffer, (DWORD)size, NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+	{
+		return false;
+	}
+	return GetOverlappedResult(handle, &overlapped, &bytes, TRUE) && bytes == size;
+}
+
+// Find a path in the mounted pack, or return NULL if it is not packed.
+static const fs_pack_entry_t* pack_find(fs_t* fs, const char* path)
+{
+	fs_pack_t* pack = fs->pack;
+	if (!pack)
+	{
+		return NULL;
+	}
+
+	uint64_t hash = hash_pack_path(path);
+	for (uint32_t i = (uint32_t)hash & pack->table_mask; pack->table[i].flags & k_fs_pack_entry_used; i = (i + 1) & pack->table_mask)
+	{
+		if (pack->table[i].path_hash == hash)
+		{
+			return &pack->table[i];
+		}
+	}
+	return NULL;
+}
+
+// Point work at its entry in the mounted pack, if the path is packed.
+static bool pack_attach(fs_t* fs, fs_work_t* work)
+{
+	const fs_pack_entry_t* entry = pack_find(fs, work->path);
+	if (!entry)
+	{
+		return false;
+	}
+	work->pack_entry = entry;
+	work->use_compression = (entry->flags & k_fs_pack_entry_compressed) != 0;
+	work->compute_hash = true;
+	return true;
+}
+
+// Issue an overlapped read of a packed file from the pack's shared handle.
+static bool pack_issue(fs_t* fs, fs_work_t* work)
+{
+	const fs_pack_entry_t* entry = work->pack_entry;
+	work->size = (size_t)entry->stored_size;
+	work->buffer = heap_alloc(work->heap, work->null_terminate ? work->size + 1 : work->size, 8);
+
+	memset(&work->overlapped, 0, sizeof(work->overlapped));
+	work->overlapped.Offset = (DWORD)entry->offset;
+	work->overlapped.OffsetHigh = (DWORD)(entry->offset >> 32);
+	if (!ReadFile(fs->pack->handle, work->buffer, (DWORD)work->size, NULL, &work->overlapped) &&
+		GetLastError() != ERROR_IO_PENDING)
+	{
+		file_fail(work, GetLastError());
+		return false;
+	}
+	return true;
+}
+
+static void pack_destroy(fs_t* fs)
+{
+	if (fs->pack)
+	{
+		CloseHandle(fs->pack->handle);
+		heap_free(fs->heap, fs->pack->table);
+		heap_free(fs->heap, fs->pack->dictionary);
+		heap_free(fs->heap, fs->pack);
+		fs->pack = NULL;
+	}
 }
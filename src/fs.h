@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Asynchronous read/write file system.
 
@@ -10,16 +11,86 @@ typedef struct fs_t fs_t;
 // Handle to file work.
 typedef struct fs_work_t fs_work_t;
 
+// Handle to a file stream.
+typedef struct fs_stream_t fs_stream_t;
+
+// Called with each chunk of a read stream, in file order, on the file system's thread.
+// data is only valid during the call.
+// The last call has a NULL data and zero size; result is zero if the whole file was read.
+typedef void (*fs_stream_callback_t)(void* user, const void* data, size_t size, int result);
+
+// Order in which queued file work is started.
+typedef enum fs_priority_t
+{
+	k_fs_priority_critical, //needed this frame, e.g. a shader the renderer is waiting on
+	k_fs_priority_normal,
+	k_fs_priority_background, //large writes and speculative reads; never given every in-flight slot
+	k_fs_priority_count,
+} fs_priority_t;
+
+// LZ4 compression levels for compressed writes.
+// Levels from high up are LZ4HC: several times slower to compress for a better ratio, for files written once and
+// read often, such as packed assets. Every level decompresses at the same speed.
+enum
+{
+	k_fs_compression_fast = 0,
+	k_fs_compression_high = 9,
+	k_fs_compression_max = 12,
+};
+
+// Called when file work finishes, on the file system thread that finished it.
+// Keep it short; other file work waits while it runs.
+typedef void (*fs_work_callback_t)(fs_work_t* work, void* user);
+
 typedef struct heap_t heap_t;
+typedef struct queue_t queue_t;
+
+// Optional settings for queued file work.
+// Zero-initialize for the defaults: normal priority, no callback and no completion queue.
+typedef struct fs_work_options_t
+{
+	fs_priority_t priority;
+
+	// Called once the work is finished.
+	fs_work_callback_t callback;
+	void* callback_user;
+
+	// If not NULL, the work is pushed here once finished, so a game can drain
+	// completions once a frame instead of polling each request.
+	queue_t* completion_queue;
+
+	// Level a compressed write is compressed at, up to k_fs_compression_max. 0 is k_fs_compression_fast.
+	int compression_level;
+
+	// If true, a read hashes the contents with XXH64 as it finishes, for fs_work_get_hash().
+	// Packed and cached reads always do.
+	bool compute_hash;
+} fs_work_options_t;
+typedef struct job_system_t job_system_t;
 
 // Create a new file system.
 // Provided heap will be used to allocate space for queue and work buffers.
 // Provided queue size defines number of in-flight file operations.
-fs_t* fs_create(heap_t* heap, int queue_capacity);
+// If jobs is not NULL, compressed files are compressed and decompressed in parallel chunks on it.
+fs_t* fs_create(heap_t* heap, int queue_capacity, job_system_t* jobs);
 
 // Destroy a previously created file system.
 void fs_destroy(fs_t* fs);
 
+// Mount a pack file built with fs_pack_build().
+// Reads and maps of paths stored in the pack are then served from the pack's one open handle,
+// in place of the loose files. Path case and slash direction are ignored when matching.
+// Packed files are checked against the hash of their contents stored in the pack; a corrupt one fails with ERROR_CRC.
+// Mount before issuing any work; only one pack can be mounted at a time.
+// Returns false if the pack cannot be opened or is not a valid pack.
+bool fs_mount_pack(fs_t* fs, const char* path);
+
+// Build a pack file holding the files at the given paths.
+// If use_compression is true, each file is stored LZ4 compressed at compression_level when that makes it smaller,
+// against a dictionary sampled from the pack's small files so that they compress well even on their own.
+// Blocks until the pack is written. Returns zero on success.
+int fs_pack_build(fs_t* fs, const char* pack_path, const char** paths, int count, bool use_compression, int compression_level);
+
 // Queue a file read.
 // File at the specified path will be read in full.
 // Memory for the file will be allocated out of the provided heap.
@@ -27,17 +98,64 @@ void fs_destroy(fs_t* fs);
 // Returns a work object.
 fs_work_t* fs_read(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression);
 
+// Read a file through the file system's shared cache.
+// Requests for a path that is already cached, or still being read, share one work object
+// instead of reading the file again. A cached file is read again if its last write time changed,
+// or for a packed file, if its contents no longer hash to the pack's stored hash.
+// The buffer is owned by the cache; do not free it. Each call must be paired with fs_work_destroy().
+fs_work_t* fs_read_cached(fs_t* fs, const char* path, bool null_terminate);
+
+// Start reading a file into the cache ahead of a later fs_read_cached().
+void fs_prefetch(fs_t* fs, const char* path);
+
+// Queue a file read at the given priority.
+// Otherwise the same as fs_read(), which queues at normal priority.
+fs_work_t* fs_read_with_priority(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, fs_priority_t priority);
+
+// Queue a file read with the given options, or the defaults if options is NULL.
+// With a callback or completion queue, destroy the work only once it has been reported.
+fs_work_t* fs_read_with_options(fs_t* fs, const char* path, heap_t* heap, bool null_terminate, bool use_compression, const fs_work_options_t* options);
+
+// Queue a read-only memory mapping of a file.
+// The buffer returned by fs_work_get_buffer() is a view of the file rather than a copy,
+// shared with the OS page cache and paged in as it is touched.
+// The view stays valid until fs_work_destroy(); do not free it.
+// If the file is empty, the buffer is NULL.
+fs_work_t* fs_map(fs_t* fs, const char* path);
+
 // Queue a file write.
 // File at the specified path will be written in full.
+// The data goes to a temporary file beside it, which replaces the file once written, so a crash
+// mid-write leaves the previous contents intact.
+// A write still queued when a newer write to the same path is queued is dropped without touching the disk
+// and finishes successfully, since the newer one carries the latest data; the caller may free its buffer then.
 // Returns a work object.
 fs_work_t* fs_write(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression);
 
+// Queue a file write at the given priority.
+// Otherwise the same as fs_write(), which queues at normal priority.
+fs_work_t* fs_write_with_priority(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression, fs_priority_t priority);
+
+// Queue a file write with the given options, or the defaults if options is NULL.
+// With a callback or completion queue, destroy the work only once it has been reported.
+fs_work_t* fs_write_with_options(fs_t* fs, const char* path, const void* buffer, size_t size, bool use_compression, const fs_work_options_t* options);
+
+// Cancel file work that is no longer needed.
+// Work that has not started is dropped, and reads and writes in flight are aborted where the OS allows.
+// Cancelled work finishes with ERROR_OPERATION_ABORTED and must still be destroyed.
+// Cached reads and stream chunks are not cancelled.
+void fs_work_cancel(fs_work_t* work);
+
 // If true, the file work is complete.
 bool fs_work_is_done(fs_work_t* work);
 
 // Block for the file work to complete.
 void fs_work_wait(fs_work_t* work);
 
+// Wait for the file work to complete from inside a job.
+// Suspends only the job's fiber; its worker thread runs other jobs in the meantime.
+void fs_work_wait_job(fs_work_t* work, job_system_t* jobs);
+
 // Get the error code for the file work.
 // A value of zero generally indicates success.
 int fs_work_get_result(fs_work_t* work);
@@ -48,5 +166,35 @@ void* fs_work_get_buffer(fs_work_t* work);
 // Get the size associated with the file operation.
 size_t fs_work_get_size(fs_work_t* work);
 
+// Get the XXH64 hash, with seed 0, of a read's contents once decompressed.
+// Zero unless the read computed one and succeeded.
+uint64_t fs_work_get_hash(fs_work_t* work);
+
 // Free a file work object.
 void fs_work_destroy(fs_work_t* work);
+
+// Open a file for streaming writes.
+// Data is written in chunks while the caller produces more, with a fixed number of chunks in memory.
+// If use_compression is true, chunks are compressed as a stream of dependent LZ4 blocks.
+// Returns NULL if the file cannot be created.
+fs_stream_t* fs_stream_open_write(fs_t* fs, const char* path, bool use_compression);
+
+// Set the priority of chunks a stream queues from now on.
+// Streams start at normal priority.
+void fs_stream_set_priority(fs_stream_t* stream, fs_priority_t priority);
+
+// Append data to a write stream.
+// The data is copied, so the caller may reuse its buffer on return.
+// Blocks while every chunk is waiting to be written.
+void fs_stream_write(fs_stream_t* stream, const void* data, size_t size);
+
+// Open a file for streaming reads.
+// Chunks are read ahead and passed to callback as they arrive.
+// use_compression must match the write stream that produced the file.
+// Returns NULL if the file cannot be opened.
+fs_stream_t* fs_stream_open_read(fs_t* fs, const char* path, bool use_compression, fs_stream_callback_t callback, void* user);
+
+// Close a stream.
+// Waits for pending writes to land, or for a read stream to deliver its last chunk.
+// Returns the first error the stream hit, or zero.
+int fs_stream_close(fs_stream_t* stream);
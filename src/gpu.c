@@ -1,7 +1,13 @@
 #include "gpu.h"
 
 #include "debug.h"
+#include "frame_graph.h"
+#include "frame_stats.h"
+#include "fs.h"
 #include "heap.h"
+#include "lock.h"
+#include "timer.h"
+#include "trace.h"
 #include "wm.h"
 
 #define VK_USE_PLATFORM_WIN32_KHR
@@ -10,10 +16,52 @@
 #include <malloc.h>
 #include <string.h>
 
+enum
+{
+	// GPU timestamps written per frame: frame start, one after each draw, and frame end.
+	k_gpu_max_timestamps = 64,
+
+	// Bytes of device memory allocated at once; buffers are sub-allocated from these blocks.
+	k_gpu_memory_block_size = 16 * 1024 * 1024,
+
+	// Staging buffers a frame can hold before their uploads are submitted.
+	k_gpu_max_staging_buffers = 256,
+};
+
+// A free run of bytes in a device memory block.
+typedef struct gpu_memory_range_t
+{
+	VkDeviceSize offset;
+	VkDeviceSize size;
+} gpu_memory_range_t;
+
+// One vkAllocateMemory, shared by many buffers of the same memory type.
+typedef struct gpu_memory_block_t
+{
+	VkDeviceMemory memory;
+	VkDeviceSize size;
+	VkDeviceSize used;
+	char* data; //mapped for the block's lifetime if host visible, otherwise NULL
+	gpu_memory_range_t* free_ranges; //sorted by offset; adjacent ranges are always merged
+	int free_count;
+	int free_capacity;
+	struct gpu_memory_block_t* next;
+} gpu_memory_block_t;
+
+// A sub-allocation of a device memory block.
+typedef struct gpu_allocation_t
+{
+	gpu_memory_block_t* block;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	uint32_t type_index;
+} gpu_allocation_t;
+
 typedef struct gpu_cmd_buffer_t
 {
 	VkCommandBuffer buffer;
 	VkPipelineLayout pipeline_layout;
+	VkShaderStageFlags push_constant_stages;
 	int index_count;
 	int vertex_count;
 } gpu_cmd_buffer_t;
@@ -23,15 +71,22 @@ typedef struct gpu_descriptor_t
 	VkDescriptorSet set;
 } gpu_descriptor_t;
 
+// A reusable secondary command buffer, in a pool of its own so it can be recorded on any thread.
+typedef struct gpu_bundle_t
+{
+	VkCommandPool pool;
+	gpu_cmd_buffer_t cmd_buffer;
+} gpu_bundle_t;
+
 typedef struct gpu_mesh_t
 {
 	VkBuffer index_buffer;
-	VkDeviceMemory index_memory;
+	gpu_allocation_t index_memory;
 	int index_count;
 	VkIndexType index_type;
 
 	VkBuffer vertex_buffer;
-	VkDeviceMemory vertex_memory;
+	gpu_allocation_t vertex_memory;
 	int vertex_count;
 } gpu_mesh_t;
 
@@ -39,29 +94,104 @@ typedef struct gpu_pipeline_t
 {
 	VkPipelineLayout pipeline_layout;
 	VkPipeline pipe;
+	VkPipelineBindPoint bind_point;
+	VkShaderStageFlags push_constant_stages;
+
+	//what a shader's variant was created for, to find it again
+	gpu_mesh_layout_t mesh_layout;
+	uint32_t specialization[k_gpu_specialization_max];
+	int specialization_count;
+	struct gpu_pipeline_t* next_variant;
 } gpu_pipeline_t;
 
 typedef struct gpu_shader_t
 {
 	VkShaderModule vertex_module;
 	VkShaderModule fragment_module;
+	VkShaderModule compute_module;
 	VkDescriptorSetLayout descriptor_set_layout;
+	bool uniform_ring;
+	uint32_t push_constant_size;
+
+	// Pipelines created by gpu_pipeline_get().
+	lock_t variant_lock;
+	gpu_pipeline_t* variants;
 } gpu_shader_t;
 
 typedef struct gpu_uniform_buffer_t
 {
 	VkBuffer buffer;
-	VkDeviceMemory memory;
+	gpu_allocation_t memory;
 	VkDescriptorBufferInfo descriptor;
 } gpu_uniform_buffer_t;
 
+typedef struct gpu_storage_buffer_t
+{
+	VkBuffer buffer;
+	gpu_allocation_t memory;
+	VkDescriptorBufferInfo descriptor;
+} gpu_storage_buffer_t;
+
+typedef struct gpu_texture_t
+{
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+	VkDescriptorImageInfo descriptor;
+	gpu_texture_format_t format;
+	VkFormat vk_format;
+	int width;
+	int height;
+	int mip_count;
+	int first_mip;
+} gpu_texture_t;
+
+// Host visible copy of data being uploaded to device local memory, freed once its frame retires.
+// A texture upload also carries the image it replaces, if any, which frames until then may still sample.
+typedef struct gpu_staging_buffer_t
+{
+	VkBuffer buffer;
+	gpu_allocation_t memory;
+	VkImage retired_image;
+	VkDeviceMemory retired_memory;
+	VkImageView retired_view;
+} gpu_staging_buffer_t;
+
 typedef struct gpu_frame_t
 {
 	VkImage image;
+	VkDeviceMemory image_memory; //backs offscreen images; swapchain images belong to the swapchain
 	VkImageView view;
 	VkFramebuffer frame_buffer;
 	VkFence fence;
 	gpu_cmd_buffer_t* cmd_buffer;
+	gpu_cmd_buffer_t recorders[k_gpu_max_recorders]; //secondary command buffers, one per recording thread
+	int recorder_count; //recorders begun for the frame being recorded
+	gpu_bundle_t* bundles[k_gpu_max_bundles]; //executed ahead of the recorders
+	int bundle_count;
+	uint32_t timestamp_count; //written while recording
+	uint32_t submitted_timestamp_count; //written by the last submission, read once its fence signals
+
+	// Copies from staging buffers into device local memory, submitted ahead of the frame's draws.
+	VkCommandBuffer upload_cmd_buffer;
+	VkSemaphore upload_complete_sema; //signaled by the transfer queue, waited on by the graphics queue
+	bool upload_recording;
+	gpu_staging_buffer_t staging[k_gpu_max_staging_buffers];
+
+	// Compute dispatches, submitted ahead of the frame's draws on the compute queue, or the graphics queue without one.
+	VkCommandBuffer compute_cmd_buffer;
+	bool compute_recording;
+	int staging_count;
+	int submitted_staging_count; //staging buffers read by the last submission, freed once its fence signals
+
+	// Host visible copy of an offscreen frame, written after its render pass, or VK_NULL_HANDLE without readback.
+	VkBuffer readback_buffer;
+	gpu_allocation_t readback_memory;
+
+	// Descriptors that live for one frame, reset together once its fence signals.
+	VkDescriptorPool descriptor_pool;
+	gpu_descriptor_t descriptors[k_gpu_frame_descriptor_max];
+	int descriptor_count;
 } gpu_frame_t;
 
 typedef struct gpu_t
@@ -71,18 +201,49 @@ typedef struct gpu_t
 	VkPhysicalDevice physical_device;
 	VkDevice logical_device;
 	VkPhysicalDeviceMemoryProperties memory_properties;
+	bool texture_compression_bc; //the device samples BC formats
+	VkSampler texture_sampler; //trilinear filtering with wrapping, for every texture
+	gpu_memory_block_t* memory_blocks[VK_MAX_MEMORY_TYPES]; //every block of each memory type
 	VkQueue queue;
+	VkQueue transfer_queue; //a dedicated transfer queue, or the graphics queue if there is none
+	uint32_t queue_family_index;
+	uint32_t transfer_queue_family_index;
+
+	// Async compute queue, or VK_NULL_HANDLE to dispatch on the graphics queue.
+	// Each frame's dispatches signal the next value of the timeline, which the frame's draws wait on.
+	VkQueue compute_queue;
+	uint32_t compute_queue_family_index;
+	VkCommandPool compute_pool;
+	VkSemaphore compute_timeline;
+	uint64_t compute_timeline_value;
 	VkSurfaceKHR surface;
 	VkSwapchainKHR swap_chain;
 
+	// Plan of the frame's passes, from which the render pass and transient memory were made.
+	frame_graph_t* frame_graph;
 	VkRenderPass render_pass;
 
 	VkImage depth_stencil_image;
-	VkDeviceMemory depth_stencil_memory;
 	VkImageView depth_stencil_view;
+	VkDeviceMemory transient_memory; //holds the frame graph's transient attachments at their planned offsets
+
+	// Image frames draw into with dynamic resolution, or VK_NULL_HANDLE to draw into the frame's own image.
+	// Frames draw its top left render_width by render_height and blit that up into the frame's image.
+	VkImage scene_image;
+	VkImageView scene_view;
+	VkDeviceMemory scene_memory;
+	float render_scale;
+	uint32_t render_width; //size frames draw at, from the scale when the frame being recorded began
+	uint32_t render_height;
+	int64_t frame_gpu_us; //of the last frame found finished
 
 	VkCommandPool cmd_pool;
+	VkCommandPool upload_pool; //allocates from the transfer queue's family
+	VkCommandPool recorder_pools[k_gpu_max_recorders]; //command pools are single threaded, so each recorder has its own
 	VkDescriptorPool descriptor_pool;
+	VkPipelineCache pipeline_cache; //shared by every pipeline, and saved to pipeline_cache_path
+	fs_t* fs;
+	const char* pipeline_cache_path;
 
 	VkSemaphore present_complete_sema;
 	VkSemaphore render_complete_sema;
@@ -99,17 +260,68 @@ typedef struct gpu_t
 	gpu_frame_t* frames;
 	uint32_t frame_count;
 	uint32_t frame_index;
+	uint32_t image_index; //swapchain image acquired for the frame being recorded
+	bool frame_open; //between gpu_frame_begin and gpu_frame_end
+
+	// Timestamp queries, k_gpu_max_timestamps per frame, or VK_NULL_HANDLE if the queue cannot time.
+	VkQueryPool timestamp_pool;
+	uint64_t timestamp_mask;
+	double ticks_per_timestamp;
+	uint64_t calibration_timestamp; //a GPU timestamp and the timer ticks it was taken at
+	uint64_t calibration_ticks;
+
+	// Uniform ring, one region of k_gpu_uniform_ring_size bytes per frame, mapped for the lifetime of the GPU.
+	VkBuffer uniform_ring_buffer;
+	gpu_allocation_t uniform_ring_memory;
+	char* uniform_ring_data;
+	VkDescriptorBufferInfo uniform_ring_descriptor;
+	VkDeviceSize uniform_ring_alignment;
+	VkDeviceSize uniform_ring_offset; //next free byte in the region of the frame being recorded
 } gpu_t;
 
 static void create_mesh_layouts(gpu_t* gpu);
+static void create_mesh_layout(gpu_t* gpu, gpu_mesh_layout_t layout, uint32_t stride, const VkVertexInputAttributeDescription* attributes, int attribute_count, int index_size);
+static void create_pipeline_cache(gpu_t* gpu, const VkPhysicalDeviceProperties* properties);
+static void save_pipeline_cache(gpu_t* gpu);
+static void create_timestamp_queries(gpu_t* gpu, uint32_t valid_bits);
+static void write_timestamp(gpu_t* gpu, gpu_frame_t* frame, VkPipelineStageFlagBits stage);
+static void emit_timestamps(gpu_t* gpu, gpu_frame_t* frame);
+static void set_viewport(gpu_t* gpu, VkCommandBuffer buffer);
+static void blit_scene(gpu_t* gpu, gpu_frame_t* frame);
 static void destroy_mesh_layouts(gpu_t* gpu);
 static uint32_t get_memory_type_index(gpu_t* gpu, uint32_t bits, VkMemoryPropertyFlags properties);
+static VkResult memory_alloc(gpu_t* gpu, const VkMemoryRequirements* reqs, VkMemoryPropertyFlags properties, gpu_allocation_t* allocation);
+static void memory_free(gpu_t* gpu, gpu_allocation_t* allocation);
+static bool memory_block_alloc(gpu_t* gpu, gpu_memory_block_t* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset);
+static void memory_block_insert_range(gpu_t* gpu, gpu_memory_block_t* block, int index, VkDeviceSize offset, VkDeviceSize size);
+static VkResult create_host_buffer(gpu_t* gpu, VkBufferUsageFlags usage, size_t size, VkBuffer* buffer, gpu_allocation_t* memory, const char** function);
+static VkResult create_device_buffer(gpu_t* gpu, VkBufferUsageFlags usage, const void* data, size_t size, VkBuffer* buffer, gpu_allocation_t* memory, const char** function);
+static void free_staging_buffers(gpu_t* gpu, gpu_frame_t* frame, int count);
+static VkResult begin_upload(gpu_t* gpu, gpu_frame_t* frame, const char** function);
+static VkResult create_staging_buffer(gpu_t* gpu, gpu_frame_t* frame, const void* data, size_t size, gpu_staging_buffer_t** staging, const char** function);
+static VkResult create_texture_image(gpu_t* gpu, gpu_texture_t* texture, int first_mip, const void* data, size_t size, const char** function);
+static void write_descriptor(gpu_t* gpu, gpu_descriptor_t* descriptor, const gpu_descriptor_info_t* info);
+static void write_host_memory(gpu_t* gpu, const gpu_allocation_t* memory, const void* data, size_t size);
+static VkResult create_swapchain(gpu_t* gpu, wm_window_t* window, const gpu_options_t* options, const char** function);
+static VkResult create_offscreen_images(gpu_t* gpu, const gpu_options_t* options, const char** function);
+static VkResult create_render_pass(gpu_t* gpu, int group, const VkFormat* formats, VkRenderPass* render_pass);
+static void set_buffer_sharing(gpu_t* gpu, VkBufferCreateInfo* info, uint32_t* families);
+static gpu_pipeline_t* find_variant(gpu_shader_t* shader, const gpu_pipeline_info_t* info);
 
 gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
+{
+	gpu_options_t options = { 0 };
+	return gpu_create_with_options(heap, window, &options);
+}
+
+gpu_t* gpu_create_with_options(heap_t* heap, wm_window_t* window, const gpu_options_t* options)
 {
 	gpu_t* gpu = heap_alloc(heap, sizeof(gpu_t), 8);
 	memset(gpu, 0, sizeof(*gpu));
 	gpu->heap = heap;
+	gpu->fs = options->fs;
+	gpu->pipeline_cache_path = options->pipeline_cache_path;
+	gpu->render_scale = 1.0f;
 
 	//////////////////////////////////////////////////////
 	// Create VkInstance
@@ -136,11 +348,12 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 		"VK_LAYER_KHRONOS_validation",
 	};
 
+	//without a window there is nothing to present to, so neither surfaces nor swapchains are needed
 	VkInstanceCreateInfo instance_info =
 	{
 		.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
 		.pApplicationInfo = &app_info,
-		.enabledExtensionCount = _countof(k_extensions),
+		.enabledExtensionCount = options->headless ? 0 : _countof(k_extensions),
 		.ppEnabledExtensionNames = k_extensions,
 		.enabledLayerCount = use_validation ? _countof(k_layers) : 0,
 		.ppEnabledLayerNames = k_layers,
@@ -211,114 +424,143 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 		return NULL;
 	}
 
-	float* queue_priorites = alloca(sizeof(float) * queue_count);
-	memset(queue_priorites, 0, sizeof(float) * queue_count);
+	//a family with transfer but not graphics is usually backed by DMA engines that copy alongside rendering
+	uint32_t transfer_queue_family_index = queue_family_index;
+	for (uint32_t i = 0; i < queue_family_count; ++i)
+	{
+		if (queue_families[i].queueCount > 0 && (queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+			!(queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+		{
+			transfer_queue_family_index = i;
+			break;
+		}
+	}
+
+	//a family with compute but not graphics runs dispatches alongside rasterization; one apart from the transfer family is preferred
+	uint32_t compute_queue_family_index = UINT32_MAX;
+	for (uint32_t i = 0; options->async_compute && i < queue_family_count; ++i)
+	{
+		if (queue_families[i].queueCount > 0 && (queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+			!(queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+			(compute_queue_family_index == UINT32_MAX || compute_queue_family_index == transfer_queue_family_index))
+		{
+			compute_queue_family_index = i;
+		}
+	}
 
-	VkDeviceQueueCreateInfo queue_info =
+	//the graphics queue waits on dispatches with a timeline semaphore, core in Vulkan 1.2 but optional
+	VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features =
 	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.queueFamilyIndex = queue_family_index,
-		.queueCount = queue_count,
-		.pQueuePriorities = queue_priorites,
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
 	};
-
-	const char* device_extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-	VkDeviceCreateInfo device_info =
+	VkPhysicalDeviceFeatures2 features =
 	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.queueCreateInfoCount = 1,
-		.pQueueCreateInfos = &queue_info,
-		.enabledExtensionCount = _countof(device_extensions),
-		.ppEnabledExtensionNames = device_extensions,
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = &timeline_features,
 	};
-
-	result = vkCreateDevice(gpu->physical_device, &device_info, NULL, &gpu->logical_device);
-	if (result)
+	vkGetPhysicalDeviceFeatures2(gpu->physical_device, &features);
+	if (options->async_compute && (compute_queue_family_index == UINT32_MAX || !timeline_features.timelineSemaphore))
 	{
-		function = "vkCreateDevice";
-		goto fail;
+		debug_print(k_print_warning, "No async compute queue found; dispatching on the graphics queue.\n");
+		compute_queue_family_index = UINT32_MAX;
 	}
 
-	vkGetPhysicalDeviceMemoryProperties(gpu->physical_device, &gpu->memory_properties);
-	vkGetDeviceQueue(gpu->logical_device, queue_family_index, 0, &gpu->queue);
+	//a compute family shared with transfer gets its own queue in the family if it has a second
+	uint32_t compute_queue_index = 0;
+	if (compute_queue_family_index == transfer_queue_family_index && queue_families[compute_queue_family_index].queueCount > 1)
+	{
+		compute_queue_index = 1;
+	}
 
-	//////////////////////////////////////////////////////
-	// Create a Windows surface on which to render
-	//////////////////////////////////////////////////////
+	float* queue_priorites = alloca(sizeof(float) * __max(queue_count, 2));
+	memset(queue_priorites, 0, sizeof(float) * __max(queue_count, 2));
 
-	VkWin32SurfaceCreateInfoKHR surface_info =
+	VkDeviceQueueCreateInfo queue_infos[3] =
 	{
-		.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
-		.hinstance = GetModuleHandle(NULL),
-		.hwnd = wm_get_raw_window(window),
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = queue_family_index,
+			.queueCount = queue_count,
+			.pQueuePriorities = queue_priorites,
+		},
 	};
-	result = vkCreateWin32SurfaceKHR(gpu->instance, &surface_info, NULL, &gpu->surface);
-	if (result)
+	uint32_t queue_info_count = 1;
+	if (transfer_queue_family_index != queue_family_index)
 	{
-		function = "vkCreateWin32SurfaceKHR";
-		goto fail;
+		queue_infos[queue_info_count++] = (VkDeviceQueueCreateInfo)
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = transfer_queue_family_index,
+			.queueCount = compute_queue_index + 1,
+			.pQueuePriorities = queue_priorites,
+		};
 	}
-
-	VkSurfaceCapabilitiesKHR surface_cap;
-	result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu->physical_device, gpu->surface, &surface_cap);
-	if (result)
+	if (compute_queue_family_index != UINT32_MAX && compute_queue_family_index != transfer_queue_family_index)
 	{
-		function = "vkGetPhysicalDeviceSurfaceCapabilitiesKHR";
-		goto fail;
+		queue_infos[queue_info_count++] = (VkDeviceQueueCreateInfo)
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = compute_queue_family_index,
+			.queueCount = 1,
+			.pQueuePriorities = queue_priorites,
+		};
 	}
 
-	gpu->frame_width = surface_cap.currentExtent.width;
-	gpu->frame_height = surface_cap.currentExtent.height;
+	VkPhysicalDeviceTimelineSemaphoreFeatures timeline_enable =
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+		.timelineSemaphore = VK_TRUE,
+	};
 
-	//////////////////////////////////////////////////////
-	// Create a VkSwapchain storing frame buffer images
-	//////////////////////////////////////////////////////
+	//textures are block compressed; without it they can't be created
+	gpu->texture_compression_bc = features.features.textureCompressionBC;
+	VkPhysicalDeviceFeatures enabled_features =
+	{
+		.textureCompressionBC = features.features.textureCompressionBC,
+	};
 
-	VkSwapchainCreateInfoKHR swapchain_info =
+	const char* device_extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	VkDeviceCreateInfo device_info =
 	{
-		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-		.surface = gpu->surface,
-		.minImageCount = __max(surface_cap.minImageCount + 1, 3),
-		.imageFormat = VK_FORMAT_B8G8R8A8_SRGB,
-		.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
-		.imageExtent = surface_cap.currentExtent,
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		.preTransform = surface_cap.currentTransform,
-		.imageArrayLayers = 1,
-		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-		.presentMode = VK_PRESENT_MODE_FIFO_KHR,
-		.clipped = VK_TRUE,
-		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+		.pNext = compute_queue_family_index != UINT32_MAX ? &timeline_enable : NULL,
+		.pEnabledFeatures = &enabled_features,
+		.queueCreateInfoCount = queue_info_count,
+		.pQueueCreateInfos = queue_infos,
+		.enabledExtensionCount = options->headless ? 0 : _countof(device_extensions),
+		.ppEnabledExtensionNames = device_extensions,
 	};
-	result = vkCreateSwapchainKHR(gpu->logical_device, &swapchain_info, NULL, &gpu->swap_chain);
+
+	result = vkCreateDevice(gpu->physical_device, &device_info, NULL, &gpu->logical_device);
 	if (result)
 	{
-		function = "vkCreateSwapchainKHR";
+		function = "vkCreateDevice";
 		goto fail;
 	}
 
-	result = vkGetSwapchainImagesKHR(gpu->logical_device, gpu->swap_chain, &gpu->frame_count, NULL);
-	if (result)
+	vkGetPhysicalDeviceMemoryProperties(gpu->physical_device, &gpu->memory_properties);
+	vkGetDeviceQueue(gpu->logical_device, queue_family_index, 0, &gpu->queue);
+	vkGetDeviceQueue(gpu->logical_device, transfer_queue_family_index, 0, &gpu->transfer_queue);
+	gpu->queue_family_index = queue_family_index;
+	gpu->transfer_queue_family_index = transfer_queue_family_index;
+	if (compute_queue_family_index != UINT32_MAX)
 	{
-		function = "vkGetSwapchainImagesKHR";
-		goto fail;
+		vkGetDeviceQueue(gpu->logical_device, compute_queue_family_index, compute_queue_index, &gpu->compute_queue);
+		gpu->compute_queue_family_index = compute_queue_family_index;
 	}
 
-	gpu->frames = heap_alloc(heap, sizeof(gpu_frame_t) * gpu->frame_count, 8);
-	memset(gpu->frames, 0, sizeof(gpu_frame_t) * gpu->frame_count);
-	VkImage* images = alloca(sizeof(VkImage) * gpu->frame_count);
+	//////////////////////////////////////////////////////
+	// Create the images frames are rendered into
+	//////////////////////////////////////////////////////
 
-	result = vkGetSwapchainImagesKHR(gpu->logical_device, gpu->swap_chain, &gpu->frame_count, images);
+	result = options->headless ? create_offscreen_images(gpu, options, &function) : create_swapchain(gpu, window, options, &function);
 	if (result)
 	{
-		function = "vkGetSwapchainImagesKHR";
 		goto fail;
 	}
 
 	for (uint32_t i = 0; i < gpu->frame_count; i++)
 	{
-		gpu->frames[i].image = images[i];
-
 		VkImageViewCreateInfo image_view_info =
 		{
 			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -334,7 +576,7 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 			.subresourceRange.levelCount = 1,
 			.subresourceRange.layerCount = 1,
 			.viewType = VK_IMAGE_VIEW_TYPE_2D,
-			.image = images[i],
+			.image = gpu->frames[i].image,
 		};
 		result = vkCreateImageView(gpu->logical_device, &image_view_info, NULL, &gpu->frames[i].view);
 		if (result)
@@ -345,62 +587,62 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 	}
 
 	//////////////////////////////////////////////////////
-	// Create a depth buffer image
+	// Create the image frames draw into at a scaled resolution
 	//////////////////////////////////////////////////////
+	if (options->dynamic_resolution)
 	{
-		VkImageCreateInfo depth_image_info =
+		//full size, so every scale fits; frames draw only its top left and blit from there
+		VkImageCreateInfo scene_image_info =
 		{
 			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
 			.imageType = VK_IMAGE_TYPE_2D,
-			.format = VK_FORMAT_D32_SFLOAT,
-			.extent = { surface_cap.currentExtent.width, surface_cap.currentExtent.height, 1 },
+			.format = VK_FORMAT_B8G8R8A8_SRGB,
+			.extent = { gpu->frame_width, gpu->frame_height, 1 },
 			.mipLevels = 1,
 			.arrayLayers = 1,
 			.samples = VK_SAMPLE_COUNT_1_BIT,
 			.tiling = VK_IMAGE_TILING_OPTIMAL,
-			.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+			.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
 			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 		};
-		result = vkCreateImage(gpu->logical_device, &depth_image_info, NULL, &gpu->depth_stencil_image);
+		result = vkCreateImage(gpu->logical_device, &scene_image_info, NULL, &gpu->scene_image);
 		if (result)
 		{
 			function = "vkCreateImage";
 			goto fail;
 		}
 
-		VkMemoryRequirements depth_mem_reqs;
-		vkGetImageMemoryRequirements(gpu->logical_device, gpu->depth_stencil_image, &depth_mem_reqs);
-
-		VkMemoryAllocateInfo depth_alloc_info =
+		VkMemoryRequirements scene_mem_reqs;
+		vkGetImageMemoryRequirements(gpu->logical_device, gpu->scene_image, &scene_mem_reqs);
+		VkMemoryAllocateInfo scene_alloc_info =
 		{
 			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = depth_mem_reqs.size,
-			.memoryTypeIndex = get_memory_type_index(gpu, depth_mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+			.allocationSize = scene_mem_reqs.size,
+			.memoryTypeIndex = get_memory_type_index(gpu, scene_mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
 		};
-		result = vkAllocateMemory(gpu->logical_device, &depth_alloc_info, NULL, &gpu->depth_stencil_memory);
+		result = vkAllocateMemory(gpu->logical_device, &scene_alloc_info, NULL, &gpu->scene_memory);
 		if (result)
 		{
 			function = "vkAllocateMemory";
 			goto fail;
 		}
-
-		result = vkBindImageMemory(gpu->logical_device, gpu->depth_stencil_image, gpu->depth_stencil_memory, 0);
+		result = vkBindImageMemory(gpu->logical_device, gpu->scene_image, gpu->scene_memory, 0);
 		if (result)
 		{
 			function = "vkBindImageMemory";
 			goto fail;
 		}
 
-		VkImageViewCreateInfo depth_view_info =
+		VkImageViewCreateInfo scene_view_info =
 		{
 			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
 			.viewType = VK_IMAGE_VIEW_TYPE_2D,
-			.format = VK_FORMAT_D32_SFLOAT,
+			.format = VK_FORMAT_B8G8R8A8_SRGB,
 			.subresourceRange = { .levelCount = 1, .layerCount = 1 },
-			.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
-			.image = gpu->depth_stencil_image,
+			.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.image = gpu->scene_image,
 		};
-		result = vkCreateImageView(gpu->logical_device, &depth_view_info, NULL, &gpu->depth_stencil_view);
+		result = vkCreateImageView(gpu->logical_device, &scene_view_info, NULL, &gpu->scene_view);
 		if (result)
 		{
 			function = "vkCreateImageView";
@@ -409,85 +651,119 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 	}
 
 	//////////////////////////////////////////////////////
-	// Create a VkRenderPass that draws to the screen
+	// Plan the frame's passes and the memory of their transient attachments
 	//////////////////////////////////////////////////////
 	{
-		VkAttachmentDescription attachments[2] =
+		VkImageCreateInfo depth_image_info =
 		{
-			{
-				.format = VK_FORMAT_B8G8R8A8_SRGB,
-				.samples = VK_SAMPLE_COUNT_1_BIT,
-				.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-				.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-				.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-				.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-				.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-				.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-			},
-			{
-				.format = VK_FORMAT_D32_SFLOAT,
-				.samples = VK_SAMPLE_COUNT_1_BIT,
-				.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-				.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-				.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-				.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-				.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-				.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-			}
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = VK_FORMAT_D32_SFLOAT,
+			.extent = { gpu->frame_width, gpu->frame_height, 1 },
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
 		};
+		result = vkCreateImage(gpu->logical_device, &depth_image_info, NULL, &gpu->depth_stencil_image);
+		if (result)
+		{
+			function = "vkCreateImage";
+			goto fail;
+		}
 
-		VkAttachmentReference color_reference =
+		VkMemoryRequirements depth_mem_reqs;
+		vkGetImageMemoryRequirements(gpu->logical_device, gpu->depth_stencil_image, &depth_mem_reqs);
+
+		//resources are added in framebuffer attachment order; the scene image is handed on to be blitted from
+		gpu->frame_graph = frame_graph_create(gpu->heap);
+		int backbuffer = frame_graph_add_resource(gpu->frame_graph, &(frame_graph_resource_info_t)
 		{
-			.attachment = 0,
-			.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-		};
-		VkAttachmentReference depth_reference =
+			.name = gpu->scene_image ? "scene" : "backbuffer",
+			.width = gpu->frame_width,
+			.height = gpu->frame_height,
+			.imported = true,
+			.final_usage = gpu->swap_chain && !gpu->scene_image ? k_frame_graph_usage_present : k_frame_graph_usage_transfer_read,
+		});
+		int depth = frame_graph_add_resource(gpu->frame_graph, &(frame_graph_resource_info_t)
 		{
-			.attachment = 1,
-			.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-		};
-
-		VkSubpassDescription subpass =
+			.name = "depth",
+			.width = gpu->frame_width,
+			.height = gpu->frame_height,
+			.size = depth_mem_reqs.size,
+			.alignment = depth_mem_reqs.alignment,
+		});
+		int main_pass = frame_graph_add_pass(gpu->frame_graph, "main");
+		frame_graph_pass_use(gpu->frame_graph, main_pass, backbuffer, k_frame_graph_usage_color_write);
+		frame_graph_pass_use(gpu->frame_graph, main_pass, depth, k_frame_graph_usage_depth_write);
+		if (!frame_graph_compile(gpu->frame_graph))
 		{
-			.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-			.colorAttachmentCount = 1,
-			.pColorAttachments = &color_reference,
-			.pDepthStencilAttachment = &depth_reference,
-		};
+			function = "frame_graph_compile";
+			result = VK_ERROR_INITIALIZATION_FAILED;
+			goto fail;
+		}
 
-		VkSubpassDependency dependencies[2] =
+		//transient attachments never leave tile memory where the device can allocate lazily
+		uint32_t memory_type = UINT32_MAX;
+		for (uint32_t i = 0; i < gpu->memory_properties.memoryTypeCount && memory_type == UINT32_MAX; ++i)
 		{
+			if ((depth_mem_reqs.memoryTypeBits & (1UL << i)) &&
+				(gpu->memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
 			{
-				.srcSubpass = VK_SUBPASS_EXTERNAL,
-				.dstSubpass = 0,
-				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-				.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-				.srcAccessMask = 0,
-				.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
-			},
-			{
-				.srcSubpass = 0,
-				.dstSubpass = VK_SUBPASS_EXTERNAL,
-				.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-				.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-				.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				.dstAccessMask = 0,
-				.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
-			},
+				memory_type = i;
+			}
+		}
+		if (memory_type == UINT32_MAX)
+		{
+			memory_type = get_memory_type_index(gpu, depth_mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		}
+
+		VkMemoryAllocateInfo transient_alloc_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = frame_graph_get_transient_size(gpu->frame_graph),
+			.memoryTypeIndex = memory_type,
 		};
+		result = vkAllocateMemory(gpu->logical_device, &transient_alloc_info, NULL, &gpu->transient_memory);
+		if (result)
+		{
+			function = "vkAllocateMemory";
+			goto fail;
+		}
 
-		VkRenderPassCreateInfo render_pass_info =
+		const frame_graph_resource_plan_t* depth_plan = frame_graph_get_resource_plan(gpu->frame_graph, depth);
+		result = vkBindImageMemory(gpu->logical_device, gpu->depth_stencil_image, gpu->transient_memory, depth_plan->offset);
+		if (result)
 		{
-			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-			.attachmentCount = _countof(attachments),
-			.pAttachments = attachments,
-			.subpassCount = 1,
-			.pSubpasses = &subpass,
-			.dependencyCount = _countof(dependencies),
-			.pDependencies = dependencies,
+			function = "vkBindImageMemory";
+			goto fail;
+		}
+
+		VkImageViewCreateInfo depth_view_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+			.viewType = VK_IMAGE_VIEW_TYPE_2D,
+			.format = VK_FORMAT_D32_SFLOAT,
+			.subresourceRange = { .levelCount = 1, .layerCount = 1 },
+			.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+			.image = gpu->depth_stencil_image,
 		};
-		result = vkCreateRenderPass(gpu->logical_device, &render_pass_info, NULL, &gpu->render_pass);
+		result = vkCreateImageView(gpu->logical_device, &depth_view_info, NULL, &gpu->depth_stencil_view);
+		if (result)
+		{
+			function = "vkCreateImageView";
+			goto fail;
+		}
+	}
+
+	//////////////////////////////////////////////////////
+	// Create a VkRenderPass that draws to the screen
+	//////////////////////////////////////////////////////
+	{
+		VkFormat formats[] = { VK_FORMAT_B8G8R8A8_SRGB, VK_FORMAT_D32_SFLOAT };
+		result = create_render_pass(gpu, 0, formats, &gpu->render_pass);
 		if (result)
 		{
 			function = "vkCreateRenderPass";
@@ -500,7 +776,7 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 	//////////////////////////////////////////////////////
 	for (uint32_t i = 0; i < gpu->frame_count; i++)
 	{
-		VkImageView attachments[2] = { gpu->frames[i].view, gpu->depth_stencil_view };
+		VkImageView attachments[2] = { gpu->scene_view ? gpu->scene_view : gpu->frames[i].view, gpu->depth_stencil_view };
 
 		VkFramebufferCreateInfo frame_buffer_info =
 		{
@@ -508,8 +784,8 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 			.renderPass = gpu->render_pass,
 			.attachmentCount = _countof(attachments),
 			.pAttachments = attachments,
-			.width = surface_cap.currentExtent.width,
-			.height = surface_cap.currentExtent.height,
+			.width = gpu->frame_width,
+			.height = gpu->frame_height,
 			.layers = 1,
 		};
 		result = vkCreateFramebuffer(gpu->logical_device, &frame_buffer_info, NULL, &gpu->frames[i].frame_buffer);
@@ -543,12 +819,24 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 	//////////////////////////////////////////////////////
 	// Create a VkDescriptorPool for use during the frame
 	//////////////////////////////////////////////////////
-	VkDescriptorPoolSize descriptor_pool_sizes[1] =
+	VkDescriptorPoolSize descriptor_pool_sizes[4] =
 	{
 		{
 			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
 			.descriptorCount = 512,
-		}
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+			.descriptorCount = 64,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 64,
+		},
+		{
+			.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.descriptorCount = 64,
+		},
 	};
 	VkDescriptorPoolCreateInfo descriptor_pool_info =
 	{
@@ -565,6 +853,27 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 		goto fail;
 	}
 
+	//////////////////////////////////////////////////////
+	// Create the VkSampler textures are read through
+	//////////////////////////////////////////////////////
+	VkSamplerCreateInfo sampler_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.maxLod = VK_LOD_CLAMP_NONE,
+	};
+	result = vkCreateSampler(gpu->logical_device, &sampler_info, NULL, &gpu->texture_sampler);
+	if (result)
+	{
+		function = "vkCreateSampler";
+		goto fail;
+	}
+
 	//////////////////////////////////////////////////////
 	// Create a VkCommandPool for use during the frame
 	//////////////////////////////////////////////////////
@@ -581,6 +890,39 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 		goto fail;
 	}
 
+	if (gpu->compute_queue)
+	{
+		VkCommandPoolCreateInfo compute_pool_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+			.queueFamilyIndex = gpu->compute_queue_family_index,
+			.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+		};
+		result = vkCreateCommandPool(gpu->logical_device, &compute_pool_info, NULL, &gpu->compute_pool);
+		if (result)
+		{
+			function = "vkCreateCommandPool";
+			goto fail;
+		}
+
+		VkSemaphoreTypeCreateInfo timeline_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+			.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		};
+		VkSemaphoreCreateInfo timeline_semaphore_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+			.pNext = &timeline_info,
+		};
+		result = vkCreateSemaphore(gpu->logical_device, &timeline_semaphore_info, NULL, &gpu->compute_timeline);
+		if (result)
+		{
+			function = "vkCreateSemaphore";
+			goto fail;
+		}
+	}
+
 	//////////////////////////////////////////////////////
 	// Create VkCommandBuffer objects for each frame
 	//////////////////////////////////////////////////////
@@ -603,6 +945,14 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 			goto fail;
 		}
 
+		alloc_info.commandPool = gpu->compute_pool ? gpu->compute_pool : gpu->cmd_pool;
+		result = vkAllocateCommandBuffers(gpu->logical_device, &alloc_info, &gpu->frames[i].compute_cmd_buffer);
+		if (result)
+		{
+			function = "vkAllocateCommandBuffers";
+			goto fail;
+		}
+
 		VkFenceCreateInfo fence_info =
 		{
 			.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
@@ -614,9 +964,134 @@ gpu_t* gpu_create(heap_t* heap, wm_window_t* window)
 			function = "vkCreateFence";
 			goto fail;
 		}
+
+		//sets are only ever reset together, so the pool needn't track individual frees
+		VkDescriptorPoolSize frame_pool_sizes[4] =
+		{
+			{
+				.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				.descriptorCount = k_gpu_frame_descriptor_max,
+			},
+			{
+				.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+				.descriptorCount = k_gpu_frame_descriptor_max,
+			},
+			{
+				.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				.descriptorCount = k_gpu_frame_descriptor_max * 4,
+			},
+			{
+				.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				.descriptorCount = k_gpu_frame_descriptor_max,
+			},
+		};
+		VkDescriptorPoolCreateInfo frame_pool_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+			.poolSizeCount = _countof(frame_pool_sizes),
+			.pPoolSizes = frame_pool_sizes,
+			.maxSets = k_gpu_frame_descriptor_max,
+		};
+		result = vkCreateDescriptorPool(gpu->logical_device, &frame_pool_info, NULL, &gpu->frames[i].descriptor_pool);
+		if (result)
+		{
+			function = "vkCreateDescriptorPool";
+			goto fail;
+		}
 	}
 
+	//////////////////////////////////////////////////////
+	// Create upload VkCommandBuffer objects for each frame
+	//////////////////////////////////////////////////////
+	VkCommandPoolCreateInfo upload_pool_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.queueFamilyIndex = transfer_queue_family_index,
+		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+	};
+	result = vkCreateCommandPool(gpu->logical_device, &upload_pool_info, NULL, &gpu->upload_pool);
+	if (result)
+	{
+		function = "vkCreateCommandPool";
+		goto fail;
+	}
+
+	for (uint32_t i = 0; i < gpu->frame_count; i++)
+	{
+		VkCommandBufferAllocateInfo alloc_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = gpu->upload_pool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1,
+		};
+		result = vkAllocateCommandBuffers(gpu->logical_device, &alloc_info, &gpu->frames[i].upload_cmd_buffer);
+		if (result)
+		{
+			function = "vkAllocateCommandBuffers";
+			goto fail;
+		}
+
+		result = vkCreateSemaphore(gpu->logical_device, &semaphore_info, NULL, &gpu->frames[i].upload_complete_sema);
+		if (result)
+		{
+			function = "vkCreateSemaphore";
+			goto fail;
+		}
+	}
+
+	//////////////////////////////////////////////////////
+	// Create secondary VkCommandBuffer objects for each recording thread
+	//////////////////////////////////////////////////////
+	for (int r = 0; r < k_gpu_max_recorders; r++)
+	{
+		result = vkCreateCommandPool(gpu->logical_device, &cmd_pool_info, NULL, &gpu->recorder_pools[r]);
+		if (result)
+		{
+			function = "vkCreateCommandPool";
+			goto fail;
+		}
+
+		for (uint32_t i = 0; i < gpu->frame_count; i++)
+		{
+			VkCommandBufferAllocateInfo alloc_info =
+			{
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+				.commandPool = gpu->recorder_pools[r],
+				.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+				.commandBufferCount = 1,
+			};
+			result = vkAllocateCommandBuffers(gpu->logical_device, &alloc_info, &gpu->frames[i].recorders[r].buffer);
+			if (result)
+			{
+				function = "vkAllocateCommandBuffers";
+				goto fail;
+			}
+		}
+	}
+
+	//////////////////////////////////////////////////////
+	// Create the uniform ring
+	//////////////////////////////////////////////////////
+	VkPhysicalDeviceProperties device_properties;
+	vkGetPhysicalDeviceProperties(gpu->physical_device, &device_properties);
+	gpu->uniform_ring_alignment = __max(device_properties.limits.minUniformBufferOffsetAlignment, 16);
+
+	//padded so a full range read at the end of the last region stays inside the buffer
+	VkDeviceSize uniform_ring_size = (VkDeviceSize)k_gpu_uniform_ring_size * gpu->frame_count + k_gpu_uniform_ring_range;
+	result = create_host_buffer(gpu, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, uniform_ring_size, &gpu->uniform_ring_buffer, &gpu->uniform_ring_memory, &function);
+	if (result)
+	{
+		goto fail;
+	}
+	gpu->uniform_ring_data = gpu->uniform_ring_memory.block->data + gpu->uniform_ring_memory.offset;
+	gpu->uniform_ring_descriptor.buffer = gpu->uniform_ring_buffer;
+	gpu->uniform_ring_descriptor.range = k_gpu_uniform_ring_range;
+
+	create_pipeline_cache(gpu, &device_properties);
+
 	create_mesh_layouts(gpu);
+	create_timestamp_queries(gpu, queue_families[queue_family_index].timestampValidBits);
 
 	return gpu;
 
@@ -645,6 +1120,18 @@ void gpu_destroy(gpu_t* gpu)
 	{
 		vkDestroySemaphore(gpu->logical_device, gpu->present_complete_sema, NULL);
 	}
+	if (gpu && gpu->scene_view)
+	{
+		vkDestroyImageView(gpu->logical_device, gpu->scene_view, NULL);
+	}
+	if (gpu && gpu->scene_image)
+	{
+		vkDestroyImage(gpu->logical_device, gpu->scene_image, NULL);
+	}
+	if (gpu && gpu->scene_memory)
+	{
+		vkFreeMemory(gpu->logical_device, gpu->scene_memory, NULL);
+	}
 	if (gpu && gpu->depth_stencil_view)
 	{
 		vkDestroyImageView(gpu->logical_device, gpu->depth_stencil_view, NULL);
@@ -653,9 +1140,9 @@ void gpu_destroy(gpu_t* gpu)
 	{
 		vkDestroyImage(gpu->logical_device, gpu->depth_stencil_image, NULL);
 	}
-	if (gpu && gpu->depth_stencil_memory)
+	if (gpu && gpu->transient_memory)
 	{
-		vkFreeMemory(gpu->logical_device, gpu->depth_stencil_memory, NULL);
+		vkFreeMemory(gpu->logical_device, gpu->transient_memory, NULL);
 	}
 	if (gpu && gpu->frames)
 	{
@@ -665,6 +1152,15 @@ void gpu_destroy(gpu_t* gpu)
 			{
 				vkDestroyFence(gpu->logical_device, gpu->frames[i].fence, NULL);
 			}
+			if (gpu->frames[i].upload_complete_sema)
+			{
+				vkDestroySemaphore(gpu->logical_device, gpu->frames[i].upload_complete_sema, NULL);
+			}
+			free_staging_buffers(gpu, &gpu->frames[i], gpu->frames[i].staging_count);
+			if (gpu->frames[i].compute_cmd_buffer)
+			{
+				vkFreeCommandBuffers(gpu->logical_device, gpu->compute_pool ? gpu->compute_pool : gpu->cmd_pool, 1, &gpu->frames[i].compute_cmd_buffer);
+			}
 			if (gpu->frames[i].cmd_buffer)
 			{
 				vkFreeCommandBuffers(gpu->logical_device, gpu->cmd_pool, 1, &gpu->frames[i].cmd_buffer->buffer);
@@ -678,9 +1174,47 @@ void gpu_destroy(gpu_t* gpu)
 			{
 				vkDestroyImageView(gpu->logical_device, gpu->frames[i].view, NULL);
 			}
+			if (gpu->frames[i].image_memory)
+			{
+				vkDestroyImage(gpu->logical_device, gpu->frames[i].image, NULL);
+				vkFreeMemory(gpu->logical_device, gpu->frames[i].image_memory, NULL);
+			}
+			if (gpu->frames[i].readback_buffer)
+			{
+				vkDestroyBuffer(gpu->logical_device, gpu->frames[i].readback_buffer, NULL);
+			}
+			if (gpu->frames[i].readback_memory.block)
+			{
+				memory_free(gpu, &gpu->frames[i].readback_memory);
+			}
+			if (gpu->frames[i].descriptor_pool)
+			{
+				vkDestroyDescriptorPool(gpu->logical_device, gpu->frames[i].descriptor_pool, NULL);
+			}
 		}
 		heap_free(gpu->heap, gpu->frames);
 	}
+	if (gpu && gpu->uniform_ring_buffer)
+	{
+		vkDestroyBuffer(gpu->logical_device, gpu->uniform_ring_buffer, NULL);
+	}
+	if (gpu && gpu->uniform_ring_memory.block)
+	{
+		memory_free(gpu, &gpu->uniform_ring_memory);
+	}
+	if (gpu && gpu->timestamp_pool)
+	{
+		vkDestroyQueryPool(gpu->logical_device, gpu->timestamp_pool, NULL);
+	}
+	if (gpu && gpu->pipeline_cache)
+	{
+		save_pipeline_cache(gpu);
+		vkDestroyPipelineCache(gpu->logical_device, gpu->pipeline_cache, NULL);
+	}
+	if (gpu && gpu->texture_sampler)
+	{
+		vkDestroySampler(gpu->logical_device, gpu->texture_sampler, NULL);
+	}
 	if (gpu && gpu->descriptor_pool)
 	{
 		vkDestroyDescriptorPool(gpu->logical_device, gpu->descriptor_pool, NULL);
@@ -689,10 +1223,34 @@ void gpu_destroy(gpu_t* gpu)
 	{
 		vkDestroyCommandPool(gpu->logical_device, gpu->cmd_pool, NULL);
 	}
+	if (gpu && gpu->upload_pool)
+	{
+		vkDestroyCommandPool(gpu->logical_device, gpu->upload_pool, NULL);
+	}
+	if (gpu && gpu->compute_pool)
+	{
+		vkDestroyCommandPool(gpu->logical_device, gpu->compute_pool, NULL);
+	}
+	if (gpu && gpu->compute_timeline)
+	{
+		vkDestroySemaphore(gpu->logical_device, gpu->compute_timeline, NULL);
+	}
+	for (int r = 0; gpu && r < k_gpu_max_recorders; r++)
+	{
+		//destroying a pool frees its command buffers
+		if (gpu->recorder_pools[r])
+		{
+			vkDestroyCommandPool(gpu->logical_device, gpu->recorder_pools[r], NULL);
+		}
+	}
 	if (gpu && gpu->render_pass)
 	{
 		vkDestroyRenderPass(gpu->logical_device, gpu->render_pass, NULL);
 	}
+	if (gpu && gpu->frame_graph)
+	{
+		frame_graph_destroy(gpu->frame_graph);
+	}
 	if (gpu && gpu->swap_chain)
 	{
 		vkDestroySwapchainKHR(gpu->logical_device, gpu->swap_chain, NULL);
@@ -701,6 +1259,19 @@ void gpu_destroy(gpu_t* gpu)
 	{
 		vkDestroySurfaceKHR(gpu->instance, gpu->surface, NULL);
 	}
+	for (int i = 0; gpu && i < VK_MAX_MEMORY_TYPES; i++)
+	{
+		//blocks are freed as they empty, so any left hold leaked buffers
+		while (gpu->memory_blocks[i])
+		{
+			gpu_memory_block_t* block = gpu->memory_blocks[i];
+			debug_print(k_print_warning, "GPU memory leak of %llu bytes in memory type %d.\n", block->used, i);
+			gpu->memory_blocks[i] = block->next;
+			vkFreeMemory(gpu->logical_device, block->memory, NULL);
+			heap_free(gpu->heap, block->free_ranges);
+			heap_free(gpu->heap, block);
+		}
+	}
 	if (gpu && gpu->logical_device)
 	{
 		vkDestroyDevice(gpu->logical_device, NULL);
@@ -745,22 +1316,82 @@ gpu_descriptor_t* gpu_descriptor_create(gpu_t* gpu, const gpu_descriptor_info_t*
 		return NULL;
 	}
 
-	VkWriteDescriptorSet* write_sets = alloca(sizeof(VkWriteDescriptorSet) * info->uniform_buffer_count);
+	write_descriptor(gpu, descriptor, info);
+	return descriptor;
+}
+
+gpu_descriptor_t* gpu_frame_descriptor_create(gpu_t* gpu, const gpu_descriptor_info_t* info)
+{
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (frame->descriptor_count >= k_gpu_frame_descriptor_max)
+	{
+		debug_print(k_print_error, "Frame descriptors exhausted: %d in use\n", frame->descriptor_count);
+		return NULL;
+	}
+
+	gpu_descriptor_t* descriptor = &frame->descriptors[frame->descriptor_count];
+	VkDescriptorSetAllocateInfo alloc_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = frame->descriptor_pool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &info->shader->descriptor_set_layout,
+	};
+	VkResult result = vkAllocateDescriptorSets(gpu->logical_device, &alloc_info, &descriptor->set);
+	if (result)
+	{
+		debug_print(k_print_error, "vkAllocateDescriptorSets failed: %d\n", result);
+		return NULL;
+	}
+	frame->descriptor_count++;
+
+	write_descriptor(gpu, descriptor, info);
+	return descriptor;
+}
+
+static void write_descriptor(gpu_t* gpu, gpu_descriptor_t* descriptor, const gpu_descriptor_info_t* info)
+{
+	int buffer_count = info->uniform_buffer_count + info->storage_buffer_count;
+	int write_count = buffer_count + info->texture_count;
+	VkWriteDescriptorSet* write_sets = alloca(sizeof(VkWriteDescriptorSet) * write_count);
 	for (int i = 0; i < info->uniform_buffer_count; ++i)
 	{
+		bool ring = info->shader->uniform_ring;
 		write_sets[i] = (VkWriteDescriptorSet)
 		{
 			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
 			.dstSet = descriptor->set,
 			.descriptorCount = 1,
-			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-			.pBufferInfo = &info->uniform_buffers[i]->descriptor,
+			.descriptorType = ring ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.pBufferInfo = ring && !info->uniform_buffers ? &gpu->uniform_ring_descriptor : &info->uniform_buffers[i]->descriptor,
 			.dstBinding = i,
 		};
 	}
-	vkUpdateDescriptorSets(gpu->logical_device, info->uniform_buffer_count, write_sets, 0, NULL);
-
-	return descriptor;
+	for (int i = 0; i < info->storage_buffer_count; ++i)
+	{
+		write_sets[info->uniform_buffer_count + i] = (VkWriteDescriptorSet)
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptor->set,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.pBufferInfo = &info->storage_buffers[i]->descriptor,
+			.dstBinding = info->uniform_buffer_count + i,
+		};
+	}
+	for (int i = 0; i < info->texture_count; ++i)
+	{
+		write_sets[buffer_count + i] = (VkWriteDescriptorSet)
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = descriptor->set,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+			.pImageInfo = &info->textures[i]->descriptor,
+			.dstBinding = buffer_count + i,
+		};
+	}
+	vkUpdateDescriptorSets(gpu->logical_device, write_count, write_sets, 0, NULL);
 }
 
 void gpu_descriptor_destroy(gpu_t* gpu, gpu_descriptor_t* descriptor)
@@ -784,132 +1415,48 @@ gpu_mesh_t* gpu_mesh_create(gpu_t* gpu, const gpu_mesh_info_t* info)
 	mesh->index_count = (int)info->index_data_size / gpu->mesh_index_size[info->layout];
 	mesh->vertex_count = (int)info->vertex_data_size / gpu->mesh_vertex_size[info->layout];
 
-	// Vertex data
+	const char* function = NULL;
+	VkResult result = create_device_buffer(gpu, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, info->vertex_data, info->vertex_data_size, &mesh->vertex_buffer, &mesh->vertex_memory, &function);
+	if (result)
 	{
-		VkBufferCreateInfo vertex_buffer_info =
-		{
-			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size = info->vertex_data_size,
-			.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-		};
-		VkResult result = vkCreateBuffer(gpu->logical_device, &vertex_buffer_info, NULL, &mesh->vertex_buffer);
-		if (result)
-		{
-			debug_print(k_print_error, "vkCreateBuffer failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
-
-		VkMemoryRequirements mem_reqs;
-		vkGetBufferMemoryRequirements(gpu->logical_device, mesh->vertex_buffer, &mem_reqs);
-
-		VkMemoryAllocateInfo mem_alloc =
-		{
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = mem_reqs.size,
-			.memoryTypeIndex = get_memory_type_index(gpu, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-		};
-		result = vkAllocateMemory(gpu->logical_device, &mem_alloc, NULL, &mesh->vertex_memory);
-		if (result)
-		{
-			debug_print(k_print_error, "vkAllocateMemory failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
-
-		void* vertex_dest = NULL;
-		result = vkMapMemory(gpu->logical_device, mesh->vertex_memory, 0, mem_alloc.allocationSize, 0, &vertex_dest);
-		if (result)
-		{
-			debug_print(k_print_error, "vkMapMemory failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
-		memcpy(vertex_dest, info->vertex_data, info->vertex_data_size);
-		vkUnmapMemory(gpu->logical_device, mesh->vertex_memory);
-
-		result = vkBindBufferMemory(gpu->logical_device, mesh->vertex_buffer, mesh->vertex_memory, 0);
-		if (result)
-		{
-			debug_print(k_print_error, "vkBindBufferMemory failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
+		debug_print(k_print_error, "%s failed: %d\n", function, result);
+		gpu_mesh_destroy(gpu, mesh);
+		return NULL;
 	}
 
-	// Index data
+	result = create_device_buffer(gpu, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, info->index_data, info->index_data_size, &mesh->index_buffer, &mesh->index_memory, &function);
+	if (result)
 	{
-		VkBufferCreateInfo index_buffer_info =
-		{
-			.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-			.size = info->index_data_size,
-			.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		};
-		VkResult result = vkCreateBuffer(gpu->logical_device, &index_buffer_info, NULL, &mesh->index_buffer);
-		if (result)
-		{
-			debug_print(k_print_error, "vkCreateBuffer failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
-
-		VkMemoryRequirements mem_reqs;
-		vkGetBufferMemoryRequirements(gpu->logical_device, mesh->index_buffer, &mem_reqs);
-
-		VkMemoryAllocateInfo mem_alloc =
-		{
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = mem_reqs.size,
-			.memoryTypeIndex = get_memory_type_index(gpu, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-		};
-		result = vkAllocateMemory(gpu->logical_device, &mem_alloc, NULL, &mesh->index_memory);
-		if (result)
-		{
-			debug_print(k_print_error, "vkAllocateMemory failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
-
-		void* index_dest = NULL;
-		result = vkMapMemory(gpu->logical_device, mesh->index_memory, 0, mem_alloc.allocationSize, 0, &index_dest);
-		if (result)
-		{
-			debug_print(k_print_error, "vkMapMemory failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
-		memcpy(index_dest, info->index_data, info->index_data_size);
-		vkUnmapMemory(gpu->logical_device, mesh->index_memory);
-
-		result = vkBindBufferMemory(gpu->logical_device, mesh->index_buffer, mesh->index_memory, 0);
-		if (result)
-		{
-			debug_print(k_print_error, "vkBindBufferMemory failed: %d\n", result);
-			gpu_mesh_destroy(gpu, mesh);
-			return NULL;
-		}
+		debug_print(k_print_error, "%s failed: %d\n", function, result);
+		gpu_mesh_destroy(gpu, mesh);
+		return NULL;
 	}
 
 	return mesh;
 }
 
+int gpu_mesh_get_index_count(gpu_mesh_t* mesh)
+{
+	return mesh->index_count;
+}
+
 void gpu_mesh_destroy(gpu_t* gpu, gpu_mesh_t* mesh)
 {
 	if (mesh && mesh->index_buffer)
 	{
 		vkDestroyBuffer(gpu->logical_device, mesh->index_buffer, NULL);
 	}
-	if (mesh && mesh->index_memory)
+	if (mesh && mesh->index_memory.block)
 	{
-		vkFreeMemory(gpu->logical_device, mesh->index_memory, NULL);
+		memory_free(gpu, &mesh->index_memory);
 	}
 	if (mesh && mesh->vertex_buffer)
 	{
 		vkDestroyBuffer(gpu->logical_device, mesh->vertex_buffer, NULL);
 	}
-	if (mesh && mesh->vertex_memory)
+	if (mesh && mesh->vertex_memory.block)
 	{
-		vkFreeMemory(gpu->logical_device, mesh->vertex_memory, NULL);
+		memory_free(gpu, &mesh->vertex_memory);
 	}
 	if (mesh)
 	{
@@ -919,6 +1466,12 @@ void gpu_mesh_destroy(gpu_t* gpu, gpu_mesh_t* mesh)
 
 gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info)
 {
+	if (info->specialization_count < 0 || info->specialization_count > k_gpu_specialization_max)
+	{
+		debug_print(k_print_error, "Pipeline has %d specialization constants, more than %d\n", info->specialization_count, k_gpu_specialization_max);
+		return NULL;
+	}
+
 	gpu_pipeline_t* pipeline = heap_alloc(gpu->heap, sizeof(gpu_pipeline_t), 8);
 	memset(pipeline, 0, sizeof(*pipeline));
 
@@ -972,6 +1525,26 @@ gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info)
 		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
 	};
 
+	//constant i takes the i-th value, packed one after another
+	VkSpecializationMapEntry specialization_entries[k_gpu_specialization_max];
+	for (int i = 0; i < info->specialization_count; ++i)
+	{
+		specialization_entries[i] = (VkSpecializationMapEntry)
+		{
+			.constantID = i,
+			.offset = i * sizeof(uint32_t),
+			.size = sizeof(uint32_t),
+		};
+	}
+	VkSpecializationInfo specialization_info =
+	{
+		.mapEntryCount = info->specialization_count,
+		.pMapEntries = specialization_entries,
+		.dataSize = info->specialization_count * sizeof(uint32_t),
+		.pData = info->specialization,
+	};
+	const VkSpecializationInfo* specialization = info->specialization_count ? &specialization_info : NULL;
+
 	VkPipelineShaderStageCreateInfo shader_info[2] =
 	{
 		{
@@ -979,12 +1552,14 @@ gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info)
 			.stage = VK_SHADER_STAGE_VERTEX_BIT,
 			.module = info->shader->vertex_module,
 			.pName = "main",
+			.pSpecializationInfo = specialization,
 		},
 		{
 			.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 			.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
 			.module = info->shader->fragment_module,
 			.pName = "main",
+			.pSpecializationInfo = specialization,
 		},
 	};
 
@@ -1000,11 +1575,19 @@ gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info)
 		.pDynamicStates = dynamic_states,
 	};
 
+	//push constants are visible to every stage so a shader's programs can split them however they like
+	VkPushConstantRange push_constant_range =
+	{
+		.stageFlags = info->shader->compute_module ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+		.size = info->shader->push_constant_size,
+	};
 	VkPipelineLayoutCreateInfo pipeline_layout_info =
 	{
 		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 		.setLayoutCount = 1,
 		.pSetLayouts = &info->shader->descriptor_set_layout,
+		.pushConstantRangeCount = push_constant_range.size ? 1 : 0,
+		.pPushConstantRanges = &push_constant_range,
 	};
 	VkResult result = vkCreatePipelineLayout(gpu->logical_device, &pipeline_layout_info, NULL, &pipeline->pipeline_layout);
 	if (result)
@@ -1013,6 +1596,33 @@ gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info)
 		gpu_pipeline_destroy(gpu, pipeline);
 		return NULL;
 	}
+	pipeline->push_constant_stages = push_constant_range.size ? push_constant_range.stageFlags : 0;
+
+	if (info->shader->compute_module)
+	{
+		VkComputePipelineCreateInfo compute_pipeline_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+			.layout = pipeline->pipeline_layout,
+			.stage =
+			{
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+				.module = info->shader->compute_module,
+				.pName = "main",
+				.pSpecializationInfo = specialization,
+			},
+		};
+		result = vkCreateComputePipelines(gpu->logical_device, gpu->pipeline_cache, 1, &compute_pipeline_info, NULL, &pipeline->pipe);
+		if (result)
+		{
+			debug_print(k_print_error, "vkCreateComputePipelines failed: %d\n", result);
+			gpu_pipeline_destroy(gpu, pipeline);
+			return NULL;
+		}
+		pipeline->bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
+		return pipeline;
+	}
 
 	VkGraphicsPipelineCreateInfo pipeline_info =
 	{
@@ -1030,13 +1640,14 @@ gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info)
 		.pDepthStencilState = &depth_stencil_info,
 		.pDynamicState = &dynamic_info,
 	};
-	result = vkCreateGraphicsPipelines(gpu->logical_device, NULL, 1, &pipeline_info, NULL, &pipeline->pipe);
+	result = vkCreateGraphicsPipelines(gpu->logical_device, gpu->pipeline_cache, 1, &pipeline_info, NULL, &pipeline->pipe);
 	if (result)
 	{
 		debug_print(k_print_error, "vkCreateGraphicsPipelines failed: %d\n", result);
 		gpu_pipeline_destroy(gpu, pipeline);
 		return NULL;
 	}
+	pipeline->bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
 
 	return pipeline;
 }
@@ -1057,55 +1668,136 @@ void gpu_pipeline_destroy(gpu_t* gpu, gpu_pipeline_t* pipeline)
 	}
 }
 
-gpu_shader_t* gpu_shader_create(gpu_t* gpu, const gpu_shader_info_t* info)
+gpu_pipeline_t* gpu_pipeline_get(gpu_t* gpu, const gpu_pipeline_info_t* info)
 {
-	gpu_shader_t* shader = heap_alloc(gpu->heap, sizeof(gpu_shader_t), 8);
-	memset(shader, 0, sizeof(*shader));
-
-	VkShaderModuleCreateInfo vertex_module_info =
+	gpu_shader_t* shader = info->shader;
+	lock_acquire(&shader->variant_lock);
+	gpu_pipeline_t* pipeline = find_variant(shader, info);
+	lock_release(&shader->variant_lock);
+	if (pipeline)
 	{
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = info->vertex_shader_size,
-		.pCode = info->vertex_shader_data,
-	};
-	VkResult result = vkCreateShaderModule(gpu->logical_device, &vertex_module_info, NULL, &shader->vertex_module);
-	if (result)
+		return pipeline;
+	}
+
+	//compile without the lock, so getting other variants doesn't wait on this one
+	pipeline = gpu_pipeline_create(gpu, info);
+	if (!pipeline)
 	{
-		debug_print(k_print_error, "vkCreateShaderModule failed: %d\n", result);
-		gpu_shader_destroy(gpu, shader);
 		return NULL;
 	}
+	pipeline->mesh_layout = info->mesh_layout;
+	pipeline->specialization_count = info->specialization_count;
+	memcpy(pipeline->specialization, info->specialization, info->specialization_count * sizeof(uint32_t));
 
-	VkShaderModuleCreateInfo fragment_module_info =
+	//another thread may have created the same variant meanwhile; keep the one already in the list
+	lock_acquire(&shader->variant_lock);
+	gpu_pipeline_t* existing = find_variant(shader, info);
+	if (!existing)
 	{
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = info->fragment_shader_size,
-		.pCode = info->fragment_shader_data,
-	};
-	result = vkCreateShaderModule(gpu->logical_device, &fragment_module_info, NULL, &shader->fragment_module);
-	if (result)
+		pipeline->next_variant = shader->variants;
+		shader->variants = pipeline;
+	}
+	lock_release(&shader->variant_lock);
+	if (existing)
 	{
-		debug_print(k_print_error, "vkCreateShaderModule failed: %d\n", result);
-		gpu_shader_destroy(gpu, shader);
-		return NULL;
+		gpu_pipeline_destroy(gpu, pipeline);
+		return existing;
 	}
+	return pipeline;
+}
 
-	VkDescriptorSetLayoutBinding* descriptor_set_layout_bindings = alloca(sizeof(VkDescriptorSetLayoutBinding) * info->uniform_buffer_count);
-	for (int i = 0; i < info->uniform_buffer_count; ++i)
+gpu_shader_t* gpu_shader_create(gpu_t* gpu, const gpu_shader_info_t* info)
+{
+	gpu_shader_t* shader = heap_alloc(gpu->heap, sizeof(gpu_shader_t), 8);
+	memset(shader, 0, sizeof(*shader));
+	lock_init_named(&shader->variant_lock, "gpu shader variants");
+
+	VkResult result;
+	if (info->compute_shader_data)
 	{
-		descriptor_set_layout_bindings[i] = (VkDescriptorSetLayoutBinding)
+		VkShaderModuleCreateInfo compute_module_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+			.codeSize = info->compute_shader_size,
+			.pCode = info->compute_shader_data,
+		};
+		result = vkCreateShaderModule(gpu->logical_device, &compute_module_info, NULL, &shader->compute_module);
+		if (result)
+		{
+			debug_print(k_print_error, "vkCreateShaderModule failed: %d\n", result);
+			gpu_shader_destroy(gpu, shader);
+			return NULL;
+		}
+	}
+	else
+	{
+		VkShaderModuleCreateInfo vertex_module_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+			.codeSize = info->vertex_shader_size,
+			.pCode = info->vertex_shader_data,
+		};
+		result = vkCreateShaderModule(gpu->logical_device, &vertex_module_info, NULL, &shader->vertex_module);
+		if (result)
+		{
+			debug_print(k_print_error, "vkCreateShaderModule failed: %d\n", result);
+			gpu_shader_destroy(gpu, shader);
+			return NULL;
+		}
+
+		VkShaderModuleCreateInfo fragment_module_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+			.codeSize = info->fragment_shader_size,
+			.pCode = info->fragment_shader_data,
+		};
+		result = vkCreateShaderModule(gpu->logical_device, &fragment_module_info, NULL, &shader->fragment_module);
+		if (result)
+		{
+			debug_print(k_print_error, "vkCreateShaderModule failed: %d\n", result);
+			gpu_shader_destroy(gpu, shader);
+			return NULL;
+		}
+	}
+
+	shader->uniform_ring = info->uniform_ring;
+	if (info->push_constant_size < 0 || info->push_constant_size > k_gpu_push_constant_max || info->push_constant_size % 4)
+	{
+		debug_print(k_print_error, "Push constant size %d is not a multiple of 4 up to %d bytes\n", info->push_constant_size, k_gpu_push_constant_max);
+		gpu_shader_destroy(gpu, shader);
+		return NULL;
+	}
+	shader->push_constant_size = info->push_constant_size;
+	VkDescriptorType uniform_type = info->uniform_ring ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+	int buffer_count = info->uniform_buffer_count + info->storage_buffer_count;
+	int binding_count = buffer_count + info->texture_count;
+	VkDescriptorSetLayoutBinding* descriptor_set_layout_bindings = alloca(sizeof(VkDescriptorSetLayoutBinding) * binding_count);
+	for (int i = 0; i < buffer_count; ++i)
+	{
+		descriptor_set_layout_bindings[i] = (VkDescriptorSetLayoutBinding)
+		{
+			.binding = i,
+			.descriptorType = i < info->uniform_buffer_count ? uniform_type : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+			.descriptorCount = 1,
+			.stageFlags = shader->compute_module ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+		};
+	}
+	for (int i = buffer_count; i < binding_count; ++i)
+	{
+		descriptor_set_layout_bindings[i] = (VkDescriptorSetLayoutBinding)
 		{
 			.binding = i,
-			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+			.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
 			.descriptorCount = 1,
-			.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
+			.stageFlags = shader->compute_module ? VK_SHADER_STAGE_COMPUTE_BIT : VK_SHADER_STAGE_FRAGMENT_BIT,
 		};
 	}
 
 	VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info =
 	{
 		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.bindingCount = info->uniform_buffer_count,
+		.bindingCount = binding_count,
 		.pBindings = descriptor_set_layout_bindings,
 	};
 	result = vkCreateDescriptorSetLayout(gpu->logical_device, &descriptor_set_layout_info, NULL, &shader->descriptor_set_layout);
@@ -1121,6 +1813,12 @@ gpu_shader_t* gpu_shader_create(gpu_t* gpu, const gpu_shader_info_t* info)
 
 void gpu_shader_destroy(gpu_t* gpu, gpu_shader_t* shader)
 {
+	while (shader && shader->variants)
+	{
+		gpu_pipeline_t* next = shader->variants->next_variant;
+		gpu_pipeline_destroy(gpu, shader->variants);
+		shader->variants = next;
+	}
 	if (shader && shader->vertex_module)
 	{
 		vkDestroyShaderModule(gpu->logical_device, shader->vertex_module, NULL);
@@ -1129,6 +1827,10 @@ void gpu_shader_destroy(gpu_t* gpu, gpu_shader_t* shader)
 	{
 		vkDestroyShaderModule(gpu->logical_device, shader->fragment_module, NULL);
 	}
+	if (shader && shader->compute_module)
+	{
+		vkDestroyShaderModule(gpu->logical_device, shader->compute_module, NULL);
+	}
 	if (shader && shader->descriptor_set_layout)
 	{
 		vkDestroyDescriptorSetLayout(gpu->logical_device, shader->descriptor_set_layout, NULL);
@@ -1144,73 +1846,95 @@ gpu_uniform_buffer_t* gpu_uniform_buffer_create(gpu_t* gpu, const gpu_uniform_bu
 	gpu_uniform_buffer_t* uniform_buffer = heap_alloc(gpu->heap, sizeof(gpu_uniform_buffer_t), 8);
 	memset(uniform_buffer, 0, sizeof(*uniform_buffer));
 
-	VkBufferCreateInfo buffer_info =
-	{
-		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = info->size,
-		.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-	};
-	VkResult result = vkCreateBuffer(gpu->logical_device, &buffer_info, NULL, &uniform_buffer->buffer);
+	const char* function = NULL;
+	VkResult result = create_host_buffer(gpu, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, info->size, &uniform_buffer->buffer, &uniform_buffer->memory, &function);
 	if (result)
 	{
-		debug_print(k_print_error, "vkCreateBuffer failed: %d\n", result);
+		debug_print(k_print_error, "%s failed: %d\n", function, result);
 		gpu_uniform_buffer_destroy(gpu, uniform_buffer);
 		return NULL;
 	}
 
-	VkMemoryRequirements mem_reqs;
-	vkGetBufferMemoryRequirements(gpu->logical_device, uniform_buffer->buffer, &mem_reqs);
+	uniform_buffer->descriptor.buffer = uniform_buffer->buffer;
+	uniform_buffer->descriptor.range = info->size;
+
+	gpu_uniform_buffer_update(gpu, uniform_buffer, info->data, info->size);
+
+	return uniform_buffer;
+}
+
+void gpu_uniform_buffer_update(gpu_t* gpu, gpu_uniform_buffer_t* buffer, const void* data, size_t size)
+{
+	write_host_memory(gpu, &buffer->memory, data, size);
+}
 
-	VkMemoryAllocateInfo mem_alloc =
+void gpu_uniform_buffer_destroy(gpu_t* gpu, gpu_uniform_buffer_t* buffer)
+{
+	if (buffer && buffer->buffer)
 	{
-		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-		.allocationSize = mem_reqs.size,
-		.memoryTypeIndex = get_memory_type_index(gpu, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
-	};
-	result = vkAllocateMemory(gpu->logical_device, &mem_alloc, NULL, &uniform_buffer->memory);
-	if (result)
+		vkDestroyBuffer(gpu->logical_device, buffer->buffer, NULL);
+	}
+	if (buffer && buffer->memory.block)
 	{
-		debug_print(k_print_error, "vkAllocateMemory failed: %d\n", result);
-		gpu_uniform_buffer_destroy(gpu, uniform_buffer);
-		return NULL;
+		memory_free(gpu, &buffer->memory);
+	}
+	if (buffer)
+	{
+		heap_free(gpu->heap, buffer);
+	}
+}
+
+uint32_t gpu_uniform_ring_push(gpu_t* gpu, const void* data, size_t size)
+{
+	VkDeviceSize offset = (gpu->uniform_ring_offset + gpu->uniform_ring_alignment - 1) & ~(gpu->uniform_ring_alignment - 1);
+	if (size > k_gpu_uniform_ring_range || offset + size > k_gpu_uniform_ring_size)
+	{
+		//the data is dropped and whatever is at the start of the region is drawn with instead
+		debug_print(k_print_error, "Uniform ring full: %zu bytes not pushed.\n", size);
+		return gpu->frame_index * k_gpu_uniform_ring_size;
 	}
+	gpu->uniform_ring_offset = offset + size;
+
+	VkDeviceSize ring_offset = (VkDeviceSize)gpu->frame_index * k_gpu_uniform_ring_size + offset;
+	memcpy(gpu->uniform_ring_data + ring_offset, data, size);
+	return (uint32_t)ring_offset;
+}
+
+gpu_storage_buffer_t* gpu_storage_buffer_create(gpu_t* gpu, const gpu_storage_buffer_info_t* info)
+{
+	gpu_storage_buffer_t* storage_buffer = heap_alloc(gpu->heap, sizeof(gpu_storage_buffer_t), 8);
+	memset(storage_buffer, 0, sizeof(*storage_buffer));
 
-	result = vkBindBufferMemory(gpu->logical_device, uniform_buffer->buffer, uniform_buffer->memory, 0);
+	const char* function = NULL;
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | (info->indirect ? VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT : 0);
+	VkResult result = create_host_buffer(gpu, usage, info->size, &storage_buffer->buffer, &storage_buffer->memory, &function);
 	if (result)
 	{
-		debug_print(k_print_error, "vkBindBufferMemory failed: %d\n", result);
-		gpu_uniform_buffer_destroy(gpu, uniform_buffer);
+		debug_print(k_print_error, "%s failed: %d\n", function, result);
+		gpu_storage_buffer_destroy(gpu, storage_buffer);
 		return NULL;
 	}
 
-	uniform_buffer->descriptor.buffer = uniform_buffer->buffer;
-	uniform_buffer->descriptor.range = info->size;
-
-	gpu_uniform_buffer_update(gpu, uniform_buffer, info->data, info->size);
+	storage_buffer->descriptor.buffer = storage_buffer->buffer;
+	storage_buffer->descriptor.range = info->size;
 
-	return uniform_buffer;
+	return storage_buffer;
 }
 
-void gpu_uniform_buffer_update(gpu_t* gpu, gpu_uniform_buffer_t* buffer, const void* data, size_t size)
+void gpu_storage_buffer_update(gpu_t* gpu, gpu_storage_buffer_t* buffer, size_t offset, const void* data, size_t size)
 {
-	void* dest = NULL;
-	VkResult result = vkMapMemory(gpu->logical_device, buffer->memory, 0, size, 0, &dest);
-	if (!result)
-	{
-		memcpy(dest, data, size);
-		vkUnmapMemory(gpu->logical_device, buffer->memory);
-	}
+	memcpy(buffer->memory.block->data + buffer->memory.offset + offset, data, size);
 }
 
-void gpu_uniform_buffer_destroy(gpu_t* gpu, gpu_uniform_buffer_t* buffer)
+void gpu_storage_buffer_destroy(gpu_t* gpu, gpu_storage_buffer_t* buffer)
 {
 	if (buffer && buffer->buffer)
 	{
 		vkDestroyBuffer(gpu->logical_device, buffer->buffer, NULL);
 	}
-	if (buffer && buffer->memory)
+	if (buffer && buffer->memory.block)
 	{
-		vkFreeMemory(gpu->logical_device, buffer->memory, NULL);
+		memory_free(gpu, &buffer->memory);
 	}
 	if (buffer)
 	{
@@ -1218,21 +1942,162 @@ void gpu_uniform_buffer_destroy(gpu_t* gpu, gpu_uniform_buffer_t* buffer)
 	}
 }
 
+gpu_texture_t* gpu_texture_create(gpu_t* gpu, const gpu_texture_info_t* info)
+{
+	if (!gpu->texture_compression_bc)
+	{
+		debug_print(k_print_error, "Textures need a device that samples BC formats\n");
+		return NULL;
+	}
+
+	//sRGB formats, since textures hold color
+	static const VkFormat k_formats[k_gpu_texture_format_count] =
+	{
+		[k_gpu_texture_format_bc1] = VK_FORMAT_BC1_RGBA_SRGB_BLOCK,
+		[k_gpu_texture_format_bc3] = VK_FORMAT_BC3_SRGB_BLOCK,
+		[k_gpu_texture_format_bc7] = VK_FORMAT_BC7_SRGB_BLOCK,
+	};
+
+	gpu_texture_t* texture = heap_alloc(gpu->heap, sizeof(gpu_texture_t), 8);
+	memset(texture, 0, sizeof(*texture));
+	texture->format = info->format;
+	texture->vk_format = k_formats[info->format];
+	texture->width = info->width;
+	texture->height = info->height;
+	texture->mip_count = info->mip_count;
+	texture->descriptor.sampler = gpu->texture_sampler;
+	texture->descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	const char* function = NULL;
+	VkResult result = create_texture_image(gpu, texture, info->first_mip, info->data, info->data_size, &function);
+	if (result)
+	{
+		debug_print(k_print_error, "%s failed: %d\n", function, result);
+		gpu_texture_destroy(gpu, texture);
+		return NULL;
+	}
+	return texture;
+}
+
+bool gpu_texture_set_mips(gpu_t* gpu, gpu_texture_t* texture, int first_mip, const void* data, size_t size)
+{
+	const char* function = NULL;
+	VkResult result = create_texture_image(gpu, texture, first_mip, data, size, &function);
+	if (result)
+	{
+		debug_print(k_print_error, "%s failed: %d\n", function, result);
+		return false;
+	}
+	return true;
+}
+
+int gpu_texture_get_first_mip(gpu_texture_t* texture)
+{
+	return texture->first_mip;
+}
+
+void gpu_texture_destroy(gpu_t* gpu, gpu_texture_t* texture)
+{
+	if (texture && texture->view)
+	{
+		vkDestroyImageView(gpu->logical_device, texture->view, NULL);
+	}
+	if (texture && texture->image)
+	{
+		vkDestroyImage(gpu->logical_device, texture->image, NULL);
+	}
+	if (texture && texture->memory)
+	{
+		vkFreeMemory(gpu->logical_device, texture->memory, NULL);
+	}
+	if (texture)
+	{
+		heap_free(gpu->heap, texture);
+	}
+}
+
+size_t gpu_texture_get_mip_size(gpu_texture_format_t format, int width, int height, int mip)
+{
+	size_t block_size = format == k_gpu_texture_format_bc1 ? 8 : 16;
+	size_t blocks_wide = (__max(width >> mip, 1) + 3) / 4;
+	size_t blocks_high = (__max(height >> mip, 1) + 3) / 4;
+	return blocks_wide * blocks_high * block_size;
+}
+
 gpu_cmd_buffer_t* gpu_frame_begin(gpu_t* gpu)
+{
+	gpu_frame_options_t options = { 0 };
+	return gpu_frame_begin_with_options(gpu, &options);
+}
+
+gpu_cmd_buffer_t* gpu_frame_begin_with_options(gpu_t* gpu, const gpu_frame_options_t* options)
 {
 	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
 
+	//command buffers are rerecorded, so the frame this slot last submitted must have finished
+	TRACE_ZONE_BEGIN(k_trace_category_render, "vkWaitForFences");
+	VkResult result = vkWaitForFences(gpu->logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+	TRACE_ZONE_END(k_trace_category_render);
+	if (result)
+	{
+		debug_print(k_print_error, "vkWaitForFences failed: %d\n", result);
+	}
+
+	//which also means its timestamps can be read, its staging buffers freed and its region of the uniform ring reused
+	emit_timestamps(gpu, frame);
+	free_staging_buffers(gpu, frame, frame->submitted_staging_count);
+	gpu->uniform_ring_offset = 0;
+	result = vkResetDescriptorPool(gpu->logical_device, frame->descriptor_pool, 0);
+	if (result)
+	{
+		debug_print(k_print_error, "vkResetDescriptorPool failed: %d\n", result);
+	}
+	frame->descriptor_count = 0;
+	result = vkResetFences(gpu->logical_device, 1, &frame->fence);
+	if (result)
+	{
+		debug_print(k_print_error, "vkResetFences failed: %d\n", result);
+	}
+
+	//outside FIFO the presentation engine may hand images back in any order, so the frame draws into whichever it gets
+	if (gpu->swap_chain)
+	{
+		TRACE_ZONE_BEGIN(k_trace_category_render, "vkAcquireNextImageKHR");
+		result = vkAcquireNextImageKHR(gpu->logical_device, gpu->swap_chain, UINT64_MAX, gpu->present_complete_sema, VK_NULL_HANDLE, &gpu->image_index);
+		TRACE_ZONE_END(k_trace_category_render);
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+		{
+			debug_print(k_print_error, "vkAcquireNextImageKHR failed: %d\n", result);
+		}
+	}
+	else
+	{
+		gpu->image_index = gpu->frame_index;
+	}
+
 	VkCommandBufferBeginInfo begin_info =
 	{
 		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 	};
-	VkResult result = vkBeginCommandBuffer(frame->cmd_buffer->buffer, &begin_info);
+	result = vkBeginCommandBuffer(frame->cmd_buffer->buffer, &begin_info);
 	if (result)
 	{
 		debug_print(k_print_error, "vkBeginCommandBuffer failed: %d\n", result);
 		return NULL;
 	}
 
+	//queries must be reset outside a render pass
+	frame->timestamp_count = 0;
+	if (gpu->timestamp_pool)
+	{
+		vkCmdResetQueryPool(frame->cmd_buffer->buffer, gpu->timestamp_pool, gpu->frame_index * k_gpu_max_timestamps, k_gpu_max_timestamps);
+		write_timestamp(gpu, frame, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT);
+	}
+
+	//the scale holds for the whole frame, so what is drawn and what is blitted agree
+	gpu->render_width = __min(__max((uint32_t)(gpu->frame_width * gpu->render_scale + 0.5f), 1), gpu->frame_width);
+	gpu->render_height = __min(__max((uint32_t)(gpu->frame_height * gpu->render_scale + 0.5f), 1), gpu->frame_height);
+
 	VkClearValue clear_values[2] =
 	{
 		{.color = {.float32 = { 0.0f, 0.0f, 0.2f, 1.0f } } },
@@ -1242,231 +2107,627 @@ gpu_cmd_buffer_t* gpu_frame_begin(gpu_t* gpu)
 	{
 		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 		.renderPass = gpu->render_pass,
-		.renderArea.extent.width = gpu->frame_width,
-		.renderArea.extent.height = gpu->frame_height,
+		.renderArea.extent.width = gpu->render_width,
+		.renderArea.extent.height = gpu->render_height,
 		.clearValueCount = _countof(clear_values),
 		.pClearValues = clear_values,
-		.framebuffer = frame->frame_buffer,
+		.framebuffer = gpu->frames[gpu->image_index].frame_buffer,
 	};
-	vkCmdBeginRenderPass(frame->cmd_buffer->buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
 
-	VkViewport viewport =
+	gpu->frame_open = true;
+
+	//a render pass either takes draws inline or executes secondary command buffers, never both
+	frame->recorder_count = __min(options->recorder_count, k_gpu_max_recorders);
+	frame->bundle_count = 0;
+	if (!frame->recorder_count)
 	{
-		.height = (float)gpu->frame_height,
-		.width = (float)gpu->frame_width,
-		.minDepth = 0.0f,
-		.maxDepth = 1.0f,
-	};
-	vkCmdSetViewport(frame->cmd_buffer->buffer, 0, 1, &viewport);
+		vkCmdBeginRenderPass(frame->cmd_buffer->buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
+		set_viewport(gpu, frame->cmd_buffer->buffer);
+		return frame->cmd_buffer;
+	}
 
-	VkRect2D scissor =
+	vkCmdBeginRenderPass(frame->cmd_buffer->buffer, &render_pass_begin_info, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	VkCommandBufferInheritanceInfo inheritance_info =
 	{
-		.extent.width = gpu->frame_width,
-		.extent.height = gpu->frame_height,
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass = gpu->render_pass,
+		.subpass = 0,
+		.framebuffer = gpu->frames[gpu->image_index].frame_buffer,
+	};
+	VkCommandBufferBeginInfo secondary_begin_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+		.pInheritanceInfo = &inheritance_info,
 	};
-	vkCmdSetScissor(frame->cmd_buffer->buffer, 0, 1, &scissor);
+	for (int r = 0; r < frame->recorder_count; r++)
+	{
+		gpu_cmd_buffer_t* recorder = &frame->recorders[r];
+		recorder->pipeline_layout = VK_NULL_HANDLE;
+		recorder->index_count = 0;
+		recorder->vertex_count = 0;
+		result = vkBeginCommandBuffer(recorder->buffer, &secondary_begin_info);
+		if (result)
+		{
+			debug_print(k_print_error, "vkBeginCommandBuffer failed: %d\n", result);
+		}
+
+		//dynamic state is not inherited from the primary
+		set_viewport(gpu, recorder->buffer);
+	}
 
 	return frame->cmd_buffer;
 }
 
-void gpu_frame_end(gpu_t* gpu)
+gpu_cmd_buffer_t* gpu_frame_get_recorder(gpu_t* gpu, int recorder)
 {
 	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
-	gpu->frame_index = (gpu->frame_index + 1) % gpu->frame_count;
+	return recorder < frame->recorder_count ? &frame->recorders[recorder] : NULL;
+}
 
-	vkCmdEndRenderPass(frame->cmd_buffer->buffer);
-	VkResult result = vkEndCommandBuffer(frame->cmd_buffer->buffer);
+gpu_bundle_t* gpu_bundle_create(gpu_t* gpu)
+{
+	gpu_bundle_t* bundle = heap_alloc(gpu->heap, sizeof(gpu_bundle_t), 8);
+	memset(bundle, 0, sizeof(*bundle));
+
+	VkCommandPoolCreateInfo pool_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.queueFamilyIndex = gpu->queue_family_index,
+	};
+	VkResult result = vkCreateCommandPool(gpu->logical_device, &pool_info, NULL, &bundle->pool);
 	if (result)
 	{
-		debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+		debug_print(k_print_error, "vkCreateCommandPool failed: %d\n", result);
+		gpu_bundle_destroy(gpu, bundle);
+		return NULL;
 	}
 
-	uint32_t image_index;
-	result = vkAcquireNextImageKHR(gpu->logical_device, gpu->swap_chain, UINT64_MAX, gpu->present_complete_sema, VK_NULL_HANDLE, &image_index);
-	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	VkCommandBufferAllocateInfo alloc_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = bundle->pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+		.commandBufferCount = 1,
+	};
+	result = vkAllocateCommandBuffers(gpu->logical_device, &alloc_info, &bundle->cmd_buffer.buffer);
+	if (result)
 	{
-		debug_print(k_print_error, "vkAcquireNextImageKHR failed: %d\n", result);
+		debug_print(k_print_error, "vkAllocateCommandBuffers failed: %d\n", result);
+		gpu_bundle_destroy(gpu, bundle);
+		return NULL;
 	}
 
-	result = vkWaitForFences(gpu->logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
-	if (result)
+	return bundle;
+}
+
+void gpu_bundle_destroy(gpu_t* gpu, gpu_bundle_t* bundle)
+{
+	//destroying a pool frees its command buffers
+	if (bundle && bundle->pool)
 	{
-		debug_print(k_print_error, "vkWaitForFences failed: %d\n", result);
+		vkDestroyCommandPool(gpu->logical_device, bundle->pool, NULL);
 	}
-	result = vkResetFences(gpu->logical_device, 1, &frame->fence);
-	if (result)
+	if (bundle)
 	{
-		debug_print(k_print_error, "vkResetFences failed: %d\n", result);
+		heap_free(gpu->heap, bundle);
 	}
+}
 
-	VkPipelineStageFlags wait_stage_mask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	VkSubmitInfo submit_info =
-	{
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.pWaitDstStageMask = &wait_stage_mask,
-		.waitSemaphoreCount = 1,
-		.signalSemaphoreCount = 1,
-		.pCommandBuffers = &frame->cmd_buffer->buffer,
-		.commandBufferCount = 1,
-		.pWaitSemaphores = &gpu->present_complete_sema,
-		.pSignalSemaphores = &gpu->render_complete_sema,
-	};
-	result = vkQueueSubmit(gpu->queue, 1, &submit_info, frame->fence);
+gpu_cmd_buffer_t* gpu_bundle_begin(gpu_t* gpu, gpu_bundle_t* bundle)
+{
+	VkResult result = vkResetCommandPool(gpu->logical_device, bundle->pool, 0);
 	if (result)
 	{
-		debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
+		debug_print(k_print_error, "vkResetCommandPool failed: %d\n", result);
 	}
 
-	VkPresentInfoKHR present_info =
+	//no framebuffer is named, since a bundle draws into whichever image each frame acquires
+	VkCommandBufferInheritanceInfo inheritance_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.renderPass = gpu->render_pass,
+		.subpass = 0,
+	};
+	VkCommandBufferBeginInfo begin_info =
 	{
-		.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-		.swapchainCount = 1,
-		.pSwapchains = &gpu->swap_chain,
-		.pImageIndices = &image_index,
-		.pWaitSemaphores = &gpu->render_complete_sema,
-		.waitSemaphoreCount = 1,
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+		.pInheritanceInfo = &inheritance_info,
 	};
-	result = vkQueuePresentKHR(gpu->queue, &present_info);
-	if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+	bundle->cmd_buffer.pipeline_layout = VK_NULL_HANDLE;
+	bundle->cmd_buffer.index_count = 0;
+	bundle->cmd_buffer.vertex_count = 0;
+	result = vkBeginCommandBuffer(bundle->cmd_buffer.buffer, &begin_info);
+	if (result)
 	{
-		debug_print(k_print_error, "vkQueuePresentKHR failed: %d\n", result);
+		debug_print(k_print_error, "vkBeginCommandBuffer failed: %d\n", result);
 	}
+
+	set_viewport(gpu, bundle->cmd_buffer.buffer);
+	return &bundle->cmd_buffer;
 }
 
-void gpu_cmd_pipeline_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_pipeline_t* pipeline)
+void gpu_bundle_end(gpu_t* gpu, gpu_bundle_t* bundle)
 {
-	vkCmdBindPipeline(cmd_buffer->buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipe);
-	cmd_buffer->pipeline_layout = pipeline->pipeline_layout;
+	VkResult result = vkEndCommandBuffer(bundle->cmd_buffer.buffer);
+	if (result)
+	{
+		debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+	}
 }
 
-void gpu_cmd_descriptor_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_descriptor_t* descriptor)
+void gpu_frame_execute_bundle(gpu_t* gpu, gpu_bundle_t* bundle)
 {
-	vkCmdBindDescriptorSets(cmd_buffer->buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, cmd_buffer->pipeline_layout, 0, 1, &descriptor->set, 0, NULL);
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (!frame->recorder_count || frame->bundle_count >= k_gpu_max_bundles)
+	{
+		debug_print(k_print_error, "Bundle not executed: the frame has no recorders or already executes %d bundles\n", frame->bundle_count);
+		return;
+	}
+	frame->bundles[frame->bundle_count++] = bundle;
 }
 
-void gpu_cmd_mesh_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_mesh_t* mesh)
+void gpu_frame_end(gpu_t* gpu)
 {
-	if (mesh->vertex_count)
+	TRACE_ZONE_BEGIN(k_trace_category_render, "gpu_frame_end");
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	gpu->frame_index = (gpu->frame_index + 1) % gpu->frame_count;
+
+	if (frame->recorder_count)
 	{
-		VkDeviceSize zero = 0;
-		vkCmdBindVertexBuffers(cmd_buffer->buffer, 0, 1, &mesh->vertex_buffer, &zero);
-		cmd_buffer->vertex_count = mesh->vertex_count;
+		VkCommandBuffer secondaries[k_gpu_max_bundles + k_gpu_max_recorders];
+		int secondary_count = 0;
+		for (int b = 0; b < frame->bundle_count; b++)
+		{
+			secondaries[secondary_count++] = frame->bundles[b]->cmd_buffer.buffer;
+		}
+		for (int r = 0; r < frame->recorder_count; r++)
+		{
+			VkResult result = vkEndCommandBuffer(frame->recorders[r].buffer);
+			if (result)
+			{
+				debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+			}
+			secondaries[secondary_count++] = frame->recorders[r].buffer;
+		}
+		vkCmdExecuteCommands(frame->cmd_buffer->buffer, secondary_count, secondaries);
 	}
-	else
+
+	vkCmdEndRenderPass(frame->cmd_buffer->buffer);
+	if (gpu->scene_image)
 	{
-		cmd_buffer->vertex_count = 0;
+		blit_scene(gpu, frame);
 	}
-	if (mesh->index_count)
+	if (frame->readback_buffer)
 	{
-		vkCmdBindIndexBuffer(cmd_buffer->buffer, mesh->index_buffer, 0, mesh->index_type);
-		cmd_buffer->index_count = mesh->index_count;
+		//the render pass or the blit leaves the image ready to copy; the barrier makes the copy visible to the host once the fence signals
+		VkBufferImageCopy region =
+		{
+			.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .layerCount = 1 },
+			.imageExtent = { gpu->frame_width, gpu->frame_height, 1 },
+		};
+		vkCmdCopyImageToBuffer(frame->cmd_buffer->buffer, frame->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame->readback_buffer, 1, &region);
+		VkMemoryBarrier barrier =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+		};
+		vkCmdPipelineBarrier(frame->cmd_buffer->buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
 	}
-	else
+	write_timestamp(gpu, frame, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	VkResult result = vkEndCommandBuffer(frame->cmd_buffer->buffer);
+	if (result)
 	{
-		cmd_buffer->index_count = 0;
+		debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
 	}
-}
 
-void gpu_cmd_draw(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer)
-{
-	if (cmd_buffer->index_count)
+	frame->submitted_timestamp_count = frame->timestamp_count;
+	frame->submitted_staging_count = frame->staging_count;
+	gpu->frame_open = false;
+
+	//offscreen frames have no image to wait for
+	VkSemaphore wait_semas[3];
+	VkPipelineStageFlags wait_stage_masks[3];
+	uint64_t wait_values[3] = { 0 }; //only read for the compute timeline
+	uint32_t wait_count = 0;
+	if (gpu->swap_chain)
 	{
-		vkCmdDrawIndexed(cmd_buffer->buffer, cmd_buffer->index_count, 1, 0, 0, 0);
+		//with dynamic resolution the image is first written by the blit
+		wait_semas[wait_count] = gpu->present_complete_sema;
+		wait_stage_masks[wait_count++] = gpu->scene_image ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	}
-	else if (cmd_buffer->vertex_count)
+	if (frame->upload_recording)
 	{
-		vkCmdDraw(cmd_buffer->buffer, cmd_buffer->vertex_count, 1, 0, 0);
+		frame->upload_recording = false;
+		if (gpu->transfer_queue != gpu->queue)
+		{
+			//the semaphore hands the copies to the graphics queue and makes them visible to vertex input
+			result = vkEndCommandBuffer(frame->upload_cmd_buffer);
+			if (result)
+			{
+				debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+			}
+			VkSubmitInfo upload_submit_info =
+			{
+				.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.pCommandBuffers = &frame->upload_cmd_buffer,
+				.commandBufferCount = 1,
+				.signalSemaphoreCount = 1,
+				.pSignalSemaphores = &frame->upload_complete_sema,
+			};
+			result = vkQueueSubmit(gpu->transfer_queue, 1, &upload_submit_info, VK_NULL_HANDLE);
+			if (result)
+			{
+				debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
+			}
+			wait_semas[wait_count] = frame->upload_complete_sema;
+			wait_stage_masks[wait_count++] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+		}
+		else
+		{
+			//on a shared queue a barrier orders the copies before vertex input and texture reads instead
+			VkMemoryBarrier barrier =
+			{
+				.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+			};
+			vkCmdPipelineBarrier(frame->upload_cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+			result = vkEndCommandBuffer(frame->upload_cmd_buffer);
+			if (result)
+			{
+				debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+			}
+			VkSubmitInfo upload_submit_info =
+			{
+				.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.pCommandBuffers = &frame->upload_cmd_buffer,
+				.commandBufferCount = 1,
+			};
+			result = vkQueueSubmit(gpu->queue, 1, &upload_submit_info, VK_NULL_HANDLE);
+			if (result)
+			{
+				debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
+			}
+		}
 	}
-}
 
-static void create_mesh_layouts(gpu_t* gpu)
-{
-	// k_gpu_mesh_layout_tri_p444_i2
+	if (frame->compute_recording && gpu->compute_queue)
 	{
-		gpu->mesh_input_assembly_info[k_gpu_mesh_layout_tri_p444_i2] = (VkPipelineInputAssemblyStateCreateInfo)
+		//waiting on the timeline makes the dispatches' writes visible to the frame's draws,
+		//while until then the graphics queue goes on rasterizing earlier frames
+		frame->compute_recording = false;
+		result = vkEndCommandBuffer(frame->compute_cmd_buffer);
+		if (result)
+		{
+			debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+		}
+		uint64_t signal_value = ++gpu->compute_timeline_value;
+		VkTimelineSemaphoreSubmitInfo timeline_submit_info =
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-			.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+			.signalSemaphoreValueCount = 1,
+			.pSignalSemaphoreValues = &signal_value,
 		};
-
-		VkVertexInputBindingDescription* vertex_binding = heap_alloc(gpu->heap, sizeof(VkVertexInputBindingDescription), 8);
-		*vertex_binding = (VkVertexInputBindingDescription)
+		VkSubmitInfo compute_submit_info =
 		{
-			.binding = 0,
-			.stride = 12,
-			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pNext = &timeline_submit_info,
+			.pCommandBuffers = &frame->compute_cmd_buffer,
+			.commandBufferCount = 1,
+			.signalSemaphoreCount = 1,
+			.pSignalSemaphores = &gpu->compute_timeline,
 		};
-
-		VkVertexInputAttributeDescription* vertex_attributes = heap_alloc(gpu->heap, sizeof(VkVertexInputAttributeDescription) * 1, 8);
-		vertex_attributes[0] = (VkVertexInputAttributeDescription)
+		result = vkQueueSubmit(gpu->compute_queue, 1, &compute_submit_info, VK_NULL_HANDLE);
+		if (result)
+		{
+			debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
+		}
+		wait_semas[wait_count] = gpu->compute_timeline;
+		wait_values[wait_count] = signal_value;
+		wait_stage_masks[wait_count++] = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+	}
+	else if (frame->compute_recording)
+	{
+		//later submissions on the queue see the dispatches' writes as draw arguments and shader input
+		frame->compute_recording = false;
+		VkMemoryBarrier barrier =
 		{
-			.binding = 0,
-			.location = 0,
-			.format = VK_FORMAT_R32G32B32_SFLOAT,
-			.offset = 0,
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+			.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+			.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
 		};
-
-		gpu->mesh_vertex_input_info[k_gpu_mesh_layout_tri_p444_i2] = (VkPipelineVertexInputStateCreateInfo)
+		vkCmdPipelineBarrier(frame->compute_cmd_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+		result = vkEndCommandBuffer(frame->compute_cmd_buffer);
+		if (result)
+		{
+			debug_print(k_print_error, "vkEndCommandBuffer failed: %d\n", result);
+		}
+		VkSubmitInfo compute_submit_info =
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-			.vertexBindingDescriptionCount = 1,
-			.pVertexBindingDescriptions = vertex_binding,
-			.vertexAttributeDescriptionCount = 1,
-			.pVertexAttributeDescriptions = vertex_attributes,
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pCommandBuffers = &frame->compute_cmd_buffer,
+			.commandBufferCount = 1,
 		};
+		result = vkQueueSubmit(gpu->queue, 1, &compute_submit_info, VK_NULL_HANDLE);
+		if (result)
+		{
+			debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
+		}
+	}
 
-		gpu->mesh_index_type[k_gpu_mesh_layout_tri_p444_i2] = VK_INDEX_TYPE_UINT16;
-		gpu->mesh_index_size[k_gpu_mesh_layout_tri_p444_i2] = 2;
-		gpu->mesh_vertex_size[k_gpu_mesh_layout_tri_p444_i2] = 12;
+	VkTimelineSemaphoreSubmitInfo timeline_submit_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+		.waitSemaphoreValueCount = wait_count,
+		.pWaitSemaphoreValues = wait_values,
+	};
+	VkSubmitInfo submit_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.pNext = gpu->compute_queue ? &timeline_submit_info : NULL,
+		.pWaitDstStageMask = wait_stage_masks,
+		.waitSemaphoreCount = wait_count,
+		.signalSemaphoreCount = gpu->swap_chain ? 1 : 0,
+		.pCommandBuffers = &frame->cmd_buffer->buffer,
+		.commandBufferCount = 1,
+		.pWaitSemaphores = wait_semas,
+		.pSignalSemaphores = &gpu->render_complete_sema,
+	};
+	result = vkQueueSubmit(gpu->queue, 1, &submit_info, frame->fence);
+	if (result)
+	{
+		debug_print(k_print_error, "vkQueueSubmit failed: %d\n", result);
 	}
 
-	// k_gpu_mesh_layout_tri_p444_c444_i2
+	if (gpu->swap_chain)
 	{
-		gpu->mesh_input_assembly_info[k_gpu_mesh_layout_tri_p444_c444_i2] = (VkPipelineInputAssemblyStateCreateInfo)
+		VkPresentInfoKHR present_info =
 		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-			.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+			.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+			.swapchainCount = 1,
+			.pSwapchains = &gpu->swap_chain,
+			.pImageIndices = &gpu->image_index,
+			.pWaitSemaphores = &gpu->render_complete_sema,
+			.waitSemaphoreCount = 1,
 		};
-
-		VkVertexInputBindingDescription* vertex_binding = heap_alloc(gpu->heap, sizeof(VkVertexInputBindingDescription), 8);
-		*vertex_binding = (VkVertexInputBindingDescription)
+		result = vkQueuePresentKHR(gpu->queue, &present_info);
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
 		{
-			.binding = 0,
-			.stride = 24,
-			.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
-		};
+			debug_print(k_print_error, "vkQueuePresentKHR failed: %d\n", result);
+		}
+	}
+	TRACE_ZONE_END(k_trace_category_render);
+}
+
+void gpu_frame_wait(gpu_t* gpu)
+{
+	gpu_frame_t* frame = &gpu->frames[(gpu->frame_index + gpu->frame_count - 1) % gpu->frame_count];
+	TRACE_ZONE_BEGIN(k_trace_category_render, "vkWaitForFences");
+	VkResult result = vkWaitForFences(gpu->logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+	TRACE_ZONE_END(k_trace_category_render);
+	if (result)
+	{
+		debug_print(k_print_error, "vkWaitForFences failed: %d\n", result);
+	}
+}
+
+const void* gpu_frame_readback(gpu_t* gpu)
+{
+	gpu_frame_t* frame = &gpu->frames[(gpu->frame_index + gpu->frame_count - 1) % gpu->frame_count];
+	if (!frame->readback_buffer)
+	{
+		return NULL;
+	}
+	gpu_frame_wait(gpu);
+	return frame->readback_memory.block->data + frame->readback_memory.offset;
+}
+
+void gpu_get_frame_size(gpu_t* gpu, int* width, int* height)
+{
+	*width = gpu->frame_width;
+	*height = gpu->frame_height;
+}
+
+void gpu_set_render_scale(gpu_t* gpu, float scale)
+{
+	if (gpu->scene_image)
+	{
+		gpu->render_scale = __min(__max(scale, 0.5f), 1.0f);
+	}
+}
+
+float gpu_get_render_scale(gpu_t* gpu)
+{
+	return gpu->render_scale;
+}
+
+int64_t gpu_get_frame_gpu_us(gpu_t* gpu)
+{
+	return gpu->frame_gpu_us;
+}
 
-		VkVertexInputAttributeDescription* vertex_attributes = heap_alloc(gpu->heap, sizeof(VkVertexInputAttributeDescription) * 2, 8);
-		vertex_attributes[0] = (VkVertexInputAttributeDescription)
+void gpu_compute_dispatch(gpu_t* gpu, gpu_pipeline_t* pipeline, gpu_descriptor_t* descriptor, const uint32_t* offsets, int offset_count, int group_count)
+{
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (!frame->compute_recording)
+	{
+		VkCommandBufferBeginInfo begin_info =
 		{
-			.binding = 0,
-			.location = 0,
-			.format = VK_FORMAT_R32G32B32_SFLOAT,
-			.offset = 0,
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
 		};
-		vertex_attributes[1] = (VkVertexInputAttributeDescription)
+		VkResult result = vkBeginCommandBuffer(frame->compute_cmd_buffer, &begin_info);
+		if (result)
 		{
-			.binding = 0,
-			.location = 1,
-			.format = VK_FORMAT_R32G32B32_SFLOAT,
-			.offset = 12,
-		};
+			debug_print(k_print_error, "vkBeginCommandBuffer failed: %d\n", result);
+			return;
+		}
+		frame->compute_recording = true;
+	}
 
-		gpu->mesh_vertex_input_info[k_gpu_mesh_layout_tri_p444_c444_i2] = (VkPipelineVertexInputStateCreateInfo)
-		{
-			.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-			.vertexBindingDescriptionCount = 1,
-			.pVertexBindingDescriptions = vertex_binding,
-			.vertexAttributeDescriptionCount = 2,
-			.pVertexAttributeDescriptions = vertex_attributes,
-		};
+	vkCmdBindPipeline(frame->compute_cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipe);
+	vkCmdBindDescriptorSets(frame->compute_cmd_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline_layout, 0, 1, &descriptor->set, offset_count, offsets);
+	vkCmdDispatch(frame->compute_cmd_buffer, group_count, 1, 1);
+}
+
+void gpu_cmd_pipeline_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_pipeline_t* pipeline)
+{
+	vkCmdBindPipeline(cmd_buffer->buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipe);
+	cmd_buffer->pipeline_layout = pipeline->pipeline_layout;
+	cmd_buffer->push_constant_stages = pipeline->push_constant_stages;
+}
+
+void gpu_cmd_push_constants(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, const void* data, size_t size)
+{
+	vkCmdPushConstants(cmd_buffer->buffer, cmd_buffer->pipeline_layout, cmd_buffer->push_constant_stages, 0, (uint32_t)size, data);
+}
+
+void gpu_cmd_descriptor_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_descriptor_t* descriptor)
+{
+	gpu_cmd_descriptor_bind_with_offsets(gpu, cmd_buffer, descriptor, NULL, 0);
+}
+
+void gpu_cmd_descriptor_bind_with_offsets(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_descriptor_t* descriptor, const uint32_t* offsets, int offset_count)
+{
+	vkCmdBindDescriptorSets(cmd_buffer->buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, cmd_buffer->pipeline_layout, 0, 1, &descriptor->set, offset_count, offsets);
+}
+
+void gpu_cmd_mesh_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_mesh_t* mesh)
+{
+	if (mesh->vertex_count)
+	{
+		VkDeviceSize zero = 0;
+		vkCmdBindVertexBuffers(cmd_buffer->buffer, 0, 1, &mesh->vertex_buffer, &zero);
+		cmd_buffer->vertex_count = mesh->vertex_count;
+	}
+	else
+	{
+		cmd_buffer->vertex_count = 0;
+	}
+	if (mesh->index_count)
+	{
+		vkCmdBindIndexBuffer(cmd_buffer->buffer, mesh->index_buffer, 0, mesh->index_type);
+		cmd_buffer->index_count = mesh->index_count;
+	}
+	else
+	{
+		cmd_buffer->index_count = 0;
+	}
+}
+
+void gpu_cmd_draw(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer)
+{
+	gpu_cmd_draw_instanced(gpu, cmd_buffer, 0, 1);
+}
+
+void gpu_cmd_draw_instanced(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, int first_instance, int instance_count)
+{
+	if (cmd_buffer->index_count)
+	{
+		vkCmdDrawIndexed(cmd_buffer->buffer, cmd_buffer->index_count, instance_count, 0, 0, first_instance);
+	}
+	else if (cmd_buffer->vertex_count)
+	{
+		vkCmdDraw(cmd_buffer->buffer, cmd_buffer->vertex_count, instance_count, 0, first_instance);
+	}
+
+	//keep the last query for the end of the frame
+	//draws in secondary command buffers are not timed; their render pass only allows executing them
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (cmd_buffer == frame->cmd_buffer && frame->timestamp_count < k_gpu_max_timestamps - 1)
+	{
+		write_timestamp(gpu, frame, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+	}
+}
+
+void gpu_cmd_draw_indirect(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_storage_buffer_t* buffer, size_t offset)
+{
+	if (cmd_buffer->index_count)
+	{
+		vkCmdDrawIndexedIndirect(cmd_buffer->buffer, buffer->buffer, offset, 1, sizeof(VkDrawIndexedIndirectCommand));
+	}
 
-		gpu->mesh_index_type[k_gpu_mesh_layout_tri_p444_c444_i2] = VK_INDEX_TYPE_UINT16;
-		gpu->mesh_index_size[k_gpu_mesh_layout_tri_p444_c444_i2] = 2;
-		gpu->mesh_vertex_size[k_gpu_mesh_layout_tri_p444_c444_i2] = 24;
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (cmd_buffer == frame->cmd_buffer && frame->timestamp_count < k_gpu_max_timestamps - 1)
+	{
+		write_timestamp(gpu, frame, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
 	}
 }
 
+static void create_mesh_layouts(gpu_t* gpu)
+{
+	//attributes are read at location 0 for position, 1 for color and 2 for normal
+	VkVertexInputAttributeDescription p444[] =
+	{
+		{ .location = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0 },
+	};
+	VkVertexInputAttributeDescription p444_c444[] =
+	{
+		{ .location = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 0 },
+		{ .location = 1, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = 12 },
+	};
+	//three component 16 and 8 bit formats are rarely supported for vertex input, so a fourth pads them
+	VkVertexInputAttributeDescription ph2222_c1111[] =
+	{
+		{ .location = 0, .format = VK_FORMAT_R16G16B16A16_SFLOAT, .offset = 0 },
+		{ .location = 1, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = 8 },
+	};
+	VkVertexInputAttributeDescription ps2222_n22_c1111[] =
+	{
+		{ .location = 0, .format = VK_FORMAT_R16G16B16A16_SNORM, .offset = 0 },
+		{ .location = 2, .format = VK_FORMAT_R16G16_SNORM, .offset = 8 },
+		{ .location = 1, .format = VK_FORMAT_R8G8B8A8_UNORM, .offset = 12 },
+	};
+
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_p444_i2, 12, p444, _countof(p444), 2);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_p444_c444_i2, 24, p444_c444, _countof(p444_c444), 2);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_p444_i4, 12, p444, _countof(p444), 4);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_p444_c444_i4, 24, p444_c444, _countof(p444_c444), 4);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_ph2222_c1111_i2, 12, ph2222_c1111, _countof(ph2222_c1111), 2);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_ph2222_c1111_i4, 12, ph2222_c1111, _countof(ph2222_c1111), 4);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_ps2222_n22_c1111_i2, 16, ps2222_n22_c1111, _countof(ps2222_n22_c1111), 2);
+	create_mesh_layout(gpu, k_gpu_mesh_layout_tri_ps2222_n22_c1111_i4, 16, ps2222_n22_c1111, _countof(ps2222_n22_c1111), 4);
+}
+
+// Describe one interleaved triangle list layout, copying its attributes for the lifetime of the GPU.
+static void create_mesh_layout(gpu_t* gpu, gpu_mesh_layout_t layout, uint32_t stride, const VkVertexInputAttributeDescription* attributes, int attribute_count, int index_size)
+{
+	gpu->mesh_input_assembly_info[layout] = (VkPipelineInputAssemblyStateCreateInfo)
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	};
+
+	VkVertexInputBindingDescription* vertex_binding = heap_alloc(gpu->heap, sizeof(VkVertexInputBindingDescription), 8);
+	*vertex_binding = (VkVertexInputBindingDescription)
+	{
+		.binding = 0,
+		.stride = stride,
+		.inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+	};
+
+	VkVertexInputAttributeDescription* vertex_attributes = heap_alloc(gpu->heap, sizeof(VkVertexInputAttributeDescription) * attribute_count, 8);
+	memcpy(vertex_attributes, attributes, sizeof(VkVertexInputAttributeDescription) * attribute_count);
+
+	gpu->mesh_vertex_input_info[layout] = (VkPipelineVertexInputStateCreateInfo)
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = 1,
+		.pVertexBindingDescriptions = vertex_binding,
+		.vertexAttributeDescriptionCount = attribute_count,
+		.pVertexAttributeDescriptions = vertex_attributes,
+	};
+
+	gpu->mesh_index_type[layout] = index_size == 4 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+	gpu->mesh_index_size[layout] = index_size;
+	gpu->mesh_vertex_size[layout] = stride;
+}
+
 static void destroy_mesh_layouts(gpu_t* gpu)
 {
 	for (int i = 0; i < _countof(gpu->mesh_vertex_input_info); ++i)
@@ -1494,3 +2755,1158 @@ static uint32_t get_memory_type_index(gpu_t* gpu, uint32_t bits, VkMemoryPropert
 	debug_print(k_print_error, "Unable to find memory of type: %x\n", bits);
 	return 0;
 }
+
+static void create_pipeline_cache(gpu_t* gpu, const VkPhysicalDeviceProperties* properties)
+{
+	fs_work_t* work = NULL;
+	void* data = NULL;
+	size_t size = 0;
+	if (gpu->fs && gpu->pipeline_cache_path)
+	{
+		work = fs_read(gpu->fs, gpu->pipeline_cache_path, gpu->heap, false, false);
+		fs_work_wait(work);
+		data = fs_work_get_buffer(work);
+		size = fs_work_get_result(work) ? 0 : fs_work_get_size(work);
+	}
+
+	//a cache saved by another driver or device is thrown away and starts empty
+	const VkPipelineCacheHeaderVersionOne* header = data;
+	if (size < sizeof(*header) ||
+		header->headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+		header->vendorID != properties->vendorID ||
+		header->deviceID != properties->deviceID ||
+		memcmp(header->pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) != 0)
+	{
+		size = 0;
+	}
+
+	VkPipelineCacheCreateInfo cache_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = size,
+		.pInitialData = size ? data : NULL,
+	};
+	VkResult result = vkCreatePipelineCache(gpu->logical_device, &cache_info, NULL, &gpu->pipeline_cache);
+	if (result)
+	{
+		debug_print(k_print_warning, "vkCreatePipelineCache failed: %d; pipelines will not be cached.\n", result);
+		gpu->pipeline_cache = VK_NULL_HANDLE;
+	}
+
+	if (work)
+	{
+		heap_free(gpu->heap, data);
+		fs_work_destroy(work);
+	}
+}
+
+static void save_pipeline_cache(gpu_t* gpu)
+{
+	if (!gpu->fs || !gpu->pipeline_cache_path)
+	{
+		return;
+	}
+
+	size_t size = 0;
+	VkResult result = vkGetPipelineCacheData(gpu->logical_device, gpu->pipeline_cache, &size, NULL);
+	if (result || !size)
+	{
+		return;
+	}
+
+	void* data = heap_alloc(gpu->heap, size, 8);
+	result = vkGetPipelineCacheData(gpu->logical_device, gpu->pipeline_cache, &size, data);
+	if (!result)
+	{
+		fs_work_t* work = fs_write(gpu->fs, gpu->pipeline_cache_path, data, size, false);
+		fs_work_wait(work);
+		if (fs_work_get_result(work))
+		{
+			debug_print(k_print_warning, "Unable to save pipeline cache to %s.\n", gpu->pipeline_cache_path);
+		}
+		fs_work_destroy(work);
+	}
+	heap_free(gpu->heap, data);
+}
+
+static void create_timestamp_queries(gpu_t* gpu, uint32_t valid_bits)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(gpu->physical_device, &properties);
+	if (!valid_bits || properties.limits.timestampPeriod <= 0.0f)
+	{
+		return;
+	}
+
+	VkQueryPoolCreateInfo pool_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = gpu->frame_count * k_gpu_max_timestamps,
+	};
+	VkResult result = vkCreateQueryPool(gpu->logical_device, &pool_info, NULL, &gpu->timestamp_pool);
+	if (result)
+	{
+		debug_print(k_print_warning, "vkCreateQueryPool failed: %d; GPU timings disabled.\n", result);
+		gpu->timestamp_pool = VK_NULL_HANDLE;
+		return;
+	}
+
+	gpu->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ULL << valid_bits) - 1;
+	gpu->ticks_per_timestamp = properties.limits.timestampPeriod * (double)timer_get_ticks_per_second() / 1000000000.0;
+
+	//calibrate against the CPU clock with one timestamp, taken as halfway between submit and idle
+	VkCommandBuffer cmd_buffer = VK_NULL_HANDLE;
+	VkCommandBufferAllocateInfo alloc_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = gpu->cmd_pool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = 1,
+	};
+	vkAllocateCommandBuffers(gpu->logical_device, &alloc_info, &cmd_buffer);
+	VkCommandBufferBeginInfo begin_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	vkBeginCommandBuffer(cmd_buffer, &begin_info);
+	vkCmdResetQueryPool(cmd_buffer, gpu->timestamp_pool, 0, 1);
+	vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, gpu->timestamp_pool, 0);
+	vkEndCommandBuffer(cmd_buffer);
+
+	VkSubmitInfo submit_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+		.commandBufferCount = 1,
+		.pCommandBuffers = &cmd_buffer,
+	};
+	uint64_t submit_ticks = timer_get_ticks();
+	vkQueueSubmit(gpu->queue, 1, &submit_info, VK_NULL_HANDLE);
+	vkQueueWaitIdle(gpu->queue);
+	uint64_t idle_ticks = timer_get_ticks();
+	vkFreeCommandBuffers(gpu->logical_device, gpu->cmd_pool, 1, &cmd_buffer);
+
+	result = vkGetQueryPoolResults(gpu->logical_device, gpu->timestamp_pool, 0, 1, sizeof(uint64_t),
+		&gpu->calibration_timestamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result)
+	{
+		debug_print(k_print_warning, "vkGetQueryPoolResults failed: %d; GPU timings disabled.\n", result);
+		vkDestroyQueryPool(gpu->logical_device, gpu->timestamp_pool, NULL);
+		gpu->timestamp_pool = VK_NULL_HANDLE;
+		return;
+	}
+	gpu->calibration_timestamp &= gpu->timestamp_mask;
+	gpu->calibration_ticks = submit_ticks + (idle_ticks - submit_ticks) / 2;
+}
+
+static VkResult memory_alloc(gpu_t* gpu, const VkMemoryRequirements* reqs, VkMemoryPropertyFlags properties, gpu_allocation_t* allocation)
+{
+	uint32_t type_index = get_memory_type_index(gpu, reqs->memoryTypeBits, properties);
+
+	VkDeviceSize offset = 0;
+	gpu_memory_block_t* block = gpu->memory_blocks[type_index];
+	while (block && !memory_block_alloc(gpu, block, reqs->size, reqs->alignment, &offset))
+	{
+		block = block->next;
+	}
+
+	if (!block)
+	{
+		//allocations larger than a block get a block of their own
+		VkDeviceSize block_size = __max(reqs->size, k_gpu_memory_block_size);
+		VkMemoryAllocateInfo mem_alloc =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = block_size,
+			.memoryTypeIndex = type_index,
+		};
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkResult result = vkAllocateMemory(gpu->logical_device, &mem_alloc, NULL, &memory);
+		if (result)
+		{
+			return result;
+		}
+
+		void* data = NULL;
+		if (gpu->memory_properties.memoryTypes[type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+		{
+			//memory may only be mapped once, so host visible blocks stay mapped for all their buffers
+			result = vkMapMemory(gpu->logical_device, memory, 0, VK_WHOLE_SIZE, 0, &data);
+			if (result)
+			{
+				vkFreeMemory(gpu->logical_device, memory, NULL);
+				return result;
+			}
+		}
+
+		block = heap_alloc(gpu->heap, sizeof(gpu_memory_block_t), 8);
+		memset(block, 0, sizeof(*block));
+		block->memory = memory;
+		block->size = block_size;
+		block->data = data;
+		memory_block_insert_range(gpu, block, 0, 0, block_size);
+		block->next = gpu->memory_blocks[type_index];
+		gpu->memory_blocks[type_index] = block;
+
+		memory_block_alloc(gpu, block, reqs->size, reqs->alignment, &offset);
+	}
+
+	block->used += reqs->size;
+	allocation->block = block;
+	allocation->offset = offset;
+	allocation->size = reqs->size;
+	allocation->type_index = type_index;
+	return VK_SUCCESS;
+}
+
+static void memory_free(gpu_t* gpu, gpu_allocation_t* allocation)
+{
+	gpu_memory_block_t* block = allocation->block;
+
+	//return the range, merging it with the free ranges on either side
+	int index = 0;
+	while (index < block->free_count && block->free_ranges[index].offset < allocation->offset)
+	{
+		++index;
+	}
+	VkDeviceSize end = allocation->offset + allocation->size;
+	bool merge_prev = index > 0 && block->free_ranges[index - 1].offset + block->free_ranges[index - 1].size == allocation->offset;
+	bool merge_next = index < block->free_count && block->free_ranges[index].offset == end;
+	if (merge_prev && merge_next)
+	{
+		block->free_ranges[index - 1].size += allocation->size + block->free_ranges[index].size;
+		memmove(&block->free_ranges[index], &block->free_ranges[index + 1], sizeof(gpu_memory_range_t) * (block->free_count - index - 1));
+		--block->free_count;
+	}
+	else if (merge_prev)
+	{
+		block->free_ranges[index - 1].size += allocation->size;
+	}
+	else if (merge_next)
+	{
+		block->free_ranges[index].offset = allocation->offset;
+		block->free_ranges[index].size += allocation->size;
+	}
+	else
+	{
+		memory_block_insert_range(gpu, block, index, allocation->offset, allocation->size);
+	}
+
+	block->used -= allocation->size;
+	if (!block->used)
+	{
+		gpu_memory_block_t** link = &gpu->memory_blocks[allocation->type_index];
+		while (*link != block)
+		{
+			link = &(*link)->next;
+		}
+		*link = block->next;
+		vkFreeMemory(gpu->logical_device, block->memory, NULL);
+		heap_free(gpu->heap, block->free_ranges);
+		heap_free(gpu->heap, block);
+	}
+
+	memset(allocation, 0, sizeof(*allocation));
+}
+
+// First fit search of a block's free ranges, leaving alignment padding free.
+static bool memory_block_alloc(gpu_t* gpu, gpu_memory_block_t* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+	for (int i = 0; i < block->free_count; ++i)
+	{
+		gpu_memory_range_t* range = &block->free_ranges[i];
+		VkDeviceSize aligned = (range->offset + alignment - 1) / alignment * alignment;
+		VkDeviceSize end = range->offset + range->size;
+		if (aligned + size > end)
+		{
+			continue;
+		}
+
+		*offset = aligned;
+		VkDeviceSize padding = aligned - range->offset;
+		VkDeviceSize tail = end - (aligned + size);
+		if (padding && tail)
+		{
+			range->size = padding;
+			memory_block_insert_range(gpu, block, i + 1, aligned + size, tail);
+		}
+		else if (padding)
+		{
+			range->size = padding;
+		}
+		else if (tail)
+		{
+			range->offset = aligned + size;
+			range->size = tail;
+		}
+		else
+		{
+			memmove(range, range + 1, sizeof(gpu_memory_range_t) * (block->free_count - i - 1));
+			--block->free_count;
+		}
+		return true;
+	}
+	return false;
+}
+
+static void memory_block_insert_range(gpu_t* gpu, gpu_memory_block_t* block, int index, VkDeviceSize offset, VkDeviceSize size)
+{
+	if (block->free_count == block->free_capacity)
+	{
+		int capacity = __max(block->free_capacity * 2, 16);
+		gpu_memory_range_t* ranges = heap_alloc(gpu->heap, sizeof(gpu_memory_range_t) * capacity, 8);
+		if (block->free_ranges)
+		{
+			memcpy(ranges, block->free_ranges, sizeof(gpu_memory_range_t) * block->free_count);
+			heap_free(gpu->heap, block->free_ranges);
+		}
+		block->free_ranges = ranges;
+		block->free_capacity = capacity;
+	}
+	memmove(&block->free_ranges[index + 1], &block->free_ranges[index], sizeof(gpu_memory_range_t) * (block->free_count - index));
+	block->free_ranges[index].offset = offset;
+	block->free_ranges[index].size = size;
+	++block->free_count;
+}
+
+static VkResult create_host_buffer(gpu_t* gpu, VkBufferUsageFlags usage, size_t size, VkBuffer* buffer, gpu_allocation_t* memory, const char** function)
+{
+	VkBufferCreateInfo buffer_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage,
+	};
+	uint32_t queue_families[3];
+	set_buffer_sharing(gpu, &buffer_info, queue_families);
+	VkResult result = vkCreateBuffer(gpu->logical_device, &buffer_info, NULL, buffer);
+	if (result)
+	{
+		*function = "vkCreateBuffer";
+		return result;
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(gpu->logical_device, *buffer, &mem_reqs);
+
+	result = memory_alloc(gpu, &mem_reqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memory);
+	if (result)
+	{
+		*function = "vkAllocateMemory";
+		return result;
+	}
+
+	result = vkBindBufferMemory(gpu->logical_device, *buffer, memory->block->memory, memory->offset);
+	if (result)
+	{
+		*function = "vkBindBufferMemory";
+	}
+	return result;
+}
+
+static void write_host_memory(gpu_t* gpu, const gpu_allocation_t* memory, const void* data, size_t size)
+{
+	memcpy(memory->block->data + memory->offset, data, size);
+}
+
+static VkResult create_device_buffer(gpu_t* gpu, VkBufferUsageFlags usage, const void* data, size_t size, VkBuffer* buffer, gpu_allocation_t* memory, const char** function)
+{
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (frame->staging_count == k_gpu_max_staging_buffers)
+	{
+		*function = "create_device_buffer";
+		return VK_ERROR_TOO_MANY_OBJECTS;
+	}
+
+	VkBufferCreateInfo buffer_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = size,
+		.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+	};
+	uint32_t queue_families[3];
+	set_buffer_sharing(gpu, &buffer_info, queue_families);
+	VkResult result = vkCreateBuffer(gpu->logical_device, &buffer_info, NULL, buffer);
+	if (result)
+	{
+		*function = "vkCreateBuffer";
+		return result;
+	}
+
+	VkMemoryRequirements mem_reqs;
+	vkGetBufferMemoryRequirements(gpu->logical_device, *buffer, &mem_reqs);
+
+	result = memory_alloc(gpu, &mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memory);
+	if (result)
+	{
+		*function = "vkAllocateMemory";
+		return result;
+	}
+
+	result = vkBindBufferMemory(gpu->logical_device, *buffer, memory->block->memory, memory->offset);
+	if (result)
+	{
+		*function = "vkBindBufferMemory";
+		return result;
+	}
+
+	gpu_staging_buffer_t* staging;
+	result = create_staging_buffer(gpu, frame, data, size, &staging, function);
+	if (result)
+	{
+		return result;
+	}
+
+	result = begin_upload(gpu, frame, function);
+	if (result)
+	{
+		return result;
+	}
+
+	VkBufferCopy region = { .size = size };
+	vkCmdCopyBuffer(frame->upload_cmd_buffer, staging->buffer, *buffer, 1, &region);
+	return VK_SUCCESS;
+}
+
+// Copy data into a new staging buffer, freed once the current frame retires.
+static VkResult create_staging_buffer(gpu_t* gpu, gpu_frame_t* frame, const void* data, size_t size, gpu_staging_buffer_t** result_staging, const char** function)
+{
+	if (frame->staging_count == k_gpu_max_staging_buffers)
+	{
+		*function = "create_staging_buffer";
+		return VK_ERROR_TOO_MANY_OBJECTS;
+	}
+
+	gpu_staging_buffer_t* staging = &frame->staging[frame->staging_count];
+	memset(staging, 0, sizeof(*staging));
+	VkResult result = create_host_buffer(gpu, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size, &staging->buffer, &staging->memory, function);
+	if (result)
+	{
+		gpu_staging_buffer_t failed = *staging;
+		if (failed.buffer)
+		{
+			vkDestroyBuffer(gpu->logical_device, failed.buffer, NULL);
+		}
+		if (failed.memory.block)
+		{
+			memory_free(gpu, &failed.memory);
+		}
+		memset(staging, 0, sizeof(*staging));
+		return result;
+	}
+	++frame->staging_count;
+	write_host_memory(gpu, &staging->memory, data, size);
+	*result_staging = staging;
+	return VK_SUCCESS;
+}
+
+// Start recording the frame's upload command buffer, if it isn't already.
+static VkResult begin_upload(gpu_t* gpu, gpu_frame_t* frame, const char** function)
+{
+	if (frame->upload_recording)
+	{
+		return VK_SUCCESS;
+	}
+
+	//outside a frame the slot's last submission may still be reading its upload command buffer
+	if (!gpu->frame_open)
+	{
+		vkWaitForFences(gpu->logical_device, 1, &frame->fence, VK_TRUE, UINT64_MAX);
+	}
+
+	VkCommandBufferBeginInfo begin_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	VkResult result = vkBeginCommandBuffer(frame->upload_cmd_buffer, &begin_info);
+	if (result)
+	{
+		*function = "vkBeginCommandBuffer";
+		return result;
+	}
+	frame->upload_recording = true;
+	return VK_SUCCESS;
+}
+
+static void free_staging_buffers(gpu_t* gpu, gpu_frame_t* frame, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		vkDestroyBuffer(gpu->logical_device, frame->staging[i].buffer, NULL);
+		memory_free(gpu, &frame->staging[i].memory);
+		if (frame->staging[i].retired_view)
+		{
+			vkDestroyImageView(gpu->logical_device, frame->staging[i].retired_view, NULL);
+		}
+		if (frame->staging[i].retired_image)
+		{
+			vkDestroyImage(gpu->logical_device, frame->staging[i].retired_image, NULL);
+		}
+		if (frame->staging[i].retired_memory)
+		{
+			vkFreeMemory(gpu->logical_device, frame->staging[i].retired_memory, NULL);
+		}
+	}
+
+	//staging buffers added since the last submission are still waiting for theirs
+	frame->staging_count -= count;
+	memmove(&frame->staging[0], &frame->staging[count], sizeof(gpu_staging_buffer_t) * frame->staging_count);
+	frame->submitted_staging_count = 0;
+}
+
+// Give a texture a new image holding mip levels first_mip to its last, uploaded from data packed finest first.
+// The image it had, if any, is freed with the upload's staging buffer, once frames that may sample it finish.
+// On failure the texture keeps the image it had.
+static VkResult create_texture_image(gpu_t* gpu, gpu_texture_t* texture, int first_mip, const void* data, size_t size, const char** function)
+{
+	if (first_mip < 0 || first_mip >= texture->mip_count)
+	{
+		*function = "create_texture_image";
+		return VK_ERROR_FORMAT_NOT_SUPPORTED;
+	}
+
+	//one region per level, read from the staging buffer one after another
+	uint32_t mip_count = texture->mip_count - first_mip;
+	VkBufferImageCopy* regions = alloca(sizeof(VkBufferImageCopy) * mip_count);
+	VkDeviceSize offset = 0;
+	for (uint32_t i = 0; i < mip_count; ++i)
+	{
+		int mip = first_mip + i;
+		regions[i] = (VkBufferImageCopy)
+		{
+			.bufferOffset = offset,
+			.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = i, .layerCount = 1 },
+			.imageExtent = { __max(texture->width >> mip, 1), __max(texture->height >> mip, 1), 1 },
+		};
+		offset += gpu_texture_get_mip_size(texture->format, texture->width, texture->height, mip);
+	}
+	if (offset != size)
+	{
+		debug_print(k_print_error, "Texture mips %d to %d are %zu bytes, not %zu\n", first_mip, texture->mip_count - 1, (size_t)offset, size);
+		*function = "create_texture_image";
+		return VK_ERROR_FORMAT_NOT_SUPPORTED;
+	}
+
+	gpu_frame_t* frame = &gpu->frames[gpu->frame_index];
+	if (frame->staging_count == k_gpu_max_staging_buffers)
+	{
+		*function = "create_texture_image";
+		return VK_ERROR_TOO_MANY_OBJECTS;
+	}
+
+	uint32_t queue_families[2] = { gpu->queue_family_index, gpu->transfer_queue_family_index };
+	VkImageCreateInfo image_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = texture->vk_format,
+		.extent = regions[0].imageExtent,
+		.mipLevels = mip_count,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = VK_IMAGE_TILING_OPTIMAL,
+		.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	};
+	//like buffers, uploaded on the transfer queue and sampled on the graphics queue without ownership transfers
+	if (gpu->transfer_queue_family_index != gpu->queue_family_index)
+	{
+		image_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		image_info.queueFamilyIndexCount = _countof(queue_families);
+		image_info.pQueueFamilyIndices = queue_families;
+	}
+
+	VkImage image = VK_NULL_HANDLE;
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkImageView view = VK_NULL_HANDLE;
+	VkResult result = vkCreateImage(gpu->logical_device, &image_info, NULL, &image);
+	if (result)
+	{
+		*function = "vkCreateImage";
+		goto fail;
+	}
+
+	//images get memory of their own, rather than sharing blocks with buffers
+	VkMemoryRequirements mem_reqs;
+	vkGetImageMemoryRequirements(gpu->logical_device, image, &mem_reqs);
+	VkMemoryAllocateInfo alloc_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+		.allocationSize = mem_reqs.size,
+		.memoryTypeIndex = get_memory_type_index(gpu, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+	};
+	result = vkAllocateMemory(gpu->logical_device, &alloc_info, NULL, &memory);
+	if (result)
+	{
+		*function = "vkAllocateMemory";
+		goto fail;
+	}
+	result = vkBindImageMemory(gpu->logical_device, image, memory, 0);
+	if (result)
+	{
+		*function = "vkBindImageMemory";
+		goto fail;
+	}
+
+	VkImageViewCreateInfo view_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = texture->vk_format,
+		.subresourceRange = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .levelCount = mip_count, .layerCount = 1 },
+		.image = image,
+	};
+	result = vkCreateImageView(gpu->logical_device, &view_info, NULL, &view);
+	if (result)
+	{
+		*function = "vkCreateImageView";
+		goto fail;
+	}
+
+	gpu_staging_buffer_t* staging;
+	result = create_staging_buffer(gpu, frame, data, size, &staging, function);
+	if (result)
+	{
+		goto fail;
+	}
+	result = begin_upload(gpu, frame, function);
+	if (result)
+	{
+		goto fail;
+	}
+
+	VkImageMemoryBarrier barrier =
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.srcAccessMask = 0,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = image,
+		.subresourceRange = view_info.subresourceRange,
+	};
+	vkCmdPipelineBarrier(frame->upload_cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+	vkCmdCopyBufferToImage(frame->upload_cmd_buffer, staging->buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mip_count, regions);
+
+	//a transfer queue has no shader stage to name; the semaphore the frame's draws wait on orders the reads instead
+	bool shared_queue = gpu->transfer_queue == gpu->queue;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = shared_queue ? VK_ACCESS_SHADER_READ_BIT : 0;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	VkPipelineStageFlags dst_stage = shared_queue ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	vkCmdPipelineBarrier(frame->upload_cmd_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+	staging->retired_image = texture->image;
+	staging->retired_memory = texture->memory;
+	staging->retired_view = texture->view;
+	texture->image = image;
+	texture->memory = memory;
+	texture->view = view;
+	texture->first_mip = first_mip;
+	texture->descriptor.imageView = view;
+	return VK_SUCCESS;
+
+fail:
+	if (view)
+	{
+		vkDestroyImageView(gpu->logical_device, view, NULL);
+	}
+	if (image)
+	{
+		vkDestroyImage(gpu->logical_device, image, NULL);
+	}
+	if (memory)
+	{
+		vkFreeMemory(gpu->logical_device, memory, NULL);
+	}
+	return result;
+}
+
+static void set_viewport(gpu_t* gpu, VkCommandBuffer buffer)
+{
+	VkViewport viewport =
+	{
+		.height = (float)gpu->render_height,
+		.width = (float)gpu->render_width,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+	vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+	VkRect2D scissor =
+	{
+		.extent.width = gpu->render_width,
+		.extent.height = gpu->render_height,
+	};
+	vkCmdSetScissor(buffer, 0, 1, &scissor);
+}
+
+// Scale the part of the scene image the frame drew up into the image it was acquired for, leaving it ready to
+// present, or to copy out offscreen. The render pass left the scene image ready to blit from.
+static void blit_scene(gpu_t* gpu, gpu_frame_t* frame)
+{
+	//the image acquired held an earlier frame, which is drawn over whole
+	VkImage image = gpu->frames[gpu->image_index].image;
+	VkImageMemoryBarrier barrier =
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+		.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+		.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+		.image = image,
+		.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+	};
+	vkCmdPipelineBarrier(frame->cmd_buffer->buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+	VkImageBlit region =
+	{
+		.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+		.srcOffsets = { { 0, 0, 0 }, { (int32_t)gpu->render_width, (int32_t)gpu->render_height, 1 } },
+		.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+		.dstOffsets = { { 0, 0, 0 }, { (int32_t)gpu->frame_width, (int32_t)gpu->frame_height, 1 } },
+	};
+	vkCmdBlitImage(frame->cmd_buffer->buffer, gpu->scene_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	if (gpu->swap_chain)
+	{
+		barrier.dstAccessMask = 0;
+		barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		vkCmdPipelineBarrier(frame->cmd_buffer->buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+	}
+	else
+	{
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		vkCmdPipelineBarrier(frame->cmd_buffer->buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+	}
+}
+
+static void write_timestamp(gpu_t* gpu, gpu_frame_t* frame, VkPipelineStageFlagBits stage)
+{
+	if (gpu->timestamp_pool && frame->timestamp_count < k_gpu_max_timestamps)
+	{
+		uint32_t slot = (uint32_t)(frame - gpu->frames);
+		vkCmdWriteTimestamp(frame->cmd_buffer->buffer, stage, gpu->timestamp_pool, slot * k_gpu_max_timestamps + frame->timestamp_count);
+		frame->timestamp_count++;
+	}
+}
+
+// Record the last submitted frame's timestamps on the trace's GPU track.
+static void emit_timestamps(gpu_t* gpu, gpu_frame_t* frame)
+{
+	trace_t* trace = trace_get_default();
+	frame_stats_t* stats = frame_stats_get_default();
+	uint32_t count = frame->submitted_timestamp_count;
+	if (!gpu->timestamp_pool || count < 2)
+	{
+		return;
+	}
+
+	uint64_t timestamps[k_gpu_max_timestamps];
+	uint32_t slot = (uint32_t)(frame - gpu->frames);
+	VkResult result = vkGetQueryPoolResults(gpu->logical_device, gpu->timestamp_pool, slot * k_gpu_max_timestamps, count,
+		sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result)
+	{
+		return;
+	}
+
+	//convert to timer ticks; the masked difference stays right across a timestamp wrap
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint64_t delta = (timestamps[i] - gpu->calibration_timestamp) & gpu->timestamp_mask;
+		timestamps[i] = gpu->calibration_ticks + (uint64_t)((double)delta * gpu->ticks_per_timestamp);
+	}
+
+	//the first and last timestamps bound the frame; the ones between end each draw
+	gpu->frame_gpu_us = timer_ticks_to_us(timestamps[count - 1] - timestamps[0]);
+	frame_stats_add(stats, k_frame_stat_gpu_us, gpu->frame_gpu_us);
+	if (!trace)
+	{
+		return;
+	}
+	trace_gpu_duration_push(trace, "GPU Frame", timestamps[0]);
+	for (uint32_t i = 1; i < count - 1; ++i)
+	{
+		trace_gpu_duration_push(trace, "Draw", timestamps[i - 1]);
+		trace_gpu_duration_pop(trace, timestamps[i]);
+	}
+	trace_gpu_duration_pop(trace, timestamps[count - 1]);
+}
+
+static VkResult create_swapchain(gpu_t* gpu, wm_window_t* window, const gpu_options_t* options, const char** function)
+{
+	VkWin32SurfaceCreateInfoKHR surface_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
+		.hinstance = GetModuleHandle(NULL),
+		.hwnd = wm_get_raw_window(window),
+	};
+	VkResult result = vkCreateWin32SurfaceKHR(gpu->instance, &surface_info, NULL, &gpu->surface);
+	if (result)
+	{
+		*function = "vkCreateWin32SurfaceKHR";
+		return result;
+	}
+
+	VkSurfaceCapabilitiesKHR surface_cap;
+	result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu->physical_device, gpu->surface, &surface_cap);
+	if (result)
+	{
+		*function = "vkGetPhysicalDeviceSurfaceCapabilitiesKHR";
+		return result;
+	}
+
+	gpu->frame_width = surface_cap.currentExtent.width;
+	gpu->frame_height = surface_cap.currentExtent.height;
+
+	//FIFO is the one present mode every surface supports
+	VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+	VkPresentModeKHR k_present_modes[] = { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+	uint32_t present_mode_count = 0;
+	vkGetPhysicalDeviceSurfacePresentModesKHR(gpu->physical_device, gpu->surface, &present_mode_count, NULL);
+	VkPresentModeKHR* present_modes = alloca(sizeof(VkPresentModeKHR) * present_mode_count);
+	vkGetPhysicalDeviceSurfacePresentModesKHR(gpu->physical_device, gpu->surface, &present_mode_count, present_modes);
+	for (uint32_t i = 0; i < present_mode_count; ++i)
+	{
+		if (present_modes[i] == k_present_modes[options->present_mode])
+		{
+			present_mode = present_modes[i];
+		}
+	}
+	if (present_mode != k_present_modes[options->present_mode])
+	{
+		debug_print(k_print_warning, "Present mode %d not supported; using FIFO.\n", options->present_mode);
+	}
+
+	//a max image count of zero means no limit
+	uint32_t image_count = options->frame_count ? options->frame_count : 3;
+	image_count = __max(image_count, surface_cap.minImageCount);
+	if (surface_cap.maxImageCount)
+	{
+		image_count = __min(image_count, surface_cap.maxImageCount);
+	}
+
+	VkSwapchainCreateInfoKHR swapchain_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+		.surface = gpu->surface,
+		.minImageCount = image_count,
+		.imageFormat = VK_FORMAT_B8G8R8A8_SRGB,
+		.imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+		.imageExtent = surface_cap.currentExtent,
+		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (options->dynamic_resolution ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0),
+		.preTransform = surface_cap.currentTransform,
+		.imageArrayLayers = 1,
+		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.presentMode = present_mode,
+		.clipped = VK_TRUE,
+		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+	};
+	result = vkCreateSwapchainKHR(gpu->logical_device, &swapchain_info, NULL, &gpu->swap_chain);
+	if (result)
+	{
+		*function = "vkCreateSwapchainKHR";
+		return result;
+	}
+
+	result = vkGetSwapchainImagesKHR(gpu->logical_device, gpu->swap_chain, &gpu->frame_count, NULL);
+	if (result)
+	{
+		*function = "vkGetSwapchainImagesKHR";
+		return result;
+	}
+
+	gpu->frames = heap_alloc(gpu->heap, sizeof(gpu_frame_t) * gpu->frame_count, 8);
+	memset(gpu->frames, 0, sizeof(gpu_frame_t) * gpu->frame_count);
+	VkImage* images = alloca(sizeof(VkImage) * gpu->frame_count);
+
+	result = vkGetSwapchainImagesKHR(gpu->logical_device, gpu->swap_chain, &gpu->frame_count, images);
+	if (result)
+	{
+		*function = "vkGetSwapchainImagesKHR";
+		return result;
+	}
+
+	for (uint32_t i = 0; i < gpu->frame_count; i++)
+	{
+		gpu->frames[i].image = images[i];
+	}
+	return VK_SUCCESS;
+}
+
+static VkResult create_offscreen_images(gpu_t* gpu, const gpu_options_t* options, const char** function)
+{
+	gpu->frame_width = options->width ? options->width : 1280;
+	gpu->frame_height = options->height ? options->height : 720;
+	gpu->frame_count = options->frame_count ? options->frame_count : 3;
+	gpu->frames = heap_alloc(gpu->heap, sizeof(gpu_frame_t) * gpu->frame_count, 8);
+	memset(gpu->frames, 0, sizeof(gpu_frame_t) * gpu->frame_count);
+
+	for (uint32_t i = 0; i < gpu->frame_count; i++)
+	{
+		gpu_frame_t* frame = &gpu->frames[i];
+
+		//the frame is copied out of its image after the render pass, so the image is also a transfer source,
+		//and with dynamic resolution the scene is blitted into it
+		VkImageCreateInfo image_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+			.imageType = VK_IMAGE_TYPE_2D,
+			.format = VK_FORMAT_B8G8R8A8_SRGB,
+			.extent = { gpu->frame_width, gpu->frame_height, 1 },
+			.mipLevels = 1,
+			.arrayLayers = 1,
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.tiling = VK_IMAGE_TILING_OPTIMAL,
+			.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | (options->dynamic_resolution ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0),
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+		};
+		VkResult result = vkCreateImage(gpu->logical_device, &image_info, NULL, &frame->image);
+		if (result)
+		{
+			*function = "vkCreateImage";
+			return result;
+		}
+
+		//images get memory of their own, rather than sharing blocks with buffers
+		VkMemoryRequirements mem_reqs;
+		vkGetImageMemoryRequirements(gpu->logical_device, frame->image, &mem_reqs);
+		VkMemoryAllocateInfo alloc_info =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = mem_reqs.size,
+			.memoryTypeIndex = get_memory_type_index(gpu, mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+		};
+		result = vkAllocateMemory(gpu->logical_device, &alloc_info, NULL, &frame->image_memory);
+		if (result)
+		{
+			*function = "vkAllocateMemory";
+			return result;
+		}
+
+		result = vkBindImageMemory(gpu->logical_device, frame->image, frame->image_memory, 0);
+		if (result)
+		{
+			*function = "vkBindImageMemory";
+			return result;
+		}
+
+		if (options->readback)
+		{
+			size_t size = (size_t)gpu->frame_width * gpu->frame_height * 4;
+			result = create_host_buffer(gpu, VK_BUFFER_USAGE_TRANSFER_DST_BIT, size, &frame->readback_buffer, &frame->readback_memory, function);
+			if (result)
+			{
+				return result;
+			}
+		}
+	}
+	return VK_SUCCESS;
+}
+
+// Create the render pass for one group of the frame graph's compiled passes, each a subpass of it.
+// Attachments are numbered by resource, so formats has one per resource and framebuffers list views in that order.
+static VkResult create_render_pass(gpu_t* gpu, int group, const VkFormat* formats, VkRenderPass* render_pass)
+{
+	//pipeline stage, access and layout of each frame graph usage
+	static const struct
+	{
+		VkPipelineStageFlags stage;
+		VkAccessFlags access;
+		VkImageLayout layout;
+	} k_usages[k_frame_graph_usage_count] =
+	{
+		[k_frame_graph_usage_none] = { VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED },
+		[k_frame_graph_usage_color_write] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
+		[k_frame_graph_usage_depth_write] =
+		{
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		},
+		[k_frame_graph_usage_depth_read] =
+		{
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+		},
+		[k_frame_graph_usage_input] = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		[k_frame_graph_usage_sampled] = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+		[k_frame_graph_usage_transfer_read] = { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL },
+		[k_frame_graph_usage_present] = { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR },
+	};
+	const VkAccessFlags k_write_access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	frame_graph_t* graph = gpu->frame_graph;
+	int resource_count = frame_graph_get_resource_count(graph);
+	int pass_count = frame_graph_get_pass_count(graph);
+
+	//a resource's first use clears it unless it reads what was there before
+	VkAttachmentDescription attachments[k_frame_graph_max_resources];
+	for (int r = 0; r < resource_count; ++r)
+	{
+		const frame_graph_resource_plan_t* plan = frame_graph_get_resource_plan(graph, r);
+		attachments[r] = (VkAttachmentDescription)
+		{
+			.format = formats[r],
+			.samples = VK_SAMPLE_COUNT_1_BIT,
+			.loadOp = plan->load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = plan->store ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+			.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			.finalLayout = k_usages[plan->final_usage].layout,
+		};
+	}
+
+	//each subpass's color, input and depth references, in that order
+	VkSubpassDescription subpasses[k_frame_graph_max_passes];
+	VkAttachmentReference references[k_frame_graph_max_passes][k_frame_graph_max_pass_uses];
+	uint32_t subpass_count = 0;
+	for (int p = 0; p < pass_count; ++p)
+	{
+		const frame_graph_pass_plan_t* plan = frame_graph_get_pass_plan(graph, p);
+		if (plan->culled || plan->group != group)
+		{
+			continue;
+		}
+
+		const int* resources;
+		const frame_graph_usage_t* usages;
+		int use_count = frame_graph_get_pass_uses(graph, p, &resources, &usages);
+
+		VkSubpassDescription* subpass = &subpasses[plan->subpass];
+		VkAttachmentReference* refs = references[plan->subpass];
+		memset(subpass, 0, sizeof(*subpass));
+		subpass->pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+		uint32_t ref_count = 0;
+		subpass->pColorAttachments = refs;
+		for (int u = 0; u < use_count; ++u)
+		{
+			if (usages[u] == k_frame_graph_usage_color_write)
+			{
+				refs[ref_count++] = (VkAttachmentReference) { .attachment = resources[u], .layout = k_usages[usages[u]].layout };
+				subpass->colorAttachmentCount++;
+			}
+		}
+		subpass->pInputAttachments = refs + ref_count;
+		for (int u = 0; u < use_count; ++u)
+		{
+			if (usages[u] == k_frame_graph_usage_input)
+			{
+				refs[ref_count++] = (VkAttachmentReference) { .attachment = resources[u], .layout = k_usages[usages[u]].layout };
+				subpass->inputAttachmentCount++;
+			}
+		}
+		for (int u = 0; u < use_count; ++u)
+		{
+			if (usages[u] == k_frame_graph_usage_depth_write || usages[u] == k_frame_graph_usage_depth_read)
+			{
+				refs[ref_count] = (VkAttachmentReference) { .attachment = resources[u], .layout = k_usages[usages[u]].layout };
+				subpass->pDepthStencilAttachment = &refs[ref_count++];
+			}
+		}
+		subpass_count = __max(subpass_count, (uint32_t)plan->subpass + 1);
+	}
+
+	//a barrier from outside the render pass waits on the external side; a first use waits only on the previous frame's same stage
+	const frame_graph_barrier_t* barriers;
+	int barrier_count = frame_graph_get_barriers(graph, &barriers);
+	VkSubpassDependency dependencies[k_frame_graph_max_barriers];
+	uint32_t dependency_count = 0;
+	for (int b = 0; b < barrier_count; ++b)
+	{
+		const frame_graph_barrier_t* barrier = &barriers[b];
+		const frame_graph_pass_plan_t* src = barrier->src_pass >= 0 ? frame_graph_get_pass_plan(graph, barrier->src_pass) : NULL;
+		const frame_graph_pass_plan_t* dst = barrier->pass < pass_count ? frame_graph_get_pass_plan(graph, barrier->pass) : NULL;
+		bool src_inside = src && src->group == group;
+		bool dst_inside = dst && dst->group == group;
+		if (!src_inside && !dst_inside)
+		{
+			continue;
+		}
+
+		VkSubpassDependency* dependency = &dependencies[dependency_count++];
+		*dependency = (VkSubpassDependency)
+		{
+			.srcSubpass = src_inside ? (uint32_t)src->subpass : VK_SUBPASS_EXTERNAL,
+			.dstSubpass = dst_inside ? (uint32_t)dst->subpass : VK_SUBPASS_EXTERNAL,
+			.srcStageMask = k_usages[barrier->src_usage].stage,
+			.dstStageMask = k_usages[barrier->dst_usage].stage,
+			.srcAccessMask = k_usages[barrier->src_usage].access & k_write_access,
+			.dstAccessMask = k_usages[barrier->dst_usage].access,
+			.dependencyFlags = barrier->by_region || !src_inside || !dst_inside ? VK_DEPENDENCY_BY_REGION_BIT : 0,
+		};
+		if (barrier->src_usage == k_frame_graph_usage_none)
+		{
+			//an imported resource may still be in the previous frame's hands, such as a blit reading it
+			const frame_graph_resource_plan_t* plan = frame_graph_get_resource_plan(graph, barrier->resource);
+			const frame_graph_resource_info_t* info = frame_graph_get_resource_info(graph, barrier->resource);
+			dependency->srcStageMask = dependency->dstStageMask | (info->imported ? k_usages[info->final_usage].stage : 0);
+			dependency->srcAccessMask = dependency->dstAccessMask & k_write_access;
+			attachments[barrier->resource].initialLayout = plan->load ? k_usages[barrier->dst_usage].layout : VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+	}
+
+	VkRenderPassCreateInfo render_pass_info =
+	{
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+		.attachmentCount = resource_count,
+		.pAttachments = attachments,
+		.subpassCount = subpass_count,
+		.pSubpasses = subpasses,
+		.dependencyCount = dependency_count,
+		.pDependencies = dependencies,
+	};
+	return vkCreateRenderPass(gpu->logical_device, &render_pass_info, NULL, render_pass);
+}
+
+// Find a shader's variant for a pipeline info; the caller holds the shader's variant lock.
+static gpu_pipeline_t* find_variant(gpu_shader_t* shader, const gpu_pipeline_info_t* info)
+{
+	for (gpu_pipeline_t* variant = shader->variants; variant; variant = variant->next_variant)
+	{
+		//compute pipelines have no mesh layout
+		if ((shader->compute_module || variant->mesh_layout == info->mesh_layout) &&
+			variant->specialization_count == info->specialization_count &&
+			memcmp(variant->specialization, info->specialization, info->specialization_count * sizeof(uint32_t)) == 0)
+		{
+			return variant;
+		}
+	}
+	return NULL;
+}
+
+// Share a buffer between every queue family the GPU submits to, with room for three families.
+// Concurrent sharing lets the transfer and compute queues use buffers without queue family ownership transfers.
+static void set_buffer_sharing(gpu_t* gpu, VkBufferCreateInfo* info, uint32_t* families)
+{
+	uint32_t count = 0;
+	families[count++] = gpu->queue_family_index;
+	if (gpu->transfer_queue_family_index != gpu->queue_family_index)
+	{
+		families[count++] = gpu->transfer_queue_family_index;
+	}
+	if (gpu->compute_queue && gpu->compute_queue_family_index != gpu->transfer_queue_family_index)
+	{
+		families[count++] = gpu->compute_queue_family_index;
+	}
+	if (count > 1)
+	{
+		info->sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info->queueFamilyIndexCount = count;
+		info->pQueueFamilyIndices = families;
+	}
+}
@@ -1,29 +1,75 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct gpu_t gpu_t;
+typedef struct gpu_bundle_t gpu_bundle_t;
 typedef struct gpu_cmd_buffer_t gpu_cmd_buffer_t;
 typedef struct gpu_descriptor_t gpu_descriptor_t;
 typedef struct gpu_mesh_t gpu_mesh_t;
 typedef struct gpu_pipeline_t gpu_pipeline_t;
 typedef struct gpu_shader_t gpu_shader_t;
+typedef struct gpu_storage_buffer_t gpu_storage_buffer_t;
+typedef struct gpu_texture_t gpu_texture_t;
 typedef struct gpu_uniform_buffer_t gpu_uniform_buffer_t;
 
+typedef struct fs_t fs_t;
 typedef struct heap_t heap_t;
 typedef struct wm_window_t wm_window_t;
 
+enum
+{
+	// Most secondary command buffers a frame can be recorded into at once.
+	k_gpu_max_recorders = 8,
+
+	// Bytes of uniform data each frame can push onto the uniform ring.
+	k_gpu_uniform_ring_size = 4 * 1024 * 1024,
+
+	// Largest uniform block a shader can read from the uniform ring.
+	k_gpu_uniform_ring_range = 1024,
+
+	// Descriptors each frame can create with gpu_frame_descriptor_create().
+	k_gpu_frame_descriptor_max = 1024,
+
+	// Bytes of push constants every device accepts, the most a shader can read.
+	k_gpu_push_constant_max = 128,
+
+	// Most bundles a frame can execute.
+	k_gpu_max_bundles = 4,
+
+	// Most specialization constants a pipeline can set.
+	k_gpu_specialization_max = 16,
+};
+
 typedef struct gpu_descriptor_info_t
 {
 	gpu_shader_t* shader;
-	gpu_uniform_buffer_t** uniform_buffers;
+	gpu_uniform_buffer_t** uniform_buffers; //or NULL if the shader reads uniforms from the uniform ring; a ring shader given buffers reads them at offset 0
 	int uniform_buffer_count;
+	gpu_storage_buffer_t** storage_buffers; //bound after the uniform buffers
+	int storage_buffer_count;
+	gpu_texture_t** textures; //bound after the storage buffers
+	int texture_count;
 } gpu_descriptor_info_t;
 
+// Vertex and index formats of a mesh's triangle list.
+// Named by attribute, p for position, c for color and n for normal, followed by the bytes of
+// each component, then i and the bytes of each index. Components are 32-bit floats unless noted.
+// Shaders read position at location 0, color at location 1 and normal at location 2.
 typedef enum gpu_mesh_layout_t
 {
 	k_gpu_mesh_layout_tri_p444_i2,
 	k_gpu_mesh_layout_tri_p444_c444_i2,
+	k_gpu_mesh_layout_tri_p444_i4,
+	k_gpu_mesh_layout_tri_p444_c444_i4,
+	//half-float positions with a fourth, padding component, and unorm8 colors: half the bytes of p444_c444
+	k_gpu_mesh_layout_tri_ph2222_c1111_i2,
+	k_gpu_mesh_layout_tri_ph2222_c1111_i4,
+	//snorm16 positions, read in -1 to 1 so the model matrix scales them by the mesh's extent,
+	//octahedral-encoded snorm16 normals, and unorm8 colors
+	k_gpu_mesh_layout_tri_ps2222_n22_c1111_i2,
+	k_gpu_mesh_layout_tri_ps2222_n22_c1111_i4,
 
 	k_gpu_mesh_layout_count,
 } gpu_mesh_layout_t;
@@ -41,6 +87,10 @@ typedef struct gpu_pipeline_info_t
 {
 	gpu_shader_t* shader;
 	gpu_mesh_layout_t mesh_layout;
+	// 32 bit values of the specialization constants with ids 0 up to the count, in every stage, at most
+	// k_gpu_specialization_max. The driver compiles them in as constants, so branches on them cost nothing.
+	const uint32_t* specialization;
+	int specialization_count;
 } gpu_pipeline_info_t;
 
 typedef struct gpu_shader_info_t
@@ -49,7 +99,13 @@ typedef struct gpu_shader_info_t
 	size_t vertex_shader_size;
 	void* fragment_shader_data;
 	size_t fragment_shader_size;
+	void* compute_shader_data; //a compute shader takes the place of the vertex and fragment programs
+	size_t compute_shader_size;
 	int uniform_buffer_count;
+	int storage_buffer_count; //bound after the uniform buffers
+	bool uniform_ring; //uniform buffers are read from the uniform ring at offsets given when binding descriptors
+	int push_constant_size; //bytes set with gpu_cmd_push_constants(), read by every stage, at most k_gpu_push_constant_max
+	int texture_count; //sampled by the fragment program, bound after the storage buffers
 } gpu_shader_info_t;
 
 typedef struct gpu_uniform_buffer_info_t
@@ -58,15 +114,109 @@ typedef struct gpu_uniform_buffer_info_t
 	size_t size;
 } gpu_uniform_buffer_info_t;
 
+typedef struct gpu_storage_buffer_info_t
+{
+	size_t size;
+	bool indirect; //also read as arguments by gpu_cmd_draw_indirect()
+} gpu_storage_buffer_info_t;
+
+// Block-compressed formats of a texture, each 4x4 block of pixels read as sRGB color.
+typedef enum gpu_texture_format_t
+{
+	k_gpu_texture_format_bc1, //8 bytes a block: color, with one bit of alpha
+	k_gpu_texture_format_bc3, //16 bytes a block: color with smooth alpha
+	k_gpu_texture_format_bc7, //16 bytes a block: color and alpha at the best quality
+
+	k_gpu_texture_format_count,
+} gpu_texture_format_t;
+
+typedef struct gpu_texture_info_t
+{
+	gpu_texture_format_t format;
+	int width; //of mip 0, in pixels
+	int height;
+	int mip_count;
+	// Mip levels from first_mip to the last, finest first and packed one after another.
+	// Levels finer than first_mip are left out, so a texture can start at low detail.
+	int first_mip;
+	const void* data;
+	size_t data_size;
+} gpu_texture_info_t;
+
+// Options for starting a frame of rendering.
+// Zero-initialized options give the same frame as gpu_frame_begin().
+typedef struct gpu_frame_options_t
+{
+	// Secondary command buffers to record draws into, up to k_gpu_max_recorders; zero records inline.
+	int recorder_count;
+} gpu_frame_options_t;
+
+// How finished frames are shown on the window.
+typedef enum gpu_present_mode_t
+{
+	k_gpu_present_mode_fifo, //waits for vertical blank, so frames never tear and rendering is paced by the display
+	k_gpu_present_mode_mailbox, //shows the newest frame at vertical blank; never tears, renders as fast as it can
+	k_gpu_present_mode_immediate, //shows frames as soon as they finish; lowest latency, but frames may tear
+} gpu_present_mode_t;
+
+// Options for creating a GPU.
+// Zero-initialized options give the same GPU as gpu_create().
+typedef struct gpu_options_t
+{
+	// File system the pipeline cache is loaded and saved with, or NULL to keep no cache on disk.
+	fs_t* fs;
+	// Path of the pipeline cache, read on creation and written on destruction.
+	// Compiled pipelines are reused across runs, so shaders are not compiled again on startup.
+	const char* pipeline_cache_path;
+	// Present mode, falling back to FIFO if the window does not support it.
+	gpu_present_mode_t present_mode;
+	// Swapchain images, each with its own frame in flight, or zero for the default of three.
+	// Clamped to what the window supports. Fewer frames in flight lowers latency; more smooths throughput.
+	int frame_count;
+	// Render into offscreen images instead of the window, which may then be NULL, and present nothing.
+	// Frames are begun and ended as usual, so the render path can be exercised on machines without a desktop.
+	bool headless;
+	// Size of offscreen images, or zero for 1280 by 720.
+	int width;
+	int height;
+	// Copy each offscreen frame to host memory for gpu_frame_readback().
+	bool readback;
+	// Run gpu_compute_dispatch() work on a compute-only queue, if the device has one, so it overlaps
+	// rasterization of earlier frames. Falls back to the graphics queue otherwise.
+	bool async_compute;
+	// Draw each frame into an image of its own at a fraction of the frame size, set with
+	// gpu_set_render_scale(), and scale it up into the frame's image when the frame ends.
+	bool dynamic_resolution;
+} gpu_options_t;
+
 // Create an instance of Vulkan on the provided window.
 gpu_t* gpu_create(heap_t* heap, wm_window_t* window);
 
+// Create an instance of Vulkan on the provided window with the specified options.
+gpu_t* gpu_create_with_options(heap_t* heap, wm_window_t* window, const gpu_options_t* options);
+
 // Destroy the previously created Vulkan.
 void gpu_destroy(gpu_t* gpu);
 
 // Get the number of frames in the swapchain.
 int gpu_get_frame_count(gpu_t* gpu);
 
+// Get the size of the images frames are rendered into.
+void gpu_get_frame_size(gpu_t* gpu, int* width, int* height);
+
+// Set the fraction of the frame's width and height that frames begun from now on draw, clamped between a
+// half and 1. The viewport and scissor frames begin with cover only that much of the
+// top left of the image drawn into, so bundles recorded at another scale must be recorded again.
+// Only GPUs created with dynamic resolution draw at less than the full size; for others the scale stays 1.
+void gpu_set_render_scale(gpu_t* gpu, float scale);
+
+// Get the fraction of the frame's width and height that frames draw.
+float gpu_get_render_scale(gpu_t* gpu);
+
+// Get the microseconds the GPU spent on the last frame found finished when a frame began, or zero if
+// the queue cannot time. It lags the frame being recorded by the frames in flight.
+int64_t gpu_get_frame_gpu_us(gpu_t* gpu);
+
 // Wait for the GPU to be done all queued work.
 void gpu_wait_until_idle(gpu_t* gpu);
 
@@ -76,19 +226,35 @@ gpu_descriptor_t* gpu_descriptor_create(gpu_t* gpu, const gpu_descriptor_info_t*
 // Destroys a descriptor.
 void gpu_descriptor_destroy(gpu_t* gpu, gpu_descriptor_t* descriptor);
 
+// Binds buffers to a shader layout for the frame being recorded only.
+// The descriptor is allocated from a pool belonging to the frame, which is reset wholesale when the
+// frame's slot is next begun, so it is never destroyed and costs no heap allocation.
+// Call from the thread that begins frames. Returns NULL once k_gpu_frame_descriptor_max are in use.
+gpu_descriptor_t* gpu_frame_descriptor_create(gpu_t* gpu, const gpu_descriptor_info_t* info);
+
 // Create a drawable piece of geometry with vertex and index data.
 gpu_mesh_t* gpu_mesh_create(gpu_t* gpu, const gpu_mesh_info_t* info);
 
+// Get the number of indices a mesh draws, as written into indirect draw arguments.
+int gpu_mesh_get_index_count(gpu_mesh_t* mesh);
+
 // Destroy some geometry.
 void gpu_mesh_destroy(gpu_t* gpu, gpu_mesh_t* mesh);
 
 // Setup an object that binds a shader to a mesh layout for rendering.
+// Compute shaders make a compute pipeline for gpu_compute_dispatch(); the mesh layout is ignored.
 gpu_pipeline_t* gpu_pipeline_create(gpu_t* gpu, const gpu_pipeline_info_t* info);
 
 // Destroy a pipeline.
 void gpu_pipeline_destroy(gpu_t* gpu, gpu_pipeline_t* pipeline);
 
-// Create a shader object with vertex and fragment shader programs.
+// Get a shader's pipeline for a mesh layout and specialization values, creating it the first time they are asked for.
+// Variants belong to the shader and are destroyed with it, not with gpu_pipeline_destroy().
+// May be called on any thread; creating the variants a game needs while loading keeps compiles out of its frames.
+gpu_pipeline_t* gpu_pipeline_get(gpu_t* gpu, const gpu_pipeline_info_t* info);
+
+// Create a shader object with vertex and fragment shader programs, or a compute shader program.
+// Shaders and pipelines may be created on any thread, including while another thread records a frame.
 gpu_shader_t* gpu_shader_create(gpu_t* gpu, const gpu_shader_info_t* info);
 
 // Destroy a shader.
@@ -104,13 +270,96 @@ void gpu_uniform_buffer_update(gpu_t* gpu, gpu_uniform_buffer_t* buffer, const v
 // Destroy a uniform buffer.
 void gpu_uniform_buffer_destroy(gpu_t* gpu, gpu_uniform_buffer_t* buffer);
 
+// Copy data onto the uniform ring for the frame being recorded, returning its offset for
+// gpu_cmd_descriptor_bind_with_offsets(). The ring is persistently mapped and reset every
+// frame, so this neither maps memory nor allocates. Call between gpu_frame_begin() and
+// gpu_frame_end(), from the thread that began the frame.
+// Size must be at most k_gpu_uniform_ring_range.
+uint32_t gpu_uniform_ring_push(gpu_t* gpu, const void* data, size_t size);
+
+// Create a storage buffer of the specified size, for arrays a shader reads by index,
+// such as per-instance transforms.
+gpu_storage_buffer_t* gpu_storage_buffer_create(gpu_t* gpu, const gpu_storage_buffer_info_t* info);
+
+// Write size bytes of data to a storage buffer, starting offset bytes in.
+void gpu_storage_buffer_update(gpu_t* gpu, gpu_storage_buffer_t* buffer, size_t offset, const void* data, size_t size);
+
+// Destroy a storage buffer.
+void gpu_storage_buffer_destroy(gpu_t* gpu, gpu_storage_buffer_t* buffer);
+
+// Create a texture holding some of its mip levels, uploaded through staging like meshes.
+// Returns NULL if the device can't sample block-compressed formats.
+gpu_texture_t* gpu_texture_create(gpu_t* gpu, const gpu_texture_info_t* info);
+
+// Replace the mip levels a texture holds with levels first_mip to its last, packed as for gpu_texture_create().
+// The texture moves to a new image, and the old one is freed once the frames that drew with it finish.
+// Descriptors written before go on reading the old image, so bind textures whose levels change through
+// gpu_frame_descriptor_create(). Returns false, keeping the levels it had, if the new image can't be made.
+bool gpu_texture_set_mips(gpu_t* gpu, gpu_texture_t* texture, int first_mip, const void* data, size_t size);
+
+// Get the finest mip level a texture holds.
+int gpu_texture_get_first_mip(gpu_texture_t* texture);
+
+// Destroy a texture.
+void gpu_texture_destroy(gpu_t* gpu, gpu_texture_t* texture);
+
+// Get the bytes of one mip level of a texture of a format and size.
+size_t gpu_texture_get_mip_size(gpu_texture_format_t format, int width, int height, int mip);
+
 // Start a new frame of rendering. May wait on a prior frame to complete.
 // Returns a command buffer for all rendering in that frame.
 gpu_cmd_buffer_t* gpu_frame_begin(gpu_t* gpu);
 
+// Start a new frame of rendering with the specified options.
+// With recorders, draws go into secondary command buffers from gpu_frame_get_recorder()
+// instead of the returned command buffer, and gpu_frame_end() executes them in order.
+gpu_cmd_buffer_t* gpu_frame_begin_with_options(gpu_t* gpu, const gpu_frame_options_t* options);
+
+// Get a secondary command buffer of the frame being recorded, or NULL if the frame has fewer recorders.
+// Each recorder has its own command pool, so different threads may record into different recorders at once.
+// Recording must be finished before gpu_frame_end().
+gpu_cmd_buffer_t* gpu_frame_get_recorder(gpu_t* gpu, int recorder);
+
+// Create a bundle: a secondary command buffer of draws recorded once and executed by any number of frames.
+// Recording draws once saves doing it every frame for geometry that doesn't change.
+gpu_bundle_t* gpu_bundle_create(gpu_t* gpu);
+
+// Destroy a bundle. No frame in flight may execute it.
+void gpu_bundle_destroy(gpu_t* gpu, gpu_bundle_t* bundle);
+
+// Start recording a bundle's draws, replacing any recorded before. No frame in flight may execute it.
+// A bundle outlives the frame's uniform ring, so its descriptors should read uniform buffers instead.
+gpu_cmd_buffer_t* gpu_bundle_begin(gpu_t* gpu, gpu_bundle_t* bundle);
+
+// Finish recording a bundle's draws.
+void gpu_bundle_end(gpu_t* gpu, gpu_bundle_t* bundle);
+
+// Execute a recorded bundle in the frame being recorded, ahead of the draws of its recorders.
+// The frame must have begun with at least one recorder, since bundles are secondary command buffers.
+void gpu_frame_execute_bundle(gpu_t* gpu, gpu_bundle_t* bundle);
+
 // Finish rendering frame.
 void gpu_frame_end(gpu_t* gpu);
 
+// Wait for the GPU to finish the last frame ended.
+// Waiting before input is sampled for the next frame trades throughput for input-to-photon latency,
+// since nothing the next frame renders queues up behind frames still in flight.
+void gpu_frame_wait(gpu_t* gpu);
+
+// Wait for the GPU to finish the last frame ended and get its pixels: rows of frame width
+// 32-bit BGRA pixels, frame height rows, top to bottom. Returns NULL unless the GPU renders
+// offscreen with readback. The pixels stay valid until the frame is overwritten, frame count
+// frames later.
+const void* gpu_frame_readback(gpu_t* gpu);
+
+// Run a compute pipeline over group_count workgroups ahead of the frame's draws.
+// Dispatches are recorded into their own command buffer, submitted before the frame's on the
+// same queue, or with async compute on the compute queue with the frame's draws waiting on it,
+// so their storage buffer writes are seen by every draw of the frame.
+// Offsets are into the uniform ring, as for gpu_cmd_descriptor_bind_with_offsets().
+// Call between gpu_frame_begin() and gpu_frame_end(), from the thread that began the frame.
+void gpu_compute_dispatch(gpu_t* gpu, gpu_pipeline_t* pipeline, gpu_descriptor_t* descriptor, const uint32_t* offsets, int offset_count, int group_count);
+
 // Set the current pipeline for this command buffer.
 void gpu_cmd_pipeline_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_pipeline_t* pipeline);
 
@@ -120,5 +369,25 @@ void gpu_cmd_mesh_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_mesh_t* mes
 // Set the current descriptor for this command buffer.
 void gpu_cmd_descriptor_bind(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_descriptor_t* descriptor);
 
+// Set the current descriptor for this command buffer, reading each uniform buffer from the
+// uniform ring at the matching offset returned by gpu_uniform_ring_push().
+void gpu_cmd_descriptor_bind_with_offsets(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_descriptor_t* descriptor, const uint32_t* offsets, int offset_count);
+
+// Write push constants for the current pipeline into the command buffer, read by draws that follow.
+// Cheaper than pushing a uniform and binding a descriptor for small per-draw data such as a model
+// matrix. Size bytes are written from offset zero, up to the push constant size of the pipeline's shader.
+void gpu_cmd_push_constants(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, const void* data, size_t size);
+
 // Draw given current pipeline, mesh, and descriptor.
 void gpu_cmd_draw(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer);
+
+// Draw instance_count copies of the current mesh.
+// Shaders tell them apart by gl_InstanceIndex, which counts up from first_instance, so draws
+// can index their own elements of an array shared by many draws.
+void gpu_cmd_draw_instanced(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, int first_instance, int instance_count);
+
+// Draw the current mesh with arguments read from a storage buffer when the draw executes.
+// The arguments are a VkDrawIndexedIndirectCommand at offset bytes into the buffer, which must
+// have been created as indirect, and the mesh must have indices. Compute dispatches can write
+// the arguments, so the CPU never learns how many instances were drawn.
+void gpu_cmd_draw_indirect(gpu_t* gpu, gpu_cmd_buffer_t* cmd_buffer, gpu_storage_buffer_t* buffer, size_t offset);
@@ -1,44 +1,187 @@
 #include "heap.h"
 
+#include "atomic.h"
 #include "debug.h"
-#include "mutex.h"
+#include "lock.h"
 #include "tlsf/tlsf.h"
+#include "trace.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
-#include <DbgHelp.h>
+#include <intrin.h>
+
+//the executable's base address, which call sites are recorded relative to
+extern IMAGE_DOS_HEADER __ImageBase;
+
+// Allocation tracking records a backtrace for every block and reports leaks in heap_destroy().
+// Each distinct backtrace is kept once in a table shared by all heaps, and a block stores its id.
+// Enabled by default in debug builds; define HEAP_TRACKING as 0 or 1 to override.
+// Pair it with DEBUG_FRAME_POINTERS to make capturing backtraces cheap enough for performance testing.
+#if !defined(HEAP_TRACKING)
+#if defined(_DEBUG)
+#define HEAP_TRACKING 1
+#else
+#define HEAP_TRACKING 0
+#endif
+#endif
 
 #define FRAME_MAX 3
 
+enum
+{
+	// Small allocations with modest alignment are served from per-thread caches.
+	k_cache_alignment = 16,
+	k_size_class_count = 7,
+	k_max_cached_size = 16 << (k_size_class_count - 1),
+
+	// Blocks moved between a thread cache and the shared heap per lock.
+	k_cache_batch = 32,
+	// A thread cache holding more free blocks than this of one class returns a batch.
+	k_cache_limit = 4 * k_cache_batch,
+
+	// Allocations of at least half the grow increment go straight to the OS when their alignment fits in a page.
+	k_large_alignment = 4096,
+
+	// Size classes stored in block_header_t for blocks that are not cached.
+	k_size_class_none = -1,
+	k_size_class_large = -2,
+
+	// Distinct allocation backtraces kept; must be a power of two.
+	// Blocks allocated once the table is three quarters full are tracked without one.
+	k_stack_slots = 1 << 16,
+};
+
 typedef struct arena_t
 {
 	pool_t pool;
+	size_t size;
+	size_t used; //bytes in blocks allocated from this arena
 	struct arena_t* next;
 } arena_t;
 
-//A struct to hold the backtrace information of each address of memory allocated using heap_alloc()
-typedef struct backtrace_t
+// Prefix of an allocation served directly by VirtualAlloc().
+typedef struct large_block_t
 {
-	void* address;
-	void* trace[FRAME_MAX];
-	unsigned short frames; //the number of frames captured
-	struct backtrace_t* next; //a pointer to allow a linked list of backtrace_t
+	size_t size; //the size of the whole mapping
+} large_block_t;
+
+// Header stored immediately before the address of every block handed out by heap_alloc().
+// Holds how to return the block and, when tracking, the backtrace information of the allocation.
+typedef struct block_header_t
+{
+#if HEAP_TRACKING
+	struct block_header_t* next; //links of a doubly linked list of all blocks, so unlinking is constant time
+	struct block_header_t* prev;
 	size_t size; //the size of the memory block
-} backtrace_t;
+	uint32_t stack; //the id of the allocation's backtrace, or 0 for none
+	unsigned short in_use; //false while sitting free in a thread cache
+#endif
+	signed char size_class; //the thread cache size class, k_size_class_none if not cached or k_size_class_large if owned by the OS
+	unsigned char tag; //the child heap the block is counted in, or 0 for none
+	unsigned short offset; //distance from the start of the underlying allocation to the address
+} block_header_t;
+
+// A distinct allocation backtrace, shared by every block allocated with it.
+typedef struct heap_stack_t
+{
+	int hash; //set once the slot holds a backtrace, and never 0 then
+	int frames; //the number of frames captured
+	void* trace[FRAME_MAX];
+} heap_stack_t;
+
+// Free small blocks owned by one thread.
+// Free blocks are chained through their first bytes.
+typedef struct thread_cache_t
+{
+	void* blocks[k_size_class_count];
+	int counts[k_size_class_count];
+	struct thread_cache_t* next;
+} thread_cache_t;
 
 typedef struct heap_t
 {
 	tlsf_t tlsf;
 	size_t grow_increment;
 	arena_t* arena;
-	backtrace_t* backtrace; //a linked list to store backtraces
-	mutex_t* mutex;
+	arena_t* empty_arena; //an arena with no blocks kept for reuse instead of being returned to the OS
+#if HEAP_TRACKING
+	block_header_t* blocks; //a linked list of every block allocated from tlsf
+#endif
+	thread_cache_t* caches; //every thread cache created for this heap
+	DWORD cache_tls;
+	size_t used_bytes; //bytes in blocks allocated from arenas or the OS
+	size_t peak_used_bytes;
+	size_t large_bytes;
+	int large_count;
+	size_t large_page_size; //size arenas and large allocations round up to when mapped with large pages, or 0
+	lock_t lock;
+
+	struct heap_t* root; //the heap blocks come from: the heap itself, or the first parent of a child heap
+	struct heap_t* children[k_heap_child_max + 1]; //child heaps by tag, with 0 unused
+	int tag; //a child heap's index in its root's children, or 0 for a root
+
+	//usage of a child heap, changed atomically as blocks come and go
+	const char* name;
+	size_t budget;
+	int64_t child_used_bytes;
+	int64_t child_peak_bytes;
+	int over_budget; //set while over budget, so the warning prints once each time it is exceeded
+
+	int tracing; //set by heap_set_tracing()
 } heap_t;
 
+// Allocation backtraces of every heap, by id - 1, allocated on first use.
+static heap_stack_t* s_stacks = NULL;
+static int s_stack_count = 0;
+static lock_t s_stack_lock; //guards adding backtraces
+
+static void* site_alloc(heap_t* heap, size_t size, size_t alignment, void* site);
+static void site_free(heap_t* heap, void* address, void* site);
+static void* root_alloc(heap_t* heap, size_t size, size_t alignment);
+static int get_size_class(size_t size);
+static thread_cache_t* get_thread_cache(heap_t* heap);
+static bool is_large(heap_t* heap, size_t size, size_t alignment);
+static block_header_t* block_alloc(heap_t* heap, size_t size, size_t alignment, int size_class);
+static void block_free(heap_t* heap, block_header_t* header);
+static block_header_t* block_realloc(heap_t* heap, block_header_t* header, size_t size);
+static size_t block_capacity(block_header_t* header);
+static block_header_t* large_alloc(heap_t* heap, size_t size, size_t alignment);
+static void large_free(heap_t* heap, block_header_t* header);
+static void* os_alloc(heap_t* heap, size_t* size);
+static size_t enable_large_pages();
+static void* arena_alloc(heap_t* heap, size_t size, size_t alignment);
+static void arena_free(heap_t* heap, void* base);
+static void arena_emptied(heap_t* heap, arena_t* arena);
+static void arena_release(heap_t* heap, arena_t* arena);
+static arena_t* find_arena(heap_t* heap, void* base);
+static void track_block(heap_t* heap, block_header_t* header, size_t size);
+static void untrack_block(heap_t* heap, block_header_t* header);
+static void retrack_block(heap_t* heap, block_header_t* header);
+static void cache_refill(heap_t* heap, thread_cache_t* cache, int size_class);
+static void cache_flush(heap_t* heap, thread_cache_t* cache, int size_class, int count);
+static void child_account(heap_t* child, int64_t bytes);
+static void record_allocation(block_header_t* header, size_t size);
+static void record_resize(block_header_t* header, size_t size);
+static bool record_free(block_header_t* header);
+static void trace_block(heap_t* heap, int64_t bytes, void* site);
+static uint32_t stack_intern(void** trace, int frames);
+static uint32_t stack_find(heap_stack_t* stacks, int hash, void** trace, int frames);
+static void report_leaks(heap_t* heap);
+static void stats_walker(void* ptr, size_t size, int used, void* user);
+static int get_histogram_bucket(size_t size);
+
 heap_t* heap_create(size_t grow_increment)
+{
+	heap_options_t options = { .grow_increment = grow_increment };
+	return heap_create_with_options(&options);
+}
+
+heap_t* heap_create_with_options(const heap_options_t* options)
 {
 	heap_t* heap = VirtualAlloc(NULL, sizeof(heap_t) + tlsf_size(),
 		MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
@@ -50,29 +193,610 @@ heap_t* heap_create(size_t grow_increment)
 		return NULL;
 	}
 
-	heap->mutex = mutex_create();
-	heap->grow_increment = grow_increment;
+	lock_init_named(&heap->lock, "heap");
+	heap->grow_increment = options->grow_increment;
 	heap->tlsf = tlsf_create(heap + 1);
 	heap->arena = NULL;
-	heap->backtrace = NULL;
+	heap->empty_arena = NULL;
+#if HEAP_TRACKING
+	heap->blocks = NULL;
+#endif
+	heap->caches = NULL;
+	heap->cache_tls = TlsAlloc();
+	heap->used_bytes = 0;
+	heap->peak_used_bytes = 0;
+	heap->large_bytes = 0;
+	heap->large_count = 0;
+	heap->large_page_size = 0;
+	heap->root = heap;
+	memset(heap->children, 0, sizeof(heap->children));
+	heap->tag = 0;
+	heap->name = NULL;
+	heap->budget = 0;
+	heap->tracing = 0;
+	if (options->large_pages)
+	{
+		heap->large_page_size = enable_large_pages();
+		if (!heap->large_page_size)
+		{
+			debug_print(k_print_warning, "Heap: large pages unavailable without the Lock pages in memory privilege; using normal pages.\n");
+		}
+	}
 
 	return heap;
 }
 
+heap_t* heap_create_child(heap_t* parent, const char* name, size_t budget)
+{
+	heap_t* root = parent->root;
+	heap_t* child = heap_alloc(root, sizeof(heap_t), 8);
+	if (!child)
+	{
+		return NULL;
+	}
+	memset(child, 0, sizeof(*child));
+	child->root = root;
+	child->name = name;
+	child->budget = budget;
+
+	lock_acquire(&root->lock);
+	for (int tag = 1; tag <= k_heap_child_max; ++tag)
+	{
+		if (!root->children[tag])
+		{
+			root->children[tag] = child;
+			child->tag = tag;
+			break;
+		}
+	}
+	lock_release(&root->lock);
+
+	if (!child->tag)
+	{
+		debug_print(k_print_error, "Heap: no room for child heap %s.\n", name);
+		heap_free(root, child);
+		return NULL;
+	}
+	return child;
+}
+
 void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 {
-	mutex_lock(heap->mutex);
-	//alloc an additional sizeof(backtrace_t) bytes as overhead for the backtrace data
-	void* address = tlsf_memalign(heap->tlsf, alignment, size + sizeof(backtrace_t));
+	return site_alloc(heap, size, alignment, _ReturnAddress());
+}
+
+// Allocate as heap_alloc() on behalf of the caller at site.
+static void* site_alloc(heap_t* heap, size_t size, size_t alignment, void* site)
+{
+	void* address = root_alloc(heap->root, size, alignment);
+	if (address)
+	{
+		//cached blocks come back with the tag of their last owner
+		block_header_t* header = (block_header_t*)address - 1;
+		header->tag = (unsigned char)heap->tag;
+		if (heap->tag)
+		{
+			child_account(heap, block_capacity(header));
+		}
+		if (heap->tracing)
+		{
+			trace_block(heap, (int64_t)block_capacity(header), site);
+		}
+	}
+	return address;
+}
+
+static void* root_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+	if (alignment <= k_cache_alignment && size <= k_max_cached_size)
+	{
+		thread_cache_t* cache = get_thread_cache(heap);
+		if (cache)
+		{
+			int size_class = get_size_class(size);
+			if (!cache->blocks[size_class])
+			{
+				cache_refill(heap, cache, size_class);
+			}
+
+			void* address = cache->blocks[size_class];
+			if (address)
+			{
+				cache->blocks[size_class] = *(void**)address;
+				cache->counts[size_class]--;
+				record_allocation((block_header_t*)address - 1, size);
+				return address;
+			}
+		}
+	}
+
+	block_header_t* header;
+	if (is_large(heap, size, alignment))
+	{
+		header = large_alloc(heap, size, alignment);
+	}
+	else
+	{
+		lock_acquire(&heap->lock);
+		header = block_alloc(heap, size, alignment, k_size_class_none);
+		lock_release(&heap->lock);
+	}
 
+	if (!header)
+	{
+		return NULL;
+	}
+	record_allocation(header, size);
+	return header + 1;
+}
+
+void heap_free(heap_t* heap, void* address)
+{
+	site_free(heap, address, _ReturnAddress());
+}
+
+// Free as heap_free() on behalf of the caller at site.
+static void site_free(heap_t* heap, void* address, void* site)
+{
 	if (!address)
 	{
-		size_t arena_size =
+		return;
+	}
+
+	block_header_t* header = (block_header_t*)address - 1;
+	if (!record_free(header))
+	{
+		return;
+	}
+
+	heap = heap->root;
+	heap_t* owner = header->tag ? heap->children[header->tag] : heap;
+	if (header->tag)
+	{
+		child_account(owner, -(int64_t)block_capacity(header));
+	}
+	if (owner && owner->tracing)
+	{
+		trace_block(owner, -(int64_t)block_capacity(header), site);
+	}
+
+	if (header->size_class == k_size_class_large)
+	{
+		large_free(heap, header);
+		return;
+	}
+
+	if (header->size_class >= 0)
+	{
+		thread_cache_t* cache = get_thread_cache(heap);
+		if (cache)
+		{
+			*(void**)address = cache->blocks[header->size_class];
+			cache->blocks[header->size_class] = address;
+			if (++cache->counts[header->size_class] > k_cache_limit)
+			{
+				cache_flush(heap, cache, header->size_class, k_cache_batch);
+			}
+			return;
+		}
+	}
+
+	lock_acquire(&heap->lock);
+	block_free(heap, header);
+	lock_release(&heap->lock);
+}
+
+void* heap_realloc(heap_t* heap, void* address, size_t size, size_t alignment)
+{
+	void* site = _ReturnAddress();
+	if (!address)
+	{
+		return site_alloc(heap, size, alignment, site);
+	}
+	if (!size)
+	{
+		site_free(heap, address, site);
+		return NULL;
+	}
+
+	block_header_t* header = (block_header_t*)address - 1;
+	size_t capacity = block_capacity(header);
+	heap_t* root = heap->root;
+	block_header_t* resized = NULL;
+
+	//arena blocks are resized by tlsf, which grows them into the next free block or moves them itself;
+	//it only guarantees its own alignment when it moves, and sizes that belong to the OS move to it below
+	if (header->size_class == k_size_class_none &&
+		alignment <= tlsf_align_size() &&
+		!is_large(root, size, alignment))
+	{
+		lock_acquire(&root->lock);
+		resized = block_realloc(root, header, size);
+		lock_release(&root->lock);
+	}
+	else if (size <= capacity)
+	{
+		//cached and large blocks already have room up to their class or mapping size
+		resized = header;
+	}
+
+	if (resized)
+	{
+		record_resize(resized, size);
+		int64_t bytes = (int64_t)block_capacity(resized) - (int64_t)capacity;
+		heap_t* owner = resized->tag ? root->children[resized->tag] : root;
+		if (resized->tag)
+		{
+			child_account(owner, bytes);
+		}
+		if (owner && owner->tracing && bytes)
+		{
+			trace_block(owner, bytes, site);
+		}
+		return resized + 1;
+	}
+
+	void* moved = site_alloc(heap, size, alignment, site);
+	if (moved)
+	{
+		memcpy(moved, address, __min(size, capacity));
+		site_free(heap, address, site);
+	}
+	return moved;
+}
+
+void heap_get_stats(heap_t* heap, heap_stats_t* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	if (heap->tag)
+	{
+		heap_get_stats(heap->root, stats);
+		stats->used_bytes = (size_t)atomic_load64(&heap->child_used_bytes);
+		stats->peak_used_bytes = (size_t)atomic_load64(&heap->child_peak_bytes);
+		return;
+	}
+
+	lock_acquire(&heap->lock);
+	stats->used_bytes = heap->used_bytes;
+	stats->peak_used_bytes = heap->peak_used_bytes;
+	stats->large_bytes = heap->large_bytes;
+	stats->large_count = heap->large_count;
+	for (thread_cache_t* cache = heap->caches; cache; cache = cache->next)
+	{
+		for (int i = 0; i < k_size_class_count; ++i)
+		{
+			stats->cached_bytes += (size_t)cache->counts[i] * ((size_t)16 << i);
+		}
+	}
+	for (arena_t* arena = heap->arena; arena; arena = arena->next)
+	{
+		stats->arena_bytes += arena->size;
+		stats->arena_count++;
+		tlsf_walk_pool(arena->pool, stats_walker, stats);
+	}
+	lock_release(&heap->lock);
+}
+
+size_t heap_get_used_bytes(heap_t* heap)
+{
+	if (heap->tag)
+	{
+		return (size_t)atomic_load64(&heap->child_used_bytes);
+	}
+
+	lock_acquire(&heap->lock);
+	size_t used_bytes = heap->used_bytes;
+	lock_release(&heap->lock);
+	return used_bytes;
+}
+
+void heap_set_tracing(heap_t* heap, bool enabled)
+{
+	atomic_store(&heap->tracing, enabled);
+}
+
+void heap_dump_stats(heap_t* heap)
+{
+	if (heap->tag)
+	{
+		debug_print(k_print_info, "Heap: %s: %lld KB used (peak %lld KB), budget %zu KB.\n",
+			heap->name, atomic_load64(&heap->child_used_bytes) / 1024, atomic_load64(&heap->child_peak_bytes) / 1024,
+			heap->budget / 1024);
+		return;
+	}
+
+	heap_stats_t stats;
+	heap_get_stats(heap, &stats);
+
+	//fragmentation is the share of free memory that cannot be used by one allocation
+	int fragmentation = stats.free_bytes ? (int)(100 - stats.largest_free_block * 100 / stats.free_bytes) : 0;
+
+	debug_print(k_print_info, "Heap: %zu KB used (peak %zu KB, %zu KB cached), %zu KB free in %d arenas of %zu KB total.\n",
+		stats.used_bytes / 1024, stats.peak_used_bytes / 1024, stats.cached_bytes / 1024,
+		stats.free_bytes / 1024, stats.arena_count, stats.arena_bytes / 1024);
+	debug_print(k_print_info, "Heap: %d used blocks, %d free blocks, largest free block %zu bytes, %d%% fragmented.\n",
+		stats.used_block_count, stats.free_block_count, stats.largest_free_block, fragmentation);
+	debug_print(k_print_info, "Heap: %d large allocations of %zu KB total mapped from the OS.\n",
+		stats.large_count, stats.large_bytes / 1024);
+	for (int i = 0; i < k_heap_histogram_buckets; ++i)
+	{
+		if (stats.used_histogram[i] || stats.free_histogram[i])
+		{
+			debug_print(k_print_info, "Heap: %10zu%s bytes: %6d used %6d free\n",
+				(size_t)16 << i, i == k_heap_histogram_buckets - 1 ? "+" : " ",
+				stats.used_histogram[i], stats.free_histogram[i]);
+		}
+	}
+
+	for (int tag = 1; tag <= k_heap_child_max; ++tag)
+	{
+		if (heap->children[tag])
+		{
+			heap_dump_stats(heap->children[tag]);
+		}
+	}
+}
+
+void heap_destroy(heap_t* heap)
+{
+	if (heap->tag)
+	{
+		int64_t used_bytes = atomic_load64(&heap->child_used_bytes);
+		if (used_bytes)
+		{
+			debug_print(k_print_warning, "Heap: child heap %s destroyed with %lld bytes still allocated.\n", heap->name, used_bytes);
+		}
+
+		heap_t* root = heap->root;
+		lock_acquire(&root->lock);
+		root->children[heap->tag] = NULL;
+		lock_release(&root->lock);
+		heap_free(root, heap);
+		return;
+	}
+
+	tlsf_destroy(heap->tlsf);
+
+	report_leaks(heap);
+
+	arena_t* arena = heap->arena;
+	while (arena)
+	{
+		arena_t* next = arena->next;
+		VirtualFree(arena, 0, MEM_RELEASE);
+		arena = next;
+	}
+
+	TlsFree(heap->cache_tls);
+
+	VirtualFree(heap, 0, MEM_RELEASE);
+}
+
+static int get_size_class(size_t size)
+{
+	int size_class = 0;
+	while ((size_t)(16 << size_class) < size)
+	{
+		++size_class;
+	}
+	return size_class;
+}
+
+static thread_cache_t* get_thread_cache(heap_t* heap)
+{
+	if (heap->cache_tls == TLS_OUT_OF_INDEXES)
+	{
+		return NULL;
+	}
+
+	thread_cache_t* cache = TlsGetValue(heap->cache_tls);
+	if (!cache)
+	{
+		lock_acquire(&heap->lock);
+		cache = arena_alloc(heap, sizeof(thread_cache_t), 8);
+		if (cache)
+		{
+			memset(cache, 0, sizeof(*cache));
+			cache->next = heap->caches;
+			heap->caches = cache;
+		}
+		lock_release(&heap->lock);
+		TlsSetValue(heap->cache_tls, cache);
+	}
+	return cache;
+}
+
+static bool is_large(heap_t* heap, size_t size, size_t alignment)
+{
+	return size >= heap->grow_increment / 2 && alignment <= k_large_alignment;
+}
+
+// Must be called with the heap lock held.
+static block_header_t* block_alloc(heap_t* heap, size_t size, size_t alignment, int size_class)
+{
+	//the header sits right before the address, so pad the front to keep the address aligned
+	size_t offset = sizeof(block_header_t);
+	offset = (offset + (alignment - 1)) & ~(alignment - 1);
+
+	void* base = arena_alloc(heap, offset + size, alignment);
+	if (!base)
+	{
+		return NULL;
+	}
+
+	block_header_t* header = (block_header_t*)((char*)base + offset) - 1;
+	header->size_class = (signed char)size_class;
+	header->offset = (unsigned short)offset;
+	track_block(heap, header, size);
+	return header;
+}
+
+// Must be called with the heap lock held.
+static void block_free(heap_t* heap, block_header_t* header)
+{
+	untrack_block(heap, header);
+	arena_free(heap, (char*)(header + 1) - header->offset);
+}
+
+// Resize an arena block with tlsf_realloc(), which may move it to another arena.
+// Returns the block's header, or NULL with the block untouched if no arena has room.
+// Must be called with the heap lock held.
+static block_header_t* block_realloc(heap_t* heap, block_header_t* header, size_t size)
+{
+	void* base = (char*)(header + 1) - header->offset;
+	arena_t* arena = find_arena(heap, base);
+	size_t old_block_size = tlsf_block_size(base);
+
+	void* resized_base = tlsf_realloc(heap->tlsf, base, header->offset + size);
+	if (!resized_base)
+	{
+		return NULL;
+	}
+
+	//account for the block as if it were freed and allocated again
+	arena_t* resized_arena = resized_base == base ? arena : find_arena(heap, resized_base);
+	size_t block_size = tlsf_block_size(resized_base);
+	arena->used -= old_block_size;
+	resized_arena->used += block_size;
+	if (heap->empty_arena == resized_arena)
+	{
+		heap->empty_arena = NULL;
+	}
+	heap->used_bytes = heap->used_bytes - old_block_size + block_size;
+	heap->peak_used_bytes = __max(heap->peak_used_bytes, heap->used_bytes);
+
+	block_header_t* resized = (block_header_t*)((char*)resized_base + header->offset) - 1;
+	if (resized != header)
+	{
+		retrack_block(heap, resized);
+		arena_emptied(heap, arena);
+	}
+	return resized;
+}
+
+// Get the number of bytes usable at a block's address.
+static size_t block_capacity(block_header_t* header)
+{
+	char* base = (char*)(header + 1) - header->offset;
+	if (header->size_class == k_size_class_large)
+	{
+		return ((large_block_t*)base)->size - header->offset;
+	}
+	if (header->size_class >= 0)
+	{
+		return (size_t)16 << header->size_class;
+	}
+	return tlsf_block_size(base) - header->offset;
+}
+
+static block_header_t* large_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+	//pages come straight from the OS with the block's size stored at the start
+	size_t offset = sizeof(large_block_t) + sizeof(block_header_t);
+	offset = (offset + (alignment - 1)) & ~(alignment - 1);
+
+	size_t mapping_size = offset + size;
+	TRACE_ZONE_BEGIN(k_trace_category_alloc, "Large Alloc");
+	char* base = os_alloc(heap, &mapping_size);
+	TRACE_ZONE_END(k_trace_category_alloc);
+	if (!base)
+	{
+		debug_print(
+			k_print_error,
+			"OUT OF MEMORY!\n");
+		return NULL;
+	}
+
+	large_block_t* large = (large_block_t*)base;
+	large->size = mapping_size;
+
+	block_header_t* header = (block_header_t*)(base + offset) - 1;
+	header->size_class = k_size_class_large;
+	header->offset = (unsigned short)offset;
+
+	lock_acquire(&heap->lock);
+	heap->large_bytes += large->size;
+	heap->large_count++;
+	heap->used_bytes += large->size;
+	heap->peak_used_bytes = __max(heap->peak_used_bytes, heap->used_bytes);
+	track_block(heap, header, size);
+	lock_release(&heap->lock);
+
+	return header;
+}
+
+static void large_free(heap_t* heap, block_header_t* header)
+{
+	large_block_t* large = (large_block_t*)((char*)(header + 1) - header->offset);
+
+	lock_acquire(&heap->lock);
+	untrack_block(heap, header);
+	heap->large_bytes -= large->size;
+	heap->large_count--;
+	heap->used_bytes -= large->size;
+	lock_release(&heap->lock);
+
+	TRACE_ZONE_BEGIN(k_trace_category_alloc, "Large Free");
+	VirtualFree(large, 0, MEM_RELEASE);
+	TRACE_ZONE_END(k_trace_category_alloc);
+}
+
+// Map pages from the OS, rounding size up to whole large pages and writing it back when the heap uses them.
+// Falls back to normal pages once physical memory is too fragmented for large ones.
+static void* os_alloc(heap_t* heap, size_t* size)
+{
+	if (heap->large_page_size)
+	{
+		size_t large_size = (*size + (heap->large_page_size - 1)) & ~(heap->large_page_size - 1);
+		void* address = VirtualAlloc(NULL, large_size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (address)
+		{
+			*size = large_size;
+			return address;
+		}
+	}
+	return VirtualAlloc(NULL, *size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
+// Enable the privilege to lock pages in memory, which large pages need, for the whole process.
+// Returns the large page size, or 0 if large pages cannot be used.
+static size_t enable_large_pages()
+{
+	size_t page_size = GetLargePageMinimum();
+	if (!page_size)
+	{
+		return 0;
+	}
+
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+	{
+		return 0;
+	}
+	TOKEN_PRIVILEGES privileges = { .PrivilegeCount = 1 };
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	//adjusting succeeds with ERROR_NOT_ALL_ASSIGNED when the account does not hold the privilege
+	bool enabled =
+		LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid) &&
+		AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) &&
+		GetLastError() == ERROR_SUCCESS;
+	CloseHandle(token);
+	return enabled ? page_size : 0;
+}
+
+// Must be called with the heap lock held.
+static void* arena_alloc(heap_t* heap, size_t size, size_t alignment)
+{
+	void* base = tlsf_memalign(heap->tlsf, alignment, size);
+	if (!base)
+	{
+		//the pool follows the arena header and holds its own overhead on top of the usable size
+		size_t mapping_size =
+			sizeof(arena_t) +
 			__max(heap->grow_increment, size * 2) +
-			sizeof(arena_t);
-		arena_t* arena = VirtualAlloc(NULL,
-			arena_size + tlsf_pool_overhead(),
-			MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+			tlsf_pool_overhead();
+		arena_t* arena = os_alloc(heap, &mapping_size);
 		if (!arena)
 		{
 			debug_print(
@@ -80,132 +804,380 @@ void* heap_alloc(heap_t* heap, size_t size, size_t alignment)
 				"OUT OF MEMORY!\n");
 			return NULL;
 		}
+		size_t arena_size = mapping_size - sizeof(arena_t);
 
 		arena->pool = tlsf_add_pool(heap->tlsf, arena + 1, arena_size);
+		arena->size = arena_size;
+		arena->used = 0;
 
 		arena->next = heap->arena;
 		heap->arena = arena;
 
-		address = tlsf_memalign(heap->tlsf, alignment, size + sizeof(backtrace_t));
+		base = tlsf_memalign(heap->tlsf, alignment, size);
+		if (!base)
+		{
+			return NULL;
+		}
 	}
 
-	//if we create a valid address of allocated memory, store the backtrace data behind the address
-	if (address)
+	arena_t* arena = find_arena(heap, base);
+	size_t block_size = tlsf_block_size(base);
+	arena->used += block_size;
+	if (heap->empty_arena == arena)
 	{
-		backtrace_t* backtrace = (backtrace_t*)((char*)address + size);
-		backtrace->address = address;
-		backtrace->frames = debug_backtrace(backtrace->trace, FRAME_MAX);
-		backtrace->size = size;
-		backtrace->next = heap->backtrace;
-		heap->backtrace = backtrace;
+		heap->empty_arena = NULL;
 	}
 
-	mutex_unlock(heap->mutex);
-	return address;
+	heap->used_bytes += block_size;
+	heap->peak_used_bytes = __max(heap->peak_used_bytes, heap->used_bytes);
+	return base;
 }
 
-void heap_free(heap_t* heap, void* address)
+// Must be called with the heap lock held.
+static void arena_free(heap_t* heap, void* base)
 {
-	mutex_lock(heap->mutex);
+	arena_t* arena = find_arena(heap, base);
+	size_t block_size = tlsf_block_size(base);
+	arena->used -= block_size;
+	heap->used_bytes -= block_size;
+	tlsf_free(heap->tlsf, base);
+	arena_emptied(heap, arena);
+}
 
-	//find the backtrace that matches the address being freed and remove it from the linked list
-	backtrace_t* trace = heap->backtrace;
-	int freed = 0;
-	if (trace && trace->address == address)
+// Release an arena after its last block is freed, unless it is kept for reuse.
+// Must be called with the heap lock held.
+static void arena_emptied(heap_t* heap, arena_t* arena)
+{
+	//keep one empty arena around so a heap hovering at an arena boundary does not thrash the OS
+	if (arena->used == 0)
 	{
-		heap->backtrace = trace->next;
-		tlsf_free(heap->tlsf, address);
-		freed = 1;
+		if (heap->empty_arena)
+		{
+			arena_release(heap, arena);
+		}
+		else
+		{
+			heap->empty_arena = arena;
+		}
 	}
-	else if(trace)
+}
+
+// Must be called with the heap lock held.
+static void arena_release(heap_t* heap, arena_t* arena)
+{
+	arena_t** link = &heap->arena;
+	while (*link != arena)
 	{
-		while (trace->next)
+		link = &(*link)->next;
+	}
+	*link = arena->next;
+
+	tlsf_remove_pool(heap->tlsf, arena->pool);
+	VirtualFree(arena, 0, MEM_RELEASE);
+}
+
+// Must be called with the heap lock held.
+static arena_t* find_arena(heap_t* heap, void* base)
+{
+	arena_t* arena = heap->arena;
+	while (arena)
+	{
+		char* start = (char*)(arena + 1);
+		if ((char*)base >= start && (char*)base < start + arena->size)
 		{
-			if (trace->next->address == address)
-			{
-				trace->next = trace->next->next;
-				tlsf_free(heap->tlsf, address);
-				freed = 1;
-				break;
-			}
-			else
-			{
-				trace = trace->next;
-			}
+			break;
 		}
+		arena = arena->next;
 	}
-	/*
-	if (freed == 0)
+	return arena;
+}
+
+// Must be called with the heap lock held.
+static void track_block(heap_t* heap, block_header_t* header, size_t size)
+{
+#if HEAP_TRACKING
+	header->in_use = false;
+	header->stack = 0;
+	header->size = size;
+	header->prev = NULL;
+	header->next = heap->blocks;
+	if (heap->blocks)
 	{
-		HANDLE process = GetCurrentProcess();
-		PIMAGEHLP_SYMBOL64 symbol;
+		heap->blocks->prev = header;
+	}
+	heap->blocks = header;
+#endif
+}
 
-		SymInitialize(process, NULL, TRUE);
+// Must be called with the heap lock held.
+static void untrack_block(heap_t* heap, block_header_t* header)
+{
+#if HEAP_TRACKING
+	//remove the block being freed from the linked list
+	if (header->prev)
+	{
+		header->prev->next = header->next;
+	}
+	else
+	{
+		heap->blocks = header->next;
+	}
+	if (header->next)
+	{
+		header->next->prev = header->prev;
+	}
+#endif
+}
 
-		symbol = (IMAGEHLP_SYMBOL64*)calloc(sizeof(IMAGEHLP_SYMBOL64) + 256 * sizeof(char), 1);
-		symbol->MaxNameLength = 255;
-		symbol->SizeOfStruct = sizeof(IMAGEHLP_SYMBOL64);
+// Point the linked list at a block's header after the block has moved, keeping its tracking information.
+// Must be called with the heap lock held.
+static void retrack_block(heap_t* heap, block_header_t* header)
+{
+#if HEAP_TRACKING
+	if (header->prev)
+	{
+		header->prev->next = header;
+	}
+	else
+	{
+		heap->blocks = header;
+	}
+	if (header->next)
+	{
+		header->next->prev = header;
+	}
+#endif
+}
 
-		//parse through each backtrace_t struct and print its leak information
-		backtrace_t* trace = heap->backtrace;
-		while (trace)
+static void cache_refill(heap_t* heap, thread_cache_t* cache, int size_class)
+{
+	lock_acquire(&heap->lock);
+	for (int i = 0; i < k_cache_batch; ++i)
+	{
+		block_header_t* header = block_alloc(heap, (size_t)16 << size_class, k_cache_alignment, size_class);
+		if (!header)
 		{
-			debug_print(k_print_warning, "Double free of size %d bytes of data and %d bytes of overhead at address %p with callstack attempted:\n", (int)trace->size, (int)sizeof(backtrace_t), trace->address);
-			for (unsigned int i = 0; i < trace->frames; i++)
-			{
-				SymGetSymFromAddr64(process, (DWORD64)(trace->trace[i]), 0, symbol);
-				debug_print(k_print_warning, "[%i] %s\n", trace->frames - i - 1, symbol->Name);
-			}
+			break;
+		}
+		void* address = header + 1;
+		*(void**)address = cache->blocks[size_class];
+		cache->blocks[size_class] = address;
+		cache->counts[size_class]++;
+	}
+	lock_release(&heap->lock);
+}
 
-			trace = trace->next;
+static void cache_flush(heap_t* heap, thread_cache_t* cache, int size_class, int count)
+{
+	lock_acquire(&heap->lock);
+	for (int i = 0; i < count && cache->blocks[size_class]; ++i)
+	{
+		void* address = cache->blocks[size_class];
+		cache->blocks[size_class] = *(void**)address;
+		cache->counts[size_class]--;
+		block_free(heap, (block_header_t*)address - 1);
+	}
+	lock_release(&heap->lock);
+}
+
+// Count bytes allocated, or freed if negative, in a child heap, warning as it first goes over budget.
+static void child_account(heap_t* child, int64_t bytes)
+{
+	if (!child)
+	{
+		return;
+	}
+
+	int64_t used_bytes = atomic_fetch_add64(&child->child_used_bytes, bytes) + bytes;
+	int64_t peak_bytes = atomic_load64(&child->child_peak_bytes);
+	while (used_bytes > peak_bytes)
+	{
+		int64_t old_peak = atomic_compare_and_exchange64(&child->child_peak_bytes, peak_bytes, used_bytes);
+		if (old_peak == peak_bytes)
+		{
+			break;
 		}
+		peak_bytes = old_peak;
+	}
 
-		free(symbol);
-		SymCleanup(process);
+	if (child->budget)
+	{
+		int over_budget = used_bytes > (int64_t)child->budget;
+		if (over_budget != atomic_load(&child->over_budget) &&
+			atomic_exchange(&child->over_budget, over_budget) != over_budget &&
+			over_budget)
+		{
+			debug_print(k_print_warning, "Heap: %s is over its budget of %zu KB with %lld KB used.\n",
+				child->name, child->budget / 1024, used_bytes / 1024);
+		}
 	}
-	*/
-	mutex_unlock(heap->mutex);
 }
 
-void heap_destroy(heap_t* heap)
+static void record_allocation(block_header_t* header, size_t size)
 {
-	tlsf_destroy(heap->tlsf);
+#if HEAP_TRACKING
+	header->size = size;
+	header->in_use = true;
+	void* trace[FRAME_MAX];
+	header->stack = stack_intern(trace, debug_backtrace(trace, FRAME_MAX));
+#endif
+}
 
-	HANDLE process = GetCurrentProcess();
-	PIMAGEHLP_SYMBOL64 symbol;
+static void record_resize(block_header_t* header, size_t size)
+{
+#if HEAP_TRACKING
+	//the block keeps the backtrace of its original allocation
+	header->size = size;
+#endif
+}
 
-	SymInitialize(process, NULL, TRUE);
+static bool record_free(block_header_t* header)
+{
+#if HEAP_TRACKING
+	if (!header->in_use)
+	{
+		debug_print(k_print_warning, "Double free of size %d bytes at address %p attempted.\n", (int)header->size, header + 1);
+		return false;
+	}
+	header->in_use = false;
+#endif
+	return true;
+}
 
-	symbol = (IMAGEHLP_SYMBOL64*)calloc(sizeof(IMAGEHLP_SYMBOL64) + 256 * sizeof(char), 1);
-	symbol->MaxNameLength = 255;
-	symbol->SizeOfStruct = sizeof(IMAGEHLP_SYMBOL64);
+// Record a block allocated, or freed if bytes is negative, and the heap's used bytes after it, in the default trace.
+static void trace_block(heap_t* heap, int64_t bytes, void* site)
+{
+	if (!TRACE_ZONES || !(k_trace_category_alloc & TRACE_ZONE_CATEGORIES) || !trace_zone_enabled(k_trace_category_alloc))
+	{
+		return;
+	}
 
-	//parse through each backtrace_t struct and print its leak information
-	backtrace_t* trace = heap->backtrace;
-	while (trace)
+	//a root heap's used bytes move as arenas and large blocks come and go, so a stale read only lags the counter
+	const char* name = heap->tag ? heap->name : "heap";
+	int64_t used_bytes = heap->tag ? atomic_load64(&heap->child_used_bytes) : (int64_t)*(volatile size_t*)&heap->used_bytes;
+	trace_t* trace = trace_get_default();
+	trace_memory(trace, name, bytes, (uint32_t)((uintptr_t)site - (uintptr_t)&__ImageBase));
+	trace_counter(trace, name, used_bytes);
+}
+
+// Get the id of a backtrace, adding it to the table if this is its first allocation.
+// Returns 0 if the table is full.
+static uint32_t stack_intern(void** trace, int frames)
+{
+#if HEAP_TRACKING
+	uint64_t mix = (uint64_t)frames;
+	for (int i = 0; i < frames; ++i)
 	{
-		debug_print(k_print_warning, "Memory leak of size %d bytes of data and %d bytes of overhead at address %p with callstack:\n", (int)trace->size, (int)sizeof(backtrace_t), trace->address);
-		for (unsigned int i = 0; i < trace->frames; i++)
+		mix = (mix ^ (uint64_t)(uintptr_t)trace[i]) * 0x9e3779b97f4a7c15ull;
+	}
+	int hash = (int)(mix >> 32) | 1;
+
+	//backtraces are never removed, so a lookup probes without the lock and takes it only to add one
+	heap_stack_t* stacks = atomic_load_ptr((void**)&s_stacks);
+	if (stacks)
+	{
+		uint32_t slot = stack_find(stacks, hash, trace, frames);
+		if (atomic_load_acquire(&stacks[slot].hash))
 		{
-			SymGetSymFromAddr64(process, (DWORD64)(trace->trace[i]), 0, symbol);
-			debug_print(k_print_warning, "[%i] %s\n", trace->frames - i - 1, symbol->Name);
+			return slot + 1;
 		}
+	}
 
-		trace = trace->next;
+	lock_acquire(&s_stack_lock);
+	if (!s_stacks)
+	{
+		atomic_store_ptr((void**)&s_stacks, VirtualAlloc(NULL, sizeof(heap_stack_t) * k_stack_slots, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
 	}
+	uint32_t id = 0;
+	if (s_stacks)
+	{
+		uint32_t slot = stack_find(s_stacks, hash, trace, frames);
+		if (s_stacks[slot].hash)
+		{
+			id = slot + 1;
+		}
+		else if (s_stack_count < k_stack_slots / 4 * 3)
+		{
+			s_stacks[slot].frames = frames;
+			memcpy(s_stacks[slot].trace, trace, sizeof(void*) * frames);
+			atomic_store_release(&s_stacks[slot].hash, hash);
+			s_stack_count++;
+			id = slot + 1;
+		}
+	}
+	lock_release(&s_stack_lock);
+	return id;
+#else
+	return 0;
+#endif
+}
 
-	free(symbol);
-	SymCleanup(process);
+// Find the slot holding a backtrace, or the empty slot where it belongs.
+static uint32_t stack_find(heap_stack_t* stacks, int hash, void** trace, int frames)
+{
+	uint32_t slot = (uint32_t)hash & (k_stack_slots - 1);
+	while (true)
+	{
+		heap_stack_t* stack = &stacks[slot];
+		int stack_hash = atomic_load_acquire(&stack->hash);
+		if (!stack_hash ||
+			(stack_hash == hash && stack->frames == frames && !memcmp(stack->trace, trace, sizeof(void*) * frames)))
+		{
+			return slot;
+		}
+		slot = (slot + 1) & (k_stack_slots - 1);
+	}
+}
 
-	arena_t* arena = heap->arena;
-	while (arena)
+static void report_leaks(heap_t* heap)
+{
+#if HEAP_TRACKING
+	//parse through each block and print leak information for those still in use
+	//blocks sitting free in a thread cache are not leaks
+	block_header_t* trace = heap->blocks;
+	while (trace)
 	{
-		arena_t* next = arena->next;
-		VirtualFree(arena, 0, MEM_RELEASE);
-		arena = next;
+		if (trace->in_use)
+		{
+			debug_print(k_print_warning, "Memory leak of size %d bytes of data and %d bytes of overhead at address %p with callstack:\n", (int)trace->size, (int)trace->offset, trace + 1);
+			heap_stack_t* stack = trace->stack ? &s_stacks[trace->stack - 1] : NULL;
+			for (int i = 0; stack && i < stack->frames; i++)
+			{
+				char name[128];
+				debug_symbolize(stack->trace[i], name, sizeof(name));
+				debug_print(k_print_warning, "[%i] %s\n", stack->frames - i - 1, name);
+			}
+		}
+
+		trace = trace->next;
 	}
+#endif
+}
 
-	mutex_destroy(heap->mutex);
+static void stats_walker(void* ptr, size_t size, int used, void* user)
+{
+	heap_stats_t* stats = user;
+	int bucket = get_histogram_bucket(size);
+	if (used)
+	{
+		stats->used_block_count++;
+		stats->used_histogram[bucket]++;
+	}
+	else
+	{
+		stats->free_bytes += size;
+		stats->largest_free_block = __max(stats->largest_free_block, size);
+		stats->free_block_count++;
+		stats->free_histogram[bucket]++;
+	}
+}
 
-	VirtualFree(heap, 0, MEM_RELEASE);
+static int get_histogram_bucket(size_t size)
+{
+	int bucket = 0;
+	while (bucket < k_heap_histogram_buckets - 1 && ((size_t)32 << bucket) <= size)
+	{
+		++bucket;
+	}
+	return bucket;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdlib.h>
 
 // Heap Memory Manager
@@ -10,16 +11,99 @@
 // Handle to a heap.
 typedef struct heap_t heap_t;
 
+enum
+{
+	// Histogram bucket i counts blocks of 2^(i+4) up to 2^(i+5) bytes; the last bucket holds everything larger.
+	k_heap_histogram_buckets = 20,
+
+	// Child heaps one heap can have alive at once.
+	k_heap_child_max = 31,
+};
+
+// Snapshot of heap usage returned by heap_get_stats().
+typedef struct heap_stats_t
+{
+	size_t used_bytes; // bytes in blocks handed out, including blocks idle in thread caches and large allocations
+	size_t peak_used_bytes; // highest used_bytes since the heap was created
+	size_t cached_bytes; // bytes idle in thread caches; approximate while other threads allocate
+	size_t free_bytes; // bytes in free blocks across all arenas
+	size_t largest_free_block; // size of the largest free block, the biggest allocation possible without growing
+	size_t arena_bytes; // total size of all arenas
+	size_t large_bytes; // bytes mapped directly from the OS for large allocations
+	int arena_count;
+	int large_count;
+	int used_block_count;
+	int free_block_count;
+	int used_histogram[k_heap_histogram_buckets];
+	int free_histogram[k_heap_histogram_buckets];
+} heap_stats_t;
+
 // Creates a new memory heap.
 // The grow increment is the default size with which the heap grows.
 // Should be a multiple of OS page size.
+// Allocations of at least half the grow increment are mapped directly from the OS,
+// and arenas left empty are returned to the OS, keeping one spare.
 heap_t* heap_create(size_t grow_increment);
 
+// Options for creating a heap.
+// Options zero-initialized apart from the grow increment give the same heap as heap_create().
+typedef struct heap_options_t
+{
+	// The default size with which the heap grows, as for heap_create().
+	size_t grow_increment;
+	// Map arenas and large allocations with large pages, usually 2 MB, so scans over big arrays miss the TLB far less.
+	// Each mapping rounds up to whole large pages, so this suits heaps dedicated to bulk data.
+	// Needs the account's "Lock pages in memory" privilege; without it, or once no large pages are free,
+	// the heap falls back to normal pages.
+	bool large_pages;
+} heap_options_t;
+
+// Creates a new memory heap with the specified options.
+heap_t* heap_create_with_options(const heap_options_t* options);
+
+// Creates a child heap, which allocates from its parent's arenas and thread caches but counts its own usage,
+// so memory growth can be attributed to the subsystem given the child.
+// Blocks are attributed to the heap they were allocated from, whichever heap frees them.
+// Once usage first exceeds a nonzero budget in bytes, a warning is printed; it prints again only after
+// usage has dropped back under the budget. The name must outlive the child.
+// A child of a child heap shares the arenas of the first parent.
+// Returns NULL if the parent already has k_heap_child_max children.
+heap_t* heap_create_child(heap_t* parent, const char* name, size_t budget);
+
 // Destroy a previously created heap.
+// Child heaps must be destroyed before their parent; a child destroyed with blocks still allocated warns.
 void heap_destroy(heap_t* heap);
 
 // Allocate memory from a heap.
+// Small allocations are served from a cache local to the calling thread without locking.
 void* heap_alloc(heap_t* heap, size_t size, size_t alignment);
 
 // Free memory previously allocated from a heap.
+// Memory may be freed from any thread; small blocks go to the freeing thread's cache.
 void heap_free(heap_t* heap, void* address);
+
+// Resize memory previously allocated from a heap, keeping its contents up to the smaller of the two sizes.
+// Alignment must be at least the alignment the memory was allocated with.
+// A block grows in place into free memory right after it where there is some, so growing a buffer
+// rarely copies; otherwise it moves as heap_alloc(), memcpy() and heap_free() would.
+// A NULL address allocates and a size of 0 frees, returning NULL.
+// Returns NULL with the memory left untouched if the heap is out of memory.
+void* heap_realloc(heap_t* heap, void* address, size_t size, size_t alignment);
+
+// Fill out a snapshot of the heap's memory usage.
+// Walks every block in every arena with the heap locked, so avoid calling this every frame.
+// A child heap gives its parent's snapshot with its own used_bytes and peak_used_bytes.
+void heap_get_stats(heap_t* heap, heap_stats_t* stats);
+
+// Get the used_bytes of heap_get_stats() without walking the arenas. Cheap enough for every frame.
+size_t heap_get_used_bytes(heap_t* heap);
+
+// Record every block allocated from or freed to a heap in the default trace while it captures the
+// k_trace_category_alloc category, with its capacity and call site, along with a counter track of the
+// heap's used bytes. Off by default; when off, an allocation pays one extra load.
+// Blocks count against the heap they were allocated from, so a root heap's setting leaves out its children.
+void heap_set_tracing(heap_t* heap, bool enabled);
+
+// Print heap usage, fragmentation and block size histograms to the debug log, followed by the usage of each child heap.
+// A child heap prints its own usage only.
+void heap_dump_stats(heap_t* heap);
@@ -0,0 +1,404 @@
+#include "hierarchy.h"
+
+#include "debug.h"
+#include "heap.h"
+#include "trace.h"
+#include "transform.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+	// Nodes tracked before the arrays first grow.
+	k_hierarchy_initial_capacity = 64,
+};
+
+typedef struct hierarchy_component_t
+{
+	ecs_entity_ref_t parent;
+	transform_t local;
+	int node; //index in depth-first order, or -1 if detached
+} hierarchy_component_t;
+
+// Entity in depth-first order: a parent is always before its children.
+// Roots are the parents without parents of their own, whose transforms something else writes.
+typedef struct hierarchy_node_t
+{
+	ecs_entity_ref_t entity;
+	int parent; //node index, or -1 for a root
+	int end; //one past the last node in this node's subtree
+} hierarchy_node_t;
+
+// Attached entity gathered while rebuilding the order.
+typedef struct hierarchy_gather_t
+{
+	ecs_entity_ref_t entity;
+	ecs_entity_ref_t parent;
+	int first_child;
+	int next_sibling;
+	int node;
+} hierarchy_gather_t;
+
+// Gathered entity whose parent is a root, sorted by the root so its children are adjacent.
+typedef struct hierarchy_root_child_t
+{
+	uint64_t root;
+	int gather;
+} hierarchy_root_child_t;
+
+typedef struct hierarchy_t
+{
+	heap_t* heap;
+	ecs_t* ecs;
+	int transform_type;
+	int hierarchy_type;
+
+	bool rebuild; //attachments changed since the order was built
+	uint32_t since_tick; //tick of the last update
+
+	// Per node arrays, capacity long.
+	hierarchy_node_t* nodes;
+	transform_t** worlds; //transforms of the subtree being updated
+	int* dirty; //nodes whose subtrees need updating
+	int* roots;
+	int node_count;
+	int root_count;
+	int capacity;
+
+	// Rebuild scratch, also capacity long.
+	hierarchy_gather_t* gathers;
+	hierarchy_root_child_t* root_children;
+	int* stack;
+} hierarchy_t;
+
+static void reserve(hierarchy_t* hierarchy, int count);
+static void rebuild(hierarchy_t* hierarchy);
+static void update_subtree(hierarchy_t* hierarchy, int node);
+static uint64_t ref_key(ecs_entity_ref_t ref);
+static int compare_root_children(const void* a, const void* b);
+static int compare_nodes(const void* a, const void* b);
+
+hierarchy_t* hierarchy_create(heap_t* heap, ecs_t* ecs, int transform_type)
+{
+	hierarchy_t* hierarchy = heap_alloc(heap, sizeof(hierarchy_t), 8);
+	memset(hierarchy, 0, sizeof(*hierarchy));
+	hierarchy->heap = heap;
+	hierarchy->ecs = ecs;
+	hierarchy->transform_type = transform_type;
+	hierarchy->hierarchy_type = ecs_register_component_type(ecs, "hierarchy", sizeof(hierarchy_component_t), _Alignof(hierarchy_component_t));
+	reserve(hierarchy, k_hierarchy_initial_capacity);
+	return hierarchy;
+}
+
+void hierarchy_destroy(hierarchy_t* hierarchy)
+{
+	heap_free(hierarchy->heap, hierarchy->nodes);
+	heap_free(hierarchy->heap, hierarchy->worlds);
+	heap_free(hierarchy->heap, hierarchy->dirty);
+	heap_free(hierarchy->heap, hierarchy->roots);
+	heap_free(hierarchy->heap, hierarchy->gathers);
+	heap_free(hierarchy->heap, hierarchy->root_children);
+	heap_free(hierarchy->heap, hierarchy->stack);
+	heap_free(hierarchy->heap, hierarchy);
+}
+
+int hierarchy_get_component_type(hierarchy_t* hierarchy)
+{
+	return hierarchy->hierarchy_type;
+}
+
+void hierarchy_set_parent(hierarchy_t* hierarchy, ecs_entity_ref_t entity, ecs_entity_ref_t parent, const transform_t* local)
+{
+	hierarchy_component_t* comp = ecs_entity_get_component(hierarchy->ecs, entity, hierarchy->hierarchy_type, true);
+	if (!comp)
+	{
+		debug_print(k_print_warning, "Attaching an entity without a hierarchy component.\n");
+		return;
+	}
+	comp->parent = parent;
+	comp->local = *local;
+	ecs_entity_mark_changed(hierarchy->ecs, entity, hierarchy->hierarchy_type);
+	hierarchy->rebuild = true;
+}
+
+void hierarchy_set_local(hierarchy_t* hierarchy, ecs_entity_ref_t entity, const transform_t* local)
+{
+	hierarchy_component_t* comp = ecs_entity_get_component(hierarchy->ecs, entity, hierarchy->hierarchy_type, true);
+	if (comp)
+	{
+		comp->local = *local;
+		ecs_entity_mark_changed(hierarchy->ecs, entity, hierarchy->hierarchy_type);
+	}
+}
+
+void hierarchy_update(hierarchy_t* hierarchy)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_ecs, "hierarchy_update");
+
+	// Changes on the tick of the last update are seen again, so writes after it on that tick aren't missed.
+	uint32_t since_tick = hierarchy->since_tick;
+	hierarchy->since_tick = ecs_get_tick(hierarchy->ecs);
+
+	int dirty_count = 0;
+	if (hierarchy->rebuild)
+	{
+		rebuild(hierarchy);
+		memcpy(hierarchy->dirty, hierarchy->roots, sizeof(int) * hierarchy->root_count);
+		dirty_count = hierarchy->root_count;
+	}
+	else
+	{
+		for (int i = 0; i < hierarchy->root_count; ++i)
+		{
+			int root = hierarchy->roots[i];
+			if (ecs_entity_get_component_version(hierarchy->ecs, hierarchy->nodes[root].entity, hierarchy->transform_type) >= since_tick)
+			{
+				hierarchy->dirty[dirty_count++] = root;
+			}
+		}
+
+		ecs_mask_t k_hierarchy_mask = ECS_MASK(hierarchy->hierarchy_type);
+		for (ecs_query_t query = ecs_query_create_changed(hierarchy->ecs, k_hierarchy_mask, k_hierarchy_mask, since_tick);
+			ecs_query_is_valid(hierarchy->ecs, &query);
+			ecs_query_next(hierarchy->ecs, &query))
+		{
+			//entities spawned since the last rebuild hold no node index yet
+			hierarchy_component_t* comp = ecs_query_get_component(hierarchy->ecs, &query, hierarchy->hierarchy_type);
+			ecs_entity_ref_t entity = ecs_query_get_entity(hierarchy->ecs, &query);
+			if (comp->node >= 0 && comp->node < hierarchy->node_count &&
+				hierarchy->nodes[comp->node].entity.entity == entity.entity &&
+				hierarchy->nodes[comp->node].entity.sequence == entity.sequence)
+			{
+				hierarchy->dirty[dirty_count++] = comp->node;
+			}
+		}
+	}
+
+	// A dirty node inside a subtree already updated needs nothing more.
+	qsort(hierarchy->dirty, dirty_count, sizeof(int), compare_nodes);
+	int updated_end = 0;
+	for (int i = 0; i < dirty_count; ++i)
+	{
+		int node = hierarchy->dirty[i];
+		if (node >= updated_end)
+		{
+			update_subtree(hierarchy, node);
+			updated_end = hierarchy->nodes[node].end;
+		}
+	}
+
+	TRACE_ZONE_END(k_trace_category_ecs);
+}
+
+static void reserve(hierarchy_t* hierarchy, int count)
+{
+	if (count <= hierarchy->capacity)
+	{
+		return;
+	}
+
+	int capacity = __max(hierarchy->capacity, k_hierarchy_initial_capacity);
+	while (capacity < count)
+	{
+		capacity *= 2;
+	}
+
+	//node order is rebuilt after growing, so nothing needs copying
+	heap_t* heap = hierarchy->heap;
+	heap_free(heap, hierarchy->nodes);
+	heap_free(heap, hierarchy->worlds);
+	heap_free(heap, hierarchy->dirty);
+	heap_free(heap, hierarchy->roots);
+	heap_free(heap, hierarchy->gathers);
+	heap_free(heap, hierarchy->root_children);
+	heap_free(heap, hierarchy->stack);
+	hierarchy->nodes = heap_alloc(heap, sizeof(hierarchy_node_t) * capacity, 8);
+	hierarchy->worlds = heap_alloc(heap, sizeof(transform_t*) * capacity, 8);
+	hierarchy->dirty = heap_alloc(heap, sizeof(int) * capacity, 8);
+	hierarchy->roots = heap_alloc(heap, sizeof(int) * capacity, 8);
+	hierarchy->gathers = heap_alloc(heap, sizeof(hierarchy_gather_t) * capacity, 8);
+	hierarchy->root_children = heap_alloc(heap, sizeof(hierarchy_root_child_t) * capacity, 8);
+	hierarchy->stack = heap_alloc(heap, sizeof(int) * capacity * 2, 8);
+	hierarchy->node_count = 0;
+	hierarchy->root_count = 0;
+	hierarchy->capacity = capacity;
+}
+
+static void rebuild(hierarchy_t* hierarchy)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_ecs, "hierarchy_rebuild");
+	ecs_t* ecs = hierarchy->ecs;
+	hierarchy->rebuild = false;
+
+	//chunk queries include entities spawned this frame, which may already be attached
+	ecs_mask_t k_attached_mask = ECS_MASK(hierarchy->hierarchy_type, hierarchy->transform_type);
+	int gather_count = 0;
+	for (ecs_chunk_query_t query = ecs_chunk_query_create(ecs, k_attached_mask);
+		ecs_chunk_query_is_valid(ecs, &query);
+		ecs_chunk_query_next(ecs, &query))
+	{
+		gather_count += ecs_chunk_query_get_count(ecs, &query);
+	}
+
+	//every attached entity may have a root of its own
+	reserve(hierarchy, gather_count * 2);
+
+	gather_count = 0;
+	for (ecs_chunk_query_t query = ecs_chunk_query_create(ecs, k_attached_mask);
+		ecs_chunk_query_is_valid(ecs, &query);
+		ecs_chunk_query_next(ecs, &query))
+	{
+		hierarchy_component_t* comps = ecs_chunk_query_get_components(ecs, &query, hierarchy->hierarchy_type);
+		int count = ecs_chunk_query_get_count(ecs, &query);
+		for (int i = 0; i < count; ++i)
+		{
+			hierarchy_gather_t* gather = &hierarchy->gathers[gather_count];
+			gather->entity = ecs_chunk_query_get_entity(ecs, &query, i);
+			gather->parent = comps[i].parent;
+			gather->first_child = -1;
+			gather->next_sibling = -1;
+			gather->node = -1;
+			comps[i].node = gather_count++;
+		}
+	}
+
+	//link children to attached parents; parents that aren't attached themselves are roots
+	int root_child_count = 0;
+	for (int i = 0; i < gather_count; ++i)
+	{
+		hierarchy_gather_t* gather = &hierarchy->gathers[i];
+		if (!ecs_entity_get_component(ecs, gather->parent, hierarchy->transform_type, true))
+		{
+			continue;
+		}
+
+		hierarchy_component_t* parent_comp = ecs_entity_get_component(ecs, gather->parent, hierarchy->hierarchy_type, true);
+		if (parent_comp)
+		{
+			hierarchy_gather_t* parent = &hierarchy->gathers[parent_comp->node];
+			gather->next_sibling = parent->first_child;
+			parent->first_child = i;
+		}
+		else
+		{
+			hierarchy->root_children[root_child_count++] = (hierarchy_root_child_t) { .root = ref_key(gather->parent), .gather = i };
+		}
+	}
+	qsort(hierarchy->root_children, root_child_count, sizeof(hierarchy_root_child_t), compare_root_children);
+
+	//walk down from each root; attachments in a cycle are never reached
+	hierarchy->node_count = 0;
+	hierarchy->root_count = 0;
+	for (int i = 0; i < root_child_count; ++i)
+	{
+		const hierarchy_gather_t* first = &hierarchy->gathers[hierarchy->root_children[i].gather];
+		if (i == 0 || hierarchy->root_children[i].root != hierarchy->root_children[i - 1].root)
+		{
+			if (hierarchy->root_count)
+			{
+				hierarchy->nodes[hierarchy->roots[hierarchy->root_count - 1]].end = hierarchy->node_count;
+			}
+			hierarchy->roots[hierarchy->root_count++] = hierarchy->node_count;
+			hierarchy->nodes[hierarchy->node_count++] = (hierarchy_node_t) { .entity = first->parent, .parent = -1 };
+		}
+		int root = hierarchy->roots[hierarchy->root_count - 1];
+
+		//stack entries are gathers to visit, or the complement of a node whose subtree is finished
+		int stack_count = 0;
+		hierarchy->stack[stack_count++] = hierarchy->root_children[i].gather;
+		hierarchy->gathers[hierarchy->root_children[i].gather].node = root;
+		while (stack_count)
+		{
+			int top = hierarchy->stack[--stack_count];
+			if (top < 0)
+			{
+				hierarchy->nodes[~top].end = hierarchy->node_count;
+				continue;
+			}
+
+			//gather node holds the parent's node until this one is placed
+			hierarchy_gather_t* gather = &hierarchy->gathers[top];
+			int node = hierarchy->node_count++;
+			hierarchy->nodes[node] = (hierarchy_node_t) { .entity = gather->entity, .parent = gather->node };
+			gather->node = node;
+			hierarchy->stack[stack_count++] = ~node;
+			for (int child = gather->first_child; child >= 0; child = hierarchy->gathers[child].next_sibling)
+			{
+				hierarchy->gathers[child].node = node;
+				hierarchy->stack[stack_count++] = child;
+			}
+		}
+	}
+	if (hierarchy->root_count)
+	{
+		hierarchy->nodes[hierarchy->roots[hierarchy->root_count - 1]].end = hierarchy->node_count;
+	}
+
+	//replace the gather indices left in components with node indices; unreached gathers never had a node placed
+	for (ecs_chunk_query_t query = ecs_chunk_query_create(ecs, k_attached_mask);
+		ecs_chunk_query_is_valid(ecs, &query);
+		ecs_chunk_query_next(ecs, &query))
+	{
+		hierarchy_component_t* comps = ecs_chunk_query_get_components(ecs, &query, hierarchy->hierarchy_type);
+		int count = ecs_chunk_query_get_count(ecs, &query);
+		for (int i = 0; i < count; ++i)
+		{
+			comps[i].node = hierarchy->gathers[comps[i].node].node;
+		}
+	}
+	TRACE_ZONE_END(k_trace_category_ecs);
+}
+
+static void update_subtree(hierarchy_t* hierarchy, int node)
+{
+	ecs_t* ecs = hierarchy->ecs;
+	hierarchy_node_t* nodes = hierarchy->nodes;
+	transform_t** worlds = hierarchy->worlds;
+
+	//the subtree's top node reads its parent's transform, which may itself be a root
+	int first = node;
+	int parent = nodes[node].parent;
+	if (parent < 0)
+	{
+		parent = node;
+		first = node + 1;
+	}
+	worlds[parent] = ecs_entity_get_component(ecs, nodes[parent].entity, hierarchy->transform_type, true);
+
+	for (int i = first; i < nodes[node].end; ++i)
+	{
+		// Removed entities leave holes until the next rebuild; their subtrees stop following.
+		hierarchy_component_t* comp = ecs_entity_get_component(ecs, nodes[i].entity, hierarchy->hierarchy_type, true);
+		worlds[i] = ecs_entity_get_component(ecs, nodes[i].entity, hierarchy->transform_type, true);
+		if (!worlds[nodes[i].parent] || !comp || !worlds[i])
+		{
+			worlds[i] = NULL;
+			hierarchy->rebuild = true;
+			continue;
+		}
+
+		*worlds[i] = comp->local;
+		transform_multiply(worlds[i], worlds[nodes[i].parent]);
+		ecs_entity_mark_changed(ecs, nodes[i].entity, hierarchy->transform_type);
+	}
+}
+
+static uint64_t ref_key(ecs_entity_ref_t ref)
+{
+	return ((uint64_t)(uint32_t)ref.entity << 32) | (uint32_t)ref.sequence;
+}
+
+static int compare_root_children(const void* a, const void* b)
+{
+	uint64_t x = ((const hierarchy_root_child_t*)a)->root;
+	uint64_t y = ((const hierarchy_root_child_t*)b)->root;
+	return (x > y) - (x < y);
+}
+
+static int compare_nodes(const void* a, const void* b)
+{
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
+}
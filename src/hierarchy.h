@@ -0,0 +1,41 @@
+#pragma once
+
+// Transform Hierarchy
+// Attaches entities to parent entities so that their transforms follow.
+// Each attached entity has a hierarchy component holding its parent and its transform relative
+// to that parent; the hierarchy writes its world transform into the entity's transform component.
+// Nodes are kept in depth-first order, so an update walks only the subtrees under a parent
+// whose transform moved or an attachment whose local transform changed, and static attachments
+// cost nothing.
+
+#include "ecs.h"
+
+typedef struct heap_t heap_t;
+typedef struct transform_t transform_t;
+
+// Handle to a transform hierarchy.
+typedef struct hierarchy_t hierarchy_t;
+
+// Create a transform hierarchy over an entity component system, registering its hierarchy component type.
+// Transform type is the component holding entities' world transforms, which must begin with a transform_t.
+hierarchy_t* hierarchy_create(heap_t* heap, ecs_t* ecs, int transform_type);
+
+// Destroy a transform hierarchy.
+void hierarchy_destroy(hierarchy_t* hierarchy);
+
+// Get the hierarchy component type, for the masks of entities that may be attached.
+int hierarchy_get_component_type(hierarchy_t* hierarchy);
+
+// Attach an entity with a hierarchy component to a parent with a transform component.
+// Its world transform becomes local applied before the parent's world transform on the next update.
+// An invalid parent detaches the entity, which keeps its last world transform.
+// Children of removed parents, and entities attached in a cycle, are detached the same way.
+void hierarchy_set_parent(hierarchy_t* hierarchy, ecs_entity_ref_t entity, ecs_entity_ref_t parent, const transform_t* local);
+
+// Move an attached entity relative to its parent.
+void hierarchy_set_local(hierarchy_t* hierarchy, ecs_entity_ref_t entity, const transform_t* local);
+
+// Recompute the world transforms of attached entities under anything that changed since the last update,
+// marking their transform components changed.
+// Reads hierarchy and transform components and writes transform components, so it may run as a system.
+void hierarchy_update(hierarchy_t* hierarchy);
@@ -0,0 +1,561 @@
+#include "job.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "heap.h"
+#include "lock.h"
+#include "object_pool.h"
+#include "queue.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_max_job_workers = 64,
+	k_job_pool_size = 1024,
+
+	// Jobs queued from threads that are not workers, or that overflow a worker's deque.
+	k_job_queue_capacity = 1024,
+
+	// Must be a power of two.
+	k_job_deque_capacity = 1024,
+
+	k_cache_line_size = 64,
+
+	// Finished fibers kept for reuse; more are created on demand.
+	k_job_fiber_pool_size = 128,
+	k_job_fiber_stack_size = 64 * 1024,
+};
+
+typedef struct job_t
+{
+	job_function_t function;
+	void* data;
+	job_counter_t* counter;
+	void* fiber; //fiber the job runs on, once it has started
+	struct job_t* next;
+} job_t;
+
+// What a job fiber asked its scheduler to do when it switched back.
+typedef enum job_action_t
+{
+	k_job_action_finish,
+	k_job_action_wait,
+	k_job_action_yield,
+} job_action_t;
+
+// Per-thread scheduling state.
+// Jobs run on fibers; a fiber switches back to its thread's scheduler fiber when the job ends or waits.
+// A suspended job may resume on a different thread, so fibers must re-read the context after every switch.
+typedef struct job_context_t
+{
+	struct job_worker_t* worker; //NULL for threads that are not workers
+	void* scheduler_fiber;
+	job_t* current; //job whose fiber is running, or NULL on the scheduler fiber
+	job_action_t action;
+	job_counter_t* wait_counter;
+} job_context_t;
+
+// Work-stealing deque in the style of Chase and Lev.
+// The owning worker pushes and pops at the bottom; other threads steal from the top.
+// Indices wrap around 2^32 and are compared by signed difference.
+typedef struct job_deque_t
+{
+	int top;
+	char pad0[k_cache_line_size];
+	int bottom;
+	char pad1[k_cache_line_size];
+	job_t* jobs[k_job_deque_capacity];
+} job_deque_t;
+
+typedef struct job_worker_t
+{
+	job_system_t* system;
+	thread_t* thread;
+	int index;
+	job_context_t context;
+	job_deque_t deque;
+} job_worker_t;
+
+typedef struct job_system_t
+{
+	heap_t* heap;
+	object_pool_t* job_pool;
+	queue_t* queue;
+	queue_t* fiber_pool;
+	lock_t dependency_lock;
+
+	job_worker_t* workers;
+	int worker_count;
+	DWORD context_tls;
+
+	int signal; //bumped whenever work is published or a counter reaches zero
+	int sleepers;
+	int quit;
+} job_system_t;
+
+static int worker_thread(void* user);
+static void __stdcall fiber_main(void* user);
+static job_context_t* get_context(job_system_t* system);
+static void push_job(job_system_t* system, job_t* job);
+static job_t* find_job(job_system_t* system, job_worker_t* worker);
+static void run_job(job_system_t* system, job_context_t* context, job_t* job);
+static void execute_job(job_system_t* system, job_t* job);
+static void suspend(job_system_t* system, job_context_t* context, job_action_t action, job_counter_t* counter);
+static void counter_decrement(job_system_t* system, job_counter_t* counter);
+static void notify(job_system_t* system);
+static bool deque_push(job_deque_t* deque, job_t* job);
+static job_t* deque_pop(job_deque_t* deque);
+static job_t* deque_steal(job_deque_t* deque);
+
+job_system_t* job_system_create(heap_t* heap, int worker_count)
+{
+	int processor_count = thread_get_processor_count();
+	if (worker_count <= 0)
+	{
+		worker_count = __max(processor_count - 1, 1);
+	}
+	worker_count = __min(worker_count, k_max_job_workers);
+
+	job_system_t* system = heap_alloc(heap, sizeof(job_system_t), 8);
+	memset(system, 0, sizeof(*system));
+	system->heap = heap;
+	system->job_pool = object_pool_create(heap, sizeof(job_t), 8, k_job_pool_size);
+	system->queue = queue_create(heap, k_job_queue_capacity);
+	system->fiber_pool = queue_create(heap, k_job_fiber_pool_size);
+	lock_init_named(&system->dependency_lock, "job dependencies");
+	system->context_tls = TlsAlloc();
+	system->worker_count = worker_count;
+	system->workers = heap_alloc(heap, sizeof(job_worker_t) * worker_count, k_cache_line_size);
+	memset(system->workers, 0, sizeof(job_worker_t) * worker_count);
+	for (int i = 0; i < worker_count; ++i)
+	{
+		system->workers[i].system = system;
+		system->workers[i].index = i;
+		system->workers[i].context.worker = &system->workers[i];
+	}
+	for (int i = 0; i < worker_count; ++i)
+	{
+		//pin workers to processors 1..n so processor 0 stays free for the main and I/O threads
+		char name[32];
+		snprintf(name, sizeof(name), "Job Worker %d", i);
+		thread_options_t options = { .name = name };
+		if (worker_count < processor_count && i + 1 < 64)
+		{
+			options.affinity_mask = 1ull << (i + 1);
+		}
+		system->workers[i].thread = thread_create_with_options(worker_thread, &system->workers[i], &options);
+	}
+	return system;
+}
+
+void job_system_destroy(job_system_t* system)
+{
+	atomic_store(&system->quit, 1);
+	atomic_increment(&system->signal);
+	atomic_wake_all(&system->signal);
+	for (int i = 0; i < system->worker_count; ++i)
+	{
+		thread_destroy(system->workers[i].thread);
+	}
+
+	void* fiber;
+	while ((fiber = queue_try_pop(system->fiber_pool)) != NULL)
+	{
+		DeleteFiber(fiber);
+	}
+
+	TlsFree(system->context_tls);
+	heap_free(system->heap, system->workers);
+	queue_destroy(system->fiber_pool);
+	queue_destroy(system->queue);
+	object_pool_destroy(system->job_pool);
+	heap_free(system->heap, system);
+}
+
+int job_system_get_worker_count(job_system_t* system)
+{
+	return system->worker_count;
+}
+
+void job_run(job_system_t* system, job_function_t function, void* data, job_counter_t* counter)
+{
+	job_run_after(system, NULL, function, data, counter);
+}
+
+void job_run_after(job_system_t* system, job_counter_t* dependency, job_function_t function, void* data, job_counter_t* counter)
+{
+	job_t* job = object_pool_alloc(system->job_pool);
+	job->function = function;
+	job->data = data;
+	job->counter = counter;
+	job->fiber = NULL;
+	job->next = NULL;
+
+	if (counter)
+	{
+		atomic_increment(&counter->value);
+	}
+
+	if (dependency)
+	{
+		//park the job on the dependency unless it has already finished
+		lock_acquire(&system->dependency_lock);
+		if (atomic_load(&dependency->value))
+		{
+			job->next = dependency->waiters;
+			dependency->waiters = job;
+			job = NULL;
+		}
+		lock_release(&system->dependency_lock);
+	}
+
+	if (job)
+	{
+		push_job(system, job);
+	}
+}
+
+void job_wait(job_system_t* system, job_counter_t* counter)
+{
+	job_context_t* context = get_context(system);
+	if (context && context->current)
+	{
+		//inside a job: park its fiber on the counter so this thread can run something else
+		while (atomic_load(&counter->value))
+		{
+			suspend(system, context, k_job_action_wait, counter);
+			context = get_context(system);
+		}
+		return;
+	}
+
+	//not inside a job: schedule jobs on this thread until the counter reaches zero
+	job_context_t local_context = { 0 };
+	bool converted = false;
+	if (!context)
+	{
+		converted = !IsThreadAFiber();
+		local_context.scheduler_fiber = converted ? ConvertThreadToFiber(NULL) : GetCurrentFiber();
+		context = &local_context;
+		TlsSetValue(system->context_tls, context);
+	}
+
+	job_worker_t* worker = context->worker;
+	while (atomic_load(&counter->value))
+	{
+		job_t* job = find_job(system, worker);
+		if (job)
+		{
+			run_job(system, context, job);
+			continue;
+		}
+
+		//nothing to help with; sleep until new work arrives or a counter finishes
+		atomic_increment(&system->sleepers);
+		int signal = atomic_load(&system->signal);
+		job = find_job(system, worker);
+		if (!job && atomic_load(&counter->value))
+		{
+			atomic_wait(&system->signal, signal);
+		}
+		atomic_decrement(&system->sleepers);
+		if (job)
+		{
+			run_job(system, context, job);
+		}
+	}
+
+	if (context == &local_context)
+	{
+		TlsSetValue(system->context_tls, NULL);
+		if (converted)
+		{
+			ConvertFiberToThread();
+		}
+	}
+}
+
+void job_yield(job_system_t* system)
+{
+	job_context_t* context = get_context(system);
+	if (context && context->current)
+	{
+		suspend(system, context, k_job_action_yield, NULL);
+	}
+	else
+	{
+		SwitchToThread();
+	}
+}
+
+static int worker_thread(void* user)
+{
+	job_worker_t* worker = user;
+	job_system_t* system = worker->system;
+	worker->context.scheduler_fiber = ConvertThreadToFiber(NULL);
+	TlsSetValue(system->context_tls, &worker->context);
+
+	while (!atomic_load(&system->quit))
+	{
+		job_t* job = find_job(system, worker);
+		if (job)
+		{
+			run_job(system, &worker->context, job);
+			continue;
+		}
+
+		atomic_increment(&system->sleepers);
+		int signal = atomic_load(&system->signal);
+		job = find_job(system, worker);
+		if (!job && !atomic_load(&system->quit))
+		{
+			atomic_wait(&system->signal, signal);
+		}
+		atomic_decrement(&system->sleepers);
+		if (job)
+		{
+			run_job(system, &worker->context, job);
+		}
+	}
+
+	ConvertFiberToThread();
+	return 0;
+}
+
+static void __stdcall fiber_main(void* user)
+{
+	job_system_t* system = user;
+	while (true)
+	{
+		job_context_t* context = get_context(system);
+		execute_job(system, context->current);
+
+		//the job may have moved threads while it waited
+		context = get_context(system);
+		context->action = k_job_action_finish;
+		SwitchToFiber(context->scheduler_fiber);
+	}
+}
+
+static job_context_t* get_context(job_system_t* system)
+{
+	return system->context_tls != TLS_OUT_OF_INDEXES ? TlsGetValue(system->context_tls) : NULL;
+}
+
+static void push_job(job_system_t* system, job_t* job)
+{
+	job_context_t* context = get_context(system);
+	job_worker_t* worker = context ? context->worker : NULL;
+	if (!(worker && deque_push(&worker->deque, job)) && !queue_try_push(system->queue, job))
+	{
+		//every queue is full, so make progress by running the job here
+		if (job->fiber)
+		{
+			//a suspended job can only continue on its own fiber
+			queue_push(system->queue, job);
+		}
+		else
+		{
+			execute_job(system, job);
+		}
+		return;
+	}
+	notify(system);
+}
+
+static job_t* find_job(job_system_t* system, job_worker_t* worker)
+{
+	job_t* job = worker ? deque_pop(&worker->deque) : NULL;
+	if (!job)
+	{
+		job = queue_try_pop(system->queue);
+	}
+
+	//steal from the other workers, starting with the next one to spread out thieves
+	int start = worker ? worker->index + 1 : 0;
+	for (int i = 0; !job && i < system->worker_count; ++i)
+	{
+		job_worker_t* victim = &system->workers[(start + i) % system->worker_count];
+		if (victim != worker)
+		{
+			job = deque_steal(&victim->deque);
+		}
+	}
+	return job;
+}
+
+static void run_job(job_system_t* system, job_context_t* context, job_t* job)
+{
+	if (!job->fiber)
+	{
+		job->fiber = queue_try_pop(system->fiber_pool);
+		if (!job->fiber)
+		{
+			job->fiber = CreateFiber(k_job_fiber_stack_size, fiber_main, system);
+		}
+	}
+
+	//the job is freed if it finishes, so hold on to its fiber
+	void* fiber = job->fiber;
+	context->current = job;
+	SwitchToFiber(fiber);
+	context->current = NULL;
+
+	switch (context->action)
+	{
+	case k_job_action_finish:
+		if (!queue_try_push(system->fiber_pool, fiber))
+		{
+			DeleteFiber(fiber);
+		}
+		break;
+
+	case k_job_action_wait:
+		//park the job on the counter unless it reached zero while the fiber was switching out
+		lock_acquire(&system->dependency_lock);
+		if (atomic_load(&context->wait_counter->value))
+		{
+			job->next = context->wait_counter->waiters;
+			context->wait_counter->waiters = job;
+			job = NULL;
+		}
+		lock_release(&system->dependency_lock);
+		if (job)
+		{
+			push_job(system, job);
+		}
+		break;
+
+	case k_job_action_yield:
+		//queue behind other work rather than at the bottom of this worker's deque
+		if (queue_try_push(system->queue, job))
+		{
+			notify(system);
+		}
+		else
+		{
+			push_job(system, job);
+		}
+		break;
+	}
+}
+
+static void execute_job(job_system_t* system, job_t* job)
+{
+	job_counter_t* counter = job->counter;
+	job->function(job->data);
+	object_pool_free(system->job_pool, job);
+	if (counter)
+	{
+		counter_decrement(system, counter);
+	}
+}
+
+static void suspend(job_system_t* system, job_context_t* context, job_action_t action, job_counter_t* counter)
+{
+	//the scheduler fiber queues the job again only after this fiber has switched out
+	context->action = action;
+	context->wait_counter = counter;
+	SwitchToFiber(context->scheduler_fiber);
+}
+
+static void counter_decrement(job_system_t* system, job_counter_t* counter)
+{
+	if (atomic_decrement(&counter->value) != 1)
+	{
+		return;
+	}
+
+	//the counter may have been reused since it hit zero; its waiters then wait for the new jobs too
+	job_t* waiters = NULL;
+	lock_acquire(&system->dependency_lock);
+	if (!atomic_load(&counter->value))
+	{
+		waiters = counter->waiters;
+		counter->waiters = NULL;
+	}
+	lock_release(&system->dependency_lock);
+
+	while (waiters)
+	{
+		job_t* next = waiters->next;
+		push_job(system, waiters);
+		waiters = next;
+	}
+
+	//wake anyone sleeping in job_wait() on this counter
+	notify(system);
+}
+
+static void notify(job_system_t* system)
+{
+	atomic_increment(&system->signal);
+	if (atomic_load(&system->sleepers))
+	{
+		atomic_wake_all(&system->signal);
+	}
+}
+
+static bool deque_push(job_deque_t* deque, job_t* job)
+{
+	unsigned int bottom = (unsigned int)deque->bottom;
+	unsigned int top = (unsigned int)atomic_load(&deque->top);
+	if ((int)(bottom - top) >= k_job_deque_capacity)
+	{
+		return false;
+	}
+	deque->jobs[bottom & (k_job_deque_capacity - 1)] = job;
+	atomic_store(&deque->bottom, (int)(bottom + 1));
+	return true;
+}
+
+static job_t* deque_pop(job_deque_t* deque)
+{
+	//the interlocked decrement orders the bottom update before reading top
+	unsigned int bottom = (unsigned int)atomic_decrement(&deque->bottom) - 1;
+	unsigned int top = (unsigned int)atomic_load(&deque->top);
+	int size = (int)(bottom - top);
+	if (size < 0)
+	{
+		atomic_store(&deque->bottom, (int)top);
+		return NULL;
+	}
+
+	job_t* job = deque->jobs[bottom & (k_job_deque_capacity - 1)];
+	if (size > 0)
+	{
+		return job;
+	}
+
+	//last job: race any thief for it
+	if (atomic_compare_and_exchange(&deque->top, (int)top, (int)(top + 1)) != (int)top)
+	{
+		job = NULL;
+	}
+	atomic_store(&deque->bottom, (int)(top + 1));
+	return job;
+}
+
+static job_t* deque_steal(job_deque_t* deque)
+{
+	unsigned int top = (unsigned int)atomic_load(&deque->top);
+	unsigned int bottom = (unsigned int)atomic_load(&deque->bottom);
+	if ((int)(bottom - top) <= 0)
+	{
+		return NULL;
+	}
+
+	job_t* job = deque->jobs[top & (k_job_deque_capacity - 1)];
+	if (atomic_compare_and_exchange(&deque->top, (int)top, (int)(top + 1)) != (int)top)
+	{
+		return NULL;
+	}
+	return job;
+}
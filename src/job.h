@@ -0,0 +1,53 @@
+#pragma once
+
+// Job System
+// Runs small functions on a shared pool of worker threads.
+// Each worker keeps its own deque of jobs and idle workers steal from the others.
+// Counters track groups of jobs; waiting on a counter runs other jobs instead of blocking.
+// Jobs run on fibers, so a job that waits is suspended and its worker thread moves on to other jobs.
+
+typedef struct heap_t heap_t;
+
+// Handle to a job system.
+typedef struct job_system_t job_system_t;
+
+// Function run by a job.
+typedef void (*job_function_t)(void* data);
+
+// Number of outstanding jobs in a group.
+// Zero-initialize before first use; may be reused once it reaches zero.
+typedef struct job_counter_t
+{
+	int value;
+	struct job_t* waiters; //jobs started by job_run_after() once value reaches zero
+} job_counter_t;
+
+// Create a job system with worker_count worker threads.
+// If worker_count is zero or less, creates one worker per processor, less one for the calling thread.
+job_system_t* job_system_create(heap_t* heap, int worker_count);
+
+// Destroy a job system, stopping its worker threads.
+// All jobs must have finished.
+void job_system_destroy(job_system_t* jobs);
+
+// Get the number of worker threads.
+int job_system_get_worker_count(job_system_t* jobs);
+
+// Queue function(data) to run on a worker.
+// If counter is not NULL, it is incremented now and decremented once the job has run.
+// Safe to call from any thread, including from inside a job.
+void job_run(job_system_t* jobs, job_function_t function, void* data, job_counter_t* counter);
+
+// Queue function(data) to run once dependency reaches zero.
+// counter is handled as in job_run().
+void job_run_after(job_system_t* jobs, job_counter_t* dependency, job_function_t function, void* data, job_counter_t* counter);
+
+// Wait for a counter to reach zero.
+// Called from inside a job, suspends the job's fiber until the counter reaches zero.
+// Otherwise the calling thread runs queued jobs while it waits.
+void job_wait(job_system_t* jobs, job_counter_t* counter);
+
+// Let other jobs run before continuing.
+// Called from inside a job, suspends the job's fiber and queues it behind other pending work.
+// Use to poll for work done outside the job system, such as file work.
+void job_yield(job_system_t* jobs);
@@ -0,0 +1,275 @@
+#include "lock.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "timer.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <intrin.h>
+
+enum
+{
+	// Spin iterations before a contended lock blocks in the kernel.
+	// Long enough to cover a typical short critical section on another core.
+	k_lock_spin_count = 256,
+
+	// Distinct lock names measured by lock profiling.
+	k_lock_profile_max = 64,
+	k_lock_profile_counter_name = 64,
+};
+
+// Measurements of the locks of one name.
+typedef struct lock_profile_t
+{
+	const char* name;
+	int64_t acquires;
+	int64_t contentions; //acquires that found the lock held
+	int64_t wait_ticks;
+	int64_t hold_ticks;
+	int64_t max_wait_ticks;
+
+	//totals at the last lock_profile_trace(), which reports the difference
+	int64_t traced_contentions;
+	int64_t traced_wait_ticks;
+	int64_t traced_hold_ticks;
+	char contention_counter[k_lock_profile_counter_name];
+	char wait_counter[k_lock_profile_counter_name];
+	char hold_counter[k_lock_profile_counter_name];
+} lock_profile_t;
+
+#if LOCK_PROFILING
+// Every lock name measured, appended under the registry lock and read without it.
+static lock_t s_lock_profile_lock;
+static lock_profile_t s_lock_profiles[k_lock_profile_max];
+static int s_lock_profile_count = 0;
+#endif
+
+static void acquire_contended(lock_t* lock);
+static lock_profile_t* find_lock_profile(const char* name);
+static uint64_t profile_wait_begin(lock_t* lock);
+static void profile_wait_end(lock_t* lock, uint64_t wait_start);
+static void profile_acquired(lock_t* lock);
+static void profile_released(lock_t* lock);
+
+void lock_init(lock_t* lock)
+{
+	lock->state = 0;
+#if LOCK_PROFILING
+	lock->profile = NULL;
+	lock->acquire_ticks = 0;
+#endif
+}
+
+void lock_init_named(lock_t* lock, const char* name)
+{
+	lock_init(lock);
+#if LOCK_PROFILING
+	lock->profile = find_lock_profile(name);
+#endif
+}
+
+void lock_acquire(lock_t* lock)
+{
+	if (atomic_compare_and_exchange(&lock->state, 0, 1) != 0)
+	{
+		uint64_t wait_start = profile_wait_begin(lock);
+		acquire_contended(lock);
+		profile_wait_end(lock, wait_start);
+	}
+	profile_acquired(lock);
+}
+
+bool lock_try_acquire(lock_t* lock)
+{
+	if (atomic_compare_and_exchange(&lock->state, 0, 1) != 0)
+	{
+		return false;
+	}
+	profile_acquired(lock);
+	return true;
+}
+
+void lock_release(lock_t* lock)
+{
+	profile_released(lock);
+	if (atomic_exchange(&lock->state, 0) == 2)
+	{
+		atomic_wake_one(&lock->state);
+	}
+}
+
+void lock_profile_trace(trace_t* trace)
+{
+#if LOCK_PROFILING
+	int count = atomic_load(&s_lock_profile_count);
+	for (int i = 0; i < count; ++i)
+	{
+		lock_profile_t* profile = &s_lock_profiles[i];
+		int64_t contentions = atomic_load64(&profile->contentions);
+		int64_t wait_ticks = atomic_load64(&profile->wait_ticks);
+		int64_t hold_ticks = atomic_load64(&profile->hold_ticks);
+		trace_counter(trace, profile->contention_counter, contentions - profile->traced_contentions);
+		trace_counter(trace, profile->wait_counter, (int64_t)timer_ticks_to_us(wait_ticks - profile->traced_wait_ticks));
+		trace_counter(trace, profile->hold_counter, (int64_t)timer_ticks_to_us(hold_ticks - profile->traced_hold_ticks));
+		profile->traced_contentions = contentions;
+		profile->traced_wait_ticks = wait_ticks;
+		profile->traced_hold_ticks = hold_ticks;
+	}
+#endif
+}
+
+void lock_profile_dump()
+{
+#if LOCK_PROFILING
+	int count = atomic_load(&s_lock_profile_count);
+	for (int i = 0; i < count; ++i)
+	{
+		lock_profile_t* profile = &s_lock_profiles[i];
+		int64_t acquires = atomic_load64(&profile->acquires);
+		int64_t contentions = atomic_load64(&profile->contentions);
+		debug_print(k_print_info, "Lock %s: %lld acquires, %lld contended (%.1f%%), %llu us waiting (max %llu us), %llu us held.\n",
+			profile->name, acquires, contentions, acquires ? contentions * 100.0 / acquires : 0.0,
+			timer_ticks_to_us(atomic_load64(&profile->wait_ticks)),
+			timer_ticks_to_us(atomic_load64(&profile->max_wait_ticks)),
+			timer_ticks_to_us(atomic_load64(&profile->hold_ticks)));
+	}
+#endif
+}
+
+// Take a lock another thread holds.
+static void acquire_contended(lock_t* lock)
+{
+	//spin while the owner is likely to release soon; only read so the cache line stays shared
+	for (int i = 0; i < k_lock_spin_count; ++i)
+	{
+		_mm_pause();
+		if (atomic_load(&lock->state) == 0 && atomic_compare_and_exchange(&lock->state, 0, 1) == 0)
+		{
+			return;
+		}
+	}
+
+	//mark the lock contended so the owner wakes a waiter on release
+	while (atomic_exchange(&lock->state, 2) != 0)
+	{
+		atomic_wait(&lock->state, 2);
+	}
+}
+
+// Find the measurements of a lock name, adding them if the name is new.
+// Returns NULL once k_lock_profile_max names are measured.
+static lock_profile_t* find_lock_profile(const char* name)
+{
+#if LOCK_PROFILING
+	lock_acquire(&s_lock_profile_lock);
+	lock_profile_t* profile = NULL;
+	for (int i = 0; i < s_lock_profile_count; ++i)
+	{
+		if (strcmp(s_lock_profiles[i].name, name) == 0)
+		{
+			profile = &s_lock_profiles[i];
+			break;
+		}
+	}
+	if (!profile && s_lock_profile_count < k_lock_profile_max)
+	{
+		profile = &s_lock_profiles[s_lock_profile_count];
+		profile->name = name;
+		snprintf(profile->contention_counter, sizeof(profile->contention_counter), "Lock %s Contentions", name);
+		snprintf(profile->wait_counter, sizeof(profile->wait_counter), "Lock %s Wait (us)", name);
+		snprintf(profile->hold_counter, sizeof(profile->hold_counter), "Lock %s Held (us)", name);
+		//publish the filled slot to readers that do not take the lock
+		atomic_store(&s_lock_profile_count, s_lock_profile_count + 1);
+	}
+	lock_release(&s_lock_profile_lock);
+	return profile;
+#else
+	return NULL;
+#endif
+}
+
+static uint64_t profile_wait_begin(lock_t* lock)
+{
+#if LOCK_PROFILING
+	if (lock->profile)
+	{
+		return timer_get_ticks();
+	}
+#endif
+	return 0;
+}
+
+static void profile_wait_end(lock_t* lock, uint64_t wait_start)
+{
+#if LOCK_PROFILING
+	lock_profile_t* profile = lock->profile;
+	if (profile)
+	{
+		int64_t wait_ticks = (int64_t)(timer_get_ticks() - wait_start);
+		atomic_increment64(&profile->contentions);
+		atomic_fetch_add64(&profile->wait_ticks, wait_ticks);
+		//locks of one name share the maximum, so raise it with compare and exchange
+		int64_t max_wait = atomic_load64(&profile->max_wait_ticks);
+		while (wait_ticks > max_wait)
+		{
+			int64_t old_max = atomic_compare_and_exchange64(&profile->max_wait_ticks, max_wait, wait_ticks);
+			if (old_max == max_wait)
+			{
+				break;
+			}
+			max_wait = old_max;
+		}
+	}
+#endif
+}
+
+static void profile_acquired(lock_t* lock)
+{
+#if LOCK_PROFILING
+	if (lock->profile)
+	{
+		atomic_increment64(&lock->profile->acquires);
+		lock->acquire_ticks = timer_get_ticks();
+	}
+#endif
+}
+
+static void profile_released(lock_t* lock)
+{
+#if LOCK_PROFILING
+	if (lock->profile)
+	{
+		atomic_fetch_add64(&lock->profile->hold_ticks, (int64_t)(timer_get_ticks() - lock->acquire_ticks));
+	}
+#endif
+}
+
+void rwlock_init(rwlock_t* lock)
+{
+	InitializeSRWLock((PSRWLOCK)&lock->state);
+}
+
+void rwlock_acquire_read(rwlock_t* lock)
+{
+	AcquireSRWLockShared((PSRWLOCK)&lock->state);
+}
+
+void rwlock_release_read(rwlock_t* lock)
+{
+	ReleaseSRWLockShared((PSRWLOCK)&lock->state);
+}
+
+void rwlock_acquire_write(rwlock_t* lock)
+{
+	AcquireSRWLockExclusive((PSRWLOCK)&lock->state);
+}
+
+void rwlock_release_write(rwlock_t* lock)
+{
+	ReleaseSRWLockExclusive((PSRWLOCK)&lock->state);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Lightweight lock thread synchronization
+// Non-recursive locks for short critical sections.
+// Uncontended acquire and release are a single interlocked instruction and never enter the kernel.
+// Unlike mutex_t, locks live inside the structure they protect instead of behind a handle,
+// so the heap can use one before any memory exists.
+
+// Lock profiling measures, for each lock initialized with a name by lock_init_named(), how often an acquire
+// had to wait, how long acquirers waited and how long the lock was held, for trace counters and the debug log.
+// Costs two timer reads and a few interlocked adds per acquire of a named lock, so off by default;
+// define LOCK_PROFILING as 1 to enable.
+#if !defined(LOCK_PROFILING)
+#define LOCK_PROFILING 0
+#endif
+
+typedef struct lock_profile_t lock_profile_t;
+typedef struct trace_t trace_t;
+
+// Exclusive lock.
+// Spins briefly when contended, then blocks until the owner releases it.
+// Zero-initialize or call lock_init before first use.
+typedef struct lock_t
+{
+	int state; //0 = unlocked, 1 = locked, 2 = locked with threads blocked
+#if LOCK_PROFILING
+	lock_profile_t* profile; //measurements shared by locks of the same name, or NULL if unnamed
+	uint64_t acquire_ticks; //when the owner acquired it
+#endif
+} lock_t;
+
+// Reader/writer lock.
+// Any number of readers, or a single writer, may hold it at once.
+// Zero-initialize or call rwlock_init before first use.
+typedef struct rwlock_t
+{
+	void* state;
+} rwlock_t;
+
+// Initialize a lock to the unlocked state.
+void lock_init(lock_t* lock);
+
+// Initialize a lock to the unlocked state, measuring it under a name when LOCK_PROFILING is enabled.
+// Locks of the same name, such as one per heap, are measured together. The name must outlive the lock.
+void lock_init_named(lock_t* lock, const char* name);
+
+// Acquire a lock. Blocks if another thread holds it.
+// A thread must not acquire a lock it already holds.
+void lock_acquire(lock_t* lock);
+
+// Acquire a lock if no other thread holds it.
+// Returns true if the lock was acquired.
+bool lock_try_acquire(lock_t* lock);
+
+// Release a lock held by the calling thread.
+void lock_release(lock_t* lock);
+
+// Record how much each named lock was contended, waited on and held since the last call as trace counters.
+// Call once a frame. Does nothing unless LOCK_PROFILING is enabled.
+void lock_profile_trace(trace_t* trace);
+
+// Print how much each named lock was contended, waited on and held since startup to the debug log.
+// Does nothing unless LOCK_PROFILING is enabled.
+void lock_profile_dump();
+
+// Initialize a reader/writer lock to the unlocked state.
+void rwlock_init(rwlock_t* lock);
+
+// Acquire a reader/writer lock for reading.
+// Blocks while a writer holds it.
+void rwlock_acquire_read(rwlock_t* lock);
+
+// Release a reader/writer lock held for reading.
+void rwlock_release_read(rwlock_t* lock);
+
+// Acquire a reader/writer lock for writing.
+// Blocks while any reader or writer holds it.
+void rwlock_acquire_write(rwlock_t* lock);
+
+// Release a reader/writer lock held for writing.
+void rwlock_release_write(rwlock_t* lock);
@@ -1,43 +1,688 @@
+#include "bench.h"
+#include "cpu.h"
 #include "debug.h"
+#include "frame_stats.h"
+#include "frustum.h"
 #include "fs.h"
+#include "gpu.h"
 #include "heap.h"
+#include "job.h"
+#include "lock.h"
+#include "metrics.h"
 #include "render.h"
+#include "render_bench.h"
 #include "physics_sandbox.h"
+#include "profiler.h"
+#include "string_id.h"
 #include "timer.h"
+#include "trace.h"
 #include "wm.h"
 #include "physics.h"
 
 #include "cpp_test.h"
 
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+// Seconds between heap statistics dumps to the debug log, or 0 to disable.
+// Dumps once a minute in debug builds by default.
+#if !defined(HEAP_STATS_INTERVAL)
+#if defined(_DEBUG)
+#define HEAP_STATS_INTERVAL 60
+#else
+#define HEAP_STATS_INTERVAL 0
+#endif
+#endif
+
+// Back the game's heap, which holds its component arrays and physics state, with large pages, or 0 for normal pages.
+// Falls back to normal pages without the Lock pages in memory privilege.
+#if !defined(GAME_HEAP_LARGE_PAGES)
+#define GAME_HEAP_LARGE_PAGES 1
+#endif
+
+// Seconds between frame statistics summaries in the debug log, or 0 to disable.
+// Summarizes every ten seconds in debug builds by default.
+#if !defined(FRAME_STATS_INTERVAL)
+#if defined(_DEBUG)
+#define FRAME_STATS_INTERVAL 10
+#else
+#define FRAME_STATS_INTERVAL 0
+#endif
+#endif
+
+// StatsD server, as host:port, that frame statistics and heap usage are sent to, or NULL to disable.
+// Metric names start with METRICS_PREFIX, then server or client.
+#if !defined(METRICS_ADDRESS)
+#define METRICS_ADDRESS NULL
+#endif
+#if !defined(METRICS_PREFIX)
+#define METRICS_PREFIX "ga2022"
+#endif
+
+// Path of a file that receives a copy of the debug log, or NULL to only print to the console.
+#if !defined(DEBUG_LOG_PATH)
+#define DEBUG_LOG_PATH NULL
+#endif
+
+// Path of a trace capture recorded for the whole run, or NULL to disable.
+// Convert it with -trace2json to view it in Chrome.
+#if !defined(TRACE_CAPTURE_PATH)
+#define TRACE_CAPTURE_PATH NULL
+#endif
+
+// Define as 1 to record every allocation from the fs and render heaps in the trace capture.
+#if !defined(TRACE_HEAP_EVENTS)
+#define TRACE_HEAP_EVENTS 0
+#endif
+
+// Path of folded callstacks sampled for the whole run, or NULL to disable.
+// View it with flamegraph.pl or speedscope.
+#if !defined(PROFILER_OUTPUT_PATH)
+#define PROFILER_OUTPUT_PATH NULL
+#endif
+
+// Milliseconds between profiler samples of every thread.
+#if !defined(PROFILER_INTERVAL_MS)
+#define PROFILER_INTERVAL_MS 2
+#endif
+
+// Path the GPU pipeline cache is kept in between runs, or NULL to compile every pipeline on startup.
+#if !defined(PIPELINE_CACHE_PATH)
+#define PIPELINE_CACHE_PATH "pipeline.cache"
+#endif
+
+// How frames are presented: k_gpu_present_mode_fifo, k_gpu_present_mode_mailbox or k_gpu_present_mode_immediate.
+#if !defined(GPU_PRESENT_MODE)
+#define GPU_PRESENT_MODE k_gpu_present_mode_fifo
+#endif
+
+// Frames the GPU keeps in flight, or 0 for its default.
+#if !defined(GPU_FRAME_COUNT)
+#define GPU_FRAME_COUNT 0
+#endif
+
+// Nonzero to have the game wait for the GPU to finish each frame before starting the next,
+// lowering input-to-photon latency at the cost of throughput.
+#if !defined(RENDER_LOW_LATENCY)
+#define RENDER_LOW_LATENCY 0
+#endif
+
+// Nonzero to render offscreen instead of to the window, for benchmarking on machines without a display.
+#if !defined(RENDER_HEADLESS)
+#define RENDER_HEADLESS 0
+#endif
+
+// Nonzero to run compute work such as GPU culling on a dedicated compute queue when the GPU has one.
+#if !defined(GPU_ASYNC_COMPUTE)
+#define GPU_ASYNC_COMPUTE 1
+#endif
+
+// Microseconds of GPU time each frame is held to by lowering its drawn resolution, or 0 to always draw at full size.
+#if !defined(RENDER_GPU_TARGET_US)
+#define RENDER_GPU_TARGET_US 0
+#endif
+
+// Updates per second of a dedicated server (ga2022 -server), which sleeps between them.
+// The game steps physics a fixed 1/60 s each update, so this keeps simulation in real time.
+#if !defined(SERVER_TICK_RATE)
+#define SERVER_TICK_RATE 60
+#endif
+
+// Read raw input on a dedicated thread, latched just before simulation, or 0 to read it when the window is pumped.
+#if !defined(INPUT_THREAD)
+#define INPUT_THREAD 1
+#endif
+
+// Frames per second a client is capped at, sleeping out the rest of each frame, or 0 to run as fast as presenting allows.
+#if !defined(CLIENT_FRAME_RATE)
+#define CLIENT_FRAME_RATE 0
+#endif
+
+// Mask of cpu_feature_t instruction sets kernels may not use even where the CPU has them, to time or test
+// the slower variants on a fast machine, or 0 to use everything the CPU has.
+#if !defined(CPU_DISABLED_FEATURES)
+#define CPU_DISABLED_FEATURES 0
+#endif
+
+// Set when a dedicated server is asked to stop from the console.
+static volatile LONG s_server_quit = 0;
+
+static BOOL WINAPI server_console_handler(DWORD type);
+static void parse_stress_options(int argc, const char** argv, physics_sandbox_stress_t* stress, bool* draw);
+static void parse_net_load_options(int argc, const char** argv, physics_sandbox_net_load_t* load);
+static void parse_render_bench_options(int argc, const char** argv, render_bench_options_t* options);
+static bool is_option(const char* option, size_t length, const char* name);
+
 int main(int argc, const char* argv[])
 {
 	debug_set_print_mask(k_print_info | k_print_warning | k_print_error);
 	debug_install_exception_handler();
 
 	timer_startup();
+	cpu_startup(CPU_DISABLED_FEATURES);
+	string_id_startup();
+	frustum_startup();
 	debug_print(k_print_info, "%d\n", cpp_test_function(42));
 	
 
 	heap_t* heap = heap_create(2 * 1024 * 1024);
-	fs_t* fs = fs_create(heap, 8);
-	wm_window_t* window = wm_create(heap);
-	render_t* render = render_create(heap, window);
+	debug_print(k_print_info, "%d\n", cpp_test_ecs(heap));
+	job_system_t* jobs = job_system_create(heap, 0);
+	//subsystems with heaps of their own show their usage apart, warning once past a budget well over a normal session's
+	heap_t* fs_heap = heap_create_child(heap, "fs", 128 * 1024 * 1024);
+	fs_t* fs = fs_create(fs_heap, 8, jobs);
 
-	physics_sandbox_t* game = physics_sandbox_create(heap, fs, window, render, argc, argv);
+	//ga2022 -pack <pack> <files...> builds a pack, compressed with LZ4HC since it is read far more than written, and exits
+	if (argc >= 3 && strcmp(argv[1], "-pack") == 0)
+	{
+		int result = fs_pack_build(fs, argv[2], argv + 3, argc - 3, true, k_fs_compression_high);
+		debug_print(result ? k_print_error : k_print_info, "Pack %s %s.\n", argv[2], result ? "failed" : "built");
+		fs_destroy(fs);
+		heap_destroy(fs_heap);
+		job_system_destroy(jobs);
+		heap_destroy(heap);
+		return result;
+	}
+
+	//ga2022 -trace2json <capture> <json> converts a binary trace capture and exits
+	if (argc >= 4 && strcmp(argv[1], "-trace2json") == 0)
+	{
+		fs_destroy(fs);
+		heap_destroy(fs_heap);
+		int result = trace_convert_to_json(heap, argv[2], argv[3], false);
+		debug_print(result ? k_print_error : k_print_info, "Trace %s %s.\n", argv[3], result ? "failed" : "written");
+		job_system_destroy(jobs);
+		heap_destroy(heap);
+		return result;
+	}
+
+	//ga2022 -physicsbench times each physics broadphase on typical scenes, then one space against a world of regions, and exits
+	if (argc >= 2 && strcmp(argv[1], "-physicsbench") == 0)
+	{
+		fs_destroy(fs);
+		heap_destroy(fs_heap);
+		int result = physicsBenchmarkBroadphases(heap) | physicsBenchmarkWorld(heap, jobs);
+		job_system_destroy(jobs);
+		heap_destroy(heap);
+		return result;
+	}
 
-	while (!wm_pump(window))
+	//ga2022 -bench [results.csv] times core engine primitives and exits
+	if (argc >= 2 && strcmp(argv[1], "-bench") == 0)
 	{
+		int result = bench_run(heap, fs, argc >= 3 ? argv[2] : NULL);
+		fs_destroy(fs);
+		heap_destroy(fs_heap);
+		job_system_destroy(jobs);
+		heap_destroy(heap);
+		return result;
+	}
+
+	//ga2022 -renderbench [meshes=N] [shaders=N] [instances=N] [path=model|pushed|instanced|culled] [frames=N] [recorders=N]
+	//times pushing, recording and drawing a synthetic scene headless and exits
+	if (argc >= 2 && strcmp(argv[1], "-renderbench") == 0)
+	{
+		render_bench_options_t render_bench_options;
+		parse_render_bench_options(argc - 2, argv + 2, &render_bench_options);
+		int result = render_bench_run(heap, fs, jobs, &render_bench_options);
+		fs_destroy(fs);
+		heap_destroy(fs_heap);
+		job_system_destroy(jobs);
+		heap_destroy(heap);
+		return result;
+	}
+
+	//prints from here on are written by a background thread instead of stalling the caller
+	debug_logger_start(heap, DEBUG_LOG_PATH);
+
+	//assets found in the pack are read from it instead of from loose files
+	fs_mount_pack(fs, "assets.pak");
+
+	//engine zones record here; they cost one flag check while no capture runs
+	trace_t* trace = trace_create(heap, 64 * 1024);
+	trace_set_default(trace);
+	if (TRACE_CAPTURE_PATH)
+	{
+		trace_capture_start(trace, TRACE_CAPTURE_PATH);
+	}
+
+	profiler_t* profiler = NULL;
+	if (PROFILER_OUTPUT_PATH)
+	{
+		profiler = profiler_create(heap, PROFILER_INTERVAL_MS);
+		profiler_start(profiler);
+	}
+
+	//summaries cover the last few seconds of frames
+	frame_stats_t* frame_stats = frame_stats_create(heap, 256, FRAME_STATS_INTERVAL);
+	frame_stats_set_default(frame_stats);
+
+	//ga2022 -server [address] runs a dedicated server without a window or GPU, until Ctrl+C;
+	//the game sees the arguments after -server
+	bool dedicated = argc >= 2 && strcmp(argv[1], "-server") == 0;
+
+	//ga2022 -stress [bodies=N] [circles=percent] [joints=N] [broadphase=tree|hash|sweep] [pool=0|1] [threads=N] [steps=N] [draw=0|1]
+	//times updates of a physics stress scene, drawing offscreen unless draw=0, and exits
+	bool stress = argc >= 2 && strcmp(argv[1], "-stress") == 0;
+	physics_sandbox_stress_t stress_options;
+	bool stress_draw = true;
+	if (stress)
+	{
+		parse_stress_options(argc - 2, argv + 2, &stress_options, &stress_draw);
+	}
+
+	//ga2022 -record path [address] plays as usual, recording each frame's input, packets and time to path;
+	//ga2022 -replay path plays those frames back on the recorded clock, as fast as they go, and exits after the last
+	bool record = argc >= 3 && strcmp(argv[1], "-record") == 0;
+	bool replay = argc >= 3 && strcmp(argv[1], "-replay") == 0;
+	physics_sandbox_options_t game_options = { 0 };
+	if (record || replay)
+	{
+		game_options.record_path = record ? argv[2] : NULL;
+		game_options.replay_path = replay ? argv[2] : NULL;
+		//the game sees the arguments after the path
+		argc -= 2;
+		argv += 2;
+	}
+
+	//ga2022 -netload [clients=N] [seconds=N] [rate=N] [latency=ms] [jitter=ms] [loss=percent] [bandwidth=B/s] [shards=N]
+	//runs a dedicated server and simulated clients over a conditioned loopback link, reports the server's load and exits
+	bool net_load = argc >= 2 && strcmp(argv[1], "-netload") == 0;
+	physics_sandbox_net_load_t net_load_options;
+	if (net_load)
+	{
+		parse_net_load_options(argc - 2, argv + 2, &net_load_options);
+	}
+
+	//render_create() returns at once and creates the GPU on the render thread, overlapping the game's creation below,
+	//which queues its asset reads first; each phase shows as a zone in a trace capture
+	TRACE_ZONE_BEGIN(k_trace_category_general, "Startup: Window and Render");
+	heap_t* render_heap = heap_create_child(heap, "render", 256 * 1024 * 1024);
+	heap_set_tracing(fs_heap, TRACE_HEAP_EVENTS);
+	heap_set_tracing(render_heap, TRACE_HEAP_EVENTS);
+	wm_window_t* window = NULL;
+	render_t* render = NULL;
+	if (dedicated)
+	{
+		SetConsoleCtrlHandler(server_console_handler, TRUE);
+		argc--;
+		argv++;
+	}
+	else if (stress)
+	{
+		if (stress_draw)
+		{
+			render_options_t render_options =
+			{
+				.jobs = jobs,
+				.recorder_count = 4,
+				.fs = fs,
+				.pipeline_cache_path = PIPELINE_CACHE_PATH,
+				.present_mode = GPU_PRESENT_MODE,
+				.headless = true,
+				.async_compute = GPU_ASYNC_COMPUTE,
+			};
+			render = render_create_with_options(render_heap, NULL, &render_options);
+		}
+	}
+	else if (!net_load)
+	{
+		wm_options_t window_options =
+		{
+			.input_thread = INPUT_THREAD,
+		};
+		window = wm_create_with_options(heap, &window_options);
+		render_options_t render_options =
+		{
+		.jobs = jobs,
+		.recorder_count = 4,
+		.fs = fs,
+		.pipeline_cache_path = PIPELINE_CACHE_PATH,
+		.present_mode = GPU_PRESENT_MODE,
+		.frame_count = GPU_FRAME_COUNT,
+		.low_latency = RENDER_LOW_LATENCY,
+		.headless = RENDER_HEADLESS,
+			.async_compute = GPU_ASYNC_COMPUTE,
+			.gpu_target_us = RENDER_GPU_TARGET_US,
+		};
+		render = render_create_with_options(render_heap, window, &render_options);
+	}
+	TRACE_ZONE_END(k_trace_category_general);
+
+	//the game's bulk data scans better from a heap of its own, mapped with large pages where possible
+	heap_options_t game_heap_options =
+	{
+		.grow_increment = 16 * 1024 * 1024,
+		.large_pages = GAME_HEAP_LARGE_PAGES,
+	};
+	heap_t* game_heap = heap_create_with_options(&game_heap_options);
+
+	metrics_t* metrics = NULL;
+	if (METRICS_ADDRESS)
+	{
+		char prefix[64];
+		snprintf(prefix, sizeof(prefix), "%s.%s", METRICS_PREFIX, dedicated ? "server" : "client");
+		metrics_options_t metrics_options = { .address = METRICS_ADDRESS, .prefix = prefix };
+		metrics = metrics_create(heap, frame_stats, &metrics_options);
+		metrics_add_heap(metrics, "main", heap);
+		metrics_add_heap(metrics, "game", game_heap);
+		metrics_add_heap(metrics, "fs", fs_heap);
+		metrics_add_heap(metrics, "render", render_heap);
+	}
+
+	physics_sandbox_t* game = NULL;
+	if (stress)
+	{
+		game = physics_sandbox_create_stress(game_heap, fs, jobs, render, &stress_options);
+		physics_sandbox_run_stress(game);
+	}
+	else if (!net_load)
+	{
+		TRACE_ZONE_BEGIN(k_trace_category_general, "Startup: Game");
+		game = physics_sandbox_create_with_options(game_heap, fs, jobs, window, render, argc, argv, &game_options);
+		TRACE_ZONE_END(k_trace_category_general);
+	}
+
+	int result = 0;
+	if (net_load)
+	{
+		result = physics_sandbox_run_net_load(game_heap, fs, jobs, &net_load_options);
+	}
+
+	uint64_t stats_ticks = timer_get_ticks();
+	timer_limiter_t limiter;
+	timer_limiter_init(&limiter, dedicated ? SERVER_TICK_RATE : replay ? 0 : CLIENT_FRAME_RATE);
+	while (!stress && !net_load && (dedicated ? !s_server_quit : !wm_pump(window)))
+	{
+		if (physics_sandbox_is_replay_finished(game))
+		{
+			//frame times at the end of the playback, to compare between builds
+			frame_stats_dump(frame_stats);
+			break;
+		}
+
 		physics_sandbox_update(game);
+
+		frame_stats_set(frame_stats, k_frame_stat_heap_bytes, heap_get_used_bytes(heap) + heap_get_used_bytes(game_heap));
+		trace_counter(trace, "Heap fs (KB)", (int64_t)(heap_get_used_bytes(fs_heap) / 1024));
+		trace_counter(trace, "Heap render (KB)", (int64_t)(heap_get_used_bytes(render_heap) / 1024));
+		lock_profile_trace(trace);
+		frame_stats_end_frame(frame_stats);
+
+		if (HEAP_STATS_INTERVAL && timer_get_ticks() - stats_ticks >= HEAP_STATS_INTERVAL * timer_get_ticks_per_second())
+		{
+			heap_dump_stats(heap);
+			heap_dump_stats(game_heap);
+			stats_ticks = timer_get_ticks();
+		}
+
+		//lands in the frame just starting, closed a frame after the one that ran long
+		frame_stats_add(frame_stats, k_frame_stat_tick_overrun_us, timer_ticks_to_us(timer_limiter_wait(&limiter)));
 	}
 
+	//sends a last time while the heaps it reads are still alive
+	metrics_destroy(metrics);
+
 	/* XXX: Shutdown render before the game. Render uses game resources. */
-	render_destroy(render);
+	if (render)
+	{
+		render_destroy(render);
+	}
+	heap_destroy(render_heap);
+
+	if (game)
+	{
+		physics_sandbox_destroy(game);
+	}
+	heap_destroy(game_heap);
+
+	if (window)
+	{
+		wm_destroy(window);
+	}
+
+	frame_stats_set_default(NULL);
+	frame_stats_destroy(frame_stats);
+
+	if (profiler)
+	{
+		profiler_stop(profiler);
+		profiler_write_folded(profiler, fs, PROFILER_OUTPUT_PATH);
+		profiler_destroy(profiler);
+	}
 
-	physics_sandbox_destroy(game);
+	lock_profile_dump();
+
+	trace_capture_stop(trace);
+	trace_set_default(NULL);
+	trace_destroy(trace);
 
-	wm_destroy(window);
 	fs_destroy(fs);
+	heap_destroy(fs_heap);
+	job_system_destroy(jobs);
+	debug_logger_stop();
 	heap_destroy(heap);
 
-	return 0;
+	return result;
+}
+
+static BOOL WINAPI server_console_handler(DWORD type)
+{
+	//the main loop exits and shuts down normally; closing the console gives it a few seconds to
+	InterlockedExchange(&s_server_quit, 1);
+	return TRUE;
+}
+
+// Read name=value options of a stress scene over its defaults, ignoring any that are not understood.
+static void parse_stress_options(int argc, const char** argv, physics_sandbox_stress_t* stress, bool* draw)
+{
+	*stress = (physics_sandbox_stress_t)
+	{
+		.body_count = 1000,
+		.circle_percent = 50,
+		.joint_count = 0,
+		.broadphase = k_physics_broadphase_tree,
+		.pooled_bodies = true,
+		.thread_count = 0,
+		.step_count = 600,
+	};
+	*draw = true;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		const char* value = strchr(argv[i], '=');
+		if (!value)
+		{
+			debug_print(k_print_warning, "Ignoring stress option %s, which is not name=value.\n", argv[i]);
+			continue;
+		}
+		size_t name_length = value - argv[i];
+		++value;
+
+		if (is_option(argv[i], name_length, "bodies"))
+		{
+			stress->body_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "circles"))
+		{
+			stress->circle_percent = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "joints"))
+		{
+			stress->joint_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "pool"))
+		{
+			stress->pooled_bodies = atoi(value) != 0;
+		}
+		else if (is_option(argv[i], name_length, "threads"))
+		{
+			stress->thread_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "steps"))
+		{
+			stress->step_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "draw"))
+		{
+			*draw = atoi(value) != 0;
+		}
+		else if (is_option(argv[i], name_length, "broadphase"))
+		{
+			int broadphase = 0;
+			while (broadphase < k_physics_broadphase_count && strcmp(value, physicsBroadphaseGetName(broadphase)) != 0)
+			{
+				++broadphase;
+			}
+			if (broadphase < k_physics_broadphase_count)
+			{
+				stress->broadphase = broadphase;
+			}
+			else
+			{
+				debug_print(k_print_warning, "Ignoring unknown broadphase %s.\n", value);
+			}
+		}
+		else
+		{
+			debug_print(k_print_warning, "Ignoring unknown stress option %s.\n", argv[i]);
+		}
+	}
+}
+
+// Read name=value options of a network load test over its defaults, ignoring any that are not understood.
+static void parse_net_load_options(int argc, const char** argv, physics_sandbox_net_load_t* load)
+{
+	*load = (physics_sandbox_net_load_t)
+	{
+		.client_count = 16,
+		.seconds = 10,
+		.update_rate = SERVER_TICK_RATE,
+	};
+
+	for (int i = 0; i < argc; ++i)
+	{
+		const char* value = strchr(argv[i], '=');
+		if (!value)
+		{
+			debug_print(k_print_warning, "Ignoring net load option %s, which is not name=value.\n", argv[i]);
+			continue;
+		}
+		size_t name_length = value - argv[i];
+		++value;
+
+		if (is_option(argv[i], name_length, "clients"))
+		{
+			load->client_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "seconds"))
+		{
+			load->seconds = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "rate"))
+		{
+			load->update_rate = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "latency"))
+		{
+			load->latency_ms = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "jitter"))
+		{
+			load->jitter_ms = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "loss"))
+		{
+			load->loss_percent = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "bandwidth"))
+		{
+			load->bandwidth = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "shards"))
+		{
+			load->shard_count = atoi(value);
+		}
+		else
+		{
+			debug_print(k_print_warning, "Ignoring unknown net load option %s.\n", argv[i]);
+		}
+	}
+}
+
+// Read name=value options of a render benchmark over its defaults, ignoring any that are not understood.
+static void parse_render_bench_options(int argc, const char** argv, render_bench_options_t* options)
+{
+	*options = (render_bench_options_t)
+	{
+		.mesh_count = 8,
+		.shader_count = 4,
+		.instance_count = 64,
+		.path = k_render_bench_path_instanced,
+		.frame_count = 300,
+		.recorder_count = 4,
+	};
+
+	for (int i = 0; i < argc; ++i)
+	{
+		const char* value = strchr(argv[i], '=');
+		if (!value)
+		{
+			debug_print(k_print_warning, "Ignoring render bench option %s, which is not name=value.\n", argv[i]);
+			continue;
+		}
+		size_t name_length = value - argv[i];
+		++value;
+
+		if (is_option(argv[i], name_length, "meshes"))
+		{
+			options->mesh_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "shaders"))
+		{
+			options->shader_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "instances"))
+		{
+			options->instance_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "frames"))
+		{
+			options->frame_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "recorders"))
+		{
+			options->recorder_count = atoi(value);
+		}
+		else if (is_option(argv[i], name_length, "path"))
+		{
+			int path = 0;
+			while (path < k_render_bench_path_count && strcmp(value, render_bench_get_path_name(path)) != 0)
+			{
+				++path;
+			}
+			if (path < k_render_bench_path_count)
+			{
+				options->path = path;
+			}
+			else
+			{
+				debug_print(k_print_warning, "Ignoring unknown render path %s.\n", value);
+			}
+		}
+		else
+		{
+			debug_print(k_print_warning, "Ignoring unknown render bench option %s.\n", argv[i]);
+		}
+	}
+}
+
+static bool is_option(const char* option, size_t length, const char* name)
+{
+	return strlen(name) == length && strncmp(option, name, length) == 0;
 }
@@ -7,6 +7,12 @@
 
 #include <xmmintrin.h>
 
+#if MATH_SIMD
+static __m128 mat2_mul(__m128 a, __m128 b);
+static __m128 mat2_adj_mul(__m128 a, __m128 b);
+static __m128 mat2_mul_adj(__m128 a, __m128 b);
+#endif
+
 void mat4f_make_identity(mat4f_t* m)
 {
 	memset(m, 0, sizeof(*m));
@@ -80,6 +86,21 @@ void mat4f_rotate(mat4f_t* m, const quatf_t* q)
 
 void mat4f_mul(mat4f_t* result, const mat4f_t* a, const mat4f_t* b)
 {
+#if MATH_SIMD
+	//each row of the result is a's row weighting b's rows; b is loaded first in case result is b
+	__m128 b0 = _mm_loadu_ps(b->data[0]);
+	__m128 b1 = _mm_loadu_ps(b->data[1]);
+	__m128 b2 = _mm_loadu_ps(b->data[2]);
+	__m128 b3 = _mm_loadu_ps(b->data[3]);
+	for (int i = 0; i < 4; ++i)
+	{
+		__m128 row = _mm_mul_ps(_mm_set1_ps(a->data[i][0]), b0);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->data[i][1]), b1));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->data[i][2]), b2));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a->data[i][3]), b3));
+		_mm_storeu_ps(result->data[i], row);
+	}
+#else
 	for (int i = 0; i < 4; ++i)
 	{
 		for (int j = 0; j < 4; ++j)
@@ -92,6 +113,7 @@ void mat4f_mul(mat4f_t* result, const mat4f_t* a, const mat4f_t* b)
 			result->data[i][j] = tmp;
 		}
 	}
+#endif
 }
 
 void mat4f_mul_inplace(mat4f_t* result, const mat4f_t* m)
@@ -102,30 +124,32 @@ void mat4f_mul_inplace(mat4f_t* result, const mat4f_t* m)
 
 void mat4f_transform(const mat4f_t* m, const vec3f_t* in, vec3f_t* out)
 {
-#if 1
-	out->x = in->x * m->data[0][0] + in->y * m->data[1][0] + in->z * m->data[2][0] + m->data[3][0];
-	out->y = in->x * m->data[0][1] + in->y * m->data[1][1] + in->z * m->data[2][1] + m->data[3][1];
-	out->z = in->x * m->data[0][2] + in->y * m->data[1][2] + in->z * m->data[2][2] + m->data[3][2];
-#else
-	__m128 column0 = _mm_load_ps((float*)&m->data[0]);
+#if MATH_SIMD
+	__m128 column0 = _mm_loadu_ps((float*)&m->data[0]);
 	__m128 x = _mm_load_ps1(&in->x);
 	__m128 x_result = _mm_mul_ps(x, column0);
 
-	__m128 column1 = _mm_load_ps((float*)&m->data[1]);
+	__m128 column1 = _mm_loadu_ps((float*)&m->data[1]);
 	__m128 y = _mm_load_ps1(&in->y);
 	__m128 y_result = _mm_mul_ps(y, column1);
 
-	__m128 column2 = _mm_load_ps((float*)&m->data[2]);
+	__m128 column2 = _mm_loadu_ps((float*)&m->data[2]);
 	__m128 z = _mm_load_ps1(&in->z);
 	__m128 z_result = _mm_mul_ps(z, column2);
 
 	__m128 x_plus_y = _mm_add_ps(x_result, y_result);
 	__m128 x_plus_y_plus_z = _mm_add_ps(x_plus_y, z_result);
-	__m128 column3 = _mm_load_ps((float*)&m->data[3]);
+	__m128 column3 = _mm_loadu_ps((float*)&m->data[3]);
 
 	__m128 result = _mm_add_ps(x_plus_y_plus_z, column3);
 
-	_mm_storeu_ps(&out->x, result);
+	//vec3f_t is 12 bytes, so store x and y together and then z, not all four lanes
+	_mm_storel_pi((__m64*)&out->x, result);
+	_mm_store_ss(&out->z, _mm_movehl_ps(result, result));
+#else
+	out->x = in->x * m->data[0][0] + in->y * m->data[1][0] + in->z * m->data[2][0] + m->data[3][0];
+	out->y = in->x * m->data[0][1] + in->y * m->data[1][1] + in->z * m->data[2][1] + m->data[3][1];
+	out->z = in->x * m->data[0][2] + in->y * m->data[1][2] + in->z * m->data[2][2] + m->data[3][2];
 #endif
 }
 
@@ -137,6 +161,59 @@ void mat4f_transform_inplace(const mat4f_t* m, vec3f_t* v)
 
 bool mat4f_invert(mat4f_t* m)
 {
+#if MATH_SIMD
+	//block inverse over the 2x2 submatrices | A B | of m, each held as one vector
+	//                                       | C D |
+	__m128 r0 = _mm_loadu_ps(m->data[0]);
+	__m128 r1 = _mm_loadu_ps(m->data[1]);
+	__m128 r2 = _mm_loadu_ps(m->data[2]);
+	__m128 r3 = _mm_loadu_ps(m->data[3]);
+	__m128 a = _mm_movelh_ps(r0, r1);
+	__m128 b = _mm_movehl_ps(r1, r0);
+	__m128 c = _mm_movelh_ps(r2, r3);
+	__m128 d = _mm_movehl_ps(r3, r2);
+
+	//determinants |A| |B| |C| |D|
+	__m128 det_sub = _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(3, 1, 3, 1))),
+		_mm_mul_ps(_mm_shuffle_ps(r0, r2, _MM_SHUFFLE(3, 1, 3, 1)), _mm_shuffle_ps(r1, r3, _MM_SHUFFLE(2, 0, 2, 0))));
+	__m128 det_a = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(0, 0, 0, 0));
+	__m128 det_b = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(1, 1, 1, 1));
+	__m128 det_c = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(2, 2, 2, 2));
+	__m128 det_d = _mm_shuffle_ps(det_sub, det_sub, _MM_SHUFFLE(3, 3, 3, 3));
+
+	//the inverse is | X Y | over |M|, built from adjugates (#) of the submatrices
+	//               | Z W |
+	__m128 d_c = mat2_adj_mul(d, c);
+	__m128 a_b = mat2_adj_mul(a, b);
+	__m128 x = _mm_sub_ps(_mm_mul_ps(det_d, a), mat2_mul(b, d_c));
+	__m128 w = _mm_sub_ps(_mm_mul_ps(det_a, d), mat2_mul(c, a_b));
+	__m128 y = _mm_sub_ps(_mm_mul_ps(det_b, c), mat2_mul_adj(d, a_b));
+	__m128 z = _mm_sub_ps(_mm_mul_ps(det_c, b), mat2_mul_adj(a, d_c));
+
+	//|M| = |A||D| + |B||C| - tr((A#B)(D#C))
+	__m128 tr = _mm_mul_ps(a_b, _mm_shuffle_ps(d_c, d_c, _MM_SHUFFLE(3, 1, 2, 0)));
+	tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(2, 3, 0, 1)));
+	tr = _mm_add_ps(tr, _mm_shuffle_ps(tr, tr, _MM_SHUFFLE(1, 0, 3, 2)));
+	__m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(det_a, det_d), _mm_mul_ps(det_b, det_c)), tr);
+	if (_mm_cvtss_f32(det) == 0.0f)
+	{
+		return false;
+	}
+
+	__m128 inv_det = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+	x = _mm_mul_ps(x, inv_det);
+	y = _mm_mul_ps(y, inv_det);
+	z = _mm_mul_ps(z, inv_det);
+	w = _mm_mul_ps(w, inv_det);
+
+	//taking the adjugates and gathering rows in one shuffle each
+	_mm_storeu_ps(m->data[0], _mm_shuffle_ps(x, y, _MM_SHUFFLE(1, 3, 1, 3)));
+	_mm_storeu_ps(m->data[1], _mm_shuffle_ps(x, y, _MM_SHUFFLE(0, 2, 0, 2)));
+	_mm_storeu_ps(m->data[2], _mm_shuffle_ps(z, w, _MM_SHUFFLE(1, 3, 1, 3)));
+	_mm_storeu_ps(m->data[3], _mm_shuffle_ps(z, w, _MM_SHUFFLE(0, 2, 0, 2)));
+	return true;
+#else
 	float s[6];
 	s[0] = m->data[0][0] * m->data[1][1] - m->data[1][0] * m->data[0][1];
 	s[1] = m->data[0][0] * m->data[1][2] - m->data[1][0] * m->data[0][2];
@@ -183,6 +260,7 @@ bool mat4f_invert(mat4f_t* m)
 
 	*m = tmp;
 	return true;
+#endif
 }
 
 void mat4f_make_perspective(mat4f_t* m, float angle, float aspect, float z_near, float z_far)
@@ -281,3 +359,30 @@ void mat4f_make_lookat(mat4f_t* m, const vec3f_t* eye, const vec3f_t* dir, const
 	m->data[3][2] = -vec3f_dot(z_vec, *eye);
 	m->data[3][3] = 1.0f;
 }
+
+#if MATH_SIMD
+// 2x2 matrices held row by row in one vector.
+// Product a * b.
+static __m128 mat2_mul(__m128 a, __m128 b)
+{
+	return _mm_add_ps(
+		_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 3, 0))),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+
+// Product of a's adjugate and b.
+static __m128 mat2_adj_mul(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 3, 3)), b),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 1, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2))));
+}
+
+// Product of a and b's adjugate.
+static __m128 mat2_mul_adj(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(
+		_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 3, 0, 3))),
+		_mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 2, 1, 2))));
+}
+#endif
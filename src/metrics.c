@@ -0,0 +1,316 @@
+#include "metrics.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "frame_stats.h"
+#include "heap.h"
+#include "lock.h"
+#include "net.h"
+#include "thread.h"
+#include "timer.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winsock2.h>
+#pragma comment(lib, "WS2_32.lib")
+
+enum
+{
+	k_metrics_default_interval_ms = 10000,
+	k_metrics_poll_ms = 100, //longest the thread sleeps before checking whether it is stopping
+	k_metrics_packet_size = 1432, //lines sent per datagram, kept under a typical MTU
+	k_metrics_max_key = 128,
+};
+
+typedef enum metrics_type_t
+{
+	k_metrics_type_heap,
+	k_metrics_type_gauge,
+	k_metrics_type_counter,
+} metrics_type_t;
+
+typedef struct metrics_metric_t
+{
+	const char* name;
+	metrics_type_t type;
+	heap_t* heap;
+	int64_t value; //a gauge's last value or a counter's sum since the last send
+} metrics_metric_t;
+
+typedef struct metrics_t
+{
+	heap_t* heap;
+	frame_stats_t* stats;
+	char prefix[k_metrics_max_key];
+	uint64_t interval_ticks;
+
+	SOCKET sock;
+	struct sockaddr_in address;
+
+	lock_t lock; //guards registration
+	metrics_metric_t metrics[k_metrics_max];
+	int metric_count; //entries below it are complete
+
+	thread_t* thread;
+	int stopping;
+
+	// Only touched by the thread.
+	int64_t sent_totals[k_frame_stat_count]; //frame statistic totals as of the last send
+	char packet[k_metrics_packet_size];
+	int packet_size;
+} metrics_t;
+
+static int metrics_thread_func(void* user);
+static int add_metric(metrics_t* metrics, const char* name, metrics_type_t type, heap_t* heap);
+static void send_metrics(metrics_t* metrics);
+static void send_line(metrics_t* metrics, const char* group, const char* name, const char* suffix, int64_t value, const char* type);
+static void flush_packet(metrics_t* metrics);
+static int append_key(char* key, int key_size, int length, const char* name);
+
+metrics_t* metrics_create(heap_t* heap, frame_stats_t* stats, const metrics_options_t* options)
+{
+	WSADATA data;
+	WSAStartup(MAKEWORD(2, 2), &data);
+
+	net_address_t address;
+	if (!options->address || !net_string_to_address(options->address, &address))
+	{
+		debug_print(k_print_warning, "Metrics: cannot resolve %s.\n", options->address ? options->address : "(null)");
+		WSACleanup();
+		return NULL;
+	}
+
+	metrics_t* metrics = heap_alloc(heap, sizeof(metrics_t), 8);
+	memset(metrics, 0, sizeof(*metrics));
+	metrics->heap = heap;
+	metrics->stats = stats;
+	int interval_ms = options->interval_ms ? options->interval_ms : k_metrics_default_interval_ms;
+	metrics->interval_ticks = (uint64_t)interval_ms * timer_get_ticks_per_second() / 1000;
+	if (options->prefix)
+	{
+		int length = append_key(metrics->prefix, sizeof(metrics->prefix), 0, options->prefix);
+		if (length && length < (int)sizeof(metrics->prefix) - 1)
+		{
+			metrics->prefix[length] = '.';
+			metrics->prefix[length + 1] = '\0';
+		}
+	}
+	lock_init(&metrics->lock);
+
+	metrics->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	metrics->address.sin_family = AF_INET;
+	metrics->address.sin_port = htons(address.port);
+	memcpy(&metrics->address.sin_addr, address.ip, sizeof(address.ip));
+
+	//counters start from whatever the frame statistics already hold
+	for (int i = 0; stats && i < k_frame_stat_count; ++i)
+	{
+		frame_stat_summary_t summary;
+		frame_stats_get(stats, i, &summary);
+		metrics->sent_totals[i] = summary.total;
+	}
+
+	thread_options_t thread_options = { .name = "Metrics", .priority = k_thread_priority_low };
+	metrics->thread = thread_create_with_options(metrics_thread_func, metrics, &thread_options);
+	return metrics;
+}
+
+void metrics_destroy(metrics_t* metrics)
+{
+	if (!metrics)
+	{
+		return;
+	}
+
+	atomic_store(&metrics->stopping, 1);
+	thread_destroy(metrics->thread);
+
+	if (metrics->sock != INVALID_SOCKET)
+	{
+		closesocket(metrics->sock);
+	}
+	WSACleanup();
+	heap_free(metrics->heap, metrics);
+}
+
+void metrics_add_heap(metrics_t* metrics, const char* name, heap_t* heap)
+{
+	add_metric(metrics, name, k_metrics_type_heap, heap);
+}
+
+int metrics_add_gauge(metrics_t* metrics, const char* name)
+{
+	return add_metric(metrics, name, k_metrics_type_gauge, NULL);
+}
+
+int metrics_add_counter(metrics_t* metrics, const char* name)
+{
+	return add_metric(metrics, name, k_metrics_type_counter, NULL);
+}
+
+void metrics_set_gauge(metrics_t* metrics, int gauge, int64_t value)
+{
+	if (metrics && gauge >= 0)
+	{
+		atomic_store64(&metrics->metrics[gauge].value, value);
+	}
+}
+
+void metrics_add(metrics_t* metrics, int counter, int64_t value)
+{
+	if (metrics && counter >= 0)
+	{
+		atomic_fetch_add64(&metrics->metrics[counter].value, value);
+	}
+}
+
+static int add_metric(metrics_t* metrics, const char* name, metrics_type_t type, heap_t* heap)
+{
+	if (!metrics)
+	{
+		return -1;
+	}
+
+	int index = -1;
+	lock_acquire(&metrics->lock);
+	if (metrics->metric_count < k_metrics_max)
+	{
+		index = metrics->metric_count;
+		metrics->metrics[index] = (metrics_metric_t){ .name = name, .type = type, .heap = heap };
+		//the thread reads entries below the count without the lock
+		atomic_store_release(&metrics->metric_count, index + 1);
+	}
+	lock_release(&metrics->lock);
+
+	if (index < 0)
+	{
+		debug_print(k_print_warning, "Metrics: no room for %s.\n", name);
+	}
+	return index;
+}
+
+static int metrics_thread_func(void* user)
+{
+	metrics_t* metrics = user;
+	uint64_t send_ticks = timer_get_ticks();
+	while (!atomic_load(&metrics->stopping))
+	{
+		thread_sleep(k_metrics_poll_ms);
+		if (timer_get_ticks() - send_ticks >= metrics->interval_ticks)
+		{
+			send_metrics(metrics);
+			send_ticks = timer_get_ticks();
+		}
+	}
+
+	//a last send, so a run shorter than the interval is still reported
+	send_metrics(metrics);
+	return 0;
+}
+
+static void send_metrics(metrics_t* metrics)
+{
+	for (int i = 0; metrics->stats && i < k_frame_stat_count; ++i)
+	{
+		frame_stat_summary_t summary;
+		frame_stats_get(metrics->stats, i, &summary);
+		if (!summary.frame_count)
+		{
+			continue;
+		}
+
+		const char* name = frame_stats_get_name(i);
+		send_line(metrics, "frame", name, "avg", summary.avg, "g");
+		send_line(metrics, "frame", name, "p99", summary.p99, "g");
+		send_line(metrics, "frame", name, "max", summary.max, "g");
+		send_line(metrics, "frame", name, "total", summary.total - metrics->sent_totals[i], "c");
+		metrics->sent_totals[i] = summary.total;
+	}
+
+	int count = atomic_load_acquire(&metrics->metric_count);
+	for (int i = 0; i < count; ++i)
+	{
+		metrics_metric_t* metric = &metrics->metrics[i];
+		switch (metric->type)
+		{
+		case k_metrics_type_heap:
+			send_line(metrics, "heap", metric->name, "used_bytes", (int64_t)heap_get_used_bytes(metric->heap), "g");
+			break;
+		case k_metrics_type_gauge:
+			send_line(metrics, NULL, metric->name, NULL, atomic_load64(&metric->value), "g");
+			break;
+		case k_metrics_type_counter:
+			send_line(metrics, NULL, metric->name, NULL, atomic_exchange64(&metric->value, 0), "c");
+			break;
+		}
+	}
+	flush_packet(metrics);
+}
+
+// Queue one StatsD line, prefix.group.name.suffix:value|type, sending the packet first if it would not fit.
+static void send_line(metrics_t* metrics, const char* group, const char* name, const char* suffix, int64_t value, const char* type)
+{
+	char key[k_metrics_max_key];
+	int length = (int)strlen(metrics->prefix);
+	memcpy(key, metrics->prefix, length + 1);
+	if (group)
+	{
+		length = append_key(key, sizeof(key), length, group);
+		length = append_key(key, sizeof(key), length, ".");
+	}
+	length = append_key(key, sizeof(key), length, name);
+	if (suffix)
+	{
+		length = append_key(key, sizeof(key), length, ".");
+		length = append_key(key, sizeof(key), length, suffix);
+	}
+
+	char line[k_metrics_max_key + 32];
+	int line_size = snprintf(line, sizeof(line), "%s:%lld|%s\n", key, (long long)value, type);
+	line_size = __min(line_size, (int)sizeof(line) - 1);
+	if (metrics->packet_size + line_size > k_metrics_packet_size)
+	{
+		flush_packet(metrics);
+	}
+	memcpy(metrics->packet + metrics->packet_size, line, line_size);
+	metrics->packet_size += line_size;
+}
+
+static void flush_packet(metrics_t* metrics)
+{
+	if (metrics->packet_size && metrics->sock != INVALID_SOCKET)
+	{
+		//a lost datagram only leaves a gap on the dashboard, so send failures are ignored
+		sendto(metrics->sock, metrics->packet, metrics->packet_size, 0, (struct sockaddr*)&metrics->address, sizeof(metrics->address));
+	}
+	metrics->packet_size = 0;
+}
+
+// Append a display name to a key at length as lowercase letters and digits, with runs of anything else
+// turned into a single underscore, so "GPU Frame End (us)" becomes "gpu_frame_end_us". Returns the new length.
+static int append_key(char* key, int key_size, int length, const char* name)
+{
+	bool separate = false;
+	for (const char* c = name; *c && length < key_size - 2; ++c)
+	{
+		if ((*c >= 'a' && *c <= 'z') || (*c >= '0' && *c <= '9') || (*c >= 'A' && *c <= 'Z') || *c == '.')
+		{
+			if (separate)
+			{
+				key[length++] = '_';
+				separate = false;
+			}
+			key[length++] = (*c >= 'A' && *c <= 'Z') ? (char)(*c - 'A' + 'a') : *c;
+		}
+		else if (length && key[length - 1] != '.')
+		{
+			separate = true;
+		}
+	}
+	key[length] = '\0';
+	return length;
+}
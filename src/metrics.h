@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+// Metrics export.
+// A background thread periodically sends frame statistics, heap usage and registered gauges and counters
+// as StatsD lines over UDP, so dashboards can follow frame time, tick overrun and bandwidth per instance.
+// Every frame statistic is sent as gauges of its average, 99th percentile and maximum over the frame
+// statistics window, and a counter of its total since the last send.
+// Recording a gauge or counter is a single atomic operation; summarizing, formatting and sending all
+// happen on the background thread.
+
+typedef struct frame_stats_t frame_stats_t;
+typedef struct heap_t heap_t;
+
+// Handle to a metrics exporter.
+typedef struct metrics_t metrics_t;
+
+enum
+{
+	// Heaps, gauges and counters one exporter can have registered.
+	k_metrics_max = 64,
+};
+
+// Options for creating a metrics exporter.
+typedef struct metrics_options_t
+{
+	// StatsD server to send to, as host:port.
+	const char* address;
+	// Prefix of every metric's name, such as the game and the server instance, or NULL for none.
+	const char* prefix;
+	// Milliseconds between sends, or zero for 10000.
+	int interval_ms;
+} metrics_options_t;
+
+// Creates a metrics exporter sending frame statistics, which may be NULL, and starts its thread.
+// Returns NULL if the address does not resolve.
+metrics_t* metrics_create(heap_t* heap, frame_stats_t* stats, const metrics_options_t* options);
+
+// Sends the metrics a last time, stops the thread and destroys the exporter.
+// Heaps must outlive the exporter.
+void metrics_destroy(metrics_t* metrics);
+
+// Send a heap's used bytes as a gauge, read on the background thread with heap_get_used_bytes().
+void metrics_add_heap(metrics_t* metrics, const char* name, heap_t* heap);
+
+// Register a gauge, which sends the last value set; returns its index, or -1 if k_metrics_max are registered.
+// Names must outlive the exporter.
+int metrics_add_gauge(metrics_t* metrics, const char* name);
+
+// Register a counter, which sends the sum of values added since the last send; returns its index, or -1.
+int metrics_add_counter(metrics_t* metrics, const char* name);
+
+// Set a gauge. Safe to call from any thread.
+void metrics_set_gauge(metrics_t* metrics, int gauge, int64_t value);
+
+// Add to a counter. Safe to call from any thread.
+void metrics_add(metrics_t* metrics, int counter, int64_t value);
@@ -0,0 +1,112 @@
+#include "mover.h"
+
+#include "ecs.h"
+#include "ecs_scheduler.h"
+#include "heap.h"
+#include "transform.h"
+
+#include <string.h>
+
+typedef struct mover_t
+{
+	heap_t* heap;
+	ecs_t* ecs;
+	ecs_scheduler_t* scheduler;
+	int transform_type;
+	size_t transform_size; //stride of the transform arrays in chunks
+	int mover_type;
+	int system;
+} mover_t;
+
+static void update_movers(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
+
+mover_t* mover_create(heap_t* heap, ecs_t* ecs, ecs_scheduler_t* scheduler, int transform_type)
+{
+	mover_t* mover = heap_alloc(heap, sizeof(mover_t), 8);
+	memset(mover, 0, sizeof(*mover));
+	mover->heap = heap;
+	mover->ecs = ecs;
+	mover->scheduler = scheduler;
+	mover->transform_type = transform_type;
+	mover->transform_size = ecs_get_component_type_size(ecs, transform_type);
+	mover->mover_type = ecs_register_component_type(ecs, "mover", sizeof(mover_component_t), _Alignof(mover_component_t));
+	mover->system = ecs_scheduler_add_system(scheduler, "movers", ECS_MASK(mover->mover_type), ECS_MASK(transform_type), true, update_movers, mover);
+	return mover;
+}
+
+void mover_destroy(mover_t* mover)
+{
+	heap_free(mover->heap, mover);
+}
+
+int mover_get_component_type(mover_t* mover)
+{
+	return mover->mover_type;
+}
+
+int mover_get_system(mover_t* mover)
+{
+	return mover->system;
+}
+
+// Move a chunk of entities by their velocities over the time since the system last ran on it, then wrap them.
+static void update_movers(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user)
+{
+	mover_t* mover = user;
+	float dt = (float)ecs_scheduler_get_delta_us(mover->scheduler, mover->system, chunk) * 0.000001f;
+
+	char* transform_comps = ecs_chunk_query_get_components(ecs, chunk, mover->transform_type);
+	const mover_component_t* mover_comps = ecs_chunk_query_get_components(ecs, chunk, mover->mover_type);
+	int count = ecs_chunk_query_get_count(ecs, chunk);
+
+#if MATH_SIMD
+	//an axis per lane; the fourth lane of each load is the field after the vector, which is left as it was
+	__m128 step = _mm_set1_ps(dt);
+	__m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+	__m128i axis_bits = _mm_setr_epi32(k_mover_wrap_x, k_mover_wrap_y, k_mover_wrap_z, 0);
+	for (int i = 0; i < count; ++i)
+	{
+		transform_t* transform = (transform_t*)(transform_comps + i * mover->transform_size);
+		const mover_component_t* mover_comp = &mover_comps[i];
+
+		__m128 old = _mm_loadu_ps(&transform->translation.x);
+		__m128 velocity = _mm_loadu_ps(&mover_comp->velocity.x);
+		__m128 min = _mm_loadu_ps(&mover_comp->wrap_min.x);
+		__m128 max = _mm_loadu_ps(&mover_comp->wrap_max.x);
+		__m128i wrap_bits = _mm_and_si128(_mm_set1_epi32(mover_comp->wrap_mask), axis_bits);
+		__m128 wraps = _mm_castsi128_ps(_mm_cmpgt_epi32(wrap_bits, _mm_setzero_si128()));
+
+		__m128 moved = _mm_add_ps(old, _mm_mul_ps(velocity, step));
+		__m128 span = _mm_sub_ps(max, min);
+		__m128 above = _mm_and_ps(_mm_cmpgt_ps(moved, max), wraps);
+		__m128 below = _mm_and_ps(_mm_cmplt_ps(moved, min), wraps);
+		moved = _mm_sub_ps(moved, _mm_and_ps(above, span));
+		moved = _mm_add_ps(moved, _mm_and_ps(below, span));
+		_mm_storeu_ps(&transform->translation.x, _mm_or_ps(_mm_and_ps(xyz, moved), _mm_andnot_ps(xyz, old)));
+	}
+#else
+	for (int i = 0; i < count; ++i)
+	{
+		transform_t* transform = (transform_t*)(transform_comps + i * mover->transform_size);
+		const mover_component_t* mover_comp = &mover_comps[i];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float moved = transform->translation.a[axis] + mover_comp->velocity.a[axis] * dt;
+			if (mover_comp->wrap_mask & (1 << axis))
+			{
+				float span = mover_comp->wrap_max.a[axis] - mover_comp->wrap_min.a[axis];
+				if (moved > mover_comp->wrap_max.a[axis])
+				{
+					moved -= span;
+				}
+				else if (moved < mover_comp->wrap_min.a[axis])
+				{
+					moved += span;
+				}
+			}
+			transform->translation.a[axis] = moved;
+		}
+	}
+#endif
+	ecs_chunk_query_mark_changed(ecs, chunk, mover->transform_type);
+}
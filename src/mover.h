@@ -0,0 +1,57 @@
+#pragma once
+
+// Kinematic Movers
+// Moves entities at constant velocities, wrapping them around bounds on the axes they choose, as traffic
+// that drives off one side of a lane comes back on the other.
+// Each moving entity has a mover component holding its velocity and bounds. The mover's system adds the
+// velocity, times the time since it last ran, to the translation in the entity's transform component.
+// It goes a chunk at a time, in parallel on the scheduler's jobs, straight through the chunk's arrays,
+// so moving costs a few vector instructions per entity instead of a transform multiply.
+
+#include "vec3f.h"
+
+#include <stdint.h>
+
+typedef struct ecs_t ecs_t;
+typedef struct ecs_scheduler_t ecs_scheduler_t;
+typedef struct heap_t heap_t;
+
+// Handle to a set of movers.
+typedef struct mover_t mover_t;
+
+// Axes a mover wraps around its bounds on.
+enum
+{
+	k_mover_wrap_x = 1 << 0,
+	k_mover_wrap_y = 1 << 1,
+	k_mover_wrap_z = 1 << 2,
+};
+
+// How an entity moves.
+typedef struct mover_component_t
+{
+	// Units per second.
+	vec3f_t velocity;
+	// On each wrapped axis, a translation that passes max goes back by the distance from min to max, and one
+	// that passes min forward by it.
+	vec3f_t wrap_min;
+	vec3f_t wrap_max;
+	// k_mover_wrap_* bits of the axes that wrap; the others move without bounds.
+	uint32_t wrap_mask;
+} mover_component_t;
+
+// Create movers over an entity component system, registering the mover component type and a system on
+// scheduler that moves the entities with one.
+// Transform type is the component holding entities' transforms, which must begin with a transform_t.
+// The system runs after the systems already registered that it conflicts with, and is given the time since
+// it last ran on each chunk, so movers in slower tiers of the scheduler still keep their speed.
+mover_t* mover_create(heap_t* heap, ecs_t* ecs, ecs_scheduler_t* scheduler, int transform_type);
+
+// Destroy movers. Their system stays registered, so destroy the scheduler first.
+void mover_destroy(mover_t* mover);
+
+// Get the mover component type, for the masks of entities that move.
+int mover_get_component_type(mover_t* mover);
+
+// Get the movers' system index in the scheduler.
+int mover_get_system(mover_t* mover);
@@ -1,18 +1,32 @@
 #include "net.h"
 
+#include "atomic.h"
 #include "debug.h"
+#include "frame_stats.h"
 #include "heap.h"
-#include "mutex.h"
-#include "queue.h"
+#include "job.h"
+#include "lock.h"
+#include "object_pool.h"
+#include "spsc_queue.h"
 #include "thread.h"
 #include "timer.h"
+#include "timer_object.h"
+#include "trace.h"
+#include "vec3f.h"
 
+#define LZ4_STATIC_LINKING_ONLY
+#include "lz4/lz4.h"
+#include "lz4/xxhash.h"
+
+#include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mswsock.h>
 #pragma comment(lib, "WS2_32.lib")
 
 enum
@@ -20,121 +34,773 @@ enum
 	k_net_mtu = 1024,
 	k_timeout_ms = 5000,
 	k_max_entity_types = 32,
-	k_max_snapshots = 256,
-	k_max_entities = 32,
+	k_max_entities = 1024,
+	k_max_component_types = k_ecs_max_component_types,
+	k_max_component_fields = 8,
+
+	// Packets a connection keeps of what it sent and received, to encode and decode deltas against.
+	// Senders only encode against an acked packet this recent, named by its distance in baseline bits.
+	k_recv_snapshots = 32,
+	k_baseline_bits = 5,
+
+	// Packets sent to each connection per tick unless net options say otherwise.
+	k_net_default_packets_per_update = 4,
+
+	// Ticks per second unless net options say otherwise; each tick snapshots entities and sends.
+	k_net_default_tick_rate = 30,
+
+	// Adapting the send rate to congestion: a connection is congested with this round trip time or
+	// percentage of packets lost. Its send interval then doubles, up to the most ticks apart, at most
+	// once a second; once uncongested for the recovery time it halves again.
+	k_congested_rtt_ms = 250,
+	k_congested_loss_percent = 10,
+	k_max_send_interval = 8,
+	k_send_recovery_seconds = 5,
+
+	// Bandwidth is measured over windows of this length.
+	k_bandwidth_window_ms = 1000,
+
+	// Ticks a remote entity may go unsent before it is removed.
+	// Entities only leave packets when out of range or outbid for space, so this is well above
+	// how often a relevant entity's accumulated priority wins it a place.
+	k_entity_timeout_sequences = 60,
+
+	// Slots indexing remote entities by sequence, a power of two at least twice k_max_entities.
+	k_remote_entity_slot_bits = 11,
+	k_remote_entity_slots = 1 << k_remote_entity_slot_bits,
+
+	k_relevancy_grid_buckets = 256,
+
+	// Received packets a connection holds for the game thread; a few updates' worth, so packets
+	// bunched up by jitter are not dropped.
+	k_net_default_recv_queue_size = 32,
+
+	// Received packets a connection decodes per update before the game thread applies them; well within
+	// the received snapshots kept, so none is decoded over before it is applied. A longer backlog is
+	// dropped from its oldest end instead of carried to the next update.
+	k_max_incoming_packets = k_recv_snapshots / 2,
+
+	// Timestamped states kept of each remote entity to interpolate between, and the floats of
+	// each that are interpolated; fields beyond them snap to the newest state.
+	// Samples must span the interpolation delay at the sender's update rate.
+	k_interpolation_samples = 8,
+	k_max_interpolated_floats = 12,
+	k_net_default_interpolation_delay_ms = 100,
+
+	// Longest a remote entity is extrapolated past its newest state before it holds still.
+	k_max_extrapolation_ms = 100,
+
+	// Input commands kept until an authoritative peer has simulated them, at most this many resent
+	// in each update's first packet, and the largest predicted state compared against corrections.
+	k_input_history = 128,
+	k_max_packet_inputs = 16,
+	k_max_packet_corrections = 8,
+	k_max_input_state_size = 64,
+
+	// Reliable events queued to each connection until it acks them, enough for a spawn of every entity when
+	// the connection starts and as many again, at most this many resent in each update's first packet; and
+	// remote entities spawned ahead of their first state, kept to hold them once it arrives.
+	k_connection_events = k_max_entities * 2,
+	k_max_packet_events = 32,
+	k_max_pending_spawns = 64,
+
+	// Entity header in packets: type, entity sequence as a varint and how the entity is encoded.
+	// Sent snapshots hold two MTUs of in-memory headers and data, so no more entities than that could fit.
+	k_entity_type_bits = 5,
+	k_entity_mode_bits = 2,
+	k_min_entity_header_bits = k_entity_type_bits + 8 + k_entity_mode_bits,
+	k_max_packet_entities = k_net_mtu * 2 / 8,
+
+	// Packet header on the wire: 16 bit sequence and ack, ack bits, send time, flags, command and event counts.
+	// Sequences are widened against the newest the receiver knows of, so they may wrap.
+	k_packet_header_size = 2 + 2 + 4 + 4 + 1 + 1 + 1 + 1,
+	k_packet_pool_size = 64,
+	k_net_default_max_connections = 64,
+
+	// Receives kept posted and sends in flight at once with registered I/O.
+	k_net_rio_recv_count = 64,
+	k_net_rio_send_count = 64,
+
+	// Longest compression dictionary kept; LZ4 matches reach back no further.
+	k_net_max_dictionary_size = 64 * 1024,
 };
 
+// Table entry marking a removed connection. Its address is the broadcast address, never a peer.
+static const int64_t k_connection_tombstone = -1;
+
 typedef struct entity_type_t
 {
-	uint64_t component_mask;
-	uint64_t replicated_component_mask;
+	ecs_mask_t component_mask;
+	ecs_mask_t replicated_component_mask;
 	net_configure_entity_callback_t configure_callback;
 	void* configure_callback_data;
-	size_t replicated_size;
+	int replicated_bits; //encoded size of the replicated components
+	size_t replicated_size; //replicated_bits rounded up to whole bytes, as stored in snapshots
+
+	// Set for types driven by input commands.
+	net_input_callback_t input_callback;
+	void* input_callback_data;
+	int input_size;
 } entity_type_t;
 
+// Encoding of a replicated component type; without fields it is copied whole.
+typedef struct component_fields_t
+{
+	net_field_t fields[k_max_component_fields];
+	int count;
+} component_fields_t;
+
+// Bit-packed read or write position in a buffer.
+// Values are stored least significant bit first. Going past capacity sets overflow;
+// writes are dropped and reads return zero.
+typedef struct bit_stream_t
+{
+	uint8_t* data;
+	size_t capacity; //in bits
+	size_t position; //in bits
+	bool overflow;
+} bit_stream_t;
+
 typedef struct entity_data_t
 {
 	ecs_entity_ref_t ref;
 	int type;
 	int remote_sequence;
 	int last_recved_sequence;
+	uint32_t data_hash; //of the encoded data last decoded into the entity
+	bool live; //ours: registered, and not yet seen removed to send its despawn
+	bool spawned; //remote: its spawn event arrived, so it is held until despawned rather than timed out
 } entity_data_t;
 
+// Entities carried by one packet, as encoded before packing.
 typedef struct snapshot_t
 {
-	int sequence;
+	int sequence; //of the packet
 	int size;
-	char data[k_net_mtu];
+	//each entity is a header and its components encoded to replicated_size bytes;
+	//entity headers are wider here than in packets, so this holds more than a packet
+	char data[k_net_mtu * 2];
+
+	// Sent packets only: whether the receiver acked it, and for each entity in data order,
+	// its index in net->entities and the newest write tick of its replicated components.
+	bool acked;
+	int indices[k_max_packet_entities];
+	uint32_t versions[k_max_packet_entities];
+
+	// Sent packets only: the ECS tick the world snapshot it came from was taken on.
+	// Components written on that tick may have been written again after the snapshot, under the same tick.
+	uint32_t tick;
+
+	// When the packet was sent, by the sender's playback clock.
+	uint32_t time_ms;
+
+	// Sent packets only: system time it was sent, to measure round trips.
+	uint32_t sent_ms;
+
+	// Sent packets only: newest reliable event carried, or -1.
+	int event_last;
 } snapshot_t;
 
+// Interpolated fields of a remote entity as of when the sender sent them.
+typedef struct entity_sample_t
+{
+	uint32_t time_ms;
+	float values[k_max_interpolated_floats];
+} entity_sample_t;
+
+// Jitter buffer of a remote entity's recent states, oldest first.
+typedef struct interpolation_t
+{
+	entity_sample_t samples[k_interpolation_samples];
+	int count;
+} interpolation_t;
+
+// Entity that may be sent to a connection, ordered by priority.
+typedef struct candidate_t
+{
+	int index;
+	float priority;
+} candidate_t;
+
+// An entity's delta against one baseline state, shared this update by every connection whose baseline is that state.
+// Baselines are found by the write tick they were encoded at; equal ticks mean equal data, as long as the
+// baseline was taken on a later tick than that, which is the only kind cached.
+// Connections build their packets in parallel, so each entry has a lock.
+typedef struct delta_cache_t
+{
+	lock_t lock;
+	bool valid;
+	uint32_t base_version;
+	int changed_bytes;
+	int offset; //of the encoded delta in the world snapshot's delta data, or -1 until a connection sends it
+	int bits;
+} delta_cache_t;
+
+// State of every replicated entity for the current update, from which each connection's packet is chosen.
+typedef struct world_snapshot_t
+{
+	int size;
+	int count; //entries, indexed as net->entities
+	int offsets[k_max_entities]; //of each entity's header in data, or -1 if it did not fit
+	uint32_t versions[k_max_entities];
+	uint32_t tick; //ECS tick the snapshot was taken on
+
+	// Spatial hash of entity positions for relevancy; entities without one are always relevant.
+	bool has_position[k_max_entities];
+	vec3f_t positions[k_max_entities];
+	int grid_heads[k_relevancy_grid_buckets];
+	int grid_next[k_max_entities];
+
+	char data[k_net_mtu * 64];
+
+	// Each delta costs at most 9 bits per byte of data, and each entity caches one at a time.
+	delta_cache_t deltas[k_max_entities];
+	uint8_t delta_data[k_net_mtu * 64 * 9 / 8];
+	int delta_size; //reserved atomically, for the most a delta could take
+} world_snapshot_t;
+
 typedef struct packet_t
 {
+	struct sockaddr_in address; //destination of an outgoing packet
+	SOCKET sock; //an outgoing packet is sent from
+	uint64_t ticks; //when an outgoing packet is due out of link conditioning, or an incoming one arrived
 	int size;
 	char data[k_net_mtu];
 } packet_t;
 
+// Packet buffer registered with the socket, with room for the remote address beside the data.
+typedef struct rio_slot_t
+{
+	char data[k_net_mtu];
+	SOCKADDR_INET address;
+} rio_slot_t;
+
+// Every packet stands alone: it carries a slice of the sender's entities, each delta encoded
+// against an earlier packet the receiver acked, so a lost packet only delays its own entities.
+// Held with full sequences, written in k_packet_header_size bytes by packet_header_write().
 typedef struct packet_header_t
 {
 	int sequence;
-	int ack_sequence;
+	int ack_sequence; //newest packet received from the other side
+	uint32_t ack_bits; //bit i set if packet ack_sequence - 1 - i was received too
+	uint32_t send_ms; //sender's clock when sent, to play remote entities back on
+	int flags;
+
+	// Input commands, then corrections, then reliable events precede the entities.
+	uint16_t input_count;
+	uint16_t correction_count;
+	uint16_t event_count;
 } packet_header_t;
 
+// Packet header flags.
+enum
+{
+	k_packet_flag_compressed = 1 << 0, //entities that follow the header are LZ4 compressed
+	k_packet_flag_dictionary = 1 << 1, //and compressed against the shared dictionary
+};
+
+// How an entity is encoded in a packet.
+// Except in full, the mode is followed by how many packets back the baseline is.
+typedef enum entity_mode_t
+{
+	k_entity_mode_same, //unchanged since the baseline
+	k_entity_mode_delta, //per byte of encoded data, a changed bit and the XOR with the baseline if changed
+	k_entity_mode_full, //encoded data in full
+} entity_mode_t;
+
 typedef struct entity_packet_header_t
 {
 	int type;
 	int sequence;
 } entity_packet_header_t;
 
+// Input command in a packet, followed by the type's input_size bytes.
+// Entity sequence is the sender's, as in entity_packet_header_t.
+typedef struct input_packet_header_t
+{
+	int entity_sequence;
+	int type;
+	int sequence; //of the command, counting every command the sender pushed
+} input_packet_header_t;
+
+// Authoritative state of an entity the receiver sent us commands for, followed by its
+// replicated components encoded to the type's replicated_size bytes.
+typedef struct correction_packet_header_t
+{
+	int entity_sequence; //the receiver's
+	int type;
+	int input_sequence; //newest of the receiver's commands simulated into the state
+} correction_packet_header_t;
+
+// Kinds of reliable event.
+typedef enum event_kind_t
+{
+	k_event_spawn, //one of the sender's entities was registered; the receiver holds it until despawned
+	k_event_despawn, //and was removed
+	k_event_user, //sent with net_send_event()
+} event_kind_t;
+
+// Reliable event in a packet, followed by size bytes of data.
+// Entity sequence and type are the sender's, as in entity_packet_header_t.
+typedef struct event_packet_header_t
+{
+	int sequence; //of the event, counting every event queued to the connection
+	int entity_sequence;
+	uint8_t kind;
+	uint8_t type;
+	uint16_t size;
+} event_packet_header_t;
+
+// Reliable event queued to a connection until it acks a packet carrying it.
+typedef struct event_t
+{
+	event_packet_header_t header;
+	char data[k_net_max_event_size];
+} event_t;
+
+// Input command applied to one of our entities, kept to replay until an authoritative peer simulates it.
+typedef struct input_record_t
+{
+	int sequence;
+	ecs_entity_ref_t ref;
+	int type;
+	char input[k_net_max_input_size];
+	char state[k_max_input_state_size]; //encoded replicated components predicted after the command
+	bool has_state;
+} input_record_t;
+
+// A packet built by a connection's job, to copy into a send slot or pooled packet.
+typedef struct outgoing_t
+{
+	int size;
+	char data[k_net_mtu];
+} outgoing_t;
+
+// A packet popped by a connection's job, decompressed in place, with its entities decoded into the
+// received snapshot of its sequence unless it is stale or malformed.
+typedef struct incoming_t
+{
+	packet_t* packet;
+	packet_header_t header;
+	bool decoded;
+} incoming_t;
+
+typedef struct net_shard_t net_shard_t;
+
 typedef struct connection_t
 {
 	net_t* net;
+	net_shard_t* shard; //whose socket the connection's packets arrive on and are sent from
 
 	net_address_t address;
 
-	int incoming_sequence;
+	int incoming_sequence; //newest packet received
+	uint32_t incoming_bits; //packets received before it, as sent in ack_bits
 	int ack_sequence;
+	int send_sequence; //of the next packet sent
 
-	thread_t* send_thread;
-
-	queue_t* send_queue;
-	queue_t* recv_queue;
+	spsc_queue_t* recv_queue;
 
 	uint32_t last_recv_ms;
+	int recv_dropped; //received packets dropped by a full receive queue or behind a backlog
+
+	// Work net_update() splits around the connection's job: packets built for the game thread to send,
+	// with the entities already in one of them, and packets received and decoded for it to apply.
+	bool job_done; //ran its job this update
+	bool send_pending; //packets are built and sent this update
+	outgoing_t* outgoing; //packets per update of them
+	int outgoing_count;
+	bool picked[k_max_entities];
+	LZ4_stream_t* lz4; //compresses payloads against the shared dictionary, or NULL without one
+	incoming_t incoming[k_max_incoming_packets];
+	int incoming_count;
 
 	entity_data_t entities[k_max_entities];
+
+	// Remote entities by their sender's entity sequence, in open addressed slots holding index + 1 into entities,
+	// or 0 where empty. Each slot of entities is present from when it is first used until it is reused.
+	uint16_t remote_slots[k_remote_entity_slots];
+	int remote_search; //slot of entities the search for an unused one starts at
+
+	// Encoded entities of the most recent packets sent and received, indexed by sequence.
+	snapshot_t sent_snapshots[k_recv_snapshots];
+	snapshot_t recv_snapshots[k_recv_snapshots];
+
+	// Priority each of our entities has built up since last sent on this connection,
+	// and the newest acked packet that carried it, or -1.
+	float priorities[k_max_entities];
+	int last_acked[k_max_entities];
+
+	// Remote entities are shown interpolation delay behind the sender's clock, mapped onto ours
+	// by the offset at which its packets arrive soonest, so they move smoothly however packets bunch up.
+	interpolation_t interpolation[k_max_entities]; //indexed as entities
+	int64_t clock_offset_ms; //our clock minus the sender's
+	bool clock_synced;
+
+	int input_sequence; //newest input command from the connection we simulated, or -1
+
+	// Reliable events, ordered, rare and too important to lose with a packet. Each update's first packet carries
+	// those the connection has not acked, oldest first, so acking a packet acks every event in it and all before.
+	// A connection is sent a spawn of each of our entities when it starts, ahead of any later event.
+	bool events_started;
+	event_t events[k_connection_events]; //ring indexed by sequence
+	int event_sequence; //of the next event queued
+	int event_acked; //newest event the connection acked, or -1
+	int spawn_events[k_max_entities]; //spawn event queued for each of our entities, or -1
+	int event_received; //newest of the connection's events applied, or -1
+	int pending_spawns[k_max_pending_spawns]; //remote entity sequences spawned before their first state, + 1, or 0
+	int pending_spawn_next;
+
+	// Smoothed round trip time and fraction of packets lost, from acks, and variation in how long
+	// packets take to arrive, from their send times.
+	float rtt_ms;
+	float loss;
+	float jitter_ms;
+	int64_t last_transit_ms;
+
+	// Bytes received, added to by the recv thread, and sent, with their rates over the last window.
+	int64_t bytes_in;
+	int64_t bytes_out;
+	int64_t window_bytes_in;
+	int64_t window_bytes_out;
+	uint32_t window_start_ms;
+	float bytes_in_per_second;
+	float bytes_out_per_second;
+
+	// Smoothed and longest time from a packet arriving to its snapshot being applied.
+	float apply_ms;
+	float max_apply_ms;
+
+	// Ticks between sends to the connection; more than one while adapting to congestion.
+	int send_interval;
+	int ticks_since_send;
+	int ticks_since_adapt; //since the interval last changed
+	int ticks_uncongested;
 } connection_t;
 
+// A socket and the connections whose packets arrive on it, each bound to its own port with its own receive thread.
+// A connection belongs to the shard that first received from it, or that its address hashes to if we connect
+// to it, and is only ever fed by that shard's thread; so receiving scales with shards, which share no lock.
+typedef struct net_shard_t
+{
+	net_t* net;
+	SOCKET sock;
+	thread_t* recv_thread;
+
+	// The shard's connections are a range of the net's.
+	int first_connection;
+	int connection_count;
+
+	// Connections are found by address in an open-addressed table of packed entries.
+	// Each entry holds the address in its high 48 bits and the connection index in its
+	// low 16, so the recv thread reads one without a lock; the lock only serializes
+	// adding and removing connections.
+	lock_t connections_lock;
+	int64_t* connection_table;
+	int connection_table_mask;
+	int connection_table_used; //live entries and tombstones
+
+	// Registered I/O (Winsock RIO), or a NULL request queue to use recvfrom and sendto.
+	// Receives complete in batches on the recv thread; the game thread defers each connection's
+	// send and commits them all with one call per update, so neither pays a syscall per packet.
+	RIO_RQ rio_rq;
+	RIO_CQ rio_recv_cq;
+	RIO_CQ rio_send_cq; //polled by the game thread to recycle send slots
+	HANDLE rio_recv_event;
+	rio_slot_t* rio_slots; //k_net_rio_recv_count receive slots, then k_net_rio_send_count send slots
+	RIO_BUFFERID rio_buffer_id;
+	int rio_send_free[k_net_rio_send_count];
+	int rio_send_free_count;
+	int rio_send_pending; //deferred sends not yet committed
+} net_shard_t;
+
 typedef struct net_t
 {
 	heap_t* heap;
 	ecs_t* ecs;
 
 	int sequence;
-
-	SOCKET sock;
-	thread_t* recv_thread;
-
-	mutex_t* connections_mutex;
-	connection_t connections[3];
+	job_system_t* jobs; //runs connections' jobs, or NULL to run them on the game thread
+
+	// Dictionary payloads are compressed against, or NULL. Its stream is loaded once and attached to each
+	// connection's working stream before a packet is compressed, so no packet pays to load it.
+	char* dictionary;
+	int dictionary_size;
+	LZ4_stream_t* dictionary_stream;
+
+	// Sockets, each with its own receive thread and share of the connections.
+	net_shard_t* shards;
+	int shard_count;
+
+	connection_t* connections;
+	int max_connections;
+	int recv_queue_size;
+	int packets_per_update;
+	int interpolation_delay_ms;
+
+	// Sends happen on fixed ticks, whatever rate net_update() is called at.
+	int tick_rate;
+	uint64_t tick_interval; //in timer ticks
+	uint64_t tick_accumulator;
+	uint64_t tick_last; //timer ticks at the last net_update()
+	bool adapt_send_rate;
+	timer_object_t* timer; //or NULL for the system timer
+
+	// Every packet buffer is allocated up front; with none free, packets are dropped rather than
+	// falling back to the heap, so the network path never takes the heap's lock.
+	object_pool_t* packet_pool;
+	int dropped_packets;
+
+	// One thread sends for every connection, unless registered I/O sends from the game thread.
+	thread_t* send_thread;
+	spsc_queue_t* send_queue;
+	int send_closing;
+	bool offline; //packets sent are dropped, and only those injected are received
+	net_packet_callback_t packet_callback;
+	void* packet_callback_data;
+
+	// Link conditioning, applied by the send thread. Packets it holds until due are a ring in the order
+	// they were sent, which is also the order they are due in.
+	net_link_t link;
+	bool link_conditioned;
+	packet_t** link_held;
+	int link_held_capacity;
+	int link_held_head;
+	int link_held_count;
+	uint64_t link_free_ticks; //when the link has sent every packet held, under a bandwidth cap
+	uint64_t link_due_ticks; //when the newest packet held is due
+	uint32_t link_random;
+
+	// Registered I/O functions, for shards whose sockets have it.
+	RIO_EXTENSION_FUNCTION_TABLE rio;
+	int rio_closing;
+
+	// Authoritative peers simulate the input commands connections send and correct their entities;
+	// other peers predict their own entities from the commands they push, ring indexed by sequence.
+	bool authoritative;
+	int input_sequence; //of the next command pushed
+	int input_acked; //newest command an authoritative peer simulated, or -1
+	input_record_t input_history[k_input_history];
 
 	entity_type_t entity_types[k_max_entity_types];
+	component_fields_t component_fields[k_max_component_types];
 	entity_data_t entities[k_max_entities];
-	snapshot_t snapshots[k_max_snapshots];
+	int entity_count; //slots of entities ever registered; removed ones leave holes until reused
+	world_snapshot_t snapshot;
+	net_relevancy_t relevancy;
+
+	net_event_callback_t event_callback;
+	void* event_callback_data;
 } net_t;
 
+static int send_thread_func(void* user);
+static void send_packet(net_t* net, packet_t* packet);
+static void link_hold(net_t* net, packet_t* packet);
+static uint32_t link_random(net_t* net);
 static int recv_thread_func(void* user);
-static connection_t* find_or_create_connection(net_t* net, const net_address_t* address);
+static void rio_recv(net_shard_t* shard);
+static void recv_packet(net_shard_t* shard, packet_t* packet, const struct sockaddr_in* address);
+static bool rio_create(net_shard_t* shard);
+static void rio_destroy(net_shard_t* shard);
+static void rio_post_recv(net_shard_t* shard, int slot);
+static int rio_acquire_send_slot(net_shard_t* shard);
+static void rio_send(connection_t* connection, int slot, int size);
+static RIO_BUF rio_buf(net_shard_t* shard, void* field, ULONG length);
+static void address_to_sockaddr(const net_address_t* address, struct sockaddr_in* sockaddr);
+static connection_t* find_connection(net_shard_t* shard, const net_address_t* address);
+static int64_t connection_key(const net_address_t* address);
+static void connection_table_insert(net_shard_t* shard, int64_t key, int index);
+static void connection_table_remove(net_shard_t* shard, const net_address_t* address);
+static void connection_clear(net_t* net, connection_t* connection);
+static connection_t* find_or_create_connection(net_shard_t* shard, const net_address_t* address);
+static net_shard_t* shard_for_address(net_t* net, const net_address_t* address);
+static uint16_t shard_create(net_t* net, net_shard_t* shard, int first_connection, int connection_count, uint16_t port);
+static void shard_destroy(net_shard_t* shard);
 
 static void timeout_old_connections(net_t* net);
+static bool net_tick(net_t* net);
+static void connection_update_stats(connection_t* connection, net_connection_stats_t* totals);
+static void connection_adapt_send_rate(connection_t* connection);
 static void snapshot_entities(net_t* net);
+static void connection_job(void* data);
+static void packet_build(connection_t* connection);
 static void packet_send(connection_t* connection);
+static void packet_decode(connection_t* connection);
 static void packet_recv(connection_t* connection);
+static void update_replicated_size(net_t* net, int type);
+static int count_changed_bytes(const char* data, const char* base_data, size_t size);
+static const char* entity_baseline(connection_t* connection, int index, int entity_sequence, int* distance, uint32_t* version);
+static void packet_process_acks(connection_t* connection, const packet_header_t* header);
+static void connection_relevance(connection_t* connection, float* relevance);
+static bool entity_position(net_t* net, ecs_entity_ref_t ref, int type, vec3f_t* position);
+static int relevancy_grid_bucket(int x, int y, int z);
+static const char* snapshot_find(net_t* net, const snapshot_t* snapshot, int sequence, int* index);
+static int compare_candidates(const void* a, const void* b);
+static bool packet_read_snapshot(connection_t* connection, const char* packet, size_t packet_size, snapshot_t* snapshot);
+static void packet_apply_snapshot(connection_t* connection, const snapshot_t* snapshot);
+static uint32_t remote_entity_home(int sequence);
+static entity_data_t* remote_entity_find(connection_t* connection, int sequence);
+static entity_data_t* remote_entity_create(connection_t* connection, int sequence);
+static void remote_entity_remove(connection_t* connection, int index);
+static int connection_push_event(connection_t* connection, event_kind_t kind, int type, int entity_sequence, const void* data, int size);
+static void push_entity_event(net_t* net, event_kind_t kind, int index);
+static void connection_start_events(connection_t* connection);
+static void event_apply(connection_t* connection, const event_packet_header_t* header, const char* data);
+static void pending_spawn_push(connection_t* connection, int sequence);
+static bool pending_spawn_take(connection_t* connection, int sequence);
+static size_t packet_write_inputs(net_t* net, char* data, size_t capacity, int* count);
+static size_t packet_write_corrections(connection_t* connection, char* data, size_t capacity, int* count);
+static size_t packet_write_events(connection_t* connection, char* data, size_t capacity, int* count, int* last);
+static const char* packet_read_inputs(connection_t* connection, const char* data, const char* end, int count, bool apply);
+static const char* packet_read_corrections(connection_t* connection, const char* data, const char* end, int count, bool apply);
+static const char* packet_read_events(connection_t* connection, const char* data, const char* end, int count, bool apply);
+static void input_reconcile(net_t* net, const correction_packet_header_t* correction, const char* state);
+static void entity_encode(net_t* net, ecs_entity_ref_t ref, int type, char* data);
+static void entity_decode(net_t* net, ecs_entity_ref_t ref, int type, const char* data);
+static void entity_push_sample(connection_t* connection, entity_data_t* entity, uint32_t time_ms, bool changed);
+static void connection_interpolate(connection_t* connection);
+static int entity_get_values(net_t* net, const entity_data_t* entity, float* values);
+static void entity_set_values(net_t* net, const entity_data_t* entity, const float* a, const float* b, float t);
+static int interpolated_floats(const net_field_t* field);
+static uint32_t net_time_ms(net_t* net);
+static int component_bits(net_t* net, int component_type);
+static void component_write(net_t* net, bit_stream_t* stream, int component_type, const char* data);
+static void component_read(net_t* net, bit_stream_t* stream, int component_type, char* data);
+static uint32_t quantize(float value, float min, float max, int bits);
+static float dequantize(uint32_t value, float min, float max, int bits);
+static void packet_header_write(const packet_header_t* header, char* data);
+static void packet_header_read(connection_t* connection, int newest, const char* data, packet_header_t* header);
+static int sequence_widen(uint16_t sequence, int reference);
+static void bit_write(bit_stream_t* stream, uint32_t value, int bits);
+static void delta_write(bit_stream_t* stream, const char* data, const char* base, size_t size);
+static uint32_t bit_read(bit_stream_t* stream, int bits);
+static void varint_write(bit_stream_t* stream, uint32_t value);
+static uint32_t varint_read(bit_stream_t* stream);
+static int varint_bits(uint32_t value);
 
 net_t* net_create(heap_t* heap, ecs_t* ecs)
+{
+	net_options_t options = { 0 };
+	return net_create_with_options(heap, ecs, &options);
+}
+
+net_t* net_create_with_options(heap_t* heap, ecs_t* ecs, const net_options_t* options)
 {
 	net_t* net = heap_alloc(heap, sizeof(net_t), 8);
 	memset(net, 0, sizeof(net_t));
 	net->heap = heap;
 	net->ecs = ecs;
 
+	net->packets_per_update = options->packets_per_update ? options->packets_per_update : k_net_default_packets_per_update;
+	net->recv_queue_size = options->recv_queue_size ? options->recv_queue_size : k_net_default_recv_queue_size;
+	net->interpolation_delay_ms = options->interpolation_delay_ms ? options->interpolation_delay_ms : k_net_default_interpolation_delay_ms;
+	net->timer = options->timer;
+	net->authoritative = options->authoritative;
+	net->adapt_send_rate = options->adapt_send_rate;
+	net->tick_rate = options->tick_rate ? options->tick_rate : k_net_default_tick_rate;
+	net->tick_interval = timer_get_ticks_per_second() / net->tick_rate;
+	net->tick_accumulator = net->tick_interval; //send on the first update
+	net->tick_last = timer_get_ticks();
+	net->input_acked = -1;
+	net->max_connections = options->max_connections ? __min(options->max_connections, k_net_max_connections) : k_net_default_max_connections;
+	net->link = options->link;
+	net->link_conditioned = net->link.latency_ms || net->link.jitter_ms || net->link.loss_percent || net->link.bandwidth;
+	net->link_random = (uint32_t)timer_get_ticks() | 1;
+	net->offline = options->offline;
+	net->jobs = options->jobs;
+	if (options->compression_dictionary_size > 0)
+	{
+		//LZ4 refers back at most 64 KB, so only the end of a longer dictionary is kept
+		net->dictionary_size = __min(options->compression_dictionary_size, k_net_max_dictionary_size);
+		net->dictionary = heap_alloc(heap, net->dictionary_size, 8);
+		memcpy(net->dictionary, (const char*)options->compression_dictionary + options->compression_dictionary_size - net->dictionary_size, net->dictionary_size);
+		net->dictionary_stream = LZ4_initStream(heap_alloc(heap, sizeof(LZ4_stream_t), 8), sizeof(LZ4_stream_t));
+		LZ4_loadDict(net->dictionary_stream, net->dictionary, net->dictionary_size);
+	}
+	net->packet_callback = options->packet_callback;
+	net->packet_callback_data = options->packet_callback_data;
+	net->event_callback = options->event_callback;
+	net->event_callback_data = options->event_callback_data;
+	net->connections = heap_alloc(heap, sizeof(connection_t) * net->max_connections, 8);
+	memset(net->connections, 0, sizeof(connection_t) * net->max_connections);
+	for (int i = 0; i < net->max_connections; ++i)
+	{
+		//queues live as long as their slot, so the recv thread may still push into one whose connection just timed out
+		net->connections[i].recv_queue = spsc_queue_create(heap, net->recv_queue_size);
+		net->connections[i].outgoing = heap_alloc(heap, sizeof(outgoing_t) * net->packets_per_update, 8);
+		if (net->dictionary)
+		{
+			net->connections[i].lz4 = LZ4_initStream(heap_alloc(heap, sizeof(LZ4_stream_t), 8), sizeof(LZ4_stream_t));
+		}
+	}
+
 	WSADATA data;
 	WSAStartup(MAKEWORD(2, 2), &data);
 
-	net->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-	net->connections_mutex = mutex_create();
+	//connections are split evenly between shards, which take the ports after the first while they are free
+	net->shard_count = __min(__max(options->shard_count, 1), net->max_connections);
+	net->shards = heap_alloc(heap, sizeof(net_shard_t) * net->shard_count, 8);
+	memset(net->shards, 0, sizeof(net_shard_t) * net->shard_count);
+	int shard_connections = (net->max_connections + net->shard_count - 1) / net->shard_count;
+	uint16_t port = 0;
+	for (int i = 0; i < net->shard_count; ++i)
+	{
+		int first = i * shard_connections;
+		uint16_t bound = shard_create(net, &net->shards[i], first, __min(shard_connections, net->max_connections - first), port ? (uint16_t)(port + i) : 0);
+		port = i == 0 ? bound : port;
+	}
+	for (int i = 0; i < net->max_connections; ++i)
+	{
+		net->connections[i].shard = &net->shards[i / shard_connections];
+	}
 
-	struct sockaddr_in address;
-	address.sin_family = AF_INET;
-	address.sin_port = 0;
-	address.sin_addr.s_addr = htonl(INADDR_ANY);
-	bind(net->sock, (struct sockaddr*)&address, sizeof(address));
+	//each connection has a tick's packets queued to send and about as many received waiting for the game thread
+	int packet_count = __max(k_packet_pool_size, net->max_connections * net->packets_per_update * 2);
+	if (net->link_conditioned)
+	{
+		//and a tick's packets held by link conditioning for every tick of latency
+		int held_ticks = ((net->link.latency_ms + net->link.jitter_ms) * net->tick_rate + 999) / 1000;
+		packet_count += net->max_connections * net->packets_per_update * held_ticks;
+	}
+	net->packet_pool = object_pool_create(heap, sizeof(packet_t), 8, packet_count);
 
-	int address_len = sizeof(address);
-	getsockname(net->sock, (struct sockaddr*)&address, &address_len);
-	debug_print(k_print_info, "Net bound port %d\n", ntohs(address.sin_port));
+	if (net->link_conditioned)
+	{
+		debug_print(k_print_info, "Net link conditioned: %d ms latency, %d ms jitter, %d%% loss, %d B/s.\n",
+			net->link.latency_ms, net->link.jitter_ms, net->link.loss_percent, net->link.bandwidth);
+		net->link_held_capacity = packet_count;
+		net->link_held = heap_alloc(heap, sizeof(packet_t*) * packet_count, 8);
+	}
+	//every shard without registered I/O shares the one send thread
+	bool rio = !net->link_conditioned && !net->offline;
+	bool send_thread = false;
+	for (int i = 0; i < net->shard_count; ++i)
+	{
+		if (!rio || !rio_create(&net->shards[i]))
+		{
+			send_thread = true;
+		}
+	}
+	if (send_thread)
+	{
+		debug_print(k_print_info, "Net registered I/O unavailable, link conditioned or offline; using recvfrom and sendto.\n");
 
-	net->recv_thread = thread_create(recv_thread_func, net);
+		net->send_queue = spsc_queue_create(heap, packet_count);
+		thread_options_t send_options = { .name = "Net Send", .priority = k_thread_priority_high };
+		net->send_thread = thread_create_with_options(send_thread_func, net, &send_options);
+	}
+
+	//offline, the game thread injecting packets is the only producer into the receive queues
+	for (int i = 0; i < net->shard_count && !net->offline; ++i)
+	{
+		char name[32] = "Net Recv";
+		if (i)
+		{
+			snprintf(name, sizeof(name), "Net Recv %d", i);
+		}
+		thread_options_t thread_options = { .name = name, .priority = k_thread_priority_high };
+		net->shards[i].recv_thread = thread_create_with_options(recv_thread_func, &net->shards[i], &thread_options);
+	}
 
 	return net;
 }
@@ -142,55 +808,240 @@ net_t* net_create(heap_t* heap, ecs_t* ecs)
 void net_destroy(net_t* net)
 {
 	net_disconnect_all(net);
-	closesocket(net->sock);
-	thread_destroy(net->recv_thread);
+	if (net->send_thread)
+	{
+		atomic_store(&net->send_closing, 1);
+		spsc_queue_push(net->send_queue, NULL);
+		thread_destroy(net->send_thread);
+		spsc_queue_destroy(net->send_queue);
+	}
+	atomic_store(&net->rio_closing, 1);
+	for (int i = 0; i < net->shard_count; ++i)
+	{
+		shard_destroy(&net->shards[i]);
+	}
 	WSACleanup();
-	mutex_destroy(net->connections_mutex);
+	for (int i = 0; i < net->max_connections; ++i)
+	{
+		connection_clear(net, &net->connections[i]);
+		spsc_queue_destroy(net->connections[i].recv_queue);
+		heap_free(net->heap, net->connections[i].outgoing);
+		if (net->connections[i].lz4)
+		{
+			heap_free(net->heap, net->connections[i].lz4);
+		}
+	}
+	if (net->link_held)
+	{
+		heap_free(net->heap, net->link_held);
+	}
+	if (net->dictionary)
+	{
+		heap_free(net->heap, net->dictionary_stream);
+		heap_free(net->heap, net->dictionary);
+	}
+	heap_free(net->heap, net->shards);
+	heap_free(net->heap, net->connections);
+	object_pool_destroy(net->packet_pool);
 	heap_free(net->heap, net);
 }
 
 void net_update(net_t* net)
 {
+	TRACE_ZONE_BEGIN(k_trace_category_net, "net_update");
 	timeout_old_connections(net);
-	snapshot_entities(net);
-	for (int i = 0; i < _countof(net->connections); ++i)
+
+	//packets are received and remote entities interpolated every update, but only sent on ticks
+	bool tick = net_tick(net);
+	if (tick)
+	{
+		snapshot_entities(net);
+	}
+
+	//each connection's job builds its packets and decodes what it received, touching only the connection and
+	//reading the snapshot and entities; sends and everything that writes entities follow here in connection order
+	//connections the recv thread adds meanwhile wait for the next update
+	net_connection_stats_t totals = { 0 };
+	int connection_count = 0;
+	job_counter_t counter = { 0 };
+	for (int i = 0; i < net->max_connections; ++i)
 	{
 		connection_t* c = &net->connections[i];
 		if (c->address.port)
 		{
-			packet_send(c);
+			connection_update_stats(c, &totals);
+			c->send_pending = false;
+			if (tick)
+			{
+				connection_adapt_send_rate(c);
+				if (++c->ticks_since_send >= c->send_interval)
+				{
+					c->send_pending = true;
+					c->ticks_since_send = 0;
+				}
+			}
+			c->job_done = true;
+			if (net->jobs)
+			{
+				job_run(net->jobs, connection_job, c, &counter);
+			}
+			else
+			{
+				connection_job(c);
+			}
+			connection_count++;
+		}
+	}
+	if (net->jobs)
+	{
+		job_wait(net->jobs, &counter);
+	}
+	for (int i = 0; i < net->max_connections; ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (c->job_done)
+		{
+			c->job_done = false;
+			if (c->send_pending)
+			{
+				packet_send(c);
+			}
 			packet_recv(c);
+			connection_interpolate(c);
+		}
+	}
+	for (int i = 0; i < net->shard_count; ++i)
+	{
+		net_shard_t* shard = &net->shards[i];
+		if (shard->rio_send_pending)
+		{
+			net->rio.RIOSendEx(shard->rio_rq, NULL, 0, NULL, NULL, NULL, NULL, RIO_MSG_COMMIT_ONLY, NULL);
+			shard->rio_send_pending = 0;
+		}
+	}
+	if (tick)
+	{
+		net->sequence++;
+	}
+
+	//worst latency and loss of any connection, and bandwidth over them all
+	trace_t* trace = trace_get_default();
+	trace_counter(trace, "Net Connections", connection_count);
+	trace_counter(trace, "Net RTT (ms)", (int64_t)totals.rtt_ms);
+	trace_counter(trace, "Net Jitter (ms)", (int64_t)totals.jitter_ms);
+	trace_counter(trace, "Net Loss (%)", (int64_t)(totals.loss * 100.0f));
+	trace_counter(trace, "Net In (B/s)", (int64_t)totals.bytes_in_per_second);
+	trace_counter(trace, "Net Out (B/s)", (int64_t)totals.bytes_out_per_second);
+	trace_counter(trace, "Net Dropped Packets", atomic_load(&net->dropped_packets));
+	trace_counter(trace, "Net Recv Dropped Packets", totals.recv_dropped);
+	TRACE_ZONE_END(k_trace_category_net);
+}
+
+int net_get_connection_stats(net_t* net, net_connection_stats_t* stats, int max_count)
+{
+	int count = 0;
+	for (int s = 0; s < net->shard_count; ++s)
+	{
+		net_shard_t* shard = &net->shards[s];
+		lock_acquire(&shard->connections_lock);
+		for (int i = shard->first_connection; i < shard->first_connection + shard->connection_count && count < max_count; ++i)
+		{
+			connection_t* c = &net->connections[i];
+			if (c->address.port)
+			{
+				stats[count++] = (net_connection_stats_t)
+				{
+					.address = c->address,
+					.rtt_ms = c->rtt_ms,
+					.jitter_ms = c->jitter_ms,
+					.loss = c->loss,
+					.bytes_in_per_second = c->bytes_in_per_second,
+					.bytes_out_per_second = c->bytes_out_per_second,
+					.send_interval = c->send_interval,
+					.bytes_in = atomic_load64(&c->bytes_in),
+					.bytes_out = c->bytes_out,
+					.apply_ms = c->apply_ms,
+					.max_apply_ms = c->max_apply_ms,
+					.recv_dropped = atomic_load(&c->recv_dropped),
+				};
+			}
 		}
+		lock_release(&shard->connections_lock);
 	}
-	net->sequence++;
+	return count;
+}
+
+int net_get_tick(net_t* net)
+{
+	return net->sequence;
+}
+
+void net_get_loopback_address(net_t* net, net_address_t* address)
+{
+	net_get_shard_loopback_address(net, 0, address);
+}
+
+int net_get_shard_count(net_t* net)
+{
+	return net->shard_count;
+}
+
+void net_get_shard_loopback_address(net_t* net, int shard, net_address_t* address)
+{
+	struct sockaddr_in sockaddr;
+	int sockaddr_len = sizeof(sockaddr);
+	getsockname(net->shards[shard % net->shard_count].sock, (struct sockaddr*)&sockaddr, &sockaddr_len);
+
+	address->ip[0] = 127;
+	address->ip[1] = 0;
+	address->ip[2] = 0;
+	address->ip[3] = 1;
+	address->port = ntohs(sockaddr.sin_port);
 }
 
 void net_connect(net_t* net, const net_address_t* address)
 {
-	find_or_create_connection(net, address);
+	find_or_create_connection(shard_for_address(net, address), address);
 }
 
-void net_disconnect_all(net_t* net)
+void net_inject_packet(net_t* net, const net_address_t* address, const void* data, int size)
 {
-	mutex_lock(net->connections_mutex);
+	packet_t* packet = size > 0 && size <= k_net_mtu ? object_pool_try_alloc(net->packet_pool) : NULL;
+	if (!packet)
+	{
+		atomic_increment(&net->dropped_packets);
+		return;
+	}
+	memcpy(packet->data, data, size);
+	packet->size = size;
 
-	for (int i = 0; i < _countof(net->connections); ++i)
+	struct sockaddr_in sockaddr;
+	address_to_sockaddr(address, &sockaddr);
+	recv_packet(shard_for_address(net, address), packet, &sockaddr);
+}
+
+void net_disconnect_all(net_t* net)
+{
+	for (int s = 0; s < net->shard_count; ++s)
 	{
-		connection_t* c = &net->connections[i];
-		if (c->address.port)
+		net_shard_t* shard = &net->shards[s];
+		lock_acquire(&shard->connections_lock);
+
+		for (int i = 0; i <= shard->connection_table_mask; ++i)
 		{
-			queue_push(c->send_queue, NULL);
-			thread_destroy(c->send_thread);
-			queue_destroy(c->send_queue);
-			queue_destroy(c->recv_queue);
+			atomic_store64(&shard->connection_table[i], 0);
+		}
+		shard->connection_table_used = 0;
+		for (int i = shard->first_connection; i < shard->first_connection + shard->connection_count; ++i)
+		{
+			connection_clear(net, &net->connections[i]);
 		}
-	}
-	memset(net->connections, 0, sizeof(net->connections));
 
-	mutex_unlock(net->connections_mutex);
+		lock_release(&shard->connections_lock);
+	}
 }
 
-void net_state_register_entity_type(net_t* net, int type, uint64_t component_mask, uint64_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data)
+void net_state_register_entity_type(net_t* net, int type, ecs_mask_t component_mask, ecs_mask_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data)
 {
 	if (type < _countof(net->entity_types))
 	{
@@ -198,14 +1049,7 @@ void net_state_register_entity_type(net_t* net, int type, uint64_t component_mas
 		net->entity_types[type].replicated_component_mask = replicated_component_mask;
 		net->entity_types[type].configure_callback = configure_callback;
 		net->entity_types[type].configure_callback_data = configure_callback_data;
-		net->entity_types[type].replicated_size = 0;
-		for (int i = 0; i < sizeof(replicated_component_mask) * 8; ++i)
-		{
-			if (replicated_component_mask & (1ULL << i))
-			{
-				net->entity_types[type].replicated_size += ecs_get_component_type_size(net->ecs, i);
-			}
-		}
+		update_replicated_size(net, type);
 	}
 	else
 	{
@@ -213,20 +1057,124 @@ void net_state_register_entity_type(net_t* net, int type, uint64_t component_mas
 	}
 }
 
+void net_state_set_relevancy(net_t* net, const net_relevancy_t* relevancy)
+{
+	net->relevancy = *relevancy;
+	if (net->relevancy.radius > 0.0f && net->relevancy.cell_size <= 0.0f)
+	{
+		net->relevancy.cell_size = net->relevancy.radius;
+	}
+}
+
+void net_state_register_component_fields(net_t* net, int component_type, const net_field_t* fields, int field_count)
+{
+	if (component_type < 0 || component_type >= k_max_component_types || field_count > k_max_component_fields)
+	{
+		debug_print(k_print_warning, "Invalid replicated fields for component type: %d\n", component_type);
+		return;
+	}
+
+	memcpy(net->component_fields[component_type].fields, fields, sizeof(net_field_t) * field_count);
+	net->component_fields[component_type].count = field_count;
+
+	//entity types registered earlier may replicate this component
+	for (int i = 0; i < _countof(net->entity_types); ++i)
+	{
+		if (ecs_mask_test(net->entity_types[i].replicated_component_mask, component_type))
+		{
+			update_replicated_size(net, i);
+		}
+	}
+}
+
+void net_state_register_input(net_t* net, int type, int input_size, net_input_callback_t callback, void* callback_data)
+{
+	if (type < 0 || type >= k_max_entity_types || input_size <= 0 || input_size > k_net_max_input_size)
+	{
+		debug_print(k_print_warning, "Invalid input for entity type: %d\n", type);
+		return;
+	}
+
+	net->entity_types[type].input_callback = callback;
+	net->entity_types[type].input_callback_data = callback_data;
+	net->entity_types[type].input_size = input_size;
+}
+
+void net_input_push(net_t* net, ecs_entity_ref_t entity, const void* input)
+{
+	int type = -1;
+	for (int i = 0; i < net->entity_count; ++i)
+	{
+		if (net->entities[i].ref.sequence == entity.sequence && ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true))
+		{
+			type = net->entities[i].type;
+			break;
+		}
+	}
+	if (type < 0 || !net->entity_types[type].input_callback)
+	{
+		debug_print(k_print_warning, "Input pushed for an entity without registered input.\n");
+		return;
+	}
+
+	const entity_type_t* entity_type = &net->entity_types[type];
+	entity_type->input_callback(net->ecs, entity, input, entity_type->input_callback_data);
+	if (net->authoritative)
+	{
+		return;
+	}
+
+	input_record_t* record = &net->input_history[net->input_sequence % _countof(net->input_history)];
+	record->sequence = net->input_sequence++;
+	record->ref = entity;
+	record->type = type;
+	memcpy(record->input, input, entity_type->input_size);
+	record->has_state = entity_type->replicated_size <= sizeof(record->state);
+	if (record->has_state)
+	{
+		entity_encode(net, entity, type, record->state);
+	}
+}
+
 void net_state_register_entity_instance(net_t* net, int type, ecs_entity_ref_t entity)
 {
 	for (int i = 0; i < _countof(net->entities); ++i)
 	{
 		if (!ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true))
 		{
+			//removed since the last tick, so its despawn goes out before the slot is reused
+			if (net->entities[i].live)
+			{
+				push_entity_event(net, k_event_despawn, i);
+			}
 			net->entities[i].ref = entity;
 			net->entities[i].type = type;
+			net->entities[i].live = true;
+			net->entity_count = __max(net->entity_count, i + 1);
+			push_entity_event(net, k_event_spawn, i);
 			return;
 		}
 	}
 	debug_print(k_print_warning, "Out of space to register entity!\n");
 }
 
+void net_send_event(net_t* net, const void* data, int size)
+{
+	if (size < 0 || size > k_net_max_event_size)
+	{
+		debug_print(k_print_warning, "Event of %d bytes is too large to send!\n", size);
+		return;
+	}
+	for (int i = 0; i < net->max_connections; ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (c->address.port && c->events_started)
+		{
+			connection_push_event(c, k_event_user, 0, 0, data, size);
+		}
+	}
+}
+
 bool net_string_to_address(const char* str, net_address_t* address)
 {
 	char address_str[256];
@@ -269,71 +1217,285 @@ bool net_string_to_address(const char* str, net_address_t* address)
 	return false;
 }
 
+// Send packets for every connection until a NULL packet arrives.
+// Each packet carries its destination, so a connection can be torn down with packets in flight.
+// With link conditioning, packets are held until due and sent within a millisecond of it; any
+// still held when the net is destroyed are dropped.
 static int send_thread_func(void* user)
 {
-	connection_t* connection = user;
-
-	struct sockaddr_in address = { 0 };
-	address.sin_family = AF_INET;
-	address.sin_port = htons(connection->address.port);
-	address.sin_addr.S_un.S_un_b.s_b1 = connection->address.ip[0];
-	address.sin_addr.S_un.S_un_b.s_b2 = connection->address.ip[1];
-	address.sin_addr.S_un.S_un_b.s_b3 = connection->address.ip[2];
-	address.sin_addr.S_un.S_un_b.s_b4 = connection->address.ip[3];
+	net_t* net = user;
 
-	while (true)
+	bool running = true;
+	while (running)
 	{
-		packet_t* packet = queue_pop(connection->send_queue);
-		if (!packet)
+		void* packets[16];
+		int count = 0;
+		if (!net->link_held_count)
 		{
-			break;
+			count = spsc_queue_pop_n(net->send_queue, packets, _countof(packets));
 		}
-
-		int bytes = sendto(connection->net->sock,
-			packet->data, packet->size, 0,
-			(struct sockaddr*)&address, sizeof(address));
-
-		heap_free(connection->net->heap, packet);
-
-		if (bytes <= 0)
+		else if (atomic_load(&net->send_closing))
 		{
 			break;
 		}
-	}
+		else
+		{
+			//wake for the next packet due, or a millisecond on for packets pushed meanwhile
+			uint64_t now = timer_get_ticks();
+			uint64_t due = net->link_held[net->link_held_head]->ticks;
+			if (due > now)
+			{
+				thread_sleep_us(__min(timer_ticks_to_us(due - now), 1000));
+			}
+			packet_t* packet;
+			while (count < _countof(packets) && (packet = spsc_queue_try_pop(net->send_queue)) != NULL)
+			{
+				packets[count++] = packet;
+			}
+		}
 
-	return 0;
-}
+		for (int i = 0; i < count; ++i)
+		{
+			packet_t* packet = packets[i];
+			if (!packet)
+			{
+				running = false;
+				break;
+			}
+
+			if (net->link_conditioned)
+			{
+				link_hold(net, packet);
+			}
+			else
+			{
+				send_packet(net, packet);
+			}
+		}
+
+		uint64_t now = timer_get_ticks();
+		while (running && net->link_held_count && net->link_held[net->link_held_head]->ticks <= now)
+		{
+			send_packet(net, net->link_held[net->link_held_head]);
+			net->link_held_head = (net->link_held_head + 1) % net->link_held_capacity;
+			net->link_held_count--;
+		}
+	}
+
+	for (; net->link_held_count; net->link_held_count--)
+	{
+		object_pool_free(net->packet_pool, net->link_held[net->link_held_head]);
+		net->link_held_head = (net->link_held_head + 1) % net->link_held_capacity;
+	}
+
+	return 0;
+}
 
-static connection_t* find_or_create_connection(net_t* net, const net_address_t* address)
+// Send a packet from the send thread and return it to the pool.
+static void send_packet(net_t* net, packet_t* packet)
 {
-	connection_t* result = NULL;
+	int bytes = net->offline ? 0 : sendto(packet->sock,
+		packet->data, packet->size, 0,
+		(struct sockaddr*)&packet->address, sizeof(packet->address));
 
-	mutex_lock(net->connections_mutex);
+	object_pool_free(net->packet_pool, packet);
 
-	for (int i = 0; i < _countof(net->connections); ++i)
+	if (bytes > 0)
 	{
-		connection_t* c = &net->connections[i];
-		if (memcmp(&c->address, address, sizeof(net_address_t)) == 0)
+		frame_stats_add(frame_stats_get_default(), k_frame_stat_net_bytes_out, bytes);
+	}
+}
+
+// Hold a packet on the send thread until link conditioning says it is due, or drop it as lost.
+static void link_hold(net_t* net, packet_t* packet)
+{
+	const net_link_t* link = &net->link;
+	if (link->loss_percent && (int)(link_random(net) % 100) < link->loss_percent)
+	{
+		object_pool_free(net->packet_pool, packet);
+		return;
+	}
+
+	//under a bandwidth cap a packet leaves once the link has sent those before it; it then arrives after
+	//latency and jitter, but never before the packet ahead of it
+	uint64_t now = timer_get_ticks();
+	uint64_t ticks_per_second = timer_get_ticks_per_second();
+	uint64_t depart = now;
+	if (link->bandwidth)
+	{
+		depart = __max(net->link_free_ticks, now) + packet->size * ticks_per_second / link->bandwidth;
+		net->link_free_ticks = depart;
+	}
+	int delay_ms = link->latency_ms + (link->jitter_ms ? (int)(link_random(net) % (link->jitter_ms + 1)) : 0);
+	packet->ticks = __max(depart + delay_ms * ticks_per_second / 1000, net->link_due_ticks);
+	net->link_due_ticks = packet->ticks;
+
+	//the pool holds no more packets than the ring, so it never fills
+	net->link_held[(net->link_held_head + net->link_held_count) % net->link_held_capacity] = packet;
+	net->link_held_count++;
+}
+
+// Next of a xorshift sequence, for which packets link conditioning drops and how it jitters them.
+static uint32_t link_random(net_t* net)
+{
+	uint32_t x = net->link_random;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	net->link_random = x;
+	return x;
+}
+
+// Look up a connection by address without taking a lock.
+// May miss a connection being added or while the table is rebuilt; callers that create
+// connections look again under the lock.
+static connection_t* find_connection(net_shard_t* shard, const net_address_t* address)
+{
+	int64_t key = connection_key(address);
+	uint32_t index = (uint32_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> 32);
+	for (int probe = 0; probe <= shard->connection_table_mask; ++probe)
+	{
+		int64_t entry = atomic_load64(&shard->connection_table[(index + probe) & shard->connection_table_mask]);
+		if (!entry)
 		{
-			result = c;
 			break;
 		}
+		if (entry != k_connection_tombstone && (entry & ~0xffffll) == key)
+		{
+			return &shard->net->connections[entry & 0xffff];
+		}
+	}
+	return NULL;
+}
+
+// Pack an address into the high 48 bits of a table entry.
+// Ports are never zero, so neither is a key.
+static int64_t connection_key(const net_address_t* address)
+{
+	uint64_t ip = ((uint64_t)address->ip[0] << 24) | ((uint64_t)address->ip[1] << 16) | ((uint64_t)address->ip[2] << 8) | address->ip[3];
+	return (int64_t)((ip << 32) | ((uint64_t)address->port << 16));
+}
+
+// Add a connection's entry to the table. Connections lock must be held.
+static void connection_table_insert(net_shard_t* shard, int64_t key, int index)
+{
+	net_t* net = shard->net;
+	//rebuild before tombstones fill the table; concurrent lookups miss until it is repopulated
+	if ((shard->connection_table_used + 1) * 4 > (shard->connection_table_mask + 1) * 3)
+	{
+		for (int i = 0; i <= shard->connection_table_mask; ++i)
+		{
+			atomic_store64(&shard->connection_table[i], 0);
+		}
+		shard->connection_table_used = 0;
+		for (int i = shard->first_connection; i < shard->first_connection + shard->connection_count; ++i)
+		{
+			if (i != index && net->connections[i].address.port)
+			{
+				connection_table_insert(shard, connection_key(&net->connections[i].address), i);
+			}
+		}
+	}
+
+	uint32_t hash = (uint32_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> 32);
+	for (int probe = 0; probe <= shard->connection_table_mask; ++probe)
+	{
+		int64_t* entry = &shard->connection_table[(hash + probe) & shard->connection_table_mask];
+		if (!*entry)
+		{
+			shard->connection_table_used++;
+		}
+		if (!*entry || *entry == k_connection_tombstone)
+		{
+			atomic_store64(entry, key | index);
+			return;
+		}
+	}
+}
+
+// Replace a connection's entry with a tombstone, so probes for later entries still find them.
+// Connections lock must be held.
+static void connection_table_remove(net_shard_t* shard, const net_address_t* address)
+{
+	int64_t key = connection_key(address);
+	uint32_t hash = (uint32_t)(((uint64_t)key * 0x9e3779b97f4a7c15ull) >> 32);
+	for (int probe = 0; probe <= shard->connection_table_mask; ++probe)
+	{
+		int64_t* entry = &shard->connection_table[(hash + probe) & shard->connection_table_mask];
+		if (!*entry)
+		{
+			return;
+		}
+		if (*entry != k_connection_tombstone && (*entry & ~0xffffll) == key)
+		{
+			atomic_store64(entry, k_connection_tombstone);
+			return;
+		}
+	}
+}
+
+// Reset a connection slot to unused, keeping its recv queue.
+// Packets left in the queue are freed; only the game thread may call this.
+static void connection_clear(net_t* net, connection_t* connection)
+{
+	spsc_queue_t* recv_queue = connection->recv_queue;
+	outgoing_t* outgoing = connection->outgoing;
+	LZ4_stream_t* lz4 = connection->lz4;
+	net_shard_t* shard = connection->shard;
+	packet_t* packet;
+	while ((packet = spsc_queue_try_pop(recv_queue)) != NULL)
+	{
+		object_pool_free(net->packet_pool, packet);
+	}
+	memset(connection, 0, sizeof(*connection));
+	connection->recv_queue = recv_queue;
+	connection->outgoing = outgoing;
+	connection->lz4 = lz4;
+	connection->shard = shard;
+}
+
+static connection_t* find_or_create_connection(net_shard_t* shard, const net_address_t* address)
+{
+	net_t* net = shard->net;
+
+	//nearly every packet is from a known connection, so look it up without the lock first
+	connection_t* result = find_connection(shard, address);
+	if (result)
+	{
+		return result;
 	}
+
+	lock_acquire(&shard->connections_lock);
+
+	//another thread may have created it between the two locks
+	result = find_connection(shard, address);
 	if (!result)
 	{
-		for (int i = 0; i < _countof(net->connections); ++i)
+		for (int i = shard->first_connection; i < shard->first_connection + shard->connection_count; ++i)
 		{
 			connection_t* c = &net->connections[i];
 			if (c->address.port == 0)
 			{
-				memcpy(&c->address, address, sizeof(*address));
 				c->net = net;
 				c->incoming_sequence = -1;
 				c->ack_sequence = -1;
+				c->input_sequence = -1;
+				c->send_interval = 1;
+				for (int s = 0; s < _countof(c->recv_snapshots); ++s)
+				{
+					c->sent_snapshots[s].sequence = -1;
+					c->recv_snapshots[s].sequence = -1;
+				}
+				for (int e = 0; e < _countof(c->last_acked); ++e)
+				{
+					c->last_acked[e] = -1;
+					c->spawn_events[e] = -1;
+				}
+				c->event_acked = -1;
+				c->event_received = -1;
 				c->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
-				c->send_queue = queue_create(net->heap, 3);
-				c->recv_queue = queue_create(net->heap, 3);
-				c->send_thread = thread_create(send_thread_func, c);
+				memcpy(&c->address, address, sizeof(*address));
+				connection_table_insert(shard, connection_key(address), i);
 
 				result = c;
 				break;
@@ -341,283 +1503,2316 @@ static connection_t* find_or_create_connection(net_t* net, const net_address_t*
 		}
 	}
 
-	mutex_unlock(net->connections_mutex);
+	lock_release(&shard->connections_lock);
 
 	return result;
 }
 
+// Set up a shard of connections with a socket bound to port, or any port if it is taken or 0.
+// Returns the port bound. Registered I/O and the receive thread are started separately.
+static uint16_t shard_create(net_t* net, net_shard_t* shard, int first_connection, int connection_count, uint16_t port)
+{
+	shard->net = net;
+	shard->first_connection = first_connection;
+	shard->connection_count = connection_count;
+
+	//at least twice the connections, so probe chains stay short
+	int table_size = 16;
+	while (table_size < connection_count * 2)
+	{
+		table_size *= 2;
+	}
+	shard->connection_table = heap_alloc(net->heap, sizeof(int64_t) * table_size, 8);
+	memset(shard->connection_table, 0, sizeof(int64_t) * table_size);
+	shard->connection_table_mask = table_size - 1;
+	lock_init_named(&shard->connections_lock, "net connections");
+
+	//registered I/O needs a socket created for it; without it the socket is used with recvfrom and sendto
+	shard->sock = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+	if (shard->sock == INVALID_SOCKET)
+	{
+		shard->sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	}
+
+	struct sockaddr_in address;
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(shard->sock, (struct sockaddr*)&address, sizeof(address)) && port)
+	{
+		address.sin_port = 0;
+		bind(shard->sock, (struct sockaddr*)&address, sizeof(address));
+	}
+
+	int address_len = sizeof(address);
+	getsockname(shard->sock, (struct sockaddr*)&address, &address_len);
+	debug_print(k_print_info, "Net bound port %d\n", ntohs(address.sin_port));
+	return ntohs(address.sin_port);
+}
+
+// Close a shard's socket, stop its receive thread and free it. The net's rio_closing must be set.
+static void shard_destroy(net_shard_t* shard)
+{
+	closesocket(shard->sock);
+	if (shard->rio_recv_event)
+	{
+		SetEvent(shard->rio_recv_event);
+	}
+	if (shard->recv_thread)
+	{
+		thread_destroy(shard->recv_thread);
+	}
+	rio_destroy(shard);
+	heap_free(shard->net->heap, shard->connection_table);
+}
+
+// Shard a connection to address is made on when we connect to it, or an injected packet from it arrives on.
+// Hashed from the same key as the connection tables, but from its high bits, which the tables index by least.
+static net_shard_t* shard_for_address(net_t* net, const net_address_t* address)
+{
+	uint32_t hash = (uint32_t)(((uint64_t)connection_key(address) * 0x9e3779b97f4a7c15ull) >> 32);
+	return &net->shards[((uint64_t)hash * net->shard_count) >> 32];
+}
+
 static int recv_thread_func(void* user)
 {
-	net_t* net = user;
+	net_shard_t* shard = user;
+	net_t* net = shard->net;
+
+	if (shard->rio_rq)
+	{
+		rio_recv(shard);
+		return 0;
+	}
 
 	while (true)
 	{
-		packet_t* packet = heap_alloc(net->heap, sizeof(packet_t), 8);
+		//with the pool empty the datagram is still read, so the socket buffer drains, then dropped
+		char discard[k_net_mtu];
+		packet_t* packet = object_pool_try_alloc(net->packet_pool);
 
 		struct sockaddr_in address;
 		int address_len = sizeof(address);
-		int bytes = recvfrom(net->sock,
-			packet->data, sizeof(packet->data), 0,
+		int bytes = recvfrom(shard->sock,
+			packet ? packet->data : discard, k_net_mtu, 0,
 			(struct sockaddr*)&address, &address_len);
 		if (bytes <= 0)
 		{
-			heap_free(net->heap, packet);
+			if (packet)
+			{
+				object_pool_free(net->packet_pool, packet);
+			}
 			break;
 		}
-
-		packet->size = bytes;
-
-		net_address_t net_addr;
-		net_addr.port = ntohs(address.sin_port);
-		net_addr.ip[0] = address.sin_addr.S_un.S_un_b.s_b1;
-		net_addr.ip[1] = address.sin_addr.S_un.S_un_b.s_b2;
-		net_addr.ip[2] = address.sin_addr.S_un.S_un_b.s_b3;
-		net_addr.ip[3] = address.sin_addr.S_un.S_un_b.s_b4;
-
-		connection_t* connection = find_or_create_connection(net, &net_addr);
-		if (!connection)
+		if (!packet)
 		{
-			debug_print(k_print_info, "Too many connections!\n");
-			heap_free(net->heap, packet);
+			atomic_increment(&net->dropped_packets);
 			continue;
 		}
-		connection->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
 
-		queue_try_push(connection->recv_queue, packet);
+		packet->size = bytes;
+		recv_packet(shard, packet, &address);
 	}
 
 	return 0;
 }
 
-static void timeout_old_connections(net_t* net)
+// Receive with registered I/O until the socket closes.
+// Every receive slot stays posted; each wakeup dequeues all completed receives at once.
+static void rio_recv(net_shard_t* shard)
 {
-	mutex_lock(net->connections_mutex);
+	net_t* net = shard->net;
+	for (int i = 0; i < k_net_rio_recv_count; ++i)
+	{
+		rio_post_recv(shard, i);
+	}
 
-	uint32_t now = timer_ticks_to_ms(timer_get_ticks());
-	for (int i = 0; i < _countof(net->connections); ++i)
+	while (!atomic_load(&net->rio_closing))
 	{
-		connection_t* c = &net->connections[i];
-		if (c->address.port && c->last_recv_ms + k_timeout_ms < now)
+		RIORESULT results[k_net_rio_recv_count];
+		ULONG count = net->rio.RIODequeueCompletion(shard->rio_recv_cq, results, _countof(results));
+		if (count == RIO_CORRUPT_CQ)
 		{
-			debug_print(k_print_info, "Disconnecting old connection.\n");
-
-			queue_push(c->send_queue, NULL);
-			thread_destroy(c->send_thread);
-			queue_destroy(c->send_queue);
-			queue_destroy(c->recv_queue);
-			memset(c, 0, sizeof(*c));
+			break;
+		}
+		if (count == 0)
+		{
+			//notify signals the event at once if a receive completed since the dequeue
+			net->rio.RIONotify(shard->rio_recv_cq);
+			WaitForSingleObject(shard->rio_recv_event, INFINITE);
+			continue;
 		}
-	}
-
-	mutex_unlock(net->connections_mutex);
-}
-
-static void snapshot_entities(net_t* net)
-{
-	snapshot_t* snapshot = &net->snapshots[net->sequence % _countof(net->snapshots)];
-	snapshot->sequence = net->sequence;
 
-	char* cur = snapshot->data;
-	const char* end = &snapshot->data[_countof(snapshot->data)];
-	for (int i = 0; i < _countof(net->entities) && ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true); ++i)
-	{
-		int type = net->entities[i].type;
-		if (net->entity_types[type].replicated_size + sizeof(entity_packet_header_t) < (size_t)(end - cur))
+		TRACE_ZONE_BEGIN(k_trace_category_net, "Net Recv Batch");
+		for (ULONG i = 0; i < count; ++i)
 		{
-			entity_packet_header_t header =
+			int slot = (int)results[i].RequestContext;
+			if (results[i].Status || !results[i].BytesTransferred)
 			{
-				.type = type,
-				.sequence = net->entities[i].ref.sequence,
-			};
-			memcpy(cur, &header, sizeof(header));
-			cur += sizeof(header);
+				continue;
+			}
 
-			uint64_t mask = net->entity_types[type].replicated_component_mask;
-			for (int c = 0; c < sizeof(mask) * 8; ++c)
+			packet_t* packet = object_pool_try_alloc(net->packet_pool);
+			if (packet)
 			{
-				if (mask & (1ULL << c))
-				{
-					void* component_data = ecs_entity_get_component(net->ecs, net->entities[i].ref, c, true);
-					size_t component_size = ecs_get_component_type_size(net->ecs, c);
-					memcpy(cur, component_data, component_size);
-					cur += component_size;
-				}
+				packet->size = (int)results[i].BytesTransferred;
+				memcpy(packet->data, shard->rio_slots[slot].data, packet->size);
+				recv_packet(shard, packet, (struct sockaddr_in*)&shard->rio_slots[slot].address);
 			}
+			else
+			{
+				atomic_increment(&net->dropped_packets);
+			}
+			rio_post_recv(shard, slot);
 		}
+		TRACE_ZONE_END(k_trace_category_net);
 	}
-	snapshot->size = (int)(cur - snapshot->data);
 }
 
-static size_t packet_add_entities(connection_t* connection, char* packet, size_t packet_capacity)
+// Hand a received packet to its connection, creating one for a new address.
+static void recv_packet(net_shard_t* shard, packet_t* packet, const struct sockaddr_in* address)
 {
-	net_t* net = connection->net;
-
-	snapshot_t* cur_snapshot = &net->snapshots[net->sequence % _countof(net->snapshots)];
-	const char* cur_iter = cur_snapshot->data;
-	const char* cur_end = &cur_snapshot->data[cur_snapshot->size];
-
-	snapshot_t* ack_snapshot = &net->snapshots[connection->ack_sequence % _countof(net->snapshots)];
-	const char* ack_iter = ack_snapshot->data;
-	const char* ack_end = &ack_snapshot->data[ack_snapshot->size];
-	if (ack_snapshot->sequence != connection->ack_sequence)
+	net_t* net = shard->net;
+	packet->ticks = timer_get_ticks();
+	frame_stats_add(frame_stats_get_default(), k_frame_stat_net_bytes_in, packet->size);
+
+	net_address_t net_addr;
+	net_addr.port = ntohs(address->sin_port);
+	net_addr.ip[0] = address->sin_addr.S_un.S_un_b.s_b1;
+	net_addr.ip[1] = address->sin_addr.S_un.S_un_b.s_b2;
+	net_addr.ip[2] = address->sin_addr.S_un.S_un_b.s_b3;
+	net_addr.ip[3] = address->sin_addr.S_un.S_un_b.s_b4;
+
+	connection_t* connection = find_or_create_connection(shard, &net_addr);
+	if (!connection)
 	{
-		ack_iter = ack_end;
+		debug_print(k_print_info, "Too many connections!\n");
+		object_pool_free(net->packet_pool, packet);
+		return;
 	}
+	connection->last_recv_ms = timer_ticks_to_ms(timer_get_ticks());
+	atomic_fetch_add64(&connection->bytes_in, packet->size);
 
-	char* packet_iter = packet;
-
-	while (cur_iter < cur_end)
+	if (!spsc_queue_try_push(connection->recv_queue, packet))
 	{
-		entity_packet_header_t cur_header;
-		memcpy(&cur_header, cur_iter, sizeof(cur_header));
-
-		memcpy(packet_iter, cur_iter, sizeof(cur_header));
-		cur_iter += sizeof(cur_header);
-		packet_iter += sizeof(cur_header);
+		atomic_increment(&connection->recv_dropped);
+		object_pool_free(net->packet_pool, packet);
+	}
+}
 
-		size_t ent_size = net->entity_types[cur_header.type].replicated_size;
+static void timeout_old_connections(net_t* net)
+{
+	uint32_t now = timer_ticks_to_ms(timer_get_ticks());
+	for (int s = 0; s < net->shard_count; ++s)
+	{
+		net_shard_t* shard = &net->shards[s];
+		lock_acquire(&shard->connections_lock);
 
-		bool diff = true;
-		if (ack_iter < ack_end)
+		for (int i = shard->first_connection; i < shard->first_connection + shard->connection_count; ++i)
 		{
-			entity_packet_header_t ack_header;
-			memcpy(&ack_header, ack_iter, sizeof(ack_header));
-			if (ack_header.sequence == cur_header.sequence)
+			connection_t* c = &net->connections[i];
+			if (c->address.port && c->last_recv_ms + k_timeout_ms < now)
 			{
-				diff = memcmp(cur_iter, &ack_iter[sizeof(ack_header)], ent_size) != 0;
-				ack_iter += sizeof(ack_header) + ent_size;
+				debug_print(k_print_info, "Disconnecting old connection.\n");
+
+				connection_table_remove(shard, &c->address);
+				connection_clear(net, c);
 			}
 		}
 
-		*packet_iter++ = diff;
+		lock_release(&shard->connections_lock);
+	}
+}
 
-		if (diff)
+// Advance the tick clock by the time since the last update.
+// Returns true if a tick is due. Ticks missed by a slow update are dropped rather than sent in a burst.
+static bool net_tick(net_t* net)
+{
+	uint64_t now = timer_get_ticks();
+	net->tick_accumulator += now - net->tick_last;
+	net->tick_last = now;
+	if (net->tick_accumulator < net->tick_interval)
+	{
+		return false;
+	}
+	net->tick_accumulator = __min(net->tick_accumulator - net->tick_interval, net->tick_interval);
+	return true;
+}
+
+// Close a connection's bandwidth window if it has run its length, and fold its stats into totals:
+// the worst latency, jitter and loss, and the sum of bandwidth.
+static void connection_update_stats(connection_t* connection, net_connection_stats_t* totals)
+{
+	uint32_t now = timer_ticks_to_ms(timer_get_ticks());
+	uint32_t elapsed_ms = now - connection->window_start_ms;
+	if (elapsed_ms >= k_bandwidth_window_ms)
+	{
+		int64_t bytes_in = atomic_load64(&connection->bytes_in);
+		if (connection->window_start_ms)
 		{
-			memcpy(packet_iter, cur_iter, ent_size);
-			packet_iter += ent_size;
+			connection->bytes_in_per_second = (bytes_in - connection->window_bytes_in) * 1000.0f / elapsed_ms;
+			connection->bytes_out_per_second = (connection->bytes_out - connection->window_bytes_out) * 1000.0f / elapsed_ms;
 		}
-
-		cur_iter += ent_size;
+		connection->window_bytes_in = bytes_in;
+		connection->window_bytes_out = connection->bytes_out;
+		connection->window_start_ms = now;
 	}
 
-	return (size_t)(packet_iter - packet);
+	totals->rtt_ms = __max(totals->rtt_ms, connection->rtt_ms);
+	totals->jitter_ms = __max(totals->jitter_ms, connection->jitter_ms);
+	totals->loss = __max(totals->loss, connection->loss);
+	totals->bytes_in_per_second += connection->bytes_in_per_second;
+	totals->bytes_out_per_second += connection->bytes_out_per_second;
+	totals->recv_dropped += atomic_load(&connection->recv_dropped);
 }
 
-static void packet_send(connection_t* connection)
+// Halve how often we send to a congested connection, and double it again once it recovers.
+static void connection_adapt_send_rate(connection_t* connection)
 {
 	net_t* net = connection->net;
-
-	packet_t* packet = heap_alloc(net->heap, sizeof(packet_t), 8);
-
-	packet_header_t header =
+	if (!net->adapt_send_rate)
 	{
-		.sequence = net->sequence,
-		.ack_sequence = connection->incoming_sequence,
-	};
-	memcpy(packet->data, &header, sizeof(header));
-
-	packet->size = sizeof(header);
-	packet->size += (int)packet_add_entities(connection, &packet->data[packet->size], sizeof(packet->data) - packet->size);
+		return;
+	}
 
-	queue_push(connection->send_queue, packet);
+	bool congested = connection->rtt_ms > k_congested_rtt_ms || connection->loss * 100.0f > k_congested_loss_percent;
+	connection->ticks_since_adapt++;
+	if (congested)
+	{
+		connection->ticks_uncongested = 0;
+		if (connection->send_interval < k_max_send_interval && connection->ticks_since_adapt >= net->tick_rate)
+		{
+			connection->send_interval *= 2;
+			connection->ticks_since_adapt = 0;
+			debug_print(k_print_info, "Net connection congested; sending every %d ticks.\n", connection->send_interval);
+		}
+	}
+	else if (++connection->ticks_uncongested >= net->tick_rate * k_send_recovery_seconds && connection->send_interval > 1)
+	{
+		connection->send_interval /= 2;
+		connection->ticks_since_adapt = 0;
+		connection->ticks_uncongested = 0;
+	}
 }
 
-static void packet_read_entities(connection_t* connection, char* packet, size_t packet_size)
+static void snapshot_entities(net_t* net)
 {
-	net_t* net = connection->net;
-
-	const char* iter = packet;
-	const char* end = packet + packet_size;
-	while (iter < end)
+	world_snapshot_t* snapshot = &net->snapshot;
+	for (int i = 0; i < _countof(snapshot->grid_heads); ++i)
 	{
-		entity_packet_header_t header;
-		memcpy(&header, iter, sizeof(header));
-		iter += sizeof(header);
+		snapshot->grid_heads[i] = -1;
+	}
 
-		ecs_entity_ref_t ref = { .entity = -1 };
-		for (int i = 0; i < _countof(connection->entities); ++i)
+	char* cur = snapshot->data;
+	const char* end = &snapshot->data[_countof(snapshot->data)];
+	int count = 0;
+	memset(snapshot->deltas, 0, sizeof(snapshot->deltas));
+	snapshot->delta_size = 0;
+	snapshot->tick = ecs_get_tick(net->ecs);
+	for (int i = 0; i < net->entity_count; ++i)
+	{
+		int type = net->entities[i].type;
+		snapshot->offsets[i] = -1;
+		count = i + 1;
+		if (!ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true))
 		{
-			if (connection->entities[i].remote_sequence == header.sequence)
+			if (net->entities[i].live)
 			{
-				ref = connection->entities[i].ref;
-				connection->entities[i].last_recved_sequence = net->sequence;
-				break;
+				net->entities[i].live = false;
+				push_entity_event(net, k_event_despawn, i);
 			}
+			continue;
 		}
-
-		if (!ecs_is_entity_ref_valid(net->ecs, ref, true))
+		if (net->entity_types[type].replicated_size + sizeof(entity_packet_header_t) <= (size_t)(end - cur))
 		{
-			ref = ecs_entity_add(net->ecs, net->entity_types[header.type].component_mask);
-			void* configure_callback_data = net->entity_types[header.type].configure_callback_data;
-			net->entity_types[header.type].configure_callback(net->ecs, ref, header.type, configure_callback_data);
+			snapshot->offsets[i] = (int)(cur - snapshot->data);
 
-			for (int i = 0; i < _countof(connection->entities); ++i)
+			entity_packet_header_t header =
 			{
-				if (!ecs_is_entity_ref_valid(net->ecs, connection->entities[i].ref, true))
-				{
-					connection->entities[i].ref = ref;
-					connection->entities[i].remote_sequence = header.sequence;
-					connection->entities[i].type = header.type;
-					connection->entities[i].last_recved_sequence = net->sequence;
-					break;
-				}
-			}
-		}
+				.type = type,
+				.sequence = net->entities[i].ref.sequence,
+			};
+			memcpy(cur, &header, sizeof(header));
+			cur += sizeof(header);
 
-		bool diff = *iter++ != 0;
-		if (diff)
-		{
-			uint64_t mask = net->entity_types[header.type].replicated_component_mask;
-			for (int i = 0; i < sizeof(mask) * 8; ++i)
+			//encoded once here, so every connection diffs and sends the quantized values
+			size_t size = net->entity_types[type].replicated_size;
+			memset(cur, 0, size);
+			bit_stream_t stream = { .data = (uint8_t*)cur, .capacity = size * 8 };
+
+			uint32_t version = 0;
+			ecs_mask_t mask = net->entity_types[type].replicated_component_mask;
+			for (int c = ecs_mask_next(mask, 0); c >= 0; c = ecs_mask_next(mask, c + 1))
 			{
-				if (mask & (1ULL << i))
-				{
-					void* component_data = ecs_entity_get_component(net->ecs, ref, i, true);
-					size_t component_size = ecs_get_component_type_size(net->ecs, i);
-					memcpy(component_data, iter, component_size);
-					iter += component_size;
-				}
+				const char* component_data = ecs_entity_get_component(net->ecs, net->entities[i].ref, c, true);
+				component_write(net, &stream, c, component_data);
+				version = __max(version, ecs_entity_get_component_version(net->ecs, net->entities[i].ref, c));
 			}
-		}
-	}
+			cur += size;
+			snapshot->versions[i] = version;
 
-	// Remove entities that we didn't see in the snapshot!
-	for (int i = 0; i < _countof(connection->entities); ++i)
-	{
-		if (ecs_is_entity_ref_valid(net->ecs, connection->entities[i].ref, true))
-		{
-			if (connection->entities[i].last_recved_sequence != net->sequence)
+			snapshot->has_position[i] = net->relevancy.radius > 0.0f && entity_position(net, net->entities[i].ref, type, &snapshot->positions[i]);
+			if (snapshot->has_position[i])
 			{
-				ecs_entity_remove(net->ecs, connection->entities[i].ref, true);
+				float cell = net->relevancy.cell_size;
+				int bucket = relevancy_grid_bucket(
+					(int)floorf(snapshot->positions[i].x / cell),
+					(int)floorf(snapshot->positions[i].y / cell),
+					(int)floorf(snapshot->positions[i].z / cell));
+				snapshot->grid_next[i] = snapshot->grid_heads[bucket];
+				snapshot->grid_heads[bucket] = i;
 			}
 		}
 	}
+	snapshot->count = count;
+	snapshot->size = (int)(cur - snapshot->data);
 }
 
-static void packet_recv(connection_t* connection)
+// Write the relevant entities most worth sending that are not yet in this update's packets to the
+// connection, each encoded against the newest acked packet that carried it.
+// The highest priorities that fit are sent and reset, so distant and unchanged entities still take turns.
+// What is written is recorded in sent; more is set if relevant entities were left out.
+static size_t packet_add_entities(connection_t* connection, const float* relevance, snapshot_t* sent, char* packet, size_t packet_capacity, bool* more)
 {
 	net_t* net = connection->net;
-
-	while (true)
+	world_snapshot_t* world = &net->snapshot;
+
+	//cost each candidate against its baseline, then pick by priority
+	candidate_t candidates[k_max_entities];
+	entity_mode_t modes[k_max_entities];
+	int bits[k_max_entities];
+	int distances[k_max_entities];
+	size_t sizes[k_max_entities];
+	const char* base_data[k_max_entities];
+	uint32_t base_versions[k_max_entities];
+	int candidate_count = 0;
+
+	for (int i = 0; i < world->count; ++i)
 	{
-		packet_t* packet = queue_try_pop(connection->recv_queue);
-		if (!packet || !packet->size)
-		{
-			break;
-		}
-
-		packet_header_t header;
-		memcpy(&header, packet->data, sizeof(header));
-		if (header.sequence <= connection->incoming_sequence)
+		if (world->offsets[i] < 0 || relevance[i] <= 0.0f || connection->picked[i])
 		{
 			continue;
 		}
 
-		connection->incoming_sequence = header.sequence;
-		connection->ack_sequence = header.ack_sequence;
-
-		packet_read_entities(connection, &packet->data[sizeof(header)], packet->size - sizeof(header));
-
-		heap_free(net->heap, packet);
+		entity_packet_header_t header;
+		const char* data = &world->data[world->offsets[i]];
+		memcpy(&header, data, sizeof(header));
+		data += sizeof(header);
+		size_t ent_size = net->entity_types[header.type].replicated_size;
+		int ent_bits = net->entity_types[header.type].replicated_bits;
+		sizes[i] = ent_size;
+		int header_bits = k_entity_type_bits + varint_bits((uint32_t)header.sequence) + k_entity_mode_bits;
+
+		modes[i] = k_entity_mode_full;
+		bits[i] = header_bits + ent_bits;
+		uint32_t base_version = 0;
+		base_data[i] = entity_baseline(connection, i, header.sequence, &distances[i], &base_version);
+		base_versions[i] = base_version;
+		if (base_data[i])
+		{
+			// Only compare data for entities that were written since the acked packet,
+			// and only once per baseline state across connections.
+			// A baseline without a version may have missed writes, so it is always compared, and not cached.
+			int changed_bytes = 0;
+			if (!base_version)
+			{
+				changed_bytes = count_changed_bytes(data, base_data[i], ent_size);
+			}
+			else if (world->versions[i] != base_version)
+			{
+				delta_cache_t* delta = &world->deltas[i];
+				lock_acquire(&delta->lock);
+				if (!delta->valid || delta->base_version != base_version)
+				{
+					int changed = count_changed_bytes(data, base_data[i], ent_size);
+					delta->valid = true;
+					delta->base_version = base_version;
+					delta->changed_bytes = changed;
+					delta->offset = -1;
+				}
+				changed_bytes = delta->changed_bytes;
+				lock_release(&delta->lock);
+			}
+
+			//the connection holds an entity it acked the spawn of until the despawn, so one it has as is needs no resend
+			int spawn = connection->spawn_events[i];
+			if (!changed_bytes && spawn >= 0 && spawn <= connection->event_acked)
+			{
+				connection->priorities[i] = 0.0f;
+				continue;
+			}
+
+			if (!changed_bytes)
+			{
+				modes[i] = k_entity_mode_same;
+				bits[i] = header_bits + k_baseline_bits;
+			}
+			else if ((int)ent_size + changed_bytes * 8 + k_baseline_bits < ent_bits)
+			{
+				modes[i] = k_entity_mode_delta;
+				bits[i] = header_bits + k_baseline_bits + (int)ent_size + changed_bytes * 8;
+			}
+		}
+
+		candidates[candidate_count].index = i;
+		candidates[candidate_count].priority = connection->priorities[i];
+		++candidate_count;
+	}
+	qsort(candidates, candidate_count, sizeof(candidate_t), compare_candidates);
+
+	bool picked[k_max_entities] = { 0 };
+	int picked_count = 0;
+	size_t budget = packet_capacity * 8;
+	size_t sent_budget = sizeof(sent->data);
+	*more = false;
+	for (int c = 0; c < candidate_count; ++c)
+	{
+		int i = candidates[c].index;
+		size_t sent_size = sizeof(entity_packet_header_t) + sizes[i];
+		if ((size_t)bits[i] <= budget && sent_size <= sent_budget && picked_count < k_max_packet_entities)
+		{
+			picked[i] = true;
+			++picked_count;
+			budget -= bits[i];
+			sent_budget -= sent_size;
+			connection->priorities[i] = 0.0f;
+			connection->picked[i] = true;
+		}
+		else
+		{
+			*more = true;
+		}
+	}
+
+	//written in entity order, so equal selections give equal packets
+	bit_stream_t stream = { .data = (uint8_t*)packet, .capacity = packet_capacity * 8 };
+	char* sent_iter = sent->data;
+	int sent_count = 0;
+	for (int i = 0; i < world->count; ++i)
+	{
+		if (!picked[i])
+		{
+			continue;
+		}
+
+		entity_packet_header_t header;
+		const char* data = &world->data[world->offsets[i]];
+		memcpy(&header, data, sizeof(header));
+		size_t ent_size = net->entity_types[header.type].replicated_size;
+
+		memcpy(sent_iter, data, sizeof(header) + ent_size);
+		sent_iter += sizeof(header) + ent_size;
+		sent->indices[sent_count] = i;
+		sent->versions[sent_count] = world->versions[i];
+		++sent_count;
+		data += sizeof(header);
+
+		bit_write(&stream, header.type, k_entity_type_bits);
+		varint_write(&stream, (uint32_t)header.sequence);
+		bit_write(&stream, modes[i], k_entity_mode_bits);
+		if (modes[i] != k_entity_mode_full)
+		{
+			bit_write(&stream, distances[i], k_baseline_bits);
+		}
+
+		if (modes[i] == k_entity_mode_delta)
+		{
+			//encoded by the first connection to send this delta, then copied by the rest; an encoding, once
+			//written, never moves, so it is copied outside the lock even if the entry moves on to another baseline
+			delta_cache_t* cache = &world->deltas[i];
+			lock_acquire(&cache->lock);
+			bool cached = base_versions[i] && cache->valid && cache->base_version == base_versions[i];
+			if (cached && cache->offset < 0)
+			{
+				int reserve = (int)(ent_size * 9 / 8 + 1);
+				int offset = atomic_fetch_add(&world->delta_size, reserve);
+				if (offset + reserve <= (int)sizeof(world->delta_data))
+				{
+					bit_stream_t encoded = { .data = &world->delta_data[offset], .capacity = reserve * 8 };
+					delta_write(&encoded, data, base_data[i], ent_size);
+					cache->offset = offset;
+					cache->bits = (int)encoded.position;
+				}
+			}
+			int cache_offset = cached ? cache->offset : -1;
+			int cache_bits = cache->bits;
+			lock_release(&cache->lock);
+
+			if (cache_offset >= 0)
+			{
+				bit_stream_t encoded = { .data = &world->delta_data[cache_offset], .capacity = cache_bits };
+				for (int remaining = cache_bits; remaining > 0; remaining -= 32)
+				{
+					int chunk = __min(remaining, 32);
+					bit_write(&stream, bit_read(&encoded, chunk), chunk);
+				}
+			}
+			else
+			{
+				delta_write(&stream, data, base_data[i], ent_size);
+			}
+		}
+		else if (modes[i] == k_entity_mode_full)
+		{
+			bit_stream_t entity = { .data = (uint8_t*)data, .capacity = ent_size * 8 };
+			for (int remaining = net->entity_types[header.type].replicated_bits; remaining > 0; remaining -= 32)
+			{
+				int chunk = __min(remaining, 32);
+				bit_write(&stream, bit_read(&entity, chunk), chunk);
+			}
+		}
+	}
+	sent->size = (int)(sent_iter - sent->data);
+	sent->tick = world->tick;
+
+	return (stream.position + 7) / 8;
+}
+
+static int count_changed_bytes(const char* data, const char* base_data, size_t size)
+{
+	int changed = 0;
+	for (size_t b = 0; b < size; ++b)
+	{
+		changed += data[b] != base_data[b];
+	}
+	return changed;
+}
+
+// Find an entity's data in the newest packet carrying it that the connection acked.
+// Returns NULL if there is none recent enough for the connection to still have it.
+// Version is the newest write tick of the data, or 0 if it was written on the tick the packet's snapshot
+// was taken, when later writes on that tick would carry the same version.
+static const char* entity_baseline(connection_t* connection, int index, int entity_sequence, int* distance, uint32_t* version)
+{
+	int acked = connection->last_acked[index];
+	*distance = connection->send_sequence - acked;
+	if (acked < 0 || *distance >= k_recv_snapshots)
+	{
+		return NULL;
+	}
+
+	const snapshot_t* snapshot = &connection->sent_snapshots[acked % _countof(connection->sent_snapshots)];
+	int entry = 0;
+	const char* data = snapshot->sequence == acked ? snapshot_find(connection->net, snapshot, entity_sequence, &entry) : NULL;
+	if (data)
+	{
+		*version = snapshot->versions[entry] < snapshot->tick ? snapshot->versions[entry] : 0;
+	}
+	return data;
+}
+
+// Note which of our packets the other side has received, so later packets can encode against them.
+static void packet_process_acks(connection_t* connection, const packet_header_t* header)
+{
+	for (int i = 0; i <= 32; ++i)
+	{
+		int sequence = header->ack_sequence - i;
+		if (sequence < 0 || connection->send_sequence - sequence > k_recv_snapshots)
+		{
+			break;
+		}
+		if (i > 0 && !(header->ack_bits & (1u << (i - 1))))
+		{
+			continue;
+		}
+
+		snapshot_t* snapshot = &connection->sent_snapshots[sequence % _countof(connection->sent_snapshots)];
+		if (snapshot->sequence != sequence || snapshot->acked)
+		{
+			continue;
+		}
+		snapshot->acked = true;
+		connection->event_acked = __max(connection->event_acked, snapshot->event_last);
+		if (i == 0)
+		{
+			float rtt_ms = (float)(timer_ticks_to_ms(timer_get_ticks()) - snapshot->sent_ms);
+			connection->rtt_ms = connection->rtt_ms > 0.0f ? connection->rtt_ms + (rtt_ms - connection->rtt_ms) * 0.1f : rtt_ms;
+		}
+
+		//entries are counted by walking the data, so a snapshot needs no count of its own
+		const char* iter = snapshot->data;
+		const char* end = &snapshot->data[snapshot->size];
+		for (int e = 0; iter < end; ++e)
+		{
+			entity_packet_header_t entity;
+			memcpy(&entity, iter, sizeof(entity));
+			iter += sizeof(entity) + connection->net->entity_types[entity.type].replicated_size;
+
+			int index = snapshot->indices[e];
+			connection->last_acked[index] = __max(connection->last_acked[index], sequence);
+		}
+	}
+}
+
+// Rate how relevant each of our entities is to a connection, from 0 (not sent) to 1.
+// A connection's view is the positions of the focus entities it replicates to us; until it
+// sends any, or with relevancy off, everything is fully relevant.
+static void connection_relevance(connection_t* connection, float* relevance)
+{
+	net_t* net = connection->net;
+	world_snapshot_t* world = &net->snapshot;
+	const net_relevancy_t* relevancy = &net->relevancy;
+
+	vec3f_t focus[k_max_entities];
+	int focus_count = 0;
+	if (relevancy->radius > 0.0f)
+	{
+		for (int i = 0; i < _countof(connection->entities); ++i)
+		{
+			const entity_data_t* entity = &connection->entities[i];
+			if ((!relevancy->focus_entity_types || (relevancy->focus_entity_types & (1ULL << entity->type))) &&
+				ecs_is_entity_ref_valid(net->ecs, entity->ref, true) &&
+				entity_position(net, entity->ref, entity->type, &focus[focus_count]))
+			{
+				++focus_count;
+			}
+		}
+	}
+
+	for (int i = 0; i < world->count; ++i)
+	{
+		relevance[i] = (focus_count && world->has_position[i]) ? 0.0f : 1.0f;
+	}
+
+	float radius = relevancy->radius;
+	float cell = relevancy->cell_size;
+	for (int f = 0; f < focus_count; ++f)
+	{
+		int min_x = (int)floorf((focus[f].x - radius) / cell), max_x = (int)floorf((focus[f].x + radius) / cell);
+		int min_y = (int)floorf((focus[f].y - radius) / cell), max_y = (int)floorf((focus[f].y + radius) / cell);
+		int min_z = (int)floorf((focus[f].z - radius) / cell), max_z = (int)floorf((focus[f].z + radius) / cell);
+		for (int z = min_z; z <= max_z; ++z)
+		{
+			for (int y = min_y; y <= max_y; ++y)
+			{
+				for (int x = min_x; x <= max_x; ++x)
+				{
+					//buckets are shared by colliding cells, so every entity's distance is checked
+					for (int e = world->grid_heads[relevancy_grid_bucket(x, y, z)]; e >= 0; e = world->grid_next[e])
+					{
+						float distance2 = vec3f_dist2(world->positions[e], focus[f]);
+						if (distance2 < radius * radius)
+						{
+							//nearer entities build priority faster; the farthest still get a tenth
+							relevance[e] = __max(relevance[e], 1.0f - 0.9f * sqrtf(distance2) / radius);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// Read an entity's position for relevancy, if its type has the position component.
+static bool entity_position(net_t* net, ecs_entity_ref_t ref, int type, vec3f_t* position)
+{
+	int component_type = net->relevancy.position_component_type;
+	if (!ecs_mask_test(net->entity_types[type].component_mask, component_type))
+	{
+		return false;
+	}
+	const char* component = ecs_entity_get_component(net->ecs, ref, component_type, true);
+	memcpy(position, component + net->relevancy.position_offset, sizeof(*position));
+	return true;
+}
+
+static int relevancy_grid_bucket(int x, int y, int z)
+{
+	uint32_t hash = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+	return (int)(hash % k_relevancy_grid_buckets);
+}
+
+// Find an entity's encoded data in a snapshot by its sequence, or NULL.
+static const char* snapshot_find(net_t* net, const snapshot_t* snapshot, int sequence, int* index)
+{
+	const char* iter = snapshot->data;
+	const char* end = &snapshot->data[snapshot->size];
+	for (int i = 0; iter < end; ++i)
+	{
+		entity_packet_header_t header;
+		memcpy(&header, iter, sizeof(header));
+		iter += sizeof(header);
+		if (header.sequence == sequence)
+		{
+			*index = i;
+			return iter;
+		}
+		iter += net->entity_types[header.type].replicated_size;
+	}
+	return NULL;
+}
+
+static int compare_candidates(const void* a, const void* b)
+{
+	float x = ((const candidate_t*)a)->priority;
+	float y = ((const candidate_t*)b)->priority;
+	return (x < y) - (x > y);
+}
+
+// Send the connection this update's entities, in as many packets as they need up to the per-update limit.
+// Build and decode a connection's packets for net_update(), as a job or on the game thread.
+static void connection_job(void* data)
+{
+	connection_t* connection = data;
+	if (connection->send_pending)
+	{
+		packet_build(connection);
+	}
+	packet_decode(connection);
+}
+
+// Build this update's packets to a connection into its outgoing packets.
+static void packet_build(connection_t* connection)
+{
+	net_t* net = connection->net;
+	world_snapshot_t* world = &net->snapshot;
+
+	if (!connection->events_started)
+	{
+		connection_start_events(connection);
+	}
+
+	float relevance[k_max_entities];
+	connection_relevance(connection, relevance);
+	for (int i = 0; i < world->count; ++i)
+	{
+		connection->priorities[i] = relevance[i] > 0.0f ? connection->priorities[i] + relevance[i] : 0.0f;
+		connection->picked[i] = false;
+	}
+
+	//at least one packet goes out every update, carrying our acks even with nothing to send
+	bool more = true;
+	connection->outgoing_count = 0;
+	for (int p = 0; p < net->packets_per_update && more; ++p)
+	{
+		char* data = connection->outgoing[p].data;
+
+		int sequence = connection->send_sequence;
+		packet_header_t header =
+		{
+			.sequence = sequence,
+			.ack_sequence = connection->incoming_sequence,
+			.ack_bits = connection->incoming_bits,
+			.send_ms = net_time_ms(net),
+		};
+
+		//commands and corrections are resent every tick until superseded, so one packet carries them
+		char* payload = &data[k_packet_header_size];
+		size_t capacity = k_net_mtu - k_packet_header_size;
+		size_t blocks_size = 0;
+		int event_last = -1;
+		if (p == 0)
+		{
+			int input_count = 0;
+			int correction_count = 0;
+			int event_count = 0;
+			blocks_size = packet_write_inputs(net, payload, capacity, &input_count);
+			blocks_size += packet_write_corrections(connection, payload + blocks_size, capacity - blocks_size, &correction_count);
+			blocks_size += packet_write_events(connection, payload + blocks_size, capacity - blocks_size, &event_count, &event_last);
+			header.input_count = (uint16_t)input_count;
+			header.correction_count = (uint16_t)correction_count;
+			header.event_count = (uint16_t)event_count;
+		}
+
+		//a packet leaving the ack window unacked was lost
+		snapshot_t* sent = &connection->sent_snapshots[sequence % _countof(connection->sent_snapshots)];
+		if (sent->sequence >= 0)
+		{
+			connection->loss += ((sent->acked ? 0.0f : 1.0f) - connection->loss) * 0.1f;
+		}
+
+		int payload_size = (int)(blocks_size + packet_add_entities(connection, relevance, sent, payload + blocks_size, capacity - blocks_size, &more));
+		sent->sequence = sequence;
+		sent->acked = false;
+		sent->time_ms = header.send_ms;
+		sent->sent_ms = timer_ticks_to_ms(timer_get_ticks());
+		sent->event_last = event_last;
+		connection->send_sequence++;
+
+		//bit-packed deltas are dense, so keep the compressed form only when it is smaller
+		char compressed[LZ4_COMPRESSBOUND(k_net_mtu)];
+		int compressed_size;
+		if (connection->lz4)
+		{
+			//a payload alone is too small for LZ4 to find many matches in, but typical payloads before it have them
+			LZ4_resetStream_fast(connection->lz4);
+			LZ4_attach_dictionary(connection->lz4, net->dictionary_stream);
+			compressed_size = LZ4_compress_fast_continue(connection->lz4, payload, compressed, payload_size, sizeof(compressed), 1);
+		}
+		else
+		{
+			compressed_size = LZ4_compress_default(payload, compressed, payload_size, sizeof(compressed));
+		}
+		if (compressed_size > 0 && compressed_size < payload_size)
+		{
+			memcpy(payload, compressed, compressed_size);
+			payload_size = compressed_size;
+			header.flags |= k_packet_flag_compressed | (connection->lz4 ? k_packet_flag_dictionary : 0);
+		}
+
+		packet_header_write(&header, data);
+		int size = k_packet_header_size + payload_size;
+		connection->bytes_out += size;
+		connection->outgoing[p].size = size;
+		connection->outgoing_count++;
+	}
+}
+
+// Send the packets built for a connection this update, from registered send slots or pooled packets for the send thread.
+static void packet_send(connection_t* connection)
+{
+	net_t* net = connection->net;
+	for (int p = 0; p < connection->outgoing_count; ++p)
+	{
+		const outgoing_t* outgoing = &connection->outgoing[p];
+		if (connection->shard->rio_rq)
+		{
+			int slot = rio_acquire_send_slot(connection->shard);
+			if (slot >= 0)
+			{
+				memcpy(connection->shard->rio_slots[slot].data, outgoing->data, outgoing->size);
+				rio_send(connection, slot, outgoing->size);
+				continue;
+			}
+		}
+		else
+		{
+			packet_t* packet = object_pool_try_alloc(net->packet_pool);
+			if (packet)
+			{
+				memcpy(packet->data, outgoing->data, outgoing->size);
+				packet->size = outgoing->size;
+				address_to_sockaddr(&connection->address, &packet->address);
+				packet->sock = connection->shard->sock;
+				spsc_queue_push(net->send_queue, packet);
+				continue;
+			}
+		}
+
+		//the rest go unacked as if lost, and their entities build priority again to be resent
+		atomic_fetch_add(&net->dropped_packets, connection->outgoing_count - p);
+		break;
+	}
+	connection->outgoing_count = 0;
+}
+
+// Rebuild the encoded entities of a received packet into a snapshot, whose sequence is the packet's.
+// Returns false if the packet refers to baseline entities we do not have.
+static bool packet_read_snapshot(connection_t* connection, const char* packet, size_t packet_size, snapshot_t* snapshot)
+{
+	net_t* net = connection->net;
+
+	char* cur = snapshot->data;
+	const char* end = &snapshot->data[_countof(snapshot->data)];
+
+	bit_stream_t stream = { .data = (uint8_t*)packet, .capacity = packet_size * 8 };
+	while (stream.position + k_min_entity_header_bits <= stream.capacity)
+	{
+		entity_packet_header_t header;
+		header.type = (int)bit_read(&stream, k_entity_type_bits);
+		header.sequence = (int)varint_read(&stream);
+		entity_mode_t mode = (entity_mode_t)bit_read(&stream, k_entity_mode_bits);
+		if (!net->entity_types[header.type].configure_callback)
+		{
+			debug_print(k_print_warning, "Received unregistered entity type: %d\n", header.type);
+			return false;
+		}
+
+		size_t ent_size = net->entity_types[header.type].replicated_size;
+		if (ent_size + sizeof(header) > (size_t)(end - cur))
+		{
+			return false;
+		}
+
+		const char* base_data = NULL;
+		if (mode != k_entity_mode_full)
+		{
+			int base_sequence = snapshot->sequence - (int)bit_read(&stream, k_baseline_bits);
+			const snapshot_t* baseline = &connection->recv_snapshots[(base_sequence & 0x7fffffff) % _countof(connection->recv_snapshots)];
+			int base_index = 0;
+			if (base_sequence >= 0 && baseline->sequence == base_sequence && baseline != snapshot)
+			{
+				base_data = snapshot_find(net, baseline, header.sequence, &base_index);
+			}
+		}
+		if (mode != k_entity_mode_full && !base_data)
+		{
+			return false;
+		}
+
+		memcpy(cur, &header, sizeof(header));
+		cur += sizeof(header);
+
+		switch (mode)
+		{
+		case k_entity_mode_same:
+			memcpy(cur, base_data, ent_size);
+			break;
+		case k_entity_mode_delta:
+			for (size_t b = 0; b < ent_size; ++b)
+			{
+				cur[b] = base_data[b];
+				if (bit_read(&stream, 1))
+				{
+					cur[b] ^= (char)bit_read(&stream, 8);
+				}
+			}
+			break;
+		default:
+		{
+			memset(cur, 0, ent_size);
+			bit_stream_t entity = { .data = (uint8_t*)cur, .capacity = ent_size * 8 };
+			for (int bits = net->entity_types[header.type].replicated_bits; bits > 0; bits -= 32)
+			{
+				int chunk = __min(bits, 32);
+				bit_write(&entity, bit_read(&stream, chunk), chunk);
+			}
+			break;
+		}
+		}
+		cur += ent_size;
+
+		if (stream.overflow)
+		{
+			return false;
+		}
+	}
+
+	snapshot->size = (int)(cur - snapshot->data);
+	return true;
+}
+
+// Update entities from a received snapshot, creating any we have not seen.
+// Components are only decoded if their data differs from what was last decoded into the entity.
+static void packet_apply_snapshot(connection_t* connection, const snapshot_t* snapshot)
+{
+	net_t* net = connection->net;
+
+	const char* iter = snapshot->data;
+	const char* end = &snapshot->data[snapshot->size];
+	while (iter < end)
+	{
+		entity_packet_header_t header;
+		memcpy(&header, iter, sizeof(header));
+		iter += sizeof(header);
+
+		size_t ent_size = net->entity_types[header.type].replicated_size;
+		const char* data = iter;
+		iter += ent_size;
+
+		entity_data_t* entity = remote_entity_find(connection, header.sequence);
+
+		//an authoritative peer simulates entities driven by commands itself, so their state is only taken when created
+		bool controlled = net->authoritative && net->entity_types[header.type].input_callback;
+
+		bool diff = true;
+		if (!entity)
+		{
+			entity = remote_entity_create(connection, header.sequence);
+			if (!entity)
+			{
+				debug_print(k_print_warning, "Out of space for remote entities!\n");
+				continue;
+			}
+
+			entity->ref = ecs_entity_add(net->ecs, net->entity_types[header.type].component_mask);
+			connection->interpolation[entity - connection->entities].count = 0;
+			entity->type = header.type;
+			entity->spawned = pending_spawn_take(connection, header.sequence);
+			void* configure_callback_data = net->entity_types[header.type].configure_callback_data;
+			net->entity_types[header.type].configure_callback(net->ecs, entity->ref, header.type, configure_callback_data);
+		}
+		else
+		{
+			//packets are slices sent in any order of entities, so compare with what we last decoded
+			diff = !controlled && XXH32(data, ent_size, 0) != entity->data_hash;
+		}
+		entity->last_recved_sequence = net->sequence;
+
+		if (diff)
+		{
+			entity->data_hash = XXH32(data, ent_size, 0);
+			entity_decode(net, entity->ref, header.type, data);
+		}
+		if (!controlled)
+		{
+			entity_push_sample(connection, entity, snapshot->time_ms, diff);
+		}
+	}
+
+	// Remove entities that we haven't seen in a while, unless they wait on a despawn!
+	for (int i = 0; i < _countof(connection->entities); ++i)
+	{
+		if (!connection->entities[i].spawned && ecs_is_entity_ref_valid(net->ecs, connection->entities[i].ref, true))
+		{
+			if (net->sequence - connection->entities[i].last_recved_sequence > k_entity_timeout_sequences)
+			{
+				ecs_entity_remove(net->ecs, connection->entities[i].ref, true);
+			}
+		}
+	}
+}
+
+// Home slot of a remote entity sequence in a connection's remote slots.
+static uint32_t remote_entity_home(int sequence)
+{
+	return ((uint32_t)sequence * 0x9e3779b9u) >> (32 - k_remote_entity_slot_bits);
+}
+
+// Find a connection's live remote entity by its sender's sequence, or NULL.
+// Slots of removed entities stay until reused; probes pass over them.
+static entity_data_t* remote_entity_find(connection_t* connection, int sequence)
+{
+	for (uint32_t i = remote_entity_home(sequence);; i = (i + 1) & (k_remote_entity_slots - 1))
+	{
+		int slot = connection->remote_slots[i];
+		if (!slot)
+		{
+			return NULL;
+		}
+		entity_data_t* entity = &connection->entities[slot - 1];
+		if (entity->remote_sequence == sequence && ecs_is_entity_ref_valid(connection->net->ecs, entity->ref, true))
+		{
+			return entity;
+		}
+	}
+}
+
+// Claim an unused slot of a connection's entities for a remote entity sequence, or return NULL if there is none.
+static entity_data_t* remote_entity_create(connection_t* connection, int sequence)
+{
+	//searching on from the last slot claimed finds a free one at once while slots are claimed in turn
+	for (int n = 0; n < _countof(connection->entities); ++n)
+	{
+		int index = (connection->remote_search + n) % _countof(connection->entities);
+		entity_data_t* entity = &connection->entities[index];
+		if (!ecs_is_entity_ref_valid(connection->net->ecs, entity->ref, true))
+		{
+			connection->remote_search = index + 1;
+			remote_entity_remove(connection, index);
+			entity->remote_sequence = sequence;
+			uint32_t i = remote_entity_home(sequence);
+			while (connection->remote_slots[i])
+			{
+				i = (i + 1) & (k_remote_entity_slots - 1);
+			}
+			connection->remote_slots[i] = (uint16_t)(index + 1);
+			return entity;
+		}
+	}
+	return NULL;
+}
+
+// Take a slot of a connection's entities out of its remote slots, if it is in them.
+static void remote_entity_remove(connection_t* connection, int index)
+{
+	uint32_t mask = k_remote_entity_slots - 1;
+	uint32_t hole = remote_entity_home(connection->entities[index].remote_sequence);
+	while (connection->remote_slots[hole] != index + 1)
+	{
+		if (!connection->remote_slots[hole])
+		{
+			return;
+		}
+		hole = (hole + 1) & mask;
+	}
+
+	// Shift later entries of the probe run back into the hole, so probes never stop short of them.
+	// Lookups only happen on the game thread, so no tombstones are needed as in the connection table.
+	for (uint32_t i = (hole + 1) & mask; connection->remote_slots[i]; i = (i + 1) & mask)
+	{
+		uint32_t home = remote_entity_home(connection->entities[connection->remote_slots[i] - 1].remote_sequence);
+		//an entry can move back only if its home is not cyclically after the hole
+		if (((i - home) & mask) >= ((i - hole) & mask))
+		{
+			connection->remote_slots[hole] = connection->remote_slots[i];
+			hole = i;
+		}
+	}
+	connection->remote_slots[hole] = 0;
+}
+
+// Queue a reliable event to a connection, returning its sequence, or -1 if the connection has too many unacked.
+static int connection_push_event(connection_t* connection, event_kind_t kind, int type, int entity_sequence, const void* data, int size)
+{
+	if (connection->event_sequence - connection->event_acked > k_connection_events)
+	{
+		debug_print(k_print_warning, "Out of space for reliable events!\n");
+		return -1;
+	}
+
+	event_t* event = &connection->events[connection->event_sequence % _countof(connection->events)];
+	event->header.sequence = connection->event_sequence;
+	event->header.entity_sequence = entity_sequence;
+	event->header.kind = (uint8_t)kind;
+	event->header.type = (uint8_t)type;
+	event->header.size = (uint16_t)size;
+	if (size)
+	{
+		memcpy(event->data, data, size);
+	}
+	return connection->event_sequence++;
+}
+
+// Queue the spawn or despawn of one of our entities to every connection that has started its events.
+static void push_entity_event(net_t* net, event_kind_t kind, int index)
+{
+	const entity_data_t* entity = &net->entities[index];
+	for (int i = 0; i < net->max_connections; ++i)
+	{
+		connection_t* c = &net->connections[i];
+		if (c->address.port && c->events_started)
+		{
+			int sequence = connection_push_event(c, kind, entity->type, entity->ref.sequence, NULL, 0);
+			c->spawn_events[index] = kind == k_event_spawn ? sequence : -1;
+		}
+	}
+}
+
+// Queue a spawn of each of our entities to a connection, before its first packet.
+// Events pushed until then are left to this, as the recv thread may still be starting the connection.
+static void connection_start_events(connection_t* connection)
+{
+	net_t* net = connection->net;
+	connection->events_started = true;
+	for (int i = 0; i < net->entity_count; ++i)
+	{
+		if (net->entities[i].live)
+		{
+			connection->spawn_events[i] = connection_push_event(connection, k_event_spawn, net->entities[i].type, net->entities[i].ref.sequence, NULL, 0);
+		}
+	}
+}
+
+// Remember a remote entity spawned before its first state arrived, forgetting the oldest if full.
+static void pending_spawn_push(connection_t* connection, int sequence)
+{
+	connection->pending_spawns[connection->pending_spawn_next] = sequence + 1;
+	connection->pending_spawn_next = (connection->pending_spawn_next + 1) % _countof(connection->pending_spawns);
+}
+
+// Forget a remote entity spawned before its first state, returning whether it was.
+static bool pending_spawn_take(connection_t* connection, int sequence)
+{
+	for (int i = 0; i < _countof(connection->pending_spawns); ++i)
+	{
+		if (connection->pending_spawns[i] == sequence + 1)
+		{
+			connection->pending_spawns[i] = 0;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Write the input commands of ours no authoritative peer has simulated yet, oldest first.
+// Returns the bytes written.
+static size_t packet_write_inputs(net_t* net, char* data, size_t capacity, int* count)
+{
+	char* cur = data;
+	int first = __max(net->input_acked + 1, net->input_sequence - (int)_countof(net->input_history));
+	for (int sequence = first; sequence < net->input_sequence && *count < k_max_packet_inputs; ++sequence)
+	{
+		const input_record_t* record = &net->input_history[sequence % _countof(net->input_history)];
+		size_t size = net->entity_types[record->type].input_size;
+		if (record->sequence != sequence || !ecs_is_entity_ref_valid(net->ecs, record->ref, true))
+		{
+			continue;
+		}
+		if (sizeof(input_packet_header_t) + size > capacity - (size_t)(cur - data))
+		{
+			break;
+		}
+
+		input_packet_header_t header =
+		{
+			.entity_sequence = record->ref.sequence,
+			.type = record->type,
+			.sequence = sequence,
+		};
+		memcpy(cur, &header, sizeof(header));
+		memcpy(cur + sizeof(header), record->input, size);
+		cur += sizeof(header) + size;
+		(*count)++;
+	}
+	return cur - data;
+}
+
+// Write the state of each entity a connection drives with commands, if we have simulated any.
+// Returns the bytes written.
+static size_t packet_write_corrections(connection_t* connection, char* data, size_t capacity, int* count)
+{
+	net_t* net = connection->net;
+	if (!net->authoritative || connection->input_sequence < 0)
+	{
+		return 0;
+	}
+
+	char* cur = data;
+	for (int i = 0; i < _countof(connection->entities) && *count < k_max_packet_corrections; ++i)
+	{
+		const entity_data_t* entity = &connection->entities[i];
+		if (!net->entity_types[entity->type].input_callback || !ecs_is_entity_ref_valid(net->ecs, entity->ref, true))
+		{
+			continue;
+		}
+		size_t size = net->entity_types[entity->type].replicated_size;
+		if (sizeof(correction_packet_header_t) + size > capacity - (size_t)(cur - data))
+		{
+			break;
+		}
+
+		correction_packet_header_t header =
+		{
+			.entity_sequence = entity->remote_sequence,
+			.type = entity->type,
+			.input_sequence = connection->input_sequence,
+		};
+		memcpy(cur, &header, sizeof(header));
+		entity_encode(net, entity->ref, entity->type, cur + sizeof(header));
+		cur += sizeof(header) + size;
+		(*count)++;
+	}
+	return cur - data;
+}
+
+// Write the events queued to a connection it has not acked, oldest first, with last the newest written, or -1.
+// Returns the bytes written.
+static size_t packet_write_events(connection_t* connection, char* data, size_t capacity, int* count, int* last)
+{
+	char* cur = data;
+	*last = -1;
+	for (int sequence = connection->event_acked + 1; sequence < connection->event_sequence && *count < k_max_packet_events; ++sequence)
+	{
+		const event_t* event = &connection->events[sequence % _countof(connection->events)];
+		if (sizeof(event->header) + event->header.size > capacity - (size_t)(cur - data))
+		{
+			break;
+		}
+
+		memcpy(cur, &event->header, sizeof(event->header));
+		memcpy(cur + sizeof(event->header), event->data, event->header.size);
+		cur += sizeof(event->header) + event->header.size;
+		*last = sequence;
+		(*count)++;
+	}
+	return cur - data;
+}
+
+// Simulate the input commands in a packet we have not yet, if we are authoritative and apply is set.
+// Returns the data after the commands, or NULL if they are malformed.
+static const char* packet_read_inputs(connection_t* connection, const char* data, const char* end, int count, bool apply)
+{
+	net_t* net = connection->net;
+	for (int c = 0; c < count; ++c)
+	{
+		input_packet_header_t header;
+		if (sizeof(header) > (size_t)(end - data))
+		{
+			return NULL;
+		}
+		memcpy(&header, data, sizeof(header));
+		if (header.type < 0 || header.type >= k_max_entity_types || !net->entity_types[header.type].input_callback)
+		{
+			return NULL;
+		}
+		const entity_type_t* type = &net->entity_types[header.type];
+		const char* input = data + sizeof(header);
+		if ((size_t)type->input_size > (size_t)(end - input))
+		{
+			return NULL;
+		}
+		data = input + type->input_size;
+
+		if (!apply || !net->authoritative || header.sequence <= connection->input_sequence)
+		{
+			continue;
+		}
+		//commands lost beyond the resend window are skipped; the correction brings the sender back in line
+		connection->input_sequence = header.sequence;
+		entity_data_t* entity = remote_entity_find(connection, header.entity_sequence);
+		if (entity && entity->type == header.type)
+		{
+			type->input_callback(net->ecs, entity->ref, input, type->input_callback_data);
+		}
+	}
+	return data;
+}
+
+// Reconcile our entities with the corrections in a packet, if apply is set.
+// Returns the data after the corrections, or NULL if they are malformed.
+static const char* packet_read_corrections(connection_t* connection, const char* data, const char* end, int count, bool apply)
+{
+	net_t* net = connection->net;
+	for (int c = 0; c < count; ++c)
+	{
+		correction_packet_header_t header;
+		if (sizeof(header) > (size_t)(end - data))
+		{
+			return NULL;
+		}
+		memcpy(&header, data, sizeof(header));
+		if (header.type < 0 || header.type >= k_max_entity_types || !net->entity_types[header.type].input_callback)
+		{
+			return NULL;
+		}
+		const char* state = data + sizeof(header);
+		if (net->entity_types[header.type].replicated_size > (size_t)(end - state))
+		{
+			return NULL;
+		}
+		data = state + net->entity_types[header.type].replicated_size;
+
+		if (apply && !net->authoritative)
+		{
+			input_reconcile(net, &header, state);
+		}
+	}
+	return data;
+}
+
+// Apply the events in a packet we have not yet, in order, if apply is set.
+// Returns the data after the events, or NULL if they are malformed.
+static const char* packet_read_events(connection_t* connection, const char* data, const char* end, int count, bool apply)
+{
+	for (int e = 0; e < count; ++e)
+	{
+		event_packet_header_t header;
+		if (sizeof(header) > (size_t)(end - data))
+		{
+			return NULL;
+		}
+		memcpy(&header, data, sizeof(header));
+		const char* event_data = data + sizeof(header);
+		if (header.kind > k_event_user || header.type >= k_max_entity_types || header.size > k_net_max_event_size ||
+			header.size > (size_t)(end - event_data))
+		{
+			return NULL;
+		}
+		data = event_data + header.size;
+
+		//every packet carries the events not acked when it was sent, so only those newer than the last applied are new
+		if (apply && header.sequence > connection->event_received)
+		{
+			connection->event_received = header.sequence;
+			event_apply(connection, &header, event_data);
+		}
+	}
+	return data;
+}
+
+// Apply a reliable event from a connection.
+static void event_apply(connection_t* connection, const event_packet_header_t* header, const char* data)
+{
+	net_t* net = connection->net;
+	if (header->kind == k_event_user)
+	{
+		if (net->event_callback)
+		{
+			net->event_callback(&connection->address, data, header->size, net->event_callback_data);
+		}
+		return;
+	}
+
+	entity_data_t* entity = remote_entity_find(connection, header->entity_sequence);
+	if (header->kind == k_event_spawn)
+	{
+		if (entity)
+		{
+			entity->spawned = true;
+		}
+		else
+		{
+			pending_spawn_push(connection, header->entity_sequence);
+		}
+	}
+	else
+	{
+		pending_spawn_take(connection, header->entity_sequence);
+		if (entity)
+		{
+			ecs_entity_remove(net->ecs, entity->ref, true);
+		}
+	}
+}
+
+// Move one of our entities to an authoritative state and replay the commands simulated after it.
+// Nothing changes if the state matches what we predicted for the same command.
+static void input_reconcile(net_t* net, const correction_packet_header_t* correction, const char* state)
+{
+	if (correction->input_sequence < net->input_acked || correction->input_sequence >= net->input_sequence)
+	{
+		return;
+	}
+	net->input_acked = correction->input_sequence;
+
+	ecs_entity_ref_t ref = { 0 };
+	bool found = false;
+	for (int i = 0; i < net->entity_count; ++i)
+	{
+		if (net->entities[i].ref.sequence == correction->entity_sequence && net->entities[i].type == correction->type &&
+			ecs_is_entity_ref_valid(net->ecs, net->entities[i].ref, true))
+		{
+			ref = net->entities[i].ref;
+			found = true;
+			break;
+		}
+	}
+	if (!found)
+	{
+		return;
+	}
+
+	const entity_type_t* type = &net->entity_types[correction->type];
+	const input_record_t* acked = &net->input_history[correction->input_sequence % _countof(net->input_history)];
+	if (acked->sequence == correction->input_sequence && acked->has_state && acked->ref.sequence == ref.sequence &&
+		memcmp(acked->state, state, type->replicated_size) == 0)
+	{
+		return;
+	}
+
+	entity_decode(net, ref, correction->type, state);
+	for (int sequence = correction->input_sequence + 1; sequence < net->input_sequence; ++sequence)
+	{
+		input_record_t* record = &net->input_history[sequence % _countof(net->input_history)];
+		if (record->sequence != sequence || record->ref.sequence != ref.sequence)
+		{
+			continue;
+		}
+		type->input_callback(net->ecs, ref, record->input, type->input_callback_data);
+		if (record->has_state)
+		{
+			entity_encode(net, ref, correction->type, record->state);
+		}
+	}
+}
+
+// Encode an entity's replicated components to its type's replicated_size bytes.
+static void entity_encode(net_t* net, ecs_entity_ref_t ref, int type, char* data)
+{
+	size_t size = net->entity_types[type].replicated_size;
+	memset(data, 0, size);
+	bit_stream_t stream = { .data = (uint8_t*)data, .capacity = size * 8 };
+	ecs_mask_t mask = net->entity_types[type].replicated_component_mask;
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		const char* component_data = ecs_entity_get_component(net->ecs, ref, i, true);
+		component_write(net, &stream, i, component_data);
+	}
+}
+
+// Decode encoded replicated components into an entity.
+static void entity_decode(net_t* net, ecs_entity_ref_t ref, int type, const char* data)
+{
+	bit_stream_t stream = { .data = (uint8_t*)data, .capacity = net->entity_types[type].replicated_size * 8 };
+	ecs_mask_t mask = net->entity_types[type].replicated_component_mask;
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		char* component_data = ecs_entity_get_component(net->ecs, ref, i, true);
+		component_read(net, &stream, i, component_data);
+		ecs_entity_mark_changed(net->ecs, ref, i);
+	}
+}
+
+// Add a remote entity's state as of time to its jitter buffer, dropping the oldest if full.
+// Unless changed, the entity's interpolated fields are as in the newest sample.
+static void entity_push_sample(connection_t* connection, entity_data_t* entity, uint32_t time_ms, bool changed)
+{
+	net_t* net = connection->net;
+	interpolation_t* interpolation = &connection->interpolation[entity - connection->entities];
+
+	const entity_sample_t* newest = interpolation->count ? &interpolation->samples[interpolation->count - 1] : NULL;
+	if (newest && (int32_t)(time_ms - newest->time_ms) <= 0)
+	{
+		return;
+	}
+
+	if (interpolation->count == _countof(interpolation->samples))
+	{
+		memmove(&interpolation->samples[0], &interpolation->samples[1], sizeof(entity_sample_t) * (interpolation->count - 1));
+		interpolation->count--;
+		newest = &interpolation->samples[interpolation->count - 1];
+	}
+
+	entity_sample_t* sample = &interpolation->samples[interpolation->count++];
+	sample->time_ms = time_ms;
+	if (changed || !newest)
+	{
+		entity_get_values(net, entity, sample->values);
+	}
+	else
+	{
+		memcpy(sample->values, newest->values, sizeof(sample->values));
+	}
+}
+
+// Set a connection's remote entities to where they were interpolation delay ago on the sender's clock,
+// between the two samples either side, or extrapolated a little past the newest.
+static void connection_interpolate(connection_t* connection)
+{
+	net_t* net = connection->net;
+	if (!connection->clock_synced)
+	{
+		return;
+	}
+
+	int64_t render_ms = (int64_t)net_time_ms(net) - connection->clock_offset_ms - net->interpolation_delay_ms;
+	for (int i = 0; i < _countof(connection->entities); ++i)
+	{
+		const interpolation_t* interpolation = &connection->interpolation[i];
+		if (!interpolation->count || !ecs_is_entity_ref_valid(net->ecs, connection->entities[i].ref, true))
+		{
+			continue;
+		}
+
+		const entity_sample_t* samples = interpolation->samples;
+		int count = interpolation->count;
+		int next = 0;
+		while (next < count && (int64_t)samples[next].time_ms <= render_ms)
+		{
+			++next;
+		}
+
+		const entity_sample_t* a = &samples[__max(next - 1, 0)];
+		const entity_sample_t* b = a;
+		float t = 0.0f;
+		if (next > 0 && next < count)
+		{
+			b = &samples[next];
+			t = (float)(render_ms - a->time_ms) / (float)(b->time_ms - a->time_ms);
+		}
+		else if (next == count && count >= 2)
+		{
+			a = &samples[count - 2];
+			b = &samples[count - 1];
+			int64_t until_ms = __min(render_ms, (int64_t)b->time_ms + k_max_extrapolation_ms);
+			t = (float)(until_ms - a->time_ms) / (float)(b->time_ms - a->time_ms);
+		}
+		entity_set_values(net, &connection->entities[i], a->values, b->values, t);
+	}
+}
+
+// Copy the interpolated fields of an entity's replicated components into values.
+// Returns how many floats were copied.
+static int entity_get_values(net_t* net, const entity_data_t* entity, float* values)
+{
+	int count = 0;
+	ecs_mask_t mask = net->entity_types[entity->type].replicated_component_mask;
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		const component_fields_t* fields = &net->component_fields[i];
+		const char* data = ecs_entity_get_component(net->ecs, entity->ref, i, true);
+		for (int f = 0; f < fields->count; ++f)
+		{
+			const net_field_t* field = &fields->fields[f];
+			int floats = interpolated_floats(field);
+			if (!floats || count + floats > k_max_interpolated_floats)
+			{
+				continue;
+			}
+			memcpy(&values[count], data + field->offset, sizeof(float) * floats);
+			count += floats;
+		}
+	}
+	return count;
+}
+
+// Set the interpolated fields of an entity's replicated components t of the way from a to b.
+// Quaternions are blended normalized, the short way round.
+static void entity_set_values(net_t* net, const entity_data_t* entity, const float* a, const float* b, float t)
+{
+	int count = 0;
+	ecs_mask_t mask = net->entity_types[entity->type].replicated_component_mask;
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		const component_fields_t* fields = &net->component_fields[i];
+		char* data = ecs_entity_get_component(net->ecs, entity->ref, i, true);
+		for (int f = 0; f < fields->count; ++f)
+		{
+			const net_field_t* field = &fields->fields[f];
+			int floats = interpolated_floats(field);
+			if (!floats || count + floats > k_max_interpolated_floats)
+			{
+				continue;
+			}
+
+			float* out = (float*)(data + field->offset);
+			if (field->encoding == k_net_field_quaternion)
+			{
+				const float* qa = &a[count];
+				const float* qb = &b[count];
+				float sign = (qa[0] * qb[0] + qa[1] * qb[1] + qa[2] * qb[2] + qa[3] * qb[3]) < 0.0f ? -1.0f : 1.0f;
+				float q[4];
+				float length_sq = 0.0f;
+				for (int v = 0; v < 4; ++v)
+				{
+					q[v] = lerpf(qa[v], qb[v] * sign, t);
+					length_sq += q[v] * q[v];
+				}
+				float scale = length_sq > 0.0f ? 1.0f / sqrtf(length_sq) : 0.0f;
+				for (int v = 0; v < 4; ++v)
+				{
+					out[v] = q[v] * scale;
+				}
+			}
+			else
+			{
+				for (int v = 0; v < floats; ++v)
+				{
+					out[v] = lerpf(a[count + v], b[count + v], t);
+				}
+			}
+			count += floats;
+		}
+		ecs_entity_mark_changed(net->ecs, entity->ref, i);
+	}
+}
+
+// Floats a field contributes to interpolation; raw fields snap instead.
+static int interpolated_floats(const net_field_t* field)
+{
+	switch (field->encoding)
+	{
+	case k_net_field_fixed:
+		return field->count;
+	case k_net_field_quaternion:
+		return 4;
+	default:
+		return 0;
+	}
+}
+
+// Current time of the clock remote entities are played back on.
+static uint32_t net_time_ms(net_t* net)
+{
+	return net->timer ? timer_object_get_ms(net->timer) : timer_ticks_to_ms(timer_get_ticks());
+}
+
+// Pop the packets a connection received, decompressing each and decoding its entities against the
+// snapshots received before it, for packet_recv() to apply.
+static void packet_decode(connection_t* connection)
+{
+	net_t* net = connection->net;
+
+	//everything queued is taken, at most a queue's worth so a fast sender cannot keep us here, and only the
+	//newest are kept; dropped packets go unacked, so their entities are resent against what we do have
+	packet_t* pending[k_max_incoming_packets];
+	int pending_count = 0;
+	for (int i = 0; i < net->recv_queue_size; ++i)
+	{
+		packet_t* packet = spsc_queue_try_pop(connection->recv_queue);
+		if (!packet || !packet->size)
+		{
+			if (packet)
+			{
+				object_pool_free(net->packet_pool, packet);
+			}
+			break;
+		}
+		if (pending_count >= k_max_incoming_packets)
+		{
+			object_pool_free(net->packet_pool, pending[pending_count % k_max_incoming_packets]);
+			atomic_increment(&connection->recv_dropped);
+		}
+		pending[pending_count % k_max_incoming_packets] = packet;
+		pending_count++;
+	}
+
+	//packets decoded are not yet applied, so stale ones are told apart by the newest decoded
+	int newest = connection->incoming_sequence;
+	int first = __max(pending_count - k_max_incoming_packets, 0);
+	connection->incoming_count = 0;
+	for (int p = first; p < pending_count; ++p)
+	{
+		packet_t* packet = pending[p % k_max_incoming_packets];
+		incoming_t* incoming = &connection->incoming[connection->incoming_count++];
+		incoming->packet = packet;
+		incoming->decoded = false;
+		if (packet->size < k_packet_header_size)
+		{
+			continue;
+		}
+
+		packet_header_t header;
+		packet_header_read(connection, newest, packet->data, &header);
+		incoming->header = header;
+		if (header.sequence <= newest)
+		{
+			continue;
+		}
+
+		//decompressed in place, so the packet callback sees a packet that replays the same
+		char* payload = &packet->data[k_packet_header_size];
+		int payload_size = packet->size - k_packet_header_size;
+		if (header.flags & k_packet_flag_compressed)
+		{
+			//without the sender's dictionary the packet cannot be read
+			char decompressed[k_net_mtu - k_packet_header_size];
+			if (header.flags & k_packet_flag_dictionary)
+			{
+				payload_size = net->dictionary
+					? LZ4_decompress_safe_usingDict(payload, decompressed, payload_size, sizeof(decompressed), net->dictionary, net->dictionary_size)
+					: -1;
+			}
+			else
+			{
+				payload_size = LZ4_decompress_safe(payload, decompressed, payload_size, sizeof(decompressed));
+			}
+			if (payload_size < 0)
+			{
+				continue;
+			}
+			memcpy(payload, decompressed, payload_size);
+			packet->size = k_packet_header_size + payload_size;
+			header.flags &= ~(k_packet_flag_compressed | k_packet_flag_dictionary);
+			packet_header_write(&header, packet->data);
+		}
+
+		const char* payload_end = payload + payload_size;
+		const char* entities = packet_read_inputs(connection, payload, payload_end, header.input_count, false);
+		entities = entities ? packet_read_corrections(connection, entities, payload_end, header.correction_count, false) : NULL;
+		entities = entities ? packet_read_events(connection, entities, payload_end, header.event_count, false) : NULL;
+		if (!entities)
+		{
+			continue;
+		}
+
+		//without a baseline an entity refers to the packet cannot be decoded; it goes unacked, so the
+		//sender stops encoding against anything we lack
+		snapshot_t* snapshot = &connection->recv_snapshots[header.sequence % _countof(connection->recv_snapshots)];
+		snapshot->sequence = header.sequence;
+		snapshot->time_ms = header.send_ms;
+		if (!packet_read_snapshot(connection, entities, payload_end - entities, snapshot))
+		{
+			snapshot->sequence = -1;
+			continue;
+		}
+		incoming->decoded = true;
+		newest = header.sequence;
+	}
+}
+
+// Apply the packets a connection decoded this update: their commands, corrections, acks and entities.
+static void packet_recv(connection_t* connection)
+{
+	net_t* net = connection->net;
+
+	for (int i = 0; i < connection->incoming_count; ++i)
+	{
+		packet_t* packet = connection->incoming[i].packet;
+		if (net->packet_callback)
+		{
+			net->packet_callback(&connection->address, packet->data, packet->size, net->packet_callback_data);
+		}
+		if (!connection->incoming[i].decoded)
+		{
+			object_pool_free(net->packet_pool, packet);
+			continue;
+		}
+
+		const packet_header_t header = connection->incoming[i].header;
+		const char* payload = &packet->data[k_packet_header_size];
+		const char* payload_end = &packet->data[packet->size];
+		const char* entities = packet_read_inputs(connection, payload, payload_end, header.input_count, true);
+		entities = packet_read_corrections(connection, entities, payload_end, header.correction_count, true);
+		packet_read_events(connection, entities, payload_end, header.event_count, true);
+		const snapshot_t* snapshot = &connection->recv_snapshots[header.sequence % _countof(connection->recv_snapshots)];
+
+		int shift = header.sequence - connection->incoming_sequence;
+		if (connection->incoming_sequence < 0 || shift > 32)
+		{
+			connection->incoming_bits = 0;
+		}
+		else
+		{
+			connection->incoming_bits = (shift == 32 ? 0 : connection->incoming_bits << shift) | (1u << (shift - 1));
+		}
+		connection->incoming_sequence = header.sequence;
+		connection->ack_sequence = header.ack_sequence;
+		packet_process_acks(connection, &header);
+
+		//the soonest a packet arrives is latency without jitter; later arrivals only creep the offset
+		//up a millisecond each, so it follows a lasting rise in latency without jitter moving it
+		int64_t offset = (int64_t)net_time_ms(net) - header.send_ms;
+
+		//jitter is smoothed as in RTP, from how much each packet's transit time differs from the last's
+		if (connection->clock_synced)
+		{
+			float difference = (float)llabs(offset - connection->last_transit_ms);
+			connection->jitter_ms += (difference - connection->jitter_ms) / 16.0f;
+		}
+		connection->last_transit_ms = offset;
+
+		if (!connection->clock_synced || offset < connection->clock_offset_ms)
+		{
+			connection->clock_offset_ms = offset;
+			connection->clock_synced = true;
+		}
+		else if (offset > connection->clock_offset_ms)
+		{
+			connection->clock_offset_ms++;
+		}
+
+		packet_apply_snapshot(connection, snapshot);
+
+		float apply_ms = timer_ticks_to_us(timer_get_ticks() - packet->ticks) * 0.001f;
+		connection->apply_ms += (apply_ms - connection->apply_ms) / 16.0f;
+		connection->max_apply_ms = __max(connection->max_apply_ms, apply_ms);
+
+		object_pool_free(net->packet_pool, packet);
+	}
+	connection->incoming_count = 0;
+}
+
+// Set up registered I/O on the socket, returning false if Winsock lacks it.
+static bool rio_create(net_shard_t* shard)
+{
+	net_t* net = shard->net;
+	GUID id = WSAID_MULTIPLE_RIO;
+	DWORD bytes = 0;
+	net->rio.cbSize = sizeof(net->rio);
+	if (WSAIoctl(shard->sock, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &id, sizeof(id), &net->rio, sizeof(net->rio), &bytes, NULL, NULL))
+	{
+		return false;
+	}
+
+	//the slots are registered once, so no receive or send locks pages of its own
+	size_t slots_size = sizeof(rio_slot_t) * (k_net_rio_recv_count + k_net_rio_send_count);
+	shard->rio_slots = heap_alloc(net->heap, slots_size, 64);
+	shard->rio_buffer_id = net->rio.RIORegisterBuffer((PCHAR)shard->rio_slots, (DWORD)slots_size);
+
+	shard->rio_recv_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+	RIO_NOTIFICATION_COMPLETION notification =
+	{
+		.Type = RIO_EVENT_COMPLETION,
+		.Event.EventHandle = shard->rio_recv_event,
+		.Event.NotifyReset = TRUE,
+	};
+	shard->rio_recv_cq = net->rio.RIOCreateCompletionQueue(k_net_rio_recv_count, &notification);
+	shard->rio_send_cq = net->rio.RIOCreateCompletionQueue(k_net_rio_send_count, NULL);
+	if (shard->rio_buffer_id != RIO_INVALID_BUFFERID && shard->rio_recv_cq != RIO_INVALID_CQ && shard->rio_send_cq != RIO_INVALID_CQ)
+	{
+		shard->rio_rq = net->rio.RIOCreateRequestQueue(shard->sock, k_net_rio_recv_count, 1, k_net_rio_send_count, 1, shard->rio_recv_cq, shard->rio_send_cq, shard);
+	}
+	if (shard->rio_rq == RIO_INVALID_RQ)
+	{
+		shard->rio_rq = NULL;
+		rio_destroy(shard);
+		return false;
+	}
+
+	for (int i = 0; i < k_net_rio_send_count; ++i)
+	{
+		shard->rio_send_free[i] = k_net_rio_recv_count + i;
+	}
+	shard->rio_send_free_count = k_net_rio_send_count;
+	return true;
+}
+
+static void rio_destroy(net_shard_t* shard)
+{
+	net_t* net = shard->net;
+	//the request queue is closed along with the socket
+	if (shard->rio_recv_cq && shard->rio_recv_cq != RIO_INVALID_CQ)
+	{
+		net->rio.RIOCloseCompletionQueue(shard->rio_recv_cq);
+	}
+	if (shard->rio_send_cq && shard->rio_send_cq != RIO_INVALID_CQ)
+	{
+		net->rio.RIOCloseCompletionQueue(shard->rio_send_cq);
+	}
+	if (shard->rio_slots)
+	{
+		if (shard->rio_buffer_id != RIO_INVALID_BUFFERID)
+		{
+			net->rio.RIODeregisterBuffer(shard->rio_buffer_id);
+		}
+		heap_free(net->heap, shard->rio_slots);
+	}
+	if (shard->rio_recv_event)
+	{
+		CloseHandle(shard->rio_recv_event);
+	}
+	shard->rio_recv_cq = NULL;
+	shard->rio_send_cq = NULL;
+	shard->rio_slots = NULL;
+	shard->rio_recv_event = NULL;
+}
+
+static void rio_post_recv(net_shard_t* shard, int slot)
+{
+	net_t* net = shard->net;
+	RIO_BUF data = rio_buf(shard, shard->rio_slots[slot].data, k_net_mtu);
+	RIO_BUF address = rio_buf(shard, &shard->rio_slots[slot].address, sizeof(SOCKADDR_INET));
+	if (!net->rio.RIOReceiveEx(shard->rio_rq, &data, 1, NULL, &address, NULL, NULL, 0, (void*)(intptr_t)slot))
+	{
+		debug_print(k_print_warning, "RIOReceiveEx failed: %d\n", WSAGetLastError());
+	}
+}
+
+// Take a free send slot to build a packet in, or return -1 if every slot is in flight.
+// Slots whose sends completed are recycled first.
+static int rio_acquire_send_slot(net_shard_t* shard)
+{
+	net_t* net = shard->net;
+	RIORESULT results[k_net_rio_send_count];
+	ULONG count = net->rio.RIODequeueCompletion(shard->rio_send_cq, results, _countof(results));
+	for (ULONG i = 0; count != RIO_CORRUPT_CQ && i < count; ++i)
+	{
+		shard->rio_send_free[shard->rio_send_free_count++] = (int)results[i].RequestContext;
+		frame_stats_add(frame_stats_get_default(), k_frame_stat_net_bytes_out, results[i].BytesTransferred);
+	}
+	if (!shard->rio_send_free_count && shard->rio_send_pending)
+	{
+		//with more connections than send slots, commit what is deferred so slots come back sooner
+		net->rio.RIOSendEx(shard->rio_rq, NULL, 0, NULL, NULL, NULL, NULL, RIO_MSG_COMMIT_ONLY, NULL);
+		shard->rio_send_pending = 0;
+	}
+	if (!shard->rio_send_free_count)
+	{
+		return -1;
+	}
+	return shard->rio_send_free[--shard->rio_send_free_count];
+}
+
+// Queue the packet built in a send slot to send with the next commit in net_update.
+static void rio_send(connection_t* connection, int slot, int size)
+{
+	net_t* net = connection->net;
+	net_shard_t* shard = connection->shard;
+
+	rio_slot_t* rio_slot = &shard->rio_slots[slot];
+	memset(&rio_slot->address, 0, sizeof(rio_slot->address));
+	address_to_sockaddr(&connection->address, &rio_slot->address.Ipv4);
+
+	RIO_BUF data = rio_buf(shard, rio_slot->data, size);
+	RIO_BUF address = rio_buf(shard, &rio_slot->address, sizeof(SOCKADDR_INET));
+	if (net->rio.RIOSendEx(shard->rio_rq, &data, 1, NULL, &address, NULL, NULL, RIO_MSG_DEFER, (void*)(intptr_t)slot))
+	{
+		shard->rio_send_pending++;
+	}
+	else
+	{
+		shard->rio_send_free[shard->rio_send_free_count++] = slot;
+	}
+}
+
+// Describe part of a slot as a range of the registered buffer.
+static RIO_BUF rio_buf(net_shard_t* shard, void* field, ULONG length)
+{
+	RIO_BUF buf =
+	{
+		.BufferId = shard->rio_buffer_id,
+		.Offset = (ULONG)((char*)field - (char*)shard->rio_slots),
+		.Length = length,
+	};
+	return buf;
+}
+
+static void address_to_sockaddr(const net_address_t* address, struct sockaddr_in* sockaddr)
+{
+	memset(sockaddr, 0, sizeof(*sockaddr));
+	sockaddr->sin_family = AF_INET;
+	sockaddr->sin_port = htons(address->port);
+	sockaddr->sin_addr.S_un.S_un_b.s_b1 = address->ip[0];
+	sockaddr->sin_addr.S_un.S_un_b.s_b2 = address->ip[1];
+	sockaddr->sin_addr.S_un.S_un_b.s_b3 = address->ip[2];
+	sockaddr->sin_addr.S_un.S_un_b.s_b4 = address->ip[3];
+}
+
+static void update_replicated_size(net_t* net, int type)
+{
+	int bits = 0;
+	ecs_mask_t mask = net->entity_types[type].replicated_component_mask;
+	for (int i = ecs_mask_next(mask, 0); i >= 0; i = ecs_mask_next(mask, i + 1))
+	{
+		bits += component_bits(net, i);
+	}
+	net->entity_types[type].replicated_bits = bits;
+	net->entity_types[type].replicated_size = (bits + 7) / 8;
+}
+
+static int component_bits(net_t* net, int component_type)
+{
+	const component_fields_t* fields = &net->component_fields[component_type];
+	if (!fields->count)
+	{
+		return (int)ecs_get_component_type_size(net->ecs, component_type) * 8;
+	}
+
+	int bits = 0;
+	for (int i = 0; i < fields->count; ++i)
+	{
+		const net_field_t* field = &fields->fields[i];
+		switch (field->encoding)
+		{
+		case k_net_field_raw: bits += field->count * 8; break;
+		case k_net_field_fixed: bits += field->count * field->bits; break;
+		case k_net_field_quaternion: bits += 2 + 3 * field->bits; break;
+		}
+	}
+	return bits;
+}
+
+static void component_write(net_t* net, bit_stream_t* stream, int component_type, const char* data)
+{
+	const component_fields_t* fields = &net->component_fields[component_type];
+	if (!fields->count)
+	{
+		size_t size = ecs_get_component_type_size(net->ecs, component_type);
+		for (size_t i = 0; i < size; ++i)
+		{
+			bit_write(stream, (uint8_t)data[i], 8);
+		}
+		return;
+	}
+
+	for (int i = 0; i < fields->count; ++i)
+	{
+		const net_field_t* field = &fields->fields[i];
+		const char* field_data = data + field->offset;
+		switch (field->encoding)
+		{
+		case k_net_field_raw:
+			for (int b = 0; b < field->count; ++b)
+			{
+				bit_write(stream, (uint8_t)field_data[b], 8);
+			}
+			break;
+		case k_net_field_fixed:
+			for (int f = 0; f < field->count; ++f)
+			{
+				float value;
+				memcpy(&value, field_data + f * sizeof(float), sizeof(value));
+				bit_write(stream, quantize(value, field->min, field->max, field->bits), field->bits);
+			}
+			break;
+		case k_net_field_quaternion:
+		{
+			//smallest three: the largest component is rebuilt from the others, which for a unit
+			//quaternion each lie within +/-1/sqrt(2); negating the quaternion keeps it positive
+			float q[4];
+			memcpy(q, field_data, sizeof(q));
+			int largest = 0;
+			for (int c = 1; c < 4; ++c)
+			{
+				if (fabsf(q[c]) > fabsf(q[largest]))
+				{
+					largest = c;
+				}
+			}
+			float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+			bit_write(stream, largest, 2);
+			for (int c = 0; c < 4; ++c)
+			{
+				if (c != largest)
+				{
+					bit_write(stream, quantize(q[c] * sign, -0.70710678f, 0.70710678f, field->bits), field->bits);
+				}
+			}
+			break;
+		}
+		}
+	}
+}
+
+static void component_read(net_t* net, bit_stream_t* stream, int component_type, char* data)
+{
+	const component_fields_t* fields = &net->component_fields[component_type];
+	if (!fields->count)
+	{
+		size_t size = ecs_get_component_type_size(net->ecs, component_type);
+		for (size_t i = 0; i < size; ++i)
+		{
+			data[i] = (char)bit_read(stream, 8);
+		}
+		return;
+	}
+
+	for (int i = 0; i < fields->count; ++i)
+	{
+		const net_field_t* field = &fields->fields[i];
+		char* field_data = data + field->offset;
+		switch (field->encoding)
+		{
+		case k_net_field_raw:
+			for (int b = 0; b < field->count; ++b)
+			{
+				field_data[b] = (char)bit_read(stream, 8);
+			}
+			break;
+		case k_net_field_fixed:
+			for (int f = 0; f < field->count; ++f)
+			{
+				float value = dequantize(bit_read(stream, field->bits), field->min, field->max, field->bits);
+				memcpy(field_data + f * sizeof(float), &value, sizeof(value));
+			}
+			break;
+		case k_net_field_quaternion:
+		{
+			float q[4];
+			int largest = (int)bit_read(stream, 2);
+			float sum = 0.0f;
+			for (int c = 0; c < 4; ++c)
+			{
+				if (c != largest)
+				{
+					q[c] = dequantize(bit_read(stream, field->bits), -0.70710678f, 0.70710678f, field->bits);
+					sum += q[c] * q[c];
+				}
+			}
+			q[largest] = sqrtf(__max(0.0f, 1.0f - sum));
+			memcpy(field_data, q, sizeof(q));
+			break;
+		}
+		}
+	}
+}
+
+// Map a value in [min, max] to the nearest of 2^bits evenly spaced steps.
+static uint32_t quantize(float value, float min, float max, int bits)
+{
+	double steps = (double)(bits >= 32 ? 0xffffffffu : (1u << bits) - 1);
+	double t = ((double)value - min) / ((double)max - min);
+	t = __min(__max(t, 0.0), 1.0);
+	return (uint32_t)(t * steps + 0.5);
+}
+
+static float dequantize(uint32_t value, float min, float max, int bits)
+{
+	double steps = (double)(bits >= 32 ? 0xffffffffu : (1u << bits) - 1);
+	return (float)(min + (value / steps) * ((double)max - min));
+}
+
+static void bit_write(bit_stream_t* stream, uint32_t value, int bits)
+{
+	if (stream->position + bits > stream->capacity)
+	{
+		stream->overflow = true;
+		return;
+	}
+	while (bits > 0)
+	{
+		int shift = (int)(stream->position & 7);
+		int chunk = __min(8 - shift, bits);
+		uint8_t mask = (uint8_t)(((1u << chunk) - 1) << shift);
+		uint8_t* byte = &stream->data[stream->position >> 3];
+		*byte = (uint8_t)((*byte & ~mask) | ((value << shift) & mask));
+		value >>= chunk;
+		bits -= chunk;
+		stream->position += chunk;
+	}
+}
+
+// Write a packet header in k_packet_header_size bytes, its sequences truncated to 16 bits.
+static void packet_header_write(const packet_header_t* header, char* data)
+{
+	uint16_t sequence = (uint16_t)header->sequence;
+	uint16_t ack_sequence = (uint16_t)header->ack_sequence;
+	memcpy(data, &sequence, 2);
+	memcpy(data + 2, &ack_sequence, 2);
+	memcpy(data + 4, &header->ack_bits, 4);
+	memcpy(data + 8, &header->send_ms, 4);
+	data[12] = (char)header->flags;
+	data[13] = (char)header->input_count;
+	data[14] = (char)header->correction_count;
+	data[15] = (char)header->event_count;
+}
+
+// Read a packet header written by packet_header_write() on a connection.
+// Its sequence is widened against newest, the newest packet received, and its ack against the newest sent.
+static void packet_header_read(connection_t* connection, int newest, const char* data, packet_header_t* header)
+{
+	uint16_t sequence;
+	uint16_t ack_sequence;
+	memcpy(&sequence, data, 2);
+	memcpy(&ack_sequence, data + 2, 2);
+	memset(header, 0, sizeof(*header));
+	//the first packet received starts the connection's sequences wherever the sender's are
+	header->sequence = newest < 0 ? sequence : sequence_widen(sequence, newest);
+	header->ack_sequence = sequence_widen(ack_sequence, connection->send_sequence - 1);
+	memcpy(&header->ack_bits, data + 4, 4);
+	memcpy(&header->send_ms, data + 8, 4);
+	header->flags = (uint8_t)data[12];
+	header->input_count = (uint8_t)data[13];
+	header->correction_count = (uint8_t)data[14];
+	header->event_count = (uint8_t)data[15];
+}
+
+// Widen a sequence truncated to 16 bits to the full sequence nearest reference.
+static int sequence_widen(uint16_t sequence, int reference)
+{
+	return reference + (int16_t)(uint16_t)(sequence - (uint16_t)reference);
+}
+
+// Write data as a delta from base: per byte a changed bit, then the changed bits if set.
+static void delta_write(bit_stream_t* stream, const char* data, const char* base, size_t size)
+{
+	for (size_t b = 0; b < size; ++b)
+	{
+		uint8_t delta = (uint8_t)(data[b] ^ base[b]);
+		bit_write(stream, delta != 0, 1);
+		if (delta)
+		{
+			bit_write(stream, delta, 8);
+		}
+	}
+}
+
+static uint32_t bit_read(bit_stream_t* stream, int bits)
+{
+	if (stream->position + bits > stream->capacity)
+	{
+		stream->overflow = true;
+		return 0;
+	}
+	uint32_t value = 0;
+	int offset = 0;
+	while (offset < bits)
+	{
+		int shift = (int)(stream->position & 7);
+		int chunk = __min(8 - shift, bits - offset);
+		uint32_t byte = stream->data[stream->position >> 3];
+		value |= ((byte >> shift) & ((1u << chunk) - 1)) << offset;
+		offset += chunk;
+		stream->position += chunk;
+	}
+	return value;
+}
+
+// Write a value in groups of 7 bits, low first, each with a bit set if another group follows.
+static void varint_write(bit_stream_t* stream, uint32_t value)
+{
+	do
+	{
+		uint32_t group = value & 0x7f;
+		value >>= 7;
+		bit_write(stream, group | (value ? 0x80 : 0), 8);
+	} while (value);
+}
+
+static uint32_t varint_read(bit_stream_t* stream)
+{
+	uint32_t value = 0;
+	for (int shift = 0; shift < 32; shift += 7)
+	{
+		uint32_t group = bit_read(stream, 8);
+		value |= (group & 0x7f) << shift;
+		if (!(group & 0x80))
+		{
+			break;
+		}
+	}
+	return value;
+}
+
+// Bits varint_write() takes to write a value.
+static int varint_bits(uint32_t value)
+{
+	int bits = 8;
+	while (value >>= 7)
+	{
+		bits += 8;
 	}
+	return bits;
 }
@@ -8,6 +8,8 @@
 typedef struct net_t net_t;
 
 typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+typedef struct timer_object_t timer_object_t;
 
 typedef struct net_address_t
 {
@@ -17,15 +19,223 @@ typedef struct net_address_t
 
 typedef void(*net_configure_entity_callback_t)(ecs_t* ecs, ecs_entity_ref_t entity, int type, void* user);
 
+// Most connections a net system can hold.
+enum { k_net_max_connections = 0xffff };
+
+// Largest input command, in bytes.
+enum { k_net_max_input_size = 32 };
+
+// Largest event sent with net_send_event(), in bytes.
+enum { k_net_max_event_size = 32 };
+
+// Applies one input command to an entity, advancing it by that command alone.
+// Must depend only on the command and the entity's replicated components, so the peer simulating the
+// entity with authority and the peer predicting it reach the same state.
+typedef void(*net_input_callback_t)(ecs_t* ecs, ecs_entity_ref_t entity, const void* input, void* user);
+
+// Called on the game thread with each packet net_update() processes, before it is processed.
+// Compressed packets are passed decompressed, which replays the same.
+typedef void(*net_packet_callback_t)(const net_address_t* address, const void* data, int size, void* user);
+
+// Called on the game thread with each event a connection sent with net_send_event(), once and in the order sent.
+typedef void(*net_event_callback_t)(const net_address_t* address, const void* data, int size, void* user);
+
+// Options for creating a net system.
+// Zero-initialized options match net_create().
+// Conditioning of the link packets are sent over, to test against a poor network on loopback.
+// Each peer conditions what it sends, so conditioning both ends of a connection conditions both directions.
+typedef struct net_link_t
+{
+	int latency_ms; //added to every packet
+	int jitter_ms; //up to this much more per packet; packets are never reordered
+	int loss_percent; //of packets dropped
+	int bandwidth; //bytes per second sent to all connections; packets queue behind the cap. 0 means no cap.
+} net_link_t;
+
+typedef struct net_options_t
+{
+	int max_connections; //0 means 64
+
+	// Sockets to receive on, each bound to its own port with its own receive thread and an even share of
+	// the connections, so a server with many clients receives on as many cores. The first takes any free
+	// port and the rest the ports after it where free. A connection stays with the socket its packets arrive
+	// on, or that its address hashes to when we connect to it, so clients should be spread across the ports,
+	// as by net_get_shard_loopback_address(). 0 means 1.
+	int shard_count;
+
+	// Received packets each connection holds until net_update() takes them; more arriving in between are dropped.
+	// Each update applies at most the newest 16 of them. 0 means 32.
+	int recv_queue_size;
+
+	// Most packets sent to each connection per tick; entities beyond them wait their turn.
+	// 0 means 4.
+	int packets_per_update;
+
+	// Times per second entities are snapshotted and sent, however often net_update() is called.
+	// 0 means 30.
+	int tick_rate;
+
+	// Send to a connection less often, down to every 8th tick, while its round trip time or
+	// packet loss shows it is congested.
+	bool adapt_send_rate;
+
+	// Remote entities are buffered and shown this far behind when their sender sent them,
+	// interpolating fixed and quaternion fields between states, so jitter in when packets
+	// arrive does not show. Should span a few of the sender's ticks. 0 means 100.
+	int interpolation_delay_ms;
+
+	// Clock remote entities are played back on, read during net_update(). NULL means the system timer.
+	timer_object_t* timer;
+
+	// Simulate the input commands connections send for their entities and send back the results,
+	// ignoring the state connections replicate for them. Set on the server; clients predict instead.
+	bool authoritative;
+
+	// Delay, drop and cap the bandwidth of packets sent, with the send thread rather than registered I/O.
+	// All zero sends packets at once.
+	net_link_t link;
+
+	// Called with every packet received, to record them for net_inject_packet() to replay.
+	net_packet_callback_t packet_callback;
+	void* packet_callback_data;
+
+	// Called with the events connections send.
+	net_event_callback_t event_callback;
+	void* event_callback_data;
+
+	// Send and receive nothing on the socket; packets arrive only through net_inject_packet().
+	bool offline;
+
+	// Compress payloads against this dictionary, copied at creation. Every peer must be given the same one.
+	// A payload alone is too small for LZ4 to find many matches in; typical payloads concatenated, such as
+	// packets recorded by a replay, give it matches to refer back to. Only the last 64 KB is used.
+	const void* compression_dictionary;
+	int compression_dictionary_size;
+
+	// Build each connection's packets and decode the packets it received as jobs, one per connection.
+	// The thread calling net_update() waits for them, then sends the packets and applies what was received
+	// in connection order, so callbacks and entity changes stay on it. NULL does it all on that thread.
+	job_system_t* jobs;
+} net_options_t;
+
 net_t* net_create(heap_t* heap, ecs_t* ecs);
+net_t* net_create_with_options(heap_t* heap, ecs_t* ecs, const net_options_t* options);
 void net_destroy(net_t* net);
 
 void net_update(net_t* net);
 
 void net_connect(net_t* net, const net_address_t* address);
+
+// Hand a packet to the next net_update() as if it had been received from address, from the game thread.
+// Meant for offline nets; one connection takes at most 32 packets between updates.
+void net_inject_packet(net_t* net, const net_address_t* address, const void* data, int size);
 void net_disconnect_all(net_t* net);
 
-void net_state_register_entity_type(net_t* net, int type, uint64_t component_mask, uint64_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data);
+void net_state_register_entity_type(net_t* net, int type, ecs_mask_t component_mask, ecs_mask_t replicated_component_mask, net_configure_entity_callback_t configure_callback, void* configure_callback_data);
+
+// Replicate one of our entities to every connection until it is removed from the ecs.
+// Its spawn and, once net_update() sees it removed, its despawn are sent reliably: connections hold it
+// until the despawn rather than timing it out, even while it is out of their relevancy, so it is not resent
+// while unchanged since a packet they acked, and remove it as soon as the despawn arrives.
 void net_state_register_entity_instance(net_t* net, int type, ecs_entity_ref_t entity);
 
+// Send a rare event of up to k_net_max_event_size bytes to every connection, reliably and in order
+// with the spawns and despawns of our entities. Connections receive it in their event callback.
+void net_send_event(net_t* net, const void* data, int size);
+
+// Drive entities of a type with input commands of input_size bytes, at most k_net_max_input_size.
+// Call before connecting, identically on every peer.
+void net_state_register_input(net_t* net, int type, int input_size, net_input_callback_t callback, void* callback_data);
+
+// Apply an input command to one of our registered entities now, predicting its result, and send it
+// to authoritative peers. When one's result differs from the prediction, the entity takes that
+// result and the commands it has not simulated yet are replayed on top.
+void net_input_push(net_t* net, ecs_entity_ref_t entity, const void* input);
+
+// Ways a replicated component field is encoded.
+typedef enum net_field_encoding_t
+{
+	k_net_field_raw, //count bytes copied unchanged
+	k_net_field_fixed, //count floats, each quantized to bits over [min, max]
+	k_net_field_quaternion, //unit quaternion of four floats as its smallest three components, bits each
+} net_field_encoding_t;
+
+// One field of a replicated component.
+typedef struct net_field_t
+{
+	net_field_encoding_t encoding;
+	int offset; //byte offset of the field in the component
+	int count;
+	int bits;
+	float min;
+	float max;
+} net_field_t;
+
+// Describe how a component type is encoded when replicated.
+// Bytes outside the fields are not sent and keep the receiver's values, so omit anything
+// that never changes after the configure callback. Without fields a component is sent whole.
+// Call before connecting, identically on every peer.
+void net_state_register_component_fields(net_t* net, int component_type, const net_field_t* fields, int field_count);
+
+// How entities are chosen for each connection's packets.
+// Zero-initialized, every entity is relevant to every connection.
+typedef struct net_relevancy_t
+{
+	// Component holding a vec3f_t position at position_offset.
+	// Entities whose type lacks it are always relevant.
+	int position_component_type;
+	int position_offset;
+
+	// Entities farther than radius from all of a connection's focus entities are not sent to it.
+	// 0 disables filtering.
+	float radius;
+
+	// Size of the grid cells entities are bucketed into. 0 means the radius.
+	float cell_size;
+
+	// Mask of entity types a connection replicates to us whose positions are its view.
+	// 0 means all of its entities.
+	uint64_t focus_entity_types;
+} net_relevancy_t;
+
+// Filter which entities are sent to each connection by distance from what that connection replicates.
+// Relevant entities build up priority each update, nearer ones faster, and each packet takes the
+// highest priorities that fit, so bandwidth per connection stays within a packet however large the world.
+void net_state_set_relevancy(net_t* net, const net_relevancy_t* relevancy);
+
 bool net_string_to_address(const char* str, net_address_t* address);
+
+// Measured quality of a connection.
+typedef struct net_connection_stats_t
+{
+	net_address_t address;
+	float rtt_ms; //smoothed round trip time from acks
+	float jitter_ms; //smoothed variation in how long the connection's packets take to arrive
+	float loss; //smoothed fraction of our packets the connection did not ack
+	float bytes_in_per_second;
+	float bytes_out_per_second;
+	int send_interval; //ticks between our sends, above one while adapting to congestion
+	int64_t bytes_in; //since the connection began
+	int64_t bytes_out;
+	float apply_ms; //smoothed time from a packet arriving to its snapshot being applied, waiting on net_update()
+	float max_apply_ms; //longest of any packet since the connection began
+	int recv_dropped; //packets received but dropped, by a full receive queue or behind a backlog too long to apply
+} net_connection_stats_t;
+
+// Fill stats for up to max_count connections, returning how many were filled.
+// The worst latency, jitter and loss of any connection and total bandwidth are also recorded as
+// trace counters every update.
+int net_get_connection_stats(net_t* net, net_connection_stats_t* stats, int max_count);
+
+// Get how many ticks a net has sent on.
+int net_get_tick(net_t* net);
+
+// Get the loopback address of the port a net is bound to, for peers in the same process to connect to.
+// With several shards, it is the first shard's port.
+void net_get_loopback_address(net_t* net, net_address_t* address);
+
+// Get how many sockets a net receives on. See net_options_t.
+int net_get_shard_count(net_t* net);
+
+// Get the loopback address of one of a net's sockets, which wraps around the shard count.
+void net_get_shard_loopback_address(net_t* net, int shard, net_address_t* address);
@@ -0,0 +1,102 @@
+#include "object_pool.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct object_pool_t
+{
+	heap_t* heap;
+	char* elements;
+	size_t element_size;
+	size_t alignment;
+	int count;
+
+	// Index of the next free object for each object, -1 at the end of the list.
+	// Kept outside the objects so a stale read during a lost race is harmless.
+	int* next;
+
+	// Low 32 bits are the index of the first free object plus one, zero when empty.
+	// High 32 bits count every change to the head so a recycled index is never mistaken for an unchanged one.
+	int64_t head;
+} object_pool_t;
+
+static int64_t make_head(uint64_t head, int index);
+
+object_pool_t* object_pool_create(heap_t* heap, size_t element_size, size_t alignment, int count)
+{
+	object_pool_t* pool = heap_alloc(heap, sizeof(object_pool_t), 8);
+	pool->heap = heap;
+	pool->element_size = (element_size + (alignment - 1)) & ~(alignment - 1);
+	pool->alignment = alignment;
+	pool->count = count;
+	pool->elements = heap_alloc(heap, pool->element_size * count, alignment);
+	pool->next = heap_alloc(heap, sizeof(int) * count, 8);
+	for (int i = 0; i < count; ++i)
+	{
+		pool->next[i] = i + 1 < count ? i + 1 : -1;
+	}
+	pool->head = make_head(0, count > 0 ? 0 : -1);
+	return pool;
+}
+
+void object_pool_destroy(object_pool_t* pool)
+{
+	heap_free(pool->heap, pool->next);
+	heap_free(pool->heap, pool->elements);
+	heap_free(pool->heap, pool);
+}
+
+void* object_pool_alloc(object_pool_t* pool)
+{
+	void* address = object_pool_try_alloc(pool);
+	return address ? address : heap_alloc(pool->heap, pool->element_size, pool->alignment);
+}
+
+void* object_pool_try_alloc(object_pool_t* pool)
+{
+	while (true)
+	{
+		int64_t head = atomic_load64(&pool->head);
+		int index = (int)(uint32_t)head - 1;
+		if (index < 0)
+		{
+			return NULL;
+		}
+
+		int next = atomic_load(&pool->next[index]);
+		if (atomic_compare_and_exchange64(&pool->head, head, make_head(head, next)) == head)
+		{
+			return pool->elements + pool->element_size * index;
+		}
+	}
+}
+
+void object_pool_free(object_pool_t* pool, void* address)
+{
+	char* element = address;
+	if (element < pool->elements || element >= pool->elements + pool->element_size * pool->count)
+	{
+		heap_free(pool->heap, address);
+		return;
+	}
+
+	int index = (int)((element - pool->elements) / pool->element_size);
+	while (true)
+	{
+		int64_t head = atomic_load64(&pool->head);
+		atomic_store(&pool->next[index], (int)(uint32_t)head - 1);
+		if (atomic_compare_and_exchange64(&pool->head, head, make_head(head, index)) == head)
+		{
+			break;
+		}
+	}
+}
+
+static int64_t make_head(uint64_t head, int index)
+{
+	uint64_t tag = (head >> 32) + 1;
+	return (int64_t)((tag << 32) | (uint32_t)(index + 1));
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Object Pool
+// Allocator for many objects of one fixed size.
+// Free objects are kept on a lock-free list, so allocating and freeing never takes a lock.
+
+#include <stddef.h>
+
+typedef struct heap_t heap_t;
+
+// Handle to an object pool.
+typedef struct object_pool_t object_pool_t;
+
+// Create a pool of count objects of element_size bytes, each aligned to alignment.
+// Memory for all objects is allocated up front from heap.
+object_pool_t* object_pool_create(heap_t* heap, size_t element_size, size_t alignment, int count);
+
+// Destroy an object pool.
+// Objects that are still allocated become invalid.
+void object_pool_destroy(object_pool_t* pool);
+
+// Allocate an object from the pool.
+// Safe to call from any thread. If the pool is empty, the object is allocated from the heap instead.
+void* object_pool_alloc(object_pool_t* pool);
+
+// Allocate an object from the pool, or return NULL if the pool is empty.
+// Safe to call from any thread; never touches the heap.
+void* object_pool_try_alloc(object_pool_t* pool);
+
+// Return an object previously allocated from the pool.
+// Safe to call from any thread, including one other than the allocating thread.
+void object_pool_free(object_pool_t* pool, void* address);
@@ -0,0 +1,331 @@
+#include "parallel.h"
+
+#include "atomic.h"
+#include "job.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+	// Chunks per worker a parallel for splits into when not given a chunk size.
+	k_parallel_chunks_per_worker = 4,
+	// Blocks of items sorts and scans split into at most, each counted or summed on its own.
+	k_parallel_max_blocks = 8,
+	// Fewest items in a block; smaller arrays are not worth the jobs.
+	k_parallel_min_block_items = 4096,
+	// Buckets of a radix sort pass, which sorts a byte of the key.
+	k_radix_buckets = 256,
+};
+
+typedef struct parallel_for_t
+{
+	parallel_for_function_t function;
+	void* data;
+	int count;
+	int chunk_size;
+	int chunk_count;
+	int next_chunk; //taken by workers as they finish their last
+} parallel_for_t;
+
+typedef struct radix_sort_t
+{
+	int key_size; //4 or 8 bytes
+	int count;
+	int block_size;
+	int shift; //bit position of the byte sorted by this pass
+	const void* src_keys;
+	const uint32_t* src_values;
+	void* dst_keys;
+	uint32_t* dst_values;
+	int offsets[k_parallel_max_blocks][k_radix_buckets]; //each block's count of every byte, then where the block writes the next one
+} radix_sort_t;
+
+typedef struct scan_t
+{
+	const int* input;
+	int* output;
+	int count;
+	int block_size;
+	int sums[k_parallel_max_blocks]; //each block's sum, then its first output, then the output after its last
+} scan_t;
+
+static void parallel_for_job(void* data);
+static void run_chunks(parallel_for_t* loop);
+static int get_block_count(job_system_t* jobs, int count);
+static void radix_sort(job_system_t* jobs, void* keys, uint32_t* values, void* temp_keys, uint32_t* temp_values, int count, int key_size);
+static void radix_count(void* data, int begin, int end);
+static void radix_scatter(void* data, int begin, int end);
+static void scan_sum(void* data, int begin, int end);
+static void scan_write(void* data, int begin, int end);
+
+void parallel_for(job_system_t* jobs, int count, int chunk_size, parallel_for_function_t function, void* data)
+{
+	if (count <= 0)
+	{
+		return;
+	}
+
+	int workers = jobs ? job_system_get_worker_count(jobs) + 1 : 1;
+	if (chunk_size <= 0)
+	{
+		int chunk_count = workers * k_parallel_chunks_per_worker;
+		chunk_size = (count + chunk_count - 1) / chunk_count;
+	}
+
+	parallel_for_t loop =
+	{
+		.function = function,
+		.data = data,
+		.count = count,
+		.chunk_size = chunk_size,
+		.chunk_count = (int)(((int64_t)count + chunk_size - 1) / chunk_size),
+		.next_chunk = 0,
+	};
+	if (!jobs || loop.chunk_count == 1)
+	{
+		function(data, 0, count);
+		return;
+	}
+
+	//the calling thread takes chunks too, so one job fewer than there are workers to share them
+	job_counter_t counter = { 0 };
+	int job_count = __min(loop.chunk_count, workers) - 1;
+	for (int i = 0; i < job_count; ++i)
+	{
+		job_run(jobs, parallel_for_job, &loop, &counter);
+	}
+	run_chunks(&loop);
+	job_wait(jobs, &counter);
+}
+
+void parallel_radix_sort32(job_system_t* jobs, uint32_t* keys, uint32_t* values, uint32_t* temp_keys, uint32_t* temp_values, int count)
+{
+	radix_sort(jobs, keys, values, temp_keys, temp_values, count, sizeof(uint32_t));
+}
+
+void parallel_radix_sort64(job_system_t* jobs, uint64_t* keys, uint32_t* values, uint64_t* temp_keys, uint32_t* temp_values, int count)
+{
+	radix_sort(jobs, keys, values, temp_keys, temp_values, count, sizeof(uint64_t));
+}
+
+int parallel_exclusive_scan(job_system_t* jobs, const int* input, int* output, int count)
+{
+	if (count <= 0)
+	{
+		return 0;
+	}
+
+	scan_t scan = { .input = input, .output = output, .count = count };
+	int block_count = get_block_count(jobs, count);
+	scan.block_size = (count + block_count - 1) / block_count;
+	block_count = (count + scan.block_size - 1) / scan.block_size;
+
+	//blocks sum their items, then write their prefixes starting from the sum of the blocks before them
+	if (block_count > 1)
+	{
+		parallel_for(jobs, block_count, 1, scan_sum, &scan);
+	}
+	int total = 0;
+	for (int b = 0; b < block_count; ++b)
+	{
+		int sum = block_count > 1 ? scan.sums[b] : 0;
+		scan.sums[b] = total;
+		total += sum;
+	}
+	parallel_for(jobs, block_count, 1, scan_write, &scan);
+	return scan.sums[block_count - 1];
+}
+
+static void parallel_for_job(void* data)
+{
+	run_chunks(data);
+}
+
+static void run_chunks(parallel_for_t* loop)
+{
+	for (int chunk = atomic_fetch_add(&loop->next_chunk, 1); chunk < loop->chunk_count; chunk = atomic_fetch_add(&loop->next_chunk, 1))
+	{
+		int begin = chunk * loop->chunk_size;
+		loop->function(loop->data, begin, __min(begin + loop->chunk_size, loop->count));
+	}
+}
+
+// Get how many blocks to split count items into: one per worker, as long as each has enough items.
+static int get_block_count(job_system_t* jobs, int count)
+{
+	int workers = jobs ? job_system_get_worker_count(jobs) + 1 : 1;
+	int block_count = __min(__min(workers, k_parallel_max_blocks), count / k_parallel_min_block_items);
+	return __max(block_count, 1);
+}
+
+static void radix_sort(job_system_t* jobs, void* keys, uint32_t* values, void* temp_keys, uint32_t* temp_values, int count, int key_size)
+{
+	if (count < 2)
+	{
+		return;
+	}
+
+	radix_sort_t sort = { .key_size = key_size, .count = count };
+	int block_count = get_block_count(jobs, count);
+	sort.block_size = (count + block_count - 1) / block_count;
+	block_count = (count + sort.block_size - 1) / sort.block_size;
+
+	void* src_keys = keys;
+	uint32_t* src_values = values;
+	void* dst_keys = temp_keys;
+	uint32_t* dst_values = values ? temp_values : NULL;
+	for (int shift = 0; shift < key_size * 8; shift += 8)
+	{
+		sort.shift = shift;
+		sort.src_keys = src_keys;
+		sort.src_values = src_values;
+		sort.dst_keys = dst_keys;
+		sort.dst_values = dst_values;
+		parallel_for(jobs, block_count, 1, radix_count, &sort);
+
+		//each byte's items go in block order, which keeps the sort stable
+		int total = 0;
+		bool shared = false;
+		for (int d = 0; d < k_radix_buckets; ++d)
+		{
+			int bucket_total = 0;
+			for (int b = 0; b < block_count; ++b)
+			{
+				int bucket = sort.offsets[b][d];
+				sort.offsets[b][d] = total;
+				total += bucket;
+				bucket_total += bucket;
+			}
+			shared |= bucket_total == count;
+		}
+
+		//a byte every item shares leaves the order as it is
+		if (shared)
+		{
+			continue;
+		}
+		parallel_for(jobs, block_count, 1, radix_scatter, &sort);
+
+		void* temp = src_keys;
+		src_keys = dst_keys;
+		dst_keys = temp;
+		uint32_t* temp_value = src_values;
+		src_values = dst_values;
+		dst_values = temp_value;
+	}
+
+	if (src_keys != keys)
+	{
+		memcpy(keys, src_keys, (size_t)count * key_size);
+		if (values)
+		{
+			memcpy(values, src_values, (size_t)count * sizeof(uint32_t));
+		}
+	}
+}
+
+static void radix_count(void* data, int begin, int end)
+{
+	radix_sort_t* sort = data;
+	for (int b = begin; b < end; ++b)
+	{
+		int* counts = sort->offsets[b];
+		memset(counts, 0, sizeof(sort->offsets[b]));
+		int first = b * sort->block_size;
+		int last = __min(first + sort->block_size, sort->count);
+		if (sort->key_size == sizeof(uint64_t))
+		{
+			const uint64_t* keys = sort->src_keys;
+			for (int i = first; i < last; ++i)
+			{
+				++counts[(keys[i] >> sort->shift) & 0xff];
+			}
+		}
+		else
+		{
+			const uint32_t* keys = sort->src_keys;
+			for (int i = first; i < last; ++i)
+			{
+				++counts[(keys[i] >> sort->shift) & 0xff];
+			}
+		}
+	}
+}
+
+static void radix_scatter(void* data, int begin, int end)
+{
+	radix_sort_t* sort = data;
+	for (int b = begin; b < end; ++b)
+	{
+		int* offsets = sort->offsets[b];
+		int first = b * sort->block_size;
+		int last = __min(first + sort->block_size, sort->count);
+		const uint32_t* src_values = sort->src_values;
+		uint32_t* dst_values = sort->dst_values;
+		if (sort->key_size == sizeof(uint64_t))
+		{
+			const uint64_t* src_keys = sort->src_keys;
+			uint64_t* dst_keys = sort->dst_keys;
+			for (int i = first; i < last; ++i)
+			{
+				int to = offsets[(src_keys[i] >> sort->shift) & 0xff]++;
+				dst_keys[to] = src_keys[i];
+				if (src_values)
+				{
+					dst_values[to] = src_values[i];
+				}
+			}
+		}
+		else
+		{
+			const uint32_t* src_keys = sort->src_keys;
+			uint32_t* dst_keys = sort->dst_keys;
+			for (int i = first; i < last; ++i)
+			{
+				int to = offsets[(src_keys[i] >> sort->shift) & 0xff]++;
+				dst_keys[to] = src_keys[i];
+				if (src_values)
+				{
+					dst_values[to] = src_values[i];
+				}
+			}
+		}
+	}
+}
+
+static void scan_sum(void* data, int begin, int end)
+{
+	scan_t* scan = data;
+	for (int b = begin; b < end; ++b)
+	{
+		int first = b * scan->block_size;
+		int last = __min(first + scan->block_size, scan->count);
+		int sum = 0;
+		for (int i = first; i < last; ++i)
+		{
+			sum += scan->input[i];
+		}
+		scan->sums[b] = sum;
+	}
+}
+
+static void scan_write(void* data, int begin, int end)
+{
+	scan_t* scan = data;
+	for (int b = begin; b < end; ++b)
+	{
+		int first = b * scan->block_size;
+		int last = __min(first + scan->block_size, scan->count);
+		int sum = scan->sums[b];
+		for (int i = first; i < last; ++i)
+		{
+			//read before writing, so output may be input
+			int value = scan->input[i];
+			scan->output[i] = sum;
+			sum += value;
+		}
+		scan->sums[b] = sum;
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+
+// Parallel Algorithms
+// Building blocks that split work over arrays across the job system: a chunked parallel for,
+// a stable least significant digit radix sort and an exclusive prefix sum.
+// Each call blocks until the work is done, running part of it on the calling thread. Called from
+// inside a job, the wait suspends the job's fiber as job_wait() does.
+// The job system may be NULL, in which case the work runs on the calling thread alone.
+
+typedef struct job_system_t job_system_t;
+
+// Function run over the items begin up to but not including end.
+typedef void (*parallel_for_function_t)(void* data, int begin, int end);
+
+// Run function over the items from 0 up to count, in chunks of chunk_size items.
+// Workers take chunks in order as they finish, so uneven chunks balance themselves.
+// A chunk size of zero or less splits the items into a few chunks per worker.
+void parallel_for(job_system_t* jobs, int count, int chunk_size, parallel_for_function_t function, void* data);
+
+// Sort 32-bit keys in ascending order, moving values with them if values is not NULL.
+// The sort is stable. temp_keys and temp_values, if values is not NULL, must hold count items;
+// the sorted items land in keys and values, and the temporary arrays are left undefined.
+// A byte of the key that every item shares costs one counting pass and no other work.
+void parallel_radix_sort32(job_system_t* jobs, uint32_t* keys, uint32_t* values, uint32_t* temp_keys, uint32_t* temp_values, int count);
+
+// Sort 64-bit keys in ascending order, as parallel_radix_sort32().
+void parallel_radix_sort64(job_system_t* jobs, uint64_t* keys, uint32_t* values, uint64_t* temp_keys, uint32_t* temp_values, int count);
+
+// Write to output the sum of every input before each item, starting with 0, and return the sum of all of them.
+// Output may be the same array as input.
+int parallel_exclusive_scan(job_system_t* jobs, const int* input, int* output, int count);
@@ -1,19 +1,410 @@
 #include "physics.h"
+#include "chipmunk/cpHastySpace.h"
+#include "debug.h"
+#include "heap.h"
+#include "job.h"
+#include "timer.h"
 #define _USE_MATH_DEFINES
+#include <float.h>
 #include <math.h>
+#include <string.h>
 
 const float R2D = (float)(180.0f / M_PI);
+
+enum
+{
+	// Most solver workers chipmunk dispatches at once (its MAX_DISPATCH_THREADS).
+	k_max_solver_workers = 16,
+
+	// Bytes ahead of each chipmunk allocation holding its size, which realloc copies; keeps 16 byte alignment.
+	k_physics_alloc_header_size = 16,
+
+	// Most jobs a batched query is split across, and fewest queries worth giving a job of its own.
+	k_max_query_jobs = 16,
+	k_min_queries_per_job = 32,
+
+	// Tree paths optimized between checks of the time budget, a few microseconds' worth on a tree of thousands of shapes.
+	k_optimize_passes_per_check = 16,
+
+	// Percent of the last step's contacting pairs and contacts kept preallocated past them for the next step.
+	k_reserve_headroom_percent = 25,
+
+	// Steps each broadphase is timed over per benchmark scene, after the warm up steps let the scene settle into contact.
+	k_benchmark_warmup_steps = 30,
+	k_benchmark_steps = 120,
+
+	// Most regions a world divides into.
+	k_max_world_regions = 64,
+
+	// Bodies in the world benchmark's strip, spread across its regions.
+	k_benchmark_world_bodies = 8000,
+};
+
+static const char* s_broadphase_names[k_physics_broadphase_count] =
+{
+	"tree",
+	"hash",
+	"sweep",
+};
+
+static const char* s_phase_names[k_physics_phase_count] =
+{
+	"integrate",
+	"broadphase",
+	"narrowphase",
+	"solver",
+};
+
+///Shape distribution a broadphase benchmark scene is filled with
+typedef struct benchmark_scene_t
+{
+	const char* name;
+	int count;
+	cpFloat min_size; //shape half extents are spread uniformly between these
+	cpFloat max_size;
+	cpFloat width; //shapes start scattered over a width by height area above a floor
+	cpFloat height;
+	cpFloat cell_size; //spatial hash cell, about the size of a typical shape
+} benchmark_scene_t;
+
+///One solver worker's share of a step, run as a job
+typedef struct solver_job_t
+{
+	cpSpace* space;
+	cpHastySpaceWorkFunction work;
+	unsigned long worker;
+	unsigned long worker_count;
+} solver_job_t;
+
+///A slice of a batched query, run as a job; rays or boxes is set
+typedef struct query_job_t
+{
+	cpSpace* space;
+	const physicsRay* rays;
+	cpSegmentQueryInfo* hits;
+	const physicsOverlap* boxes;
+	cpShape** shapes;
+	int max_shapes_per_box;
+	int* shape_counts;
+	int first;
+	int count;
+} query_job_t;
+
+///Kinematic stand-in for a body near the edge of its region, in the space of the region next to it
+///It follows its owner after every step, so bodies on either side of a boundary collide with each other
+typedef struct physicsGhost
+{
+	cpBody* owner;
+	int region; //the neighbour the stand-in is in
+	cpBody* body;
+	int seen_step; //step the owner was last near enough to the neighbour
+} physicsGhost;
+
+struct physicsBodyPool
+{
+	int bodies_per_block;
+	cpArray* blocks; //of bodies_per_block bodies each, the last one filling
+	int used; //bodies taken from the last block
+	cpArray* free; //destroyed bodies, taken again before the last block's next
+	int count; //live bodies
+};
+
+struct physicsWorld
+{
+	job_system_t* jobs;
+	cpSpace* regions[k_max_world_regions];
+	int region_count;
+	cpFloat origin_x;
+	cpFloat region_width;
+	cpFloat ghost_margin;
+	cpHashSet* ghosts; //keyed by owner and region
+	cpArray* leaving; //scratch: bodies whose centers left a region this step
+	cpArray* shapes; //scratch: a migrating body's shapes
+	int step;
+	cpFloat dt; //of the last step, for telling which owners rest
+	int migration_count;
+};
+
+///One region of a world stepped as a job
+typedef struct region_job_t
+{
+	cpSpace* space;
+	cpFloat dt;
+} region_job_t;
+
+///Shapes found so far by one box of an overlap query
+typedef struct overlap_result_t
+{
+	const physicsOverlap* box;
+	cpShape** shapes;
+	int max_count;
+	int count;
+} overlap_result_t;
+
+///The spatial hash's class, once one has been created; its queries stamp shapes, so they can't run in parallel
+static const cpSpatialIndexClass* s_space_hash_class = NULL;
+
+static void* physics_calloc(size_t count, size_t size, void* data);
+static void* physics_realloc(void* ptr, size_t size, void* data);
+static void physics_free(void* ptr, void* data);
+static void free_shape(cpShape* shape, void* data);
+static void free_constraint(cpConstraint* constraint, void* data);
+static void free_body(cpBody* body, void* data);
+static void remove_shape(cpSpace* space, void* key, void* data);
+static void remove_constraint(cpSpace* space, void* key, void* data);
+static void remove_body(cpSpace* space, void* key, void* data);
+static void body_free(cpBody* body);
+static cpVect shape_velocity(cpShape* shape);
+static cpBool shape_pair_reject(cpShape* a, cpShape* b);
+static void copy_shape(void* shape, void* data);
+static cpSpatialIndex* broadphase_create(physicsBroadphase broadphase, cpFloat cell_size, int expected_count, cpSpatialIndex* static_index);
+static double benchmark_scene(const benchmark_scene_t* scene, physicsBroadphase broadphase, cpFloat* max_speed);
+static void fill_world_scene(cpSpace* space, physicsWorld* world, cpFloat width);
+static void solver_dispatch(cpSpace* space, cpHastySpaceWorkFunction work, unsigned long worker_count, void* data);
+static void solver_job(void* data);
+static unsigned int pin_float_control();
+static void restore_float_control(unsigned int control);
+static unsigned long long phase_clock();
+static void run_query_batch(cpSpace* space, const query_job_t* batch, int count, job_system_t* jobs);
+static void query_job(void* data);
+static cpFloat raycast_shape(void* ray, void* shape, void* data);
+static cpCollisionID overlap_shape(void* result, void* shape, cpCollisionID id, void* data);
+static void region_job(void* data);
+static int world_region_of(physicsWorld* world, cpFloat x);
+static void world_migrate(physicsWorld* world);
+static void world_update_ghosts(physicsWorld* world);
+static void ghost_update_position(cpBody* body, cpFloat dt);
+static void ghost_follow(physicsWorld* world, physicsGhost* ghost);
+static cpBool ghost_equal(const void* key, const void* ghost);
+static void* ghost_create(const void* key, void* data);
+static cpShape* ghost_copy_shape(cpBody* body, const cpShape* shape);
+static cpBool ghost_expire(void* ghost, void* data);
+static void ghost_free(void* ghost, void* data);
+///Allocator Functions
+///Allocate all physics memory (spaces, bodies, shapes, contacts) from a heap, so it is tracked and pooled, or from the CRT if NULL
+///Set before creating the first space and keep until the last is destroyed
+void physicsSetHeap(heap_t* heap)
+{
+	cpAllocator allocator =
+	{
+		.callocFunc = physics_calloc,
+		.reallocFunc = physics_realloc,
+		.freeFunc = physics_free,
+		.data = heap,
+	};
+	cpSetAllocator(heap ? &allocator : NULL);
+}
+
 ///Space Functions
-///Return an allocated physics space
+///Return an allocated physics space solved on the calling thread
 cpSpace* physicsSpaceCreate()
 {
-	cpSpace* space = cpSpaceNew();
+	return physicsSpaceCreateThreaded(1, NULL);
+}
+///Return an allocated physics space whose contact and constraint solver is split across threads workers, the caller included
+///Chipmunk only wakes the workers on steps with more than 50 contacts and constraints
+///Workers run as jobs on jobs, sharing its threads with everything else, or on threads of the space's own if jobs is NULL
+///The default solver splits iterations between at most 2 workers, so only 1 is deterministic; see physicsSpaceSetColoredSolver()
+cpSpace* physicsSpaceCreateThreaded(unsigned long threads, job_system_t* jobs)
+{
+	cpSpace* space = cpHastySpaceNew();
+	cpBBTreeSetPairRejectFunc(space->dynamicShapes, (cpBBTreePairRejectFunc)shape_pair_reject);
+	if (jobs)
+	{
+		cpHastySpaceSetDispatch(space, solver_dispatch, jobs);
+	}
+	cpHastySpaceSetThreads(space, threads);
 	return space;
 }
-///Destroy and free a passed in physics space
+///Solve contacts and constraints in colors that share no bodies, each color split across the space's workers
+///Scales to 16 workers with jobs, and steps identically whatever the worker count
+void physicsSpaceSetColoredSolver(cpSpace* space, cpBool colored)
+{
+	cpHastySpaceSetColoredSolver(space, colored);
+}
+///Step bit-identically on every peer and replay given the same build, inputs and steps, for lockstep and replay files
+///Forces the colored solver, so the worker count doesn't matter, and pins rounding and denormal handling on every
+///thread that steps the space, which other code such as drivers may have changed
+void physicsSpaceSetDeterministic(cpSpace* space, cpBool deterministic)
+{
+	cpHastySpaceSetDeterministic(space, deterministic);
+}
+///Switch the spatial index a space finds colliding shape pairs with, moving the shapes already in it
+///The hash uses cell size, about the size of a typical shape, and expected count, roughly the number of shapes, to size
+///its table; the tree and sweep ignore both
+void physicsSpaceSetBroadphase(cpSpace* space, physicsBroadphase broadphase, cpFloat cell_size, int expected_count)
+{
+	cpSpatialIndex* static_shapes = broadphase_create(broadphase, cell_size, expected_count, NULL);
+	cpSpatialIndex* dynamic_shapes = broadphase_create(broadphase, cell_size, expected_count, static_shapes);
+
+	cpSpatialIndexEach(space->staticShapes, copy_shape, static_shapes);
+	cpSpatialIndexEach(space->dynamicShapes, copy_shape, dynamic_shapes);
+
+	cpSpatialIndexFree(space->staticShapes);
+	cpSpatialIndexFree(space->dynamicShapes);
+
+	space->staticShapes = static_shapes;
+	space->dynamicShapes = dynamic_shapes;
+}
+///Spend up to budget_us microseconds improving a tree broadphase with rotations, keeping queries from slowing down as
+///shapes that move far end up badly placed in it; call between steps, such as once per frame on a long running server
+///Returns the rotations made, which stay near zero on a healthy tree; other broadphases don't degrade and return zero
+int physicsSpaceOptimizeBroadphase(cpSpace* space, int budget_us)
+{
+	uint64_t start = timer_get_ticks();
+	int rotations = 0;
+	for (;;)
+	{
+		int made = cpBBTreeOptimizeIncremental(space->dynamicShapes, k_optimize_passes_per_check);
+		made += cpBBTreeOptimizeIncremental(space->staticShapes, k_optimize_passes_per_check);
+		rotations += made;
+
+		//a round without rotations means the paths it sampled are settled, so the rest are likely too
+		if (made == 0 || timer_ticks_to_us(timer_get_ticks() - start) >= (uint64_t)budget_us)
+		{
+			break;
+		}
+	}
+	return rotations;
+}
+///Return a broadphase's name, as printed by the benchmark
+const char* physicsBroadphaseGetName(physicsBroadphase broadphase)
+{
+	return s_broadphase_names[broadphase];
+}
+///Add the timer ticks each phase of every step of a space takes to ticks, which holds k_physics_phase_count counts,
+///or pass NULL to stop; reading the timer costs tens of nanoseconds per phase
+void physicsSpaceSetPhaseTimes(cpSpace* space, uint64_t* ticks)
+{
+	cpHastySpaceSetPhaseTimer(space, phase_clock, (unsigned long long*)ticks);
+}
+///Return the name of a phase of a step, for reports
+const char* physicsPhaseGetName(physicsPhase phase)
+{
+	return s_phase_names[phase];
+}
+///Time every broadphase stepping scenes like ours and print milliseconds per step to the debug log
+///Returns zero on success
+int physicsBenchmarkBroadphases(heap_t* heap)
+{
+	const benchmark_scene_t scenes[] =
+	{
+		{ .name = "debris", .count = 3000, .min_size = 0.2, .max_size = 0.3, .width = 80.0, .height = 80.0, .cell_size = 0.6 },
+		{ .name = "mixed", .count = 1500, .min_size = 0.2, .max_size = 6.0, .width = 150.0, .height = 150.0, .cell_size = 2.0 },
+		{ .name = "strip", .count = 1000, .min_size = 0.5, .max_size = 1.0, .width = 2000.0, .height = 4.0, .cell_size = 2.0 },
+	};
+
+	physicsSetHeap(heap);
+	//the fastest body still moving at the end shows whether a pile settles, which precision can change
+	debug_print(k_print_info, "Broadphase benchmark in %s precision, ms per step over %d steps and fastest body left:\n",
+		CP_USE_DOUBLES ? "double" : "single", k_benchmark_steps);
+	for (int i = 0; i < _countof(scenes); ++i)
+	{
+		for (int broadphase = 0; broadphase < k_physics_broadphase_count; ++broadphase)
+		{
+			cpFloat max_speed;
+			double ms = benchmark_scene(&scenes[i], broadphase, &max_speed);
+			debug_print(k_print_info, "  %-8s %5d shapes  %-6s %8.3f %8.4f m/s\n", scenes[i].name, scenes[i].count, s_broadphase_names[broadphase], ms, (double)max_speed);
+		}
+	}
+	physicsSetHeap(NULL);
+	return 0;
+}
+///Time a strip of bodies as one space and as a world of a region per thread, printing milliseconds per step to the debug log
+///Returns zero on success
+int physicsBenchmarkWorld(heap_t* heap, job_system_t* jobs)
+{
+	const cpFloat width = 2000.0f;
+	int region_count = __min(job_system_get_worker_count(jobs) + 1, k_max_world_regions);
+
+	physicsSetHeap(heap);
+	cpSpace* space = physicsSpaceCreate();
+	fill_world_scene(space, NULL, width);
+	physicsWorld* world = physicsWorldCreate(region_count, -0.5f * width, width / region_count, 2.0f, jobs);
+	fill_world_scene(NULL, world, width);
+
+	for (int i = 0; i < k_benchmark_warmup_steps; ++i)
+	{
+		physicsSpaceStep(space, 1.0f / 60.0f);
+		physicsWorldStep(world, 1.0f / 60.0f);
+	}
+	uint64_t start = timer_get_ticks();
+	for (int i = 0; i < k_benchmark_steps; ++i)
+	{
+		physicsSpaceStep(space, 1.0f / 60.0f);
+	}
+	double space_ms = timer_ticks_to_us(timer_get_ticks() - start) * 0.001 / k_benchmark_steps;
+	int migrations = 0;
+	start = timer_get_ticks();
+	for (int i = 0; i < k_benchmark_steps; ++i)
+	{
+		physicsWorldStep(world, 1.0f / 60.0f);
+		migrations += physicsWorldGetMigrationCount(world);
+	}
+	double world_ms = timer_ticks_to_us(timer_get_ticks() - start) * 0.001 / k_benchmark_steps;
+
+	debug_print(k_print_info, "World benchmark, %d bodies over %.0f m, ms per step over %d steps:\n", k_benchmark_world_bodies, (double)width, k_benchmark_steps);
+	debug_print(k_print_info, "  one space  %8.3f\n", space_ms);
+	debug_print(k_print_info, "  %2d regions %8.3f  %.2fx  %d migrations  %d ghosts\n",
+		region_count, world_ms, space_ms / world_ms, migrations, physicsWorldGetGhostCount(world));
+
+	physicsWorldDestroy(world);
+	physicsSpaceDestroy(space);
+	physicsSetHeap(NULL);
+	return 0;
+}
+///Stop the worker threads of, destroy and free a passed in physics space, with every body, shape and constraint still in it
 void physicsSpaceDestroy(cpSpace* space)
 {
-	cpSpaceFree(space);
+	//removing a sleeping body wakes it, which nobody needs to hear about now
+	cpSpaceSetSleepCallback(space, NULL, NULL);
+	//iterating locks the space, so removal waits for the post step callbacks its unlock runs
+	cpSpaceEachShape(space, free_shape, space);
+	cpSpaceEachConstraint(space, free_constraint, space);
+	cpSpaceEachBody(space, free_body, space);
+	cpHastySpaceFree(space);
+}
+///Advance a physics space by dt seconds
+///Afterwards storage is grown past what this step used, so steps with a similar load don't allocate
+void physicsSpaceStep(cpSpace* space, cpFloat dt)
+{
+	if (cpHastySpaceGetDeterministic(space))
+	{
+		unsigned int control = pin_float_control();
+		cpHastySpaceStep(space, dt);
+		restore_float_control(control);
+	}
+	else
+	{
+		cpHastySpaceStep(space, dt);
+	}
+
+	int contacts = 0;
+	for (int i = 0; i < space->arbiters->num; ++i)
+	{
+		contacts += ((cpArbiter*)space->arbiters->arr[i])->count;
+	}
+	int pairs = space->arbiters->num;
+	cpHastySpaceReserve(space, pairs + pairs * k_reserve_headroom_percent / 100, contacts + contacts * k_reserve_headroom_percent / 100);
+}
+///Preallocate for steps with up to contacting_pairs touching shape pairs and contacts contact points, e.g. before spawning a pile
+///of bodies; steps grow storage as needed anyway, this only keeps the growth out of them
+void physicsSpaceReserve(cpSpace* space, int contacting_pairs, int contacts)
+{
+	cpHastySpaceReserve(space, contacting_pairs, contacts);
+}
+///Save body states and cached contacts into a buffer of size bytes, for rolling back to; nothing is allocated
+///Returns the bytes the snapshot needs, which are only written if they fit, so size a buffer with a NULL one first
+size_t physicsSpaceSaveSnapshot(cpSpace* space, void* buffer, size_t size)
+{
+	return cpSpaceSaveSnapshot(space, buffer, size);
+}
+///Roll a space back to a snapshot without recreating anything; bodies and shapes must be the ones it was saved with
+///Steps from it match the original ones on a deterministic space with sleeping disabled
+///Returns false if the snapshot doesn't fit the space, leaving the space as it was
+cpBool physicsSpaceRestoreSnapshot(cpSpace* space, const void* buffer, size_t size)
+{
+	return cpSpaceRestoreSnapshot(space, buffer, size);
 }
 ///Set the gravity of a physics space
 void physicsSpaceSetGravity(cpSpace* space, cpVect gravity)
@@ -25,6 +416,75 @@ cpBody* physicsSpaceGetStaticBody(cpSpace* space)
 {
 	return cpSpaceGetStaticBody(space);
 }
+///Put bodies to sleep once they and everything touching them have rested for seconds, or INFINITY to never sleep
+void physicsSpaceSetSleepTime(cpSpace* space, cpFloat seconds)
+{
+	cpSpaceSetSleepTimeThreshold(space, seconds);
+}
+///Set the speed under which a body counts as resting, or 0 to derive it from gravity
+void physicsSpaceSetIdleSpeed(cpSpace* space, cpFloat speed)
+{
+	cpSpaceSetIdleSpeedThreshold(space, speed);
+}
+///Call func as each dynamic body falls asleep or wakes up, or NULL to stop; bodies fall asleep during physicsSpaceStep
+///and wake during it or whenever they are touched, so func must not add or remove anything from the space
+void physicsSpaceSetSleepCallback(cpSpace* space, cpSpaceSleepFunc func, void* data)
+{
+	cpSpaceSetSleepCallback(space, func, data);
+}
+///Return the space's awake dynamic and kinematic bodies; static and sleeping bodies are left out
+///The array is the space's own and changes as bodies are added, removed, fall asleep or wake
+cpBody** physicsSpaceGetAwakeBodies(cpSpace* space, int* count)
+{
+	*count = space->dynamicBodies->num;
+	return (cpBody**)space->dynamicBodies->arr;
+}
+
+///Query Functions
+///Write the nearest hit of each ray with a shape that isn't a sensor to hits, a miss leaving a NULL shape, the ray's end and alpha 1
+///Queries are split across jobs when given any, so call without jobs from inside a job; never while the space steps
+void physicsSpaceRaycastBatch(cpSpace* space, const physicsRay* rays, int count, cpSegmentQueryInfo* hits, job_system_t* jobs)
+{
+	query_job_t batch = { .space = space, .rays = rays, .hits = hits };
+	run_query_batch(space, &batch, count, jobs);
+}
+///Write the shapes whose bounding boxes overlap each box to shapes, box i's from shapes[i * max_shapes_per_box]
+///Each box's count of overlapping shapes goes to shape_counts, and may exceed max_shapes_per_box when some didn't fit
+///Queries are split across jobs when given any, so call without jobs from inside a job; never while the space steps
+void physicsSpaceOverlapBatch(cpSpace* space, const physicsOverlap* boxes, int count, cpShape** shapes, int max_shapes_per_box, int* shape_counts, job_system_t* jobs)
+{
+	query_job_t batch = { .space = space, .boxes = boxes, .shapes = shapes, .max_shapes_per_box = max_shapes_per_box, .shape_counts = shape_counts };
+	run_query_batch(space, &batch, count, jobs);
+}
+
+///Body Pool Functions
+///Return an empty pool of rigidbodies, allocated bodies_per_block at a time in blocks that never move
+///Bodies are handed out in the order they are created, reusing destroyed ones first; create them on one thread at a time
+physicsBodyPool* physicsBodyPoolCreate(int bodies_per_block)
+{
+	physicsBodyPool* pool = cpcalloc(1, sizeof(physicsBodyPool));
+	pool->bodies_per_block = bodies_per_block > 0 ? bodies_per_block : 1;
+	pool->blocks = cpArrayNew(0);
+	pool->free = cpArrayNew(0);
+	return pool;
+}
+///Free a pool's memory; its bodies must have been destroyed, or their spaces destroyed with them, first
+void physicsBodyPoolDestroy(physicsBodyPool* pool)
+{
+	cpAssertWarn(pool->count == 0, "Destroying a body pool that %d bodies still use.", pool->count);
+	for (int i = 0; i < pool->blocks->num; ++i)
+	{
+		cpfree(pool->blocks->arr[i]);
+	}
+	cpArrayFree(pool->blocks);
+	cpArrayFree(pool->free);
+	cpfree(pool);
+}
+///Return the number of bodies taken from a pool and not yet destroyed
+int physicsBodyPoolGetCount(physicsBodyPool* pool)
+{
+	return pool->count;
+}
 
 ///Rigidbody Functions
 ///Return an allocated rigidbody of dynamic kinematic or static type with mass moment a position and rotation
@@ -41,10 +501,45 @@ cpBody* physicsRigidBodyCreate(cpSpace* space, cpBodyType type, cpFloat mass, cp
 	}
 	return body;
 }
-///Destroy and free a rigidbody
+///Return a rigidbody like physicsRigidBodyCreate(), its memory taken from a pool
+///Bodies created one after another from a pool sit next to each other, so stepping and syncing them walks memory in order
+cpBody* physicsRigidBodyCreatePooled(cpSpace* space, physicsBodyPool* pool, cpBodyType type, cpFloat mass, cpFloat moment, cpVect pos, cpFloat angle)
+{
+	cpBody* body;
+	if (pool->free->num)
+	{
+		body = cpArrayPop(pool->free);
+	}
+	else
+	{
+		if (!pool->blocks->num || pool->used == pool->bodies_per_block)
+		{
+			cpArrayPush(pool->blocks, cpcalloc(pool->bodies_per_block, sizeof(cpBody)));
+			pool->used = 0;
+		}
+		cpBody* block = pool->blocks->arr[pool->blocks->num - 1];
+		body = &block[pool->used++];
+	}
+	++pool->count;
+
+	memset(body, 0, sizeof(*body));
+	cpBodyInit(body, 0.0f, 0.0f);
+	body->pool = pool;
+	cpSpaceAddBody(space, body);
+	cpBodySetType(body, type);
+	cpBodySetPosition(body, pos);
+	cpBodySetAngle(body, angle/R2D);
+	if (cpBodyGetType(body) == CP_BODY_TYPE_DYNAMIC)
+	{
+		cpBodySetMass(body, mass);
+		cpBodySetMoment(body, moment);
+	}
+	return body;
+}
+///Destroy and free a rigidbody, or give it back to the pool it was taken from
 void physicsRigidBodyDestroy(cpBody* body)
 {
-	cpBodyFree(body);
+	body_free(body);
 }
 
 ///Absoulutely set the velocity of a rigidbody, used for player movement with kinematic bodies
@@ -53,6 +548,27 @@ void physicsRigidBodySetVelocity(cpBody* body, cpVect velocity)
 	cpBodySetVelocity(body, velocity);
 }
 
+///Attach game data to a rigidbody, such as an index into an array of per body state
+void physicsRigidBodySetUserData(cpBody* body, cpDataPointer data)
+{
+	cpBodySetUserData(body, data);
+}
+///Stop a fast rigidbody passing through thin shapes between steps by sweeping its motion as a circle of radius, somewhat
+///less than its shapes reach from its center, or pass a negative radius to step it as normal again
+///Only steps that move it further than the radius pay for the sweep, so a low step rate stays cheap for everything else
+void physicsRigidBodySetContinuous(cpBody* body, cpFloat radius)
+{
+	if (radius >= 0.0f)
+	{
+		cpBodySetSweepRadius(body, radius);
+		cpBodySetPositionUpdateFunc(body, cpBodyUpdatePositionSwept);
+	}
+	else
+	{
+		cpBodySetPositionUpdateFunc(body, cpBodyUpdatePosition);
+	}
+}
+
 ///Shape Functions
 ///Return an allocated circle shape attached to a rigidbody in a space with a radius and friction coeff
 cpShape* physicsCircleCreate(cpSpace* space, cpBody* body, cpFloat radius, cpFloat friction)
@@ -68,8 +584,721 @@ cpShape* physicsBoxCreate(cpSpace* space, cpBody* body, cpFloat width, cpFloat h
 	cpShapeSetFriction(box, friction);
 	return box;
 }
+///Put a shape in the categories, a bitmask of layers, and collide it only with shapes in the layers of mask whose
+///own masks hold one of its categories; shapes sharing a group other than CP_NO_GROUP never collide
+///The tree broadphase never pairs shapes kept apart, so they cost nothing after they first overlap; the shape is
+///reinserted into its space's broadphase to pair it again under the new filter, so don't call while the space steps
+///A world's ghosts keep the filter their shape had when they appeared
+void physicsShapeSetFilter(cpShape* shape, cpGroup group, cpBitmask categories, cpBitmask mask)
+{
+	cpShapeSetFilter(shape, cpShapeFilterNew(group, categories, mask));
+
+	cpSpace* space = shape->space;
+	if (space)
+	{
+		cpAssertHard(!space->locked, "Shape filters can't change while the space steps or runs a query callback");
+		cpSpatialIndex* index = cpSpatialIndexContains(space->dynamicShapes, shape, shape->hashid) ? space->dynamicShapes : space->staticShapes;
+		cpSpatialIndexRemove(index, shape, shape->hashid);
+		cpSpatialIndexInsert(index, shape, shape->hashid);
+	}
+}
 ///Destroy and free a shape
 void physicsShapeDestroy(cpShape* shape)
 {
 	cpShapeFree(shape);
-}
\ No newline at end of file
+}
+
+///Constraint Functions
+///Return an allocated pivot joint in a space holding two rigidbodies together at a point in world coordinates
+cpConstraint* physicsPivotJointCreate(cpSpace* space, cpBody* a, cpBody* b, cpVect pivot)
+{
+	return cpSpaceAddConstraint(space, cpPivotJointNew(a, b, pivot));
+}
+
+///World Functions
+///Return a world of region_count regions along x, each region_width wide from origin_x, the first and last reaching out
+///to infinity, stepped as jobs on jobs or one after another without
+///Each region is a space of its own: configure it through physicsWorldGetRegion() and create bodies in the space
+///physicsWorldGetSpaceAt() gives for their position. Static shapes near a boundary go into every region they reach
+///Bodies within ghost_margin of a neighbouring region, counting their shapes' bounds, get a kinematic ghost there, so
+///they push and are pushed by what is across the boundary; for stacks reaching over a boundary, at least the largest
+///shape's size. Ghosts lag their owners' momentum by one step, and the pushing is one way on each side
+///A ghost turns static while its owner rests, so piles along a boundary can still fall asleep
+physicsWorld* physicsWorldCreate(int region_count, cpFloat origin_x, cpFloat region_width, cpFloat ghost_margin, job_system_t* jobs)
+{
+	physicsWorld* world = cpcalloc(1, sizeof(physicsWorld));
+	world->jobs = jobs;
+	world->region_count = __max(1, __min(region_count, k_max_world_regions));
+	world->origin_x = origin_x;
+	world->region_width = region_width;
+	world->ghost_margin = __min(ghost_margin, region_width);
+	for (int i = 0; i < world->region_count; ++i)
+	{
+		world->regions[i] = physicsSpaceCreate();
+	}
+	world->ghosts = cpHashSetNew(0, ghost_equal);
+	world->leaving = cpArrayNew(0);
+	world->shapes = cpArrayNew(0);
+	return world;
+}
+///Destroy a world, its regions and everything in them
+void physicsWorldDestroy(physicsWorld* world)
+{
+	//the ghosts' bodies and shapes go with their regions
+	cpHashSetEach(world->ghosts, ghost_free, NULL);
+	cpHashSetFree(world->ghosts);
+	for (int i = 0; i < world->region_count; ++i)
+	{
+		physicsSpaceDestroy(world->regions[i]);
+	}
+	cpArrayFree(world->leaving);
+	cpArrayFree(world->shapes);
+	cpfree(world);
+}
+///Return the number of regions a world was divided into
+int physicsWorldGetRegionCount(physicsWorld* world)
+{
+	return world->region_count;
+}
+///Return the space of a region, counting from the lowest x
+cpSpace* physicsWorldGetRegion(physicsWorld* world, int region)
+{
+	return world->regions[region];
+}
+///Return the space of the region a position is in, to create a body at that position in
+cpSpace* physicsWorldGetSpaceAt(physicsWorld* world, cpVect pos)
+{
+	return world->regions[world_region_of(world, pos.x)];
+}
+///Step every region of a world by dt seconds in parallel, then move bodies whose centers crossed into another region
+///over to it and bring the ghosts up to date
+///Bodies held by constraints stay in the region they were created in, as the constraint can't span two spaces
+void physicsWorldStep(physicsWorld* world, cpFloat dt)
+{
+	region_job_t job_data[k_max_world_regions];
+	job_counter_t counter = { 0 };
+	for (int i = 0; i < world->region_count; ++i)
+	{
+		job_data[i] = (region_job_t){ .space = world->regions[i], .dt = dt };
+		if (world->jobs && i > 0)
+		{
+			job_run(world->jobs, region_job, &job_data[i], &counter);
+		}
+	}
+	region_job(&job_data[0]);
+	if (world->jobs)
+	{
+		job_wait(world->jobs, &counter);
+	}
+	else
+	{
+		for (int i = 1; i < world->region_count; ++i)
+		{
+			region_job(&job_data[i]);
+		}
+	}
+
+	world->dt = dt;
+	world_migrate(world);
+	world_update_ghosts(world);
+}
+///Return the number of bodies the last step moved from one region to another
+int physicsWorldGetMigrationCount(physicsWorld* world)
+{
+	return world->migration_count;
+}
+///Return the number of ghosts standing in for bodies near a boundary
+int physicsWorldGetGhostCount(physicsWorld* world)
+{
+	return cpHashSetCount(world->ghosts);
+}
+///Return whether a body is a world's ghost of a body in another region rather than one of the game's
+///Moving ghosts show up among a region's awake bodies and resting ones among its static bodies; they carry no user data
+cpBool physicsBodyIsGhost(const cpBody* body)
+{
+	return body->position_func == ghost_update_position;
+}
+
+///Velocity the tree uses to grow a moving shape's bounds in its direction of travel, as cpSpaceNew() sets up
+static cpVect shape_velocity(cpShape* shape)
+{
+	return shape->body->v;
+}
+
+///Never pair shapes on one body or ones their filters keep apart, the checks of chipmunk's QueryReject() that can't
+///change while both shapes stay in the tree
+static cpBool shape_pair_reject(cpShape* a, cpShape* b)
+{
+	return a->body == b->body || cpShapeFilterReject(a->filter, b->filter);
+}
+
+static void copy_shape(void* shape, void* data)
+{
+	cpSpatialIndexInsert(data, shape, ((cpShape*)shape)->hashid);
+}
+
+static cpSpatialIndex* broadphase_create(physicsBroadphase broadphase, cpFloat cell_size, int expected_count, cpSpatialIndex* static_index)
+{
+	cpSpatialIndex* index = NULL;
+	switch (broadphase)
+	{
+	case k_physics_broadphase_hash:
+		//chipmunk suggests about ten times as many cells as shapes
+		index = cpSpaceHashNew(cell_size, __max(expected_count * 10, 1000), (cpSpatialIndexBBFunc)cpShapeGetBB, static_index);
+		s_space_hash_class = index->klass;
+		break;
+	case k_physics_broadphase_sweep:
+		index = cpSweep1DNew((cpSpatialIndexBBFunc)cpShapeGetBB, static_index);
+		break;
+	default:
+		index = cpBBTreeNew((cpSpatialIndexBBFunc)cpShapeGetBB, static_index);
+		if (static_index)
+		{
+			cpBBTreeSetVelocityFunc(index, (cpBBTreeVelocityFunc)shape_velocity);
+			cpBBTreeSetPairRejectFunc(index, (cpBBTreePairRejectFunc)shape_pair_reject);
+		}
+		break;
+	}
+	return index;
+}
+
+///Build a scene of random boxes and circles falling onto a floor and time stepping it, in milliseconds per step
+///Also finds the speed of the fastest body awake after the last step
+static double benchmark_scene(const benchmark_scene_t* scene, physicsBroadphase broadphase, cpFloat* max_speed)
+{
+	cpSpace* space = physicsSpaceCreate();
+	physicsSpaceSetGravity(space, cpv(0.0f, -10.0f));
+	physicsSpaceSetBroadphase(space, broadphase, scene->cell_size, scene->count);
+
+	cpBody* floor = physicsRigidBodyCreate(space, CP_BODY_TYPE_STATIC, 0.0f, 0.0f, cpv(0.0f, -1.0f), 0.0f);
+	physicsBoxCreate(space, floor, scene->width + 20.0f, 2.0f, 0.0f, 1.0f);
+
+	//the same seed gives every broadphase the same scene
+	uint32_t seed = 12345;
+	for (int i = 0; i < scene->count; ++i)
+	{
+		cpFloat r[3];
+		for (int j = 0; j < _countof(r); ++j)
+		{
+			seed = seed * 1664525 + 1013904223;
+			r[j] = (seed >> 8) / (cpFloat)(1 << 24);
+		}
+		cpFloat size = scene->min_size + (scene->max_size - scene->min_size) * r[0];
+		cpVect pos = cpv((r[1] - 0.5f) * scene->width, 1.0f + r[2] * scene->height);
+		cpBody* body = physicsRigidBodyCreate(space, CP_BODY_TYPE_DYNAMIC, size * size, size * size, pos, 0.0f);
+		if (i & 1)
+		{
+			physicsCircleCreate(space, body, size, 0.7f);
+		}
+		else
+		{
+			physicsBoxCreate(space, body, 2.0f * size, 2.0f * size, 0.0f, 0.7f);
+		}
+	}
+
+	for (int i = 0; i < k_benchmark_warmup_steps; ++i)
+	{
+		physicsSpaceStep(space, 1.0f / 60.0f);
+	}
+	uint64_t start = timer_get_ticks();
+	for (int i = 0; i < k_benchmark_steps; ++i)
+	{
+		physicsSpaceStep(space, 1.0f / 60.0f);
+	}
+	double ms = timer_ticks_to_us(timer_get_ticks() - start) * 0.001 / k_benchmark_steps;
+
+	*max_speed = 0.0f;
+	for (int i = 0; i < space->dynamicBodies->num; ++i)
+	{
+		cpBody* body = space->dynamicBodies->arr[i];
+		*max_speed = cpfmax(*max_speed, cpvlength(body->v));
+	}
+
+	physicsSpaceDestroy(space);
+	return ms;
+}
+
+///Drop the world benchmark's bodies onto a floor in a space, or into the regions of a world their positions fall in
+///The same seed gives both the same bodies, and every region the whole floor
+static void fill_world_scene(cpSpace* space, physicsWorld* world, cpFloat width)
+{
+	int space_count = world ? physicsWorldGetRegionCount(world) : 1;
+	for (int i = 0; i < space_count; ++i)
+	{
+		cpSpace* s = world ? physicsWorldGetRegion(world, i) : space;
+		physicsSpaceSetGravity(s, cpv(0.0f, -10.0f));
+		cpBody* floor = physicsRigidBodyCreate(s, CP_BODY_TYPE_STATIC, 0.0f, 0.0f, cpv(0.0f, -1.0f), 0.0f);
+		physicsBoxCreate(s, floor, width + 20.0f, 2.0f, 0.0f, 1.0f);
+	}
+
+	uint32_t seed = 12345;
+	for (int i = 0; i < k_benchmark_world_bodies; ++i)
+	{
+		cpFloat r[3];
+		for (int j = 0; j < _countof(r); ++j)
+		{
+			seed = seed * 1664525 + 1013904223;
+			r[j] = (seed >> 8) / (cpFloat)(1 << 24);
+		}
+		cpFloat size = 0.3f + 0.4f * r[0];
+		cpVect pos = cpv((r[1] - 0.5f) * width, 1.0f + r[2] * 6.0f);
+		cpSpace* s = world ? physicsWorldGetSpaceAt(world, pos) : space;
+		cpBody* body = physicsRigidBodyCreate(s, CP_BODY_TYPE_DYNAMIC, size * size, size * size, pos, 0.0f);
+		if (i & 1)
+		{
+			physicsCircleCreate(s, body, size, 0.7f);
+		}
+		else
+		{
+			physicsBoxCreate(s, body, 2.0f * size, 2.0f * size, 0.0f, 0.7f);
+		}
+	}
+}
+
+///Run worker 0 on the stepping thread and the rest as jobs, waiting for all of them
+static void solver_dispatch(cpSpace* space, cpHastySpaceWorkFunction work, unsigned long worker_count, void* data)
+{
+	job_system_t* jobs = data;
+	solver_job_t job_data[k_max_solver_workers];
+	job_counter_t counter = { 0 };
+	for (unsigned long i = 1; i < worker_count && i < k_max_solver_workers; ++i)
+	{
+		job_data[i] = (solver_job_t){ .space = space, .work = work, .worker = i, .worker_count = worker_count };
+		job_run(jobs, solver_job, &job_data[i], &counter);
+	}
+	work(space, 0, worker_count);
+	job_wait(jobs, &counter);
+}
+
+static void solver_job(void* data)
+{
+	solver_job_t* job = data;
+	if (cpHastySpaceGetDeterministic(job->space))
+	{
+		//jobs run on threads shared with everything else, so pin for this job alone
+		unsigned int control = pin_float_control();
+		job->work(job->space, job->worker, job->worker_count);
+		restore_float_control(control);
+	}
+	else
+	{
+		job->work(job->space, job->worker, job->worker_count);
+	}
+}
+
+static unsigned int pin_float_control()
+{
+	unsigned int control;
+	_controlfp_s(&control, 0, 0);
+	unsigned int pinned;
+	_controlfp_s(&pinned, _RC_NEAR | _DN_SAVE, _MCW_RC | _MCW_DN);
+	return control;
+}
+
+static void restore_float_control(unsigned int control)
+{
+	unsigned int restored;
+	_controlfp_s(&restored, control, _MCW_RC | _MCW_DN);
+}
+
+///Split a batch of queries into slices run as jobs, the calling thread taking the first
+///Chipmunk's own query functions lock the space, which isn't atomic, so slices search the spatial indices directly
+static void run_query_batch(cpSpace* space, const query_job_t* batch, int count, job_system_t* jobs)
+{
+	int job_count = 1;
+	if (jobs &&
+		space->staticShapes->klass != s_space_hash_class &&
+		space->dynamicShapes->klass != s_space_hash_class)
+	{
+		job_count = __max(1, __min(k_max_query_jobs, count / k_min_queries_per_job));
+	}
+	int per_job = (count + job_count - 1) / job_count;
+
+	query_job_t job_data[k_max_query_jobs];
+	job_counter_t counter = { 0 };
+	for (int i = job_count - 1; i >= 0; --i)
+	{
+		job_data[i] = *batch;
+		job_data[i].first = i * per_job;
+		job_data[i].count = __max(0, __min(per_job, count - job_data[i].first));
+		if (i > 0)
+		{
+			job_run(jobs, query_job, &job_data[i], &counter);
+		}
+	}
+	query_job(&job_data[0]);
+	if (job_count > 1)
+	{
+		job_wait(jobs, &counter);
+	}
+}
+
+static void query_job(void* data)
+{
+	query_job_t* job = data;
+	cpSpace* space = job->space;
+	for (int i = job->first; i < job->first + job->count; ++i)
+	{
+		if (job->rays)
+		{
+			//static shapes first, so the dynamic search can stop at the nearest static hit
+			const physicsRay* ray = &job->rays[i];
+			cpSegmentQueryInfo* hit = &job->hits[i];
+			*hit = (cpSegmentQueryInfo){ NULL, ray->end, cpvzero, 1.0f };
+			cpSpatialIndexSegmentQuery(space->staticShapes, (void*)ray, ray->start, ray->end, 1.0f, raycast_shape, hit);
+			cpSpatialIndexSegmentQuery(space->dynamicShapes, (void*)ray, ray->start, ray->end, hit->alpha, raycast_shape, hit);
+		}
+		else
+		{
+			overlap_result_t result =
+			{
+				.box = &job->boxes[i],
+				.shapes = job->shapes + (size_t)i * job->max_shapes_per_box,
+				.max_count = job->max_shapes_per_box,
+			};
+			cpSpatialIndexQuery(space->dynamicShapes, &result, result.box->bb, overlap_shape, NULL);
+			cpSpatialIndexQuery(space->staticShapes, &result, result.box->bb, overlap_shape, NULL);
+			job->shape_counts[i] = result.count;
+		}
+	}
+}
+
+static cpFloat raycast_shape(void* ray, void* shape, void* data)
+{
+	const physicsRay* query = ray;
+	cpShape* candidate = shape;
+	cpSegmentQueryInfo* hit = data;
+	cpSegmentQueryInfo info;
+	if (!cpShapeFilterReject(candidate->filter, query->filter) && !candidate->sensor &&
+		cpShapeSegmentQuery(candidate, query->start, query->end, query->radius, &info) &&
+		info.alpha < hit->alpha)
+	{
+		*hit = info;
+	}
+	return hit->alpha;
+}
+
+static cpCollisionID overlap_shape(void* result, void* shape, cpCollisionID id, void* data)
+{
+	overlap_result_t* overlap = result;
+	cpShape* candidate = shape;
+	if (!cpShapeFilterReject(candidate->filter, overlap->box->filter) && cpBBIntersects(overlap->box->bb, candidate->bb))
+	{
+		if (overlap->count < overlap->max_count)
+		{
+			overlap->shapes[overlap->count] = candidate;
+		}
+		overlap->count++;
+	}
+	return id;
+}
+
+static void* physics_calloc(size_t count, size_t size, void* data)
+{
+	char* block = heap_alloc(data, k_physics_alloc_header_size + count * size, 16);
+	*(size_t*)block = count * size;
+	memset(block + k_physics_alloc_header_size, 0, count * size);
+	return block + k_physics_alloc_header_size;
+}
+
+static void* physics_realloc(void* ptr, size_t size, void* data)
+{
+	char* block = heap_alloc(data, k_physics_alloc_header_size + size, 16);
+	*(size_t*)block = size;
+	if (ptr)
+	{
+		size_t old_size = *(size_t*)((char*)ptr - k_physics_alloc_header_size);
+		memcpy(block + k_physics_alloc_header_size, ptr, __min(old_size, size));
+		physics_free(ptr, data);
+	}
+	return block + k_physics_alloc_header_size;
+}
+
+static void physics_free(void* ptr, void* data)
+{
+	if (ptr)
+	{
+		heap_free(data, (char*)ptr - k_physics_alloc_header_size);
+	}
+}
+
+static void free_shape(cpShape* shape, void* data)
+{
+	cpSpaceAddPostStepCallback(data, remove_shape, shape, NULL);
+}
+
+static void free_constraint(cpConstraint* constraint, void* data)
+{
+	cpSpaceAddPostStepCallback(data, remove_constraint, constraint, NULL);
+}
+
+static void free_body(cpBody* body, void* data)
+{
+	cpSpaceAddPostStepCallback(data, remove_body, body, NULL);
+}
+
+static void remove_shape(cpSpace* space, void* key, void* data)
+{
+	cpSpaceRemoveShape(space, key);
+	cpShapeFree(key);
+}
+
+static void remove_constraint(cpSpace* space, void* key, void* data)
+{
+	cpSpaceRemoveConstraint(space, key);
+	cpConstraintFree(key);
+}
+
+static void remove_body(cpSpace* space, void* key, void* data)
+{
+	cpSpaceRemoveBody(space, key);
+	body_free(key);
+}
+
+static void body_free(cpBody* body)
+{
+	physicsBodyPool* pool = body->pool;
+	if (!pool)
+	{
+		cpBodyFree(body);
+		return;
+	}
+	cpBodyDestroy(body);
+	cpArrayPush(pool->free, body);
+	--pool->count;
+}
+
+static unsigned long long phase_clock()
+{
+	return timer_get_ticks();
+}
+
+static void region_job(void* data)
+{
+	region_job_t* job = data;
+	physicsSpaceStep(job->space, job->dt);
+}
+
+///Region whose strip holds x, the first and last taking everything beyond them
+static int world_region_of(physicsWorld* world, cpFloat x)
+{
+	cpFloat region = cpffloor((x - world->origin_x) / world->region_width);
+	if (region < 0.0f)
+	{
+		return 0;
+	}
+	return region >= world->region_count ? world->region_count - 1 : (int)region;
+}
+
+///Move every awake body whose center left its region into the space of the region it is now in, with its shapes
+static void world_migrate(physicsWorld* world)
+{
+	world->migration_count = 0;
+	for (int r = 0; r < world->region_count; ++r)
+	{
+		//bodies can't leave a space while its array of them is walked, so they are collected first
+		cpSpace* space = world->regions[r];
+		cpArray* bodies = space->dynamicBodies;
+		world->leaving->num = 0;
+		for (int i = 0; i < bodies->num; ++i)
+		{
+			cpBody* body = bodies->arr[i];
+			if (!physicsBodyIsGhost(body) && !body->constraintList && world_region_of(world, body->p.x) != r)
+			{
+				cpArrayPush(world->leaving, body);
+			}
+		}
+
+		for (int i = 0; i < world->leaving->num; ++i)
+		{
+			cpBody* body = world->leaving->arr[i];
+			cpSpace* target = world->regions[world_region_of(world, body->p.x)];
+			world->shapes->num = 0;
+			CP_BODY_FOREACH_SHAPE(body, shape)
+			{
+				cpArrayPush(world->shapes, shape);
+			}
+			for (int s = 0; s < world->shapes->num; ++s)
+			{
+				cpSpaceRemoveShape(space, world->shapes->arr[s]);
+			}
+			cpSpaceRemoveBody(space, body);
+			cpSpaceAddBody(target, body);
+			for (int s = 0; s < world->shapes->num; ++s)
+			{
+				cpSpaceAddShape(target, world->shapes->arr[s]);
+			}
+		}
+		world->migration_count += world->leaving->num;
+	}
+}
+
+///Give every awake body near a boundary a ghost across it, move the ghosts to their owners and drop those no longer needed
+static void world_update_ghosts(physicsWorld* world)
+{
+	++world->step;
+	for (int r = 0; r < world->region_count; ++r)
+	{
+		cpArray* bodies = world->regions[r]->dynamicBodies;
+		cpFloat low = world->origin_x + r * world->region_width;
+		cpFloat high = low + world->region_width;
+		for (int i = 0; i < bodies->num; ++i)
+		{
+			cpBody* body = bodies->arr[i];
+			if (physicsBodyIsGhost(body) || !body->shapeList)
+			{
+				continue;
+			}
+
+			cpBB bb = body->shapeList->bb;
+			CP_BODY_FOREACH_SHAPE(body, shape)
+			{
+				bb = cpBBMerge(bb, shape->bb);
+			}
+			for (int n = r - 1; n <= r + 1; n += 2)
+			{
+				cpBool near = n < r ? bb.l < low + world->ghost_margin : bb.r > high - world->ghost_margin;
+				if (n < 0 || n >= world->region_count || !near)
+				{
+					continue;
+				}
+
+				physicsGhost key = { .owner = body, .region = n };
+				physicsGhost* ghost = (physicsGhost*)cpHashSetInsert(world->ghosts, CP_HASH_PAIR(body, n), &key, ghost_create, world);
+				ghost_follow(world, ghost);
+				ghost->seen_step = world->step;
+			}
+		}
+	}
+	cpHashSetFilter(world->ghosts, ghost_expire, world);
+}
+
+///Ghosts are placed after each step by their owners; their velocity is only there for the contacts they make
+static void ghost_update_position(cpBody* body, cpFloat dt)
+{
+}
+
+///Move a ghost to its owner, or hold it still as a static body while its owner rests
+///Resting is judged by the owner's own energy against the threshold its space sleeps bodies under, as its idle time is
+///reset by anything kinematic touching it, which a ghost of its neighbour would be
+static void ghost_follow(physicsWorld* world, physicsGhost* ghost)
+{
+	//anything touching a kinematic body is kept awake, which would keep whole piles along a boundary from sleeping
+	cpBody* owner = ghost->owner;
+	cpSpace* space = cpBodyGetSpace(owner);
+	cpFloat idle_speed = space->idleSpeedThreshold ? space->idleSpeedThreshold : cpvlength(space->gravity) * world->dt;
+	if (cpBodyIsSleeping(owner) || cpBodyKineticEnergy(owner) <= owner->m * idle_speed * idle_speed)
+	{
+		if (cpBodyGetType(ghost->body) != CP_BODY_TYPE_STATIC)
+		{
+			cpBodySetType(ghost->body, CP_BODY_TYPE_STATIC);
+			cpSpaceReindexShapesForBody(cpBodyGetSpace(ghost->body), ghost->body);
+		}
+		return;
+	}
+
+	cpBodySetType(ghost->body, CP_BODY_TYPE_KINEMATIC);
+	cpBodySetPosition(ghost->body, owner->p);
+	cpBodySetAngle(ghost->body, owner->a);
+	cpBodySetVelocity(ghost->body, owner->v);
+	cpBodySetAngularVelocity(ghost->body, owner->w);
+}
+
+static cpBool ghost_equal(const void* key, const void* ghost)
+{
+	const physicsGhost* a = key;
+	const physicsGhost* b = ghost;
+	return a->owner == b->owner && a->region == b->region;
+}
+
+///Make the ghost of a key's owner in the key's region, with a copy of each of the owner's shapes
+static void* ghost_create(const void* key, void* data)
+{
+	const physicsGhost* k = key;
+	physicsWorld* world = data;
+	cpSpace* space = world->regions[k->region];
+	physicsGhost* ghost = cpcalloc(1, sizeof(physicsGhost));
+	ghost->owner = k->owner;
+	ghost->region = k->region;
+	ghost->body = cpSpaceAddBody(space, cpBodyNewKinematic());
+	cpBodySetPositionUpdateFunc(ghost->body, ghost_update_position);
+	cpBodySetPosition(ghost->body, k->owner->p);
+	cpBodySetAngle(ghost->body, k->owner->a);
+	CP_BODY_FOREACH_SHAPE(k->owner, shape)
+	{
+		cpSpaceAddShape(space, ghost_copy_shape(ghost->body, shape));
+	}
+	return ghost;
+}
+
+///Copy a shape's geometry and surface onto a ghost; the copy keeps no user data, so game callbacks can tell it apart
+static cpShape* ghost_copy_shape(cpBody* body, const cpShape* shape)
+{
+	cpShape* copy;
+	switch (shape->klass->type)
+	{
+	case CP_CIRCLE_SHAPE:
+		copy = cpCircleShapeNew(body, cpCircleShapeGetRadius(shape), cpCircleShapeGetOffset(shape));
+		break;
+	case CP_SEGMENT_SHAPE:
+		copy = cpSegmentShapeNew(body, cpSegmentShapeGetA(shape), cpSegmentShapeGetB(shape), cpSegmentShapeGetRadius(shape));
+		break;
+	default:
+	{
+		int count = cpPolyShapeGetCount(shape);
+		cpVect* verts = cpcalloc(count, sizeof(cpVect));
+		for (int i = 0; i < count; ++i)
+		{
+			verts[i] = cpPolyShapeGetVert(shape, i);
+		}
+		copy = cpPolyShapeNewRaw(body, count, verts, cpPolyShapeGetRadius(shape));
+		cpfree(verts);
+		break;
+	}
+	}
+	cpShapeSetSensor(copy, shape->sensor);
+	cpShapeSetElasticity(copy, shape->e);
+	cpShapeSetFriction(copy, shape->u);
+	cpShapeSetSurfaceVelocity(copy, shape->surfaceV);
+	cpShapeSetCollisionType(copy, shape->type);
+	cpShapeSetFilter(copy, shape->filter);
+	return copy;
+}
+
+///Keep ghosts whose owners were near their region this step, or are asleep and so weren't walked; free the rest
+static cpBool ghost_expire(void* ghost, void* data)
+{
+	physicsGhost* g = ghost;
+	physicsWorld* world = data;
+	if (g->seen_step == world->step)
+	{
+		return cpTrue;
+	}
+	//sleeping owners aren't walked, so their ghosts stay, unless one came to rest in the ghost's region and would collide with it
+	if (cpBodyIsSleeping(g->owner) && world_region_of(world, g->owner->p.x) != g->region)
+	{
+		ghost_follow(world, g);
+		return cpTrue;
+	}
+	ghost_free(ghost, world->regions[g->region]);
+	return cpFalse;
+}
+
+///Free a ghost, taking its body and shapes out of space first, or leaving them to be freed with their space if NULL
+static void ghost_free(void* ghost, void* data)
+{
+	physicsGhost* g = ghost;
+	cpSpace* space = data;
+	if (space)
+	{
+		while (g->body->shapeList)
+		{
+			cpShape* shape = g->body->shapeList;
+			cpSpaceRemoveShape(space, shape);
+			cpShapeFree(shape);
+		}
+		cpSpaceRemoveBody(space, g->body);
+		cpBodyFree(g->body);
+	}
+	cpfree(g);
+}
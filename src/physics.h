@@ -1,23 +1,149 @@
 #include "chipmunk/chipmunk_private.h"
+
+typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+///Spatial indices a space can find colliding shape pairs with; compare them on a scene with ga2022 -physicsbench
+typedef enum physicsBroadphase
+{
+	k_physics_broadphase_tree, //bounding box tree, the default; copes with any mix of sizes
+	k_physics_broadphase_hash, //spatial hash; for many shapes of about one size, with cells sized to match
+	k_physics_broadphase_sweep, //sort and sweep along x; for shapes spread out more along x than y
+	k_physics_broadphase_count,
+} physicsBroadphase;
+
+///Phases of a step, timed by physicsSpaceSetPhaseTimes(); in the order of cpHastySpacePhase
+typedef enum physicsPhase
+{
+	k_physics_phase_integrate, //positions, velocities, the contact graph and sleeping
+	k_physics_phase_broadphase, //shape bounds and overlapping pairs
+	k_physics_phase_narrowphase, //contacts of the overlapping pairs
+	k_physics_phase_solver, //impulses on contacts and constraints
+	k_physics_phase_count,
+} physicsPhase;
+
+///One ray of a batched raycast, swept from start to end with a radius, against shapes the filter accepts
+typedef struct physicsRay
+{
+	cpVect start;
+	cpVect end;
+	cpFloat radius;
+	cpShapeFilter filter;
+} physicsRay;
+
+///Rigidbodies allocated in blocks, handed out in creation order; see physicsBodyPoolCreate()
+typedef struct physicsBodyPool physicsBodyPool;
+
+///A wide world divided along x into regions, each a space of its own stepped in parallel; see physicsWorldCreate()
+typedef struct physicsWorld physicsWorld;
+
+///One box of a batched overlap query, against shapes the filter accepts
+typedef struct physicsOverlap
+{
+	cpBB bb;
+	cpShapeFilter filter;
+} physicsOverlap;
+
+///Allocator Functions
+void physicsSetHeap(heap_t* heap);
+
 ///Space Functions
 cpSpace* physicsSpaceCreate();
 
+cpSpace* physicsSpaceCreateThreaded(unsigned long threads, job_system_t* jobs);
+
+void physicsSpaceSetColoredSolver(cpSpace* space, cpBool colored);
+
+void physicsSpaceSetDeterministic(cpSpace* space, cpBool deterministic);
+
+void physicsSpaceSetBroadphase(cpSpace* space, physicsBroadphase broadphase, cpFloat cell_size, int expected_count);
+
+int physicsSpaceOptimizeBroadphase(cpSpace* space, int budget_us);
+
+const char* physicsBroadphaseGetName(physicsBroadphase broadphase);
+
+void physicsSpaceSetPhaseTimes(cpSpace* space, uint64_t* ticks);
+
+const char* physicsPhaseGetName(physicsPhase phase);
+
+int physicsBenchmarkBroadphases(heap_t* heap);
+
+int physicsBenchmarkWorld(heap_t* heap, job_system_t* jobs);
+
 void physicsSpaceDestroy(cpSpace* space);
 
+void physicsSpaceStep(cpSpace* space, cpFloat dt);
+
+void physicsSpaceReserve(cpSpace* space, int contacting_pairs, int contacts);
+
+size_t physicsSpaceSaveSnapshot(cpSpace* space, void* buffer, size_t size);
+
+cpBool physicsSpaceRestoreSnapshot(cpSpace* space, const void* buffer, size_t size);
+
 void physicsSpaceSetGravity(cpSpace* space, cpVect gravity);
 
 cpBody* physicsSpaceGetStaticBody(cpSpace* space);
 
+void physicsSpaceSetSleepTime(cpSpace* space, cpFloat seconds);
+
+void physicsSpaceSetIdleSpeed(cpSpace* space, cpFloat speed);
+
+void physicsSpaceSetSleepCallback(cpSpace* space, cpSpaceSleepFunc func, void* data);
+
+cpBody** physicsSpaceGetAwakeBodies(cpSpace* space, int* count);
+
+///Query Functions
+void physicsSpaceRaycastBatch(cpSpace* space, const physicsRay* rays, int count, cpSegmentQueryInfo* hits, job_system_t* jobs);
+
+void physicsSpaceOverlapBatch(cpSpace* space, const physicsOverlap* boxes, int count, cpShape** shapes, int max_shapes_per_box, int* shape_counts, job_system_t* jobs);
+
+///Body Pool Functions
+physicsBodyPool* physicsBodyPoolCreate(int bodies_per_block);
+
+void physicsBodyPoolDestroy(physicsBodyPool* pool);
+
+int physicsBodyPoolGetCount(physicsBodyPool* pool);
+
 ///Rigidbody Functions
 cpBody* physicsRigidBodyCreate(cpSpace* space, cpBodyType type, cpFloat mass, cpFloat moment, cpVect pos, cpFloat angle);
 
+cpBody* physicsRigidBodyCreatePooled(cpSpace* space, physicsBodyPool* pool, cpBodyType type, cpFloat mass, cpFloat moment, cpVect pos, cpFloat angle);
+
 void physicsRigidBodyDestroy(cpBody* body);
 
 void physicsRigidBodySetVelocity(cpBody* body, cpVect velocity);
 
+void physicsRigidBodySetUserData(cpBody* body, cpDataPointer data);
+
+void physicsRigidBodySetContinuous(cpBody* body, cpFloat radius);
+
 ///Shape Functions
 cpShape* physicsCircleCreate(cpSpace* space, cpBody* body, cpFloat radius, cpFloat friction);
 
 cpShape* physicsBoxCreate(cpSpace* space, cpBody* body, cpFloat width, cpFloat height, cpFloat radius, cpFloat friction);
 
-void physicsShapeDestroy(cpShape* shape);
\ No newline at end of file
+void physicsShapeSetFilter(cpShape* shape, cpGroup group, cpBitmask categories, cpBitmask mask);
+
+void physicsShapeDestroy(cpShape* shape);
+
+///Constraint Functions
+cpConstraint* physicsPivotJointCreate(cpSpace* space, cpBody* a, cpBody* b, cpVect pivot);
+
+///World Functions
+physicsWorld* physicsWorldCreate(int region_count, cpFloat origin_x, cpFloat region_width, cpFloat ghost_margin, job_system_t* jobs);
+
+void physicsWorldDestroy(physicsWorld* world);
+
+int physicsWorldGetRegionCount(physicsWorld* world);
+
+cpSpace* physicsWorldGetRegion(physicsWorld* world, int region);
+
+cpSpace* physicsWorldGetSpaceAt(physicsWorld* world, cpVect pos);
+
+void physicsWorldStep(physicsWorld* world, cpFloat dt);
+
+int physicsWorldGetMigrationCount(physicsWorld* world);
+
+int physicsWorldGetGhostCount(physicsWorld* world);
+
+cpBool physicsBodyIsGhost(const cpBody* body);
@@ -2,12 +2,20 @@
 
 #include "debug.h"
 #include "ecs.h"
+#include "ecs_scheduler.h"
+#include "frame_stats.h"
+#include "frustum.h"
 #include "fs.h"
 #include "gpu.h"
 #include "heap.h"
+#include "hierarchy.h"
 #include "net.h"
 #include "render.h"
+#include "replay.h"
+#include "string_id.h"
+#include "timer.h"
 #include "timer_object.h"
+#include "trace.h"
 #include "transform.h"
 #include "wm.h"
 #include "physics.h"
@@ -15,9 +23,93 @@
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Cull models on the GPU with a compute shader that writes indirect draws, or 0 to cull them
+// on the CPU before they are pushed to the renderer.
+#if !defined(GPU_CULLING)
+#define GPU_CULLING 1
+#endif
+
+// Workers the physics solver is split across, the game thread and jobs, or 1 to solve on the game thread alone.
+// Scenes with thousands of contacts are solver-bound.
+#if !defined(PHYSICS_THREADS)
+#define PHYSICS_THREADS 4
+#endif
+
+// Solve physics in graph colors of contacts sharing no bodies, which scales with PHYSICS_THREADS and steps the same
+// whatever it is, or 0 for chipmunk's solver, which splits iterations across at most 2 workers nondeterministically.
+#if !defined(PHYSICS_COLORED_SOLVER)
+#define PHYSICS_COLORED_SOLVER 1
+#endif
+
+// Step physics bit-identically given the same build and inputs, forcing the colored solver, or 0 to let the
+// floating point environment follow whatever the thread was left with.
+#if !defined(PHYSICS_DETERMINISTIC)
+#define PHYSICS_DETERMINISTIC 1
+#endif
+
+// Seconds a pile of bodies must rest before it sleeps, leaving the solver and transform sync until something touches it,
+// or INFINITY to keep every body awake.
+#if !defined(PHYSICS_SLEEP_TIME)
+#define PHYSICS_SLEEP_TIME 0.5f
+#endif
+
+// Microseconds a frame may spend repairing the physics broadphase tree, which bodies moving far leave less efficient to
+// query over a long session, or 0 to never repair it.
+#if !defined(PHYSICS_OPTIMIZE_US)
+#define PHYSICS_OPTIMIZE_US 50
+#endif
+
 const float screen_size = 20.0f;
+const float physics_time_step = 1.0f / 60.0f;
+
+enum
+{
+	// Models whose bounds are gathered and culled at once.
+	k_cull_batch_size = 64,
+
+	// Net entity type of players, which the peer without a server address simulates from their input.
+	k_net_type_player = 1,
+
+	// Most fixed physics steps in one update; time past them is dropped so a long stall can't snowball.
+	k_max_physics_steps = 4,
+
+	// Body states tracked before the array first grows.
+	k_initial_physics_syncs = 64,
+
+	// Bodies in each block of the body pool.
+	k_bodies_per_pool_block = 1024,
+
+	// Updates of a stress scene run before timing, while the pile settles into its first contacts.
+	k_stress_warmup_updates = 10,
+
+	// Seconds a network load test runs before timing, while its clients connect and receive the scene.
+	k_net_load_warmup_seconds = 1,
+
+	// Replay flag of a session whose net simulated its clients' input rather than predicting its own.
+	k_replay_flag_authoritative = 1 << 0,
+};
+
+// Parts of an update a stress scene times, starting with the physics step's own phases.
+enum
+{
+	k_stress_phase_physics_other = k_physics_phase_count, //body states and broadphase repair around the step
+	k_stress_phase_ecs_sync,
+	k_stress_phase_net,
+	k_stress_phase_systems,
+	k_stress_phase_count,
+};
+
+static const char* s_stress_phase_names[k_stress_phase_count - k_physics_phase_count] =
+{
+	"physics other",
+	"ecs sync",
+	"net",
+	"systems, draw submission",
+};
 
 typedef struct transform_component_t
 {
@@ -34,8 +126,14 @@ typedef struct model_component_t
 {
 	gpu_mesh_info_t* mesh_info;
 	gpu_shader_info_t* shader_info;
+	float radius; //bounds the mesh around its origin, before scaling
 } model_component_t;
 
+typedef struct visibility_component_t
+{
+	uint64_t camera_mask; //bit per camera, in camera query order, that can see the model
+} visibility_component_t;
+
 typedef struct player_component_t
 {
 	int index;
@@ -43,9 +141,16 @@ typedef struct player_component_t
 	cpShape* shape;
 } player_component_t;
 
+// Input command moving a player for one frame.
+typedef struct player_input_t
+{
+	uint32_t key_mask;
+	float dt;
+} player_input_t;
+
 typedef struct name_component_t
 {
-	char name[32];
+	string_id_t name;
 } name_component_t;
 
 typedef struct physics_component_t
@@ -54,68 +159,139 @@ typedef struct physics_component_t
 	cpShape* shape;
 } physics_component_t;
 
+// Body states the transform of a physics entity is blended between.
+// Kept in an array the body's user data indexes, so syncing walks the space's awake bodies instead of every physics entity,
+// and in transform terms, so the rotation is built once a step rather than once a frame.
+typedef struct physics_sync_t
+{
+	ecs_entity_ref_t entity;
+	vec3f_t prev_translation; //state before the last step
+	quatf_t prev_rotation;
+	vec3f_t translation; //state after the last step
+	quatf_t rotation;
+	bool synced; //the transform already holds the state, which no longer changes between frames
+} physics_sync_t;
+
 typedef struct physics_sandbox_t
 {
 	heap_t* heap;
+	heap_t* physics_heap; //children of the heap, so physics and network usage show apart from the game's
+	heap_t* net_heap;
 	fs_t* fs;
 	wm_window_t* window;
 	render_t* render;
 	net_t* net;
 	cpSpace* physics_space;
+	physicsBodyPool* body_pool; //bodies are taken from, in the order their entities are made, or NULL to allocate each
+	double physics_accumulator; //seconds of real time not yet simulated
+	float physics_alpha; //fraction of a step the accumulator holds, between the previous and current body states
+	physics_sync_t* physics_syncs;
+	int physics_sync_count;
+	int physics_sync_capacity;
 
 	timer_object_t* timer;
 
 	ecs_t* ecs;
+	ecs_scheduler_t* scheduler;
+	hierarchy_t* hierarchy;
 	int transform_type;
 	int camera_type;
 	int model_type;
+	int visibility_type;
 	int player_type;
 	int name_type;
 	int physics_type;
+	int hierarchy_type;
+	int camera_query; //registered, as cameras are walked once per batch of models culled and models once per camera drawn
+	int model_query;
 	ecs_entity_ref_t player_ent;
 	ecs_entity_ref_t physics_ent;
 	ecs_entity_ref_t camera_ent;
 
 	gpu_mesh_info_t cube_mesh;
 	gpu_mesh_info_t hex_mesh;
+	float cube_radius;
+	float hex_radius;
 	gpu_shader_info_t cube_shader;
+	gpu_shader_info_t cull_shader;
 	fs_work_t* vertex_shader_work;
 	fs_work_t* fragment_shader_work;
+	fs_work_t* cull_shader_work;
+
+	physics_sandbox_stress_t stress; //options of a stress scene, if created with them
+	uint64_t net_ticks; //spent in net_update(), for a network load test to read and reset
+
+	// Recording of the session's frames, or playback that drives them instead of the window, network and clock.
+	replay_t* replay;
+	bool replay_missing; //a playback was asked for but could not be read
+	uint32_t key_mask; //latched for update_players, from the window or the frame played back
 } physics_sandbox_t;
 
+static physics_sandbox_t* create_game(heap_t* heap, fs_t* fs, job_system_t* jobs, wm_window_t* window, render_t* render, int physics_threads, const net_options_t* net_options);
+static void spawn_scene(physics_sandbox_t* game, bool local_player);
+static int sum_connection_bytes(net_t* net, net_connection_stats_t* stats, int max_count, int64_t* bytes_in, int64_t* bytes_out);
+static void spawn_stress_scene(physics_sandbox_t* game, const physics_sandbox_stress_t* stress);
+static int register_stress_prefab(physics_sandbox_t* game, bool circle, cpBodyType type, vec3f_t size);
+static cpBody* spawn_stress_body(physics_sandbox_t* game, ecs_entity_ref_t entity, bool circle, cpBodyType type, cpVect pos);
+static int compare_ticks(const void* a, const void* b);
 static void load_resources(physics_sandbox_t* game);
+static void create_resources(physics_sandbox_t* game);
+static float mesh_radius(const vec3f_t* verts, size_t verts_size);
 static void unload_resources(physics_sandbox_t* game);
+static void register_player_net_type(physics_sandbox_t* game);
 static void spawn_player(physics_sandbox_t* game, int index);
 static void spawn_cube(physics_sandbox_t* game, int index, vec3f_t size, vec3f_t pos, float angle, float friction, cpBodyType type);
 static void spawn_circle(physics_sandbox_t* game, int index, float size, vec3f_t pos, float angle, float friction, cpBodyType type);
 static void spawn_camera(physics_sandbox_t* game);
-static void update_players(physics_sandbox_t* game);
-static void update_physics(physics_sandbox_t* game);
-static void draw_models(physics_sandbox_t* game);
-
-physics_sandbox_t* physics_sandbox_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, int argc, const char** argv)
+static void spawn_attachment(physics_sandbox_t* game, ecs_entity_ref_t parent, const transform_t* local);
+static void player_input(ecs_t* ecs, ecs_entity_ref_t entity, const void* input, void* user);
+static cpBody* create_body(physics_sandbox_t* game, cpBodyType type, cpFloat mass, cpFloat moment, cpVect pos, cpFloat angle);
+static void add_physics_sync(physics_sandbox_t* game, ecs_entity_ref_t entity, cpBody* body, transform_t* transform);
+static ecs_mask_t model_mask(physics_sandbox_t* game, cpBodyType type);
+static void push_static_model(physics_sandbox_t* game, cpBodyType type, const transform_t* transform, const model_component_t* model_comp);
+static void store_body_state(physics_sync_t* sync, const cpBody* body);
+static void physics_sleep(cpSpace* space, cpBody* body, cpBool sleeping, void* data);
+static void step_physics(physics_sandbox_t* game);
+static void sync_physics(physics_sandbox_t* game);
+static void update_players(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
+static void update_hierarchy(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
+static void cull_models(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
+static void draw_models(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user);
+static void record_packet(const net_address_t* address, const void* data, int size, void* user);
+
+physics_sandbox_t* physics_sandbox_create(heap_t* heap, fs_t* fs, job_system_t* jobs, wm_window_t* window, render_t* render, int argc, const char** argv)
 {
-	physics_sandbox_t* game = heap_alloc(heap, sizeof(physics_sandbox_t), 8);
-	game->heap = heap;
-	game->fs = fs;
-	game->window = window;
-	game->render = render;
-	game->physics_space = physicsSpaceCreate();
-	physicsSpaceSetGravity(game->physics_space, cpv(0.0f, -10.0f));
+	physics_sandbox_options_t options = { 0 };
+	return physics_sandbox_create_with_options(heap, fs, jobs, window, render, argc, argv, &options);
+}
 
-	game->timer = timer_object_create(heap, NULL);
+physics_sandbox_t* physics_sandbox_create_with_options(heap_t* heap, fs_t* fs, job_system_t* jobs, wm_window_t* window, render_t* render, int argc, const char** argv, const physics_sandbox_options_t* options)
+{
+	net_options_t net_options = { .authoritative = !window || argc < 2, .jobs = jobs };
 
-	game->ecs = ecs_create(heap);
-	game->transform_type = ecs_register_component_type(game->ecs, "transform", sizeof(transform_component_t), _Alignof(transform_component_t));
-	game->camera_type = ecs_register_component_type(game->ecs, "camera", sizeof(camera_component_t), _Alignof(camera_component_t));
-	game->model_type = ecs_register_component_type(game->ecs, "model", sizeof(model_component_t), _Alignof(model_component_t));
-	game->player_type = ecs_register_component_type(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t));
-	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
-	game->physics_type = ecs_register_component_type(game->ecs, "physics", sizeof(physics_component_t), _Alignof(physics_component_t));
+	//a playback's net hears only the packets recorded, and sends nothing
+	replay_t* replay = NULL;
+	if (options->replay_path)
+	{
+		replay = replay_create_playback(heap, fs, options->replay_path);
+		if (replay)
+		{
+			net_options.authoritative = (replay_get_flags(replay) & k_replay_flag_authoritative) != 0;
+			net_options.offline = true;
+		}
+	}
+	else if (options->record_path)
+	{
+		replay = replay_create_recording(heap, fs, options->record_path, net_options.authoritative ? k_replay_flag_authoritative : 0);
+		net_options.packet_callback = record_packet;
+		net_options.packet_callback_data = replay;
+	}
 
+	physics_sandbox_t* game = create_game(heap, fs, jobs, window, render, PHYSICS_THREADS, &net_options);
+	game->replay = replay;
+	game->replay_missing = options->replay_path && !replay;
 
-	game->net = net_create(heap, game->ecs);
-	if (argc >= 2)
+	if (argc >= 2 && !net_options.offline)
 	{
 		net_address_t server;
 		if (net_string_to_address(argv[1], &server))
@@ -128,8 +304,22 @@ physics_sandbox_t* physics_sandbox_create(heap_t* heap, fs_t* fs, wm_window_t* w
 		}
 	}
 
-	load_resources(game);
-	spawn_player(game, 0);
+	spawn_scene(game, window != NULL);
+	return game;
+}
+
+// Spawn the usual scene, with a player driven by the game's input if local player is set.
+static void spawn_scene(physics_sandbox_t* game, bool local_player)
+{
+	//a dedicated server has no player of its own, but simulates its clients'
+	if (local_player)
+	{
+		spawn_player(game, 0);
+	}
+	else
+	{
+		register_player_net_type(game);
+	}
 	spawn_cube(game, 0, vec3f_new(2.0f, 2.0f, 0.0f), vec3f_new(5.0f, 5.0f, 0.0f), 0.0f, 1.0f, CP_BODY_TYPE_DYNAMIC);
 	spawn_circle(game, 1, 2.0f, vec3f_new(20.0f, 9.0f, 0.0f), 0.0f, 1.0f, CP_BODY_TYPE_DYNAMIC);
 	spawn_circle(game, 5, 20.0f, vec3f_new(50.0f, 9.0f, 0.0f), 0.0f, 1.0f, CP_BODY_TYPE_DYNAMIC);
@@ -138,37 +328,554 @@ physics_sandbox_t* physics_sandbox_create(heap_t* heap, fs_t* fs, wm_window_t* w
 	spawn_cube(game, 4, vec3f_new(10.0f, 1.0f, 0.0f), vec3f_new(0.0f, -20.0f, 0.0f), -20.0f, 1.0f, CP_BODY_TYPE_STATIC);
 	
 	spawn_camera(game);
+}
+
+// Create a game with its systems and resources but nothing spawned.
+// Its net is created with the options given, played back on the game's timer.
+static physics_sandbox_t* create_game(heap_t* heap, fs_t* fs, job_system_t* jobs, wm_window_t* window, render_t* render, int physics_threads, const net_options_t* net_options)
+{
+	physics_sandbox_t* game = heap_alloc(heap, sizeof(physics_sandbox_t), 8);
+	game->heap = heap;
+	game->fs = fs;
+	game->window = window;
+	game->render = render;
+	//the shaders load while the rest of the game is created
+	load_resources(game);
+	memset(&game->stress, 0, sizeof(game->stress));
+	game->net_ticks = 0;
+	game->replay = NULL;
+	game->replay_missing = false;
+	game->key_mask = 0;
+	game->physics_heap = heap_create_child(heap, "physics", 256 * 1024 * 1024);
+	game->net_heap = heap_create_child(heap, "net", 64 * 1024 * 1024);
+	physicsSetHeap(game->physics_heap);
+	game->physics_space = physicsSpaceCreateThreaded(physics_threads, jobs);
+	game->body_pool = physicsBodyPoolCreate(k_bodies_per_pool_block);
+	physicsSpaceSetColoredSolver(game->physics_space, PHYSICS_COLORED_SOLVER);
+	physicsSpaceSetDeterministic(game->physics_space, PHYSICS_DETERMINISTIC);
+	physicsSpaceSetGravity(game->physics_space, cpv(0.0f, -10.0f));
+	physicsSpaceSetSleepTime(game->physics_space, PHYSICS_SLEEP_TIME);
+	physicsSpaceSetSleepCallback(game->physics_space, physics_sleep, game);
+	game->physics_accumulator = 0.0;
+	game->physics_alpha = 0.0f;
+	game->physics_sync_capacity = k_initial_physics_syncs;
+	game->physics_sync_count = 0;
+	game->physics_syncs = heap_alloc(heap, sizeof(physics_sync_t) * game->physics_sync_capacity, 8);
+
+	game->timer = timer_object_create(heap, NULL);
+
+	game->ecs = ecs_create(heap);
+	game->transform_type = ecs_register_component_type(game->ecs, "transform", sizeof(transform_component_t), _Alignof(transform_component_t));
+	//cameras and players are one entity or a few each, read per entity, so keep them out of chunk rows
+	ecs_component_options_t sparse_options = { .storage = k_ecs_storage_sparse };
+	game->camera_type = ecs_register_component_type_with_options(game->ecs, "camera", sizeof(camera_component_t), _Alignof(camera_component_t), &sparse_options);
+	game->model_type = ecs_register_component_type(game->ecs, "model", sizeof(model_component_t), _Alignof(model_component_t));
+	game->visibility_type = ecs_register_component_type(game->ecs, "visibility", sizeof(visibility_component_t), _Alignof(visibility_component_t));
+	game->player_type = ecs_register_component_type_with_options(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t), &sparse_options);
+	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
+	game->physics_type = ecs_register_component_type(game->ecs, "physics", sizeof(physics_component_t), _Alignof(physics_component_t));
+	game->hierarchy = hierarchy_create(heap, game->ecs, game->transform_type);
+	game->hierarchy_type = hierarchy_get_component_type(game->hierarchy);
+	game->camera_query = ecs_register_query(game->ecs, ECS_MASK(game->camera_type));
+	game->model_query = ecs_register_query(game->ecs, ECS_MASK(game->transform_type, game->model_type, game->visibility_type));
+
+	//a dedicated server has no window to read input from or renderer to draw with
+	game->scheduler = ecs_scheduler_create(heap, game->ecs, jobs);
+	if (window)
+	{
+		ecs_scheduler_add_system(game->scheduler, "update_players",
+			ECS_MASK(game->player_type), ECS_MASK(game->transform_type), false, update_players, game);
+	}
+	ecs_scheduler_add_system(game->scheduler, "update_hierarchy",
+		ECS_MASK(game->hierarchy_type), ECS_MASK(game->transform_type), false, update_hierarchy, game);
+	if (render)
+	{
+#if !GPU_CULLING
+		ecs_scheduler_add_system(game->scheduler, "cull_models",
+			ECS_MASK(game->transform_type, game->model_type), ECS_MASK(game->visibility_type), true, cull_models, game);
+#endif
+		ecs_scheduler_add_system(game->scheduler, "draw_models",
+			ECS_MASK(game->camera_type, game->transform_type, game->model_type, game->visibility_type), ecs_mask_empty(), false, draw_models, game);
+	}
+
+	net_options_t game_net_options = *net_options;
+	game_net_options.timer = game->timer;
+	game->net = net_create_with_options(game->net_heap, game->ecs, &game_net_options);
+	//positions to 1/512 of a unit within 256 units of the origin, scale to 1/64 up to 64 units
+	net_field_t transform_fields[] =
+	{
+		{ .encoding = k_net_field_fixed, .offset = offsetof(transform_component_t, transform.translation), .count = 3, .bits = 18, .min = -256.0f, .max = 256.0f },
+		{ .encoding = k_net_field_fixed, .offset = offsetof(transform_component_t, transform.scale), .count = 3, .bits = 12, .min = 0.0f, .max = 64.0f },
+		{ .encoding = k_net_field_quaternion, .offset = offsetof(transform_component_t, transform.rotation), .bits = 10 },
+	};
+	net_state_register_component_fields(game->net, game->transform_type, transform_fields, _countof(transform_fields));
 
+	create_resources(game);
 	return game;
 }
 
 void physics_sandbox_destroy(physics_sandbox_t* game)
 {
-	cpSpaceDestroy(game->physics_space);
+	//the static set draws the game's meshes and shaders, which are about to go
+	if (game->render)
+	{
+		render_clear_static(game->render);
+	}
+
+	//another game destroyed first would have cleared it
+	physicsSetHeap(game->physics_heap);
+	physicsSpaceDestroy(game->physics_space);
+	if (game->body_pool)
+	{
+		physicsBodyPoolDestroy(game->body_pool);
+	}
+	physicsSetHeap(NULL);
+	heap_destroy(game->physics_heap);
+	heap_free(game->heap, game->physics_syncs);
 	net_destroy(game->net);
+	heap_destroy(game->net_heap);
+	ecs_scheduler_destroy(game->scheduler);
+	hierarchy_destroy(game->hierarchy);
 	ecs_destroy(game->ecs);
 	timer_object_destroy(game->timer);
 	unload_resources(game);
+	if (game->replay)
+	{
+		replay_destroy(game->replay);
+	}
 	heap_free(game->heap, game);
 }
 
+bool physics_sandbox_is_replay_finished(physics_sandbox_t* game)
+{
+	return game->replay_missing || (game->replay && replay_is_finished(game->replay));
+}
+
 void physics_sandbox_update(physics_sandbox_t* game)
 {
-	cpFloat timeStep = 1.0 / 60.0;
-	cpSpaceStep(game->physics_space, timeStep);
-	timer_object_update(game->timer);
+	//a playback steps the clock by the recorded frame's time, so every run simulates the same frames
+	bool playback = game->replay && replay_is_playback(game->replay);
+	replay_frame_t frame = { 0 };
+	if (playback ? !replay_next_frame(game->replay, &frame) : game->replay_missing)
+	{
+		return;
+	}
+
+	TRACE_ZONE_BEGIN(k_trace_category_general, "physics_sandbox_update");
+	if (playback)
+	{
+		timer_object_step(game->timer, frame.delta_us);
+	}
+	else
+	{
+		timer_object_update(game->timer);
+	}
+	game->physics_accumulator += timer_object_get_delta_ms(game->timer) * 0.001;
+	step_physics(game);
 	ecs_update(game->ecs);
+	sync_physics(game);
+	for (int i = 0; i < frame.packet_count; ++i)
+	{
+		net_address_t address;
+		const void* data;
+		int size;
+		replay_get_packet(game->replay, i, &address, &data, &size);
+		net_inject_packet(game->net, &address, data, size);
+	}
+	uint64_t net_start = timer_get_ticks();
 	net_update(game->net);
-	update_players(game);
-	update_physics(game);
-	draw_models(game);
-	render_push_done(game->render);
+	game->net_ticks += timer_get_ticks() - net_start;
+	trace_counter(trace_get_default(), "Heap physics (KB)", (int64_t)(heap_get_used_bytes(game->physics_heap) / 1024));
+	trace_counter(trace_get_default(), "Heap net (KB)", (int64_t)(heap_get_used_bytes(game->net_heap) / 1024));
+	if (playback)
+	{
+		game->key_mask = frame.key_mask;
+	}
+	else if (game->window)
+	{
+		//the freshest input for update_players
+		wm_latch_input(game->window);
+		game->key_mask = wm_get_key_mask(game->window);
+		frame.mouse_mask = wm_get_mouse_mask(game->window);
+		wm_get_mouse_move(game->window, &frame.mouse_x, &frame.mouse_y);
+	}
+	if (game->replay && !playback)
+	{
+		frame.delta_us = timer_object_get_delta_us(game->timer);
+		frame.key_mask = game->key_mask;
+		replay_record_frame(game->replay, &frame);
+	}
+	ecs_scheduler_update(game->scheduler);
+	if (game->render)
+	{
+		render_push_done(game->render);
+	}
+	TRACE_ZONE_END(k_trace_category_general);
+}
+
+physics_sandbox_t* physics_sandbox_create_stress(heap_t* heap, fs_t* fs, job_system_t* jobs, render_t* render, const physics_sandbox_stress_t* stress)
+{
+	net_options_t net_options = { .authoritative = true };
+	physics_sandbox_t* game = create_game(heap, fs, jobs, NULL, render, stress->thread_count ? stress->thread_count : PHYSICS_THREADS, &net_options);
+	game->stress = *stress;
+	if (!stress->pooled_bodies)
+	{
+		physicsBodyPoolDestroy(game->body_pool);
+		game->body_pool = NULL;
+	}
+	spawn_stress_scene(game, stress);
+	spawn_camera(game);
+	return game;
+}
+
+void physics_sandbox_run_stress(physics_sandbox_t* game)
+{
+	const physics_sandbox_stress_t* stress = &game->stress;
+	uint64_t phase_ticks[k_stress_phase_count] = { 0 };
+	uint64_t* update_ticks = heap_alloc(game->heap, sizeof(uint64_t) * __max(stress->step_count, 1), 8);
+	for (int i = -k_stress_warmup_updates; i < stress->step_count; ++i)
+	{
+		//one fixed step per update, whatever the real time, so every run does the same work
+		physicsSpaceSetPhaseTimes(game->physics_space, i >= 0 ? phase_ticks : NULL);
+		game->physics_accumulator += physics_time_step;
+
+		uint64_t start = timer_get_ticks();
+		uint64_t physics_before = phase_ticks[k_physics_phase_integrate] + phase_ticks[k_physics_phase_broadphase] +
+			phase_ticks[k_physics_phase_narrowphase] + phase_ticks[k_physics_phase_solver];
+		step_physics(game);
+		uint64_t physics_after = phase_ticks[k_physics_phase_integrate] + phase_ticks[k_physics_phase_broadphase] +
+			phase_ticks[k_physics_phase_narrowphase] + phase_ticks[k_physics_phase_solver];
+		uint64_t ecs_start = timer_get_ticks();
+		ecs_update(game->ecs);
+		sync_physics(game);
+		uint64_t net_start = timer_get_ticks();
+		net_update(game->net);
+		uint64_t systems_start = timer_get_ticks();
+		ecs_scheduler_update(game->scheduler);
+		if (game->render)
+		{
+			render_push_done(game->render);
+		}
+		uint64_t end = timer_get_ticks();
+
+		if (i >= 0)
+		{
+			phase_ticks[k_stress_phase_physics_other] += (ecs_start - start) - (physics_after - physics_before);
+			phase_ticks[k_stress_phase_ecs_sync] += net_start - ecs_start;
+			phase_ticks[k_stress_phase_net] += systems_start - net_start;
+			phase_ticks[k_stress_phase_systems] += end - systems_start;
+			update_ticks[i] = end - start;
+		}
+	}
+	physicsSpaceSetPhaseTimes(game->physics_space, NULL);
+
+	int count = __max(stress->step_count, 1);
+	debug_print(k_print_info, "Stress scene: %d bodies, %d%% circles, %d joints, %s broadphase, %d physics threads, %d updates\n",
+		stress->body_count, stress->circle_percent, stress->joint_count, physicsBroadphaseGetName(stress->broadphase),
+		stress->thread_count ? stress->thread_count : PHYSICS_THREADS, stress->step_count);
+	debug_print(k_print_info, "  ms per update by phase:\n");
+	for (int phase = 0; phase < k_stress_phase_count; ++phase)
+	{
+		const char* name = phase < k_physics_phase_count ? physicsPhaseGetName(phase) : s_stress_phase_names[phase - k_physics_phase_count];
+		debug_print(k_print_info, "    %-26s %9.3f\n", name, timer_ticks_to_us(phase_ticks[phase]) * 0.001 / count);
+	}
+	if (stress->step_count > 0)
+	{
+		qsort(update_ticks, stress->step_count, sizeof(uint64_t), compare_ticks);
+		debug_print(k_print_info, "  ms per update: p50 %.3f  p99 %.3f  max %.3f\n",
+			timer_ticks_to_us(update_ticks[stress->step_count * 50 / 100]) * 0.001,
+			timer_ticks_to_us(update_ticks[stress->step_count * 99 / 100]) * 0.001,
+			timer_ticks_to_us(update_ticks[stress->step_count - 1]) * 0.001);
+	}
+
+	heap_free(game->heap, update_ticks);
+}
+
+int physics_sandbox_run_net_load(heap_t* heap, fs_t* fs, job_system_t* jobs, const physics_sandbox_net_load_t* load)
+{
+	int client_count = __max(load->client_count, 1);
+	net_options_t server_options =
+	{
+		.authoritative = true,
+		.max_connections = client_count,
+		.shard_count = load->shard_count,
+		.jobs = jobs,
+		.link =
+		{
+			.latency_ms = load->latency_ms,
+			.jitter_ms = load->jitter_ms,
+			.loss_percent = load->loss_percent,
+			.bandwidth = load->bandwidth,
+		},
+	};
+	physics_sandbox_t* server = create_game(heap, fs, jobs, NULL, NULL, PHYSICS_THREADS, &server_options);
+	spawn_scene(server, false);
+
+	//each client is a windowless game of its own, as a real one would be, solving physics on its game thread alone
+	net_options_t client_options = { .link = server_options.link };
+	physics_sandbox_t** clients = heap_alloc(heap, sizeof(physics_sandbox_t*) * client_count, 8);
+	for (int i = 0; i < client_count; ++i)
+	{
+		clients[i] = create_game(heap, fs, jobs, NULL, NULL, 1, &client_options);
+		net_address_t server_address;
+		net_get_shard_loopback_address(server->net, i, &server_address);
+		net_connect(clients[i]->net, &server_address);
+		spawn_scene(clients[i], true);
+	}
+
+	net_connection_stats_t* stats = heap_alloc(heap, sizeof(net_connection_stats_t) * client_count, 8);
+	int64_t start_bytes_in = 0;
+	int64_t start_bytes_out = 0;
+	int start_tick = 0;
+	uint64_t server_ticks = 0;
+	int updates = 0;
+	bool timing = false;
+
+	uint64_t ticks_per_second = timer_get_ticks_per_second();
+	uint64_t start = timer_get_ticks();
+	uint64_t timing_start = start + k_net_load_warmup_seconds * ticks_per_second;
+	uint64_t end = timing_start + __max(load->seconds, 1) * ticks_per_second;
+	timer_limiter_t limiter;
+	timer_limiter_init(&limiter, load->update_rate);
+	for (uint64_t now = start; now < end; now = timer_get_ticks())
+	{
+		if (!timing && now >= timing_start)
+		{
+			sum_connection_bytes(server->net, stats, client_count, &start_bytes_in, &start_bytes_out);
+			start_tick = net_get_tick(server->net);
+			server->net_ticks = 0;
+			timing = true;
+		}
+
+		//every player walks left and right a second each way, out of step with the others
+		uint32_t second = (uint32_t)((now - start) / ticks_per_second);
+		for (int i = 0; i < client_count; ++i)
+		{
+			player_input_t input =
+			{
+				.key_mask = (second + i) % 2 ? k_key_left : k_key_right,
+				.dt = (float)timer_object_get_delta_ms(clients[i]->timer) * 0.001f,
+			};
+			net_input_push(clients[i]->net, clients[i]->player_ent, &input);
+		}
+
+		uint64_t server_start = timer_get_ticks();
+		physics_sandbox_update(server);
+		if (timing)
+		{
+			server_ticks += timer_get_ticks() - server_start;
+			updates++;
+		}
+		for (int i = 0; i < client_count; ++i)
+		{
+			physics_sandbox_update(clients[i]);
+		}
+
+		timer_limiter_wait(&limiter);
+	}
+
+	int64_t bytes_in = 0;
+	int64_t bytes_out = 0;
+	int connection_count = sum_connection_bytes(server->net, stats, client_count, &bytes_in, &bytes_out);
+	int ticks = __max(net_get_tick(server->net) - start_tick, 1);
+	updates = __max(updates, 1);
+
+	float apply_ms = 0.0f;
+	float max_apply_ms = 0.0f;
+	int applying_clients = 0;
+	int recv_dropped = 0;
+	for (int i = 0; i < client_count; ++i)
+	{
+		net_connection_stats_t client_stats;
+		if (net_get_connection_stats(clients[i]->net, &client_stats, 1))
+		{
+			apply_ms += client_stats.apply_ms;
+			max_apply_ms = __max(max_apply_ms, client_stats.max_apply_ms);
+			recv_dropped += client_stats.recv_dropped;
+			applying_clients++;
+		}
+	}
+
+	double update_ms = timer_ticks_to_us(server_ticks) * 0.001 / updates;
+	double net_ms = timer_ticks_to_us(server->net_ticks) * 0.001 / updates;
+	debug_print(k_print_info, "Net load: %d clients for %d s at %d updates/s; link %d ms latency, %d ms jitter, %d%% loss, %d B/s\n",
+		client_count, __max(load->seconds, 1), load->update_rate, load->latency_ms, load->jitter_ms, load->loss_percent, load->bandwidth);
+	debug_print(k_print_info, "  server connections: %d of %d\n", connection_count, client_count);
+	debug_print(k_print_info, "  server ms per update: %.3f, of which net %.3f\n", update_ms, net_ms);
+	debug_print(k_print_info, "  server us per client per update: %.1f, of which net %.1f\n",
+		update_ms * 1000.0 / client_count, net_ms * 1000.0 / client_count);
+	debug_print(k_print_info, "  bytes per client per tick over %d ticks: %.0f out, %.0f in\n", ticks,
+		(double)(bytes_out - start_bytes_out) / client_count / ticks, (double)(bytes_in - start_bytes_in) / client_count / ticks);
+	debug_print(k_print_info, "  client ms to apply a snapshot: %.3f average, %.3f max\n",
+		applying_clients ? apply_ms / applying_clients : 0.0f, max_apply_ms);
+	debug_print(k_print_info, "  client packets dropped on receive: %d\n", recv_dropped);
+
+	heap_free(heap, stats);
+	for (int i = 0; i < client_count; ++i)
+	{
+		physics_sandbox_destroy(clients[i]);
+	}
+	heap_free(heap, clients);
+	physics_sandbox_destroy(server);
+
+	return connection_count < client_count ? 1 : 0;
+}
+
+// Fill stats for a net's connections, summing the bytes each has exchanged.
+// Returns how many connections there are.
+static int sum_connection_bytes(net_t* net, net_connection_stats_t* stats, int max_count, int64_t* bytes_in, int64_t* bytes_out)
+{
+	int count = net_get_connection_stats(net, stats, max_count);
+	*bytes_in = 0;
+	*bytes_out = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		*bytes_in += stats[i].bytes_in;
+		*bytes_out += stats[i].bytes_out;
+	}
+	return count;
+}
+
+// Fill the space with a grid of bodies over a floor, joining neighbours in each row.
+// The bodies' entities are instantiated from a prefab per shape in one go, then given their bodies in grid order.
+// The same options give the same scene.
+static void spawn_stress_scene(physics_sandbox_t* game, const physics_sandbox_stress_t* stress)
+{
+	const float size = 0.5f;
+	const float spacing = 1.25f;
+
+	//twice as wide as tall, so piles settle in a few seconds
+	int columns = __max((int)sqrtf(stress->body_count * 2.0f), 1);
+	float width = columns * spacing;
+	physicsSpaceSetBroadphase(game->physics_space, stress->broadphase, 2.0f * size, stress->body_count);
+	physicsSpaceReserve(game->physics_space, stress->body_count * 3, stress->body_count * 6);
+
+	ecs_entity_ref_t floor;
+	ecs_instantiate_n(game->ecs, register_stress_prefab(game, false, CP_BODY_TYPE_STATIC, vec3f_new(width * 0.5f + 10.0f, 1.0f, 1.0f)), 1, &floor);
+	spawn_stress_body(game, floor, false, CP_BODY_TYPE_STATIC, cpv(0.0f, -1.0f));
+
+	//choose every body's shape first, so each shape's entities can be made together
+	bool* circles = heap_alloc(game->heap, __max(stress->body_count, 1) * sizeof(bool), 8);
+	int circle_count = 0;
+	uint32_t seed = 12345;
+	for (int i = 0; i < stress->body_count; ++i)
+	{
+		seed = seed * 1664525 + 1013904223;
+		circles[i] = (int)((seed >> 8) % 100) < stress->circle_percent;
+		circle_count += circles[i];
+	}
+
+	ecs_entity_ref_t* entities = heap_alloc(game->heap, __max(stress->body_count, 1) * sizeof(ecs_entity_ref_t), 8);
+	ecs_entity_ref_t* circle_entities = entities;
+	ecs_entity_ref_t* box_entities = entities + circle_count;
+	vec3f_t scale = vec3f_new(size, size, size);
+	ecs_instantiate_n(game->ecs, register_stress_prefab(game, true, CP_BODY_TYPE_DYNAMIC, scale), circle_count, circle_entities);
+	ecs_instantiate_n(game->ecs, register_stress_prefab(game, false, CP_BODY_TYPE_DYNAMIC, scale), stress->body_count - circle_count, box_entities);
+
+	cpBody* prev_body = NULL;
+	int joints = 0;
+	for (int i = 0; i < stress->body_count; ++i)
+	{
+		int column = i % columns;
+		cpVect pos = cpv((column - columns * 0.5f) * spacing, 1.0f + (i / columns) * spacing);
+
+		ecs_entity_ref_t entity = circles[i] ? *circle_entities++ : *box_entities++;
+		cpBody* body = spawn_stress_body(game, entity, circles[i], CP_BODY_TYPE_DYNAMIC, pos);
+		if (column && joints < stress->joint_count)
+		{
+			physicsPivotJointCreate(game->physics_space, prev_body, body, cpv(pos.x - spacing * 0.5f, pos.y));
+			++joints;
+		}
+		prev_body = body;
+	}
+	heap_free(game->heap, entities);
+	heap_free(game->heap, circles);
+}
+
+// Register a prefab for stress scene entities of one shape and size, outside the net and without a name.
+static int register_stress_prefab(physics_sandbox_t* game, bool circle, cpBodyType type, vec3f_t size)
+{
+	ecs_mask_t k_stress_ent_mask = ecs_mask_or(model_mask(game, type), ECS_MASK(
+		game->transform_type,
+		game->physics_type));
+	int prefab = ecs_register_prefab(game->ecs, k_stress_ent_mask);
+
+	transform_component_t* transform_comp = ecs_prefab_get_component(game->ecs, prefab, game->transform_type);
+	transform_identity(&transform_comp->transform);
+	transform_comp->transform.scale = size;
+
+	model_component_t* model_comp = ecs_prefab_get_component(game->ecs, prefab, game->model_type);
+	model_comp->shader_info = &game->cube_shader;
+	model_comp->mesh_info = circle ? &game->hex_mesh : &game->cube_mesh;
+	model_comp->radius = circle ? game->hex_radius : game->cube_radius;
+	return prefab;
+}
+
+// Give an entity instantiated from a stress prefab its body and shape, sized by its transform's scale.
+static cpBody* spawn_stress_body(physics_sandbox_t* game, ecs_entity_ref_t entity, bool circle, cpBodyType type, cpVect pos)
+{
+	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, entity, game->transform_type, true);
+	physics_component_t* physics_comp = ecs_entity_get_component(game->ecs, entity, game->physics_type, true);
+	model_component_t* model_comp = ecs_entity_get_component(game->ecs, entity, game->model_type, true);
+	vec3f_t size = transform_comp->transform.scale;
+	if (circle)
+	{
+		cpFloat mass = M_PI * size.x * size.x;
+		physics_comp->body = create_body(game, type, mass, cpMomentForCircle(mass, 0.0f, size.x, cpvzero), pos, 0.0f);
+		physics_comp->shape = physicsCircleCreate(game->physics_space, physics_comp->body, size.x, 0.7f);
+	}
+	else
+	{
+		cpFloat mass = 4.0f * size.x * size.y;
+		physics_comp->body = create_body(game, type, mass, cpMomentForBox(mass, 2.0f * size.x, 2.0f * size.y), pos, 0.0f);
+		physics_comp->shape = physicsBoxCreate(game->physics_space, physics_comp->body, 2.0f * size.x, 2.0f * size.y, 0.0f, 0.7f);
+	}
+	add_physics_sync(game, entity, physics_comp->body, &transform_comp->transform);
+	push_static_model(game, type, &transform_comp->transform, model_comp);
+	return physics_comp->body;
 }
 
+static int compare_ticks(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// Queue every resource read at once, without waiting on any, so they overlap each other and the rest of startup.
 static void load_resources(physics_sandbox_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
+#if GPU_CULLING
+	game->vertex_shader_work = fs_map(game->fs, "shaders/culled.vert.spv");
+	game->cull_shader_work = fs_map(game->fs, "shaders/cull.comp.spv");
+#else
+	game->vertex_shader_work = fs_map(game->fs, "shaders/instanced.vert.spv");
+#endif
+	game->fragment_shader_work = fs_map(game->fs, "shaders/triangle.frag.spv");
+}
+
+// Wait for the resources load_resources() queued, describe them and have the render thread create their GPU objects
+// while the game starts, rather than in the first frame that draws them.
+static void create_resources(physics_sandbox_t* game)
+{
+	//in a capture, a short zone here means the reads finished while the rest of the game was created
+	TRACE_ZONE_BEGIN(k_trace_category_general, "Wait For Resources");
+	fs_work_wait(game->vertex_shader_work);
+	fs_work_wait(game->fragment_shader_work);
+#if GPU_CULLING
+	fs_work_wait(game->cull_shader_work);
+#endif
+	TRACE_ZONE_END(k_trace_category_general);
+
+#if GPU_CULLING
+	game->cull_shader = (gpu_shader_info_t)
+	{
+		.compute_shader_data = fs_work_get_buffer(game->cull_shader_work),
+		.compute_shader_size = fs_work_get_size(game->cull_shader_work),
+		.uniform_buffer_count = 1,
+		.storage_buffer_count = 3,
+	};
+#endif
 	game->cube_shader = (gpu_shader_info_t)
 	{
 		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
@@ -176,6 +883,7 @@ static void load_resources(physics_sandbox_t* game)
 		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
 		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
 		.uniform_buffer_count = 1,
+		.storage_buffer_count = GPU_CULLING ? 2 : 1,
 	};
 
 	static vec3f_t cube_verts[] =
@@ -227,12 +935,36 @@ static void load_resources(physics_sandbox_t* game)
 		.index_data = hex_indices,
 		.index_data_size = sizeof(hex_indices),
 	};
+
+	game->cube_radius = mesh_radius(cube_verts, sizeof(cube_verts));
+	game->hex_radius = mesh_radius(hex_verts, sizeof(hex_verts));
+
+	if (game->render)
+	{
+		render_preload(game->render, &game->cube_mesh, &game->cube_shader);
+		render_preload(game->render, &game->hex_mesh, &game->cube_shader);
+#if GPU_CULLING
+		render_preload(game->render, &game->cube_mesh, &game->cull_shader);
+#endif
+	}
+}
+
+// Radius around the origin bounding a mesh's positions; vertices are a position followed by a color.
+static float mesh_radius(const vec3f_t* verts, size_t verts_size)
+{
+	float radius2 = 0.0f;
+	for (size_t i = 0; i < verts_size / sizeof(vec3f_t); i += 2)
+	{
+		radius2 = fmaxf(radius2, vec3f_mag2(verts[i]));
+	}
+	return sqrtf(radius2);
 }
 
 static void unload_resources(physics_sandbox_t* game)
 {
-	heap_free(game->heap, fs_work_get_buffer(game->vertex_shader_work));
-	heap_free(game->heap, fs_work_get_buffer(game->fragment_shader_work));
+#if GPU_CULLING
+	fs_work_destroy(game->cull_shader_work);
+#endif
 	fs_work_destroy(game->fragment_shader_work);
 	fs_work_destroy(game->vertex_shader_work);
 }
@@ -244,50 +976,65 @@ static void player_net_configure(ecs_t* ecs, ecs_entity_ref_t entity, int type,
 	model_component_t* model_comp = ecs_entity_get_component(ecs, entity, game->model_type, true);
 	model_comp->mesh_info = &game->cube_mesh;
 	model_comp->shader_info = &game->cube_shader;
+	model_comp->radius = game->cube_radius;
 }
 
 static void spawn_player(physics_sandbox_t* game, int index)
 {
-	uint64_t k_player_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->player_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_player_ent_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->visibility_type,
+		game->player_type,
+		game->name_type);
 	game->player_ent = ecs_entity_add(game->ecs, k_player_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->transform_type, true);
 	transform_identity(&transform_comp->transform);
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "player");
+	name_comp->name = string_id_intern("player");
 
 	player_component_t* player_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->player_type, true);
 	player_comp->index = index;
-	player_comp->body = physicsRigidBodyCreate(game->physics_space, CP_BODY_TYPE_KINEMATIC, 1.0f, 1.0f, cpv(0.0f, 0.0f), 0.0f);
+	player_comp->body = create_body(game, CP_BODY_TYPE_KINEMATIC, 1.0f, 1.0f, cpv(0.0f, 0.0f), 0.0f);
 	player_comp->shape = physicsBoxCreate(game->physics_space, player_comp->body, 2.0f, 2.0f, 0.0f, 1.0f);
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->model_type, true);
 	model_comp->mesh_info = &game->cube_mesh;
 	model_comp->shader_info = &game->cube_shader;
+	model_comp->radius = game->cube_radius;
 
-	uint64_t k_player_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->name_type);
-	uint64_t k_player_ent_rep_mask =
-		(1ULL << game->transform_type);
-	net_state_register_entity_type(game->net, 0, k_player_ent_net_mask, k_player_ent_rep_mask, player_net_configure, game);
+	//a marker riding on top of the player, placed by the hierarchy rather than by hand
+	transform_t marker;
+	transform_identity(&marker);
+	marker.translation = vec3f_new(0.0f, 1.5f, 0.0f);
+	marker.scale = vec3f_new(0.25f, 0.25f, 0.25f);
+	spawn_attachment(game, game->player_ent, &marker);
+
+	register_player_net_type(game);
+	net_state_register_entity_instance(game->net, k_net_type_player, game->player_ent);
+}
 
-	net_state_register_entity_instance(game->net, 0, game->player_ent);
+// Register how players replicate and are driven by input, for our own player and other peers'.
+static void register_player_net_type(physics_sandbox_t* game)
+{
+	ecs_mask_t k_player_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->visibility_type,
+		game->name_type);
+	ecs_mask_t k_player_ent_rep_mask = ECS_MASK(game->transform_type);
+	net_state_register_entity_type(game->net, k_net_type_player, k_player_ent_net_mask, k_player_ent_rep_mask, player_net_configure, game);
+	net_state_register_input(game->net, k_net_type_player, sizeof(player_input_t), player_input, game);
 }
 
 static void spawn_cube(physics_sandbox_t* game, int index, vec3f_t size, vec3f_t pos, float angle, float friction, cpBodyType type)
 {
-	uint64_t k_cube_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->physics_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_cube_ent_mask = ecs_mask_or(model_mask(game, type), ECS_MASK(
+		game->transform_type,
+		game->physics_type,
+		game->name_type));
 	game->physics_ent = ecs_entity_add(game->ecs, k_cube_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->transform_type, true);
@@ -296,22 +1043,25 @@ static void spawn_cube(physics_sandbox_t* game, int index, vec3f_t size, vec3f_t
 	transform_comp->transform.translation = pos;
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "cube");
+	name_comp->name = string_id_intern("cube");
 
 	physics_component_t* physics_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->physics_type, true);
-	physics_comp->body = physicsRigidBodyCreate(game->physics_space, type, size.x*size.y, 1.0f, cpv(pos.x, pos.y), angle);
+	physics_comp->body = create_body(game, type, size.x*size.y, 1.0f, cpv(pos.x, pos.y), angle);
 	physics_comp->shape = physicsBoxCreate(game->physics_space, physics_comp->body, 2*size.x, 2*size.y, 0.0f, friction);
+	add_physics_sync(game, game->physics_ent, physics_comp->body, &transform_comp->transform);
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->model_type, true);
 	model_comp->mesh_info = &game->cube_mesh;
 	model_comp->shader_info = &game->cube_shader;
-
-	uint64_t k_cube_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->name_type);
-	uint64_t k_cube_ent_rep_mask =
-		(1ULL << game->transform_type);
+	model_comp->radius = game->cube_radius;
+	push_static_model(game, type, &transform_comp->transform, model_comp);
+
+	ecs_mask_t k_cube_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->visibility_type,
+		game->name_type);
+	ecs_mask_t k_cube_ent_rep_mask = ECS_MASK(game->transform_type);
 	net_state_register_entity_type(game->net, 0, k_cube_ent_net_mask, k_cube_ent_rep_mask, player_net_configure, game);
 
 	net_state_register_entity_instance(game->net, 0, game->physics_ent);
@@ -319,11 +1069,10 @@ static void spawn_cube(physics_sandbox_t* game, int index, vec3f_t size, vec3f_t
 
 static void spawn_circle(physics_sandbox_t* game, int index, float size, vec3f_t pos, float angle, float friction, cpBodyType type)
 {
-	uint64_t k_circle_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->physics_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_circle_ent_mask = ecs_mask_or(model_mask(game, type), ECS_MASK(
+		game->transform_type,
+		game->physics_type,
+		game->name_type));
 	game->physics_ent = ecs_entity_add(game->ecs, k_circle_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->transform_type, true);
@@ -333,22 +1082,25 @@ static void spawn_circle(physics_sandbox_t* game, int index, float size, vec3f_t
 	transform_comp->transform.translation = pos;
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "circle");
+	name_comp->name = string_id_intern("circle");
 
 	physics_component_t* physics_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->physics_type, true);
-	physics_comp->body = physicsRigidBodyCreate(game->physics_space, type, pow((M_PI * size), 2.0f), 1.0f, cpv(pos.x, pos.y), angle);
+	physics_comp->body = create_body(game, type, pow((M_PI * size), 2.0f), 1.0f, cpv(pos.x, pos.y), angle);
 	physics_comp->shape = physicsCircleCreate(game->physics_space, physics_comp->body, size, friction);
+	add_physics_sync(game, game->physics_ent, physics_comp->body, &transform_comp->transform);
 
 	model_component_t* model_comp = ecs_entity_get_component(game->ecs, game->physics_ent, game->model_type, true);
 	model_comp->mesh_info = &game->hex_mesh;
 	model_comp->shader_info = &game->cube_shader;
-
-	uint64_t k_circle_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->name_type);
-	uint64_t k_circle_ent_rep_mask =
-		(1ULL << game->transform_type);
+	model_comp->radius = game->hex_radius;
+	push_static_model(game, type, &transform_comp->transform, model_comp);
+
+	ecs_mask_t k_circle_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->visibility_type,
+		game->name_type);
+	ecs_mask_t k_circle_ent_rep_mask = ECS_MASK(game->transform_type);
 	net_state_register_entity_type(game->net, 0, k_circle_ent_net_mask, k_circle_ent_rep_mask, player_net_configure, game);
 
 	net_state_register_entity_instance(game->net, 0, game->physics_ent);
@@ -356,13 +1108,13 @@ static void spawn_circle(physics_sandbox_t* game, int index, float size, vec3f_t
 
 static void spawn_camera(physics_sandbox_t* game)
 {
-	uint64_t k_camera_ent_mask =
-		(1ULL << game->camera_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_camera_ent_mask = ECS_MASK(
+		game->camera_type,
+		game->name_type);
 	game->camera_ent = ecs_entity_add(game->ecs, k_camera_ent_mask);
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->camera_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "camera");
+	name_comp->name = string_id_intern("camera");
 
 	camera_component_t* camera_comp = ecs_entity_get_component(game->ecs, game->camera_ent, game->camera_type, true);
 	mat4f_make_orthographic(&camera_comp->projection, screen_size, 2.0f, -1000.0f, 1000.0f);
@@ -373,13 +1125,177 @@ static void spawn_camera(physics_sandbox_t* game)
 	mat4f_make_lookat(&camera_comp->view, &eye_pos, &forward, &up);
 }
 
-static void update_players(physics_sandbox_t* game)
+// Spawn a cube that follows parent, placed at local relative to it.
+static void spawn_attachment(physics_sandbox_t* game, ecs_entity_ref_t parent, const transform_t* local)
+{
+	ecs_mask_t k_attachment_ent_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->visibility_type,
+		game->hierarchy_type,
+		game->name_type);
+	ecs_entity_ref_t entity = ecs_entity_add(game->ecs, k_attachment_ent_mask);
+
+	name_component_t* name_comp = ecs_entity_get_component(game->ecs, entity, game->name_type, true);
+	name_comp->name = string_id_intern("attachment");
+
+	model_component_t* model_comp = ecs_entity_get_component(game->ecs, entity, game->model_type, true);
+	model_comp->mesh_info = &game->cube_mesh;
+	model_comp->shader_info = &game->cube_shader;
+	model_comp->radius = game->cube_radius;
+
+	hierarchy_set_parent(game->hierarchy, entity, parent, local);
+}
+
+// Create a body in the game's space, from its pool when it has one.
+static cpBody* create_body(physics_sandbox_t* game, cpBodyType type, cpFloat mass, cpFloat moment, cpVect pos, cpFloat angle)
+{
+	if (game->body_pool)
+	{
+		return physicsRigidBodyCreatePooled(game->physics_space, game->body_pool, type, mass, moment, pos, angle);
+	}
+	return physicsRigidBodyCreate(game->physics_space, type, mass, moment, pos, angle);
+}
+
+// Track a physics entity's body so sync_physics can write its transform, and write it now.
+// Static bodies are never awake, so this is the only time their transform is written.
+static void add_physics_sync(physics_sandbox_t* game, ecs_entity_ref_t entity, cpBody* body, transform_t* transform)
+{
+	if (game->physics_sync_count == game->physics_sync_capacity)
+	{
+		physics_sync_t* syncs = heap_alloc(game->heap, sizeof(physics_sync_t) * game->physics_sync_capacity * 2, 8);
+		memcpy(syncs, game->physics_syncs, sizeof(physics_sync_t) * game->physics_sync_count);
+		heap_free(game->heap, game->physics_syncs);
+		game->physics_syncs = syncs;
+		game->physics_sync_capacity *= 2;
+	}
+
+	//user data 0 marks bodies without a sync, such as the player's
+	int index = game->physics_sync_count++;
+	physics_sync_t* sync = &game->physics_syncs[index];
+	memset(sync, 0, sizeof(*sync));
+	sync->entity = entity;
+	store_body_state(sync, body);
+	sync->prev_translation = sync->translation;
+	sync->prev_rotation = sync->rotation;
+	sync->synced = true;
+	physicsRigidBodySetUserData(body, (cpDataPointer)(uintptr_t)(index + 1));
+
+	transform->translation = sync->translation;
+	transform->rotation = sync->rotation;
+}
+
+// Components a body's model needs. Static bodies drawn here are left out of the model query, without
+// visibility, since their models are drawn from the renderer's static set instead.
+static ecs_mask_t model_mask(physics_sandbox_t* game, cpBodyType type)
+{
+	ecs_mask_t mask = ECS_MASK(game->model_type);
+	if (type != CP_BODY_TYPE_STATIC || !game->render)
+	{
+		ecs_mask_set(&mask, game->visibility_type);
+	}
+	return mask;
+}
+
+// Add a static body's model to the renderer's static set, which draws it every frame without it being pushed again.
+static void push_static_model(physics_sandbox_t* game, cpBodyType type, const transform_t* transform, const model_component_t* model_comp)
+{
+	if (type == CP_BODY_TYPE_STATIC && game->render)
+	{
+		mat4f_t* model = render_push_static_instances(game->render, model_comp->mesh_info, model_comp->shader_info, sizeof(mat4f_t), 1);
+		transform_to_matrix(transform, model);
+	}
+}
+
+// Shift a body's current state to its previous one and read its new current state.
+static void store_body_state(physics_sync_t* sync, const cpBody* body)
 {
+	vec3f_t translation = vec3f_new((float)body->p.x, (float)-body->p.y, 0.0f);
+	quatf_t rotation = quatf_from_z_angle(-(float)body->a);
+
+	//the transform stays stale until it has caught up to a state that holds still
+	if (memcmp(&sync->translation, &sync->prev_translation, sizeof(vec3f_t)) ||
+		memcmp(&sync->rotation, &sync->prev_rotation, sizeof(quatf_t)) ||
+		memcmp(&translation, &sync->translation, sizeof(vec3f_t)) ||
+		memcmp(&rotation, &sync->rotation, sizeof(quatf_t)))
+	{
+		sync->synced = false;
+	}
+	sync->prev_translation = sync->translation;
+	sync->prev_rotation = sync->rotation;
+	sync->translation = translation;
+	sync->rotation = rotation;
+}
+
+// Snap the transform of a body falling asleep to where it came to rest, since sync_physics only walks awake bodies.
+// Its entity isn't marked changed again until it wakes, so resting piles cost no replication either.
+static void physics_sleep(cpSpace* space, cpBody* body, cpBool sleeping, void* data)
+{
+	physics_sandbox_t* game = data;
+	uintptr_t sync_index = (uintptr_t)body->userData;
+	if (!sync_index)
+	{
+		return;
+	}
+
+	physics_sync_t* sync = &game->physics_syncs[sync_index - 1];
+	if (sleeping)
+	{
+		store_body_state(sync, body);
+		sync->prev_translation = sync->translation;
+		sync->prev_rotation = sync->rotation;
+
+		transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, sync->entity, game->transform_type, true);
+		transform_comp->transform.translation = sync->translation;
+		transform_comp->transform.rotation = sync->rotation;
+		ecs_entity_mark_changed(game->ecs, sync->entity, game->transform_type);
+	}
+	sync->synced = sleeping;
+}
+
+// Advance physics in fixed steps by the time the accumulator holds.
+// Renders land between steps, so sync_physics blends each body between its last two states.
+static void step_physics(physics_sandbox_t* game)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_physics, "step_physics");
+	uint64_t start_ticks = timer_get_ticks();
+
+	for (int step = 0; step < k_max_physics_steps && game->physics_accumulator >= physics_time_step; ++step)
+	{
+		physicsSpaceStep(game->physics_space, physics_time_step);
+		game->physics_accumulator -= physics_time_step;
+
+		int body_count;
+		cpBody** bodies = physicsSpaceGetAwakeBodies(game->physics_space, &body_count);
+		for (int i = 0; i < body_count; ++i)
+		{
+			uintptr_t sync_index = (uintptr_t)bodies[i]->userData;
+			if (sync_index)
+			{
+				store_body_state(&game->physics_syncs[sync_index - 1], bodies[i]);
+			}
+		}
+	}
+	game->physics_accumulator = fmod(game->physics_accumulator, physics_time_step);
+	game->physics_alpha = (float)(game->physics_accumulator / physics_time_step);
+
+	if (PHYSICS_OPTIMIZE_US)
+	{
+		physicsSpaceOptimizeBroadphase(game->physics_space, PHYSICS_OPTIMIZE_US);
+	}
+	frame_stats_add(frame_stats_get_default(), k_frame_stat_physics_us, timer_ticks_to_us(timer_get_ticks() - start_ticks));
+	TRACE_ZONE_END(k_trace_category_physics);
+}
+
+static void update_players(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user)
+{
+	physics_sandbox_t* game = user;
+
 	float dt = (float)timer_object_get_delta_ms(game->timer) * 0.001f;
 
-	uint32_t key_mask = wm_get_key_mask(game->window);
+	uint32_t key_mask = game->key_mask;
 
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->player_type);
+	ecs_mask_t k_query_mask = ECS_MASK(game->transform_type, game->player_type);
 
 	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
 		ecs_query_is_valid(game->ecs, &query);
@@ -388,80 +1304,215 @@ static void update_players(physics_sandbox_t* game)
 		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
 		player_component_t* player_comp = ecs_query_get_component(game->ecs, &query, game->player_type);
 
-		transform_comp->transform.translation.x = (float)player_comp->body->p.x;
-		transform_comp->transform.translation.y = (float)-player_comp->body->p.y;
+		//the transform is predicted from input and corrected by the server; the body follows it over the next
+		//update's steps, which take about as long as this frame did
+		player_input_t input = { .key_mask = key_mask, .dt = dt };
+		net_input_push(game->net, ecs_query_get_entity(game->ecs, &query), &input);
 
-		float vel_x = 0.0f;
-		float vel_y = 0.0f;
-		if (key_mask & k_key_up)
-		{
-			vel_y += 1.0f;
-		}
-		if (key_mask & k_key_down)
-		{
-			vel_y -= 1.0f;
-		}
-		if (key_mask & k_key_left)
+		cpVect target = cpv(transform_comp->transform.translation.x, -transform_comp->transform.translation.y);
+		physicsRigidBodySetVelocity(player_comp->body, cpvmult(cpvsub(target, player_comp->body->p), 1.0f / fmaxf(dt, physics_time_step)));
+	}
+}
+
+// Record a packet the game's net processes into the frame in progress.
+static void record_packet(const net_address_t* address, const void* data, int size, void* user)
+{
+	replay_record_packet(user, address, data, size);
+}
+
+static void update_hierarchy(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user)
+{
+	physics_sandbox_t* game = user;
+	hierarchy_update(game->hierarchy);
+}
+
+// Move a player by one input command.
+// Runs for our own player as it is pushed and when replayed after a correction, and on the server for every player.
+static void player_input(ecs_t* ecs, ecs_entity_ref_t entity, const void* input, void* user)
+{
+	physics_sandbox_t* game = user;
+	const player_input_t* player_input = input;
+	uint32_t key_mask = player_input->key_mask;
+
+	transform_component_t* transform_comp = ecs_entity_get_component(ecs, entity, game->transform_type, true);
+
+	float vel_x = 0.0f;
+	float vel_y = 0.0f;
+	if (key_mask & k_key_up)
+	{
+		vel_y += 1.0f;
+	}
+	if (key_mask & k_key_down)
+	{
+		vel_y -= 1.0f;
+	}
+	if (key_mask & k_key_left)
+	{
+		vel_x += 1.0f;
+	}
+	if (key_mask & k_key_right)
+	{
+		vel_x -= 1.0f;
+	}
+	transform_comp->transform.translation.x += vel_x * 10.0f * player_input->dt;
+	transform_comp->transform.translation.y -= vel_y * 10.0f * player_input->dt;
+	ecs_entity_mark_changed(ecs, entity, game->transform_type);
+}
+
+// Write the blended state of every awake body that has moved into its entity's transform.
+// Sleeping and static bodies, and bodies whose transform has caught up to them, are skipped, and so aren't marked changed.
+static void sync_physics(physics_sandbox_t* game)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_physics, "sync_physics");
+	float alpha = game->physics_alpha;
+
+	int body_count;
+	cpBody** bodies = physicsSpaceGetAwakeBodies(game->physics_space, &body_count);
+	for (int i = 0; i < body_count; ++i)
+	{
+		uintptr_t sync_index = (uintptr_t)bodies[i]->userData;
+		if (!sync_index)
 		{
-			vel_x += 1.0f;
+			continue;
 		}
-		if (key_mask & k_key_right)
+		physics_sync_t* sync = &game->physics_syncs[sync_index - 1];
+		if (sync->synced)
 		{
-			vel_x -= 1.0f;
+			continue;
 		}
-		physicsRigidBodySetVelocity(player_comp->body, cpvmult(cpv(vel_x, vel_y), 10.0f));
+
+		transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, sync->entity, game->transform_type, false);
+		transform_comp->transform.translation = vec3f_lerp(sync->prev_translation, sync->translation, alpha);
+		transform_comp->transform.rotation = quatf_nlerp(sync->prev_rotation, sync->rotation, alpha);
+		ecs_entity_mark_changed(game->ecs, sync->entity, game->transform_type);
+
+		sync->synced =
+			!memcmp(&sync->translation, &sync->prev_translation, sizeof(vec3f_t)) &&
+			!memcmp(&sync->rotation, &sync->prev_rotation, sizeof(quatf_t));
 	}
+	TRACE_ZONE_END(k_trace_category_physics);
 }
 
-static void update_physics(physics_sandbox_t* game)
+static void cull_models(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user)
 {
-	float dt = (float)timer_object_get_delta_ms(game->timer) * 0.001f;
+	physics_sandbox_t* game = user;
 
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->physics_type);
+	// Called by the scheduler for each chunk of models, possibly in parallel.
+	transform_component_t* transform_comps = ecs_chunk_query_get_components(ecs, chunk, game->transform_type);
+	model_component_t* model_comps = ecs_chunk_query_get_components(ecs, chunk, game->model_type);
+	visibility_component_t* visibility_comps = ecs_chunk_query_get_components(ecs, chunk, game->visibility_type);
+	int count = ecs_chunk_query_get_count(ecs, chunk);
 
-	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
-		ecs_query_is_valid(game->ecs, &query);
-		ecs_query_next(game->ecs, &query))
+	for (int first = 0; first < count; first += k_cull_batch_size)
 	{
-		transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-		physics_component_t* physics_comp = ecs_query_get_component(game->ecs, &query, game->physics_type);
+		int batch_count = __min(count - first, k_cull_batch_size);
+
+		//models are centered on their origin, so their world bounds follow the translation and largest scale
+		frustum_sphere_t spheres[k_cull_batch_size];
+		for (int i = 0; i < batch_count; ++i)
+		{
+			const transform_t* transform = &transform_comps[first + i].transform;
+			float scale = fmaxf(fabsf(transform->scale.x), fmaxf(fabsf(transform->scale.y), fabsf(transform->scale.z)));
+			spheres[i].center = transform->translation;
+			spheres[i].radius = model_comps[first + i].radius * scale;
+			visibility_comps[first + i].camera_mask = 0;
+		}
 
-		transform_comp->transform.translation.x = (float)physics_comp->body->p.x;
-		transform_comp->transform.translation.y = (float)-physics_comp->body->p.y;
-		transform_comp->transform.rotation = quatf_from_eulers(vec3f_new(0.0f, 0.0f, -(float)physics_comp->body->a));
+		int camera_index = 0;
+		for (ecs_query_t camera_query = ecs_query_create_registered(ecs, game->camera_query);
+			ecs_query_is_valid(ecs, &camera_query) && camera_index < 64;
+			ecs_query_next(ecs, &camera_query), ++camera_index)
+		{
+			camera_component_t* camera_comp = ecs_query_get_component(ecs, &camera_query, game->camera_type);
+
+			frustum_t frustum;
+			frustum_from_camera(&frustum, &camera_comp->projection, &camera_comp->view);
+
+			bool visible[k_cull_batch_size];
+			frustum_cull_spheres(&frustum, spheres, batch_count, visible);
+			for (int i = 0; i < batch_count; ++i)
+			{
+				visibility_comps[first + i].camera_mask |= (uint64_t)visible[i] << camera_index;
+			}
+		}
 	}
 }
 
-static void draw_models(physics_sandbox_t* game)
+static void draw_models(ecs_t* ecs, ecs_chunk_query_t* chunk, void* user)
 {
-	uint64_t k_camera_query_mask = (1ULL << game->camera_type);
-	for (ecs_query_t camera_query = ecs_query_create(game->ecs, k_camera_query_mask);
-		ecs_query_is_valid(game->ecs, &camera_query);
-		ecs_query_next(game->ecs, &camera_query))
+	physics_sandbox_t* game = user;
+
+	int camera_index = 0;
+	for (ecs_query_t camera_query = ecs_query_create_registered(game->ecs, game->camera_query);
+		ecs_query_is_valid(game->ecs, &camera_query) && camera_index < 64;
+		ecs_query_next(game->ecs, &camera_query), ++camera_index)
 	{
 		camera_component_t* camera_comp = ecs_query_get_component(game->ecs, &camera_query, game->camera_type);
 
-		uint64_t k_model_query_mask = (1ULL << game->transform_type) | (1ULL << game->model_type);
-		for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
-			ecs_query_is_valid(game->ecs, &query);
-			ecs_query_next(game->ecs, &query))
+		struct
+		{
+			mat4f_t projection;
+			mat4f_t view;
+		} uniform_data;
+		uniform_data.projection = camera_comp->projection;
+		uniform_data.view = camera_comp->view;
+		gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
+
+		//the static set is drawn from the first camera
+		if (camera_index == 0)
 		{
-			transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
-			model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
-			ecs_entity_ref_t entity_ref = ecs_query_get_entity(game->ecs, &query);
+			render_set_static_uniform(game->render, &uniform_info);
+		}
 
-			struct
+		for (ecs_chunk_query_t query = ecs_chunk_query_create_registered(game->ecs, game->model_query);
+			ecs_chunk_query_is_valid(game->ecs, &query);
+			ecs_chunk_query_next(game->ecs, &query))
+		{
+			transform_component_t* transform_comps = ecs_chunk_query_get_components(game->ecs, &query, game->transform_type);
+			model_component_t* model_comps = ecs_chunk_query_get_components(game->ecs, &query, game->model_type);
+#if !GPU_CULLING
+			visibility_component_t* visibility_comps = ecs_chunk_query_get_components(game->ecs, &query, game->visibility_type);
+#endif
+			int count = ecs_chunk_query_get_count(game->ecs, &query);
+
+			//every model of a mesh shares the camera and is drawn in one instanced draw;
+			//runs of models with the same mesh and shader convert their transforms straight into the draw's instances
+			for (int first = 0, last = 0; first < count; first = last)
 			{
-				mat4f_t projection;
-				mat4f_t model;
-				mat4f_t view;
-			} uniform_data;
-			uniform_data.projection = camera_comp->projection;
-			uniform_data.view = camera_comp->view;
-			transform_to_matrix(&transform_comp->transform, &uniform_data.model);
-			gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
-
-			render_push_model(game->render, &entity_ref, model_comp->mesh_info, model_comp->shader_info, &uniform_info);
+				model_component_t* model_comp = &model_comps[first];
+				float radius = model_comp->radius;
+#if GPU_CULLING
+				bool visible = true;
+#else
+				bool visible = (visibility_comps[first].camera_mask & (1ULL << camera_index)) != 0;
+#endif
+				for (last = first + 1; last < count; ++last)
+				{
+					if (model_comps[last].mesh_info != model_comp->mesh_info ||
+						model_comps[last].shader_info != model_comp->shader_info)
+					{
+						break;
+					}
+#if !GPU_CULLING
+					if (((visibility_comps[last].camera_mask & (1ULL << camera_index)) != 0) != visible)
+					{
+						break;
+					}
+#endif
+					radius = __max(radius, model_comps[last].radius);
+				}
+
+				if (visible)
+				{
+					//transform components hold only a transform, so a chunk's components are an array of transforms
+#if GPU_CULLING
+					mat4f_t* models = render_push_culled_instances(game->render, model_comp->mesh_info, model_comp->shader_info, &game->cull_shader, &uniform_info, radius, last - first);
+#else
+					mat4f_t* models = render_push_instances(game->render, model_comp->mesh_info, model_comp->shader_info, &uniform_info, sizeof(mat4f_t), last - first);
+#endif
+					transform_to_matrix_batch(&transform_comps[first].transform, last - first, models);
+				}
+			}
 		}
 	}
 }
@@ -3,19 +3,100 @@
 // Simple Test Game
 // Brings together major engine systems to make a very simple "game."
 
+#include <stdbool.h>
+
 typedef struct physics_sandbox_t physics_sandbox_t;
 
 typedef struct fs_t fs_t;
 typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
 typedef struct render_t render_t;
 typedef struct wm_window_t wm_window_t;
 
 // Create an instance of simple test game.
-physics_sandbox_t* physics_sandbox_create(heap_t* heap, fs_t* fs, wm_window_t* window, render_t* render, int argc, const char** argv);
+// ECS systems run as jobs on the provided job system.
+// Window and render may both be NULL to run as a dedicated server: no local player or drawing,
+// simulating its clients' players and replicating the world to them.
+physics_sandbox_t* physics_sandbox_create(heap_t* heap, fs_t* fs, job_system_t* jobs, wm_window_t* window, render_t* render, int argc, const char** argv);
+
+// Options for creating an instance of simple test game.
+// Zero-initialized options match physics_sandbox_create().
+typedef struct physics_sandbox_options_t
+{
+	// Record the session's frames to this file, written when the game is destroyed. See replay.h.
+	const char* record_path;
+
+	// Play back the frames recorded in this file instead of reading the window's input and the network,
+	// stepping the game's clock by each frame's recorded time however long the frame really takes.
+	const char* replay_path;
+} physics_sandbox_options_t;
+
+// Create an instance of simple test game with options.
+// Otherwise the same as physics_sandbox_create(); a playback does not connect to the server address given.
+physics_sandbox_t* physics_sandbox_create_with_options(heap_t* heap, fs_t* fs, job_system_t* jobs, wm_window_t* window, render_t* render, int argc, const char** argv, const physics_sandbox_options_t* options);
+
+// Has the game played back every recorded frame, or failed to read the recording.
+// Always false for games not created to play one back; updates once it is true change nothing.
+bool physics_sandbox_is_replay_finished(physics_sandbox_t* game);
 
 // Destroy an instance of simple test game.
 void physics_sandbox_destroy(physics_sandbox_t* game);
 
 // Per-frame update for our simple test game.
 void physics_sandbox_update(physics_sandbox_t* game);
+
+// Shapes, joints and threading of a stress scene. See physics_sandbox_create_stress().
+typedef struct physics_sandbox_stress_t
+{
+	// Dynamic bodies, dropped in a grid over a floor.
+	int body_count;
+	// Percentage of the bodies that are circles; the rest are boxes.
+	int circle_percent;
+	// Pivot joints, each joining a body to its neighbour in a row of the grid.
+	int joint_count;
+	// Spatial index the space finds colliding pairs with, a physicsBroadphase.
+	int broadphase;
+	// Take the bodies from a pool in the order their entities are made, so stepping and syncing them walks memory
+	// in order, rather than allocating each on its own.
+	bool pooled_bodies;
+	// Workers the physics solver is split across, or 0 for the game's default.
+	int thread_count;
+	// Updates to time, each one fixed physics step, after a few untimed ones.
+	int step_count;
+} physics_sandbox_stress_t;
+
+// Create an instance of the game holding a stress scene instead of the usual one, without a window or local player.
+// The same options give the same scene, so runs can be compared. Render may be NULL to leave out drawing.
+// Destroy it with physics_sandbox_destroy().
+physics_sandbox_t* physics_sandbox_create_stress(heap_t* heap, fs_t* fs, job_system_t* jobs, render_t* render, const physics_sandbox_stress_t* stress);
+
+// Run the updates of a stress scene as fast as they go and print how long each phase of an update took on average,
+// from the physics step's integration, broadphase, narrowphase and solver to draw submission,
+// along with percentiles of the whole update.
+void physics_sandbox_run_stress(physics_sandbox_t* game);
+
+// Simulated clients and the link between them and the server in a network load test. See physics_sandbox_run_net_load().
+typedef struct physics_sandbox_net_load_t
+{
+	// Clients connected to the server over loopback, each a windowless game whose player walks by scripted input.
+	int client_count;
+	// Seconds to time the server for, after a second for the clients to connect.
+	int seconds;
+	// Updates per second of the server and clients, or 0 to update as fast as they go.
+	int update_rate;
+	// Link conditioning of packets each way, as net_link_t: latency and jitter in milliseconds,
+	// percentage of packets lost and bytes per second each peer may send, or 0 for no cap.
+	int latency_ms;
+	int jitter_ms;
+	int loss_percent;
+	int bandwidth;
+	// Sockets the server receives on, each with its own thread, with the clients spread across them, or 0 for one.
+	int shard_count;
+} physics_sandbox_net_load_t;
+
+// Run a dedicated server with the usual scene and a number of simulated clients in this process, over loopback,
+// then print the server's game thread time per client, the bytes it exchanged with each client per tick
+// and how long clients took to apply the snapshots they received, for sizing servers.
+// Returns zero on success, or nonzero if not every client connected.
+int physics_sandbox_run_net_load(heap_t* heap, fs_t* fs, job_system_t* jobs, const physics_sandbox_net_load_t* load);
 #pragma once
@@ -0,0 +1,379 @@
+#include "profiler.h"
+
+#include "atomic.h"
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "thread.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <DbgHelp.h>
+#include <TlHelp32.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	k_profiler_max_frames = 48,
+	k_profiler_max_threads = 64,
+	k_profiler_max_stacks = 16 * 1024, //distinct callstacks kept; must be a power of two
+	k_profiler_refresh_samples = 64, //samples between scans for threads created or exited
+	k_profiler_max_name = 64,
+};
+
+typedef struct profiler_stack_t
+{
+	uint64_t hash; //zero marks an unused slot
+	DWORD tid;
+	int count;
+	int frames;
+	void* stack[k_profiler_max_frames]; //innermost frame first
+} profiler_stack_t;
+
+typedef struct profiler_thread_t
+{
+	DWORD tid;
+	HANDLE handle;
+} profiler_thread_t;
+
+typedef struct profiler_name_t
+{
+	DWORD tid;
+	char name[k_profiler_max_name];
+} profiler_name_t;
+
+typedef struct profiler_t
+{
+	heap_t* heap;
+	int interval_ms;
+
+	thread_t* thread;
+	int stopping;
+
+	profiler_thread_t threads[k_profiler_max_threads];
+	int thread_count;
+
+	//names are kept for every thread seen, so stacks of exited threads still get one
+	profiler_name_t names[k_profiler_max_threads];
+	int name_count;
+
+	profiler_stack_t* stacks;
+	int stack_count;
+	int sample_count;
+	int dropped_count;
+} profiler_t;
+
+static int sample_thread_func(void* user);
+static void refresh_threads(profiler_t* profiler, DWORD self);
+static void close_threads(profiler_t* profiler);
+static void sample_thread(profiler_t* profiler, profiler_thread_t* thread);
+static int walk_stack(CONTEXT* context, void** stack, int stack_capacity);
+static void record_sample(profiler_t* profiler, DWORD tid, void** stack, int frames);
+static const char* get_thread_name(profiler_t* profiler, DWORD tid);
+
+profiler_t* profiler_create(heap_t* heap, int interval_ms)
+{
+	profiler_t* profiler = heap_alloc(heap, sizeof(profiler_t), 8);
+	memset(profiler, 0, sizeof(*profiler));
+	profiler->heap = heap;
+	profiler->interval_ms = interval_ms;
+	profiler->stacks = heap_alloc(heap, sizeof(profiler_stack_t) * k_profiler_max_stacks, 8);
+	memset(profiler->stacks, 0, sizeof(profiler_stack_t) * k_profiler_max_stacks);
+	return profiler;
+}
+
+void profiler_destroy(profiler_t* profiler)
+{
+	profiler_stop(profiler);
+	heap_free(profiler->heap, profiler->stacks);
+	heap_free(profiler->heap, profiler);
+}
+
+void profiler_start(profiler_t* profiler)
+{
+	if (profiler->thread)
+	{
+		return;
+	}
+	atomic_store(&profiler->stopping, 0);
+	thread_options_t options = { .name = "Profiler", .priority = k_thread_priority_critical };
+	profiler->thread = thread_create_with_options(sample_thread_func, profiler, &options);
+}
+
+void profiler_stop(profiler_t* profiler)
+{
+	if (!profiler->thread)
+	{
+		return;
+	}
+	atomic_store(&profiler->stopping, 1);
+	thread_destroy(profiler->thread);
+	profiler->thread = NULL;
+
+	if (profiler->dropped_count)
+	{
+		debug_print(k_print_warning, "Profiler dropped %d of %d samples; too many distinct callstacks.\n",
+			profiler->dropped_count, profiler->sample_count);
+	}
+}
+
+int profiler_write_folded(profiler_t* profiler, fs_t* fs, const char* path)
+{
+	size_t capacity = 64 * 1024;
+	size_t size = 0;
+	char* buffer = heap_alloc(profiler->heap, capacity, 8);
+
+	for (int i = 0; i < k_profiler_max_stacks; ++i)
+	{
+		profiler_stack_t* stack = &profiler->stacks[i];
+		if (!stack->hash)
+		{
+			continue;
+		}
+
+		//folded stacks run from the root to the innermost frame, then the sample count
+		char line[4096];
+		int length = snprintf(line, sizeof(line), "%s", get_thread_name(profiler, stack->tid));
+		for (int f = stack->frames - 1; f >= 0 && length < (int)sizeof(line); --f)
+		{
+			//most frames recur across stacks, so after the first the names come from the symbol cache
+			void* address = stack->stack[f];
+			char name[128];
+			if (debug_symbolize(address, name, sizeof(name)))
+			{
+				length += snprintf(line + length, sizeof(line) - length, ";%s", name);
+			}
+			else
+			{
+				length += snprintf(line + length, sizeof(line) - length, ";0x%llx", (unsigned long long)(uintptr_t)address);
+			}
+		}
+		length = __min(length, (int)sizeof(line) - 32);
+		length += snprintf(line + length, sizeof(line) - length, " %d\n", stack->count);
+
+		if (size + length > capacity)
+		{
+			size_t new_capacity = __max(capacity * 2, size + length);
+			buffer = heap_realloc(profiler->heap, buffer, new_capacity, 8);
+			capacity = new_capacity;
+		}
+		memcpy(buffer + size, line, length);
+		size += length;
+	}
+
+	fs_work_t* work = fs_write(fs, path, buffer, size, false);
+	fs_work_wait(work);
+	int result = fs_work_get_result(work);
+	fs_work_destroy(work);
+	heap_free(profiler->heap, buffer);
+
+	debug_print(result ? k_print_error : k_print_info, "Profiler wrote %d samples in %d callstacks to %s.\n",
+		profiler->sample_count - profiler->dropped_count, profiler->stack_count, path);
+	return result;
+}
+
+static int sample_thread_func(void* user)
+{
+	profiler_t* profiler = user;
+	DWORD self = GetCurrentThreadId();
+
+	for (int tick = 0; !atomic_load(&profiler->stopping); ++tick)
+	{
+		if (tick % k_profiler_refresh_samples == 0)
+		{
+			refresh_threads(profiler, self);
+		}
+		for (int i = 0; i < profiler->thread_count; ++i)
+		{
+			sample_thread(profiler, &profiler->threads[i]);
+		}
+		thread_sleep(profiler->interval_ms);
+	}
+
+	close_threads(profiler);
+	return 0;
+}
+
+static void refresh_threads(profiler_t* profiler, DWORD self)
+{
+	close_threads(profiler);
+
+	HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+	if (snapshot == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	DWORD pid = GetCurrentProcessId();
+	THREADENTRY32 entry = { .dwSize = sizeof(entry) };
+	for (BOOL more = Thread32First(snapshot, &entry); more && profiler->thread_count < k_profiler_max_threads; more = Thread32Next(snapshot, &entry))
+	{
+		if (entry.th32OwnerProcessID != pid || entry.th32ThreadID == self)
+		{
+			continue;
+		}
+
+		HANDLE handle = OpenThread(THREAD_SUSPEND_RESUME | THREAD_GET_CONTEXT | THREAD_QUERY_LIMITED_INFORMATION, FALSE, entry.th32ThreadID);
+		if (!handle)
+		{
+			continue;
+		}
+
+		profiler_thread_t* thread = &profiler->threads[profiler->thread_count++];
+		thread->tid = entry.th32ThreadID;
+		thread->handle = handle;
+
+		bool named = false;
+		for (int i = 0; i < profiler->name_count && !named; ++i)
+		{
+			named = profiler->names[i].tid == thread->tid;
+		}
+		if (!named && profiler->name_count < k_profiler_max_threads)
+		{
+			profiler_name_t* name = &profiler->names[profiler->name_count++];
+			name->tid = thread->tid;
+			name->name[0] = '\0';
+
+			PWSTR wide_name = NULL;
+			if (SUCCEEDED(GetThreadDescription(handle, &wide_name)) && wide_name)
+			{
+				WideCharToMultiByte(CP_UTF8, 0, wide_name, -1, name->name, sizeof(name->name), NULL, NULL);
+				LocalFree(wide_name);
+			}
+			if (!name->name[0])
+			{
+				snprintf(name->name, sizeof(name->name), "Thread %lu", thread->tid);
+			}
+		}
+	}
+
+	CloseHandle(snapshot);
+}
+
+static void close_threads(profiler_t* profiler)
+{
+	for (int i = 0; i < profiler->thread_count; ++i)
+	{
+		CloseHandle(profiler->threads[i].handle);
+	}
+	profiler->thread_count = 0;
+}
+
+static void sample_thread(profiler_t* profiler, profiler_thread_t* thread)
+{
+	if (SuspendThread(thread->handle) == (DWORD)-1)
+	{
+		return;
+	}
+
+	//nothing between suspend and resume may take a lock the suspended thread could hold
+	CONTEXT context = { 0 };
+	context.ContextFlags = CONTEXT_CONTROL | CONTEXT_INTEGER;
+	void* stack[k_profiler_max_frames];
+	int frames = 0;
+	if (GetThreadContext(thread->handle, &context))
+	{
+		frames = walk_stack(&context, stack, _countof(stack));
+	}
+
+	ResumeThread(thread->handle);
+
+	if (frames)
+	{
+		record_sample(profiler, thread->tid, stack, frames);
+	}
+}
+
+static int walk_stack(CONTEXT* context, void** stack, int stack_capacity)
+{
+#if defined(_M_X64)
+	//unwind with the image's unwind tables; DbgHelp's StackWalk64 allocates, so it can't be used here
+	int frames = 0;
+	__try
+	{
+		while (context->Rip && frames < stack_capacity)
+		{
+			stack[frames++] = (void*)context->Rip;
+
+			DWORD64 image_base;
+			PRUNTIME_FUNCTION function = RtlLookupFunctionEntry(context->Rip, &image_base, NULL);
+			if (function)
+			{
+				void* handler_data;
+				DWORD64 establisher_frame;
+				RtlVirtualUnwind(UNW_FLAG_NHANDLER, image_base, context->Rip, function, context, &handler_data, &establisher_frame, NULL);
+			}
+			else
+			{
+				//leaf functions have no unwind data and leave the return address on top of the stack
+				context->Rip = *(DWORD64*)context->Rsp;
+				context->Rsp += 8;
+			}
+		}
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER)
+	{
+		//a stack caught mid-update can unwind into garbage; keep the frames found so far
+	}
+	return frames;
+#else
+	//without unwind tables only the sampled instruction is reliable
+	stack[0] = (void*)context->Eip;
+	return stack_capacity > 0 ? 1 : 0;
+#endif
+}
+
+static void record_sample(profiler_t* profiler, DWORD tid, void** stack, int frames)
+{
+	++profiler->sample_count;
+
+	//FNV-1a over the thread and its frames
+	uint64_t hash = 0xcbf29ce484222325ull;
+	hash = (hash ^ tid) * 0x100000001b3ull;
+	for (int i = 0; i < frames; ++i)
+	{
+		hash = (hash ^ (uint64_t)(uintptr_t)stack[i]) * 0x100000001b3ull;
+	}
+	hash |= 1;
+
+	for (int probe = 0; probe < k_profiler_max_stacks; ++probe)
+	{
+		profiler_stack_t* entry = &profiler->stacks[(hash + probe) & (k_profiler_max_stacks - 1)];
+		if (!entry->hash)
+		{
+			if (profiler->stack_count >= k_profiler_max_stacks / 2)
+			{
+				//keep the table half empty so probes stay short
+				break;
+			}
+			entry->hash = hash;
+			entry->tid = tid;
+			entry->count = 1;
+			entry->frames = frames;
+			memcpy(entry->stack, stack, sizeof(void*) * frames);
+			++profiler->stack_count;
+			return;
+		}
+		if (entry->hash == hash && entry->tid == tid && entry->frames == frames &&
+			memcmp(entry->stack, stack, sizeof(void*) * frames) == 0)
+		{
+			++entry->count;
+			return;
+		}
+	}
+	++profiler->dropped_count;
+}
+
+static const char* get_thread_name(profiler_t* profiler, DWORD tid)
+{
+	for (int i = 0; i < profiler->name_count; ++i)
+	{
+		if (profiler->names[i].tid == tid)
+		{
+			return profiler->names[i].name;
+		}
+	}
+	return "Unknown Thread";
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Sampling CPU profiler.
+// A background thread periodically suspends every other thread in the process, captures
+// its callstack and counts how often each distinct callstack is seen. This finds hot spots
+// in code that is not instrumented with trace zones.
+// Results are written in the folded stack format read by flamegraph.pl and speedscope.
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+
+// Handle to a sampling profiler.
+typedef struct profiler_t profiler_t;
+
+// Creates a sampling profiler that samples every interval milliseconds once started.
+// All memory for samples is allocated up front; sampling never allocates, since a
+// suspended thread may hold the heap's lock.
+profiler_t* profiler_create(heap_t* heap, int interval_ms);
+
+// Destroys a sampling profiler, stopping it first if it is running.
+void profiler_destroy(profiler_t* profiler);
+
+// Start sampling on a background thread.
+// Samples accumulate across multiple starts and stops.
+void profiler_start(profiler_t* profiler);
+
+// Stop sampling and wait for the background thread to exit.
+void profiler_stop(profiler_t* profiler);
+
+// Write the samples collected so far as folded stacks, one line per distinct callstack,
+// rooted at the thread's name. The profiler must be stopped.
+// Returns zero on success.
+int profiler_write_folded(profiler_t* profiler, fs_t* fs, const char* path);
@@ -29,7 +29,7 @@ vec3f_t quatf_to_eulers(quatf_t q)
 	float cosy = 1.0f - 2.0f * (q.y * q.y + q.z * q.z);
 	float yaw = atan2f(siny, cosy);
 
-	return (vec3f_t) { .x = roll, .x = pitch, .x = yaw };
+	return (vec3f_t) { .x = roll, .y = pitch, .z = yaw };
 }
 
 quatf_t quatf_from_eulers(vec3f_t euler_angles)
@@ -4,6 +4,10 @@
 
 #include "vec3f.h"
 
+#if MATH_SIMD
+#include <xmmintrin.h>
+#endif
+
 // Quaternion object.
 typedef struct quatf_t
 {
@@ -24,13 +28,21 @@ __forceinline quatf_t quatf_identity()
 __forceinline quatf_t quatf_mul(quatf_t a, quatf_t b)
 {
 	quatf_t result;
-
+#if MATH_SIMD
+	//a.w * b plus each of a's x, y and z times b shuffled and signed as the Hamilton product needs
+	__m128 qb = _mm_loadu_ps(&b.x);
+	__m128 r = _mm_mul_ps(_mm_set1_ps(a.w), qb);
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.x), _mm_mul_ps(_mm_shuffle_ps(qb, qb, _MM_SHUFFLE(0, 1, 2, 3)), _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f))));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.y), _mm_mul_ps(_mm_shuffle_ps(qb, qb, _MM_SHUFFLE(1, 0, 3, 2)), _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f))));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a.z), _mm_mul_ps(_mm_shuffle_ps(qb, qb, _MM_SHUFFLE(2, 3, 0, 1)), _mm_setr_ps(-1.0f, 1.0f, 1.0f, -1.0f))));
+	_mm_storeu_ps(&result.x, r);
+#else
 	result.v3 = vec3f_cross(a.v3, b.v3);
 	result.v3 = vec3f_add(result.v3, vec3f_scale(b.v3, a.s));
 	result.v3 = vec3f_add(result.v3, vec3f_scale(a.v3, b.s));
 
 	result.s = (a.s * b.s) - vec3f_dot(a.v3, b.v3);
-
+#endif
 	return result;
 }
 
@@ -56,3 +68,69 @@ vec3f_t quatf_to_eulers(quatf_t q);
 
 // Converts roll, yaw, pitch in radians to a quaternion.
 quatf_t quatf_from_eulers(vec3f_t euler_angles);
+
+// Creates a quaternion rotating by an angle in radians about a normalized axis.
+// The half angle's sine and cosine come from sincosf_approx().
+__forceinline quatf_t quatf_from_axis_angle(vec3f_t axis, float angle)
+{
+	float s;
+	float c;
+	sincosf_approx(angle * 0.5f, &s, &c);
+	return (quatf_t){ .x = axis.x * s, .y = axis.y * s, .z = axis.z * s, .w = c };
+}
+
+// Creates a quaternion rotating by an angle in radians about the Z axis, as for 2D rotations.
+// Matches quatf_from_eulers() with only a yaw, without the trigonometry for the other two angles.
+__forceinline quatf_t quatf_from_z_angle(float angle)
+{
+	float s;
+	float c;
+	sincosf_approx(angle * 0.5f, &s, &c);
+	return (quatf_t){ .x = 0.0f, .y = 0.0f, .z = s, .w = c };
+}
+
+// Gets the angle in radians, between -pi and pi, of a quaternion that only rotates about the Z axis.
+// Matches the yaw of quatf_to_eulers() for such a quaternion, with one arctangent instead of three and an arcsine.
+__forceinline float quatf_to_z_angle(quatf_t q)
+{
+	//q and -q are the same rotation; the one with positive w has a half angle within a quarter turn
+	float sign = q.w < 0.0f ? -1.0f : 1.0f;
+	return 2.0f * atan2f(sign * q.z, sign * q.w);
+}
+
+// Blends two normalized quaternions -- a toward b by f -- along the shorter arc, renormalizing the result.
+// Cheaper than spherical interpolation and close to it for the small angles between consecutive states.
+__forceinline quatf_t quatf_nlerp(quatf_t a, quatf_t b, float f)
+{
+#if MATH_SIMD
+	__m128 qa = _mm_loadu_ps(&a.x);
+	__m128 qb = _mm_loadu_ps(&b.x);
+	__m128 dot = _mm_mul_ps(qa, qb);
+	dot = _mm_add_ps(dot, _mm_movehl_ps(dot, dot));
+	dot = _mm_add_ss(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(1, 1, 1, 1)));
+	float sign = _mm_cvtss_f32(dot) < 0.0f ? -1.0f : 1.0f;
+
+	__m128 r = _mm_add_ps(_mm_mul_ps(qa, _mm_set1_ps(1.0f - f)), _mm_mul_ps(qb, _mm_set1_ps(sign * f)));
+	__m128 length = _mm_mul_ps(r, r);
+	length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(2, 3, 0, 1)));
+	length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(1, 0, 3, 2)));
+	quatf_t result;
+	_mm_storeu_ps(&result.x, _mm_div_ps(r, _mm_sqrt_ps(length)));
+	return result;
+#else
+	float sign = (a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w) < 0.0f ? -1.0f : 1.0f;
+	quatf_t result =
+	{
+		.x = lerpf(a.x, b.x * sign, f),
+		.y = lerpf(a.y, b.y * sign, f),
+		.z = lerpf(a.z, b.z * sign, f),
+		.w = lerpf(a.w, b.w * sign, f),
+	};
+	float scale = 1.0f / sqrtf(result.x * result.x + result.y * result.y + result.z * result.z + result.w * result.w);
+	result.x *= scale;
+	result.y *= scale;
+	result.z *= scale;
+	result.w *= scale;
+	return result;
+#endif
+}
@@ -1,76 +1,369 @@
+#include "queue.h"
+
 #include "atomic.h"
 #include "heap.h"
-#include "semaphore.h"
 
+enum
+{
+	k_cache_line_size = 64,
+};
+
+// Each slot's sequence says whose turn it is:
+// equal to a push index when free for that push, one past it once the item is published.
+typedef struct queue_slot_t
+{
+	int sequence;
+	void* item;
+} queue_slot_t;
+
+// Producer and consumer counters sit on separate cache lines so pushes and pops do not contend.
 typedef struct queue_t
 {
 	heap_t* heap;
-	semaphore_t* used_items;
-	semaphore_t* free_items;
-	void** items;
-	int capacity;
-	int head_index;
+	queue_slot_t* slots;
+	unsigned int capacity; //always a power of two
+	unsigned int mask;
+	char pad0[k_cache_line_size];
+
 	int tail_index;
+	int push_count; //bumped after every push; poppers park on it when empty
+	int pop_waiters;
+	char pad1[k_cache_line_size];
+
+	int head_index;
+	int pop_count; //bumped after every pop; pushers park on it when full
+	int push_waiters;
+	char pad2[k_cache_line_size];
 } queue_t;
 
+static bool slot_push(queue_t* queue, void* item);
+static bool slot_pop(queue_t* queue, void** item);
+static int slot_push_n(queue_t* queue, void** items, int count);
+static int slot_pop_n(queue_t* queue, void** items, int capacity);
+static void notify_push(queue_t* queue);
+static void notify_pop(queue_t* queue);
+static unsigned int load_counter(int* address);
+static void store_counter(int* address, unsigned int value);
+static unsigned int claim_counter(int* address, unsigned int compare, unsigned int exchange);
+
 queue_t* queue_create(heap_t* heap, int capacity)
 {
-	queue_t* queue = heap_alloc(heap, sizeof(queue_t), 8);
-	queue->items = heap_alloc(heap, sizeof(void*) * capacity, 8);
-	queue->used_items = semaphore_create(0, capacity);
-	queue->free_items = semaphore_create(capacity, capacity);
+	queue_t* queue = heap_alloc(heap, sizeof(queue_t), k_cache_line_size);
 	queue->heap = heap;
-	queue->capacity = capacity;
-	queue->head_index = 0;
+	queue->capacity = 1;
+	while (queue->capacity < (unsigned int)capacity)
+	{
+		queue->capacity <<= 1;
+	}
+	queue->mask = queue->capacity - 1;
+	queue->slots = heap_alloc(heap, sizeof(queue_slot_t) * queue->capacity, k_cache_line_size);
+	for (unsigned int i = 0; i < queue->capacity; ++i)
+	{
+		queue->slots[i].sequence = (int)i;
+		queue->slots[i].item = NULL;
+	}
 	queue->tail_index = 0;
+	queue->push_count = 0;
+	queue->pop_waiters = 0;
+	queue->head_index = 0;
+	queue->pop_count = 0;
+	queue->push_waiters = 0;
 	return queue;
 }
 
 void queue_destroy(queue_t* queue)
 {
-	semaphore_destroy(queue->used_items);
-	semaphore_destroy(queue->free_items);
-	heap_free(queue->heap, queue->items);
+	heap_free(queue->heap, queue->slots);
 	heap_free(queue->heap, queue);
 }
 
 void queue_push(queue_t* queue, void* item)
 {
-	semaphore_acquire(queue->free_items);
-	int index = atomic_increment(&queue->tail_index) % queue->capacity;
-	queue->items[index] = item;
-	semaphore_release(queue->used_items);
+	while (!slot_push(queue, item))
+	{
+		//announce the wait before sampling the counter so a pop in between is guaranteed to wake us
+		atomic_increment(&queue->push_waiters);
+		int pops = atomic_load(&queue->pop_count);
+		if (slot_push(queue, item))
+		{
+			atomic_decrement(&queue->push_waiters);
+			break;
+		}
+		atomic_wait(&queue->pop_count, pops);
+		atomic_decrement(&queue->push_waiters);
+	}
+	notify_push(queue);
 }
 
 void* queue_pop(queue_t* queue)
 {
-	semaphore_acquire(queue->used_items);
-	int index = atomic_increment(&queue->head_index) % queue->capacity;
-	void* item = queue->items[index];
-	semaphore_release(queue->free_items);
+	void* item;
+	while (!slot_pop(queue, &item))
+	{
+		atomic_increment(&queue->pop_waiters);
+		int pushes = atomic_load(&queue->push_count);
+		if (slot_pop(queue, &item))
+		{
+			atomic_decrement(&queue->pop_waiters);
+			break;
+		}
+		atomic_wait(&queue->push_count, pushes);
+		atomic_decrement(&queue->pop_waiters);
+	}
+	notify_pop(queue);
 	return item;
 }
 
 bool queue_try_push(queue_t* queue, void* item)
 {
-	if (semaphore_try_acquire(queue->free_items))
+	if (!slot_push(queue, item))
 	{
-		int index = atomic_increment(&queue->tail_index) % queue->capacity;
-		queue->items[index] = item;
-		semaphore_release(queue->used_items);
-		return true;
+		return false;
 	}
-	return false;
+	notify_push(queue);
+	return true;
 }
 
 void* queue_try_pop(queue_t* queue)
 {
-	if (semaphore_try_acquire(queue->used_items))
+	void* item;
+	if (!slot_pop(queue, &item))
+	{
+		return NULL;
+	}
+	notify_pop(queue);
+	return item;
+}
+
+void queue_push_n(queue_t* queue, void** items, int count)
+{
+	while (count > 0)
+	{
+		int pushed = slot_push_n(queue, items, count);
+		if (!pushed)
+		{
+			atomic_increment(&queue->push_waiters);
+			int pops = atomic_load(&queue->pop_count);
+			pushed = slot_push_n(queue, items, count);
+			if (!pushed)
+			{
+				atomic_wait(&queue->pop_count, pops);
+			}
+			atomic_decrement(&queue->push_waiters);
+		}
+		if (pushed)
+		{
+			notify_push(queue);
+			items += pushed;
+			count -= pushed;
+		}
+	}
+}
+
+int queue_pop_n(queue_t* queue, void** items, int capacity)
+{
+	int popped;
+	while (!(popped = slot_pop_n(queue, items, capacity)))
+	{
+		atomic_increment(&queue->pop_waiters);
+		int pushes = atomic_load(&queue->push_count);
+		popped = slot_pop_n(queue, items, capacity);
+		if (!popped)
+		{
+			atomic_wait(&queue->push_count, pushes);
+		}
+		atomic_decrement(&queue->pop_waiters);
+		if (popped)
+		{
+			break;
+		}
+	}
+	notify_pop(queue);
+	return popped;
+}
+
+static bool slot_push(queue_t* queue, void* item)
+{
+	unsigned int index = load_counter(&queue->tail_index);
+	queue_slot_t* slot;
+	while (true)
+	{
+		slot = &queue->slots[index & queue->mask];
+		int difference = (int)(load_counter(&slot->sequence) - index);
+		if (difference == 0)
+		{
+			unsigned int old_index = claim_counter(&queue->tail_index, index, index + 1);
+			if (old_index == index)
+			{
+				break;
+			}
+			index = old_index;
+		}
+		else if (difference < 0)
+		{
+			//the slot still holds the item from one lap ago
+			return false;
+		}
+		else
+		{
+			index = load_counter(&queue->tail_index);
+		}
+	}
+
+	slot->item = item;
+	store_counter(&slot->sequence, index + 1);
+	return true;
+}
+
+static bool slot_pop(queue_t* queue, void** item)
+{
+	unsigned int index = load_counter(&queue->head_index);
+	queue_slot_t* slot;
+	while (true)
+	{
+		slot = &queue->slots[index & queue->mask];
+		int difference = (int)(load_counter(&slot->sequence) - (index + 1));
+		if (difference == 0)
+		{
+			unsigned int old_index = claim_counter(&queue->head_index, index, index + 1);
+			if (old_index == index)
+			{
+				break;
+			}
+			index = old_index;
+		}
+		else if (difference < 0)
+		{
+			//nothing has been published in this slot yet
+			return false;
+		}
+		else
+		{
+			index = load_counter(&queue->head_index);
+		}
+	}
+
+	*item = slot->item;
+	store_counter(&slot->sequence, index + queue->capacity);
+	return true;
+}
+
+static int slot_push_n(queue_t* queue, void** items, int count)
+{
+	unsigned int index = load_counter(&queue->tail_index);
+	unsigned int claimed;
+	while (true)
+	{
+		//claim the run of consecutive slots that are free for this lap
+		claimed = 0;
+		while (claimed < (unsigned int)count && claimed < queue->capacity &&
+			load_counter(&queue->slots[(index + claimed) & queue->mask].sequence) == index + claimed)
+		{
+			++claimed;
+		}
+
+		if (claimed)
+		{
+			unsigned int old_index = claim_counter(&queue->tail_index, index, index + claimed);
+			if (old_index == index)
+			{
+				break;
+			}
+			index = old_index;
+		}
+		else if ((int)(load_counter(&queue->slots[index & queue->mask].sequence) - index) < 0)
+		{
+			return 0;
+		}
+		else
+		{
+			index = load_counter(&queue->tail_index);
+		}
+	}
+
+	for (unsigned int i = 0; i < claimed; ++i)
+	{
+		queue_slot_t* slot = &queue->slots[(index + i) & queue->mask];
+		slot->item = items[i];
+		store_counter(&slot->sequence, index + i + 1);
+	}
+	return (int)claimed;
+}
+
+static int slot_pop_n(queue_t* queue, void** items, int capacity)
+{
+	unsigned int index = load_counter(&queue->head_index);
+	unsigned int claimed;
+	while (true)
+	{
+		//claim the run of consecutive slots that have been published
+		claimed = 0;
+		while (claimed < (unsigned int)capacity && claimed < queue->capacity &&
+			load_counter(&queue->slots[(index + claimed) & queue->mask].sequence) == index + claimed + 1)
+		{
+			++claimed;
+		}
+
+		if (claimed)
+		{
+			unsigned int old_index = claim_counter(&queue->head_index, index, index + claimed);
+			if (old_index == index)
+			{
+				break;
+			}
+			index = old_index;
+		}
+		else if ((int)(load_counter(&queue->slots[index & queue->mask].sequence) - (index + 1)) < 0)
+		{
+			return 0;
+		}
+		else
+		{
+			index = load_counter(&queue->head_index);
+		}
+	}
+
+	for (unsigned int i = 0; i < claimed; ++i)
+	{
+		queue_slot_t* slot = &queue->slots[(index + i) & queue->mask];
+		items[i] = slot->item;
+		store_counter(&slot->sequence, index + i + queue->capacity);
+	}
+	return (int)claimed;
+}
+
+// Counters wrap around 2^32 like unsigned integers. Since the capacity is a power of two,
+// masking a wrapped counter still picks the right slot and differences stay meaningful.
+static unsigned int load_counter(int* address)
+{
+	return (unsigned int)atomic_load(address);
+}
+
+static void store_counter(int* address, unsigned int value)
+{
+	atomic_store(address, (int)value);
+}
+
+static unsigned int claim_counter(int* address, unsigned int compare, unsigned int exchange)
+{
+	return (unsigned int)atomic_compare_and_exchange(address, (int)compare, (int)exchange);
+}
+
+static void notify_push(queue_t* queue)
+{
+	//only enter the kernel when a popper is actually parked
+	atomic_increment(&queue->push_count);
+	if (atomic_load(&queue->pop_waiters))
+	{
+		atomic_wake_all(&queue->push_count);
+	}
+}
+
+static void notify_pop(queue_t* queue)
+{
+	atomic_increment(&queue->pop_count);
+	if (atomic_load(&queue->push_waiters))
 	{
-		int index = atomic_increment(&queue->head_index) % queue->capacity;
-		void* item = queue->items[index];
-		semaphore_release(queue->free_items);
-		return item;
+		atomic_wake_all(&queue->pop_count);
 	}
-	return NULL;
 }
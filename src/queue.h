@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 // Thread-safe Queue container
+// Bounded lock-free ring; threads only block in the OS while the queue is empty or full.
 
 // Handle to a thread-safe queue.
 typedef struct queue_t queue_t;
@@ -10,6 +11,7 @@ typedef struct queue_t queue_t;
 typedef struct heap_t heap_t;
 
 // Create a queue with the defined capacity.
+// The capacity is rounded up to a power of two so indexing is a mask instead of a divide.
 queue_t* queue_create(heap_t* heap, int capacity);
 
 // Destroy a previously created queue.
@@ -34,3 +36,15 @@ bool queue_try_push(queue_t* queue, void* item);
 // If the queue is empty, returns NULL.
 // Safe for multiple threads to pop at the same time.
 void* queue_try_pop(queue_t* queue);
+
+// Push count items onto a queue, in order.
+// Blocks until every item has been pushed; free slots are claimed in runs so
+// a batch costs one synchronization step instead of one per item.
+// Safe for multiple threads to push at the same time, though batches from different threads may interleave.
+void queue_push_n(queue_t* queue, void** items, int count);
+
+// Pop up to capacity items off a queue (FIFO order) into items.
+// If the queue is empty, blocks until at least one item is available.
+// Returns the number of items popped.
+// Safe for multiple threads to pop at the same time.
+int queue_pop_n(queue_t* queue, void** items, int capacity);
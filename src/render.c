@@ -1,47 +1,112 @@
 #include "render.h"
 
-#include "ecs.h"
+#include "atomic.h"
+#include "debug.h"
+#include "frame_arena.h"
+#include "frame_stats.h"
 #include "gpu.h"
 #include "heap.h"
-#include "queue.h"
+#include "job.h"
+#include "mat4f.h"
+#include "semaphore.h"
+#include "spsc_queue.h"
 #include "thread.h"
+#include "timer.h"
+#include "trace.h"
 #include "wm.h"
 
-#include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include <string.h>
 
 enum
 {
-	k_render_max_drawables = 512,
+	// Items the resource caches and frame packets first make room for; they double as needed.
+	k_render_initial_capacity = 64,
+
+	// Bytes the per-frame storage buffers start at; they double as needed.
+	k_render_frame_buffer_initial_size = 64 * 1024,
+
+	// Instances each workgroup of a cull shader tests.
+	k_render_cull_group_size = 64,
+
+	// Stale meshes and shaders destroyed per frame at most, so dropping many at once spreads over several frames.
+	k_render_max_evictions_per_frame = 8,
+
+	// Draws each recording job takes at least, so small frames stay on the render thread.
+	k_render_min_draws_per_recorder = 64,
+
+	// Frame packets and the uniform data they point to live until the render thread retires their frame.
+	// By default the game builds one frame while the render thread records another and a third waits between them.
+	k_render_default_pipeline_depth = 3,
+	k_render_arena_size = 256 * 1024,
+
+	// Mesh and shader pairs render_preload() queues at most before it waits for the render thread to take them.
+	k_render_preload_capacity = 64,
+
+	// Shaders waiting on the resource thread at most before the render thread waits to queue more.
+	k_render_resource_queue_capacity = 256,
+
+	// The render scale moves in steps of one part in this many, so small swings in GPU time leave it be.
+	k_render_scale_steps = 16,
+	// Percent of the GPU target a frame must come in under before the scale is raised again.
+	k_render_scale_headroom_percent = 85,
 };
 
-typedef enum command_type_t
+// Storage buffers every frame in flight has one of, in the order shaders bind them after the uniform.
+typedef enum render_frame_buffer_t
 {
-	k_command_frame_done,
-	k_command_model,
-} command_type_t;
+	k_render_frame_buffer_objects, //every instanced batch's instance data
+	k_render_frame_buffer_visible, //indices of the instances cull shaders found visible
+	k_render_frame_buffer_arguments, //indirect draw arguments of culled batches, written by cull shaders
+
+	k_render_frame_buffer_count,
+} render_frame_buffer_t;
 
 typedef struct model_command_t
 {
-	command_type_t type;
-	ecs_entity_ref_t entity;
 	gpu_mesh_info_t* mesh;
 	gpu_shader_info_t* shader;
 	gpu_uniform_buffer_info_t uniform_buffer;
+	void* constants; //pushed with the draw, or NULL
+	int constant_size;
 } model_command_t;
 
-typedef struct frame_done_command_t
+// Instances of one mesh and shader pushed this frame, drawn with a single instanced draw.
+typedef struct batch_command_t
 {
-	command_type_t type;
-} frame_done_command_t;
+	gpu_mesh_info_t* mesh;
+	gpu_shader_info_t* shader;
+	gpu_uniform_buffer_info_t uniform_buffer; //shared by every instance, copied from the first
+	gpu_shader_info_t* cull_shader; //decides which instances are drawn on the GPU, or NULL to draw them all
+	float radius; //largest bounding radius pushed for a culled instance
+	size_t instance_size;
+	void* instance_data; //heap array reused by later frames that use this packet
+	int instance_count;
+	int instance_capacity;
+} batch_command_t;
 
-typedef struct draw_instance_t
+// All commands for one frame, written by the game thread and handed to the render thread at once.
+typedef struct frame_packet_t
 {
-	ecs_entity_ref_t entity;
-	gpu_uniform_buffer_t** uniform_buffers;
-	gpu_descriptor_t** descriptors;
-	int frame_counter;
-} draw_instance_t;
+	model_command_t* models;
+	int model_count;
+	int model_capacity;
+	batch_command_t* batches;
+	int batch_count;
+	int batch_capacity;
+	int batch_slots; //batches initialized so far, in use or not
+
+	// Changes to the static set, applied by the render thread ahead of the packet's frame.
+	bool static_clear; //static instances pushed by earlier packets are removed
+	batch_command_t* static_batches; //added to the static set, laid out like batches but without a uniform
+	int static_batch_count;
+	int static_batch_capacity;
+	int static_batch_slots;
+	gpu_uniform_buffer_info_t static_uniform; //data is NULL unless set for this frame
+
+	uint64_t flow; //trace flow from the game thread to the render thread
+} frame_packet_t;
 
 typedef struct draw_mesh_t
 {
@@ -50,146 +115,530 @@ typedef struct draw_mesh_t
 	int frame_counter;
 } draw_mesh_t;
 
+// A shader and pipeline built off the render thread, which picks them up once done is set.
+typedef struct shader_build_t
+{
+	gpu_shader_info_t info; //the draw shader's info, reading the uniform ring
+	gpu_mesh_layout_t mesh_layout;
+	gpu_shader_t* shader;
+	gpu_pipeline_t* pipeline;
+	int done;
+} shader_build_t;
+
 typedef struct draw_shader_t
 {
 	gpu_shader_info_t* info;
 	gpu_shader_t* shader;
-	gpu_pipeline_t* pipeline;
+	gpu_pipeline_t* pipeline; //NULL until built; draws with the shader are skipped until then
+	shader_build_t* build; //in progress, or NULL
+	gpu_descriptor_t* descriptor; //reads the uniform ring; created once a model draws with the shader
+	gpu_descriptor_t* object_descriptor; //also reads the frame's storage buffers; created from the frame's pool once a batch draws with it
+	int object_descriptor_frame; //frame counter the object descriptor was created in
 	int frame_counter;
 } draw_shader_t;
 
+// Open-addressed map from a cache key to the index of its item in a resource array.
+typedef struct render_index_slot_t
+{
+	uint64_t key;
+	int index; //negative marks an empty slot
+} render_index_slot_t;
+
+typedef struct render_index_t
+{
+	render_index_slot_t* slots;
+	int capacity; //always a power of two, kept at least twice count
+	int count;
+} render_index_t;
+
+// Neighbors of a cache item in its recency list, or -1 at the ends.
+typedef struct render_lru_link_t
+{
+	int prev;
+	int next;
+} render_lru_link_t;
+
+// Doubly linked list of a resource array's items, least recently used first, threaded through
+// links parallel to the array. Items move to the back the first time they are used in a frame,
+// so the stale ones collect at the front and eviction never scans the rest.
+typedef struct render_lru_t
+{
+	render_lru_link_t* links;
+	int capacity;
+	int head; //-1 when empty
+	int tail;
+} render_lru_t;
+
+// Instances of one mesh and shader in the static set.
+typedef struct static_batch_t
+{
+	gpu_mesh_info_t* mesh;
+	gpu_shader_info_t* shader;
+	size_t instance_size;
+	int first_instance; //in instance size strides from the start of the static instance data
+	int instance_count;
+} static_batch_t;
+
+// The static set's GPU copy and recorded draws for one frame in flight, rebuilt once the set changes.
+typedef struct static_slot_t
+{
+	gpu_bundle_t* bundle;
+	gpu_uniform_buffer_t* uniform; //rewritten every frame from the latest static uniform
+	gpu_storage_buffer_t* instances;
+	size_t instance_capacity;
+	gpu_descriptor_t** descriptors; //one per static batch drawn
+	int descriptor_count;
+	int descriptor_capacity;
+	int generation; //of the static set the bundle was recorded from
+	bool complete; //every static batch's shader was built when the bundle was recorded
+} static_slot_t;
+
+// A resolved draw, ready to be recorded on any thread.
+typedef struct draw_t
+{
+	gpu_pipeline_t* pipeline;
+	gpu_mesh_t* mesh;
+	gpu_descriptor_t* descriptor;
+	uint32_t uniform_offset; //into the uniform ring
+	const void* constants; //push constants written before the draw, or NULL
+	int constant_size;
+	int first_instance; //index of the draw's first element in the object buffer
+	int instance_count;
+	gpu_storage_buffer_t* indirect_buffer; //arguments written by a cull shader, or NULL to draw instance_count instances
+	size_t indirect_offset;
+	uint64_t sort_key; //see draw_sort_key()
+} draw_t;
+
+// Uniform a cull shader reads for one batch.
+typedef struct cull_uniform_t
+{
+	float camera[2][16]; //projection and view matrices, copied from the start of the batch's uniform
+	uint32_t first_instance;
+	uint32_t instance_count;
+	uint32_t draw_index; //of the batch's arguments in the arguments buffer
+	float radius;
+} cull_uniform_t;
+
+// Indirect draw arguments, laid out as a VkDrawIndexedIndirectCommand.
+typedef struct draw_arguments_t
+{
+	uint32_t index_count;
+	uint32_t instance_count; //counted up by the cull shader
+	uint32_t first_index;
+	int32_t vertex_offset;
+	uint32_t first_instance;
+} draw_arguments_t;
+
+// A draw's sort key and its position in the unsorted draws.
+typedef struct draw_sort_t
+{
+	uint64_t key;
+	int index;
+} draw_sort_t;
+
+// A run of a frame's draws recorded into one command buffer.
+typedef struct draw_recorder_t
+{
+	render_t* render;
+	gpu_cmd_buffer_t* cmdbuf;
+	int first;
+	int count;
+	int pipeline_binds;
+	int mesh_binds;
+} draw_recorder_t;
+
 typedef struct render_t
 {
 	heap_t* heap;
 	wm_window_t* window;
 	thread_t* thread;
 	gpu_t* gpu;
-	queue_t* queue;
+	gpu_options_t gpu_options; //the GPU is created on the render thread
+	spsc_queue_t* queue;
+
+	// Shaders and pipelines are built on their own thread, so compiling one never stalls a frame.
+	// The queue is NULL when they are built inline on the render thread instead.
+	bool inline_resources;
+	thread_t* resource_thread;
+	spsc_queue_t* resource_queue;
+
+	// Mesh and shader info pairs from render_preload(), taken by the render thread between frames.
+	// While a run of them is waiting, the frame queue holds &preload_pending to wake the render thread.
+	spsc_queue_t* preloads;
+	int preload_pending;
+
+	// Packets and uniform data rotate with the arena's buffers; frame_slots counts buffers free for reuse.
+	frame_packet_t* packets;
+	int packet_count; //the pipeline depth; the queue holds every packet in flight plus the one that stops the render thread
+	int packet_index; //packet the game thread is writing
+	frame_arena_t* arena;
+	light_semaphore_t frame_slots;
+	bool low_latency; //frame slots are released once the GPU finishes the frame, not once it is submitted
 
 	int frame_counter;
 	int gpu_frame_count;
 
-	int instance_count;
+	// Draws record in parallel on jobs when there are enough of them; only touched by the render thread.
+	job_system_t* jobs;
+	int recorder_count;
+	draw_t* draws;
+	int draw_count;
+	int draw_capacity;
+
+	// Draws are sorted by key before recording so state changes do not depend on command order.
+	draw_t* sorted_draws;
+	int sorted_draw_capacity;
+	draw_sort_t* sort_items; //twice the draw count; the halves alternate as source and destination
+	int sort_item_capacity;
+	draw_recorder_t recorders[k_gpu_max_recorders];
+
+	// k_render_frame_buffer_count storage buffers per frame in flight.
+	// Draws find their instances by gl_InstanceIndex, which starts at the draw's first instance.
+	gpu_storage_buffer_t** frame_buffers;
+	size_t* frame_buffer_sizes;
+
+	// Resource caches, indexed by info pointers; only touched by the render thread.
+	draw_mesh_t* meshes;
+	draw_shader_t* shaders;
 	int mesh_count;
 	int shader_count;
-	draw_instance_t instances[k_render_max_drawables];
-	draw_mesh_t meshes[k_render_max_drawables];
-	draw_shader_t shaders[k_render_max_drawables];
+	int mesh_capacity;
+	int shader_capacity;
+	render_index_t mesh_index;
+	render_index_t shader_index;
+	render_lru_t mesh_lru;
+	render_lru_t shader_lru;
+
+	// Static instances, drawn every frame from bundles recorded once per frame in flight; only touched by the render thread.
+	static_batch_t* static_batches;
+	int static_batch_count;
+	int static_batch_capacity;
+	char* static_instance_data;
+	int static_instance_bytes;
+	int static_instance_capacity;
+	int static_generation; //counts changes to the static set, and to the render scale the bundles set the viewport at
+	char static_uniform[k_gpu_uniform_ring_range];
+	size_t static_uniform_size;
+	static_slot_t* static_slots; //one per frame in flight
+
+	// Dynamic resolution; the GPU's frame time lags by the frames in flight, so after a change the scale
+	// holds until a frame drawn at the new one has been timed.
+	int gpu_target_us;
+	int scale_cooldown; //frames left before the scale may change again
 } render_t;
 
 static int render_thread_func(void* user);
-static draw_shader_t* create_or_get_shader_for_model_command(render_t* render, model_command_t* command);
-static draw_mesh_t* create_or_get_mesh_for_model_command(render_t* render, model_command_t* command);
-static draw_instance_t* create_or_get_instance_for_model_command(render_t* render, model_command_t* command, gpu_shader_t* shader);
-static void destroy_stale_data(render_t* render);
+static int resource_thread_func(void* user);
+static void run_shader_build(gpu_t* gpu, shader_build_t* build);
+static void build_shader(render_t* render, draw_shader_t* shader, gpu_mesh_info_t* mesh);
+static bool collect_shader_build(render_t* render, draw_shader_t* shader);
+static draw_shader_t* create_or_get_shader(render_t* render, gpu_shader_info_t* info, gpu_mesh_info_t* mesh);
+static draw_mesh_t* create_or_get_mesh(render_t* render, gpu_mesh_info_t* info);
+static gpu_descriptor_t* get_object_descriptor(render_t* render, draw_shader_t* shader, int frame_index);
+static void reserve_frame_buffer(render_t* render, int frame_index, render_frame_buffer_t kind, size_t size);
+static batch_command_t* get_batch(render_t* render, bool is_static, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_shader_info_t* cull_shader, gpu_uniform_buffer_info_t* uniform, size_t instance_size);
+static void apply_static_changes(render_t* render, frame_packet_t* packet);
+static void draw_static(render_t* render, int frame_index);
+static void record_static(render_t* render, static_slot_t* slot);
+static void destroy_static_slot(render_t* render, static_slot_t* slot);
+static void destroy_stale_data(render_t* render, int budget);
+static void preload_data(render_t* render);
+static void render_frame(render_t* render, frame_packet_t* packet);
+static void update_render_scale(render_t* render);
+static uint64_t draw_sort_key(render_t* render, draw_shader_t* shader, draw_mesh_t* mesh, uint32_t uniform_offset);
+static void sort_draws(render_t* render);
+static void record_draws_job(void* data);
+static void record_draws(draw_recorder_t* recorder);
+static void* reserve_array(render_t* render, void* array, int count, int needed, int* capacity, size_t item_size);
+static int index_find(render_index_t* index, uint64_t key);
+static void index_set(render_t* render, render_index_t* index, uint64_t key, int value);
+static void index_remove(render_index_t* index, uint64_t key);
+static uint64_t hash_key(uint64_t key);
+static void lru_push(render_t* render, render_lru_t* lru, int index);
+static void lru_touch(render_lru_t* lru, int index);
+static void lru_remove(render_lru_t* lru, int index);
+static void lru_move(render_lru_t* lru, int from, int to);
 
 render_t* render_create(heap_t* heap, wm_window_t* window)
+{
+	render_options_t options = { 0 };
+	return render_create_with_options(heap, window, &options);
+}
+
+render_t* render_create_with_options(heap_t* heap, wm_window_t* window, const render_options_t* options)
 {
 	render_t* render = heap_alloc(heap, sizeof(render_t), 8);
+	memset(render, 0, sizeof(*render));
 	render->heap = heap;
 	render->window = window;
-	render->queue = queue_create(heap, 3);
-	render->frame_counter = 0;
-	render->instance_count = 0;
-	render->mesh_count = 0;
-	render->shader_count = 0;
-	render->thread = thread_create(render_thread_func, render);
+	render->jobs = options->jobs;
+	render->recorder_count = options->jobs ? __min(options->recorder_count, k_gpu_max_recorders) : 0;
+	render->gpu_options.fs = options->fs;
+	render->gpu_options.pipeline_cache_path = options->pipeline_cache_path;
+	render->gpu_options.present_mode = options->present_mode;
+	render->gpu_options.frame_count = options->frame_count;
+	render->gpu_options.headless = options->headless;
+	render->gpu_options.width = options->width;
+	render->gpu_options.height = options->height;
+	render->gpu_options.async_compute = options->async_compute;
+	render->gpu_options.dynamic_resolution = options->gpu_target_us > 0;
+	render->gpu_target_us = __max(options->gpu_target_us, 0);
+	render->low_latency = options->low_latency;
+	render->inline_resources = options->inline_resource_creation;
+	render->mesh_lru.head = render->mesh_lru.tail = -1;
+	render->shader_lru.head = render->shader_lru.tail = -1;
+	//every packet in flight keeps its frame arena buffer, so the pipeline is no deeper than the arena
+	render->packet_count = options->pipeline_depth ? __min(__max(options->pipeline_depth, 2), k_frame_arena_max_frames) : k_render_default_pipeline_depth;
+	render->packets = heap_alloc(heap, sizeof(frame_packet_t) * render->packet_count, 8);
+	memset(render->packets, 0, sizeof(frame_packet_t) * render->packet_count);
+	render->queue = spsc_queue_create(heap, render->packet_count);
+	render->preloads = spsc_queue_create(heap, k_render_preload_capacity * 2);
+	render->arena = frame_arena_create(heap, k_render_arena_size, render->packet_count);
+	//in low latency mode the game thread may not run ahead of the frame being drawn at all
+	int frame_slots = options->low_latency ? 0 : render->packet_count - 1;
+	light_semaphore_init(&render->frame_slots, frame_slots, render->packet_count - 1);
+	thread_options_t thread_options = { .name = "Render", .priority = k_thread_priority_high };
+	render->thread = thread_create_with_options(render_thread_func, render, &thread_options);
 	return render;
 }
 
 void render_destroy(render_t* render)
 {
-	queue_push(render->queue, NULL);
+	spsc_queue_push(render->queue, NULL);
 	thread_destroy(render->thread);
-	queue_destroy(render->queue);
+	spsc_queue_destroy(render->queue);
+	spsc_queue_destroy(render->preloads);
+	frame_arena_destroy(render->arena);
+	for (int i = 0; i < render->packet_count; ++i)
+	{
+		heap_free(render->heap, render->packets[i].models);
+		for (int b = 0; b < render->packets[i].batch_slots; ++b)
+		{
+			heap_free(render->heap, render->packets[i].batches[b].instance_data);
+		}
+		heap_free(render->heap, render->packets[i].batches);
+		for (int b = 0; b < render->packets[i].static_batch_slots; ++b)
+		{
+			heap_free(render->heap, render->packets[i].static_batches[b].instance_data);
+		}
+		heap_free(render->heap, render->packets[i].static_batches);
+	}
+	heap_free(render->heap, render->packets);
+	heap_free(render->heap, render->sort_items);
+	heap_free(render->heap, render->sorted_draws);
+	heap_free(render->heap, render->draws);
+	heap_free(render->heap, render->meshes);
+	heap_free(render->heap, render->shaders);
+	heap_free(render->heap, render->mesh_index.slots);
+	heap_free(render->heap, render->shader_index.slots);
+	heap_free(render->heap, render->mesh_lru.links);
+	heap_free(render->heap, render->shader_lru.links);
+	heap_free(render->heap, render->static_batches);
+	heap_free(render->heap, render->static_instance_data);
 	heap_free(render->heap, render);
 }
 
-void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform)
+void render_push_model(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform)
 {
-	model_command_t* command = heap_alloc(render->heap, sizeof(model_command_t), 8);
-	command->type = k_command_model;
-	command->entity = *entity;
+	frame_packet_t* packet = &render->packets[render->packet_index];
+	packet->models = reserve_array(render, packet->models, packet->model_count, packet->model_count + 1, &packet->model_capacity, sizeof(model_command_t));
+
+	model_command_t* command = &packet->models[packet->model_count++];
 	command->mesh = mesh;
 	command->shader = shader;
 	command->uniform_buffer.size = uniform->size;
-	command->uniform_buffer.data = heap_alloc(render->heap, uniform->size, 8);
+	command->uniform_buffer.data = frame_arena_alloc(render->arena, uniform->size, 8);
 	memcpy(command->uniform_buffer.data, uniform->data, uniform->size);
-	queue_push(render->queue, command);
+	command->constants = NULL;
+	command->constant_size = 0;
+}
+
+void render_push_model_with_constants(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform, const void* constants, size_t constant_size)
+{
+	render_push_model(render, mesh, shader, uniform);
+
+	frame_packet_t* packet = &render->packets[render->packet_index];
+	model_command_t* command = &packet->models[packet->model_count - 1];
+	command->constants = frame_arena_alloc(render->arena, constant_size, 8);
+	command->constant_size = (int)constant_size;
+	memcpy(command->constants, constants, constant_size);
+}
+
+void render_push_instance(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform, const void* instance_data, size_t instance_size)
+{
+	memcpy(render_push_instances(render, mesh, shader, uniform, instance_size, 1), instance_data, instance_size);
+}
+
+void render_push_culled_instance(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_shader_info_t* cull_shader, gpu_uniform_buffer_info_t* uniform, const mat4f_t* model, float radius)
+{
+	*render_push_culled_instances(render, mesh, shader, cull_shader, uniform, radius, 1) = *model;
+}
+
+void* render_push_instances(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform, size_t instance_size, int count)
+{
+	batch_command_t* batch = get_batch(render, false, mesh, shader, NULL, uniform, instance_size);
+	batch->instance_data = reserve_array(render, batch->instance_data, batch->instance_count, batch->instance_count + count, &batch->instance_capacity, instance_size);
+	void* instances = (char*)batch->instance_data + instance_size * batch->instance_count;
+	batch->instance_count += count;
+	return instances;
+}
+
+mat4f_t* render_push_culled_instances(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_shader_info_t* cull_shader, gpu_uniform_buffer_info_t* uniform, float radius, int count)
+{
+	batch_command_t* batch = get_batch(render, false, mesh, shader, cull_shader, uniform, sizeof(mat4f_t));
+	batch->radius = __max(batch->radius, radius);
+	batch->instance_data = reserve_array(render, batch->instance_data, batch->instance_count, batch->instance_count + count, &batch->instance_capacity, sizeof(mat4f_t));
+	mat4f_t* instances = (mat4f_t*)batch->instance_data + batch->instance_count;
+	batch->instance_count += count;
+	return instances;
+}
+
+void* render_push_static_instances(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, size_t instance_size, int count)
+{
+	batch_command_t* batch = get_batch(render, true, mesh, shader, NULL, NULL, instance_size);
+	batch->instance_data = reserve_array(render, batch->instance_data, batch->instance_count, batch->instance_count + count, &batch->instance_capacity, instance_size);
+	void* instances = (char*)batch->instance_data + instance_size * batch->instance_count;
+	batch->instance_count += count;
+	return instances;
+}
+
+void render_clear_static(render_t* render)
+{
+	frame_packet_t* packet = &render->packets[render->packet_index];
+	packet->static_clear = true;
+	packet->static_batch_count = 0;
+}
+
+void render_set_static_uniform(render_t* render, gpu_uniform_buffer_info_t* uniform)
+{
+	frame_packet_t* packet = &render->packets[render->packet_index];
+	packet->static_uniform.size = uniform->size;
+	packet->static_uniform.data = frame_arena_alloc(render->arena, uniform->size, 8);
+	memcpy(packet->static_uniform.data, uniform->data, uniform->size);
+}
+
+void render_preload(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader)
+{
+	void* items[] = { mesh, shader };
+	spsc_queue_push_n(render->preloads, items, _countof(items));
+
+	//wake the render thread once per run of preloads; frames already queued go first
+	if (atomic_exchange(&render->preload_pending, 1) == 0)
+	{
+		spsc_queue_push(render->queue, &render->preload_pending);
+	}
 }
 
 void render_push_done(render_t* render)
 {
-	frame_done_command_t* command = heap_alloc(render->heap, sizeof(frame_done_command_t), 8);
-	command->type = k_command_frame_done;
-	queue_push(render->queue, command);
+	frame_packet_t* packet = &render->packets[render->packet_index];
+	trace_t* trace = trace_get_default();
+	trace_instant(trace, "Frame");
+	trace_counter(trace, "Render Commands", packet->model_count + packet->batch_count);
+	packet->flow = trace_flow_begin(trace, "Render Frame");
+	spsc_queue_push(render->queue, packet);
+
+	// Wait for the render thread to retire the frame that last used the next buffer and packet.
+	// Time spent here is the game running a full pipeline ahead of the render thread.
+	TRACE_ZONE_BEGIN(k_trace_category_render, "Wait For Render Slot");
+	light_semaphore_acquire(&render->frame_slots);
+	TRACE_ZONE_END(k_trace_category_render);
+	frame_arena_next_frame(render->arena);
+	render->packet_index = (render->packet_index + 1) % render->packet_count;
+	render->packets[render->packet_index].model_count = 0;
+	render->packets[render->packet_index].batch_count = 0;
+	render->packets[render->packet_index].static_clear = false;
+	render->packets[render->packet_index].static_batch_count = 0;
+	render->packets[render->packet_index].static_uniform.data = NULL;
 }
 
 static int render_thread_func(void* user)
 {
 	render_t* render = user;
 
-	render->gpu = gpu_create(render->heap, render->window);
+	//the game keeps starting up on its own thread while the instance, device and swapchain are created
+	TRACE_ZONE_BEGIN(k_trace_category_render, "Create GPU");
+	render->gpu = gpu_create_with_options(render->heap, render->window, &render->gpu_options);
+	TRACE_ZONE_END(k_trace_category_render);
 	render->gpu_frame_count = gpu_get_frame_count(render->gpu);
+	int frame_buffer_count = render->gpu_frame_count * k_render_frame_buffer_count;
+	render->frame_buffers = heap_alloc(render->heap, sizeof(gpu_storage_buffer_t*) * frame_buffer_count, 8);
+	render->frame_buffer_sizes = heap_alloc(render->heap, sizeof(size_t) * frame_buffer_count, 8);
+	memset(render->frame_buffers, 0, sizeof(gpu_storage_buffer_t*) * frame_buffer_count);
+	memset(render->frame_buffer_sizes, 0, sizeof(size_t) * frame_buffer_count);
+	render->static_slots = heap_alloc(render->heap, sizeof(static_slot_t) * render->gpu_frame_count, 8);
+	memset(render->static_slots, 0, sizeof(static_slot_t) * render->gpu_frame_count);
 
-	gpu_cmd_buffer_t* cmdbuf = NULL;
-	gpu_pipeline_t* last_pipeline = NULL;
-	gpu_mesh_t* last_mesh = NULL;
-	int frame_index = 0;
+	if (!render->inline_resources)
+	{
+		render->resource_queue = spsc_queue_create(render->heap, k_render_resource_queue_capacity);
+		thread_options_t resource_options = { .name = "Render Resources" };
+		render->resource_thread = thread_create_with_options(resource_thread_func, render, &resource_options);
+	}
 
 	while (true)
 	{
-		command_type_t* type = queue_pop(render->queue);
-		if (!type)
+		frame_packet_t* packet = spsc_queue_pop(render->queue);
+		if (!packet)
 		{
 			break;
 		}
-
-		if (!cmdbuf)
+		if ((void*)packet == &render->preload_pending)
 		{
-			cmdbuf = gpu_frame_begin(render->gpu);
+			//clear first, so a preload queued while we drain pushes another wake
+			atomic_store(&render->preload_pending, 0);
+			preload_data(render);
+			continue;
 		}
 
-		if (*type == k_command_frame_done)
-		{
-			gpu_frame_end(render->gpu);
-			cmdbuf = NULL;
-			last_pipeline = NULL;
-			last_mesh = NULL;
+		TRACE_ZONE_BEGIN(k_trace_category_render, "Render Frame");
+		uint64_t frame_ticks = timer_get_ticks();
+		trace_flow_end(trace_get_default(), "Render Frame", packet->flow);
+		render_frame(render, packet);
 
-			destroy_stale_data(render);
-			++render->frame_counter;
-			frame_index = render->frame_counter % render->gpu_frame_count;
+		destroy_stale_data(render, k_render_max_evictions_per_frame);
+		if (render->low_latency)
+		{
+			gpu_frame_wait(render->gpu);
 		}
-		else if (*type == k_command_model)
+		++render->frame_counter;
+		if (render->frame_counter == 1)
 		{
-			model_command_t* command = (model_command_t*)type;
-			draw_shader_t* shader = create_or_get_shader_for_model_command(render, command);
-			draw_mesh_t* mesh = create_or_get_mesh_for_model_command(render, command);
-			draw_instance_t* instance = create_or_get_instance_for_model_command(render, command, shader->shader);
-
-			heap_free(render->heap, command->uniform_buffer.data);
-
-			if (last_pipeline != shader->pipeline)
-			{
-				gpu_cmd_pipeline_bind(render->gpu, cmdbuf, shader->pipeline);
-				last_pipeline = shader->pipeline;
-			}
-			if (last_mesh != mesh->mesh)
-			{
-				gpu_cmd_mesh_bind(render->gpu, cmdbuf, mesh->mesh);
-				last_mesh = mesh->mesh;
-			}
-			gpu_cmd_descriptor_bind(render->gpu, cmdbuf, instance->descriptors[frame_index]);
-			gpu_cmd_draw(render->gpu, cmdbuf);
+			//time to first frame, to compare startup changes by
+			trace_instant(trace_get_default(), "First Frame");
+			debug_print(k_print_info, "First frame submitted %u ms after startup.\n", timer_ticks_to_ms(timer_get_ticks()));
 		}
+		frame_stats_add(frame_stats_get_default(), k_frame_stat_render_us, timer_ticks_to_us(timer_get_ticks() - frame_ticks));
+		TRACE_ZONE_END(k_trace_category_render);
+
+		light_semaphore_release(&render->frame_slots);
+	}
 
-		heap_free(render->heap, type);
+	//finish every build in progress so the stale data below can all be destroyed
+	if (render->resource_thread)
+	{
+		spsc_queue_push(render->resource_queue, NULL);
+		thread_destroy(render->resource_thread);
+		spsc_queue_destroy(render->resource_queue);
+		render->resource_thread = NULL;
+		render->resource_queue = NULL;
 	}
 
 	gpu_wait_until_idle(render->gpu);
+	for (int i = 0; i < render->gpu_frame_count; ++i)
+	{
+		destroy_static_slot(render, &render->static_slots[i]);
+	}
+	heap_free(render->heap, render->static_slots);
 	render->frame_counter += render->gpu_frame_count + 1;
-	destroy_stale_data(render);
+	destroy_stale_data(render, INT_MAX);
+
+	for (int i = 0; i < frame_buffer_count; ++i)
+	{
+		gpu_storage_buffer_destroy(render->gpu, render->frame_buffers[i]);
+	}
+	heap_free(render->heap, render->frame_buffer_sizes);
+	heap_free(render->heap, render->frame_buffers);
 
 	gpu_destroy(render->gpu);
 	render->gpu = NULL;
@@ -197,140 +646,1013 @@ static int render_thread_func(void* user)
 	return 0;
 }
 
-static draw_shader_t* create_or_get_shader_for_model_command(render_t* render, model_command_t* command)
+static batch_command_t* get_batch(render_t* render, bool is_static, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_shader_info_t* cull_shader, gpu_uniform_buffer_info_t* uniform, size_t instance_size)
 {
-	draw_shader_t* shader = NULL;
-	for (int i = 0; i < render->shader_count; ++i)
+	frame_packet_t* packet = &render->packets[render->packet_index];
+	batch_command_t** batches = is_static ? &packet->static_batches : &packet->batches;
+	int* count = is_static ? &packet->static_batch_count : &packet->batch_count;
+	int* capacity = is_static ? &packet->static_batch_capacity : &packet->batch_capacity;
+	int* slots = is_static ? &packet->static_batch_slots : &packet->batch_slots;
+
+	//a frame holds only a handful of batches, so a linear search beats hashing
+	for (int i = 0; i < *count; ++i)
 	{
-		if (render->shaders[i].info == command->shader)
+		batch_command_t* batch = &(*batches)[i];
+		if (batch->mesh == mesh && batch->shader == shader && batch->cull_shader == cull_shader)
 		{
-			shader = &render->shaders[i];
-			break;
+			return batch;
 		}
 	}
-	if (!shader)
+
+	if (*count == *slots)
+	{
+		*batches = reserve_array(render, *batches, *slots, *slots + 1, capacity, sizeof(batch_command_t));
+		memset(&(*batches)[(*slots)++], 0, sizeof(batch_command_t));
+	}
+	batch_command_t* batch = &(*batches)[(*count)++];
+	if (batch->instance_size != instance_size)
 	{
-		assert(render->shader_count < _countof(render->shaders));
-		shader = &render->shaders[render->shader_count++];
-		shader->info = command->shader;
+		//the reused instance array is sized for another batch's instances
+		heap_free(render->heap, batch->instance_data);
+		batch->instance_data = NULL;
+		batch->instance_capacity = 0;
+		batch->instance_size = instance_size;
 	}
-	if (!shader->shader)
+	batch->mesh = mesh;
+	batch->shader = shader;
+	batch->cull_shader = cull_shader;
+	batch->radius = 0.0f;
+	batch->instance_count = 0;
+	batch->uniform_buffer.size = uniform ? uniform->size : 0;
+	batch->uniform_buffer.data = uniform ? frame_arena_alloc(render->arena, uniform->size, 8) : NULL;
+	if (uniform)
 	{
-		shader->shader = gpu_shader_create(render->gpu, shader->info);
+		memcpy(batch->uniform_buffer.data, uniform->data, uniform->size);
 	}
+	return batch;
+}
+
+static draw_shader_t* create_or_get_shader(render_t* render, gpu_shader_info_t* info, gpu_mesh_info_t* mesh)
+{
+	uint64_t key = (uintptr_t)info;
+	int index = index_find(&render->shader_index, key);
+	if (index < 0)
+	{
+		render->shaders = reserve_array(render, render->shaders, render->shader_count, render->shader_count + 1, &render->shader_capacity, sizeof(draw_shader_t));
+		index = render->shader_count++;
+		index_set(render, &render->shader_index, key, index);
+		memset(&render->shaders[index], 0, sizeof(draw_shader_t));
+		render->shaders[index].info = info;
+		render->shaders[index].frame_counter = render->frame_counter;
+		lru_push(render, &render->shader_lru, index);
+	}
+	draw_shader_t* shader = &render->shaders[index];
 	if (!shader->pipeline)
+	{
+		build_shader(render, shader, mesh);
+	}
+	if (shader->frame_counter != render->frame_counter)
+	{
+		shader->frame_counter = render->frame_counter;
+		lru_touch(&render->shader_lru, index);
+	}
+	return shader;
+}
+
+// Start building a shader and its pipeline for a mesh's layout, or pick them up once built.
+// Meshes are still created inline: their uploads go through the frame's command buffer, and they
+// cost a copy rather than a compile.
+static void build_shader(render_t* render, draw_shader_t* shader, gpu_mesh_info_t* mesh)
+{
+	if (!shader->build)
+	{
+		shader_build_t* build = heap_alloc(render->heap, sizeof(shader_build_t), 8);
+		memset(build, 0, sizeof(*build));
+		//every draw's uniforms are pushed onto the GPU's uniform ring
+		build->info = *shader->info;
+		build->info.uniform_ring = true;
+		build->mesh_layout = mesh->layout;
+		shader->build = build;
+		if (render->resource_queue)
+		{
+			spsc_queue_push(render->resource_queue, build);
+		}
+		else
+		{
+			run_shader_build(render->gpu, build);
+		}
+	}
+	collect_shader_build(render, shader);
+}
+
+// Take a shader's finished build, if it has one.
+// Returns false if the build is still in progress.
+static bool collect_shader_build(render_t* render, draw_shader_t* shader)
+{
+	shader_build_t* build = shader->build;
+	if (!build)
+	{
+		return true;
+	}
+	if (!atomic_load_acquire(&build->done))
+	{
+		return false;
+	}
+
+	if (build->pipeline)
+	{
+		shader->shader = build->shader;
+		shader->pipeline = build->pipeline;
+	}
+	else
+	{
+		//failed; the next draw tries again
+		gpu_shader_destroy(render->gpu, build->shader);
+	}
+	shader->build = NULL;
+	heap_free(render->heap, build);
+	return true;
+}
+
+static int resource_thread_func(void* user)
+{
+	render_t* render = user;
+	shader_build_t* build;
+	while ((build = spsc_queue_pop(render->resource_queue)) != NULL)
+	{
+		run_shader_build(render->gpu, build);
+	}
+	return 0;
+}
+
+// Create a build's shader and pipeline; neither touches state the render thread uses while drawing.
+static void run_shader_build(gpu_t* gpu, shader_build_t* build)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_render, "Build Shader");
+	build->shader = gpu_shader_create(gpu, &build->info);
+	if (build->shader)
 	{
 		gpu_pipeline_info_t pipeline_info =
+		{
+			.shader = build->shader,
+			.mesh_layout = build->mesh_layout,
+		};
+		build->pipeline = gpu_pipeline_create(gpu, &pipeline_info);
+	}
+	TRACE_ZONE_END(k_trace_category_render);
+	atomic_store_release(&build->done, 1);
+}
+
+static draw_mesh_t* create_or_get_mesh(render_t* render, gpu_mesh_info_t* info)
+{
+	uint64_t key = (uintptr_t)info;
+	int index = index_find(&render->mesh_index, key);
+	if (index < 0)
+	{
+		render->meshes = reserve_array(render, render->meshes, render->mesh_count, render->mesh_count + 1, &render->mesh_capacity, sizeof(draw_mesh_t));
+		index = render->mesh_count++;
+		index_set(render, &render->mesh_index, key, index);
+		memset(&render->meshes[index], 0, sizeof(draw_mesh_t));
+		render->meshes[index].info = info;
+		render->meshes[index].frame_counter = render->frame_counter;
+		lru_push(render, &render->mesh_lru, index);
+	}
+	draw_mesh_t* mesh = &render->meshes[index];
+	if (!mesh->mesh)
+	{
+		mesh->mesh = gpu_mesh_create(render->gpu, info);
+	}
+	if (mesh->frame_counter != render->frame_counter)
+	{
+		mesh->frame_counter = render->frame_counter;
+		lru_touch(&render->mesh_lru, index);
+	}
+	return mesh;
+}
+
+static gpu_descriptor_t* get_object_descriptor(render_t* render, draw_shader_t* shader, int frame_index)
+{
+	//the frame's buffers are reserved before its batches draw, so a descriptor made this frame reads the current ones
+	if (!shader->object_descriptor || shader->object_descriptor_frame != render->frame_counter)
+	{
+		gpu_descriptor_info_t descriptor_info =
 		{
 			.shader = shader->shader,
-			.mesh_layout = command->mesh->layout,
+			.uniform_buffer_count = 1,
+			.storage_buffers = &render->frame_buffers[frame_index * k_render_frame_buffer_count],
+			.storage_buffer_count = shader->info->storage_buffer_count,
 		};
-		shader->pipeline = gpu_pipeline_create(render->gpu, &pipeline_info);
+		shader->object_descriptor = gpu_frame_descriptor_create(render->gpu, &descriptor_info);
+		shader->object_descriptor_frame = render->frame_counter;
 	}
-	shader->frame_counter = render->frame_counter;
-	return shader;
+	return shader->object_descriptor;
+}
+
+// Make one of a frame's storage buffers at least size bytes, doubling it as needed.
+static void reserve_frame_buffer(render_t* render, int frame_index, render_frame_buffer_t kind, size_t size)
+{
+	int index = frame_index * k_render_frame_buffer_count + kind;
+	if (size <= render->frame_buffer_sizes[index])
+	{
+		return;
+	}
+
+	size_t new_size = __max(render->frame_buffer_sizes[index], (size_t)k_render_frame_buffer_initial_size);
+	while (new_size < size)
+	{
+		new_size *= 2;
+	}
+
+	//the frame has begun, so its buffer is no longer in use by the GPU
+	gpu_storage_buffer_destroy(render->gpu, render->frame_buffers[index]);
+
+	gpu_storage_buffer_info_t storage_info = { .size = new_size, .indirect = kind == k_render_frame_buffer_arguments };
+	render->frame_buffers[index] = gpu_storage_buffer_create(render->gpu, &storage_info);
+	render->frame_buffer_sizes[index] = new_size;
 }
 
-static draw_mesh_t* create_or_get_mesh_for_model_command(render_t* render, model_command_t* command)
+// Destroy up to budget meshes and shaders no frame in flight uses, oldest first.
+// Whatever is left over stays at the front of the recency lists for the next frame.
+static void destroy_stale_data(render_t* render, int budget)
 {
-	draw_mesh_t* mesh = NULL;
-	for (int i = 0; i < render->mesh_count; ++i)
+	int before = render->mesh_count + render->shader_count;
+	int evicted = 0;
+	while (evicted < budget && render->mesh_lru.head >= 0)
 	{
-		if (render->meshes[i].info == command->mesh)
+		int i = render->mesh_lru.head;
+		if (render->meshes[i].frame_counter + render->gpu_frame_count > render->frame_counter)
 		{
-			mesh = &render->meshes[i];
 			break;
 		}
+		gpu_mesh_destroy(render->gpu, render->meshes[i].mesh);
+		index_remove(&render->mesh_index, (uintptr_t)render->meshes[i].info);
+		lru_remove(&render->mesh_lru, i);
+		render->meshes[i] = render->meshes[--render->mesh_count];
+		if (i < render->mesh_count)
+		{
+			index_set(render, &render->mesh_index, (uintptr_t)render->meshes[i].info, i);
+			lru_move(&render->mesh_lru, render->mesh_count, i);
+		}
+		++evicted;
 	}
-	if (!mesh)
+	while (evicted < budget && render->shader_lru.head >= 0)
 	{
-		assert(render->mesh_count < _countof(render->meshes));
-		mesh = &render->meshes[render->mesh_count++];
-		mesh->info = command->mesh;
+		int i = render->shader_lru.head;
+		if (render->shaders[i].frame_counter + render->gpu_frame_count > render->frame_counter ||
+			!collect_shader_build(render, &render->shaders[i]))
+		{
+			//a shader still building is destroyed once its build is picked up
+			break;
+		}
+		gpu_descriptor_destroy(render->gpu, render->shaders[i].descriptor);
+		gpu_pipeline_destroy(render->gpu, render->shaders[i].pipeline);
+		gpu_shader_destroy(render->gpu, render->shaders[i].shader);
+		index_remove(&render->shader_index, (uintptr_t)render->shaders[i].info);
+		lru_remove(&render->shader_lru, i);
+		render->shaders[i] = render->shaders[--render->shader_count];
+		if (i < render->shader_count)
+		{
+			index_set(render, &render->shader_index, (uintptr_t)render->shaders[i].info, i);
+			lru_move(&render->shader_lru, render->shader_count, i);
+		}
+		++evicted;
 	}
-	if (!mesh->mesh)
+
+	if (render->mesh_count + render->shader_count != before)
 	{
-		mesh->mesh = gpu_mesh_create(render->gpu, command->mesh);
+		trace_instant(trace_get_default(), "Destroy Stale Render Data");
 	}
-	mesh->frame_counter = render->frame_counter;
-	return mesh;
 }
 
-static draw_instance_t* create_or_get_instance_for_model_command(render_t* render, model_command_t* command, gpu_shader_t* shader)
+// Create the GPU objects of every mesh and shader pair render_preload() queued, so their first draws find them.
+// They enter the caches like any other data and are destroyed if no frame draws them for a while.
+static void preload_data(render_t* render)
 {
-	draw_instance_t* instance = NULL;
-	for (int i = 0; i < render->instance_count; ++i)
+	TRACE_ZONE_BEGIN(k_trace_category_render, "Preload Render Data");
+	gpu_mesh_info_t* mesh;
+	while ((mesh = spsc_queue_try_pop(render->preloads)) != NULL)
 	{
-		if (memcmp(&render->instances[i].entity, &command->entity, sizeof(ecs_entity_ref_t)) == 0)
+		//the pair is pushed together, so its shader is there or about to be
+		gpu_shader_info_t* shader = spsc_queue_pop(render->preloads);
+		create_or_get_mesh(render, mesh);
+		create_or_get_shader(render, shader, mesh);
+	}
+	TRACE_ZONE_END(k_trace_category_render);
+}
+
+static void render_frame(render_t* render, frame_packet_t* packet)
+{
+	render->draws = reserve_array(render, render->draws, 0, packet->model_count + packet->batch_count, &render->draw_capacity, sizeof(draw_t));
+	render->draw_count = packet->model_count + packet->batch_count;
+
+	apply_static_changes(render, packet);
+	update_render_scale(render);
+
+	//jobs only pay for themselves once each has a good run of draws
+	int recorder_count = __min(render->recorder_count, render->draw_count / k_render_min_draws_per_recorder);
+	if (render->static_batch_count)
+	{
+		//the static set's bundle is a secondary command buffer, which a frame only executes alongside recorders
+		recorder_count = __max(recorder_count, 1);
+	}
+	gpu_frame_options_t options = { .recorder_count = recorder_count };
+	gpu_cmd_buffer_t* cmdbuf = gpu_frame_begin_with_options(render->gpu, &options);
+	uint64_t record_ticks = timer_get_ticks();
+
+	//creating GPU objects and pushing uniforms touch the render tables and the uniform ring, so they stay on this thread;
+	//they wait for the frame to begin so the frame's buffers are no longer in use by the GPU
+	int frame_index = render->frame_counter % render->gpu_frame_count;
+	int64_t uniform_bytes = 0;
+	draw_static(render, frame_index);
+	model_command_t* last_model = NULL;
+	for (int i = 0; i < packet->model_count; ++i)
+	{
+		model_command_t* command = &packet->models[i];
+		draw_shader_t* shader = create_or_get_shader(render, command->shader, command->mesh);
+		draw_mesh_t* mesh = create_or_get_mesh(render, command->mesh);
+		if (shader->pipeline && !shader->descriptor)
 		{
-			instance = &render->instances[i];
-			break;
+			gpu_descriptor_info_t descriptor_info = { .shader = shader->shader, .uniform_buffer_count = 1 };
+			shader->descriptor = gpu_descriptor_create(render->gpu, &descriptor_info);
+		}
+
+		render->draws[i].pipeline = shader->pipeline;
+		render->draws[i].mesh = mesh->mesh;
+		render->draws[i].descriptor = shader->descriptor;
+		//models drawn with push constants usually share a camera uniform, and with it a descriptor bind
+		if (last_model &&
+			last_model->uniform_buffer.size == command->uniform_buffer.size &&
+			memcmp(last_model->uniform_buffer.data, command->uniform_buffer.data, command->uniform_buffer.size) == 0)
+		{
+			render->draws[i].uniform_offset = render->draws[i - 1].uniform_offset;
 		}
+		else
+		{
+			render->draws[i].uniform_offset = gpu_uniform_ring_push(render->gpu, command->uniform_buffer.data, command->uniform_buffer.size);
+			uniform_bytes += command->uniform_buffer.size;
+		}
+		last_model = command;
+		render->draws[i].constants = command->constants;
+		render->draws[i].constant_size = command->constant_size;
+		render->draws[i].first_instance = 0;
+		render->draws[i].instance_count = 1;
+		render->draws[i].indirect_buffer = NULL;
+		render->draws[i].sort_key = draw_sort_key(render, shader, mesh, render->draws[i].uniform_offset);
+		uniform_bytes += command->constant_size;
 	}
-	if (!instance)
+
+	//every batch's instances share the frame's object buffer, each starting at a whole multiple
+	//of its instance size so its first instance can index the shader's array
+	//culled batches also need a visible index per instance and a set of draw arguments
+	size_t object_bytes = 0;
+	size_t visible_count = 0;
+	size_t culled_count = 0;
+	for (int i = 0; i < packet->batch_count; ++i)
+	{
+		batch_command_t* command = &packet->batches[i];
+		object_bytes = (object_bytes + command->instance_size - 1) / command->instance_size * command->instance_size;
+		object_bytes += command->instance_size * command->instance_count;
+		if (command->cull_shader)
+		{
+			visible_count = object_bytes / command->instance_size;
+			++culled_count;
+		}
+	}
+	reserve_frame_buffer(render, frame_index, k_render_frame_buffer_objects, object_bytes);
+	reserve_frame_buffer(render, frame_index, k_render_frame_buffer_visible, visible_count * sizeof(uint32_t));
+	reserve_frame_buffer(render, frame_index, k_render_frame_buffer_arguments, culled_count * sizeof(draw_arguments_t));
+	gpu_storage_buffer_t** frame_buffers = &render->frame_buffers[frame_index * k_render_frame_buffer_count];
+
+	object_bytes = 0;
+	culled_count = 0;
+	batch_command_t* last_uniform = NULL;
+	for (int i = 0; i < packet->batch_count; ++i)
 	{
-		assert(render->instance_count < _countof(render->instances));
-		instance = &render->instances[render->instance_count++];
+		batch_command_t* command = &packet->batches[i];
+		draw_shader_t* shader = create_or_get_shader(render, command->shader, command->mesh);
+		draw_mesh_t* mesh = create_or_get_mesh(render, command->mesh);
+
+		int first_instance = (int)((object_bytes + command->instance_size - 1) / command->instance_size);
+		object_bytes = command->instance_size * first_instance;
+		gpu_storage_buffer_update(render->gpu, frame_buffers[k_render_frame_buffer_objects], object_bytes, command->instance_data, command->instance_size * command->instance_count);
+		object_bytes += command->instance_size * command->instance_count;
+
+		draw_t* draw = &render->draws[packet->model_count + i];
+		draw->pipeline = shader->pipeline;
+		draw->mesh = mesh->mesh;
+		draw->descriptor = shader->pipeline ? get_object_descriptor(render, shader, frame_index) : NULL;
+		draw->first_instance = first_instance;
+		draw->instance_count = command->instance_count;
+
+		//batches usually share a camera, and sharing its uniform lets them share a descriptor bind
+		if (last_uniform &&
+			last_uniform->uniform_buffer.size == command->uniform_buffer.size &&
+			memcmp(last_uniform->uniform_buffer.data, command->uniform_buffer.data, command->uniform_buffer.size) == 0)
+		{
+			draw->uniform_offset = render->draws[packet->model_count + i - 1].uniform_offset;
+		}
+		else
+		{
+			draw->uniform_offset = gpu_uniform_ring_push(render->gpu, command->uniform_buffer.data, command->uniform_buffer.size);
+			uniform_bytes += command->uniform_buffer.size;
+		}
+		last_uniform = command;
+		uniform_bytes += command->instance_size * command->instance_count;
+		draw->constants = NULL;
+		draw->constant_size = 0;
+		draw->indirect_buffer = NULL;
+		draw->indirect_offset = 0;
+		//creating the cull shader may grow the shader cache and move the shader
+		draw->sort_key = draw_sort_key(render, shader, mesh, draw->uniform_offset);
 
-		instance->entity = command->entity;
-		instance->uniform_buffers = heap_alloc(render->heap, sizeof(gpu_uniform_buffer_t*) * render->gpu_frame_count, 8);
-		instance->descriptors = heap_alloc(render->heap, sizeof(gpu_descriptor_t*) * render->gpu_frame_count, 8);
-		for (int i = 0; i < render->gpu_frame_count; ++i)
+		if (command->cull_shader)
 		{
-			instance->uniform_buffers[i] = gpu_uniform_buffer_create(render->gpu, &command->uniform_buffer);
+			//the cull shader counts visible instances into the arguments and lists them from the batch's first instance
+			draw_shader_t* cull = create_or_get_shader(render, command->cull_shader, command->mesh);
+			if (!cull->pipeline)
+			{
+				//nothing has counted the batch's visible instances
+				draw->pipeline = NULL;
+			}
+			draw_arguments_t arguments = { .index_count = gpu_mesh_get_index_count(mesh->mesh), .first_instance = first_instance };
+			draw->indirect_buffer = frame_buffers[k_render_frame_buffer_arguments];
+			draw->indirect_offset = culled_count * sizeof(draw_arguments_t);
+			gpu_storage_buffer_update(render->gpu, draw->indirect_buffer, draw->indirect_offset, &arguments, sizeof(arguments));
 
-			gpu_descriptor_info_t descriptor_info =
+			cull_uniform_t cull_uniform = { .first_instance = first_instance, .instance_count = command->instance_count, .draw_index = (uint32_t)culled_count, .radius = command->radius };
+			memcpy(cull_uniform.camera, command->uniform_buffer.data, __min(command->uniform_buffer.size, sizeof(cull_uniform.camera)));
+			uint32_t cull_offset = gpu_uniform_ring_push(render->gpu, &cull_uniform, sizeof(cull_uniform));
+			uniform_bytes += sizeof(cull_uniform);
+
+			int group_count = (command->instance_count + k_render_cull_group_size - 1) / k_render_cull_group_size;
+			if (cull->pipeline)
 			{
-				.shader = shader,
-				.uniform_buffers = &instance->uniform_buffers[i],
-				.uniform_buffer_count = 1,
-			};
-			instance->descriptors[i] = gpu_descriptor_create(render->gpu, &descriptor_info);
+				gpu_compute_dispatch(render->gpu, cull->pipeline, get_object_descriptor(render, cull, frame_index), &cull_offset, 1, group_count);
+			}
+			++culled_count;
 		}
 	}
 
-	int frame_index = render->frame_counter % render->gpu_frame_count;
-	gpu_uniform_buffer_update(render->gpu, instance->uniform_buffers[frame_index], command->uniform_buffer.data, command->uniform_buffer.size);
+	sort_draws(render);
+
+	if (recorder_count > 1)
+	{
+		//draws are split into contiguous runs so the secondary command buffers execute in order
+		job_counter_t counter = { 0 };
+		int first = 0;
+		for (int r = 0; r < recorder_count; ++r)
+		{
+			draw_recorder_t* recorder = &render->recorders[r];
+			recorder->render = render;
+			recorder->cmdbuf = gpu_frame_get_recorder(render->gpu, r);
+			recorder->first = first;
+			recorder->count = (render->draw_count - first) / (recorder_count - r);
+			first += recorder->count;
+			job_run(render->jobs, record_draws_job, recorder, &counter);
+		}
+		job_wait(render->jobs, &counter);
+	}
+	else
+	{
+		//a single recorder isn't worth a job
+		draw_recorder_t* recorder = &render->recorders[0];
+		recorder->render = render;
+		recorder->cmdbuf = recorder_count ? gpu_frame_get_recorder(render->gpu, 0) : cmdbuf;
+		recorder->first = 0;
+		recorder->count = render->draw_count;
+		record_draws(recorder);
+	}
+
+	int pipeline_binds = 0;
+	int mesh_binds = 0;
+	for (int r = 0; r < __max(recorder_count, 1); ++r)
+	{
+		pipeline_binds += render->recorders[r].pipeline_binds;
+		mesh_binds += render->recorders[r].mesh_binds;
+	}
+
+	uint64_t end_ticks = timer_get_ticks();
+	gpu_frame_end(render->gpu);
+
+	frame_stats_t* stats = frame_stats_get_default();
+	frame_stats_add(stats, k_frame_stat_render_record_us, timer_ticks_to_us(end_ticks - record_ticks));
+	frame_stats_add(stats, k_frame_stat_gpu_frame_end_us, timer_ticks_to_us(timer_get_ticks() - end_ticks));
+	frame_stats_add(stats, k_frame_stat_draw_calls, render->draw_count);
+	frame_stats_add(stats, k_frame_stat_pipeline_binds, pipeline_binds);
+	frame_stats_add(stats, k_frame_stat_mesh_binds, mesh_binds);
+	frame_stats_add(stats, k_frame_stat_uniform_bytes, uniform_bytes);
+}
+
+// Fold a packet's changes to the static set into the render thread's copy.
+static void apply_static_changes(render_t* render, frame_packet_t* packet)
+{
+	if (packet->static_clear)
+	{
+		render->static_batch_count = 0;
+		render->static_instance_bytes = 0;
+		++render->static_generation;
+	}
 
-	instance->frame_counter = render->frame_counter;
+	//like the object buffer, each batch starts at a whole multiple of its instance size
+	for (int i = 0; i < packet->static_batch_count; ++i)
+	{
+		batch_command_t* command = &packet->static_batches[i];
+		int instance_size = (int)command->instance_size;
+		int first_instance = (render->static_instance_bytes + instance_size - 1) / instance_size;
+		int bytes = instance_size * command->instance_count;
+		int end = instance_size * first_instance + bytes;
+		render->static_instance_data = reserve_array(render, render->static_instance_data, render->static_instance_bytes, end, &render->static_instance_capacity, 1);
+		memcpy(render->static_instance_data + instance_size * first_instance, command->instance_data, bytes);
+		render->static_instance_bytes = end;
 
-	return instance;
+		render->static_batches = reserve_array(render, render->static_batches, render->static_batch_count, render->static_batch_count + 1, &render->static_batch_capacity, sizeof(static_batch_t));
+		static_batch_t* batch = &render->static_batches[render->static_batch_count++];
+		batch->mesh = command->mesh;
+		batch->shader = command->shader;
+		batch->instance_size = command->instance_size;
+		batch->first_instance = first_instance;
+		batch->instance_count = command->instance_count;
+	}
+	if (packet->static_batch_count)
+	{
+		++render->static_generation;
+	}
+
+	if (packet->static_uniform.data)
+	{
+		render->static_uniform_size = __min(packet->static_uniform.size, sizeof(render->static_uniform));
+		memcpy(render->static_uniform, packet->static_uniform.data, render->static_uniform_size);
+	}
 }
 
-static void destroy_stale_data(render_t* render)
+// Execute the static set's bundle for this frame in flight, recording it again first if the set changed
+// since, or a shader it draws with was still building when it was recorded.
+static void draw_static(render_t* render, int frame_index)
 {
-	for (int i = render->instance_count - 1; i >= 0; --i)
+	if (!render->static_batch_count)
+	{
+		return;
+	}
+
+	static_slot_t* slot = &render->static_slots[frame_index];
+	if (slot->generation != render->static_generation || !slot->complete)
 	{
-		if (render->instances[i].frame_counter + render->gpu_frame_count <= render->frame_counter)
+		TRACE_ZONE_BEGIN(k_trace_category_render, "Record Static Draws");
+		record_static(render, slot);
+		TRACE_ZONE_END(k_trace_category_render);
+	}
+	else
+	{
+		//creating them again only finds them, but keeps them in the caches
+		for (int i = 0; i < render->static_batch_count; ++i)
 		{
-			for (int f = 0; f < render->gpu_frame_count; ++f)
+			create_or_get_shader(render, render->static_batches[i].shader, render->static_batches[i].mesh);
+			create_or_get_mesh(render, render->static_batches[i].mesh);
+		}
+	}
+
+	//the frame has begun, so its slot's uniform is no longer read by the GPU
+	gpu_uniform_buffer_update(render->gpu, slot->uniform, render->static_uniform, render->static_uniform_size);
+	gpu_frame_execute_bundle(render->gpu, slot->bundle);
+}
+
+// Copy the static set into a frame's slot and record its draws into the slot's bundle.
+static void record_static(render_t* render, static_slot_t* slot)
+{
+	if (!slot->bundle)
+	{
+		slot->bundle = gpu_bundle_create(render->gpu);
+		gpu_uniform_buffer_info_t uniform_info = { .data = render->static_uniform, .size = sizeof(render->static_uniform) };
+		slot->uniform = gpu_uniform_buffer_create(render->gpu, &uniform_info);
+	}
+
+	size_t bytes = (size_t)render->static_instance_bytes;
+	if (bytes > slot->instance_capacity)
+	{
+		size_t new_size = __max(slot->instance_capacity, (size_t)k_render_frame_buffer_initial_size);
+		while (new_size < bytes)
+		{
+			new_size *= 2;
+		}
+		gpu_storage_buffer_destroy(render->gpu, slot->instances);
+		gpu_storage_buffer_info_t storage_info = { .size = new_size };
+		slot->instances = gpu_storage_buffer_create(render->gpu, &storage_info);
+		slot->instance_capacity = new_size;
+	}
+	gpu_storage_buffer_update(render->gpu, slot->instances, 0, render->static_instance_data, bytes);
+
+	for (int i = 0; i < slot->descriptor_count; ++i)
+	{
+		gpu_descriptor_destroy(render->gpu, slot->descriptors[i]);
+	}
+	slot->descriptor_count = 0;
+	slot->descriptors = reserve_array(render, slot->descriptors, 0, render->static_batch_count, &slot->descriptor_capacity, sizeof(gpu_descriptor_t*));
+
+	slot->complete = true;
+	gpu_cmd_buffer_t* cmdbuf = gpu_bundle_begin(render->gpu, slot->bundle);
+	for (int i = 0; i < render->static_batch_count; ++i)
+	{
+		static_batch_t* batch = &render->static_batches[i];
+		draw_shader_t* shader = create_or_get_shader(render, batch->shader, batch->mesh);
+		draw_mesh_t* mesh = create_or_get_mesh(render, batch->mesh);
+		if (!shader->pipeline)
+		{
+			//left out until its shader is built
+			slot->complete = false;
+			continue;
+		}
+
+		//the bundle outlives the frame's uniform ring, so it reads the slot's own uniform at offset zero
+		gpu_descriptor_info_t descriptor_info =
+		{
+			.shader = shader->shader,
+			.uniform_buffers = &slot->uniform,
+			.uniform_buffer_count = 1,
+			.storage_buffers = &slot->instances,
+			.storage_buffer_count = 1,
+		};
+		gpu_descriptor_t* descriptor = gpu_descriptor_create(render->gpu, &descriptor_info);
+		slot->descriptors[slot->descriptor_count++] = descriptor;
+
+		uint32_t offset = 0;
+		gpu_cmd_pipeline_bind(render->gpu, cmdbuf, shader->pipeline);
+		gpu_cmd_mesh_bind(render->gpu, cmdbuf, mesh->mesh);
+		gpu_cmd_descriptor_bind_with_offsets(render->gpu, cmdbuf, descriptor, &offset, 1);
+		gpu_cmd_draw_instanced(render->gpu, cmdbuf, batch->first_instance, batch->instance_count);
+	}
+	gpu_bundle_end(render->gpu, slot->bundle);
+	slot->generation = render->static_generation;
+}
+
+static void destroy_static_slot(render_t* render, static_slot_t* slot)
+{
+	for (int i = 0; i < slot->descriptor_count; ++i)
+	{
+		gpu_descriptor_destroy(render->gpu, slot->descriptors[i]);
+	}
+	heap_free(render->heap, slot->descriptors);
+	gpu_storage_buffer_destroy(render->gpu, slot->instances);
+	gpu_uniform_buffer_destroy(render->gpu, slot->uniform);
+	gpu_bundle_destroy(render->gpu, slot->bundle);
+}
+
+// Move the render scale toward the one that draws a frame in the GPU target.
+// GPU time goes roughly with the pixels drawn, the square of the scale. A frame over the target lowers
+// the scale at once; raising it waits until frames come in well under, so it doesn't swing around the target.
+static void update_render_scale(render_t* render)
+{
+	if (!render->gpu_target_us)
+	{
+		return;
+	}
+	if (render->scale_cooldown > 0)
+	{
+		--render->scale_cooldown;
+		return;
+	}
+
+	int64_t gpu_us = gpu_get_frame_gpu_us(render->gpu);
+	if (gpu_us <= 0 || (gpu_us <= render->gpu_target_us && gpu_us * 100 >= (int64_t)render->gpu_target_us * k_render_scale_headroom_percent))
+	{
+		return;
+	}
+
+	//round down, so the scale chosen fits the target rather than just over it
+	float scale = gpu_get_render_scale(render->gpu);
+	float ideal = scale * sqrtf((float)render->gpu_target_us / (float)gpu_us);
+	float stepped = floorf(ideal * k_render_scale_steps) / k_render_scale_steps;
+	gpu_set_render_scale(render->gpu, stepped);
+	if (gpu_get_render_scale(render->gpu) != scale)
+	{
+		//static bundles set the viewport when they are recorded
+		++render->static_generation;
+		render->scale_cooldown = render->gpu_frame_count + 1;
+	}
+}
+
+// Build a draw's sort key, most significant field first:
+// shader (16 bits), mesh (16 bits) and uniform ring offset (32 bits).
+// Draws sharing a pipeline, then a mesh, then a uniform end up next to each other, so each
+// change of state is bound once. Shaders and meshes are keyed by their slots in the caches,
+// which hold still for the frame; the cache arrays themselves may move as they grow, so the
+// pointers passed in must come from the latest create_or_get call.
+static uint64_t draw_sort_key(render_t* render, draw_shader_t* shader, draw_mesh_t* mesh, uint32_t uniform_offset)
+{
+	uint64_t shader_slot = (uint64_t)(shader - render->shaders) & 0xffff;
+	uint64_t mesh_slot = (uint64_t)(mesh - render->meshes) & 0xffff;
+	return (shader_slot << 48) | (mesh_slot << 32) | uniform_offset;
+}
+
+// Sort the frame's draws by key with a least significant digit radix sort, one byte per pass.
+// The sort is stable, so draws with equal keys keep the order their commands were pushed in.
+static void sort_draws(render_t* render)
+{
+	int count = render->draw_count;
+	render->sort_items = reserve_array(render, render->sort_items, 0, count * 2, &render->sort_item_capacity, sizeof(draw_sort_t));
+	render->sorted_draws = reserve_array(render, render->sorted_draws, 0, count, &render->sorted_draw_capacity, sizeof(draw_t));
+
+	draw_sort_t* src = render->sort_items;
+	draw_sort_t* dst = render->sort_items + count;
+	for (int i = 0; i < count; ++i)
+	{
+		src[i].key = render->draws[i].sort_key;
+		src[i].index = i;
+	}
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		int offsets[256] = { 0 };
+		for (int i = 0; i < count; ++i)
+		{
+			++offsets[(src[i].key >> shift) & 0xff];
+		}
+
+		//most keys share their high bytes, and a byte every draw shares leaves the order as it is
+		if (count && offsets[(src[0].key >> shift) & 0xff] == count)
+		{
+			continue;
+		}
+
+		int total = 0;
+		for (int b = 0; b < 256; ++b)
+		{
+			int bucket = offsets[b];
+			offsets[b] = total;
+			total += bucket;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+
+		draw_sort_t* temp = src;
+		src = dst;
+		dst = temp;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		render->sorted_draws[i] = render->draws[src[i].index];
+	}
+
+	draw_t* temp = render->draws;
+	int temp_capacity = render->draw_capacity;
+	render->draws = render->sorted_draws;
+	render->draw_capacity = render->sorted_draw_capacity;
+	render->sorted_draws = temp;
+	render->sorted_draw_capacity = temp_capacity;
+}
+
+static void record_draws_job(void* data)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_render, "Record Draws");
+	record_draws(data);
+	TRACE_ZONE_END(k_trace_category_render);
+}
+
+static void record_draws(draw_recorder_t* recorder)
+{
+	render_t* render = recorder->render;
+	gpu_pipeline_t* last_pipeline = NULL;
+	gpu_mesh_t* last_mesh = NULL;
+	gpu_descriptor_t* last_descriptor = NULL;
+	uint32_t last_uniform_offset = 0;
+	recorder->pipeline_binds = 0;
+	recorder->mesh_binds = 0;
+
+	for (int i = recorder->first; i < recorder->first + recorder->count; ++i)
+	{
+		draw_t* draw = &render->draws[i];
+		if (!draw->pipeline)
+		{
+			//its shader is still building
+			continue;
+		}
+		if (last_pipeline != draw->pipeline)
+		{
+			gpu_cmd_pipeline_bind(render->gpu, recorder->cmdbuf, draw->pipeline);
+			last_pipeline = draw->pipeline;
+			last_descriptor = NULL; //each shader has its own descriptor set layout
+			++recorder->pipeline_binds;
+		}
+		if (last_mesh != draw->mesh)
+		{
+			gpu_cmd_mesh_bind(render->gpu, recorder->cmdbuf, draw->mesh);
+			last_mesh = draw->mesh;
+			++recorder->mesh_binds;
+		}
+		if (last_descriptor != draw->descriptor || last_uniform_offset != draw->uniform_offset)
+		{
+			gpu_cmd_descriptor_bind_with_offsets(render->gpu, recorder->cmdbuf, draw->descriptor, &draw->uniform_offset, 1);
+			last_descriptor = draw->descriptor;
+			last_uniform_offset = draw->uniform_offset;
+		}
+		if (draw->constant_size)
+		{
+			gpu_cmd_push_constants(render->gpu, recorder->cmdbuf, draw->constants, draw->constant_size);
+		}
+		if (draw->indirect_buffer)
+		{
+			gpu_cmd_draw_indirect(render->gpu, recorder->cmdbuf, draw->indirect_buffer, draw->indirect_offset);
+		}
+		else
+		{
+			gpu_cmd_draw_instanced(render->gpu, recorder->cmdbuf, draw->first_instance, draw->instance_count);
+		}
+	}
+}
+
+// Make room for at least needed items in an array holding count items, doubling its capacity.
+static void* reserve_array(render_t* render, void* array, int count, int needed, int* capacity, size_t item_size)
+{
+	if (needed <= *capacity)
+	{
+		return array;
+	}
+
+	int new_capacity = __max(*capacity, k_render_initial_capacity / 2);
+	while (new_capacity < needed)
+	{
+		new_capacity *= 2;
+	}
+
+	void* new_array = heap_alloc(render->heap, item_size * new_capacity, 8);
+	if (array)
+	{
+		memcpy(new_array, array, item_size * count);
+		heap_free(render->heap, array);
+	}
+	*capacity = new_capacity;
+	return new_array;
+}
+
+static int index_find(render_index_t* index, uint64_t key)
+{
+	if (!index->capacity)
+	{
+		return -1;
+	}
+
+	unsigned int mask = index->capacity - 1;
+	for (unsigned int i = (unsigned int)hash_key(key) & mask; index->slots[i].index >= 0; i = (i + 1) & mask)
+	{
+		if (index->slots[i].key == key)
+		{
+			return index->slots[i].index;
+		}
+	}
+	return -1;
+}
+
+static void index_set(render_t* render, render_index_t* index, uint64_t key, int value)
+{
+	if ((index->count + 1) * 2 > index->capacity)
+	{
+		render_index_t old = *index;
+		index->capacity = __max(old.capacity * 2, k_render_initial_capacity);
+		index->count = 0;
+		index->slots = heap_alloc(render->heap, sizeof(render_index_slot_t) * index->capacity, 8);
+		for (int i = 0; i < index->capacity; ++i)
+		{
+			index->slots[i].index = -1;
+		}
+		for (int i = 0; i < old.capacity; ++i)
+		{
+			if (old.slots[i].index >= 0)
 			{
-				gpu_descriptor_destroy(render->gpu, render->instances[i].descriptors[f]);
-				gpu_uniform_buffer_destroy(render->gpu, render->instances[i].uniform_buffers[f]);
+				index_set(render, index, old.slots[i].key, old.slots[i].index);
 			}
-			heap_free(render->heap, render->instances[i].descriptors);
-			heap_free(render->heap, render->instances[i].uniform_buffers);
-			render->instances[i] = render->instances[render->instance_count - 1];
-			render->instance_count--;
 		}
+		heap_free(render->heap, old.slots);
+	}
+
+	unsigned int mask = index->capacity - 1;
+	unsigned int i = (unsigned int)hash_key(key) & mask;
+	while (index->slots[i].index >= 0 && index->slots[i].key != key)
+	{
+		i = (i + 1) & mask;
+	}
+	if (index->slots[i].index < 0)
+	{
+		index->count++;
+	}
+	index->slots[i].key = key;
+	index->slots[i].index = value;
+}
+
+static void index_remove(render_index_t* index, uint64_t key)
+{
+	if (!index->capacity)
+	{
+		return;
 	}
-	for (int i = render->mesh_count - 1; i >= 0; --i)
+
+	unsigned int mask = index->capacity - 1;
+	unsigned int hole = (unsigned int)hash_key(key) & mask;
+	while (index->slots[hole].key != key || index->slots[hole].index < 0)
 	{
-		if (render->meshes[i].frame_counter + render->gpu_frame_count <= render->frame_counter)
+		if (index->slots[hole].index < 0)
 		{
-			gpu_mesh_destroy(render->gpu, render->meshes[i].mesh);
-			render->meshes[i] = render->meshes[render->mesh_count - 1];
-			render->mesh_count--;
+			return;
 		}
+		hole = (hole + 1) & mask;
 	}
-	for (int i = render->shader_count - 1; i >= 0; --i)
+
+	//shift later slots of the probe run back so lookups never stop early at the hole
+	for (unsigned int i = (hole + 1) & mask; index->slots[i].index >= 0; i = (i + 1) & mask)
 	{
-		if (render->shaders[i].frame_counter + render->gpu_frame_count <= render->frame_counter)
+		unsigned int home = (unsigned int)hash_key(index->slots[i].key) & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask))
 		{
-			gpu_pipeline_destroy(render->gpu, render->shaders[i].pipeline);
-			gpu_shader_destroy(render->gpu, render->shaders[i].shader);
-			render->shaders[i] = render->shaders[render->shader_count - 1];
-			render->shader_count--;
+			index->slots[hole] = index->slots[i];
+			hole = i;
 		}
 	}
+	index->slots[hole].index = -1;
+	index->count--;
+}
+
+static uint64_t hash_key(uint64_t key)
+{
+	//splitmix64 finalizer; pointers differ mostly in their low bits
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ull;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebull;
+	key ^= key >> 31;
+	return key;
+}
+
+// Append a new item to the back of a recency list.
+static void lru_push(render_t* render, render_lru_t* lru, int index)
+{
+	lru->links = reserve_array(render, lru->links, index, index + 1, &lru->capacity, sizeof(render_lru_link_t));
+	lru->links[index].prev = lru->tail;
+	lru->links[index].next = -1;
+	if (lru->tail >= 0)
+	{
+		lru->links[lru->tail].next = index;
+	}
+	else
+	{
+		lru->head = index;
+	}
+	lru->tail = index;
+}
+
+// Move an item to the back of a recency list.
+static void lru_touch(render_lru_t* lru, int index)
+{
+	if (lru->tail != index)
+	{
+		lru_remove(lru, index);
+		lru->links[index].prev = lru->tail;
+		lru->links[index].next = -1;
+		lru->links[lru->tail].next = index;
+		lru->tail = index;
+	}
+}
+
+static void lru_remove(render_lru_t* lru, int index)
+{
+	render_lru_link_t* link = &lru->links[index];
+	if (link->prev >= 0)
+	{
+		lru->links[link->prev].next = link->next;
+	}
+	else
+	{
+		lru->head = link->next;
+	}
+	if (link->next >= 0)
+	{
+		lru->links[link->next].prev = link->prev;
+	}
+	else
+	{
+		lru->tail = link->prev;
+	}
+}
+
+// Follow an item moved from one array index to another.
+static void lru_move(render_lru_t* lru, int from, int to)
+{
+	render_lru_link_t* link = &lru->links[to];
+	*link = lru->links[from];
+	if (link->prev >= 0)
+	{
+		lru->links[link->prev].next = to;
+	}
+	else
+	{
+		lru->head = to;
+	}
+	if (link->next >= 0)
+	{
+		lru->links[link->next].prev = to;
+	}
+	else
+	{
+		lru->tail = to;
+	}
 }
@@ -2,23 +2,129 @@
 
 // High-level graphics rendering interface.
 
+#include <stdbool.h>
+#include <stddef.h>
+
 typedef struct render_t render_t;
 
-typedef struct ecs_entity_ref_t ecs_entity_ref_t;
+typedef struct fs_t fs_t;
 typedef struct gpu_mesh_info_t gpu_mesh_info_t;
 typedef struct gpu_shader_info_t gpu_shader_info_t;
 typedef struct gpu_uniform_buffer_info_t gpu_uniform_buffer_info_t;
 typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+typedef struct mat4f_t mat4f_t;
 typedef struct wm_window_t wm_window_t;
 
+// Options for creating a render system.
+// Zero-initialized options give the same render system as render_create().
+typedef struct render_options_t
+{
+	// Job system that records a frame's draws on several threads at once, or NULL to record on the render thread.
+	job_system_t* jobs;
+	// Most jobs a frame's draws are split across, up to k_gpu_max_recorders.
+	// Frames with few draws use fewer jobs, or none.
+	int recorder_count;
+	// File system and path the GPU's pipeline cache is kept in across runs, or NULL to keep none.
+	fs_t* fs;
+	const char* pipeline_cache_path;
+	// Present mode, a gpu_present_mode_t, and frames in flight of the GPU, as in gpu_options_t.
+	int present_mode;
+	int frame_count;
+	// Keep the game a frame behind the GPU at most: once the game has pushed a frame, it waits for
+	// the GPU to finish drawing it, so the next frame samples input as late as possible.
+	bool low_latency;
+	// Render offscreen at width by height instead of to the window, as in gpu_options_t.
+	bool headless;
+	int width;
+	int height;
+	// Frames in the pipeline between the game and the render thread, clamped to two to four, or zero for three.
+	// While the render thread records frame N, the game builds frame N + 1 and up to depth - 2 more
+	// wait between them; the GPU's own frames in flight come on top of these. Deeper pipelines
+	// absorb uneven frame times at the cost of latency.
+	int pipeline_depth;
+	// Cull on the GPU's async compute queue, overlapping the previous frame's draws, as in gpu_options_t.
+	bool async_compute;
+	// Shaders and their pipelines are normally built on a background thread the first time something
+	// draws with them, and those draws are skipped until they are ready, so a compile never stalls a frame.
+	// Build them on the render thread inside that first frame instead, for runs that must draw every frame in full.
+	bool inline_resource_creation;
+	// Microseconds of GPU time a frame is held to, or zero to always draw at full size.
+	// Frames draw at a fraction of the frame size, scaled up where they are presented, and the fraction
+	// follows the GPU's measured frame time: down as soon as a frame runs over, up once there is headroom.
+	int gpu_target_us;
+} render_options_t;
+
 // Create a render system.
 render_t* render_create(heap_t* heap, wm_window_t* window);
 
+// Create a render system with the specified options.
+render_t* render_create_with_options(heap_t* heap, wm_window_t* window, const render_options_t* options);
+
 // Destroy a render system.
 void render_destroy(render_t* render);
 
 // Push a model onto a queue of items to be rendered.
-void render_push_model(render_t* render, ecs_entity_ref_t* entity, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform);
+// Uniform data is copied; mesh and shader infos are kept by pointer, read on the render thread up to
+// a pipeline depth of frames later and cached against that pointer, so they must outlive the render system.
+void render_push_model(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform);
+
+// Push a model whose shader reads its per-draw data as push constants.
+// Like render_push_model(), but constants, up to the shader's push constant size, are copied and written
+// into the command buffer with the draw, leaving the uniform for data models share, such as a camera's
+// projection and view. Models pushed in a row with the same uniform share one copy of it and one descriptor bind.
+void render_push_model_with_constants(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform, const void* constants, size_t constant_size);
+
+// Push one instance of a mesh onto a queue of items to be rendered.
+// Instances pushed in a frame with the same mesh and shader are drawn together in one
+// instanced draw. The shader reads the uniform, which is copied from the first instance
+// pushed each frame, from binding zero, and an array of every instance's data from a
+// storage buffer at binding one, indexed by gl_InstanceIndex.
+void render_push_instance(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform, const void* instance_data, size_t instance_size);
+
+// Push one instance of a mesh whose visibility is decided on the GPU.
+// Like render_push_instance(), with a model matrix as the instance data. Before the frame is
+// drawn, cull_shader, a compute shader, tests every instance against the camera and writes the
+// visible ones' indices to a storage buffer and their count to the batch's indirect draw, so
+// the CPU does the same work however many instances are drawn.
+// The cull shader reads a uniform of the camera's projection and view matrices, copied from
+// the start of the uniform, then the batch's first instance, instance count, draw index and
+// bounding radius. After that uniform it binds three storage buffers: model matrices, visible
+// indices and VkDrawIndexedIndirectCommand arguments; it runs in workgroups of 64 instances.
+// The mesh's shader binds the model matrices and visible indices after its uniform, and draws
+// instance visible[gl_InstanceIndex]. The mesh must have indices. Radius bounds the mesh around
+// its origin before the model matrix's scale; a batch culls with the largest radius pushed.
+void render_push_culled_instance(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_shader_info_t* cull_shader, gpu_uniform_buffer_info_t* uniform, const mat4f_t* model, float radius);
+
+// Push count instances of a mesh, as render_push_instance() count times.
+// Returns storage for the instances' data, count times instance size bytes, for the caller to
+// fill in place rather than build each instance elsewhere and have it copied. The storage is
+// valid until the next push.
+void* render_push_instances(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_uniform_buffer_info_t* uniform, size_t instance_size, int count);
+
+// Push count instances of a mesh whose visibility is decided on the GPU, as render_push_culled_instance()
+// count times. Returns storage for count model matrices to fill in place, valid until the next push.
+mat4f_t* render_push_culled_instances(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, gpu_shader_info_t* cull_shader, gpu_uniform_buffer_info_t* uniform, float radius, int count);
+
+// Add count instances of a mesh to the static set, which is drawn every frame without being pushed again.
+// Returns storage for the instances' data to fill in place, valid until the next push.
+// Static instances are copied to the GPU and their draws recorded into a reusable command buffer once per
+// frame in flight, and again only when the set changes, so a frame's CPU cost covers only what it pushes.
+// The shader reads the static uniform from binding zero and the instances from a storage buffer at binding one,
+// as for render_push_instances(). Mesh and shader infos must outlive the static set.
+void* render_push_static_instances(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader, size_t instance_size, int count);
+
+// Remove every instance from the static set, including those pushed earlier this frame.
+void render_clear_static(render_t* render);
+
+// Set the uniform the static set is drawn with, such as the camera's projection and view, from this frame on.
+void render_set_static_uniform(render_t* render, gpu_uniform_buffer_info_t* uniform);
+
+// Create a mesh's and shader's GPU objects on the render thread ahead of their first draw, such as while
+// loading, instead of inside that draw's frame. Returns at once; frames already pushed are rendered first.
+// The shader's pipeline is built for the mesh's layout. Call from the thread that pushes frames.
+// Preloaded data is cached like drawn data, so it is destroyed if the frames after it never draw it.
+void render_preload(render_t* render, gpu_mesh_info_t* mesh, gpu_shader_info_t* shader);
 
 // Push an end-of-frame marker on a queue of items to be rendered.
 void render_push_done(render_t* render);
@@ -0,0 +1,286 @@
+#include "render_bench.h"
+
+#include "debug.h"
+#include "frame_stats.h"
+#include "fs.h"
+#include "gpu.h"
+#include "heap.h"
+#include "mat4f.h"
+#include "render.h"
+#include "timer.h"
+#include "vec3f.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+	// Frames run before measuring, while the renderer creates meshes and pipelines.
+	k_render_bench_warmup_frames = 30,
+};
+
+static const char* s_path_names[k_render_bench_path_count] =
+{
+	"model",
+	"pushed",
+	"instanced",
+	"culled",
+};
+
+// Uniform of the per-draw shader, whose model matrix changes every draw.
+typedef struct model_uniform_t
+{
+	mat4f_t projection;
+	mat4f_t model;
+	mat4f_t view;
+} model_uniform_t;
+
+// Uniform of the instanced shaders, shared by every instance.
+typedef struct camera_uniform_t
+{
+	mat4f_t projection;
+	mat4f_t view;
+} camera_uniform_t;
+
+static void push_scene(render_t* render, const render_bench_options_t* options, gpu_mesh_info_t* meshes, gpu_shader_info_t* shaders,
+	gpu_shader_info_t* cull_shader, const camera_uniform_t* camera, const mat4f_t* models);
+static void print_ticks(const char* name, uint64_t* ticks, int count);
+static void print_stat(frame_stats_t* stats, frame_stat_t stat);
+static int compare_ticks(const void* a, const void* b);
+
+int render_bench_run(heap_t* heap, fs_t* fs, job_system_t* jobs, const render_bench_options_t* options)
+{
+	//the frame stats the render thread reports to cover exactly the measured frames
+	int frame_count = __max(options->frame_count, 1);
+	frame_stats_t* previous_stats = frame_stats_get_default();
+	frame_stats_t* stats = frame_stats_create(heap, frame_count, 0);
+	frame_stats_set_default(stats);
+
+	render_options_t render_options =
+	{
+		.jobs = options->recorder_count ? jobs : NULL,
+		.recorder_count = options->recorder_count,
+		.fs = fs,
+		.headless = true,
+		//every measured frame draws the whole scene
+		.inline_resource_creation = true,
+	};
+	render_t* render = render_create_with_options(heap, NULL, &render_options);
+
+	bool model_path = options->path == k_render_bench_path_model;
+	bool pushed_path = options->path == k_render_bench_path_pushed;
+	bool culled_path = options->path == k_render_bench_path_culled;
+	fs_work_t* vertex_work = fs_map(fs,
+		model_path ? "shaders/triangle.vert.spv" :
+		pushed_path ? "shaders/pushed.vert.spv" :
+		culled_path ? "shaders/culled.vert.spv" :
+		"shaders/instanced.vert.spv");
+	fs_work_t* fragment_work = fs_map(fs, "shaders/triangle.frag.spv");
+	fs_work_t* cull_work = culled_path ? fs_map(fs, "shaders/cull.comp.spv") : NULL;
+
+	//every shader and mesh is its own info, so the renderer caches each as a distinct pipeline or mesh
+	int shader_count = __max(options->shader_count, 1);
+	gpu_shader_info_t* shaders = heap_alloc(heap, sizeof(gpu_shader_info_t) * shader_count, 8);
+	for (int i = 0; i < shader_count; ++i)
+	{
+		shaders[i] = (gpu_shader_info_t)
+		{
+			.vertex_shader_data = fs_work_get_buffer(vertex_work),
+			.vertex_shader_size = fs_work_get_size(vertex_work),
+			.fragment_shader_data = fs_work_get_buffer(fragment_work),
+			.fragment_shader_size = fs_work_get_size(fragment_work),
+			.uniform_buffer_count = 1,
+			.storage_buffer_count = model_path || pushed_path ? 0 : culled_path ? 2 : 1,
+			.push_constant_size = pushed_path ? sizeof(mat4f_t) : 0,
+		};
+	}
+	gpu_shader_info_t cull_shader = { 0 };
+	if (cull_work)
+	{
+		cull_shader = (gpu_shader_info_t)
+		{
+			.compute_shader_data = fs_work_get_buffer(cull_work),
+			.compute_shader_size = fs_work_get_size(cull_work),
+			.uniform_buffer_count = 1,
+			.storage_buffer_count = 3,
+		};
+	}
+
+	static vec3f_t quad_verts[] =
+	{
+		{ -1.0f, -1.0f,  0.0f }, { 0.0f, 1.0f,  1.0f },
+		{  1.0f, -1.0f,  0.0f }, { 0.0f, 1.0f,  1.0f },
+		{  1.0f,  1.0f,  0.0f }, { 0.0f, 1.0f,  1.0f },
+		{ -1.0f,  1.0f,  0.0f }, { 0.0f, 1.0f,  1.0f },
+	};
+	static uint16_t quad_indices[] =
+	{
+		2, 1, 0,
+		0, 3, 2
+	};
+	int mesh_count = __max(options->mesh_count, 1);
+	gpu_mesh_info_t* meshes = heap_alloc(heap, sizeof(gpu_mesh_info_t) * mesh_count, 8);
+	for (int i = 0; i < mesh_count; ++i)
+	{
+		meshes[i] = (gpu_mesh_info_t)
+		{
+			.layout = k_gpu_mesh_layout_tri_p444_c444_i2,
+			.vertex_data = quad_verts,
+			.vertex_data_size = sizeof(quad_verts),
+			.index_data = quad_indices,
+			.index_data_size = sizeof(quad_indices),
+		};
+	}
+
+	//instances are small quads in a grid filling the view, so culling keeps every one
+	camera_uniform_t camera;
+	mat4f_make_orthographic(&camera.projection, 20.0f, 2.0f, -1000.0f, 1000.0f);
+	vec3f_t eye_pos = vec3f_scale(vec3f_forward(), -5.0f);
+	vec3f_t forward = vec3f_forward();
+	vec3f_t up = vec3f_up();
+	mat4f_make_lookat(&camera.view, &eye_pos, &forward, &up);
+
+	int instance_count = __max(options->instance_count, 1);
+	int columns = __max((int)sqrtf(instance_count * 2.0f), 1);
+	int rows = (instance_count + columns - 1) / columns;
+	mat4f_t* models = heap_alloc(heap, sizeof(mat4f_t) * instance_count, 16);
+	for (int i = 0; i < instance_count; ++i)
+	{
+		vec3f_t position = vec3f_new(
+			((i % columns) + 0.5f) * 36.0f / columns - 18.0f,
+			((i / columns) + 0.5f) * 18.0f / rows - 9.0f,
+			0.0f);
+		vec3f_t scale = vec3f_new(0.1f, 0.1f, 0.1f);
+		mat4f_make_translation(&models[i], &position);
+		mat4f_scale(&models[i], &scale);
+	}
+
+	uint64_t* submit_ticks = heap_alloc(heap, sizeof(uint64_t) * frame_count, 8);
+	uint64_t* done_ticks = heap_alloc(heap, sizeof(uint64_t) * frame_count, 8);
+	for (int frame = -k_render_bench_warmup_frames; frame < frame_count; ++frame)
+	{
+		uint64_t start = timer_get_ticks();
+		push_scene(render, options, meshes, shaders, &cull_shader, &camera, models);
+		uint64_t submitted = timer_get_ticks();
+		render_push_done(render);
+		uint64_t done = timer_get_ticks();
+		frame_stats_end_frame(stats);
+
+		if (frame >= 0)
+		{
+			submit_ticks[frame] = submitted - start;
+			done_ticks[frame] = done - submitted;
+		}
+	}
+
+	//destroying the render finishes every frame in flight
+	render_destroy(render);
+	frame_stats_end_frame(stats);
+
+	debug_print(k_print_info, "Render bench: %d meshes x %d shaders x %d instances, %s path, %d recorders, %d frames\n",
+		mesh_count, shader_count, instance_count, render_bench_get_path_name(options->path), options->recorder_count, frame_count);
+	debug_print(k_print_info, "  us per frame                  min       avg       p99       max\n");
+	print_ticks("game submit", submit_ticks, frame_count);
+	print_ticks("game wait for render slot", done_ticks, frame_count);
+	print_stat(stats, k_frame_stat_render_us);
+	print_stat(stats, k_frame_stat_render_record_us);
+	print_stat(stats, k_frame_stat_gpu_frame_end_us);
+	print_stat(stats, k_frame_stat_gpu_us);
+	frame_stat_summary_t draws;
+	frame_stats_get(stats, k_frame_stat_draw_calls, &draws);
+	debug_print(k_print_info, "  draw calls per frame: %lld\n", draws.avg);
+
+	heap_free(heap, done_ticks);
+	heap_free(heap, submit_ticks);
+	heap_free(heap, models);
+	heap_free(heap, meshes);
+	heap_free(heap, shaders);
+	if (cull_work)
+	{
+		fs_work_destroy(cull_work);
+	}
+	fs_work_destroy(fragment_work);
+	fs_work_destroy(vertex_work);
+
+	frame_stats_set_default(previous_stats);
+	frame_stats_destroy(stats);
+	return 0;
+}
+
+const char* render_bench_get_path_name(int path)
+{
+	return path >= 0 && path < k_render_bench_path_count ? s_path_names[path] : "unknown";
+}
+
+// Push every mesh with every shader, instance count times, by the benchmark's path.
+static void push_scene(render_t* render, const render_bench_options_t* options, gpu_mesh_info_t* meshes, gpu_shader_info_t* shaders,
+	gpu_shader_info_t* cull_shader, const camera_uniform_t* camera, const mat4f_t* models)
+{
+	int mesh_count = __max(options->mesh_count, 1);
+	int shader_count = __max(options->shader_count, 1);
+	int instance_count = __max(options->instance_count, 1);
+	gpu_uniform_buffer_info_t camera_info = { .data = (void*)camera, .size = sizeof(*camera) };
+	for (int s = 0; s < shader_count; ++s)
+	{
+		for (int m = 0; m < mesh_count; ++m)
+		{
+			if (options->path == k_render_bench_path_model)
+			{
+				model_uniform_t uniform = { .projection = camera->projection, .view = camera->view };
+				gpu_uniform_buffer_info_t uniform_info = { .data = &uniform, .size = sizeof(uniform) };
+				for (int i = 0; i < instance_count; ++i)
+				{
+					uniform.model = models[i];
+					render_push_model(render, &meshes[m], &shaders[s], &uniform_info);
+				}
+			}
+			else if (options->path == k_render_bench_path_pushed)
+			{
+				for (int i = 0; i < instance_count; ++i)
+				{
+					render_push_model_with_constants(render, &meshes[m], &shaders[s], &camera_info, &models[i], sizeof(mat4f_t));
+				}
+			}
+			else if (options->path == k_render_bench_path_culled)
+			{
+				mat4f_t* instances = render_push_culled_instances(render, &meshes[m], &shaders[s], cull_shader, &camera_info, 1.5f, instance_count);
+				memcpy(instances, models, sizeof(mat4f_t) * instance_count);
+			}
+			else
+			{
+				mat4f_t* instances = render_push_instances(render, &meshes[m], &shaders[s], &camera_info, sizeof(mat4f_t), instance_count);
+				memcpy(instances, models, sizeof(mat4f_t) * instance_count);
+			}
+		}
+	}
+}
+
+// Print the min, average, 99th percentile and max of a time measured every frame.
+static void print_ticks(const char* name, uint64_t* ticks, int count)
+{
+	uint64_t sum = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		sum += ticks[i];
+	}
+	qsort(ticks, count, sizeof(uint64_t), compare_ticks);
+	debug_print(k_print_info, "  %-26s %9llu %9llu %9llu %9llu\n", name,
+		timer_ticks_to_us(ticks[0]), timer_ticks_to_us(sum / count),
+		timer_ticks_to_us(ticks[count * 99 / 100]), timer_ticks_to_us(ticks[count - 1]));
+}
+
+// Print the min, average, 99th percentile and max of a frame statistic over the measured frames.
+static void print_stat(frame_stats_t* stats, frame_stat_t stat)
+{
+	frame_stat_summary_t summary;
+	frame_stats_get(stats, stat, &summary);
+	debug_print(k_print_info, "  %-26s %9lld %9lld %9lld %9lld\n", frame_stats_get_name(stat), summary.min, summary.avg, summary.p99, summary.max);
+}
+
+static int compare_ticks(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
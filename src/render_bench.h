@@ -0,0 +1,44 @@
+#pragma once
+
+// Render throughput benchmark.
+// Every frame pushes a synthetic scene, every mesh drawn with every shader a number of times, through one of the
+// renderer's submission paths, headless so it runs without a window. Reports percentiles of the game thread's
+// submit time, the render thread's record time and time in gpu_frame_end(), and the GPU's own frame time from
+// timestamps, so the per-draw and instanced paths can be compared on the same scene.
+// Run with ga2022 -renderbench [options].
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+// How a render benchmark pushes its draws.
+typedef enum render_bench_path_t
+{
+	k_render_bench_path_model, //render_push_model() per draw, each with its own uniform and descriptor bind
+	k_render_bench_path_pushed, //render_push_model_with_constants() per draw, sharing the camera uniform and pushing the model matrix
+	k_render_bench_path_instanced, //render_push_instances() per mesh and shader, one instanced draw each
+	k_render_bench_path_culled, //render_push_culled_instances() per mesh and shader, culled on the GPU
+	k_render_bench_path_count,
+} render_bench_path_t;
+
+// Scene and settings of a render benchmark.
+typedef struct render_bench_options_t
+{
+	// Distinct meshes and shaders; each pairing is drawn instance count times a frame.
+	int mesh_count;
+	int shader_count;
+	int instance_count;
+	// Submission path, a render_bench_path_t.
+	int path;
+	// Frames measured, after a few untimed ones while pipelines are created.
+	int frame_count;
+	// Most jobs a frame's draws are recorded across, as in render_options_t, or 0 to record on the render thread.
+	int recorder_count;
+} render_bench_options_t;
+
+// Run a render benchmark, printing the results.
+// Returns zero on success.
+int render_bench_run(heap_t* heap, fs_t* fs, job_system_t* jobs, const render_bench_options_t* options);
+
+// Get a submission path's name, as given on the command line.
+const char* render_bench_get_path_name(int path);
@@ -0,0 +1,270 @@
+#include "replay.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "net.h"
+
+#include <string.h>
+
+enum
+{
+	// Bytes that start a recording, "GARP" read little endian, then its version.
+	k_replay_magic = 0x50524147,
+	k_replay_version = 1,
+
+	// Bytes a recording's buffer grows by at least.
+	k_replay_initial_capacity = 64 * 1024,
+
+	// Most packets in one frame of a playback.
+	k_replay_max_packets = 256,
+};
+
+// Start of a recording.
+typedef struct replay_file_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t frame_count;
+} replay_file_header_t;
+
+// Start of a frame in a recording, followed by its packets.
+typedef struct replay_frame_header_t
+{
+	uint32_t delta_us;
+	uint32_t key_mask;
+	uint32_t mouse_mask;
+	int16_t mouse_x;
+	int16_t mouse_y;
+	uint16_t packet_count;
+} replay_frame_header_t;
+
+// Start of a packet in a recording, followed by its data.
+typedef struct replay_packet_header_t
+{
+	uint8_t ip[4];
+	uint16_t port;
+	uint16_t size;
+} replay_packet_header_t;
+
+typedef struct replay_t
+{
+	heap_t* heap;
+	fs_t* fs;
+	char path[260];
+	bool playback;
+
+	// Recordings build the file here, frame by frame; playbacks read it from here.
+	char* data;
+	size_t size;
+	size_t capacity;
+	uint32_t flags;
+	uint32_t frame_count;
+
+	// Recording: packets of the frame in progress, written after its header once the frame is done.
+	char* packets;
+	size_t packets_size;
+	size_t packets_capacity;
+	int packet_count;
+
+	// Playback: where the next frame starts, and the packets of the frame last read.
+	size_t position;
+	uint32_t frames_read;
+	const replay_packet_header_t* frame_packets[k_replay_max_packets];
+} replay_t;
+
+static void append(replay_t* replay, char** buffer, size_t* size, size_t* capacity, const void* data, size_t data_size);
+
+replay_t* replay_create_recording(heap_t* heap, fs_t* fs, const char* path, uint32_t flags)
+{
+	replay_t* replay = heap_alloc(heap, sizeof(replay_t), 8);
+	memset(replay, 0, sizeof(replay_t));
+	replay->heap = heap;
+	replay->fs = fs;
+	strcpy_s(replay->path, sizeof(replay->path), path);
+	replay->flags = flags;
+
+	//the header's frame count is filled in when the file is written
+	replay_file_header_t header = { .magic = k_replay_magic, .version = k_replay_version, .flags = flags };
+	append(replay, &replay->data, &replay->size, &replay->capacity, &header, sizeof(header));
+	return replay;
+}
+
+replay_t* replay_create_playback(heap_t* heap, fs_t* fs, const char* path)
+{
+	fs_work_t* work = fs_read(fs, path, heap, false, true);
+	int result = fs_work_get_result(work);
+	char* data = fs_work_get_buffer(work);
+	size_t size = fs_work_get_size(work);
+	fs_work_destroy(work);
+
+	replay_file_header_t header = { 0 };
+	if (!result && data && size >= sizeof(header))
+	{
+		memcpy(&header, data, sizeof(header));
+	}
+	if (header.magic != k_replay_magic || header.version != k_replay_version)
+	{
+		debug_print(k_print_error, "Unable to read replay %s.\n", path);
+		if (data)
+		{
+			heap_free(heap, data);
+		}
+		return NULL;
+	}
+
+	replay_t* replay = heap_alloc(heap, sizeof(replay_t), 8);
+	memset(replay, 0, sizeof(replay_t));
+	replay->heap = heap;
+	replay->fs = fs;
+	strcpy_s(replay->path, sizeof(replay->path), path);
+	replay->playback = true;
+	replay->data = data;
+	replay->size = size;
+	replay->flags = header.flags;
+	replay->frame_count = header.frame_count;
+	replay->position = sizeof(header);
+	debug_print(k_print_info, "Replaying %u frames from %s.\n", replay->frame_count, path);
+	return replay;
+}
+
+void replay_destroy(replay_t* replay)
+{
+	if (replay->playback)
+	{
+		heap_free(replay->heap, replay->data);
+	}
+	else
+	{
+		replay_file_header_t header;
+		memcpy(&header, replay->data, sizeof(header));
+		header.frame_count = replay->frame_count;
+		memcpy(replay->data, &header, sizeof(header));
+
+		//frames repeat much of each other, so they compress well
+		fs_work_t* work = fs_write(replay->fs, replay->path, replay->data, replay->size, true);
+		fs_work_wait(work);
+		int result = fs_work_get_result(work);
+		debug_print(result ? k_print_error : k_print_info, "Replay of %u frames %s %s.\n",
+			replay->frame_count, result ? "failed to write to" : "written to", replay->path);
+		fs_work_destroy(work);
+		heap_free(replay->heap, replay->data);
+		if (replay->packets)
+		{
+			heap_free(replay->heap, replay->packets);
+		}
+	}
+	heap_free(replay->heap, replay);
+}
+
+bool replay_is_playback(replay_t* replay)
+{
+	return replay->playback;
+}
+
+bool replay_is_finished(replay_t* replay)
+{
+	return replay->playback && replay->frames_read >= replay->frame_count;
+}
+
+uint32_t replay_get_flags(replay_t* replay)
+{
+	return replay->flags;
+}
+
+void replay_record_packet(replay_t* replay, const net_address_t* address, const void* data, int size)
+{
+	replay_packet_header_t header = { .port = address->port, .size = (uint16_t)size };
+	memcpy(header.ip, address->ip, sizeof(header.ip));
+	append(replay, &replay->packets, &replay->packets_size, &replay->packets_capacity, &header, sizeof(header));
+	append(replay, &replay->packets, &replay->packets_size, &replay->packets_capacity, data, size);
+	replay->packet_count++;
+}
+
+void replay_record_frame(replay_t* replay, const replay_frame_t* frame)
+{
+	//a frame with more packets than playback holds keeps the first of them
+	int packet_count = __min(replay->packet_count, k_replay_max_packets);
+	size_t packets_size = 0;
+	for (int i = 0; i < packet_count; ++i)
+	{
+		replay_packet_header_t header;
+		memcpy(&header, replay->packets + packets_size, sizeof(header));
+		packets_size += sizeof(header) + header.size;
+	}
+
+	replay_frame_header_t header =
+	{
+		.delta_us = (uint32_t)frame->delta_us,
+		.key_mask = frame->key_mask,
+		.mouse_mask = frame->mouse_mask,
+		.mouse_x = (int16_t)frame->mouse_x,
+		.mouse_y = (int16_t)frame->mouse_y,
+		.packet_count = (uint16_t)packet_count,
+	};
+	append(replay, &replay->data, &replay->size, &replay->capacity, &header, sizeof(header));
+	append(replay, &replay->data, &replay->size, &replay->capacity, replay->packets, packets_size);
+	replay->packets_size = 0;
+	replay->packet_count = 0;
+	replay->frame_count++;
+}
+
+bool replay_next_frame(replay_t* replay, replay_frame_t* frame)
+{
+	replay_frame_header_t header;
+	if (replay->frames_read >= replay->frame_count || replay->position + sizeof(header) > replay->size)
+	{
+		replay->frames_read = replay->frame_count;
+		return false;
+	}
+	memcpy(&header, replay->data + replay->position, sizeof(header));
+	replay->position += sizeof(header);
+
+	//packet headers are read in place; the targets allow their unaligned 16 bit loads
+	int packet_count = 0;
+	for (int i = 0; i < header.packet_count && packet_count < k_replay_max_packets; ++i)
+	{
+		const replay_packet_header_t* packet = (const replay_packet_header_t*)(replay->data + replay->position);
+		if (replay->position + sizeof(*packet) > replay->size || replay->position + sizeof(*packet) + packet->size > replay->size)
+		{
+			break;
+		}
+		replay->frame_packets[packet_count++] = packet;
+		replay->position += sizeof(*packet) + packet->size;
+	}
+
+	*frame = (replay_frame_t)
+	{
+		.delta_us = header.delta_us,
+		.key_mask = header.key_mask,
+		.mouse_mask = header.mouse_mask,
+		.mouse_x = header.mouse_x,
+		.mouse_y = header.mouse_y,
+		.packet_count = packet_count,
+	};
+	replay->frames_read++;
+	return true;
+}
+
+void replay_get_packet(replay_t* replay, int index, net_address_t* address, const void** data, int* size)
+{
+	const replay_packet_header_t* packet = replay->frame_packets[index];
+	memcpy(address->ip, packet->ip, sizeof(address->ip));
+	address->port = packet->port;
+	*data = packet + 1;
+	*size = packet->size;
+}
+
+// Append data to a growing buffer, doubling its capacity as needed.
+static void append(replay_t* replay, char** buffer, size_t* size, size_t* capacity, const void* data, size_t data_size)
+{
+	if (*size + data_size > *capacity)
+	{
+		size_t new_capacity = __max(*capacity * 2, __max(*size + data_size, k_replay_initial_capacity));
+		*buffer = heap_realloc(replay->heap, *buffer, new_capacity, 8);
+		*capacity = new_capacity;
+	}
+	memcpy(*buffer + *size, data, data_size);
+	*size += data_size;
+}
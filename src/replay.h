@@ -0,0 +1,62 @@
+#pragma once
+
+// Frame capture and replay.
+// A recording logs what drove each frame from outside the engine: the game timer's delta, the window's input and
+// the net packets processed, and writes it compressed to a file when destroyed. Playing it back hands the same
+// frames out again in order, so a session can be rerun on a fixed clock with no window input or network, and
+// frame times compared between builds on an identical workload.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+typedef struct net_address_t net_address_t;
+
+// Handle to a recording or playback of frames.
+typedef struct replay_t replay_t;
+
+// What drove one frame, besides its packets.
+typedef struct replay_frame_t
+{
+	uint64_t delta_us; //of the game timer
+	uint32_t key_mask;
+	uint32_t mouse_mask;
+	int mouse_x; //relative movement
+	int mouse_y;
+	int packet_count; //set on playback
+} replay_frame_t;
+
+// Start recording frames, to be written to path when the recording is destroyed.
+// Flags are stored with the frames for playback to read back, for whatever setup the frames depend on.
+replay_t* replay_create_recording(heap_t* heap, fs_t* fs, const char* path, uint32_t flags);
+
+// Read a recording from path to play back.
+// Returns NULL if the file cannot be read or is not a recording.
+replay_t* replay_create_playback(heap_t* heap, fs_t* fs, const char* path);
+
+// Destroy a recording or playback, writing a recording's file first.
+void replay_destroy(replay_t* replay);
+
+// Is this a playback rather than a recording.
+bool replay_is_playback(replay_t* replay);
+
+// Has a playback handed out every frame it holds.
+bool replay_is_finished(replay_t* replay);
+
+// Get the flags a recording was created with.
+uint32_t replay_get_flags(replay_t* replay);
+
+// Record a packet processed in the current frame of a recording.
+void replay_record_packet(replay_t* replay, const net_address_t* address, const void* data, int size);
+
+// Finish the current frame of a recording with what drove it, and start the next.
+void replay_record_frame(replay_t* replay, const replay_frame_t* frame);
+
+// Read the next frame of a playback, making its packets current.
+// Returns false once every frame has been read.
+bool replay_next_frame(replay_t* replay, replay_frame_t* frame);
+
+// Get a packet of the frame last read, by index up to its packet count.
+// Data stays valid until the next frame is read.
+void replay_get_packet(replay_t* replay, int index, net_address_t* address, const void** data, int* size);
@@ -1,5 +1,7 @@
 #include "semaphore.h"
 
+#include "atomic.h"
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -29,3 +31,54 @@ void semaphore_release(semaphore_t* semaphore)
 {
 	ReleaseSemaphore(semaphore, 1, NULL);
 }
+
+void light_semaphore_init(light_semaphore_t* semaphore, int initial_count, int max_count)
+{
+	semaphore->count = initial_count;
+	semaphore->max_count = max_count;
+	semaphore->waiters = 0;
+}
+
+void light_semaphore_acquire(light_semaphore_t* semaphore)
+{
+	while (!light_semaphore_try_acquire(semaphore))
+	{
+		//count as a waiter before looking at the count again, so a release in between wakes this thread
+		atomic_increment(&semaphore->waiters);
+		atomic_wait(&semaphore->count, 0);
+		atomic_decrement(&semaphore->waiters);
+	}
+}
+
+bool light_semaphore_try_acquire(light_semaphore_t* semaphore)
+{
+	int count = atomic_load(&semaphore->count);
+	while (count > 0)
+	{
+		int old_count = atomic_compare_and_exchange(&semaphore->count, count, count - 1);
+		if (old_count == count)
+		{
+			return true;
+		}
+		count = old_count;
+	}
+	return false;
+}
+
+void light_semaphore_release(light_semaphore_t* semaphore)
+{
+	int count = atomic_load(&semaphore->count);
+	while (count < semaphore->max_count)
+	{
+		int old_count = atomic_compare_and_exchange(&semaphore->count, count, count + 1);
+		if (old_count == count)
+		{
+			if (atomic_load_seq_cst(&semaphore->waiters))
+			{
+				atomic_wake_one(&semaphore->count);
+			}
+			return;
+		}
+		count = old_count;
+	}
+}
@@ -23,3 +23,28 @@ bool semaphore_try_acquire(semaphore_t* semaphore);
 
 // Raises the semaphore count by one.
 void semaphore_release(semaphore_t* semaphore);
+
+// Lightweight counting semaphore.
+// Like semaphore_t, but lives inside the structure that uses it instead of behind a kernel handle:
+// acquiring a positive count and releasing with no one waiting never enter the kernel.
+// Call light_semaphore_init before first use.
+typedef struct light_semaphore_t
+{
+	int count;
+	int max_count;
+	int waiters; //threads blocked in light_semaphore_acquire, which a release must wake
+} light_semaphore_t;
+
+// Initialize a semaphore with a count, which releases never raise above max_count.
+void light_semaphore_init(light_semaphore_t* semaphore, int initial_count, int max_count);
+
+// Lowers the semaphore count by one.
+// If the semaphore count is zero, blocks until another thread releases.
+void light_semaphore_acquire(light_semaphore_t* semaphore);
+
+// Attempts to lower the semaphore count by one.
+// If the semaphore count is zero, returns false. Otherwise true.
+bool light_semaphore_try_acquire(light_semaphore_t* semaphore);
+
+// Raises the semaphore count by one, unless it is already at its maximum.
+void light_semaphore_release(light_semaphore_t* semaphore);
@@ -0,0 +1,28 @@
+#version 450
+
+layout (location = 0) in vec3 inPos;
+layout (location = 1) in vec3 inColor;
+
+layout (binding = 0) uniform UBO 
+{
+	mat4 projectionMatrix;
+	mat4 viewMatrix;
+} ubo;
+
+layout (std430, binding = 1) readonly buffer Instances
+{
+	mat4 modelMatrix[];
+} instances;
+
+layout (location = 0) out vec3 outColor;
+
+out gl_PerVertex
+{
+    vec4 gl_Position;
+};
+
+void main()
+{
+	outColor = inColor;
+	gl_Position = ubo.projectionMatrix * ubo.viewMatrix * instances.modelMatrix[gl_InstanceIndex] * vec4(inPos.xyz, 1.0);
+}
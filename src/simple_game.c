@@ -7,12 +7,14 @@
 #include "heap.h"
 #include "net.h"
 #include "render.h"
+#include "string_id.h"
 #include "timer_object.h"
 #include "transform.h"
 #include "wm.h"
 
 #define _USE_MATH_DEFINES
 #include <math.h>
+#include <stddef.h>
 #include <string.h>
 
 typedef struct transform_component_t
@@ -39,7 +41,7 @@ typedef struct player_component_t
 
 typedef struct name_component_t
 {
-	char name[32];
+	string_id_t name;
 } name_component_t;
 
 typedef struct simple_game_t
@@ -91,7 +93,16 @@ simple_game_t* simple_game_create(heap_t* heap, fs_t* fs, wm_window_t* window, r
 	game->player_type = ecs_register_component_type(game->ecs, "player", sizeof(player_component_t), _Alignof(player_component_t));
 	game->name_type = ecs_register_component_type(game->ecs, "name", sizeof(name_component_t), _Alignof(name_component_t));
 
-	game->net = net_create(heap, game->ecs);
+	net_options_t net_options = { .timer = game->timer };
+	game->net = net_create_with_options(heap, game->ecs, &net_options);
+	//positions to 1/512 of a unit within 256 units of the origin; scale is never changed, so not sent
+	net_field_t transform_fields[] =
+	{
+		{ .encoding = k_net_field_fixed, .offset = offsetof(transform_component_t, transform.translation), .count = 3, .bits = 18, .min = -256.0f, .max = 256.0f },
+		{ .encoding = k_net_field_quaternion, .offset = offsetof(transform_component_t, transform.rotation), .bits = 10 },
+	};
+	net_state_register_component_fields(game->net, game->transform_type, transform_fields, _countof(transform_fields));
+
 	if (argc >= 2)
 	{
 		net_address_t server;
@@ -133,8 +144,8 @@ void simple_game_update(simple_game_t* game)
 
 static void load_resources(simple_game_t* game)
 {
-	game->vertex_shader_work = fs_read(game->fs, "shaders/triangle.vert.spv", game->heap, false, false);
-	game->fragment_shader_work = fs_read(game->fs, "shaders/triangle.frag.spv", game->heap, false, false);
+	game->vertex_shader_work = fs_map(game->fs, "shaders/pushed.vert.spv");
+	game->fragment_shader_work = fs_map(game->fs, "shaders/triangle.frag.spv");
 	game->cube_shader = (gpu_shader_info_t)
 	{
 		.vertex_shader_data = fs_work_get_buffer(game->vertex_shader_work),
@@ -142,6 +153,7 @@ static void load_resources(simple_game_t* game)
 		.fragment_shader_data = fs_work_get_buffer(game->fragment_shader_work),
 		.fragment_shader_size = fs_work_get_size(game->fragment_shader_work),
 		.uniform_buffer_count = 1,
+		.push_constant_size = sizeof(mat4f_t),
 	};
 
 	static vec3f_t cube_verts[] =
@@ -182,8 +194,6 @@ static void load_resources(simple_game_t* game)
 
 static void unload_resources(simple_game_t* game)
 {
-	heap_free(game->heap, fs_work_get_buffer(game->vertex_shader_work));
-	heap_free(game->heap, fs_work_get_buffer(game->fragment_shader_work));
 	fs_work_destroy(game->fragment_shader_work);
 	fs_work_destroy(game->vertex_shader_work);
 }
@@ -199,18 +209,18 @@ static void player_net_configure(ecs_t* ecs, ecs_entity_ref_t entity, int type,
 
 static void spawn_player(simple_game_t* game, int index)
 {
-	uint64_t k_player_ent_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->player_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_player_ent_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->player_type,
+		game->name_type);
 	game->player_ent = ecs_entity_add(game->ecs, k_player_ent_mask);
 
 	transform_component_t* transform_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->transform_type, true);
 	transform_identity(&transform_comp->transform);
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "player");
+	name_comp->name = string_id_intern("player");
 
 	player_component_t* player_comp = ecs_entity_get_component(game->ecs, game->player_ent, game->player_type, true);
 	player_comp->index = index;
@@ -219,12 +229,11 @@ static void spawn_player(simple_game_t* game, int index)
 	model_comp->mesh_info = &game->cube_mesh;
 	model_comp->shader_info = &game->cube_shader;
 
-	uint64_t k_player_ent_net_mask =
-		(1ULL << game->transform_type) |
-		(1ULL << game->model_type) |
-		(1ULL << game->name_type);
-	uint64_t k_player_ent_rep_mask =
-		(1ULL << game->transform_type);
+	ecs_mask_t k_player_ent_net_mask = ECS_MASK(
+		game->transform_type,
+		game->model_type,
+		game->name_type);
+	ecs_mask_t k_player_ent_rep_mask = ECS_MASK(game->transform_type);
 	net_state_register_entity_type(game->net, 0, k_player_ent_net_mask, k_player_ent_rep_mask, player_net_configure, game);
 
 	net_state_register_entity_instance(game->net, 0, game->player_ent);
@@ -232,13 +241,13 @@ static void spawn_player(simple_game_t* game, int index)
 
 static void spawn_camera(simple_game_t* game)
 {
-	uint64_t k_camera_ent_mask =
-		(1ULL << game->camera_type) |
-		(1ULL << game->name_type);
+	ecs_mask_t k_camera_ent_mask = ECS_MASK(
+		game->camera_type,
+		game->name_type);
 	game->camera_ent = ecs_entity_add(game->ecs, k_camera_ent_mask);
 
 	name_component_t* name_comp = ecs_entity_get_component(game->ecs, game->camera_ent, game->name_type, true);
-	strcpy_s(name_comp->name, sizeof(name_comp->name), "camera");
+	name_comp->name = string_id_intern("camera");
 
 	camera_component_t* camera_comp = ecs_entity_get_component(game->ecs, game->camera_ent, game->camera_type, true);
 	mat4f_make_perspective(&camera_comp->projection, (float)M_PI / 2.0f, 16.0f / 9.0f, 0.1f, 100.0f);
@@ -255,7 +264,7 @@ static void update_players(simple_game_t* game)
 
 	uint32_t key_mask = wm_get_key_mask(game->window);
 
-	uint64_t k_query_mask = (1ULL << game->transform_type) | (1ULL << game->player_type);
+	ecs_mask_t k_query_mask = ECS_MASK(game->transform_type, game->player_type);
 
 	for (ecs_query_t query = ecs_query_create(game->ecs, k_query_mask);
 		ecs_query_is_valid(game->ecs, &query);
@@ -288,39 +297,40 @@ static void update_players(simple_game_t* game)
 			move.translation = vec3f_add(move.translation, vec3f_scale(vec3f_right(), dt));
 		}
 		transform_multiply(&transform_comp->transform, &move);
+		ecs_query_mark_changed(game->ecs, &query, game->transform_type);
 	}
 }
 
 static void draw_models(simple_game_t* game)
 {
-	uint64_t k_camera_query_mask = (1ULL << game->camera_type);
+	ecs_mask_t k_camera_query_mask = ECS_MASK(game->camera_type);
 	for (ecs_query_t camera_query = ecs_query_create(game->ecs, k_camera_query_mask);
 		ecs_query_is_valid(game->ecs, &camera_query);
 		ecs_query_next(game->ecs, &camera_query))
 	{
 		camera_component_t* camera_comp = ecs_query_get_component(game->ecs, &camera_query, game->camera_type);
 
-		uint64_t k_model_query_mask = (1ULL << game->transform_type) | (1ULL << game->model_type);
+		//the camera is the only uniform; each model's matrix is pushed with its draw
+		struct
+		{
+			mat4f_t projection;
+			mat4f_t view;
+		} uniform_data;
+		uniform_data.projection = camera_comp->projection;
+		uniform_data.view = camera_comp->view;
+		gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
+
+		ecs_mask_t k_model_query_mask = ECS_MASK(game->transform_type, game->model_type);
 		for (ecs_query_t query = ecs_query_create(game->ecs, k_model_query_mask);
 			ecs_query_is_valid(game->ecs, &query);
 			ecs_query_next(game->ecs, &query))
 		{
 			transform_component_t* transform_comp = ecs_query_get_component(game->ecs, &query, game->transform_type);
 			model_component_t* model_comp = ecs_query_get_component(game->ecs, &query, game->model_type);
-			ecs_entity_ref_t entity_ref = ecs_query_get_entity(game->ecs, &query);
-
-			struct
-			{
-				mat4f_t projection;
-				mat4f_t model;
-				mat4f_t view;
-			} uniform_data;
-			uniform_data.projection = camera_comp->projection;
-			uniform_data.view = camera_comp->view;
-			transform_to_matrix(&transform_comp->transform, &uniform_data.model);
-			gpu_uniform_buffer_info_t uniform_info = { .data = &uniform_data, sizeof(uniform_data) };
-
-			render_push_model(game->render, &entity_ref, model_comp->mesh_info, model_comp->shader_info, &uniform_info);
+
+			mat4f_t model;
+			transform_to_matrix(&transform_comp->transform, &model);
+			render_push_model_with_constants(game->render, model_comp->mesh_info, model_comp->shader_info, &uniform_info, &model, sizeof(model));
 		}
 	}
 }
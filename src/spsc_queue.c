@@ -0,0 +1,191 @@
+#include "spsc_queue.h"
+
+#include "atomic.h"
+#include "heap.h"
+
+#include <stdlib.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	k_cache_line_size = 64,
+};
+
+// Each side owns one index and keeps a private copy of the other side's index,
+// refreshing it only when the copy says the queue looks full or empty.
+// One slot is always left unused so head == tail means empty.
+typedef struct spsc_queue_t
+{
+	heap_t* heap;
+	void** items;
+	int slot_count;
+	char pad0[k_cache_line_size];
+
+	int tail; //written by the producer
+	int cached_head;
+	int producer_waiting;
+	char pad1[k_cache_line_size];
+
+	int head; //written by the consumer
+	int cached_tail;
+	int consumer_waiting;
+	char pad2[k_cache_line_size];
+} spsc_queue_t;
+
+static int push_some(spsc_queue_t* queue, void** items, int count);
+static int pop_some(spsc_queue_t* queue, void** items, int capacity);
+static void wait_for_space(spsc_queue_t* queue);
+static void wait_for_items(spsc_queue_t* queue);
+
+spsc_queue_t* spsc_queue_create(heap_t* heap, int capacity)
+{
+	spsc_queue_t* queue = heap_alloc(heap, sizeof(spsc_queue_t), k_cache_line_size);
+	queue->heap = heap;
+	queue->slot_count = capacity + 1;
+	queue->items = heap_alloc(heap, sizeof(void*) * queue->slot_count, k_cache_line_size);
+	queue->tail = 0;
+	queue->cached_head = 0;
+	queue->producer_waiting = 0;
+	queue->head = 0;
+	queue->cached_tail = 0;
+	queue->consumer_waiting = 0;
+	return queue;
+}
+
+void spsc_queue_destroy(spsc_queue_t* queue)
+{
+	heap_free(queue->heap, queue->items);
+	heap_free(queue->heap, queue);
+}
+
+void spsc_queue_push(spsc_queue_t* queue, void* item)
+{
+	spsc_queue_push_n(queue, &item, 1);
+}
+
+void* spsc_queue_pop(spsc_queue_t* queue)
+{
+	void* item;
+	spsc_queue_pop_n(queue, &item, 1);
+	return item;
+}
+
+bool spsc_queue_try_push(spsc_queue_t* queue, void* item)
+{
+	return push_some(queue, &item, 1) == 1;
+}
+
+void* spsc_queue_try_pop(spsc_queue_t* queue)
+{
+	void* item;
+	return pop_some(queue, &item, 1) ? item : NULL;
+}
+
+void spsc_queue_push_n(spsc_queue_t* queue, void** items, int count)
+{
+	while (count > 0)
+	{
+		int pushed = push_some(queue, items, count);
+		if (!pushed)
+		{
+			wait_for_space(queue);
+		}
+		items += pushed;
+		count -= pushed;
+	}
+}
+
+int spsc_queue_pop_n(spsc_queue_t* queue, void** items, int capacity)
+{
+	int popped;
+	while (!(popped = pop_some(queue, items, capacity)))
+	{
+		wait_for_items(queue);
+	}
+	return popped;
+}
+
+static int push_some(spsc_queue_t* queue, void** items, int count)
+{
+	int tail = queue->tail;
+	int space = (queue->cached_head > tail ? 0 : queue->slot_count) + queue->cached_head - tail - 1;
+	if (space < count)
+	{
+		queue->cached_head = atomic_load(&queue->head);
+		space = (queue->cached_head > tail ? 0 : queue->slot_count) + queue->cached_head - tail - 1;
+	}
+
+	int pushed = __min(space, count);
+	for (int i = 0; i < pushed; ++i)
+	{
+		queue->items[tail] = items[i];
+		tail = tail + 1 == queue->slot_count ? 0 : tail + 1;
+	}
+
+	if (pushed)
+	{
+		atomic_store(&queue->tail, tail);
+		if (atomic_load(&queue->consumer_waiting))
+		{
+			atomic_wake_all(&queue->tail);
+		}
+	}
+	return pushed;
+}
+
+static int pop_some(spsc_queue_t* queue, void** items, int capacity)
+{
+	int head = queue->head;
+	int available = (queue->cached_tail >= head ? 0 : queue->slot_count) + queue->cached_tail - head;
+	if (available < capacity)
+	{
+		queue->cached_tail = atomic_load(&queue->tail);
+		available = (queue->cached_tail >= head ? 0 : queue->slot_count) + queue->cached_tail - head;
+	}
+
+	int popped = __min(available, capacity);
+	for (int i = 0; i < popped; ++i)
+	{
+		items[i] = queue->items[head];
+		head = head + 1 == queue->slot_count ? 0 : head + 1;
+	}
+
+	if (popped)
+	{
+		atomic_store(&queue->head, head);
+		if (atomic_load(&queue->producer_waiting))
+		{
+			atomic_wake_all(&queue->head);
+		}
+	}
+	return popped;
+}
+
+// The fast paths publish an index and then check the waiting flag with plain accesses.
+// While parking, the sleeping side flushes every processor's write buffer, so either it sees
+// the other side's latest index or the other side sees the flag and wakes it.
+static void wait_for_space(spsc_queue_t* queue)
+{
+	atomic_store(&queue->producer_waiting, 1);
+	FlushProcessWriteBuffers();
+	int head = atomic_load(&queue->head);
+	if ((queue->tail + 1 == queue->slot_count ? 0 : queue->tail + 1) == head)
+	{
+		atomic_wait(&queue->head, head);
+	}
+	atomic_store(&queue->producer_waiting, 0);
+}
+
+static void wait_for_items(spsc_queue_t* queue)
+{
+	atomic_store(&queue->consumer_waiting, 1);
+	FlushProcessWriteBuffers();
+	int tail = atomic_load(&queue->tail);
+	if (tail == queue->head)
+	{
+		atomic_wait(&queue->tail, tail);
+	}
+	atomic_store(&queue->consumer_waiting, 0);
+}
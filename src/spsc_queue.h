@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Single-producer/single-consumer Queue container
+// A bounded ring for the common case of one thread feeding another.
+// Pushing and popping touch no interlocked instructions; threads only block
+// in the OS while the queue is empty or full.
+// At most one thread may push and one thread may pop at any time.
+
+// Handle to a single-producer/single-consumer queue.
+typedef struct spsc_queue_t spsc_queue_t;
+
+typedef struct heap_t heap_t;
+
+// Create a queue with the defined capacity.
+spsc_queue_t* spsc_queue_create(heap_t* heap, int capacity);
+
+// Destroy a previously created queue.
+void spsc_queue_destroy(spsc_queue_t* queue);
+
+// Push an item onto a queue.
+// If the queue is full, blocks until space is available.
+void spsc_queue_push(spsc_queue_t* queue, void* item);
+
+// Pop an item off a queue (FIFO order).
+// If the queue is empty, blocks until an item is available.
+void* spsc_queue_pop(spsc_queue_t* queue);
+
+// Push an item onto a queue if space is available.
+// If the queue is full, returns false.
+bool spsc_queue_try_push(spsc_queue_t* queue, void* item);
+
+// Pop an item off a queue (FIFO order).
+// If the queue is empty, returns NULL.
+void* spsc_queue_try_pop(spsc_queue_t* queue);
+
+// Push count items onto a queue, in order, publishing each run of free slots at once.
+// Blocks until every item has been pushed.
+void spsc_queue_push_n(spsc_queue_t* queue, void** items, int count);
+
+// Pop up to capacity items off a queue (FIFO order) into items.
+// If the queue is empty, blocks until at least one item is available.
+// Returns the number of items popped.
+int spsc_queue_pop_n(spsc_queue_t* queue, void** items, int capacity);
@@ -0,0 +1,134 @@
+#include "string_id.h"
+
+#include "debug.h"
+#include "lock.h"
+
+#include "lz4/xxhash.h"
+
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+enum
+{
+	// Most strings interned in a run, and the bytes of text they may hold between them.
+	k_string_id_capacity = 1 << 16,
+	k_string_id_text_capacity = 4 * 1024 * 1024,
+
+	// Hash slots, a power of two at least twice the capacity so probes stay short.
+	k_string_id_slot_count = k_string_id_capacity * 2,
+};
+
+// Strings are stored once each, found by hash through open addressed slots holding their ids.
+// Memory is reserved and committed once at startup; the OS backs pages only as they are first written.
+typedef struct string_table_t
+{
+	lock_t lock; //held to find or add strings; reading an id's text needs none, as text never moves
+	string_id_t* slots; //0 where empty
+	uint32_t* hashes; //per id
+	uint32_t* offsets; //per id, into text
+	char* text;
+	size_t text_size;
+	uint32_t count; //ids issued, counting k_string_id_none
+} string_table_t;
+
+static string_table_t s_string_table;
+
+static string_id_t find_slot(const char* string, size_t length, uint32_t hash, uint32_t* slot);
+
+void string_id_startup()
+{
+	size_t size = sizeof(string_id_t) * k_string_id_slot_count +
+		sizeof(uint32_t) * k_string_id_capacity * 2 +
+		k_string_id_text_capacity;
+	char* memory = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (!memory)
+	{
+		debug_print(k_print_error, "Unable to reserve the string table.\n");
+		return;
+	}
+	lock_init_named(&s_string_table.lock, "string id");
+	s_string_table.slots = (string_id_t*)memory;
+	s_string_table.hashes = (uint32_t*)(s_string_table.slots + k_string_id_slot_count);
+	s_string_table.offsets = s_string_table.hashes + k_string_id_capacity;
+	s_string_table.text = (char*)(s_string_table.offsets + k_string_id_capacity);
+
+	//id 0 names the empty string at offset 0
+	s_string_table.text_size = 1;
+	s_string_table.count = 1;
+}
+
+string_id_t string_id_intern(const char* string)
+{
+	size_t length = strlen(string);
+	if (!length)
+	{
+		return k_string_id_none;
+	}
+	uint32_t hash = XXH32(string, length, 0);
+
+	lock_acquire(&s_string_table.lock);
+	uint32_t slot;
+	string_id_t id = find_slot(string, length, hash, &slot);
+	if (id == k_string_id_none)
+	{
+		if (s_string_table.count < k_string_id_capacity && s_string_table.text_size + length + 1 <= k_string_id_text_capacity)
+		{
+			id = s_string_table.count++;
+			s_string_table.hashes[id] = hash;
+			s_string_table.offsets[id] = (uint32_t)s_string_table.text_size;
+			memcpy(&s_string_table.text[s_string_table.text_size], string, length + 1);
+			s_string_table.text_size += length + 1;
+			s_string_table.slots[slot] = id;
+		}
+		else
+		{
+			debug_print(k_print_error, "Out of space to intern %s.\n", string);
+		}
+	}
+	lock_release(&s_string_table.lock);
+	return id;
+}
+
+string_id_t string_id_find(const char* string)
+{
+	size_t length = strlen(string);
+	if (!length)
+	{
+		return k_string_id_none;
+	}
+	uint32_t hash = XXH32(string, length, 0);
+
+	lock_acquire(&s_string_table.lock);
+	uint32_t slot;
+	string_id_t id = find_slot(string, length, hash, &slot);
+	lock_release(&s_string_table.lock);
+	return id;
+}
+
+const char* string_id_get(string_id_t id)
+{
+	return &s_string_table.text[s_string_table.offsets[id]];
+}
+
+// Find a string's id, or k_string_id_none with slot set to the empty slot it would be added in.
+// Called with the table's lock held.
+static string_id_t find_slot(const char* string, size_t length, uint32_t hash, uint32_t* slot)
+{
+	for (uint32_t i = hash & (k_string_id_slot_count - 1);; i = (i + 1) & (k_string_id_slot_count - 1))
+	{
+		string_id_t id = s_string_table.slots[i];
+		if (id == k_string_id_none)
+		{
+			*slot = i;
+			return k_string_id_none;
+		}
+		const char* text = &s_string_table.text[s_string_table.offsets[id]];
+		if (s_string_table.hashes[id] == hash && strncmp(text, string, length) == 0 && text[length] == '\0')
+		{
+			*slot = i;
+			return id;
+		}
+	}
+}
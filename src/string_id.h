@@ -0,0 +1,29 @@
+#pragma once
+
+// Interned strings.
+// Interning a string returns a 32 bit id, the same one for equal strings for the rest of the run, so names
+// can be stored in four bytes, compared and hashed as integers, and turned back into text only to be shown.
+// Interned text is kept until exit. Every function may be called from any thread.
+
+#include <stdint.h>
+
+typedef uint32_t string_id_t;
+
+enum
+{
+	// Id of no string; string_id_get() returns an empty string for it.
+	k_string_id_none = 0,
+};
+
+// Perform one-time initialization of the string table.
+void string_id_startup();
+
+// Get the id of a string, interning it if it is new.
+// Returns k_string_id_none for an empty string, or if the table is full.
+string_id_t string_id_intern(const char* string);
+
+// Get the id of a string if it was interned, or k_string_id_none if not.
+string_id_t string_id_find(const char* string);
+
+// Get the text of an interned string.
+const char* string_id_get(string_id_t id);
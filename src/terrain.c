@@ -0,0 +1,463 @@
+#include "terrain.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "heap.h"
+#include "job.h"
+#include "trace.h"
+
+#include "chipmunk/chipmunk_private.h"
+#include "chipmunk/cpMarch.h"
+#include "chipmunk/cpPolyline.h"
+#include "lz4/xxhash.h"
+
+#include <stdio.h>
+#include <string.h>
+
+enum
+{
+	k_terrain_default_tile_size = 64,
+
+	// First four bytes of a cached terrain file, "GTER".
+	k_terrain_file_magic = 0x52455447,
+	// Bump when the file or the way terrain is built changes, so older caches are built again.
+	k_terrain_file_version = 1,
+
+	k_terrain_max_path = 260,
+};
+
+// A cached terrain file, which is also how built terrain is held in memory: this header, the index of each
+// outline's first vertex and of each hull's, each with one past the end, then every vertex as x, y floats.
+typedef struct terrain_file_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key; //hash of the bitmap and settings it was built from
+	uint32_t outline_count;
+	uint32_t hull_count;
+	uint32_t vertex_count;
+	uint32_t reserved;
+} terrain_file_header_t;
+
+// Settings a build runs with, defaults filled in; the tolerance is in pixels.
+typedef struct terrain_build_t
+{
+	const terrain_info_t* info;
+	float cell_size; //in meters, which vertices are stored in
+	float threshold;
+	float tolerance;
+} terrain_build_t;
+
+// One tile of pixels [x0, x1) by [y0, y1), counting rows up from the bottom of the image, built as a job.
+typedef struct terrain_tile_t
+{
+	const terrain_build_t* build;
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+	cpArray* outlines; //of cpPolyline
+	cpArray* hulls;
+} terrain_tile_t;
+
+// The pixels a march samples, closed off by empty samples all around.
+typedef struct terrain_region_t
+{
+	const terrain_info_t* info;
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+} terrain_region_t;
+
+typedef struct terrain_t
+{
+	heap_t* heap;
+	terrain_file_header_t* data; //the file, read or built
+	size_t size;
+	const uint32_t* outline_starts;
+	const uint32_t* hull_starts;
+	const float* vertices;
+	bool cached;
+	fs_work_t* write; //saving a build to the cache, finished by destroy
+} terrain_t;
+
+static uint64_t hash_info(const terrain_info_t* info, const terrain_build_t* build);
+static bool read_cache(terrain_t* terrain, fs_t* fs, const char* path, uint64_t key);
+static void build_tiles(terrain_t* terrain, job_system_t* jobs, const terrain_build_t* build, uint64_t key);
+static void build_tile(void* data);
+static void build_region(terrain_tile_t* tile, int x0, int x1);
+static cpFloat sample_pixel(cpVect point, void* data);
+static size_t get_file_size(uint32_t outline_count, uint32_t hull_count, uint32_t vertex_count);
+static void set_data(terrain_t* terrain, terrain_file_header_t* data, size_t size);
+
+terrain_t* terrain_create(heap_t* heap, fs_t* fs, job_system_t* jobs, const terrain_info_t* info)
+{
+	if (!info->pixels || info->width <= 0 || info->height <= 0)
+	{
+		debug_print(k_print_error, "Terrain not built: its bitmap is empty\n");
+		return NULL;
+	}
+	TRACE_ZONE_BEGIN(k_trace_category_physics, "Build Terrain");
+
+	//tolerances are taken in meters and used in pixels, which the outlines are traced in
+	float cell_size = info->cell_size > 0.0f ? info->cell_size : 1.0f;
+	terrain_build_t build =
+	{
+		.info = info,
+		.cell_size = cell_size,
+		.threshold = info->threshold > 0.0f ? info->threshold : 0.5f,
+		.tolerance = info->tolerance > 0.0f ? info->tolerance / cell_size : 0.5f,
+	};
+	uint64_t key = hash_info(info, &build);
+
+	terrain_t* terrain = heap_alloc(heap, sizeof(terrain_t), 8);
+	memset(terrain, 0, sizeof(*terrain));
+	terrain->heap = heap;
+
+	char path[k_terrain_max_path] = { 0 };
+	if (fs && info->cache_dir)
+	{
+		snprintf(path, sizeof(path), "%s/%016llx.terrain", info->cache_dir, (unsigned long long)key);
+		terrain->cached = read_cache(terrain, fs, path, key);
+	}
+	if (!terrain->cached)
+	{
+		build_tiles(terrain, jobs, &build, key);
+		if (path[0])
+		{
+			terrain->write = fs_write(fs, path, terrain->data, terrain->size, true);
+		}
+	}
+
+	TRACE_ZONE_END(k_trace_category_physics);
+	return terrain;
+}
+
+void terrain_destroy(terrain_t* terrain)
+{
+	if (terrain->write)
+	{
+		fs_work_wait(terrain->write);
+		if (fs_work_get_result(terrain->write))
+		{
+			debug_print(k_print_warning, "Terrain could not be cached: %d\n", fs_work_get_result(terrain->write));
+		}
+		fs_work_destroy(terrain->write);
+	}
+	heap_free(terrain->heap, terrain->data);
+	heap_free(terrain->heap, terrain);
+}
+
+bool terrain_is_cached(terrain_t* terrain)
+{
+	return terrain->cached;
+}
+
+int terrain_get_outline_count(terrain_t* terrain)
+{
+	return terrain->data->outline_count;
+}
+
+int terrain_get_outline(terrain_t* terrain, int outline, const float** vertices)
+{
+	*vertices = terrain->vertices + 2 * terrain->outline_starts[outline];
+	return terrain->outline_starts[outline + 1] - terrain->outline_starts[outline];
+}
+
+int terrain_get_hull_count(terrain_t* terrain)
+{
+	return terrain->data->hull_count;
+}
+
+int terrain_get_hull(terrain_t* terrain, int hull, const float** vertices)
+{
+	*vertices = terrain->vertices + 2 * terrain->hull_starts[hull];
+	return terrain->hull_starts[hull + 1] - terrain->hull_starts[hull];
+}
+
+int terrain_add_to_space(terrain_t* terrain, cpSpace* space, cpBody* body, float radius, float friction)
+{
+	int hull_count = terrain_get_hull_count(terrain);
+	int max_count = 0;
+	for (int i = 0; i < hull_count; ++i)
+	{
+		max_count = __max(max_count, (int)(terrain->hull_starts[i + 1] - terrain->hull_starts[i]));
+	}
+
+	cpVect* verts = heap_alloc(terrain->heap, sizeof(cpVect) * __max(max_count, 1), 8);
+	for (int i = 0; i < hull_count; ++i)
+	{
+		const float* vertices;
+		int count = terrain_get_hull(terrain, i, &vertices);
+		for (int v = 0; v < count; ++v)
+		{
+			verts[v] = cpv(vertices[2 * v], vertices[2 * v + 1]);
+		}
+		cpShape* shape = cpSpaceAddShape(space, cpPolyShapeNew(body, count, verts, cpTransformIdentity, radius));
+		cpShapeSetFriction(shape, friction);
+	}
+	heap_free(terrain->heap, verts);
+	return hull_count;
+}
+
+// Hash the bitmap, seeded with a hash of every setting that changes the geometry built from it.
+static uint64_t hash_info(const terrain_info_t* info, const terrain_build_t* build)
+{
+	float settings[] =
+	{
+		(float)k_terrain_file_version,
+		(float)info->width,
+		(float)info->height,
+		(float)(info->tile_size > 0 ? info->tile_size : k_terrain_default_tile_size),
+		build->cell_size,
+		info->origin_x,
+		info->origin_y,
+		build->threshold,
+		build->tolerance,
+		(float)sizeof(cpFloat),
+	};
+	uint64_t seed = XXH64(settings, sizeof(settings), 0);
+	return XXH64(info->pixels, (size_t)info->width * info->height, seed);
+}
+
+// Read a cached build into terrain, returning false if there is none or it is not of this bitmap and settings.
+static bool read_cache(terrain_t* terrain, fs_t* fs, const char* path, uint64_t key)
+{
+	fs_work_t* work = fs_read(fs, path, terrain->heap, false, true);
+	fs_work_wait(work);
+	terrain_file_header_t* data = fs_work_get_buffer(work);
+	size_t size = fs_work_get_result(work) ? 0 : fs_work_get_size(work);
+	fs_work_destroy(work);
+
+	bool valid = size >= sizeof(terrain_file_header_t) &&
+		data->magic == k_terrain_file_magic &&
+		data->version == k_terrain_file_version &&
+		data->key == key &&
+		size == get_file_size(data->outline_count, data->hull_count, data->vertex_count);
+	if (valid)
+	{
+		//the hull starts follow on from the outlines', so the whole index counts up from zero to the vertex count
+		set_data(terrain, data, size);
+		const uint32_t* starts = terrain->outline_starts;
+		uint32_t count = data->outline_count + data->hull_count + 2;
+		valid = starts[0] == 0 && starts[data->outline_count] == starts[data->outline_count + 1] && starts[count - 1] == data->vertex_count;
+		for (uint32_t i = 1; valid && i < count; ++i)
+		{
+			valid = starts[i - 1] <= starts[i];
+		}
+	}
+	if (!valid && data)
+	{
+		heap_free(terrain->heap, data);
+		terrain->data = NULL;
+	}
+	return valid;
+}
+
+// Build every tile, on jobs when there are any, then gather their outlines and hulls into the terrain in tile order.
+static void build_tiles(terrain_t* terrain, job_system_t* jobs, const terrain_build_t* build, uint64_t key)
+{
+	const terrain_info_t* info = build->info;
+	int tile_size = info->tile_size > 0 ? info->tile_size : k_terrain_default_tile_size;
+	int columns = (info->width + tile_size - 1) / tile_size;
+	int rows = (info->height + tile_size - 1) / tile_size;
+	int tile_count = columns * rows;
+
+	terrain_tile_t* tiles = heap_alloc(terrain->heap, sizeof(terrain_tile_t) * tile_count, 8);
+	for (int i = 0; i < tile_count; ++i)
+	{
+		int x0 = (i % columns) * tile_size;
+		int y0 = (i / columns) * tile_size;
+		tiles[i] = (terrain_tile_t)
+		{
+			.build = build,
+			.x0 = x0,
+			.y0 = y0,
+			.x1 = __min(x0 + tile_size, info->width),
+			.y1 = __min(y0 + tile_size, info->height),
+		};
+	}
+
+	if (jobs && tile_count > 1)
+	{
+		job_counter_t counter = { 0 };
+		for (int i = 0; i < tile_count; ++i)
+		{
+			job_run(jobs, build_tile, &tiles[i], &counter);
+		}
+		job_wait(jobs, &counter);
+	}
+	else
+	{
+		for (int i = 0; i < tile_count; ++i)
+		{
+			build_tile(&tiles[i]);
+		}
+	}
+
+	uint32_t outline_count = 0;
+	uint32_t hull_count = 0;
+	uint32_t vertex_count = 0;
+	for (int i = 0; i < tile_count; ++i)
+	{
+		outline_count += tiles[i].outlines->num;
+		hull_count += tiles[i].hulls->num;
+		for (int l = 0; l < tiles[i].outlines->num; ++l)
+		{
+			vertex_count += ((cpPolyline*)tiles[i].outlines->arr[l])->count;
+		}
+		for (int l = 0; l < tiles[i].hulls->num; ++l)
+		{
+			vertex_count += ((cpPolyline*)tiles[i].hulls->arr[l])->count - 1;
+		}
+	}
+
+	size_t size = get_file_size(outline_count, hull_count, vertex_count);
+	terrain_file_header_t* data = heap_alloc(terrain->heap, size, 8);
+	*data = (terrain_file_header_t)
+	{
+		.magic = k_terrain_file_magic,
+		.version = k_terrain_file_version,
+		.key = key,
+		.outline_count = outline_count,
+		.hull_count = hull_count,
+		.vertex_count = vertex_count,
+	};
+	set_data(terrain, data, size);
+
+	//outlines and hulls are traced in pixels, rows counting up, and stored in meters; hulls drop their repeated first vertex
+	uint32_t* starts = (uint32_t*)terrain->outline_starts;
+	float* vertices = (float*)terrain->vertices;
+	uint32_t vertex = 0;
+	for (int set = 0; set < 2; ++set)
+	{
+		for (int i = 0; i < tile_count; ++i)
+		{
+			cpArray* lines = set ? tiles[i].hulls : tiles[i].outlines;
+			for (int l = 0; l < lines->num; ++l)
+			{
+				cpPolyline* line = lines->arr[l];
+				*starts++ = vertex;
+				for (int v = 0; v < line->count - set; ++v, ++vertex)
+				{
+					cpVect p = line->verts[v];
+					vertices[2 * vertex] = info->origin_x + (float)p.x * build->cell_size;
+					vertices[2 * vertex + 1] = info->origin_y + (float)p.y * build->cell_size;
+				}
+			}
+		}
+		*starts++ = vertex;
+	}
+
+	for (int i = 0; i < tile_count; ++i)
+	{
+		for (int set = 0; set < 2; ++set)
+		{
+			cpArray* lines = set ? tiles[i].hulls : tiles[i].outlines;
+			for (int l = 0; l < lines->num; ++l)
+			{
+				cpPolylineFree(lines->arr[l]);
+			}
+			cpArrayFree(lines);
+		}
+	}
+	heap_free(terrain->heap, tiles);
+}
+
+static void build_tile(void* data)
+{
+	terrain_tile_t* tile = data;
+	tile->outlines = cpArrayNew(0);
+	tile->hulls = cpArrayNew(0);
+	build_region(tile, tile->x0, tile->x1);
+}
+
+// Trace the columns [x0, x1) of a tile and cut what they enclose into hulls.
+// Convex decomposition can't take holes, so a region enclosing one is split down a column through it, which opens the
+// hole onto the empty samples closing off each half; the halves are built alone, and split again while they hold holes.
+static void build_region(terrain_tile_t* tile, int x0, int x1)
+{
+	const terrain_build_t* build = tile->build;
+	terrain_region_t region = { .info = build->info, .x0 = x0, .y0 = tile->y0, .x1 = x1, .y1 = tile->y1 };
+
+	//a ring of samples outside the region reads empty, so every outline is closed and meets the next region's at the seam
+	cpPolylineSet traced;
+	cpPolylineSetInit(&traced);
+	cpBB bb = cpBBNew(x0 - 1, tile->y0 - 1, x1, tile->y1);
+	cpMarchHard(bb, x1 - x0 + 2, tile->y1 - tile->y0 + 2, build->threshold,
+		(cpMarchSegmentFunc)cpPolylineSetCollectSegment, &traced, sample_pixel, &region);
+
+	int split = -1;
+	for (int i = 0; i < traced.count && split < 0; ++i)
+	{
+		cpPolyline* line = traced.lines[i];
+		if (cpAreaForPoly(line->count, line->verts, 0.0f) < 0.0f)
+		{
+			cpBB hole = cpBBNew(INFINITY, INFINITY, -INFINITY, -INFINITY);
+			for (int v = 0; v < line->count; ++v)
+			{
+				hole = cpBBExpand(hole, line->verts[v]);
+			}
+			split = __max(x0 + 1, __min((int)cpfceil((hole.l + hole.r) * 0.5f), x1 - 1));
+		}
+	}
+	if (split >= 0 && x1 - x0 > 1)
+	{
+		cpPolylineSetDestroy(&traced, cpTrue);
+		build_region(tile, x0, split);
+		build_region(tile, split, x1);
+		return;
+	}
+
+	for (int i = 0; i < traced.count; ++i)
+	{
+		cpPolyline* outline = cpPolylineSimplifyCurves(traced.lines[i], build->tolerance);
+		if (outline->count < 4 || cpAreaForPoly(outline->count, outline->verts, 0.0f) <= 0.0f)
+		{
+			//too small to enclose anything once simplified
+			cpPolylineFree(outline);
+			continue;
+		}
+		cpArrayPush(tile->outlines, outline);
+
+		cpPolylineSet* hulls = cpPolylineConvexDecomposition(outline, build->tolerance);
+		for (int h = 0; h < hulls->count; ++h)
+		{
+			cpArrayPush(tile->hulls, hulls->lines[h]);
+		}
+		cpPolylineSetFree(hulls, cpFalse);
+	}
+	cpPolylineSetDestroy(&traced, cpTrue);
+}
+
+// Get the density of the pixel a march samples, or empty outside the region it marches.
+static cpFloat sample_pixel(cpVect point, void* data)
+{
+	const terrain_region_t* region = data;
+	int x = (int)cpffloor(point.x + 0.5f);
+	int y = (int)cpffloor(point.y + 0.5f);
+	if (x < region->x0 || x >= region->x1 || y < region->y0 || y >= region->y1)
+	{
+		return 0.0f;
+	}
+	const terrain_info_t* info = region->info;
+	return info->pixels[(size_t)(info->height - 1 - y) * info->width + x] * (1.0f / 255.0f);
+}
+
+static size_t get_file_size(uint32_t outline_count, uint32_t hull_count, uint32_t vertex_count)
+{
+	return sizeof(terrain_file_header_t) +
+		sizeof(uint32_t) * ((size_t)outline_count + 1 + hull_count + 1) +
+		sizeof(float) * 2 * (size_t)vertex_count;
+}
+
+// Point terrain at its file's index and vertices.
+static void set_data(terrain_t* terrain, terrain_file_header_t* data, size_t size)
+{
+	terrain->data = data;
+	terrain->size = size;
+	terrain->outline_starts = (const uint32_t*)(data + 1);
+	terrain->hull_starts = terrain->outline_starts + data->outline_count + 1;
+	terrain->vertices = (const float*)(terrain->hull_starts + data->hull_count + 1);
+}
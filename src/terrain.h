@@ -0,0 +1,69 @@
+#pragma once
+
+// Static terrain collision built from bitmaps.
+// A bitmap's densities are traced into outlines with chipmunk's marching squares, simplified, and cut into
+// convex hulls that become poly shapes. The bitmap is split into tiles built in parallel on the job system;
+// each tile is closed off at its edges, so the hulls of neighbouring tiles meet along the seam between them.
+// A build is saved to a cache directory under a hash of its bitmap and settings, so a level that loads the
+// same bitmap again reads the geometry back instead of tracing it.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct cpBody cpBody;
+typedef struct cpSpace cpSpace;
+typedef struct fs_t fs_t;
+typedef struct heap_t heap_t;
+typedef struct job_system_t job_system_t;
+
+// Handle to built terrain.
+typedef struct terrain_t terrain_t;
+
+// What terrain is built from.
+// Zero settings take their defaults, as listed.
+typedef struct terrain_info_t
+{
+	// width * height densities from empty at 0 to solid at 255, in rows from the top of the image.
+	const uint8_t* pixels;
+	int width;
+	int height;
+	// Meters between pixels, or zero for one, and where the bottom left pixel is, in meters.
+	float cell_size;
+	float origin_x;
+	float origin_y;
+	// Density the surface is traced at, as a fraction of solid, or zero for half.
+	float threshold;
+	// Pixels along each side of a tile, or zero for 64.
+	int tile_size;
+	// Furthest, in meters, that simplified outlines and convex hulls stray from the traced surface, or zero for half a cell.
+	float tolerance;
+	// Directory builds are cached in, which must exist, or NULL to always build.
+	const char* cache_dir;
+} terrain_info_t;
+
+// Build terrain from a bitmap, or read it from the cache; blocks until done.
+// Tiles are built on jobs when given any. fs is only needed with a cache directory.
+// Returns NULL if the bitmap is empty.
+terrain_t* terrain_create(heap_t* heap, fs_t* fs, job_system_t* jobs, const terrain_info_t* info);
+
+// Destroy terrain. Shapes added from it stay in their space.
+void terrain_destroy(terrain_t* terrain);
+
+// If true, the terrain was read from the cache rather than built.
+bool terrain_is_cached(terrain_t* terrain);
+
+// Get the number of closed outlines traced around the terrain's solid parts and holes, tile by tile.
+int terrain_get_outline_count(terrain_t* terrain);
+
+// Get an outline's vertices as x, y pairs in meters, returning how many; the last repeats the first.
+int terrain_get_outline(terrain_t* terrain, int outline, const float** vertices);
+
+// Get the number of convex hulls the solid parts were cut into.
+int terrain_get_hull_count(terrain_t* terrain);
+
+// Get a hull's vertices as x, y pairs in meters, counterclockwise, returning how many.
+int terrain_get_hull(terrain_t* terrain, int hull, const float** vertices);
+
+// Add a poly shape to space for every hull, attached to body, usually the space's static body.
+// Returns the number of shapes added.
+int terrain_add_to_space(terrain_t* terrain, cpSpace* space, cpBody* body, float radius, float friction);
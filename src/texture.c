@@ -0,0 +1,330 @@
+#include "texture.h"
+
+#include "debug.h"
+#include "fs.h"
+#include "gpu.h"
+#include "heap.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum
+{
+	k_texture_default_budget = 256 * 1024 * 1024,
+	k_texture_default_upload_budget = 8 * 1024 * 1024,
+	k_texture_default_baseline_size = 32,
+	k_texture_default_keep_frames = 30,
+
+	//a 32768 pixel texture's levels
+	k_texture_max_mips = 16,
+};
+
+typedef struct texture_t
+{
+	fs_work_t* map; //view of the file, valid until the texture is unloaded
+	const uint8_t* data; //NULL until the map finishes and the file checks out
+	bool failed; //the file could not be read, so the texture is never drawn
+	texture_file_header_t header;
+	gpu_texture_t* gpu_texture;
+	int first_mip; //finest level the GPU texture holds, or the mip count before it exists
+	int wanted_mip; //chosen by the last update
+	float demand; //largest size requested since the last update
+	float last_demand; //largest size requested in the last frame it was requested in
+	int last_request_frame;
+	int index; //in the streamer's textures
+} texture_t;
+
+typedef struct texture_streamer_t
+{
+	heap_t* heap;
+	fs_t* fs;
+	gpu_t* gpu;
+	size_t budget;
+	size_t upload_budget;
+	int baseline_size;
+	int keep_frames;
+
+	texture_t* textures[k_texture_streamer_max_textures];
+	texture_t* order[k_texture_streamer_max_textures]; //scratch for sorting by demand
+	int texture_count;
+	int frame_counter;
+	size_t resident_size;
+} texture_streamer_t;
+
+static void finish_map(texture_t* texture);
+static size_t get_mip_offset(const texture_t* texture, int mip);
+static size_t get_chain_size(const texture_t* texture, int mip);
+static int choose_mip(const texture_t* texture, float size);
+static float get_demand(texture_streamer_t* streamer, const texture_t* texture);
+static void set_mips(texture_streamer_t* streamer, texture_t* texture, int mip);
+static int compare_demand(const void* a, const void* b);
+
+texture_streamer_t* texture_streamer_create(heap_t* heap, fs_t* fs, gpu_t* gpu)
+{
+	texture_streamer_options_t options = { 0 };
+	return texture_streamer_create_with_options(heap, fs, gpu, &options);
+}
+
+texture_streamer_t* texture_streamer_create_with_options(heap_t* heap, fs_t* fs, gpu_t* gpu, const texture_streamer_options_t* options)
+{
+	texture_streamer_t* streamer = heap_alloc(heap, sizeof(texture_streamer_t), 8);
+	memset(streamer, 0, sizeof(*streamer));
+	streamer->heap = heap;
+	streamer->fs = fs;
+	streamer->gpu = gpu;
+	streamer->budget = options->budget ? options->budget : k_texture_default_budget;
+	streamer->upload_budget = options->upload_budget ? options->upload_budget : k_texture_default_upload_budget;
+	streamer->baseline_size = options->baseline_size ? options->baseline_size : k_texture_default_baseline_size;
+	streamer->keep_frames = options->keep_frames ? options->keep_frames : k_texture_default_keep_frames;
+	return streamer;
+}
+
+void texture_streamer_destroy(texture_streamer_t* streamer)
+{
+	while (streamer->texture_count > 0)
+	{
+		texture_unload(streamer, streamer->textures[streamer->texture_count - 1]);
+	}
+	heap_free(streamer->heap, streamer);
+}
+
+texture_t* texture_load(texture_streamer_t* streamer, const char* path)
+{
+	if (streamer->texture_count >= k_texture_streamer_max_textures)
+	{
+		debug_print(k_print_error, "Texture %s not loaded: %d textures already\n", path, streamer->texture_count);
+		return NULL;
+	}
+
+	texture_t* texture = heap_alloc(streamer->heap, sizeof(texture_t), 8);
+	memset(texture, 0, sizeof(*texture));
+	texture->map = fs_map(streamer->fs, path);
+	texture->last_request_frame = -streamer->keep_frames;
+	texture->index = streamer->texture_count;
+	streamer->textures[streamer->texture_count++] = texture;
+	return texture;
+}
+
+void texture_unload(texture_streamer_t* streamer, texture_t* texture)
+{
+	if (texture->gpu_texture)
+	{
+		streamer->resident_size -= get_chain_size(texture, texture->first_mip);
+		gpu_texture_destroy(streamer->gpu, texture->gpu_texture);
+	}
+
+	//the view can't be freed while the map is still being made
+	fs_work_cancel(texture->map);
+	fs_work_wait(texture->map);
+	fs_work_destroy(texture->map);
+
+	texture_t* last = streamer->textures[--streamer->texture_count];
+	streamer->textures[texture->index] = last;
+	last->index = texture->index;
+	heap_free(streamer->heap, texture);
+}
+
+void texture_request(texture_streamer_t* streamer, texture_t* texture, float screen_size)
+{
+	texture->demand = __max(texture->demand, screen_size);
+}
+
+void texture_streamer_update(texture_streamer_t* streamer)
+{
+	TRACE_ZONE_BEGIN(k_trace_category_render, "Stream Textures");
+	++streamer->frame_counter;
+
+	//choose each texture's level from what was asked of it
+	size_t wanted_size = 0;
+	int order_count = 0;
+	for (int i = 0; i < streamer->texture_count; ++i)
+	{
+		texture_t* texture = streamer->textures[i];
+		if (!texture->data && !texture->failed && fs_work_is_done(texture->map))
+		{
+			finish_map(texture);
+		}
+		if (texture->demand > 0.0f)
+		{
+			texture->last_demand = texture->demand;
+			texture->last_request_frame = streamer->frame_counter;
+			texture->demand = 0.0f;
+		}
+		if (!texture->data)
+		{
+			continue;
+		}
+
+		texture->wanted_mip = choose_mip(texture, get_demand(streamer, texture));
+		wanted_size += get_chain_size(texture, texture->wanted_mip);
+		streamer->order[order_count++] = texture;
+	}
+
+	//over budget, the textures covering the least of the screen lose a level each, until everything fits
+	qsort(streamer->order, order_count, sizeof(texture_t*), compare_demand);
+	bool coarsened = true;
+	while (wanted_size > streamer->budget && coarsened)
+	{
+		coarsened = false;
+		for (int i = 0; i < order_count && wanted_size > streamer->budget; ++i)
+		{
+			texture_t* texture = streamer->order[i];
+			int baseline = choose_mip(texture, (float)streamer->baseline_size);
+			if (texture->wanted_mip < baseline)
+			{
+				wanted_size -= get_chain_size(texture, texture->wanted_mip) - get_chain_size(texture, texture->wanted_mip + 1);
+				++texture->wanted_mip;
+				coarsened = true;
+			}
+		}
+	}
+
+	//dropping levels frees memory, so it goes first; then the most needed textures gain theirs
+	size_t uploaded = 0;
+	for (int i = 0; i < order_count; ++i)
+	{
+		texture_t* texture = streamer->order[i];
+		if (texture->gpu_texture && texture->wanted_mip > texture->first_mip)
+		{
+			uploaded += get_chain_size(texture, texture->wanted_mip);
+			set_mips(streamer, texture, texture->wanted_mip);
+		}
+	}
+	for (int i = order_count - 1; i >= 0 && uploaded < streamer->upload_budget; --i)
+	{
+		texture_t* texture = streamer->order[i];
+		if (texture->wanted_mip < texture->first_mip)
+		{
+			uploaded += get_chain_size(texture, texture->wanted_mip);
+			set_mips(streamer, texture, texture->wanted_mip);
+		}
+	}
+	TRACE_ZONE_END(k_trace_category_render);
+}
+
+gpu_texture_t* texture_get_gpu_texture(texture_t* texture)
+{
+	return texture->gpu_texture;
+}
+
+size_t texture_streamer_get_resident_size(texture_streamer_t* streamer)
+{
+	return streamer->resident_size;
+}
+
+// Check a texture's mapped file, leaving the texture failed if it doesn't hold the levels its header says.
+static void finish_map(texture_t* texture)
+{
+	const uint8_t* data = fs_work_get_buffer(texture->map);
+	size_t size = fs_work_get_size(texture->map);
+	if (fs_work_get_result(texture->map) || !data || size < sizeof(texture_file_header_t))
+	{
+		debug_print(k_print_error, "Texture file could not be mapped: %d\n", fs_work_get_result(texture->map));
+		texture->failed = true;
+		return;
+	}
+
+	memcpy(&texture->header, data, sizeof(texture->header));
+	if (texture->header.magic != k_texture_file_magic ||
+		texture->header.format >= k_gpu_texture_format_count ||
+		texture->header.width == 0 ||
+		texture->header.height == 0 ||
+		texture->header.mip_count < 1 ||
+		texture->header.mip_count > k_texture_max_mips ||
+		get_mip_offset(texture, texture->header.mip_count) != size)
+	{
+		debug_print(k_print_error, "Texture file is not a %ux%u texture of %u levels\n", texture->header.width, texture->header.height, texture->header.mip_count);
+		texture->failed = true;
+		return;
+	}
+	texture->data = data;
+	texture->first_mip = texture->header.mip_count;
+}
+
+// Get where a mip level starts in a texture's file.
+static size_t get_mip_offset(const texture_t* texture, int mip)
+{
+	size_t offset = sizeof(texture_file_header_t);
+	for (int i = 0; i < mip; ++i)
+	{
+		offset += gpu_texture_get_mip_size(texture->header.format, texture->header.width, texture->header.height, i);
+	}
+	return offset;
+}
+
+// Get the bytes of a texture's levels from mip to the coarsest.
+static size_t get_chain_size(const texture_t* texture, int mip)
+{
+	return get_mip_offset(texture, texture->header.mip_count) - get_mip_offset(texture, mip);
+}
+
+// Get the size a texture is needed at: what it was last asked for while that is recent, and at least its baseline.
+static float get_demand(texture_streamer_t* streamer, const texture_t* texture)
+{
+	float demand = (float)streamer->baseline_size;
+	if (streamer->frame_counter - texture->last_request_frame < streamer->keep_frames)
+	{
+		demand = __max(demand, texture->last_demand);
+	}
+	return demand;
+}
+
+// Choose the coarsest level of a texture whose widest side is still size pixels or more.
+static int choose_mip(const texture_t* texture, float size)
+{
+	int mip_count = texture->header.mip_count;
+	uint32_t widest = __max(texture->header.width, texture->header.height);
+	int mip = 0;
+	while (mip < mip_count - 1 && (float)(widest >> (mip + 1)) >= size)
+	{
+		++mip;
+	}
+	return mip;
+}
+
+// Give a texture levels mip to its coarsest, creating its GPU texture the first time.
+static void set_mips(texture_streamer_t* streamer, texture_t* texture, int mip)
+{
+	const uint8_t* data = texture->data + get_mip_offset(texture, mip);
+	size_t size = get_chain_size(texture, mip);
+	if (!texture->gpu_texture)
+	{
+		gpu_texture_info_t info =
+		{
+			.format = texture->header.format,
+			.width = texture->header.width,
+			.height = texture->header.height,
+			.mip_count = texture->header.mip_count,
+			.first_mip = mip,
+			.data = data,
+			.data_size = size,
+		};
+		texture->gpu_texture = gpu_texture_create(streamer->gpu, &info);
+		if (!texture->gpu_texture)
+		{
+			texture->failed = true;
+			texture->data = NULL;
+			return;
+		}
+	}
+	else if (!gpu_texture_set_mips(streamer->gpu, texture->gpu_texture, mip, data, size))
+	{
+		return;
+	}
+
+	if (texture->first_mip < (int)texture->header.mip_count)
+	{
+		streamer->resident_size -= get_chain_size(texture, texture->first_mip);
+	}
+	streamer->resident_size += size;
+	texture->first_mip = mip;
+}
+
+static int compare_demand(const void* a, const void* b)
+{
+	const texture_t* texture_a = *(const texture_t**)a;
+	const texture_t* texture_b = *(const texture_t**)b;
+	return (texture_a->last_demand > texture_b->last_demand) - (texture_a->last_demand < texture_b->last_demand);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+// Block-compressed textures streamed from files.
+// A texture file is a texture_file_header_t followed by its mip levels, finest first and packed one after
+// another, so the levels from any one to the coarsest are a contiguous tail of the file. Files are mapped
+// with fs_map(), from the mounted pack when they are in it, so only the levels a texture holds are read.
+// Each frame, draws request the textures they use at the size they cover on screen. Once a frame the
+// streamer gives each texture the coarsest level still as large as that, then coarsens the textures
+// covering the least of the screen until all of them fit a memory budget.
+// The streamer drives the GPU, so it is used on the thread that owns it.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct fs_t fs_t;
+typedef struct gpu_t gpu_t;
+typedef struct gpu_texture_t gpu_texture_t;
+typedef struct heap_t heap_t;
+
+// Handle to a texture streamer.
+typedef struct texture_streamer_t texture_streamer_t;
+
+// Handle to a streamed texture.
+typedef struct texture_t texture_t;
+
+enum
+{
+	// First four bytes of a texture file, "GTEX".
+	k_texture_file_magic = 0x58455447,
+
+	// Most textures a streamer can hold.
+	k_texture_streamer_max_textures = 4096,
+};
+
+typedef struct texture_file_header_t
+{
+	uint32_t magic;
+	uint32_t format; //gpu_texture_format_t
+	uint32_t width; //of mip 0, in pixels
+	uint32_t height;
+	uint32_t mip_count;
+} texture_file_header_t;
+
+// Options for creating a texture streamer.
+// Zero-initialized options give the same streamer as texture_streamer_create().
+typedef struct texture_streamer_options_t
+{
+	// Bytes of GPU memory every texture's levels fit in together, or zero for 256 MB.
+	// A texture's old image lives on for the frames in flight after it changes, over the budget.
+	size_t budget;
+	// Most bytes uploaded in one update, or zero for 8 MB, so a burst of new demand is spread over frames.
+	size_t upload_budget;
+	// Textures hold at least their levels this many pixels wide or smaller, or 32 for zero, from the first
+	// update after their file is mapped, so they can always be drawn.
+	int baseline_size;
+	// Frames a texture keeps the detail it was last requested at, or 30 for zero, before dropping to its baseline.
+	int keep_frames;
+} texture_streamer_options_t;
+
+// Create a texture streamer loading files from fs into textures created on gpu.
+texture_streamer_t* texture_streamer_create(heap_t* heap, fs_t* fs, gpu_t* gpu);
+
+// Create a texture streamer with options.
+texture_streamer_t* texture_streamer_create_with_options(heap_t* heap, fs_t* fs, gpu_t* gpu, const texture_streamer_options_t* options);
+
+// Destroy a texture streamer and every texture it holds.
+// The GPU must be idle, as for destroying meshes.
+void texture_streamer_destroy(texture_streamer_t* streamer);
+
+// Start mapping a texture file. Returns NULL if the streamer holds its most textures.
+texture_t* texture_load(texture_streamer_t* streamer, const char* path);
+
+// Destroy a texture. Frames drawing with it must have finished, as for destroying meshes.
+void texture_unload(texture_streamer_t* streamer, texture_t* texture);
+
+// Ask for a texture at the size it covers on screen this frame: the pixels its widest side spans.
+void texture_request(texture_streamer_t* streamer, texture_t* texture, float screen_size);
+
+// Take finished file maps, choose the levels each texture holds and upload the ones that changed.
+// Call once a frame.
+void texture_streamer_update(texture_streamer_t* streamer);
+
+// Get a texture's GPU texture, or NULL until its first levels are uploaded or if its file could not be read.
+// Its levels change as it streams, so bind it through gpu_frame_descriptor_create().
+gpu_texture_t* texture_get_gpu_texture(texture_t* texture);
+
+// Get the bytes of GPU memory the streamer's textures hold.
+size_t texture_streamer_get_resident_size(texture_streamer_t* streamer);
@@ -5,14 +5,48 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
+#if !defined(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+static void set_name(HANDLE h, const char* name);
+
 thread_t* thread_create(int (*function)(void*), void* data)
 {
-	HANDLE h = CreateThread(NULL, 0, function, data, CREATE_SUSPENDED, NULL);
-	if (h == INVALID_HANDLE_VALUE)
+	thread_options_t options = { 0 };
+	return thread_create_with_options(function, data, &options);
+}
+
+thread_t* thread_create_with_options(int (*function)(void*), void* data, const thread_options_t* options)
+{
+	HANDLE h = CreateThread(NULL, options->stack_size, function, data, CREATE_SUSPENDED | STACK_SIZE_PARAM_IS_A_RESERVATION, NULL);
+	if (h == NULL)
 	{
 		debug_print(k_print_warning, "Thread failed to create!\n");
 		return NULL;
 	}
+
+	if (options->name)
+	{
+		set_name(h, options->name);
+	}
+	if (options->affinity_mask && !SetThreadAffinityMask(h, (DWORD_PTR)options->affinity_mask))
+	{
+		debug_print(k_print_warning, "Thread affinity mask %llx is not valid!\n", options->affinity_mask);
+	}
+
+	static const int k_priorities[] =
+	{
+		[k_thread_priority_normal] = THREAD_PRIORITY_NORMAL,
+		[k_thread_priority_low] = THREAD_PRIORITY_BELOW_NORMAL,
+		[k_thread_priority_high] = THREAD_PRIORITY_ABOVE_NORMAL,
+		[k_thread_priority_critical] = THREAD_PRIORITY_HIGHEST,
+	};
+	if (options->priority != k_thread_priority_normal)
+	{
+		SetThreadPriority(h, k_priorities[options->priority]);
+	}
+
 	ResumeThread(h);
 	return (thread_t*)h;
 }
@@ -28,5 +62,51 @@ int thread_destroy(thread_t* thread)
 
 void thread_sleep(uint32_t ms)
 {
-	Sleep(ms);
+	thread_sleep_us(ms * 1000ULL);
+}
+
+void thread_sleep_us(uint64_t us)
+{
+	HANDLE timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if (!timer)
+	{
+		timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+	}
+
+	//negative due times are relative, in 100 nanosecond units
+	LARGE_INTEGER due;
+	due.QuadPart = -(LONGLONG)(us * 10);
+	if (timer && SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
+	{
+		WaitForSingleObject(timer, INFINITE);
+	}
+	else
+	{
+		Sleep((DWORD)((us + 999) / 1000));
+	}
+	if (timer)
+	{
+		CloseHandle(timer);
+	}
+}
+
+void thread_set_name(const char* name)
+{
+	set_name(GetCurrentThread(), name);
+}
+
+int thread_get_processor_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+static void set_name(HANDLE h, const char* name)
+{
+	wchar_t wide_name[64];
+	if (MultiByteToWideChar(CP_UTF8, 0, name, -1, wide_name, _countof(wide_name)) > 0)
+	{
+		SetThreadDescription(h, wide_name);
+	}
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
 // Threading support.
@@ -7,14 +8,50 @@
 // Handle to a thread.
 typedef struct thread_t thread_t;
 
+// Scheduling priority of a thread, relative to other threads in the process.
+typedef enum thread_priority_t
+{
+	k_thread_priority_normal,
+	k_thread_priority_low,
+	k_thread_priority_high,
+	k_thread_priority_critical,
+} thread_priority_t;
+
+// Options for creating a thread.
+// Zero-initialized options give the same thread as thread_create().
+typedef struct thread_options_t
+{
+	// Name shown in debuggers and profilers, or NULL.
+	const char* name;
+	// Stack size in bytes, or 0 for the executable's default.
+	size_t stack_size;
+	// Bit mask of logical processors the thread may run on, or 0 for any.
+	uint64_t affinity_mask;
+	thread_priority_t priority;
+} thread_options_t;
+
 // Creates a new thread.
 // Thread begins running function with data on return.
 thread_t* thread_create(int (*function)(void*), void* data);
 
+// Creates a new thread with the specified options.
+// Thread begins running function with data on return, after the options are applied.
+thread_t* thread_create_with_options(int (*function)(void*), void* data, const thread_options_t* options);
+
 // Waits for a thread to complete and destroys it.
 // Returns the thread's exit code.
 int thread_destroy(thread);
 
 // Puts the calling thread to sleep for the specified number of milliseconds.
-// Thread will sleep for *approximately* the specified time.
+// Waits on a high resolution timer, waking within about half a millisecond of the time; without them
+// (before Windows 10 1803) the wait rounds up to the system timer resolution, about 15.6 ms by default.
 void thread_sleep(uint32_t ms);
+
+// Puts the calling thread to sleep for the specified number of microseconds, as thread_sleep() does.
+void thread_sleep_us(uint64_t us);
+
+// Sets the name of the calling thread, as shown in debuggers and profilers.
+void thread_set_name(const char* name);
+
+// Gets the number of logical processors in the system.
+int thread_get_processor_count();
@@ -1,48 +1,149 @@
 #include "timer.h"
 
+#include "thread.h"
+
+#include <stdlib.h>
+
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
-static uint64_t s_ticks_start = 0;
-static double s_ns_per_tick = 1;
-static double s_us_per_tick = 0.001;
-static double s_ms_per_tick = 0.000001;
+enum
+{
+	// Milliseconds startup measures the time stamp counter's rate over.
+	k_tsc_calibration_ms = 10,
+};
+
+timer_state_t g_timer_state = { 0 };
+
+static uint64_t s_qpc_start = 0;
+
+static timer_rate_t make_rate(uint64_t units_per_second, uint64_t ticks_per_second);
+static bool has_invariant_tsc();
+static uint64_t calibrate_tsc();
+
+void timer_limiter_init(timer_limiter_t* limiter, int rate)
+{
+	limiter->period_ticks = rate > 0 ? timer_get_ticks_per_second() / rate : 0;
+	limiter->next_ticks = timer_get_ticks();
+}
+
+uint64_t timer_limiter_wait(timer_limiter_t* limiter)
+{
+	uint64_t overrun = 0;
+	if (limiter->period_ticks)
+	{
+		//a late period is not made up, so a stall does not turn into a burst of short ones
+		uint64_t now = timer_get_ticks();
+		uint64_t deadline = limiter->next_ticks + limiter->period_ticks;
+		overrun = now > deadline ? now - deadline : 0;
+		limiter->next_ticks = __max(deadline, now);
+		timer_sleep_until(limiter->next_ticks);
+	}
+	return overrun;
+}
 
 void timer_startup()
 {
-	s_ticks_start = timer_get_ticks();
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	uint64_t ticks_per_second = freq.QuadPart;
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	s_qpc_start = now.QuadPart;
 
-	uint64_t ticks_per_second = timer_get_ticks_per_second();
-	s_ns_per_tick = 1000000000.0 / ticks_per_second;
-	s_us_per_tick = 1000000.0 / ticks_per_second;
-	s_ms_per_tick = 1000.0 / ticks_per_second;
+#if TIMER_TSC
+	if (has_invariant_tsc())
+	{
+		ticks_per_second = calibrate_tsc();
+		g_timer_state.tsc_start = __rdtsc();
+		g_timer_state.use_tsc = true;
+	}
+#endif
+
+	g_timer_state.ticks_per_second = ticks_per_second;
+	g_timer_state.ns_per_tick = make_rate(1000000000, ticks_per_second);
+	g_timer_state.us_per_tick = make_rate(1000000, ticks_per_second);
+	g_timer_state.ms_per_tick = make_rate(1000, ticks_per_second);
 }
 
-uint64_t timer_ticks_to_ns(uint64_t t)
+uint64_t timer_get_qpc_ticks()
 {
-	return (uint64_t)((double)t * s_ns_per_tick);
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart - s_qpc_start;
 }
 
-uint64_t timer_ticks_to_us(uint64_t t)
+void timer_sleep_until(uint64_t ticks)
 {
-	return (uint64_t)((double)t * s_us_per_tick);
+	//the last quarter millisecond is spun, covering how late a high resolution timer wakes
+	uint64_t spin_ticks = timer_get_ticks_per_second() / 4000;
+	uint64_t now = timer_get_ticks();
+	if (ticks > now + spin_ticks)
+	{
+		thread_sleep_us(timer_ticks_to_us(ticks - now - spin_ticks));
+	}
+	while (timer_get_ticks() < ticks)
+	{
+		YieldProcessor();
+	}
 }
 
-uint32_t timer_ticks_to_ms(uint64_t t)
+static timer_rate_t make_rate(uint64_t units_per_second, uint64_t ticks_per_second)
 {
-	return (uint32_t)((double)t * s_ms_per_tick);
+	//the remainder over ticks per second, as a fraction of 2^64, is (remainder * 2^64) / ticks per second
+	timer_rate_t rate;
+	rate.whole = units_per_second / ticks_per_second;
+	uint64_t remainder = units_per_second % ticks_per_second;
+	uint64_t high = remainder;
+	uint64_t fraction = 0;
+	for (int bit = 63; bit >= 0; --bit)
+	{
+		high <<= 1;
+		if (high >= ticks_per_second)
+		{
+			high -= ticks_per_second;
+			fraction |= 1ULL << bit;
+		}
+	}
+	rate.fraction = fraction;
+	return rate;
 }
 
-uint64_t timer_get_ticks()
+static bool has_invariant_tsc()
 {
-	LARGE_INTEGER now;
-	QueryPerformanceCounter(&now);
-	return now.QuadPart - s_ticks_start;
+#if TIMER_TSC
+	int regs[4];
+	__cpuid(regs, 0x80000000);
+	if ((unsigned)regs[0] < 0x80000007)
+	{
+		return false;
+	}
+	__cpuid(regs, 0x80000007);
+	return (regs[3] & (1 << 8)) != 0;
+#else
+	return false;
+#endif
 }
 
-uint64_t timer_get_ticks_per_second()
+static uint64_t calibrate_tsc()
 {
+	//each counter read is bracketed by reads of the other, so both ends pair up within a read's time
 	LARGE_INTEGER freq;
 	QueryPerformanceFrequency(&freq);
-	return freq.QuadPart;
+
+	LARGE_INTEGER qpc_begin;
+	uint64_t tsc_begin = __rdtsc();
+	QueryPerformanceCounter(&qpc_begin);
+	tsc_begin = tsc_begin / 2 + __rdtsc() / 2;
+
+	Sleep(k_tsc_calibration_ms);
+
+	LARGE_INTEGER qpc_end;
+	uint64_t tsc_end = __rdtsc();
+	QueryPerformanceCounter(&qpc_end);
+	tsc_end = tsc_end / 2 + __rdtsc() / 2;
+
+	double seconds = (double)(qpc_end.QuadPart - qpc_begin.QuadPart) / (double)freq.QuadPart;
+	return (uint64_t)((double)(tsc_end - tsc_begin) / seconds + 0.5);
 }
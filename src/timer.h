@@ -2,22 +2,120 @@
 
 // High resolution timer support.
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+// Read ticks from the processor's time stamp counter where it runs at a constant rate across cores and
+// power states, calibrated against QueryPerformanceCounter at startup, or 0 to always read QueryPerformanceCounter.
+// The counter reads in nanoseconds where QueryPerformanceCounter takes tens; startup takes 10 ms longer to calibrate it.
+#if !defined(TIMER_TSC)
+#if defined(_M_X64) || defined(_M_IX86)
+#define TIMER_TSC 1
+#else
+#define TIMER_TSC 0
+#endif
+#endif
+
+// Conversion from ticks to a time unit in fixed point: a whole number of units per tick plus a 64 bit binary fraction of one.
+typedef struct timer_rate_t
+{
+	uint64_t whole;
+	uint64_t fraction;
+} timer_rate_t;
+
+// Tick source and rates, written once by timer_startup() and read by the inline functions below.
+typedef struct timer_state_t
+{
+	bool use_tsc;
+	uint64_t tsc_start;
+	uint64_t ticks_per_second;
+	timer_rate_t ns_per_tick;
+	timer_rate_t us_per_tick;
+	timer_rate_t ms_per_tick;
+} timer_state_t;
+
+extern timer_state_t g_timer_state;
+
 // Perform one-time initialization of the timer.
 void timer_startup();
 
-// Get the number of OS-defined ticks that have elapsed since startup.
-uint64_t timer_get_ticks();
+// Read ticks from QueryPerformanceCounter, for timer_get_ticks() when the time stamp counter isn't used.
+uint64_t timer_get_qpc_ticks();
+
+// Get the number of ticks that have elapsed since startup.
+__forceinline uint64_t timer_get_ticks()
+{
+#if TIMER_TSC
+	if (g_timer_state.use_tsc)
+	{
+		return __rdtsc() - g_timer_state.tsc_start;
+	}
+#endif
+	return timer_get_qpc_ticks();
+}
+
+// Get the tick frequency.
+__forceinline uint64_t timer_get_ticks_per_second()
+{
+	return g_timer_state.ticks_per_second;
+}
+
+// Multiply ticks by a rate, rounding down.
+__forceinline uint64_t timer_ticks_at_rate(uint64_t t, const timer_rate_t* rate)
+{
+#if defined(_M_X64) || defined(_M_ARM64)
+	uint64_t fraction = __umulh(t, rate->fraction);
+#else
+	//high half of the 128 bit product from 32 bit halves
+	uint64_t a_lo = (uint32_t)t;
+	uint64_t a_hi = t >> 32;
+	uint64_t b_lo = (uint32_t)rate->fraction;
+	uint64_t b_hi = rate->fraction >> 32;
+	uint64_t hi_lo = a_hi * b_lo;
+	uint64_t cross = ((a_lo * b_lo) >> 32) + (uint32_t)hi_lo + a_lo * b_hi;
+	uint64_t fraction = a_hi * b_hi + (hi_lo >> 32) + (cross >> 32);
+#endif
+	return t * rate->whole + fraction;
+}
+
+// Convert a number of ticks to nanoseconds.
+__forceinline uint64_t timer_ticks_to_ns(uint64_t t)
+{
+	return timer_ticks_at_rate(t, &g_timer_state.ns_per_tick);
+}
+
+// Convert a number of ticks to microseconds.
+__forceinline uint64_t timer_ticks_to_us(uint64_t t)
+{
+	return timer_ticks_at_rate(t, &g_timer_state.us_per_tick);
+}
+
+// Convert a number of ticks to milliseconds.
+__forceinline uint32_t timer_ticks_to_ms(uint64_t t)
+{
+	return (uint32_t)timer_ticks_at_rate(t, &g_timer_state.ms_per_tick);
+}
 
-// Get the OS-defined tick frequency.
-uint64_t timer_get_ticks_per_second();
+// Sleep the calling thread until the tick count reaches ticks.
+// Waits on a high resolution timer, then spins out the last fraction of a millisecond,
+// so it wakes within microseconds of the deadline instead of a scheduler quantum later.
+void timer_sleep_until(uint64_t ticks);
 
-// Convert a number of OS-defined ticks to nanoseconds.
-uint64_t timer_ticks_to_ns(uint64_t t);
+// Paces a loop to a fixed rate.
+typedef struct timer_limiter_t
+{
+	uint64_t period_ticks; //0 to not pace at all
+	uint64_t next_ticks; //when the current period ends
+} timer_limiter_t;
 
-// Convert a number of OS-defined ticks to microseconds.
-uint64_t timer_ticks_to_us(uint64_t t);
+// Start pacing a loop at rate periods per second, starting now, or not at all if rate is 0.
+void timer_limiter_init(timer_limiter_t* limiter, int rate);
 
-// Convert a number of OS-defined ticks to milliseconds.
-uint32_t timer_ticks_to_ms(uint64_t t);
+// Sleep until the current period ends, with timer_sleep_until(), and start the next.
+// Call once per loop iteration; an iteration longer than a period starts the next one at once.
+// Returns how many ticks the iteration ran past the end of its period, or 0 if it finished in time.
+uint64_t timer_limiter_wait(timer_limiter_t* limiter);
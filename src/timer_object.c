@@ -1,47 +1,77 @@
 #include "timer_object.h"
 
+#include "debug.h"
 #include "timer.h"
 
 #include <stdbool.h>
+#include <string.h>
 
 typedef struct timer_object_t
 {
-	heap_t* heap;
+	heap_t* heap; //NULL when owned by a manager
 	uint64_t current_ticks;
 	uint64_t delta_ticks;
 	timer_object_t* parent;
 	uint64_t bias_ticks;
 	double scale;
 	bool paused;
+	timer_manager_t* manager;
 } timer_object_t;
 
+typedef struct timer_manager_t
+{
+	heap_t* heap;
+	timer_object_t* timers;
+	int max_timers;
+
+	//indices of live timers, parents before children
+	int* order;
+	int order_count;
+
+	//indices of unused timers
+	int* free;
+	int free_count;
+} timer_manager_t;
+
+static void timer_object_init(timer_object_t* t, heap_t* heap, timer_object_t* parent, timer_manager_t* manager);
+static void timer_object_advance(timer_object_t* t, uint64_t parent_ticks);
+static void timer_manager_destroy_timer(timer_manager_t* manager, timer_object_t* t);
+
 timer_object_t* timer_object_create(heap_t* heap, timer_object_t* parent)
 {
 	timer_object_t* t = heap_alloc(heap, sizeof(timer_object_t), 8);
-	t->heap = heap;
-	t->current_ticks = 0;
-	t->delta_ticks = 0;
-	t->parent = parent;
-	t->bias_ticks = parent ? parent->current_ticks : timer_get_ticks();
-	t->scale = 1.0;
-	t->paused = false;
+	timer_object_init(t, heap, parent, NULL);
 	return t;
 }
 
 void timer_object_destroy(timer_object_t* t)
 {
-	heap_free(t->heap, t);
+	if (t->manager)
+	{
+		timer_manager_destroy_timer(t->manager, t);
+	}
+	else
+	{
+		heap_free(t->heap, t);
+	}
 }
 
 void timer_object_update(timer_object_t* t)
 {
 	if (!t->paused)
 	{
-		uint64_t parent_ticks = t->parent ? t->parent->current_ticks : timer_get_ticks();
-		t->delta_ticks = (uint64_t)((parent_ticks - t->bias_ticks) * t->scale);
+		timer_object_advance(t, t->parent ? t->parent->current_ticks : timer_get_ticks());
+	}
+}
+
+void timer_object_step(timer_object_t* t, uint64_t delta_us)
+{
+	if (!t->paused)
+	{
+		t->delta_ticks = (uint64_t)(delta_us * timer_get_ticks_per_second() / 1000000 * t->scale);
 		t->current_ticks += t->delta_ticks;
-		t->bias_ticks = parent_ticks;
 	}
+	t->bias_ticks = t->parent ? t->parent->current_ticks : timer_get_ticks();
 }
 
 uint64_t timer_object_get_us(timer_object_t* t)
@@ -82,3 +112,103 @@ void timer_object_resume(timer_object_t* t)
 		t->paused = false;
 	}
 }
+
+timer_manager_t* timer_manager_create(heap_t* heap, int max_timers)
+{
+	timer_manager_t* manager = heap_alloc(heap, sizeof(timer_manager_t), 8);
+	manager->heap = heap;
+	manager->timers = heap_alloc(heap, sizeof(timer_object_t) * max_timers, 8);
+	manager->max_timers = max_timers;
+	manager->order = heap_alloc(heap, sizeof(int) * max_timers, 8);
+	manager->order_count = 0;
+	manager->free = heap_alloc(heap, sizeof(int) * max_timers, 8);
+	manager->free_count = max_timers;
+	for (int i = 0; i < max_timers; ++i)
+	{
+		//lowest indices handed out first
+		manager->free[i] = max_timers - i - 1;
+	}
+	return manager;
+}
+
+void timer_manager_destroy(timer_manager_t* manager)
+{
+	heap_free(manager->heap, manager->free);
+	heap_free(manager->heap, manager->order);
+	heap_free(manager->heap, manager->timers);
+	heap_free(manager->heap, manager);
+}
+
+timer_object_t* timer_manager_create_timer(timer_manager_t* manager, timer_object_t* parent)
+{
+	if (!manager->free_count)
+	{
+		debug_print(k_print_warning, "Timer manager is full; %d timers in use.\n", manager->max_timers);
+		return NULL;
+	}
+
+	//a new timer can only be the child of an existing one, so appending keeps parents first
+	int index = manager->free[--manager->free_count];
+	manager->order[manager->order_count++] = index;
+
+	timer_object_t* t = &manager->timers[index];
+	timer_object_init(t, NULL, parent, manager);
+	return t;
+}
+
+void timer_manager_update(timer_manager_t* manager)
+{
+	uint64_t now = timer_get_ticks();
+	for (int i = 0; i < manager->order_count; ++i)
+	{
+		timer_object_t* t = &manager->timers[manager->order[i]];
+		if (!t->paused)
+		{
+			timer_object_advance(t, t->parent ? t->parent->current_ticks : now);
+		}
+	}
+}
+
+static void timer_object_init(timer_object_t* t, heap_t* heap, timer_object_t* parent, timer_manager_t* manager)
+{
+	t->heap = heap;
+	t->current_ticks = 0;
+	t->delta_ticks = 0;
+	t->parent = parent;
+	t->bias_ticks = parent ? parent->current_ticks : timer_get_ticks();
+	t->scale = 1.0;
+	t->paused = false;
+	t->manager = manager;
+}
+
+static void timer_object_advance(timer_object_t* t, uint64_t parent_ticks)
+{
+	t->delta_ticks = (uint64_t)((parent_ticks - t->bias_ticks) * t->scale);
+	t->current_ticks += t->delta_ticks;
+	t->bias_ticks = parent_ticks;
+}
+
+static void timer_manager_destroy_timer(timer_manager_t* manager, timer_object_t* t)
+{
+	int index = (int)(t - manager->timers);
+	int position = 0;
+	while (manager->order[position] != index)
+	{
+		++position;
+	}
+
+	//children come after their parent, so only the rest of the order needs reparenting
+	for (int i = position + 1; i < manager->order_count; ++i)
+	{
+		timer_object_t* child = &manager->timers[manager->order[i]];
+		if (child->parent == t)
+		{
+			child->parent = t->parent;
+			child->bias_ticks = t->parent ? t->parent->current_ticks : timer_get_ticks();
+		}
+	}
+
+	memmove(&manager->order[position], &manager->order[position + 1], sizeof(int) * (manager->order_count - position - 1));
+	--manager->order_count;
+	manager->free[manager->free_count++] = index;
+}
@@ -4,6 +4,7 @@
 // Supports pause/resume of time.
 // Supports scaling time (slowing, speeding up).
 // Supports parent-child relationship of time where child inherits parents base time.
+// Many timers can be kept by a timer manager, which updates them all from one tick sample.
 
 #include "heap.h"
 
@@ -12,17 +13,26 @@
 // Handle to a time object.
 typedef struct timer_object_t timer_object_t;
 
+// Handle to a timer manager.
+typedef struct timer_manager_t timer_manager_t;
+
 // Create a new time object with the defined parent.
 // If parent is NULL, use system timer as base time.
 timer_object_t* timer_object_create(heap_t* heap, timer_object_t* parent);
 
-// Destroy previously created time object.
+// Destroy previously created time object, including one created by a timer manager.
+// Children of a managed timer are reparented to its parent.
 void timer_object_destroy(timer_object_t* t);
 
 // Per-frame update for time object.
 // Updates current time and delta time.
+// Reads the parent's current time, so parents must be updated first; timer_manager_update() handles this.
 void timer_object_update(timer_object_t* t);
 
+// Advance a time object by a fixed delta in microseconds, scaled as usual, instead of reading its base time.
+// For replaying recorded frames on a fixed clock; a later timer_object_update() measures from now.
+void timer_object_step(timer_object_t* t, uint64_t delta_us);
+
 // Get current time in microseconds.
 uint64_t timer_object_get_us(timer_object_t* t);
 
@@ -45,3 +55,19 @@ void timer_object_pause(timer_object_t* t);
 
 // Resume previously paused time.
 void timer_object_resume(timer_object_t* t);
+
+// Create a timer manager with room for a fixed number of timers.
+// Timers are stored together, parents before children, so an update is one pass over them.
+timer_manager_t* timer_manager_create(heap_t* heap, int max_timers);
+
+// Destroy a timer manager and every timer it holds.
+void timer_manager_destroy(timer_manager_t* manager);
+
+// Create a new time object in the manager with the defined parent, which must belong to the same manager.
+// If parent is NULL, use system timer as base time.
+// Returns NULL if the manager is full.
+timer_object_t* timer_manager_create_timer(timer_manager_t* manager, timer_object_t* parent);
+
+// Per-frame update for every timer in the manager.
+// Reads the system timer once, so all timers advance from the same sample.
+void timer_manager_update(timer_manager_t* manager);
@@ -1,256 +1,832 @@
 #include "trace.h"
+#include "atomic.h"
 #include "heap.h"
 #include "fs.h"
-#include "queue.h"
 #include "timer.h"
 #include "debug.h"
-#include "mutex.h"
-
+#include "lock.h"
+#include "queue.h"
+#include "semaphore.h"
+#include "thread.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <intrin.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-//event type holds the information needed to print into the json file
-typedef struct event_t
+enum
 {
-	char* name;
-	int event_type; //0 = begin, 1 = end
-	int pid;
-	int tid;
-	int ts;
+	k_trace_max_depth = 64, //durations a thread can have open at once
+	k_trace_block_events = 1024, //events a thread records before handing its block to the writer
+	k_trace_min_blocks = 4,
+
+	// Thread id of the GPU track; Windows thread ids are multiples of four, so it never clashes.
+	k_trace_gpu_tid = 1,
+};
+
+// Captures are written in a compact binary format, converted to Chrome JSON offline by
+// trace_convert_to_json(). After the header the file is a sequence of records, each a tag
+// byte followed by LEB128 varints:
+//   string: id, length, then the name's bytes; defines a name the first time it is used
+//   block: thread id, event count, ticks of the first event, then per event
+//     (name id << 3 | event type), the tick delta from the previous event, and for
+//     counters the zigzag encoded value, for flows the flow id or for memory events
+//     the zigzag encoded bytes and the call site
+enum
+{
+	k_trace_file_magic = 0x43525447, //"GTRC"
+	k_trace_file_version = 3,
+
+	k_trace_record_string = 1,
+	k_trace_record_block = 2,
 
-} event_t;
+	k_trace_varint_max = 10, //bytes in the longest 64-bit varint
+	k_trace_event_max = 4 * k_trace_varint_max,
+};
 
-//node for a linked list of event names
-typedef struct event_stack_t
+typedef enum trace_event_type_t
 {
-	char* name;
-	struct event_stack_t* next;
-} event_stack_t;
+	k_trace_event_begin,
+	k_trace_event_end,
+	k_trace_event_instant,
+	k_trace_event_counter,
+	k_trace_event_flow_begin,
+	k_trace_event_flow_step,
+	k_trace_event_flow_end,
+	k_trace_event_memory,
+} trace_event_type_t;
 
-//node for a linked list of threads
-typedef struct thread_list_t
+typedef struct trace_file_header_t
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t ticks_per_second;
+	uint32_t pid;
+	uint32_t reserved;
+} trace_file_header_t;
+
+//maps a name pointer to the id it was written with; names are usually literals, so the pointer is the key
+typedef struct trace_name_t
+{
+	const char* name;
+	uint32_t id;
+} trace_name_t;
+
+//one recorded begin or end; plain data so recording is a few stores
+typedef struct trace_event_t
+{
+	const char* name;
+	uint64_t ticks;
+	uint64_t value; //counter value, flow id or bytes of a memory event
+	trace_event_type_t event_type;
+	uint32_t site; //call site of a memory event
+} trace_event_t;
+
+//a batch of events from one thread, passed to the writer thread once full
+typedef struct trace_block_t
 {
 	int tid;
-	struct thread_list_t* next;
-	struct event_stack_t* event_next;
-} thread_list_t;
+	int count;
+	trace_event_t events[k_trace_block_events];
+} trace_block_t;
+
+//per thread recording state; only its thread touches the block while recording is set
+typedef struct trace_thread_t
+{
+	int tid;
+	int recording;
+	trace_block_t* block;
+	const char* stack[k_trace_max_depth]; //names of open durations, to name their end events
+	int depth;
+	struct trace_thread_t* next;
+} trace_thread_t;
 
 typedef struct trace_t
 {
 	heap_t* heap;
 	fs_t* fs;
-	mutex_t* mutex;
-	thread_list_t* thread_list;
-	event_t** event_t_array;
-	size_t event_count;
-	size_t file_size;
-	char* file_path;
-	short tracing;
+	lock_t lock; //guards thread registration and capture start and stop
+	DWORD thread_tls;
+	trace_thread_t* threads; //every thread that has recorded an event
+	trace_thread_t* gpu_track; //GPU timings, recorded by the render thread
 
+	// Blocks cycle from free_blocks to a recording thread to full_blocks and the writer.
+	trace_block_t* blocks;
+	int block_count;
+	queue_t* free_blocks;
+	queue_t* full_blocks;
+	thread_t* writer;
+	light_semaphore_t stopped; //released by the writer once a capture's file is closed
+
+	// Only touched by the writer once a capture starts.
+	fs_stream_t* stream;
+	trace_name_t* names;
+	uint32_t name_capacity; //power of two
+	uint32_t name_count;
+	char* encode_buffer; //one encoded block
+	int dropped; //events lost because no free block was left
+	int64_t next_flow;
+	int tracing;
 } trace_t;
 
+// Pushed on full_blocks in place of a block to close the capture, or to exit the writer.
+#define k_trace_stop_marker ((trace_block_t*)1)
+
+// Stands in for a thread's state in its TLS slot while the state is allocated.
+#define k_trace_thread_registering ((trace_thread_t*)1)
+
+//whole binary capture gathered in memory for conversion
+typedef struct trace_input_t
+{
+	heap_t* heap;
+	char* data;
+	size_t size;
+	size_t capacity;
+} trace_input_t;
+
+//where a name's bytes sit in the binary capture
+typedef struct trace_input_name_t
+{
+	size_t offset;
+	size_t length;
+} trace_input_name_t;
+
+static int writer_thread_func(void* user);
+static void gather_input(void* user, const void* data, size_t size, int result);
+static int convert_input(fs_t* fs, trace_input_t* input, const char* json_path);
+static trace_thread_t* get_trace_thread(trace_t* trace);
+static void record_event(trace_t* trace, const char* name, trace_event_type_t event_type, uint64_t value);
+static void record_on_track(trace_t* trace, trace_thread_t* thread, const char* name, trace_event_type_t event_type, uint64_t value, uint32_t site, uint64_t ticks);
+static void update_zone_categories();
+
+// Trace used by engine instrumentation, or NULL.
+static trace_t* s_default_trace = NULL;
+
+// Categories enabled by trace_set_categories(), which zones record while the default trace is capturing.
+static int s_trace_categories = k_trace_category_all;
+int g_trace_zone_categories = 0;
+
 trace_t* trace_create(heap_t* heap, int event_capacity)
 {
 	trace_t* trace = heap_alloc(heap, sizeof(trace_t), 8);
+	memset(trace, 0, sizeof(*trace));
 	trace->heap = heap;
-	trace->fs = fs_create(heap, 1);
-	trace->mutex = mutex_create();
+	trace->fs = fs_create(heap, 4, NULL);
+	lock_init_named(&trace->lock, "trace");
+	trace->thread_tls = TlsAlloc();
 
-	trace->thread_list = heap_alloc(heap, sizeof(thread_list_t), 8);
-	trace->thread_list->tid = GetCurrentThreadId();
+	//event capacity bounds memory; the writer recycles blocks, so captures can run for any length
+	trace->block_count = __max(event_capacity / k_trace_block_events, k_trace_min_blocks);
+	trace->blocks = heap_alloc(heap, sizeof(trace_block_t) * trace->block_count, 8);
+	trace->free_blocks = queue_create(heap, trace->block_count);
+	trace->full_blocks = queue_create(heap, trace->block_count + 1);
+	for (int i = 0; i < trace->block_count; ++i)
+	{
+		queue_push(trace->free_blocks, &trace->blocks[i]);
+	}
+	light_semaphore_init(&trace->stopped, 0, 1);
+
+	trace->gpu_track = heap_alloc(heap, sizeof(trace_thread_t), 8);
+	memset(trace->gpu_track, 0, sizeof(*trace->gpu_track));
+	trace->gpu_track->tid = k_trace_gpu_tid;
+	trace->threads = trace->gpu_track;
+	trace->encode_buffer = heap_alloc(heap, 1 + 3 * k_trace_varint_max + k_trace_event_max * k_trace_block_events, 8);
 
-	trace->event_t_array = heap_alloc(heap, sizeof(event_t*) * event_capacity, 8);
-	trace->event_count = 0;
-	trace->tracing = 0;
+	thread_options_t writer_options = { .name = "Trace Writer", .priority = k_thread_priority_low };
+	trace->writer = thread_create_with_options(writer_thread_func, trace, &writer_options);
 	return trace;
 }
 
 void trace_destroy(trace_t* trace)
 {
-	mutex_lock(trace->mutex);
-	thread_list_t* temp = trace->thread_list;
-	while (temp)                 
+	if (atomic_load(&trace->tracing))
 	{
-		event_stack_t* event_temp = temp->event_next;
-		while (event_temp)
-		{
-			event_stack_t* next_event = event_temp->next;
-			heap_free(trace->heap, event_temp);
-			event_temp = next_event;
-		}
-		thread_list_t* next_thread = temp->next;
-		heap_free(trace->heap, temp);
-		temp = next_thread;
+		trace_capture_stop(trace);
 	}
+	queue_push(trace->full_blocks, NULL);
+	thread_destroy(trace->writer);
 
-	for (int i = 0; i <= trace->event_count; i++)
+	trace_thread_t* thread = trace->threads;
+	while (thread)
 	{
-		heap_free(trace->heap, trace->event_t_array[i]);
+		trace_thread_t* next = thread->next;
+		heap_free(trace->heap, thread);
+		thread = next;
 	}
 
-	heap_free(trace->heap, trace->event_t_array);
+	if (trace->thread_tls != TLS_OUT_OF_INDEXES)
+	{
+		TlsFree(trace->thread_tls);
+	}
+	heap_free(trace->heap, trace->encode_buffer);
+	queue_destroy(trace->full_blocks);
+	queue_destroy(trace->free_blocks);
+	heap_free(trace->heap, trace->blocks);
 	fs_destroy(trace->fs);
-	mutex_unlock(trace->mutex);
-	mutex_destroy(trace->mutex);
 	heap_free(trace->heap, trace);
 }
 
 void trace_duration_push(trace_t* trace, const char* name)
 {
+	record_event(trace, name, k_trace_event_begin, 0);
+}
+
+void trace_duration_pop(trace_t* trace)
+{
+	record_event(trace, NULL, k_trace_event_end, 0);
+}
+
+void trace_instant(trace_t* trace, const char* name)
+{
+	record_event(trace, name, k_trace_event_instant, 0);
+}
+
+void trace_counter(trace_t* trace, const char* name, int64_t value)
+{
+	record_event(trace, name, k_trace_event_counter, (uint64_t)value);
+}
+
+uint64_t trace_flow_begin(trace_t* trace, const char* name)
+{
+	if (!trace || !atomic_load(&trace->tracing))
+	{
+		return 0;
+	}
+	uint64_t id = (uint64_t)atomic_increment64(&trace->next_flow);
+	record_event(trace, name, k_trace_event_flow_begin, id);
+	return id;
+}
+
+void trace_flow_step(trace_t* trace, const char* name, uint64_t id)
+{
+	if (id)
+	{
+		record_event(trace, name, k_trace_event_flow_step, id);
+	}
+}
+
+void trace_flow_end(trace_t* trace, const char* name, uint64_t id)
+{
+	if (id)
+	{
+		record_event(trace, name, k_trace_event_flow_end, id);
+	}
+}
 
-	if (trace->tracing == 1)
+void trace_memory(trace_t* trace, const char* name, int64_t bytes, uint32_t site)
+{
+	if (!trace || !atomic_load(&trace->tracing))
 	{
-		mutex_lock(trace->mutex);
-		//create an event_t and store all of the current information
-		event_t* temp = heap_alloc(trace->heap, sizeof(event_t), 8);
-		temp->name = (char*)name;
-		temp->event_type = 0;
-		temp->pid = GetCurrentProcessId();
-		temp->tid = GetCurrentThreadId();
-		temp->ts = (int)timer_ticks_to_us(timer_get_ticks());
+		return;
+	}
 
+	trace_thread_t* thread = get_trace_thread(trace);
+	if (thread)
+	{
+		record_on_track(trace, thread, name, k_trace_event_memory, (uint64_t)bytes, site, timer_get_ticks());
+	}
+}
 
-		thread_list_t* thread_list_temp = trace->thread_list;
-		bool added = false;
-		//search for a thread matching the current tid
-		while (thread_list_temp)
+void trace_gpu_duration_push(trace_t* trace, const char* name, uint64_t ticks)
+{
+	if (trace && atomic_load(&trace->tracing))
+	{
+		record_on_track(trace, trace->gpu_track, name, k_trace_event_begin, 0, 0, ticks);
+	}
+}
+
+void trace_gpu_duration_pop(trace_t* trace, uint64_t ticks)
+{
+	if (trace && atomic_load(&trace->tracing))
+	{
+		record_on_track(trace, trace->gpu_track, NULL, k_trace_event_end, 0, 0, ticks);
+	}
+}
+
+void trace_set_default(trace_t* trace)
+{
+	s_default_trace = trace;
+	update_zone_categories();
+}
+
+trace_t* trace_get_default()
+{
+	return s_default_trace;
+}
+
+void trace_set_categories(int categories)
+{
+	atomic_store(&s_trace_categories, categories & k_trace_category_all);
+	update_zone_categories();
+}
+
+int trace_get_categories()
+{
+	return atomic_load(&s_trace_categories);
+}
+
+void trace_capture_start(trace_t* trace, const char* path)
+{
+	trace_capture_start_with_compression(trace, path, false);
+}
+
+void trace_capture_start_with_compression(trace_t* trace, const char* path, bool use_compression)
+{
+	lock_acquire(&trace->lock);
+	if (!atomic_load(&trace->tracing))
+	{
+		trace->stream = fs_stream_open_write(trace->fs, path, use_compression);
+		if (trace->stream)
+		{
+			//the dump must not hold up asset reads
+			fs_stream_set_priority(trace->stream, k_fs_priority_background);
+
+			trace_file_header_t header = { 0 };
+			header.magic = k_trace_file_magic;
+			header.version = k_trace_file_version;
+			header.ticks_per_second = timer_get_ticks_per_second();
+			header.pid = GetCurrentProcessId();
+			fs_stream_write(trace->stream, &header, sizeof(header));
+			atomic_store(&trace->dropped, 0);
+			atomic_store_seq_cst(&trace->tracing, 1);
+			update_zone_categories();
+		}
+	}
+	lock_release(&trace->lock);
+}
+
+void trace_capture_stop(trace_t* trace)
+{
+	lock_acquire(&trace->lock);
+	if (atomic_load(&trace->tracing))
+	{
+		//a thread that saw tracing set keeps recording set while it touches its block,
+		//so once each thread is seen idle its partial block can be taken
+		atomic_store_seq_cst(&trace->tracing, 0);
+		update_zone_categories();
+		for (trace_thread_t* thread = trace->threads; thread; thread = thread->next)
 		{
-			if (thread_list_temp->tid == temp->tid)
+			while (atomic_load_seq_cst(&thread->recording))
 			{
-				//create a new event stack and allocate memory for it and its name
-				event_stack_t* new_stack = heap_alloc(trace->heap, sizeof(event_stack_t), 8);
+				_mm_pause();
+			}
+			if (thread->block)
+			{
+				queue_push(trace->full_blocks, thread->block);
+				thread->block = NULL;
+			}
+			thread->depth = 0;
+		}
 
-				new_stack->name = (char*)name; 
+		queue_push(trace->full_blocks, k_trace_stop_marker);
+		light_semaphore_acquire(&trace->stopped);
 
-				new_stack->next = thread_list_temp->event_next;
-				thread_list_temp->event_next = new_stack;
+		int dropped = atomic_load(&trace->dropped);
+		if (dropped)
+		{
+			debug_print(k_print_warning, "trace: dropped %d events; the writer could not keep up.\n", dropped);
+		}
+	}
+	lock_release(&trace->lock);
+}
 
-				added = true;
-				break;
+int trace_convert_to_json(heap_t* heap, const char* binary_path, const char* json_path, bool use_compression)
+{
+	fs_t* fs = fs_create(heap, 4, NULL);
+	trace_input_t input = { heap, NULL, 0, 0 };
+	fs_stream_t* stream = fs_stream_open_read(fs, binary_path, use_compression, gather_input, &input);
+	int result = stream ? fs_stream_close(stream) : -1;
+	if (!result)
+	{
+		result = convert_input(fs, &input, json_path);
+	}
+	heap_free(heap, input.data);
+	fs_destroy(fs);
+	return result;
+}
+
+static size_t write_varint(char* dst, uint64_t value)
+{
+	size_t size = 0;
+	do
+	{
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		dst[size++] = (char)(value ? byte | 0x80 : byte);
+	} while (value);
+	return size;
+}
+
+static void names_grow(trace_t* trace)
+{
+	uint32_t old_capacity = trace->name_capacity;
+	trace_name_t* old_names = trace->names;
+	trace->name_capacity = old_capacity ? old_capacity * 2 : 256;
+	trace->names = heap_alloc(trace->heap, sizeof(trace_name_t) * trace->name_capacity, 8);
+	memset(trace->names, 0, sizeof(trace_name_t) * trace->name_capacity);
+	for (uint32_t i = 0; i < old_capacity; ++i)
+	{
+		if (old_names[i].name)
+		{
+			uint32_t slot = (uint32_t)(((uintptr_t)old_names[i].name >> 3) * 2654435761u) & (trace->name_capacity - 1);
+			while (trace->names[slot].name)
+			{
+				slot = (slot + 1) & (trace->name_capacity - 1);
 			}
-			thread_list_temp = thread_list_temp->next;
+			trace->names[slot] = old_names[i];
 		}
-		//if we did not find a thread list for the current thread, make one
-		if (!added)
-		{
-			//new thread list node with tid == to current tid
-			thread_list_t* new_list = heap_alloc(trace->heap, sizeof(thread_list_t), 8);
-			new_list->tid = temp->tid;
-			//alloc a new event stack for that thread
-			new_list->event_next = heap_alloc(trace->heap, sizeof(event_stack_t), 8);
+	}
+	heap_free(trace->heap, old_names);
+}
 
-			new_list->event_next->name = (char*)name;
+// Get the id of a name, writing its string record first if this capture has not used it yet.
+static uint32_t write_name(trace_t* trace, const char* name)
+{
+	if (!name)
+	{
+		return 0;
+	}
 
-			//put the new thread list node at the head of the thread list
-			new_list->next = trace->thread_list;
-			trace->thread_list = new_list;
+	if ((trace->name_count + 1) * 2 > trace->name_capacity)
+	{
+		names_grow(trace);
+	}
+
+	uint32_t slot = (uint32_t)(((uintptr_t)name >> 3) * 2654435761u) & (trace->name_capacity - 1);
+	while (trace->names[slot].name)
+	{
+		if (trace->names[slot].name == name)
+		{
+			return trace->names[slot].id;
 		}
-		
-		//add the event to the list of pushes and pops
-		trace->event_t_array[trace->event_count] = temp;
-		trace->event_count += 1;
-		mutex_unlock(trace->mutex);
+		slot = (slot + 1) & (trace->name_capacity - 1);
 	}
+
+	trace->names[slot].name = name;
+	trace->names[slot].id = ++trace->name_count;
+
+	char record[1 + 2 * k_trace_varint_max];
+	size_t length = strlen(name);
+	size_t size = 0;
+	record[size++] = k_trace_record_string;
+	size += write_varint(record + size, trace->names[slot].id);
+	size += write_varint(record + size, length);
+	fs_stream_write(trace->stream, record, size);
+	fs_stream_write(trace->stream, name, length);
+	return trace->names[slot].id;
 }
 
-void trace_duration_pop(trace_t* trace)
+static void write_block(trace_t* trace, trace_block_t* block)
 {
-	if (trace->tracing == 1)
+	//name records must land before the block that refers to them
+	uint32_t ids[k_trace_block_events];
+	for (int i = 0; i < block->count; ++i)
 	{
-		mutex_lock(trace->mutex);
-		thread_list_t* thread_list_temp = trace->thread_list;
-		event_t* temp = heap_alloc(trace->heap, sizeof(event_t), 8);
-		
-		//remove the event name from the stack of events
-		int thread_id = GetCurrentThreadId();
-		while (thread_list_temp)
+		ids[i] = write_name(trace, block->events[i].name);
+	}
+
+	char* dst = trace->encode_buffer;
+	size_t size = 0;
+	dst[size++] = k_trace_record_block;
+	size += write_varint(dst + size, block->tid);
+	size += write_varint(dst + size, block->count);
+	uint64_t ticks = block->count ? block->events[0].ticks : 0;
+	size += write_varint(dst + size, ticks);
+	for (int i = 0; i < block->count; ++i)
+	{
+		trace_event_t* event = &block->events[i];
+		size += write_varint(dst + size, ((uint64_t)ids[i] << 3) | event->event_type);
+		size += write_varint(dst + size, event->ticks - ticks);
+		if (event->event_type == k_trace_event_counter || event->event_type == k_trace_event_memory)
 		{
-			if (thread_list_temp->tid == thread_id)
+			int64_t value = (int64_t)event->value;
+			size += write_varint(dst + size, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+			if (event->event_type == k_trace_event_memory)
 			{
-				
-				temp->name = thread_list_temp->event_next->name;
+				size += write_varint(dst + size, event->site);
+			}
+		}
+		else if (event->event_type >= k_trace_event_flow_begin)
+		{
+			size += write_varint(dst + size, event->value);
+		}
+		ticks = event->ticks;
+	}
+	fs_stream_write(trace->stream, dst, size);
+}
+
+static int writer_thread_func(void* user)
+{
+	trace_t* trace = user;
+	while (true)
+	{
+		trace_block_t* block = queue_pop(trace->full_blocks);
+		if (block == NULL)
+		{
+			break;
+		}
 
-				event_stack_t* extra = thread_list_temp->event_next->next;
-				heap_free(trace->heap, thread_list_temp->event_next);
-				thread_list_temp->event_next = extra;
+		if (block == k_trace_stop_marker)
+		{
+			fs_stream_close(trace->stream);
+			trace->stream = NULL;
 
-				break;
-			}
-			thread_list_temp = thread_list_temp->next;
+			//names are defined again in the next capture's file
+			heap_free(trace->heap, trace->names);
+			trace->names = NULL;
+			trace->name_capacity = 0;
+			trace->name_count = 0;
+			light_semaphore_release(&trace->stopped);
+			continue;
 		}
 
-		temp->event_type = 1;
-		temp->pid = GetCurrentProcessId();
-		temp->tid = GetCurrentThreadId();
-		temp->ts = (int)timer_ticks_to_us(timer_get_ticks());
+		write_block(trace, block);
+		block->count = 0;
+		queue_push(trace->free_blocks, block);
+	}
+	return 0;
+}
+
+static trace_thread_t* get_trace_thread(trace_t* trace)
+{
+	if (trace->thread_tls == TLS_OUT_OF_INDEXES)
+	{
+		return NULL;
+	}
+
+	trace_thread_t* thread = TlsGetValue(trace->thread_tls);
+	if (thread == k_trace_thread_registering)
+	{
+		return NULL;
+	}
+	if (!thread)
+	{
+		//first event on this thread: register it once for the life of the trace
+		//marked first, so memory events the allocation records (see heap_set_tracing()) are dropped rather than recursing
+		TlsSetValue(trace->thread_tls, k_trace_thread_registering);
+		thread = heap_alloc(trace->heap, sizeof(trace_thread_t), 8);
+		memset(thread, 0, sizeof(*thread));
+		thread->tid = GetCurrentThreadId();
 
-		trace->event_t_array[trace->event_count] = temp;
-		trace->event_count += 1;
-		mutex_unlock(trace->mutex);
+		lock_acquire(&trace->lock);
+		thread->next = trace->threads;
+		trace->threads = thread;
+		lock_release(&trace->lock);
+		TlsSetValue(trace->thread_tls, thread);
 	}
+	return thread;
 }
 
-void trace_capture_start(trace_t* trace, const char* path)
+// Publish the categories zones record under, from the default trace's capture state and the enabled categories.
+static void update_zone_categories()
 {
-	trace->file_path = (char*)path;
-	trace->file_size = 0;
-	trace->tracing = 1;
+	trace_t* trace = s_default_trace;
+	int categories = trace && atomic_load(&trace->tracing) ? atomic_load(&s_trace_categories) : 0;
+	atomic_store(&g_trace_zone_categories, categories);
 }
 
-void trace_capture_stop(trace_t* trace)
+static void record_event(trace_t* trace, const char* name, trace_event_type_t event_type, uint64_t value)
+{
+	if (!trace || !atomic_load(&trace->tracing))
+	{
+		return;
+	}
+
+	trace_thread_t* thread = get_trace_thread(trace);
+	if (thread)
+	{
+		record_on_track(trace, thread, name, event_type, value, 0, timer_get_ticks());
+	}
+}
+
+// Record an event on a thread's track; only one thread may record on a track at a time.
+static void record_on_track(trace_t* trace, trace_thread_t* thread, const char* name, trace_event_type_t event_type, uint64_t value, uint32_t site, uint64_t ticks)
 {
-	mutex_lock(trace->mutex);
-	int size = 0;
-	size += snprintf(NULL, 0, "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\" : [\n");
-	event_t* temp;
-	for (int i = 0; i < trace->event_count; i++)
+	//pairs with trace_capture_stop(): either it sees us recording, or we see tracing cleared
+	atomic_store_seq_cst(&thread->recording, 1);
+	if (atomic_load_seq_cst(&trace->tracing))
 	{
-		temp = trace->event_t_array[i];
-		if (i == trace->event_count - 1)
+		if (event_type == k_trace_event_begin)
 		{
-			size += snprintf(NULL, 0, "{\t\t\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"}\n\t]\n", temp->name, temp->pid, temp->tid, temp->ts);
+			if (thread->depth < k_trace_max_depth)
+			{
+				thread->stack[thread->depth] = name;
+			}
+			thread->depth++;
+		}
+		else if (event_type == k_trace_event_end && thread->depth > 0)
+		{
+			thread->depth--;
+			name = thread->depth < k_trace_max_depth ? thread->stack[thread->depth] : NULL;
+		}
+
+		if (!thread->block)
+		{
+			thread->block = queue_try_pop(trace->free_blocks);
+			if (thread->block)
+			{
+				thread->block->tid = thread->tid;
+				thread->block->count = 0;
+			}
+		}
+
+		trace_block_t* block = thread->block;
+		if (block)
+		{
+			trace_event_t* event = &block->events[block->count++];
+			event->name = name;
+			event->ticks = ticks;
+			event->value = value;
+			event->event_type = event_type;
+			event->site = site;
+			if (block->count == k_trace_block_events)
+			{
+				queue_push(trace->full_blocks, block);
+				thread->block = NULL;
+			}
 		}
 		else
 		{
-			size += snprintf(NULL, 0, "{\t\t\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"},\n", temp->name, temp->pid, temp->tid, temp->ts);
+			atomic_increment(&trace->dropped);
 		}
 	}
-	char* file_buffer = heap_alloc(trace->heap, sizeof(char) * size, 8);
-	int index = 0;
-	index += snprintf(file_buffer, size, "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\" : [\n");
-	for (int i = 0; i < trace->event_count; i++)
+	atomic_store_release(&thread->recording, 0);
+}
+
+static void gather_input(void* user, const void* data, size_t size, int result)
+{
+	trace_input_t* input = user;
+	if (input->size + size > input->capacity)
+	{
+		size_t capacity = __max(input->capacity * 2, input->size + size);
+		input->data = heap_realloc(input->heap, input->data, capacity, 8);
+		input->capacity = capacity;
+	}
+	if (size)
+	{
+		memcpy(input->data + input->size, data, size);
+		input->size += size;
+	}
+}
+
+static bool read_varint(const trace_input_t* input, size_t* offset, uint64_t* value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64 && *offset < input->size; shift += 7)
 	{
-		temp = trace->event_t_array[i];
-		if (i == trace->event_count - 1)
+		uint8_t byte = (uint8_t)input->data[(*offset)++];
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
 		{
-			if (temp->event_type == 0)
+			return true;
+		}
+	}
+	return false;
+}
+
+static int convert_input(fs_t* fs, trace_input_t* input, const char* json_path)
+{
+	trace_file_header_t header;
+	if (input->size < sizeof(header))
+	{
+		return -1;
+	}
+	memcpy(&header, input->data, sizeof(header));
+	if (header.magic != k_trace_file_magic || header.version != k_trace_file_version || !header.ticks_per_second)
+	{
+		return -1;
+	}
+
+	fs_stream_t* stream = fs_stream_open_write(fs, json_path, false);
+	if (!stream)
+	{
+		return -1;
+	}
+
+	const char* json_header = "{\n\t\"displayTimeUnit\": \"ns\", \"traceEvents\" : [\n";
+	fs_stream_write(stream, json_header, strlen(json_header));
+
+	char line[512];
+	int length = snprintf(line, sizeof(line), "\t\t{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":\"%d\",\"args\":{\"name\":\"GPU\"}}",
+		header.pid, k_trace_gpu_tid);
+	fs_stream_write(stream, line, length);
+
+	trace_input_name_t* names = NULL;
+	size_t name_capacity = 0;
+	double us_per_tick = 1000000.0 / (double)header.ticks_per_second;
+	const char* separator = ",\n";
+	int result = 0;
+
+	size_t offset = sizeof(header);
+	while (offset < input->size && !result)
+	{
+		uint8_t tag = (uint8_t)input->data[offset++];
+		if (tag == k_trace_record_string)
+		{
+			uint64_t id = 0;
+			uint64_t length = 0;
+			if (!read_varint(input, &offset, &id) || !read_varint(input, &offset, &length) ||
+				length > input->size - offset || id == 0)
 			{
-				index += snprintf((file_buffer + index), size, "\t\t{\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"}\n\t]\n}", temp->name, temp->pid, temp->tid, temp->ts);
+				result = -1;
+				break;
 			}
-			else
+			if (id >= name_capacity)
 			{
-				index += snprintf((file_buffer + index), size, "\t\t{\"name\":\"%s\",\"ph\":\"E\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"}\n\t]\n}", temp->name, temp->pid, temp->tid, temp->ts);
+				size_t capacity = __max(name_capacity * 2, (size_t)id + 1);
+				trace_input_name_t* grown = heap_alloc(input->heap, sizeof(trace_input_name_t) * capacity, 8);
+				memset(grown, 0, sizeof(trace_input_name_t) * capacity);
+				if (names)
+				{
+					memcpy(grown, names, sizeof(trace_input_name_t) * name_capacity);
+					heap_free(input->heap, names);
+				}
+				names = grown;
+				name_capacity = capacity;
 			}
+			names[id].offset = offset;
+			names[id].length = (size_t)length;
+			offset += (size_t)length;
 		}
-		else
+		else if (tag == k_trace_record_block)
 		{
-			if (temp->event_type == 0)
+			uint64_t tid = 0;
+			uint64_t count = 0;
+			uint64_t ticks = 0;
+			if (!read_varint(input, &offset, &tid) || !read_varint(input, &offset, &count) ||
+				!read_varint(input, &offset, &ticks))
 			{
-				index += snprintf((file_buffer + index), size, "\t\t{\"name\":\"%s\",\"ph\":\"B\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"},\n", temp->name, temp->pid, temp->tid, temp->ts);
+				result = -1;
+				break;
 			}
-			else
+			for (uint64_t i = 0; i < count; ++i)
 			{
-				index += snprintf((file_buffer + index), size, "\t\t{\"name\":\"%s\",\"ph\":\"E\",\"pid\":%d,\"tid\":\"%d\",\"ts\":\"%d\"},\n", temp->name, temp->pid, temp->tid, temp->ts);
+				uint64_t name_type = 0;
+				uint64_t delta = 0;
+				if (!read_varint(input, &offset, &name_type) || !read_varint(input, &offset, &delta))
+				{
+					result = -1;
+					break;
+				}
+				ticks += delta;
+
+				trace_event_type_t type = (trace_event_type_t)(name_type & 7);
+				uint64_t value = 0;
+				uint64_t site = 0;
+				if ((type >= k_trace_event_counter && !read_varint(input, &offset, &value)) ||
+					(type == k_trace_event_memory && !read_varint(input, &offset, &site)))
+				{
+					result = -1;
+					break;
+				}
+
+				uint64_t id = name_type >> 3;
+				const trace_input_name_t* name = id && id < name_capacity ? &names[id] : NULL;
+				length = snprintf(line, sizeof(line), "%s\t\t{\"name\":\"%.*s\",\"pid\":%u,\"tid\":\"%llu\",\"ts\":%.3f,",
+					separator, name ? (int)name->length : 0, name ? input->data + name->offset : "",
+					header.pid, (unsigned long long)tid, (double)ticks * us_per_tick);
+				length = __min(length, (int)sizeof(line) - 1);
+				switch (type)
+				{
+				case k_trace_event_begin:
+				case k_trace_event_end:
+					length += snprintf(line + length, sizeof(line) - length, "\"ph\":\"%s\"}", type == k_trace_event_begin ? "B" : "E");
+					break;
+				case k_trace_event_instant:
+					length += snprintf(line + length, sizeof(line) - length, "\"ph\":\"i\",\"s\":\"t\"}");
+					break;
+				case k_trace_event_counter:
+					length += snprintf(line + length, sizeof(line) - length, "\"ph\":\"C\",\"args\":{\"value\":%lld}}",
+						(long long)((value >> 1) ^ (0 - (value & 1))));
+					break;
+				case k_trace_event_memory:
+					//sites are offsets into the executable, so they resolve against its symbols whatever address it loaded at
+					length += snprintf(line + length, sizeof(line) - length,
+						"\"ph\":\"i\",\"s\":\"t\",\"cat\":\"memory\",\"args\":{\"bytes\":%lld,\"site\":\"0x%llx\"}}",
+						(long long)((value >> 1) ^ (0 - (value & 1))), (unsigned long long)site);
+					break;
+				default:
+					//flows bind to the enclosing slice on each thread they pass through
+					length += snprintf(line + length, sizeof(line) - length, "\"ph\":\"%s\",\"cat\":\"flow\",\"id\":%llu%s}",
+						type == k_trace_event_flow_begin ? "s" : type == k_trace_event_flow_step ? "t" : "f",
+						(unsigned long long)value, type == k_trace_event_flow_end ? ",\"bp\":\"e\"" : "");
+					break;
+				}
+				fs_stream_write(stream, line, __min(length, (int)sizeof(line) - 1));
+				separator = ",\n";
 			}
 		}
+		else
+		{
+			result = -1;
+		}
 	}
-	fs_work_t* w = fs_write(trace->fs, trace->file_path, file_buffer, index, false);
-	heap_free(trace->heap, file_buffer);
-	fs_work_wait(w);
-	fs_work_destroy(w);
-	trace->tracing = 0;
-	mutex_unlock(trace->mutex);
-}
\ No newline at end of file
+
+	fs_stream_write(stream, "\n\t]\n}", 5);
+	int close_result = fs_stream_close(stream);
+	heap_free(input->heap, names);
+	return result ? result : close_result;
+}
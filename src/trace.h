@@ -1,11 +1,63 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef struct heap_t heap_t;
 
+// Subsystems engine instrumentation zones belong to, each enabled or not at runtime by trace_set_categories().
+typedef enum trace_category_t
+{
+	k_trace_category_general = 1 << 0, //startup, game updates and anything not below
+	k_trace_category_render = 1 << 1,
+	k_trace_category_physics = 1 << 2,
+	k_trace_category_net = 1 << 3,
+	k_trace_category_fs = 1 << 4,
+	k_trace_category_ecs = 1 << 5,
+	k_trace_category_alloc = 1 << 6,
+	k_trace_category_all = (1 << 7) - 1,
+} trace_category_t;
+
+// Engine instrumentation zones, recorded to the default trace under a category.
+// A zone costs one load of the enabled categories unless its category is enabled and the default trace
+// is capturing. A zone must end with the category it began with.
+// Build with TRACE_ZONES defined to 0 to compile them out, or TRACE_ZONE_CATEGORIES defined to a mask
+// of the categories to keep to compile out the rest.
+#if !defined(TRACE_ZONES)
+#define TRACE_ZONES 1
+#endif
+#if !defined(TRACE_ZONE_CATEGORIES)
+#define TRACE_ZONE_CATEGORIES k_trace_category_all
+#endif
+
+#if TRACE_ZONES
+#define TRACE_ZONE_BEGIN(category, name) \
+	do { if (((category) & TRACE_ZONE_CATEGORIES) && trace_zone_enabled(category)) trace_duration_push(trace_get_default(), name); } while (0)
+#define TRACE_ZONE_END(category) \
+	do { if (((category) & TRACE_ZONE_CATEGORIES) && trace_zone_enabled(category)) trace_duration_pop(trace_get_default()); } while (0)
+#else
+#define TRACE_ZONE_BEGIN(category, name) ((void)0)
+#define TRACE_ZONE_END(category) ((void)0)
+#endif
+
+// Categories zones are recorded under: those enabled while the default trace is capturing, otherwise none.
+// Written only by the trace functions below.
+extern int g_trace_zone_categories;
+
+// Whether zones of a category are recorded now.
+// A plain load; a zone that misses a change just made is recorded or skipped as before it.
+__forceinline bool trace_zone_enabled(int category)
+{
+	return (*(volatile int*)&g_trace_zone_categories & category) != 0;
+}
+
 typedef struct trace_t trace_t;
 
 // Creates a CPU performance tracing system.
-// Event capacity is the maximum number of durations that can be traced.
+// Event capacity bounds the begin and end events held in memory at once, across all threads.
+// Events are handed to a background writer in blocks as they fill, so a capture can run for
+// any length; events are only dropped if the writer falls a whole capacity behind.
+// Recording takes no locks and allocates only on a thread's first event.
 trace_t* trace_create(heap_t* heap, int event_capacity);
 
 // Destroys a CPU performance tracing system.
@@ -18,9 +70,60 @@ void trace_duration_push(trace_t* trace, const char* name);
 // End tracing the currently active duration on the current thread.
 void trace_duration_pop(trace_t* trace);
 
+// Mark a point in time on the current thread, such as a frame boundary.
+void trace_instant(trace_t* trace, const char* name);
+
+// Record the current value of a named counter track, such as a queue depth.
+void trace_counter(trace_t* trace, const char* name, int64_t value);
+
+// Start a flow linking work as it is handed between threads.
+// Returns the flow's id, or zero if nothing is being captured.
+uint64_t trace_flow_begin(trace_t* trace, const char* name);
+
+// Mark a flow passing through the current thread.
+void trace_flow_step(trace_t* trace, const char* name, uint64_t id);
+
+// End a flow on the current thread.
+void trace_flow_end(trace_t* trace, const char* name, uint64_t id);
+
+// Mark memory allocated, or freed if bytes is negative, from a named heap on the current thread.
+// The call site identifies the caller, usually as an offset into the executable; zero if unknown.
+void trace_memory(trace_t* trace, const char* name, int64_t bytes, uint32_t site);
+
+// Begin a duration on the GPU track at a time already converted to timer ticks.
+// Only the render thread may record GPU durations.
+void trace_gpu_duration_push(trace_t* trace, const char* name, uint64_t ticks);
+
+// End the innermost duration on the GPU track.
+void trace_gpu_duration_pop(trace_t* trace, uint64_t ticks);
+
+// Set the trace that engine instrumentation records to, or NULL to record nothing.
+// Every recording function accepts a NULL trace and does nothing.
+void trace_set_default(trace_t* trace);
+
+// Get the trace set with trace_set_default().
+trace_t* trace_get_default();
+
+// Set the categories of trace_category_t whose zones are recorded, all of them to begin with.
+// Zones open when their category changes may be cut short in the capture, as with zones open when it starts.
+void trace_set_categories(int categories);
+
+// Get the categories set with trace_set_categories().
+int trace_get_categories();
+
 // Start recording trace events.
-// A Chrome trace file will be written to path.
+// A compact binary trace file will be written to path while the capture runs;
+// convert it with trace_convert_to_json() to view it in Chrome.
 void trace_capture_start(trace_t* trace, const char* path);
 
+// Start recording trace events, optionally LZ4 compressing the file as it is written.
+// Read a compressed capture back with an fs read stream opened with use_compression.
+void trace_capture_start_with_compression(trace_t* trace, const char* path, bool use_compression);
+
 // Stop recording trace events.
+// Flushes every thread's remaining events and waits for the file to be closed.
 void trace_capture_stop(trace_t* trace);
+
+// Convert a binary capture to a Chrome trace file at json_path.
+// use_compression must match the capture. Returns zero on success.
+int trace_convert_to_json(heap_t* heap, const char* binary_path, const char* json_path, bool use_compression);
@@ -9,6 +9,39 @@ void transform_identity(transform_t* transform)
 
 void transform_to_matrix(const transform_t* transform, mat4f_t* output)
 {
+#if MATH_SIMD
+	//rotation rows as in mat4f_make_rotation(), from products of the quaternion with twice itself
+	__m128 q = _mm_loadu_ps(&transform->rotation.x);
+	__m128 q2 = _mm_add_ps(q, q);
+	__m128 squares = _mm_mul_ps(q, q2);
+	__m128 diagonal = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f),
+		_mm_shuffle_ps(squares, squares, _MM_SHUFFLE(3, 0, 0, 1))),
+		_mm_shuffle_ps(squares, squares, _MM_SHUFFLE(3, 1, 2, 2)));
+
+	__m128 xz_xy_yz = _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 1, 0, 0)), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 2, 1, 2)));
+	__m128 yw_zw_xw = _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(3, 3, 3, 3)), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(3, 0, 2, 1)));
+	__m128 sum = _mm_add_ps(xz_xy_yz, yw_zw_xw);
+	__m128 difference = _mm_sub_ps(xz_xy_yz, yw_zw_xw);
+
+	__m128 off0 = _mm_shuffle_ps(sum, difference, _MM_SHUFFLE(1, 0, 2, 1));
+	off0 = _mm_shuffle_ps(off0, off0, _MM_SHUFFLE(1, 3, 2, 0));
+	__m128 off1 = _mm_shuffle_ps(sum, difference, _MM_SHUFFLE(2, 2, 0, 0));
+	off1 = _mm_shuffle_ps(off1, off1, _MM_SHUFFLE(2, 0, 2, 0));
+
+	__m128 row0 = _mm_shuffle_ps(diagonal, off0, _MM_SHUFFLE(1, 0, 3, 0));
+	row0 = _mm_shuffle_ps(row0, row0, _MM_SHUFFLE(1, 3, 2, 0));
+	__m128 row1 = _mm_shuffle_ps(diagonal, off0, _MM_SHUFFLE(3, 2, 3, 1));
+	row1 = _mm_shuffle_ps(row1, row1, _MM_SHUFFLE(1, 3, 0, 2));
+	__m128 row2 = _mm_shuffle_ps(off1, diagonal, _MM_SHUFFLE(3, 2, 1, 0));
+
+	//scaling by zero in w clears whatever the shuffles left there
+	const vec3f_t* s = &transform->scale;
+	_mm_storeu_ps(output->data[0], _mm_mul_ps(row0, _mm_setr_ps(s->x, s->x, s->x, 0.0f)));
+	_mm_storeu_ps(output->data[1], _mm_mul_ps(row1, _mm_setr_ps(s->y, s->y, s->y, 0.0f)));
+	_mm_storeu_ps(output->data[2], _mm_mul_ps(row2, _mm_setr_ps(s->z, s->z, s->z, 0.0f)));
+	const vec3f_t* t = &transform->translation;
+	_mm_storeu_ps(output->data[3], _mm_setr_ps(t->x, t->y, t->z, 1.0f));
+#else
 	const quatf_t* q = &transform->rotation;
 	float r00 = 1.0f - 2.0f * (q->y * q->y + q->z * q->z);
 	float r10 = 2.0f * (q->x * q->y - q->z * q->w);
@@ -48,6 +81,85 @@ void transform_to_matrix(const transform_t* transform, mat4f_t* output)
 	output->data[3][1] = t->y;
 	output->data[3][2] = t->z;
 	output->data[3][3] = 1.0f;
+#endif
+}
+
+void transform_to_matrix_batch(const transform_t* transforms, int count, mat4f_t* outputs)
+{
+	int i = 0;
+#if MATH_SIMD
+	for (; i + 4 <= count; i += 4)
+	{
+		const transform_t* t = &transforms[i];
+
+		//quaternion components across the four transforms, a lane each
+		__m128 x = _mm_loadu_ps(&t[0].rotation.x);
+		__m128 y = _mm_loadu_ps(&t[1].rotation.x);
+		__m128 z = _mm_loadu_ps(&t[2].rotation.x);
+		__m128 w = _mm_loadu_ps(&t[3].rotation.x);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128 x2 = _mm_add_ps(x, x);
+		__m128 y2 = _mm_add_ps(y, y);
+		__m128 z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2);
+		__m128 yy = _mm_mul_ps(y, y2);
+		__m128 zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2);
+		__m128 xz = _mm_mul_ps(x, z2);
+		__m128 yz = _mm_mul_ps(y, z2);
+		__m128 xw = _mm_mul_ps(w, x2);
+		__m128 yw = _mm_mul_ps(w, y2);
+		__m128 zw = _mm_mul_ps(w, z2);
+		__m128 one = _mm_set1_ps(1.0f);
+
+		__m128 sx = _mm_setr_ps(t[0].scale.x, t[1].scale.x, t[2].scale.x, t[3].scale.x);
+		__m128 sy = _mm_setr_ps(t[0].scale.y, t[1].scale.y, t[2].scale.y, t[3].scale.y);
+		__m128 sz = _mm_setr_ps(t[0].scale.z, t[1].scale.z, t[2].scale.z, t[3].scale.z);
+
+		//each matrix row across the four transforms, transposed back to a row per transform
+		__m128 zero = _mm_setzero_ps();
+		__m128 m00 = _mm_mul_ps(sx, _mm_sub_ps(one, _mm_add_ps(yy, zz)));
+		__m128 m01 = _mm_mul_ps(sx, _mm_add_ps(xy, zw));
+		__m128 m02 = _mm_mul_ps(sx, _mm_sub_ps(xz, yw));
+		__m128 m03 = zero;
+		_MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+
+		__m128 m10 = _mm_mul_ps(sy, _mm_sub_ps(xy, zw));
+		__m128 m11 = _mm_mul_ps(sy, _mm_sub_ps(one, _mm_add_ps(xx, zz)));
+		__m128 m12 = _mm_mul_ps(sy, _mm_add_ps(yz, xw));
+		__m128 m13 = zero;
+		_MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+
+		__m128 m20 = _mm_mul_ps(sz, _mm_add_ps(xz, yw));
+		__m128 m21 = _mm_mul_ps(sz, _mm_sub_ps(yz, xw));
+		__m128 m22 = _mm_mul_ps(sz, _mm_sub_ps(one, _mm_add_ps(xx, yy)));
+		__m128 m23 = zero;
+		_MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+
+		mat4f_t* m = &outputs[i];
+		_mm_storeu_ps(m[0].data[0], m00);
+		_mm_storeu_ps(m[0].data[1], m10);
+		_mm_storeu_ps(m[0].data[2], m20);
+		_mm_storeu_ps(m[0].data[3], _mm_setr_ps(t[0].translation.x, t[0].translation.y, t[0].translation.z, 1.0f));
+		_mm_storeu_ps(m[1].data[0], m01);
+		_mm_storeu_ps(m[1].data[1], m11);
+		_mm_storeu_ps(m[1].data[2], m21);
+		_mm_storeu_ps(m[1].data[3], _mm_setr_ps(t[1].translation.x, t[1].translation.y, t[1].translation.z, 1.0f));
+		_mm_storeu_ps(m[2].data[0], m02);
+		_mm_storeu_ps(m[2].data[1], m12);
+		_mm_storeu_ps(m[2].data[2], m22);
+		_mm_storeu_ps(m[2].data[3], _mm_setr_ps(t[2].translation.x, t[2].translation.y, t[2].translation.z, 1.0f));
+		_mm_storeu_ps(m[3].data[0], m03);
+		_mm_storeu_ps(m[3].data[1], m13);
+		_mm_storeu_ps(m[3].data[2], m23);
+		_mm_storeu_ps(m[3].data[3], _mm_setr_ps(t[3].translation.x, t[3].translation.y, t[3].translation.z, 1.0f));
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		transform_to_matrix(&transforms[i], &outputs[i]);
+	}
 }
 
 void transform_multiply(transform_t* result, const transform_t* t)
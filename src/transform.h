@@ -21,6 +21,10 @@ void transform_identity(transform_t* transform);
 // Convert a transform to a matrix representation.
 void transform_to_matrix(const transform_t* transform, mat4f_t* output);
 
+// Convert an array of count transforms to matrices, the same as transform_to_matrix() on each.
+// Vectorized builds convert four at a time, one per lane, so this is cheaper than converting them one by one.
+void transform_to_matrix_batch(const transform_t* transforms, int count, mat4f_t* outputs);
+
 // Combine to transforms -- result and t -- and store the output in result.
 void transform_multiply(transform_t* result, const transform_t* t);
 
@@ -1,7 +1,11 @@
 #include "wm.h"
 
+#include "atomic.h"
 #include "debug.h"
 #include "heap.h"
+#include "semaphore.h"
+#include "thread.h"
+#include "timer.h"
 
 #include <stddef.h>
 #include <stdio.h>
@@ -13,6 +17,15 @@
 
 #include "physics.h"
 
+enum
+{
+	// Input events kept between pumps; a frame of 8 kHz mouse movement at 10 fps fits.
+	// The input thread's ring holds as many.
+	k_max_events = 1024,
+
+	k_cache_line_size = 64,
+};
+
 typedef struct wm_window_t
 {
 	HWND hwnd;
@@ -23,6 +36,22 @@ typedef struct wm_window_t
 	uint32_t key_mask;
 	int mouse_x;
 	int mouse_y;
+	wm_event_t events[k_max_events];
+	int event_count;
+	int dropped_event_count;
+
+	//raw input read on a dedicated thread, through a single-producer/single-consumer ring
+	bool threaded_input;
+	thread_t* input_thread;
+	semaphore_t* input_ready;
+	HWND input_hwnd;
+	wm_event_t ring[k_max_events];
+	char pad0[k_cache_line_size];
+	int ring_tail; //written by the input thread
+	int ring_dropped_count;
+	char pad1[k_cache_line_size];
+	int ring_head; //written by the window's thread
+	char pad2[k_cache_line_size];
 } wm_window_t;
 
 const struct
@@ -38,6 +67,14 @@ k_key_map[] =
 	{ .virtual_key = VK_DOWN, .ga_key = k_key_down, },
 };
 
+static void _push_event(wm_window_t* win, uint32_t type, uint32_t code, int x, int y);
+static void _record_event(wm_window_t* win, const wm_event_t* event);
+static void _on_raw_input(wm_window_t* win, HRAWINPUT handle);
+static void _clip_cursor(wm_window_t* win);
+static bool _register_raw_input(HWND hwnd, DWORD flags);
+static int _input_thread_func(void* user);
+static LRESULT CALLBACK _input_window_proc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
+
 static LRESULT CALLBACK _window_proc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
 	wm_window_t* win = (wm_window_t*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
@@ -45,74 +82,25 @@ static LRESULT CALLBACK _window_proc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM
 	{
 		switch (uMsg)
 		{
-		case WM_KEYDOWN:
-			for (int i = 0; i < _countof(k_key_map); ++i)
-			{
-				if (k_key_map[i].virtual_key == wParam)
-				{
-					win->key_mask |= k_key_map[i].ga_key;
-					break;
-				}
-			}
-			break;
-		case WM_KEYUP:
-			for (int i = 0; i < _countof(k_key_map); ++i)
-			{
-				if (k_key_map[i].virtual_key == wParam)
-				{
-					win->key_mask &= ~k_key_map[i].ga_key;
-					break;
-				}
-			}
-			break;
-		case WM_LBUTTONDOWN:
-			win->mouse_mask |= k_mouse_button_left;
-			break;
-		case WM_LBUTTONUP:
-			win->mouse_mask &= ~k_mouse_button_left;
-			break;
-		case WM_RBUTTONDOWN:
-			win->mouse_mask |= k_mouse_button_right;
-			break;
-		case WM_RBUTTONUP:
-			win->mouse_mask &= ~k_mouse_button_right;
-			break;
-		case WM_MBUTTONDOWN:
-			win->mouse_mask |= k_mouse_button_middle;
-			break;
-		case WM_MBUTTONUP:
-			win->mouse_mask &= ~k_mouse_button_middle;
+		case WM_INPUT:
+			_on_raw_input(win, (HRAWINPUT)lParam);
 			break;
 
-		case WM_MOUSEMOVE:
-			if (win->has_focus)
+		case WM_ACTIVATEAPP:
+			ShowCursor(!wParam);
+			win->has_focus = wParam;
+			if (!win->has_focus)
 			{
-				// Relative mouse movement in four steps:
-				// 1. Get current mouse position (old_cursor).
-				// 2. Move mouse back to center of window.
-				// 3. Get current mouse position (new_cursor).
-				// 4. Compute relative movement (old_cursor - new_cursor).
-
-				POINT old_cursor;
-				GetCursorPos(&old_cursor);
-
-				RECT window_rect;
-				GetWindowRect(hwnd, &window_rect);
-				SetCursorPos(
-					(window_rect.left + window_rect.right) / 2,
-					(window_rect.top + window_rect.bottom) / 2);
-
-				POINT new_cursor;
-				GetCursorPos(&new_cursor);
-
-				win->mouse_x = old_cursor.x - new_cursor.x;
-				win->mouse_y = old_cursor.y - new_cursor.y;
+				//keys and buttons released while unfocused are never reported
+				win->key_mask = 0;
+				win->mouse_mask = 0;
 			}
+			_clip_cursor(win);
 			break;
 
-		case WM_ACTIVATEAPP:
-			ShowCursor(!wParam);
-			win->has_focus = wParam;
+		case WM_MOVE:
+		case WM_SIZE:
+			_clip_cursor(win);
 			break;
 
 		case WM_CLOSE:
@@ -125,6 +113,12 @@ static LRESULT CALLBACK _window_proc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM
 }
 
 wm_window_t* wm_create(heap_t* heap)
+{
+	wm_options_t options = { 0 };
+	return wm_create_with_options(heap, &options);
+}
+
+wm_window_t* wm_create_with_options(heap_t* heap, const wm_options_t* options)
 {
 	WNDCLASS wc =
 	{
@@ -161,11 +155,59 @@ wm_window_t* wm_create(heap_t* heap)
 	win->hwnd = hwnd;
 	win->key_mask = 0;
 	win->mouse_mask = 0;
+	win->mouse_x = 0;
+	win->mouse_y = 0;
+	win->event_count = 0;
+	win->dropped_event_count = 0;
+	win->threaded_input = false;
+	win->input_thread = NULL;
+	win->input_ready = NULL;
+	win->input_hwnd = NULL;
+	win->ring_tail = 0;
+	win->ring_dropped_count = 0;
+	win->ring_head = 0;
 	win->quit = false;
 	win->heap = heap;
 
 	SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)win);
 
+	if (options->input_thread)
+	{
+		//the thread registers for raw input itself, since input goes to the thread owning the target window
+		win->threaded_input = true;
+		win->input_ready = semaphore_create(0, 1);
+		thread_options_t thread_options =
+		{
+			.name = "Input",
+			.priority = k_thread_priority_high,
+		};
+		win->input_thread = thread_create_with_options(_input_thread_func, win, &thread_options);
+		if (win->input_thread)
+		{
+			semaphore_acquire(win->input_ready);
+		}
+		if (!win->input_hwnd)
+		{
+			debug_print(
+				k_print_warning,
+				"Failed to start input thread; reading input on the window's thread.\n");
+			if (win->input_thread)
+			{
+				thread_destroy(win->input_thread);
+				win->input_thread = NULL;
+			}
+			semaphore_destroy(win->input_ready);
+			win->input_ready = NULL;
+			win->threaded_input = false;
+		}
+	}
+	if (!win->threaded_input && !_register_raw_input(hwnd, 0))
+	{
+		debug_print(
+			k_print_warning,
+			"Failed to register raw input devices!\n");
+	}
+
 	// Windows are created hidden by default, so we
 	// need to show it here.
 	ShowWindow(hwnd, TRUE);
@@ -175,15 +217,50 @@ wm_window_t* wm_create(heap_t* heap)
 
 bool wm_pump(wm_window_t* window)
 {
+	if (window->dropped_event_count)
+	{
+		debug_print(k_print_warning, "Window dropped %d input events; too many in one frame.\n", window->dropped_event_count);
+	}
+	window->mouse_x = 0;
+	window->mouse_y = 0;
+	window->event_count = 0;
+	window->dropped_event_count = 0;
+
 	MSG msg = { 0 };
 	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
 	{
 		TranslateMessage(&msg);
 		DispatchMessage(&msg);
 	}
+	wm_latch_input(window);
 	return window->quit;
 }
 
+void wm_latch_input(wm_window_t* window)
+{
+	if (window->threaded_input)
+	{
+		int head = window->ring_head;
+		int tail = atomic_load_acquire(&window->ring_tail);
+		while (head != tail)
+		{
+			_record_event(window, &window->ring[head]);
+			head = (head + 1) % k_max_events;
+		}
+		atomic_store_release(&window->ring_head, head);
+		window->dropped_event_count += atomic_exchange(&window->ring_dropped_count, 0);
+	}
+	else
+	{
+		//only raw input, so the rest of the messages wait for the next pump
+		MSG msg = { 0 };
+		while (PeekMessage(&msg, window->hwnd, WM_INPUT, WM_INPUT, PM_REMOVE))
+		{
+			DispatchMessage(&msg);
+		}
+	}
+}
+
 uint32_t wm_get_mouse_mask(wm_window_t* window)
 {
 	return window->mouse_mask;
@@ -200,8 +277,20 @@ void wm_get_mouse_move(wm_window_t* window, int* x, int* y)
 	*y = window->mouse_y;
 }
 
+const wm_event_t* wm_get_events(wm_window_t* window, int* count)
+{
+	*count = window->event_count;
+	return window->events;
+}
+
 void wm_destroy(wm_window_t* window)
 {
+	if (window->input_thread)
+	{
+		PostMessage(window->input_hwnd, WM_CLOSE, 0, 0);
+		thread_destroy(window->input_thread);
+		semaphore_destroy(window->input_ready);
+	}
 	DestroyWindow(window->hwnd);
 	heap_free(window->heap, window);
 }
@@ -210,3 +299,225 @@ void* wm_get_raw_window(wm_window_t* window)
 {
 	return window->hwnd;
 }
+
+static void _push_event(wm_window_t* win, uint32_t type, uint32_t code, int x, int y)
+{
+	wm_event_t event =
+	{
+		.type = type,
+		.code = code,
+		.x = x,
+		.y = y,
+		.ticks = timer_get_ticks(),
+	};
+
+	if (!win->threaded_input)
+	{
+		_record_event(win, &event);
+		return;
+	}
+
+	//one slot is always left unused so head == tail means empty
+	int tail = win->ring_tail;
+	int next = (tail + 1) % k_max_events;
+	if (next == atomic_load_acquire(&win->ring_head))
+	{
+		atomic_increment(&win->ring_dropped_count);
+		return;
+	}
+	win->ring[tail] = event;
+	atomic_store_release(&win->ring_tail, next);
+}
+
+static void _record_event(wm_window_t* win, const wm_event_t* event)
+{
+	switch (event->type)
+	{
+	case k_wm_event_key_down:
+	case k_wm_event_key_up:
+		for (int i = 0; i < _countof(k_key_map); ++i)
+		{
+			if (k_key_map[i].virtual_key == (int)event->code)
+			{
+				if (event->type == k_wm_event_key_down)
+				{
+					win->key_mask |= k_key_map[i].ga_key;
+				}
+				else
+				{
+					win->key_mask &= ~k_key_map[i].ga_key;
+				}
+				break;
+			}
+		}
+		break;
+	case k_wm_event_mouse_down:
+		win->mouse_mask |= event->code;
+		break;
+	case k_wm_event_mouse_up:
+		win->mouse_mask &= ~event->code;
+		break;
+	case k_wm_event_mouse_move:
+		win->mouse_x += event->x;
+		win->mouse_y += event->y;
+		break;
+	}
+
+	if (win->event_count == k_max_events)
+	{
+		wm_event_t* last = &win->events[win->event_count - 1];
+		if (event->type == k_wm_event_mouse_move && last->type == k_wm_event_mouse_move)
+		{
+			//fold overflowing movement into the last event so the total stays right
+			last->x += event->x;
+			last->y += event->y;
+		}
+		else
+		{
+			++win->dropped_event_count;
+		}
+		return;
+	}
+	win->events[win->event_count++] = *event;
+}
+
+static void _on_raw_input(wm_window_t* win, HRAWINPUT handle)
+{
+	RAWINPUT input;
+	UINT size = sizeof(input);
+	if (GetRawInputData(handle, RID_INPUT, &input, &size, sizeof(RAWINPUTHEADER)) == (UINT)-1)
+	{
+		return;
+	}
+
+	if (input.header.dwType == RIM_TYPEKEYBOARD)
+	{
+		const RAWKEYBOARD* keyboard = &input.data.keyboard;
+		if (keyboard->VKey == 0xff)
+		{
+			//fake key sent as part of an escape sequence
+			return;
+		}
+
+		bool down = !(keyboard->Flags & RI_KEY_BREAK);
+		_push_event(win, down ? k_wm_event_key_down : k_wm_event_key_up, keyboard->VKey, 0, 0);
+	}
+	else if (input.header.dwType == RIM_TYPEMOUSE)
+	{
+		const RAWMOUSE* mouse = &input.data.mouse;
+		const struct
+		{
+			USHORT down_flag;
+			USHORT up_flag;
+			uint32_t ga_button;
+		}
+		k_button_map[] =
+		{
+			{ RI_MOUSE_LEFT_BUTTON_DOWN, RI_MOUSE_LEFT_BUTTON_UP, k_mouse_button_left, },
+			{ RI_MOUSE_RIGHT_BUTTON_DOWN, RI_MOUSE_RIGHT_BUTTON_UP, k_mouse_button_right, },
+			{ RI_MOUSE_MIDDLE_BUTTON_DOWN, RI_MOUSE_MIDDLE_BUTTON_UP, k_mouse_button_middle, },
+		};
+		for (int i = 0; i < _countof(k_button_map); ++i)
+		{
+			if (mouse->usButtonFlags & k_button_map[i].down_flag)
+			{
+				_push_event(win, k_wm_event_mouse_down, k_button_map[i].ga_button, 0, 0);
+			}
+			if (mouse->usButtonFlags & k_button_map[i].up_flag)
+			{
+				_push_event(win, k_wm_event_mouse_up, k_button_map[i].ga_button, 0, 0);
+			}
+		}
+
+		//absolute positions come from tablets and remote desktop, which have a cursor to use instead
+		if (!(mouse->usFlags & MOUSE_MOVE_ABSOLUTE) && (mouse->lLastX || mouse->lLastY))
+		{
+			_push_event(win, k_wm_event_mouse_move, 0, mouse->lLastX, mouse->lLastY);
+		}
+	}
+}
+
+static void _clip_cursor(wm_window_t* win)
+{
+	//raw movement keeps coming at the edge, so the hidden cursor only needs to stay inside the window
+	if (win->has_focus)
+	{
+		RECT window_rect;
+		GetWindowRect(win->hwnd, &window_rect);
+		ClipCursor(&window_rect);
+	}
+	else
+	{
+		ClipCursor(NULL);
+	}
+}
+
+static bool _register_raw_input(HWND hwnd, DWORD flags)
+{
+	//generic desktop mouse and keyboard
+	RAWINPUTDEVICE devices[] =
+	{
+		{ .usUsagePage = 0x01, .usUsage = 0x02, .dwFlags = flags, .hwndTarget = hwnd, },
+		{ .usUsagePage = 0x01, .usUsage = 0x06, .dwFlags = flags, .hwndTarget = hwnd, },
+	};
+	return RegisterRawInputDevices(devices, _countof(devices), sizeof(devices[0]));
+}
+
+static int _input_thread_func(void* user)
+{
+	wm_window_t* win = user;
+
+	WNDCLASS wc =
+	{
+		.lpfnWndProc = _input_window_proc,
+		.hInstance = GetModuleHandle(NULL),
+		.lpszClassName = L"ga2022 input class",
+	};
+	RegisterClass(&wc);
+
+	//message-only, never shown; inputs sink to it whichever window holds the foreground
+	HWND hwnd = CreateWindowEx(0, wc.lpszClassName, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, wc.hInstance, NULL);
+	if (hwnd)
+	{
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)win);
+		if (!_register_raw_input(hwnd, RIDEV_INPUTSINK))
+		{
+			DestroyWindow(hwnd);
+			hwnd = NULL;
+		}
+	}
+	win->input_hwnd = hwnd;
+	semaphore_release(win->input_ready);
+
+	MSG msg = { 0 };
+	while (hwnd && GetMessage(&msg, NULL, 0, 0) > 0)
+	{
+		DispatchMessage(&msg);
+	}
+	return 0;
+}
+
+static LRESULT CALLBACK _input_window_proc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	wm_window_t* win = (wm_window_t*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+	if (win)
+	{
+		switch (uMsg)
+		{
+		case WM_INPUT:
+			//the sink sees input for every window, so keep what the game window would have been sent
+			if (GetForegroundWindow() == win->hwnd)
+			{
+				_on_raw_input(win, (HRAWINPUT)lParam);
+			}
+			break;
+
+		case WM_CLOSE:
+			DestroyWindow(hwnd);
+			PostQuitMessage(0);
+			return 0;
+		}
+	}
+
+	return DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
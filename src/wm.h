@@ -6,6 +6,10 @@
 // Main object is wm_window_t to represents a single OS-level window.
 // Window should be pumped every frame.
 // After pumping a window can be queried for user input.
+// Mouse and keyboard are read as raw input, and every change between pumps is also kept as a
+// timestamped event, so fast key taps and high polling rate mouse movement are not lost.
+// Latching input just before simulation keeps the input it sees as recent as possible,
+// and reading raw input on a dedicated thread keeps it from waiting on the frame to be pumped.
 
 // Handle to a window.
 typedef struct wm_window_t wm_window_t;
@@ -29,26 +33,66 @@ enum
 	k_key_right = 1 << 3,
 };
 
+// Kinds of input event. See wm_get_events().
+enum
+{
+	k_wm_event_key_down,
+	k_wm_event_key_up,
+	k_wm_event_mouse_down,
+	k_wm_event_mouse_up,
+	k_wm_event_mouse_move,
+};
+
+// A single input event.
+typedef struct wm_event_t
+{
+	uint32_t type;
+	uint32_t code; //virtual key code for key events; k_mouse_button bit for mouse button events
+	int x; //relative movement for mouse move events
+	int y;
+	uint64_t ticks; //timer_get_ticks() when the event was received
+} wm_event_t;
+// Options for creating a window.
+// Zero-initialized options give the same window as wm_create().
+typedef struct wm_options_t
+{
+	// Read raw input on a dedicated thread into a lock-free ring as it arrives, where the
+	// window's own thread only sees it when pumping or latching. See wm_latch_input().
+	bool input_thread;
+} wm_options_t;
 
 // Creates a new window. Must be destroyed with wm_destroy().
 // Returns NULL on failure, otherwise a new window.
 wm_window_t* wm_create(heap_t* heap);
 
+// Creates a new window with the specified options. Must be destroyed with wm_destroy().
+// Returns NULL on failure, otherwise a new window.
+wm_window_t* wm_create_with_options(heap_t* heap, const wm_options_t* options);
+
 // Destroy a previously created window.
 void wm_destroy(wm_window_t* window);
 
 // Pump the messages for a window.
-// This will refresh the mouse and key state on the window.
+// This will refresh the mouse and key state on the window, and replace its input events.
 bool wm_pump(wm_window_t* window);
 
+// Collect input received since the window was last pumped or latched, appending to its events
+// and refreshing its mouse and key state. Call just before simulation reads input.
+// Must be called on the thread that pumps the window.
+void wm_latch_input(wm_window_t* window);
+
 // Get a mask of all mouse buttons current held.
 uint32_t wm_get_mouse_mask(wm_window_t* window);
 
 // Get a mask of all keyboard keys current held.
 uint32_t wm_get_key_mask(wm_window_t* window);
 
-// Get relative mouse movement in x and y.
+// Get relative mouse movement in x and y, summed over all events in the last pump.
 void wm_get_mouse_move(wm_window_t* window, int* x, int* y);
 
+// Get the input events received during the last pump and any latches since, oldest first.
+// The events stay valid until the next pump or latch.
+const wm_event_t* wm_get_events(wm_window_t* window, int* count);
+
 // Get the raw OS window object.
 void* wm_get_raw_window(wm_window_t* window);